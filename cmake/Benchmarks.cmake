@@ -0,0 +1,40 @@
+################################################################################
+# The bench target runs the benchmarks UNWIND_BENCH_REPEATS times, see RunBenchmarks.cmake, and pools their
+# timings with unwind-bench-compare into bench/bench-results.json in the build directory. With a baseline it
+# tests every timing against it and fails if one got significantly slower. To start a baseline, run the target
+# on a known good commit and keep a copy of bench-results.json.
+#
+# vor3d_bench is not part of this build, it needs the dexelization of the standalone voroffset project. Point
+# UNWIND_BENCH_VOR3D at the vor3d_bench of a build of src/utils/voroffset to include it.
+################################################################################
+
+set(UNWIND_BENCH_BASELINE "" CACHE FILEPATH "Results of an earlier bench run to compare with, none if empty")
+set(UNWIND_BENCH_REPEATS 5 CACHE STRING "Runs of every benchmark by the bench target")
+set(UNWIND_BENCH_ALPHA 0.01 CACHE STRING "Significance level of the Mann-Whitney U tests of the bench target")
+set(UNWIND_BENCH_THRESHOLD 0.05 CACHE STRING "Smallest relative change of a median the bench target reports")
+set(UNWIND_BENCH_SUITES "vor3d;utils;export;pipeline" CACHE STRING "Benchmarks the bench target runs")
+set(UNWIND_BENCH_VOR3D "" CACHE FILEPATH "vor3d_bench of a standalone voroffset build, vor3d is skipped if empty")
+
+# Lists cannot be passed through the command line of the target, the script splits them on commas again
+string(REPLACE ";" "," UNWIND_BENCH_SUITES_ARG "${UNWIND_BENCH_SUITES}")
+
+add_custom_target(bench
+  COMMAND ${CMAKE_COMMAND}
+    -DBENCH_DIR=${CMAKE_BINARY_DIR}/bench
+    -DSOURCE_DIR=${PROJECT_SOURCE_DIR}
+    -DSUITES=${UNWIND_BENCH_SUITES_ARG}
+    -DREPEATS=${UNWIND_BENCH_REPEATS}
+    -DVOR3D_BENCH=${UNWIND_BENCH_VOR3D}
+    -DUTILS_BENCH=$<TARGET_FILE:unwind-utils-bench>
+    -DEXPORT_BENCH=$<TARGET_FILE:unwind-export-bench>
+    -DPIPELINE_BENCH=$<TARGET_FILE:unwind-pipeline-bench>
+    -DCOMPARE=$<TARGET_FILE:unwind-bench-compare>
+    -DBASELINE=${UNWIND_BENCH_BASELINE}
+    -DALPHA=${UNWIND_BENCH_ALPHA}
+    -DTHRESHOLD=${UNWIND_BENCH_THRESHOLD}
+    -P ${CMAKE_CURRENT_LIST_DIR}/RunBenchmarks.cmake
+  WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+  USES_TERMINAL
+  VERBATIM
+)
+add_dependencies(bench unwind-utils-bench unwind-export-bench unwind-pipeline-bench unwind-bench-compare)
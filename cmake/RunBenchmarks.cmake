@@ -0,0 +1,95 @@
+################################################################################
+# Script of the bench target, see Benchmarks.cmake. Runs every benchmark of SUITES REPEATS times into BENCH_DIR
+# and compares the results with BASELINE, if given, with unwind-bench-compare.
+################################################################################
+
+string(REPLACE "," ";" SUITES "${SUITES}")
+file(REMOVE_RECURSE "${BENCH_DIR}")
+file(MAKE_DIRECTORY "${BENCH_DIR}")
+
+# The commit the results are labelled with
+execute_process(
+  COMMAND git rev-parse --short HEAD
+  WORKING_DIRECTORY "${SOURCE_DIR}"
+  OUTPUT_VARIABLE LABEL
+  OUTPUT_STRIP_TRAILING_WHITESPACE
+  ERROR_QUIET
+)
+if(NOT LABEL)
+  set(LABEL "unknown")
+endif()
+
+function(run_benchmark name)
+  message(STATUS "Running ${name}")
+  execute_process(COMMAND ${ARGN} WORKING_DIRECTORY "${BENCH_DIR}" RESULT_VARIABLE status)
+  if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${name} failed: ${status}")
+  endif()
+endfunction()
+
+function(suite_enabled suite result)
+  list(FIND SUITES ${suite} index)
+  if(index EQUAL -1)
+    set(${result} FALSE PARENT_SCOPE)
+  else()
+    set(${result} TRUE PARENT_SCOPE)
+  endif()
+endfunction()
+
+suite_enabled(vor3d run_vor3d)
+if(run_vor3d AND NOT VOR3D_BENCH)
+  message(STATUS "Skipping vor3d, UNWIND_BENCH_VOR3D is not set")
+  set(run_vor3d FALSE)
+endif()
+suite_enabled(utils run_utils)
+suite_enabled(export run_export)
+suite_enabled(pipeline run_pipeline)
+
+# Every run is one sample of the timings it reports, the runs of the benchmarks are interleaved so that a
+# slow phase of the machine does not land on a single benchmark
+set(results)
+foreach(i RANGE 1 ${REPEATS})
+  if(run_vor3d)
+    # A single repetition per run, vor3d_bench would keep the best one
+    run_benchmark("vor3d_bench (${i}/${REPEATS})" "${VOR3D_BENCH}"
+      -s num_dexels -n 256 512 -m ours -k 1 -j "${BENCH_DIR}/vor3d-${i}.json")
+    list(APPEND results "${BENCH_DIR}/vor3d-${i}.json")
+  endif()
+  if(run_utils)
+    run_benchmark("unwind-utils-bench (${i}/${REPEATS})" "${UTILS_BENCH}"
+      --label ${LABEL} --output "${BENCH_DIR}/utils-${i}.json")
+    list(APPEND results "${BENCH_DIR}/utils-${i}.json")
+  endif()
+  if(run_export)
+    # Without the disk, which is the noisiest part of an export
+    run_benchmark("unwind-export-bench (${i}/${REPEATS})" "${EXPORT_BENCH}"
+      --output /dev/null --label ${LABEL} --results "${BENCH_DIR}/export-${i}.json")
+    list(APPEND results "${BENCH_DIR}/export-${i}.json")
+  endif()
+  if(run_pipeline)
+    run_benchmark("unwind-pipeline-bench (${i}/${REPEATS})" "${PIPELINE_BENCH}"
+      --label ${LABEL} --output "${BENCH_DIR}/pipeline-${i}.json")
+    list(APPEND results "${BENCH_DIR}/pipeline-${i}.json")
+  endif()
+endforeach()
+
+if(NOT results)
+  message(FATAL_ERROR "No benchmarks to run, check UNWIND_BENCH_SUITES")
+endif()
+
+set(compare_args --output "${BENCH_DIR}/bench-results.json" --label ${LABEL}
+  --alpha ${ALPHA} --threshold ${THRESHOLD})
+if(BASELINE)
+  list(APPEND compare_args --baseline "${BASELINE}")
+endif()
+execute_process(COMMAND "${COMPARE}" ${compare_args} ${results} RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+  if(BASELINE)
+    message(FATAL_ERROR "The benchmarks are slower than the baseline '${BASELINE}' or could not be compared")
+  else()
+    message(FATAL_ERROR "Could not pool the results of the benchmarks")
+  endif()
+endif()
+if(NOT BASELINE)
+  message(STATUS "No UNWIND_BENCH_BASELINE set, keep ${BENCH_DIR}/bench-results.json as the baseline of later runs")
+endif()
@@ -0,0 +1,696 @@
+// unwind-batch: replay saved .fish.pro projects without the UI
+//
+// For each project the straightened volume is exported again from the scans next to the
+// project file, exactly like the Save button of the bounding polygon step would, but on
+// the CPU so no OpenGL context or window is needed. Projects are processed in parallel, within a
+// number of jobs and optionally a memory budget. With --queue, workers on several machines share the
+// projects through a directory on shared storage, see WorkQueue.
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/bounding_cage.h"
+#include "utils/content_hash.h"
+#include "utils/cpu_straightener.h"
+#include "utils/datfile.h"
+#include "utils/fishvol.h"
+#include "utils/metrics.h"
+#include "utils/parallel_for.h"
+#include "utils/path_utils.h"
+#include "utils/project_file.h"
+#include "utils/quality_metrics.h"
+#include "utils/skeleton_extraction.h"
+#include "utils/trace.h"
+
+namespace {
+
+struct BatchOptions {
+    std::string output_dir;
+    // Output voxels per low resolution voxel, <= 0 uses the project's downsample factor like the UI
+    double scale = -1.0;
+    bool compressed = false;
+    ResampleFilter filter = RESAMPLE_TRILINEAR;
+    int num_levels = 1;
+    bool extract_skeleton = false;
+    int num_jobs = static_cast<int>(parallel_num_threads());
+    // Bytes the exports running at once may estimate to need together, 0 for no limit
+    std::size_t memory_budget = 0;
+    // Directory of the work queue shared with other workers, empty to export every project given
+    std::string queue_dir;
+    // Seconds after which the claim of a project is taken to be left behind by a worker that died
+    double claim_timeout = 24.0 * 3600.0;
+    // Log the quality of the tet mesh of every project after its export
+    bool quality_report = false;
+    // Directory of earlier exports to compare the new ones with, empty for none
+    std::string reference_dir;
+    // Exports whose PSNR to their reference is below this fail, 0 for no limit
+    double min_psnr = 0.0;
+};
+
+enum class ProjectResult {
+    Exported,
+    // Exported before, or being exported by another worker of the queue
+    Skipped,
+    Failed,
+};
+
+// Resampled slabs are about this large, see StraightenOptions::slices_per_slab
+constexpr std::size_t SLAB_BYTES = std::size_t(16) << 20;
+
+// Admits exports while the memory they estimate to need fits in the budget, the others wait for running ones to
+// finish. An export larger than the whole budget runs once nothing else does, so every project gets its turn.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(std::size_t budget) : _budget(budget) {}
+
+    void acquire(std::size_t bytes) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _released.wait(lock, [&]() { return _budget == 0 || _in_use == 0 || _in_use + bytes <= _budget; });
+        _in_use += bytes;
+        reserved().set(std::int64_t(_in_use));
+    }
+
+    void release(std::size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _in_use -= bytes;
+            reserved().set(std::int64_t(_in_use));
+        }
+        _released.notify_all();
+    }
+
+private:
+    static metrics::Gauge& reserved() {
+        static metrics::Gauge& gauge =
+            metrics::gauge("unwind_batch_memory_reserved_bytes", "Memory estimated for the running exports");
+        return gauge;
+    }
+
+    const std::size_t _budget;
+    std::size_t _in_use = 0;
+    std::mutex _mutex;
+    std::condition_variable _released;
+};
+
+// Holds its bytes of the budget until it goes out of scope
+class MemoryReservation {
+public:
+    MemoryReservation(MemoryBudget& budget, std::size_t bytes) : _budget(budget), _bytes(bytes) {
+        _budget.acquire(_bytes);
+    }
+    ~MemoryReservation() { _budget.release(_bytes); }
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+private:
+    MemoryBudget& _budget;
+    const std::size_t _bytes;
+};
+
+// Work queue of the unwind-batch workers of a cluster, kept in a directory on shared storage instead of a
+// coordinator. Every worker is given the same projects and exports the ones no other worker took: a project is
+// claimed by creating <key>.claim, which fails if the file already exists, and marked as exported with <key>.done
+// once its outputs are written.
+//
+// The key hashes the project file, the .dat files and the size and time of the scan, and the options and
+// outputs of the export, so reruns and retries skip the projects whose outputs are up to date, while a project
+// that was edited or is exported with other options is exported again. A failed export gives its claim back for
+// the next run. The claim of a worker that died is taken over once it is older than the claim timeout, two
+// workers that find the same stale claim at the same moment may then both export the project.
+class WorkQueue {
+public:
+    enum Claim {
+        Claimed,
+        AlreadyDone,
+        TakenByOther,
+        Error,
+    };
+
+    WorkQueue(const std::string& dir, double claim_timeout) : _dir(dir), _claim_timeout(claim_timeout) {}
+
+    Claim claim(const std::string& key, const std::string& project_path, spdlog::logger& logger) {
+        if (get_file_type(done_path(key).c_str()) == FT_REGULAR_FILE) {
+            return AlreadyDone;
+        }
+        const std::string path = claim_path(key);
+        for (int attempt = 0; attempt < 2; attempt++) {
+            // "x" fails if the file exists, which makes the claim atomic
+            if (std::FILE* file = std::fopen(path.c_str(), "wx")) {
+                std::fprintf(file, "%s\n%lld\n", project_path.c_str(), static_cast<long long>(std::time(nullptr)));
+                std::fclose(file);
+                return Claimed;
+            }
+            struct stat claim_stat;
+            if (stat(path.c_str(), &claim_stat) != 0) {
+                // Given back in the meantime, try again
+                continue;
+            }
+            const double age = std::difftime(std::time(nullptr), claim_stat.st_mtime);
+            if (age < _claim_timeout) {
+                return TakenByOther;
+            }
+            logger.warn("Taking over the claim of '{}' from {:.1f} hours ago", project_path, age / 3600.0);
+            std::remove(path.c_str());
+        }
+        logger.error("Could not claim '{}' in the work queue '{}'", project_path, _dir);
+        return Error;
+    }
+
+    // Mark the claimed key as exported into outputs and give the claim back
+    bool complete(const std::string& key, const std::vector<std::string>& outputs, spdlog::logger& logger) {
+        // Written next to it and renamed, so a worker never sees the marker of an export half written
+        const std::string done = done_path(key), temp = done + ".tmp";
+        bool ok = false;
+        {
+            std::ofstream file(temp);
+            for (const std::string& output : outputs) {
+                file << output << "\n";
+            }
+            ok = bool(file);
+        }
+        ok = ok && std::rename(temp.c_str(), done.c_str()) == 0;
+        if (!ok) {
+            logger.error("Could not write '{}'", done);
+            std::remove(temp.c_str());
+        }
+        release(key);
+        return ok;
+    }
+
+    void release(const std::string& key) {
+        std::remove(claim_path(key).c_str());
+    }
+
+private:
+    std::string claim_path(const std::string& key) const { return _dir + "/" + key + ".claim"; }
+    std::string done_path(const std::string& key) const { return _dir + "/" + key + ".done"; }
+
+    const std::string _dir;
+    const double _claim_timeout;
+};
+
+// Claim of a project in a WorkQueue, given back when it goes out of scope unless the export completed
+class WorkQueueClaim {
+public:
+    WorkQueueClaim() = default;
+    WorkQueueClaim(WorkQueue& queue, const std::string& key) : _queue(&queue), _key(key) {}
+    WorkQueueClaim& operator=(WorkQueueClaim&& other) {
+        std::swap(_queue, other._queue);
+        std::swap(_key, other._key);
+        return *this;
+    }
+    ~WorkQueueClaim() {
+        if (_queue) {
+            _queue->release(_key);
+        }
+    }
+    WorkQueueClaim(const WorkQueueClaim&) = delete;
+    WorkQueueClaim& operator=(const WorkQueueClaim&) = delete;
+
+    bool complete(const std::vector<std::string>& outputs, spdlog::logger& logger) {
+        WorkQueue* queue = _queue;
+        _queue = nullptr;
+        return queue->complete(_key, outputs, logger);
+    }
+
+private:
+    WorkQueue* _queue = nullptr;
+    std::string _key;
+};
+
+// Hash of the contents of filename, or of its size and modification time for the scans, which are too big to read
+// for every key. Missing files hash to a fixed value, the export then fails on them.
+std::string file_stamp(const std::string& filename, bool read_contents, std::shared_ptr<spdlog::logger> logger) {
+    std::uint64_t hash = 0;
+    if (read_contents) {
+        if (!hash_file(filename, hash, logger)) {
+            hash = 0;
+        }
+        return std::to_string(hash);
+    }
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) != 0) {
+        return "missing";
+    }
+    return std::to_string(static_cast<long long>(file_stat.st_size)) + "@" +
+           std::to_string(static_cast<long long>(file_stat.st_mtime));
+}
+
+// Key of the export of a project in the work queue, 16 hexadecimal digits
+std::string export_key(const std::vector<std::string>& inputs, const std::string& options) {
+    std::string content = options;
+    for (const std::string& input : inputs) {
+        content += "\n" + input;
+    }
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(
+        hash_bytes(reinterpret_cast<const std::uint8_t*>(content.data()), content.size())));
+    return key;
+}
+
+// Peak memory of exporting a volume of output_dims. The resampler, the writer queue and the region of the input
+// it reads each hold about a slab, .fishvol outputs are gathered whole along with their coarser levels.
+std::size_t estimate_export_bytes(const Eigen::RowVector3i& output_dims, const BatchOptions& options) {
+    std::size_t bytes = 4 * SLAB_BYTES;
+    if (options.compressed) {
+        const std::size_t output_bytes =
+                std::size_t(output_dims[0]) * std::size_t(output_dims[1]) * std::size_t(output_dims[2]);
+        // Each level is an eighth of the one above it
+        bytes += options.num_levels > 1 ? output_bytes + output_bytes / 7 : output_bytes;
+    }
+    return bytes;
+}
+
+void print_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind-batch [options] project.fish.pro [project.fish.pro ...]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --output-dir DIR  write the exports to DIR instead of next to each project" << std::endl;
+    std::cerr << "  --scale S         output voxels per low resolution voxel (default: the downsample factor)" << std::endl;
+    std::cerr << "  --fishvol         write compressed .fishvol volumes instead of .raw" << std::endl;
+    std::cerr << "  --filter F        resampling filter: trilinear (default), bspline or box" << std::endl;
+    std::cerr << "  --levels N        store N levels of 2x downsampled copies in .fishvol exports (default: 1)" << std::endl;
+    std::cerr << "  --skeleton        extract the skeleton again and refit the cage, this discards manual cage edits" << std::endl;
+    std::cerr << "  --jobs N          number of projects processed at once (default: number of cores)" << std::endl;
+    std::cerr << "  --memory GB       only start exports while their estimated memory fits in GB gigabytes" << std::endl;
+    std::cerr << "  --list FILE       also process the projects listed in FILE, one path per line" << std::endl;
+    std::cerr << "  --queue DIR       share the projects with the workers on other machines using the same DIR," << std::endl;
+    std::cerr << "                    and skip the ones they or an earlier run already exported" << std::endl;
+    std::cerr << "  --claim-timeout H take over the projects other workers claimed more than H hours ago (default: 24)" << std::endl;
+    std::cerr << "  --qa              log the volume and quality of the tet mesh of every project after its export" << std::endl;
+    std::cerr << "  --reference DIR   compare every export with the export of the same name in DIR, e.g. of an" << std::endl;
+    std::cerr << "                    earlier version or of the exact modes, and log their PSNR and SSIM" << std::endl;
+    std::cerr << "  --min-psnr DB     fail the exports less than DB dB from their reference in PSNR" << std::endl;
+}
+
+bool parse_arguments(int argc, char *argv[], BatchOptions& options, std::vector<std::string>& projects) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--output-dir" && has_value) {
+            options.output_dir = argv[++i];
+        } else if (arg == "--scale" && has_value) {
+            options.scale = std::atof(argv[++i]);
+        } else if (arg == "--jobs" && has_value) {
+            options.num_jobs = std::atoi(argv[++i]);
+        } else if (arg == "--memory" && has_value) {
+            const double gigabytes = std::atof(argv[++i]);
+            if (gigabytes <= 0.0) {
+                std::cerr << "ERROR: --memory must be a positive number of gigabytes" << std::endl;
+                return false;
+            }
+            options.memory_budget = std::size_t(gigabytes * double(1ull << 30));
+        } else if (arg == "--list" && has_value) {
+            const std::string list_path = argv[++i];
+            std::ifstream list(list_path);
+            if (!list) {
+                std::cerr << "ERROR: Could not read the project list '" << list_path << "'" << std::endl;
+                return false;
+            }
+            for (std::string line; std::getline(list, line);) {
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty() && line[0] != '#') {
+                    projects.push_back(line);
+                }
+            }
+        } else if (arg == "--queue" && has_value) {
+            options.queue_dir = argv[++i];
+        } else if (arg == "--claim-timeout" && has_value) {
+            const double hours = std::atof(argv[++i]);
+            if (hours <= 0.0) {
+                std::cerr << "ERROR: --claim-timeout must be a positive number of hours" << std::endl;
+                return false;
+            }
+            options.claim_timeout = hours * 3600.0;
+        } else if (arg == "--reference" && has_value) {
+            options.reference_dir = argv[++i];
+        } else if (arg == "--min-psnr" && has_value) {
+            options.min_psnr = std::atof(argv[++i]);
+            if (options.min_psnr <= 0.0) {
+                std::cerr << "ERROR: --min-psnr must be a positive number of dB" << std::endl;
+                return false;
+            }
+        } else if (arg == "--levels" && has_value) {
+            options.num_levels = std::atoi(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            const std::string filter = argv[++i];
+            if (filter == "trilinear") {
+                options.filter = RESAMPLE_TRILINEAR;
+            } else if (filter == "bspline") {
+                options.filter = RESAMPLE_TRICUBIC_BSPLINE;
+            } else if (filter == "box") {
+                options.filter = RESAMPLE_BOX_MINIFY;
+            } else {
+                std::cerr << "ERROR: Unknown filter '" << filter << "'" << std::endl;
+                return false;
+            }
+        } else if (arg == "--fishvol") {
+            options.compressed = true;
+        } else if (arg == "--skeleton") {
+            options.extract_skeleton = true;
+        } else if (arg == "--qa") {
+            options.quality_report = true;
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            return false;
+        } else {
+            projects.push_back(arg);
+        }
+    }
+    if (options.num_jobs < 1) {
+        std::cerr << "ERROR: --jobs must be at least 1" << std::endl;
+        return false;
+    }
+    if (options.num_levels < 1) {
+        std::cerr << "ERROR: --levels must be at least 1" << std::endl;
+        return false;
+    }
+    if (options.num_levels > 1 && !options.compressed) {
+        std::cerr << "ERROR: --levels needs --fishvol, .raw files only hold the full resolution" << std::endl;
+        return false;
+    }
+    if (options.min_psnr > 0.0 && options.reference_dir.empty()) {
+        std::cerr << "ERROR: --min-psnr needs --reference" << std::endl;
+        return false;
+    }
+    return !projects.empty();
+}
+
+// Rebuild the cage from the saved tet mesh and endpoints, as the endpoint selection step does
+bool refit_cage(const ProjectFile& file, BoundingCage& cage, std::shared_ptr<spdlog::logger> logger) {
+    Eigen::MatrixXd TV;
+    Eigen::MatrixXi TT;
+    Eigen::VectorXi connected_components;
+    Eigen::MatrixXi endpoint_pairs_matrix;
+    int num_subdivisions = 0, num_smoothing_iters = 0;
+    double cage_bbox_radius = 0.0;
+    bool heat_geodesics = false;
+
+    bool ok = true;
+    ok = ok && file.read_matrix("dilated_tet_mesh.TV", TV);
+    ok = ok && file.read_matrix("dilated_tet_mesh.TT", TT);
+    ok = ok && file.read_matrix("dilated_tet_mesh.connected_components", connected_components);
+    ok = ok && file.read_matrix("skeleton_estimation_parameters.endpoint_pairs", endpoint_pairs_matrix);
+    ok = ok && file.read_value("skeleton_estimation_parameters.num_subdivisions", num_subdivisions);
+    ok = ok && file.read_value("skeleton_estimation_parameters.num_smoothing_iters", num_smoothing_iters);
+    ok = ok && file.read_value("skeleton_estimation_parameters.cage_bbox_radius", cage_bbox_radius);
+    if (file.has_section("skeleton_estimation_parameters.heat_geodesics")) {
+        ok = ok && file.read_value("skeleton_estimation_parameters.heat_geodesics", heat_geodesics);
+    }
+    if (!ok || TV.rows() == 0 || endpoint_pairs_matrix.rows() != 2 || endpoint_pairs_matrix.cols() == 0) {
+        logger->error("The project has no tet mesh or endpoints to extract a skeleton from");
+        return false;
+    }
+
+    std::vector<std::pair<int, int>> endpoint_pairs;
+    for (int i = 0; i < endpoint_pairs_matrix.cols(); i++) {
+        endpoint_pairs.push_back(std::make_pair(endpoint_pairs_matrix(0, i), endpoint_pairs_matrix(1, i)));
+    }
+
+    Eigen::MatrixXd skeleton_vertices;
+    Eigen::VectorXd geodesic_dists;
+    SkeletonExtractionCache cache;
+    if (!extract_skeleton(TV, TT, connected_components, endpoint_pairs, num_subdivisions,
+                          skeleton_vertices, geodesic_dists, cache, heat_geodesics, logger)) {
+        logger->error("Skeleton extraction failed");
+        return false;
+    }
+    const double rad = cage_bbox_radius;
+    Eigen::Vector4d bbox(-rad, rad, -rad, rad);
+    return cage.set_skeleton_vertices(skeleton_vertices, num_smoothing_iters, bbox);
+}
+
+// Log the quality of the tet mesh of the project and compare the export with its reference, see --qa and
+// --reference. Returns false if the export is further from its reference than the options allow.
+bool check_export_quality(const ProjectFile& file, const std::string& project_path, const std::string& output_path,
+                          const Eigen::RowVector3i& output_dims, const BatchOptions& options,
+                          std::shared_ptr<spdlog::logger> logger) {
+    TRACE_SCOPE("check_export_quality");
+    if (options.quality_report) {
+        Eigen::MatrixXd TV;
+        Eigen::MatrixXi TT;
+        if (file.read_matrix("dilated_tet_mesh.TV", TV) && file.read_matrix("dilated_tet_mesh.TT", TT)) {
+            const TetMeshQuality quality = tet_mesh_quality(TV, TT);
+            logger->info("'{}': {} tets of volume {:.1f}, mean ratio {:.3f} (min {:.3f}), {} slivers, {} inverted",
+                         project_path, quality.num_tets, quality.volume, quality.mean_quality, quality.min_quality,
+                         quality.num_slivers, quality.num_inverted);
+        } else {
+            logger->warn("'{}' has no tet mesh to report on", project_path);
+        }
+    }
+    if (options.reference_dir.empty()) {
+        return true;
+    }
+
+    const std::string reference_path =
+            options.reference_dir + "/" + dir_and_base_name(output_path.c_str()).second;
+    if (get_file_type(reference_path.c_str()) != FT_REGULAR_FILE) {
+        logger->warn("'{}' has no reference export '{}' to compare with", project_path, reference_path);
+        return true;
+    }
+    VolumeComparison comparison;
+    if (!compare_volume_files(output_path, reference_path, output_dims, comparison, logger)) {
+        logger->error("Could not compare '{}' with its reference '{}'", output_path, reference_path);
+        return false;
+    }
+    logger->info("'{}': PSNR {:.2f} dB, SSIM {:.4f}, {} of {} voxels differ by up to {}", output_path,
+                 comparison.psnr, comparison.ssim, comparison.num_differing, comparison.num_voxels,
+                 comparison.max_difference);
+    if (options.min_psnr > 0.0 && comparison.psnr < options.min_psnr) {
+        logger->error("'{}' is {:.2f} dB from its reference, less than the {:.2f} dB of --min-psnr", output_path,
+                      comparison.psnr, options.min_psnr);
+        return false;
+    }
+    return true;
+}
+
+ProjectResult process_project(const std::string& project_path, const BatchOptions& options, MemoryBudget& budget,
+                              WorkQueue* queue, std::shared_ptr<spdlog::logger> logger) {
+    TRACE_SCOPE("process_project");
+    if (get_file_type(project_path.c_str()) != FT_REGULAR_FILE) {
+        logger->error("Project file '{}' does not exist", project_path);
+        return ProjectResult::Failed;
+    }
+    if (!ProjectFile::is_project_file(project_path)) {
+        logger->error("'{}' is a legacy project, open and save it in unwind once to convert it", project_path);
+        return ProjectResult::Failed;
+    }
+
+    ProjectFile file;
+    if (!file.open(project_path, logger)) {
+        return ProjectResult::Failed;
+    }
+
+    std::string prefix, project_name;
+    int downsample_factor = 0, start_index = 0, end_index = 0;
+    bool ok = true;
+    ok = ok && file.read_string("image_input.prefix", prefix);
+    ok = ok && file.read_value("image_input.downsample_factor", downsample_factor);
+    ok = ok && file.read_value("image_input.start_index", start_index);
+    ok = ok && file.read_value("image_input.end_index", end_index);
+    ok = ok && file.read_string("image_input.project_name", project_name);
+
+    BoundingCage cage;
+    cage.set_logger(logger);
+    ok = ok && cage.read_sections(file, "cage.");
+    if (!ok) {
+        logger->error("Failed to load project file '{}'", project_path);
+        return ProjectResult::Failed;
+    }
+
+    // Like opening an existing project in the UI, the volumes are loaded from the project's directory
+    const std::string project_dir = dir_and_base_name(project_path.c_str()).first;
+    const std::string full_res_prefix = prefix + "-" + std::to_string(start_index) + "-" + std::to_string(end_index);
+    const std::string low_res_prefix = full_res_prefix + "-" + std::to_string(downsample_factor);
+
+    // The cage lives in the voxel coordinates of the low resolution volume
+    DatFile low_res_datfile;
+    if (!low_res_datfile.deserialize(project_dir + "/" + low_res_prefix + ".dat", logger)) {
+        return ProjectResult::Failed;
+    }
+    DatFile hi_res_datfile;
+    if (!hi_res_datfile.deserialize(project_dir + "/" + full_res_prefix + ".dat", logger)) {
+        return ProjectResult::Failed;
+    }
+    const Eigen::RowVector3i low_res_dims(low_res_datfile.w, low_res_datfile.h, low_res_datfile.d);
+    const Eigen::RowVector3i hi_res_dims(hi_res_datfile.w, hi_res_datfile.h, hi_res_datfile.d);
+    const std::string hi_res_path = is_fishvol_filename(hi_res_datfile.m_raw_filename) ?
+                hi_res_datfile.m_directory + "/" + hi_res_datfile.m_raw_filename :
+                project_dir + "/" + full_res_prefix + ".raw";
+
+    const std::string output_dir = options.output_dir.empty() ? project_dir : options.output_dir;
+    const std::string output_rawfile_name = project_name + (options.compressed ? ".fishvol" : ".raw");
+    const std::string output_rawfile_path = output_dir + "/" + output_rawfile_name;
+    const std::string output_datfile_path = output_dir + "/" + project_name + ".dat";
+
+    // The claim is given back if the export fails, for the next run to retry it
+    WorkQueueClaim claim;
+    if (queue) {
+        const std::string export_options = "scale=" + std::to_string(options.scale) +
+            " fishvol=" + std::to_string(options.compressed) + " filter=" + std::to_string(int(options.filter)) +
+            " levels=" + std::to_string(options.num_levels) + " skeleton=" + std::to_string(options.extract_skeleton);
+        const std::string key = export_key({ file_stamp(project_path, true, logger),
+                                             file_stamp(project_dir + "/" + low_res_prefix + ".dat", true, logger),
+                                             file_stamp(project_dir + "/" + full_res_prefix + ".dat", true, logger),
+                                             file_stamp(hi_res_path, false, logger),
+                                             output_rawfile_path }, export_options);
+        switch (queue->claim(key, project_path, *logger)) {
+        case WorkQueue::AlreadyDone:
+            logger->info("'{}' was already exported to '{}'", project_path, output_rawfile_path);
+            return ProjectResult::Skipped;
+        case WorkQueue::TakenByOther:
+            logger->info("'{}' is being exported by another worker", project_path);
+            return ProjectResult::Skipped;
+        case WorkQueue::Error:
+            return ProjectResult::Failed;
+        case WorkQueue::Claimed:
+            claim = WorkQueueClaim(*queue, key);
+            break;
+        }
+    }
+
+    if (options.extract_skeleton && !refit_cage(file, cage, logger)) {
+        return ProjectResult::Failed;
+    }
+
+    std::vector<double> kf_depths;
+    cage.keyframe_depths(kf_depths);
+    const Eigen::Vector4d kfbb = cage.keyframe_bounding_box();
+    const double scale = options.scale > 0.0 ? options.scale : double(downsample_factor);
+    const Eigen::RowVector3i output_dims(int((kfbb[1] - kfbb[0]) * scale),
+                                         int((kfbb[3] - kfbb[2]) * scale),
+                                         int(kf_depths.back() * scale));
+    if (output_dims.minCoeff() <= 0) {
+        logger->error("'{}' has an empty bounding cage", project_path);
+        return ProjectResult::Failed;
+    }
+
+    const std::size_t export_bytes = estimate_export_bytes(output_dims, options);
+    if (options.memory_budget > 0 && export_bytes > options.memory_budget) {
+        logger->warn("Exporting '{}' needs about {} MiB, more than the memory budget, it runs on its own",
+                     project_path, export_bytes >> 20);
+    }
+    MemoryReservation reservation(budget, export_bytes);
+
+    logger->info("Exporting '{}' ({} x {} x {}) to '{}'", project_path,
+                 output_dims[0], output_dims[1], output_dims[2], output_rawfile_path);
+    StraightenOptions straighten_options;
+    straighten_options.filter = options.filter;
+    straighten_options.num_levels = options.num_levels;
+    if (!straighten_volume_file(cage, low_res_dims, hi_res_path, hi_res_dims, output_dims,
+                                output_rawfile_path, logger, straighten_options)) {
+        logger->error("Failed to export '{}'", project_path);
+        return ProjectResult::Failed;
+    }
+
+    DatFile out_datfile;
+    out_datfile.w = output_dims[0];
+    out_datfile.h = output_dims[1];
+    out_datfile.d = output_dims[2];
+    out_datfile.m_raw_filename = output_rawfile_name;
+    out_datfile.m_format = "UINT8";
+    if (!out_datfile.serialize(output_datfile_path, logger)) {
+        return ProjectResult::Failed;
+    }
+    if (!check_export_quality(file, project_path, output_rawfile_path, output_dims, options, logger)) {
+        return ProjectResult::Failed;
+    }
+    if (queue && !claim.complete({ output_rawfile_path, output_datfile_path }, *logger)) {
+        return ProjectResult::Failed;
+    }
+    return ProjectResult::Exported;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[]) {
+    BatchOptions options;
+    std::vector<std::string> projects;
+    if (!parse_arguments(argc, argv, options, projects)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (!options.output_dir.empty() && mkpath(options.output_dir.c_str()) != 0) {
+        std::cerr << "ERROR: Could not create output directory '" << options.output_dir << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!options.queue_dir.empty() && mkpath(options.queue_dir.c_str()) != 0) {
+        std::cerr << "ERROR: Could not create work queue directory '" << options.queue_dir << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_mt("unwind-batch");
+    trace::init(logger);
+    metrics::init(logger);
+    metrics::Gauge& queue_depth = metrics::gauge("unwind_batch_queue_depth", "Projects not started yet");
+    metrics::Gauge& in_progress = metrics::gauge("unwind_batch_projects_in_progress", "Projects being processed");
+    metrics::Counter& projects_done = metrics::counter("unwind_batch_projects_done_total", "Projects exported");
+    metrics::Counter& projects_failed =
+        metrics::counter("unwind_batch_projects_failed_total", "Projects that failed to export");
+    metrics::Counter& projects_skipped =
+        metrics::counter("unwind_batch_projects_skipped_total", "Projects exported before or by another worker");
+    queue_depth.set(std::int64_t(projects.size()));
+
+    // Each worker pulls the next project until none are left. The resampling inside a project is
+    // parallel as well, so a few jobs are enough to keep the cores busy while others wait on disk.
+    MemoryBudget budget(options.memory_budget);
+    std::unique_ptr<WorkQueue> queue;
+    if (!options.queue_dir.empty()) {
+        queue.reset(new WorkQueue(options.queue_dir, options.claim_timeout));
+    }
+    std::atomic<std::size_t> next_project(0);
+    std::atomic<std::size_t> num_skipped(0);
+    std::mutex failed_mutex;
+    std::vector<std::string> failed;
+    auto worker = [&]() {
+        for (std::size_t i = next_project++; i < projects.size(); i = next_project++) {
+            queue_depth.add(-1);
+            in_progress.add(1);
+            const ProjectResult result = process_project(projects[i], options, budget, queue.get(), logger);
+            in_progress.add(-1);
+            if (result == ProjectResult::Skipped) {
+                projects_skipped.add();
+                num_skipped++;
+            } else {
+                (result == ProjectResult::Exported ? projects_done : projects_failed).add();
+            }
+            if (result == ProjectResult::Failed) {
+                std::lock_guard<std::mutex> lock(failed_mutex);
+                failed.push_back(projects[i]);
+            }
+        }
+    };
+
+    const std::size_t num_jobs = std::min(std::size_t(options.num_jobs), projects.size());
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < num_jobs; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+
+    logger->info("Exported {} of {} projects, skipped {}", projects.size() - failed.size() - num_skipped,
+                 projects.size(), std::size_t(num_skipped));
+    for (const std::string& project : failed) {
+        logger->error("Failed: {}", project);
+    }
+    return failed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
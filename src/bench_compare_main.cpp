@@ -0,0 +1,460 @@
+// unwind-bench-compare: pool the results of the benchmarks and test them for regressions against a baseline
+//
+// Reads the JSON files of unwind-pipeline-bench, unwind-utils-bench, unwind-export-bench (--results) and
+// vor3d_bench and collects every timing into a series of samples, one per run, e.g. the time of a pipeline
+// stage over all the runs of the pipeline benchmark. The series are written to --output, which is the format
+// of the baseline as well: keep the output of a run on a known good commit to compare later runs with.
+//
+// A series is reported as slower when a one-sided Mann-Whitney U test finds its samples larger than those of
+// the baseline at the --alpha level and its median grew by more than --threshold, and faster the other way
+// round. The test only looks at the ranks, so it is not thrown off by the odd run that was disturbed by the
+// system, but it needs a few samples on each side: with 3 against 3 the smallest possible p-value is 0.05.
+// Returns EXIT_FAILURE if a series got slower.
+
+#include <spdlog/spdlog.h>
+#include <json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct CompareOptions {
+    std::string baseline_filename;
+    std::string output_filename = "bench-results.json";
+    std::string label;
+    // Significance level of the tests
+    double alpha = 0.01;
+    // Smallest relative change of the median that is reported
+    double threshold = 0.05;
+};
+
+void print_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind-bench-compare [options] results.json [results.json ...]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --baseline FILE   output of an earlier run to test the results against" << std::endl;
+    std::cerr << "  --output FILE     file the pooled results are written to (default: bench-results.json)" << std::endl;
+    std::cerr << "  --label L         label stored with the results, e.g. the commit" << std::endl;
+    std::cerr << "  --alpha A         significance level of the Mann-Whitney U tests (default: 0.01)" << std::endl;
+    std::cerr << "  --threshold T     smallest relative change of the median that is reported (default: 0.05)" << std::endl;
+}
+
+bool parse_arguments(int argc, char *argv[], CompareOptions& options, std::vector<std::string>& inputs) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--baseline" && has_value) {
+            options.baseline_filename = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            options.output_filename = argv[++i];
+        } else if (arg == "--label" && has_value) {
+            options.label = argv[++i];
+        } else if (arg == "--alpha" && has_value) {
+            options.alpha = std::atof(argv[++i]);
+        } else if (arg == "--threshold" && has_value) {
+            options.threshold = std::atof(argv[++i]);
+        } else if (!arg.empty() && arg[0] == '-') {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (options.alpha <= 0.0 || options.alpha >= 1.0 || options.threshold < 0.0) {
+        std::cerr << "ERROR: Need 0 < --alpha < 1 and --threshold >= 0" << std::endl;
+        return false;
+    }
+    return !inputs.empty();
+}
+
+// Samples in ms by series, e.g. "pipeline/Dilating", and the options the benchmarks ran with
+struct Results {
+    std::string label;
+    std::map<std::string, std::vector<double>> series;
+    std::map<std::string, nlohmann::json> options;
+};
+
+std::string format_number(double x) {
+    std::ostringstream s;
+    s << x;
+    return s.str();
+}
+
+// The runs pooled into a series must have been made with the same options
+bool add_options(Results& results, const std::string& benchmark, const nlohmann::json& options,
+                 const std::string& filename, spdlog::logger& logger) {
+    nlohmann::json opts = options;
+    // The label of a run is not an option
+    if (opts.is_object()) {
+        opts.erase("label");
+    }
+    if (results.options.count(benchmark) > 0 && results.options[benchmark] != opts) {
+        logger.error("'{}' ran {} with other options than the files before it: {} instead of {}", filename,
+                     benchmark, opts.dump(), results.options[benchmark].dump());
+        return false;
+    }
+    results.options[benchmark] = opts;
+    return true;
+}
+
+double number(const nlohmann::json& object, const char* key) {
+    const nlohmann::json::const_iterator it = object.find(key);
+    return it != object.end() && it->is_number() ? it->get<double>() : NAN;
+}
+
+std::string text(const nlohmann::json& object, const char* key) {
+    const nlohmann::json::const_iterator it = object.find(key);
+    if (it == object.end()) {
+        return "";
+    }
+    return it->is_string() ? it->get<std::string>() : it->dump();
+}
+
+void add_sample(Results& results, const std::string& series, double ms) {
+    if (std::isfinite(ms)) {
+        results.series[series].push_back(ms);
+    }
+}
+
+bool read_pipeline_results(const nlohmann::json& json, const std::string& filename, Results& results,
+                           spdlog::logger& logger) {
+    if (!add_options(results, "pipeline", json.value("options", nlohmann::json()), filename, logger)) {
+        return false;
+    }
+    for (const nlohmann::json& stage : json.at("stages")) {
+        add_sample(results, "pipeline/" + text(stage, "name"), 1000.0 * number(stage, "seconds"));
+    }
+    add_sample(results, "pipeline/total", 1000.0 * number(json, "total_seconds"));
+    return true;
+}
+
+bool read_utils_results(const nlohmann::json& json, const std::string& filename, Results& results,
+                        spdlog::logger& logger) {
+    if (!add_options(results, "utils", json.value("options", nlohmann::json()), filename, logger)) {
+        return false;
+    }
+    for (const nlohmann::json& mesh : json.at("meshes")) {
+        for (const nlohmann::json& utility : mesh.at("utilities")) {
+            const std::string series = "utils/" + text(mesh, "name") + "/" + text(utility, "name");
+            const nlohmann::json::const_iterator samples = utility.find("samples_ms");
+            if (samples != utility.end() && samples->is_array()) {
+                for (const nlohmann::json& ms : *samples) {
+                    add_sample(results, series, ms.is_number() ? ms.get<double>() : NAN);
+                }
+            } else {
+                // Written before the samples were kept, the best run is all there is
+                add_sample(results, series, number(utility, "best_ms"));
+            }
+        }
+    }
+    return true;
+}
+
+bool read_export_results(const nlohmann::json& json, const std::string& filename, Results& results,
+                         spdlog::logger& logger) {
+    if (!add_options(results, "export", json.value("options", nlohmann::json()), filename, logger)) {
+        return false;
+    }
+    for (const nlohmann::json& run : json.at("exports")) {
+        const double render_seconds = number(run, "render_seconds");
+        const double write_seconds = number(run, "write_seconds");
+        add_sample(results, "export/render", 1000.0 * render_seconds);
+        add_sample(results, "export/write", 1000.0 * write_seconds);
+        add_sample(results, "export/total", 1000.0 * (render_seconds + write_seconds));
+    }
+    return true;
+}
+
+// A list of entries per model, see vor3d_bench.cpp. The options are part of the series names.
+bool read_vor3d_results(const nlohmann::json& json, const std::string& filename, Results& results,
+                        spdlog::logger& logger) {
+    for (nlohmann::json::const_iterator model = json.begin(); model != json.end(); ++model) {
+        if (!model->is_array()) {
+            logger.error("'{}' is not the output of a known benchmark", filename);
+            return false;
+        }
+        for (const nlohmann::json& entry : *model) {
+            const std::string series = "vor3d/" + model.key() + "/" + text(entry, "operation") + "/" +
+                                       text(entry, "method") + "/n" + format_number(number(entry, "num_dexels")) +
+                                       "/r" + format_number(number(entry, "radius_relative")) +
+                                       "/t" + format_number(number(entry, "num_threads"));
+            add_sample(results, series, number(entry, "time"));
+        }
+    }
+    return true;
+}
+
+bool read_json(const std::string& filename, nlohmann::json& json, spdlog::logger& logger) {
+    std::ifstream in(filename);
+    if (!in) {
+        logger.error("Cannot open '{}'", filename);
+        return false;
+    }
+    try {
+        in >> json;
+    } catch (const std::exception& e) {
+        logger.error("Cannot parse '{}': {}", filename, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool read_benchmark_results(const std::string& filename, Results& results, spdlog::logger& logger) {
+    nlohmann::json json;
+    if (!read_json(filename, json, logger)) {
+        return false;
+    }
+    if (!json.is_object()) {
+        logger.error("'{}' is not the output of a known benchmark", filename);
+        return false;
+    }
+    try {
+        if (json.count("stages") > 0) {
+            return read_pipeline_results(json, filename, results, logger);
+        } else if (json.count("meshes") > 0) {
+            return read_utils_results(json, filename, results, logger);
+        } else if (json.count("exports") > 0) {
+            return read_export_results(json, filename, results, logger);
+        } else {
+            return read_vor3d_results(json, filename, results, logger);
+        }
+    } catch (const std::exception& e) {
+        logger.error("Unexpected contents in '{}': {}", filename, e.what());
+        return false;
+    }
+}
+
+bool read_pooled_results(const std::string& filename, Results& results, spdlog::logger& logger) {
+    nlohmann::json json;
+    if (!read_json(filename, json, logger)) {
+        return false;
+    }
+    try {
+        results.label = json.value("label", std::string());
+        const nlohmann::json& options = json.at("options");
+        for (nlohmann::json::const_iterator it = options.begin(); it != options.end(); ++it) {
+            results.options[it.key()] = it.value();
+        }
+        const nlohmann::json& series = json.at("series");
+        for (nlohmann::json::const_iterator it = series.begin(); it != series.end(); ++it) {
+            results.series[it.key()] = it.value().get<std::vector<double>>();
+        }
+    } catch (const std::exception& e) {
+        logger.error("'{}' is not the output of unwind-bench-compare: {}", filename, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool write_pooled_results(const std::string& filename, const Results& results, spdlog::logger& logger) {
+    nlohmann::json json;
+    json["label"] = results.label;
+    json["options"] = nlohmann::json::object();
+    for (const std::pair<const std::string, nlohmann::json>& options : results.options) {
+        json["options"][options.first] = options.second;
+    }
+    json["series"] = nlohmann::json::object();
+    for (const std::pair<const std::string, std::vector<double>>& series : results.series) {
+        json["series"][series.first] = series.second;
+    }
+    std::ofstream out(filename);
+    out << std::setw(2) << json << std::endl;
+    if (!out) {
+        logger.error("Cannot write the results to '{}'", filename);
+        return false;
+    }
+    return true;
+}
+
+double median(std::vector<double> x) {
+    std::sort(x.begin(), x.end());
+    const std::size_t n = x.size();
+    return n % 2 == 1 ? x[n / 2] : 0.5 * (x[n / 2 - 1] + x[n / 2]);
+}
+
+// Probability under the null hypothesis that U, the number of pairs in which the sample of y is larger than the
+// sample of x, is at least u, for samples of n_x and n_y values without ties. Counts the orderings of the
+// samples by their U, which are all equally likely, by taking away the smallest value: a value of y is larger
+// than none of x, a value of x is smaller than all of y.
+double exact_mann_whitney_p(int n_x, int n_y, double u) {
+    // count[i][j][k]: orderings of i values of x and j values of y with U = k
+    const int max_u = n_x * n_y;
+    std::vector<std::vector<std::vector<double>>> count(n_x + 1,
+        std::vector<std::vector<double>>(n_y + 1, std::vector<double>(max_u + 1, 0.0)));
+    for (int i = 0; i <= n_x; i++) {
+        for (int j = 0; j <= n_y; j++) {
+            if (i == 0 || j == 0) {
+                count[i][j][0] = 1.0;
+                continue;
+            }
+            for (int k = 0; k <= i * j; k++) {
+                // The smallest value is from y and wins no pair, or from x and loses to every value of y
+                count[i][j][k] = count[i][j - 1][k] + (k >= j ? count[i - 1][j][k - j] : 0.0);
+            }
+        }
+    }
+    double at_least = 0.0, total = 0.0;
+    for (int k = 0; k <= max_u; k++) {
+        total += count[n_x][n_y][k];
+        at_least += k >= u - 1e-9 ? count[n_x][n_y][k] : 0.0;
+    }
+    return at_least / total;
+}
+
+// One-sided Mann-Whitney U test of whether the values of y tend to be larger than those of x, returns the p-value.
+// Exact for small samples without ties, otherwise from the normal approximation with the tie correction.
+double mann_whitney_p(const std::vector<double>& x, const std::vector<double>& y) {
+    const int n_x = int(x.size()), n_y = int(y.size());
+    if (n_x == 0 || n_y == 0) {
+        return 1.0;
+    }
+    double u = 0.0;
+    bool ties = false;
+    for (double a : x) {
+        for (double b : y) {
+            u += b > a ? 1.0 : (b == a ? 0.5 : 0.0);
+            ties = ties || b == a;
+        }
+    }
+    if (!ties && n_x + n_y <= 40) {
+        return exact_mann_whitney_p(n_x, n_y, u);
+    }
+
+    std::vector<double> all(x);
+    all.insert(all.end(), y.begin(), y.end());
+    std::sort(all.begin(), all.end());
+    double tie_sum = 0.0;
+    for (std::size_t i = 0; i < all.size();) {
+        std::size_t j = i;
+        while (j < all.size() && all[j] == all[i]) {
+            j++;
+        }
+        const double t = double(j - i);
+        tie_sum += t * t * t - t;
+        i = j;
+    }
+    const double n = double(n_x + n_y);
+    const double mean = 0.5 * n_x * n_y;
+    const double variance = double(n_x) * n_y / 12.0 * ((n + 1.0) - tie_sum / (n * (n - 1.0)));
+    if (variance <= 0.0) {
+        return 1.0;
+    }
+    // With the continuity correction
+    const double z = (u - mean - 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+// Smallest p-value the test can give for samples of these sizes, 1 / (n_x + n_y choose n_x)
+double smallest_p(int n_x, int n_y) {
+    double choose = 1.0;
+    for (int i = 1; i <= n_x; i++) {
+        choose = choose * double(n_y + i) / double(i);
+    }
+    return 1.0 / choose;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[]) {
+    CompareOptions options;
+    std::vector<std::string> inputs;
+    if (!parse_arguments(argc, argv, options, inputs)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_mt("unwind-bench-compare");
+
+    Results results;
+    results.label = options.label;
+    for (const std::string& filename : inputs) {
+        if (!read_benchmark_results(filename, results, *logger)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (!write_pooled_results(options.output_filename, results, *logger)) {
+        return EXIT_FAILURE;
+    }
+    logger->info("Wrote {} series from {} files to '{}'", results.series.size(), inputs.size(),
+                 options.output_filename);
+
+    if (options.baseline_filename.empty()) {
+        for (const std::pair<const std::string, std::vector<double>>& series : results.series) {
+            logger->info("  {}: median {:.3f} ms of {} runs", series.first, median(series.second),
+                         series.second.size());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    Results baseline;
+    if (!read_pooled_results(options.baseline_filename, baseline, *logger)) {
+        return EXIT_FAILURE;
+    }
+    for (const std::pair<const std::string, nlohmann::json>& benchmark : results.options) {
+        const std::map<std::string, nlohmann::json>::const_iterator it = baseline.options.find(benchmark.first);
+        if (it != baseline.options.end() && it->second != benchmark.second) {
+            logger->warn("The baseline ran {} with other options, {} instead of {}", benchmark.first,
+                         it->second.dump(), benchmark.second.dump());
+        }
+    }
+    logger->info("Comparing '{}' with the baseline '{}' at alpha {} and a threshold of {:.1f}%",
+                 options.label, baseline.label, options.alpha, 100.0 * options.threshold);
+
+    int num_slower = 0, num_faster = 0, num_compared = 0, num_underpowered = 0;
+    for (const std::pair<const std::string, std::vector<double>>& series : results.series) {
+        const std::map<std::string, std::vector<double>>::const_iterator base = baseline.series.find(series.first);
+        if (base == baseline.series.end()) {
+            logger->info("  {}: new, median {:.3f} ms", series.first, median(series.second));
+            continue;
+        }
+        const std::vector<double>& before = base->second;
+        const std::vector<double>& after = series.second;
+        if (before.empty() || after.empty()) {
+            continue;
+        }
+        num_compared += 1;
+        if (smallest_p(int(before.size()), int(after.size())) > options.alpha) {
+            num_underpowered += 1;
+        }
+        const double median_before = median(before), median_after = median(after);
+        const double change = median_before > 0.0 ? median_after / median_before - 1.0 : 0.0;
+        const double p_slower = mann_whitney_p(before, after);
+        const double p_faster = mann_whitney_p(after, before);
+        if (p_slower < options.alpha && change > options.threshold) {
+            num_slower += 1;
+            logger->error("  {}: SLOWER {:.3f} -> {:.3f} ms ({:+.1f}%, p = {:.2g})", series.first,
+                          median_before, median_after, 100.0 * change, p_slower);
+        } else if (p_faster < options.alpha && change < -options.threshold) {
+            num_faster += 1;
+            logger->info("  {}: faster {:.3f} -> {:.3f} ms ({:+.1f}%, p = {:.2g})", series.first,
+                         median_before, median_after, 100.0 * change, p_faster);
+        } else {
+            logger->debug("  {}: {:.3f} -> {:.3f} ms ({:+.1f}%)", series.first, median_before, median_after,
+                          100.0 * change);
+        }
+    }
+    for (const std::pair<const std::string, std::vector<double>>& series : baseline.series) {
+        if (results.series.count(series.first) == 0) {
+            logger->warn("  {}: in the baseline only", series.first);
+        }
+    }
+    if (num_underpowered > 0) {
+        logger->warn("{} of the series have too few runs to be significant at alpha {}, run the benchmarks "
+                     "more often", num_underpowered, options.alpha);
+    }
+    logger->info("{} series compared: {} slower, {} faster, {} unchanged", num_compared, num_slower, num_faster,
+                 num_compared - num_slower - num_faster);
+    return num_slower == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
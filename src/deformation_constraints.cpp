@@ -6,6 +6,7 @@
 #include <Eigen/Geometry>
 
 #include "utils.h"
+#include "skeleton_extraction.h"
 
 
 bool DeformationConstraints::validate_endpoint_pairs(const std::vector<std::array<int, 2>>& endpoints, const Eigen::VectorXi& components) {
@@ -121,6 +122,7 @@ void DeformationConstraints::clear_orientation_constraints() {
 double DeformationConstraints::one_pair_bone_constraints(
     const Eigen::MatrixXd& TV_fat,
     const Eigen::MatrixXi& TT_fat,
+    const TetMeshSpatialIndex& fat_index,
     const Eigen::MatrixXd& TV_thin,
     const Eigen::MatrixXi& TT_thin,
     const Eigen::VectorXd& geodesic_distances,
@@ -131,9 +133,6 @@ double DeformationConstraints::one_pair_bone_constraints(
   using namespace std;
   using namespace Eigen;
 
-  MatrixXd LV;
-  MatrixXi LF;
-
   unordered_set<int> vmap;
   vmap.max_load_factor(0.5);
   vmap.reserve(num_verts);
@@ -141,40 +140,51 @@ double DeformationConstraints::one_pair_bone_constraints(
   const int num_endpoint_pairs = endpoints.size();
   assert(num_endpoint_pairs > 0);
 
-  int ctr_idx = nearest_vertex(TV_fat, TV_thin.row(endpoints[0]));
+  // Both endpoints are located in the fat mesh in one batched query
+  MatrixXd endpoint_pos(2, 3);
+  endpoint_pos.row(0) = TV_thin.row(endpoints[0]);
+  endpoint_pos.row(1) = TV_thin.row(endpoints[1]);
+  VectorXi endpoint_idx;
+  fat_index.nearest_vertices(endpoint_pos, endpoint_idx);
+
+  int ctr_idx = endpoint_idx[0];
   RowVector3d last_ctr = TV_fat.row(ctr_idx);
   m_bone_constraints_idx.push_back(ctr_idx);
   m_bone_constraints_pos.push_back(straight_origin);
-  int tet_idx = -1;
-  for (int i = 0; i < TT_fat.rows(); i++) {
-    if (TT_fat(i, 0) == ctr_idx || TT_fat(i, 1) == ctr_idx || TT_fat(i, 2) == ctr_idx || TT_fat(i, 3) == ctr_idx) {
-      tet_idx = i;
-      break;
-    }
-  }
+  int tet_idx = fat_index.incident_tet(ctr_idx);
   assert(tet_idx >= 0);
   m_constrainable_tets_idx.push_back(tet_idx);
 
 
   double dist = 0.0;
-  double isovalue = geodesic_distances[endpoints[0]];
+  const double isovalue_start = geodesic_distances[endpoints[0]];
   const double isovalue_incr = (geodesic_distances[endpoints[1]] - geodesic_distances[endpoints[0]]) / num_verts;
 
+  // The centroids of the N intermediate levels between each pair of constraint levels, in a single pass
+  const int N = 10;
+  vector<double> isovalues;
+  for (int i = 1; i < num_verts; i++) {
+    for (int j = 0; j < N; j++) {
+      isovalues.push_back(isovalue_start + (i - 1 + double(j + 1) / N) * isovalue_incr);
+    }
+  }
+  MatrixXd level_ctrs;
+  VectorXd level_areas;
+  level_set_centroids(TV_thin, TT_thin, geodesic_distances, isovalues, level_ctrs, level_areas);
+
+  // Walk the centroids to get the distance along the skeleton, then locate all of the constraint levels in the
+  // fat mesh at once
+  vector<double> level_dists;
+  MatrixXd ctrs(num_verts, 3);
   for(int i = 1; i < num_verts; i++) {
-
-    const double last_isovalue = isovalue;
-    isovalue += isovalue_incr;
-
-    const int N = 10;
     bool found_non_empty = false;
-    for (int i = 0; i < N; i++) {
-      double intermediate_isoval = last_isovalue + (i+1) * (isovalue - last_isovalue) / N;
-      igl::marching_tets(TV_thin, TT_thin, geodesic_distances,  intermediate_isoval, LV, LF);
-      if (LV.rows() == 0) {
+    for (int j = 0; j < N; j++) {
+      const int level = (i - 1) * N + j;
+      if (level_areas[level] <= 0.0) {
         continue;
       }
       found_non_empty = true;
-      RowVector3d ctr = LV.colwise().sum() / LV.rows();
+      RowVector3d ctr = level_ctrs.row(level);
       dist += (ctr - last_ctr).norm();
       last_ctr = ctr;
     }
@@ -188,8 +198,16 @@ double DeformationConstraints::one_pair_bone_constraints(
 //    dist += (ctr - last_ctr).norm();
 //    last_ctr = ctr;
 
-    RowVector3d ctr = last_ctr;
-    const int tet = containing_tet(TV_fat, TT_fat, ctr);
+    ctrs.row(level_dists.size()) = last_ctr;
+    level_dists.push_back(dist);
+  }
+  ctrs.conservativeResize(level_dists.size(), 3);
+  VectorXi ctr_tets;
+  fat_index.containing_tets(ctrs, ctr_tets);
+
+  for (int l = 0; l < int(level_dists.size()); l++) {
+    RowVector3d ctr = ctrs.row(l);
+    const int tet = ctr_tets[l];
     if (tet < 0) {
       cerr << "WARNING: Vertex not in tet" << endl;
       continue;
@@ -202,22 +220,16 @@ double DeformationConstraints::one_pair_bone_constraints(
     if (vmap.find(nv) == vmap.end()) {
       vmap.insert(nv);
       m_bone_constraints_idx.push_back(nv);
-      m_bone_constraints_pos.push_back(straight_origin + dist*straight_dir);
+      m_bone_constraints_pos.push_back(straight_origin + level_dists[l]*straight_dir);
       m_constrainable_tets_idx.push_back(tet);
     }
   }
 
-  ctr_idx = nearest_vertex(TV_fat, TV_thin.row(endpoints[1]));
+  ctr_idx = endpoint_idx[1];
   dist += (TV_fat.row(ctr_idx) - last_ctr).norm();
   m_bone_constraints_idx.push_back(ctr_idx);
   m_bone_constraints_pos.push_back(straight_origin + dist*straight_dir);
-  tet_idx = -1;
-  for (int i = 0; i < TT_fat.rows(); i++) {
-    if (TT_fat(i, 0) == ctr_idx || TT_fat(i, 1) == ctr_idx || TT_fat(i, 2) == ctr_idx || TT_fat(i, 3) == ctr_idx) {
-      tet_idx = i;
-      break;
-    }
-  }
+  tet_idx = fat_index.incident_tet(ctr_idx);
   assert(tet_idx >= 0);
   m_constrainable_tets_idx.push_back(tet_idx);
   return dist;
@@ -240,10 +252,11 @@ double DeformationConstraints::update_bone_constraints(
   const int num_verts_per_segment = int(ceil(double(num_verts) / num_endpoint_pairs));
   assert(num_endpoint_pairs != 0);
 
+  const TetMeshSpatialIndex fat_index(TV_fat, TT_fat);
   vector<MatrixXi> TTcomp;
   split_mesh_components(TT_thin, components, TTcomp);
   for (int i = 0; i < num_endpoint_pairs; i++) {
-    dist += one_pair_bone_constraints(TV_fat, TT_fat, TV_thin, TTcomp[i], geodesic_distances, endpoints[i],
+    dist += one_pair_bone_constraints(TV_fat, TT_fat, fat_index, TV_thin, TTcomp[i], geodesic_distances, endpoints[i],
                                       RowVector3d(0, 0, 1),
                                       RowVector3d(0, 0, dist),
                                       num_verts_per_segment);
@@ -363,9 +376,6 @@ double DeformationConstraints::one_pair_bone_constraints(
   using namespace std;
   using namespace Eigen;
 
-  MatrixXd LV;
-  MatrixXi LF;
-
   unordered_set<int> vmap;
   vmap.max_load_factor(0.5);
   vmap.reserve(num_verts);
@@ -376,48 +386,59 @@ double DeformationConstraints::one_pair_bone_constraints(
   RowVector3d last_ctr = TV.row(endpoints[0]);
   m_bone_constraints_idx.push_back(endpoints[0]);
   m_bone_constraints_pos.push_back(straight_origin);
-  int tet_idx = -1;
-  for (int i = 0; i < TT.rows(); i++) {
-    if (TT(i, 0) == endpoints[0] || TT(i, 1) == endpoints[0] || TT(i, 2) == endpoints[0] || TT(i, 3) == endpoints[0]) {
-      tet_idx = i;
-      break;
-    }
-  }
+  // TT is the component of the endpoints, index it once for all of the levels
+  const TetMeshSpatialIndex index(TV, TT);
+  int tet_idx = index.incident_tet(endpoints[0]);
   assert(tet_idx >= 0);
   m_constrainable_tets_idx.push_back(tet_idx);
 
 
   double dist = 0.0;
-  double isovalue = geodesic_distances[endpoints[0]];
+  const double isovalue_start = geodesic_distances[endpoints[0]];
   const double isovalue_incr = (geodesic_distances[endpoints[1]] - geodesic_distances[endpoints[0]]) / num_verts;
 
-  for(int i = 1; i < num_verts; i++) {
-    isovalue += isovalue_incr;
-    igl::marching_tets(TV, TT, geodesic_distances, isovalue, LV, LF);
+  vector<double> isovalues;
+  for (int i = 1; i < num_verts; i++) {
+    isovalues.push_back(isovalue_start + i * isovalue_incr);
+  }
+  MatrixXd level_ctrs;
+  VectorXd level_areas;
+  level_set_centroids(TV, TT, geodesic_distances, isovalues, level_ctrs, level_areas);
 
-    if (LV.rows() == 0) {
+  vector<double> level_dists;
+  MatrixXd ctrs(num_verts, 3);
+  for(int i = 1; i < num_verts; i++) {
+    if (level_areas[i - 1] <= 0.0) {
       cerr << "WARNING: Empty level set" << endl;
       continue;
     }
 
-    RowVector3d ctr = LV.colwise().sum() / LV.rows();
+    RowVector3d ctr = level_ctrs.row(i - 1);
     dist += (ctr - last_ctr).norm();
     last_ctr = ctr;
+    ctrs.row(level_dists.size()) = ctr;
+    level_dists.push_back(dist);
+  }
+  ctrs.conservativeResize(level_dists.size(), 3);
+  VectorXi ctr_tets;
+  index.containing_tets(ctrs, ctr_tets);
 
-    const int tet = containing_tet(TV, TT, ctr);
+  for (int l = 0; l < int(level_dists.size()); l++) {
+    RowVector3d ctr = ctrs.row(l);
+    const int tet = ctr_tets[l];
     if (tet < 0) {
       cerr << "WARNING: Vertex not in tet" << endl;
       continue;
     }
 
-    Matrix3d v;
+    Eigen::Matrix<double, 4, 3> v;
     for (int k = 0; k < 4; k++) { v.row(k) = TV.row(TT(tet, k)); }
     int nv = TT(tet, nearest_vertex(v, ctr));
 
     if (vmap.find(nv) == vmap.end()) {
       vmap.insert(nv);
       m_bone_constraints_idx.push_back(nv);
-      m_bone_constraints_pos.push_back(straight_origin + dist*straight_dir);
+      m_bone_constraints_pos.push_back(straight_origin + level_dists[l]*straight_dir);
       m_constrainable_tets_idx.push_back(tet);
     }
   }
@@ -425,13 +446,7 @@ double DeformationConstraints::one_pair_bone_constraints(
   dist += (TV.row(endpoints[1]) - last_ctr).norm();
   m_bone_constraints_idx.push_back(endpoints[1]);
   m_bone_constraints_pos.push_back(straight_origin + dist*straight_dir);
-  tet_idx = -1;
-  for (int i = 0; i < TT.rows(); i++) {
-    if (TT(i, 0) == endpoints[1] || TT(i, 1) == endpoints[1] || TT(i, 2) == endpoints[1] || TT(i, 3) == endpoints[1]) {
-      tet_idx = i;
-      break;
-    }
-  }
+  tet_idx = index.incident_tet(endpoints[1]);
   assert(tet_idx >= 0);
   m_constrainable_tets_idx.push_back(tet_idx);
   return dist;
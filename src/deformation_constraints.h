@@ -1,8 +1,6 @@
 #ifndef CONSTRAINTS_H
 #define CONSTRAINTS_H
 
-#include <igl/marching_tets.h>
-
 #include <Eigen/Core>
 
 #include <vector>
@@ -11,6 +9,7 @@
 #include <unordered_set>
 #include <array>
 
+#include "tet_mesh_spatial_index.h"
 
 class DeformationConstraints {
   double one_pair_bone_constraints(
@@ -25,6 +24,7 @@ class DeformationConstraints {
   double one_pair_bone_constraints(
       const Eigen::MatrixXd& TV_fat,
       const Eigen::MatrixXi& TT_fat,
+      const TetMeshSpatialIndex& fat_index,
       const Eigen::MatrixXd& TV_thin,
       const Eigen::MatrixXi& TT_thin,
       const Eigen::VectorXd& geodesic_distances,
@@ -0,0 +1,413 @@
+// unwind-export-bench: measure the throughput of VolumeExporter
+//
+// A synthetic volume is straightened through a synthetic BoundingCage in a hidden window, repeatedly,
+// and the time spent rendering and reading back the slices is reported. Run it before and after a
+// change to the export path to compare them on the same hardware.
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/bounding_cage.h"
+#include "utils/gl/video_memory.h"
+#include "utils/gl/volume_exporter.h"
+#include "utils/memory_tracker.h"
+#include "utils/parallel_for.h"
+#include "utils/trace.h"
+
+namespace {
+
+struct BenchmarkOptions {
+    int volume_size = 256;
+    int num_keyframes = 16;
+    // Output voxels per volume voxel
+    double scale = 1.0;
+    int num_repeats = 3;
+    bool tiled = false;
+    ResampleFilter filter = RESAMPLE_TRILINEAR;
+    std::string output_filename = "export-bench.raw";
+    bool keep_output = false;
+    // JSON file the time of every run is written to, none if empty
+    std::string results_filename;
+    std::string label;
+};
+
+void print_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind-export-bench [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --size S          edge length of the synthetic cubic volume (default: 256)" << std::endl;
+    std::cerr << "  --keyframes N     number of keyframes of the synthetic cage (default: 16)" << std::endl;
+    std::cerr << "  --scale F         output voxels per volume voxel (default: 1)" << std::endl;
+    std::cerr << "  --repeat R        number of timed exports (default: 3)" << std::endl;
+    std::cerr << "  --tiled           use begin_tiled_write instead of update and begin_write" << std::endl;
+    std::cerr << "  --filter F        resampling filter: trilinear (default), bspline or box" << std::endl;
+    std::cerr << "  --output FILE     file the exports are written to (default: export-bench.raw), a .fishvol" << std::endl;
+    std::cerr << "                    file includes the compression, /dev/null excludes the disk" << std::endl;
+    std::cerr << "  --keep            do not delete the output file afterwards" << std::endl;
+    std::cerr << "  --results FILE    JSON file the times of the runs are written to" << std::endl;
+    std::cerr << "  --label L         label stored with the results, e.g. the commit" << std::endl;
+}
+
+bool parse_arguments(int argc, char *argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--size" && has_value) {
+            options.volume_size = std::atoi(argv[++i]);
+        } else if (arg == "--keyframes" && has_value) {
+            options.num_keyframes = std::atoi(argv[++i]);
+        } else if (arg == "--scale" && has_value) {
+            options.scale = std::atof(argv[++i]);
+        } else if (arg == "--repeat" && has_value) {
+            options.num_repeats = std::atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            options.output_filename = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            const std::string filter = argv[++i];
+            if (filter == "trilinear") {
+                options.filter = RESAMPLE_TRILINEAR;
+            } else if (filter == "bspline") {
+                options.filter = RESAMPLE_TRICUBIC_BSPLINE;
+            } else if (filter == "box") {
+                options.filter = RESAMPLE_BOX_MINIFY;
+            } else {
+                std::cerr << "ERROR: Unknown filter '" << filter << "'" << std::endl;
+                return false;
+            }
+        } else if (arg == "--tiled") {
+            options.tiled = true;
+        } else if (arg == "--keep") {
+            options.keep_output = true;
+        } else if (arg == "--results" && has_value) {
+            options.results_filename = argv[++i];
+        } else if (arg == "--label" && has_value) {
+            options.label = argv[++i];
+        } else {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        }
+    }
+    if (options.volume_size < 8 || options.num_keyframes < 2 || options.scale <= 0.0 || options.num_repeats < 1) {
+        std::cerr << "ERROR: Need --size >= 8, --keyframes >= 2, --scale > 0 and --repeat >= 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Smooth blobs on a gradient, so the export is neither constant nor noise (which would make .fishvol
+// compression unrealistically fast or slow)
+GLuint create_synthetic_volume(int size) {
+    const std::size_t n = std::size_t(size);
+    std::vector<std::uint8_t> voxels(n * n * n);
+    parallel_for_chunks(n, [&](std::size_t z_begin, std::size_t z_end, std::size_t) {
+        for (std::size_t z = z_begin; z < z_end; z++) {
+            for (std::size_t y = 0; y < n; y++) {
+                for (std::size_t x = 0; x < n; x++) {
+                    const double u = double(x) / double(n), v = double(y) / double(n), w = double(z) / double(n);
+                    const double blobs = std::sin(12.0 * u) * std::sin(9.0 * v) * std::sin(7.0 * w);
+                    const double value = 96.0 + 64.0 * u + 80.0 * blobs;
+                    voxels[(z * n + y) * n + x] = std::uint8_t(std::max(0.0, std::min(255.0, value)));
+                }
+            }
+        }
+    }, 1);
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    const GLfloat transparent_color[4] = { 0.f, 0.f, 0.f, 0.f };
+    glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, transparent_color);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, size, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, voxels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return texture;
+}
+
+// A bent tube through the volume, with keyframes spread along it until the cage has num_keyframes
+bool build_synthetic_cage(int size, int num_keyframes, BoundingCage& cage) {
+    const double pi = 3.14159265358979323846;
+    const int num_skeleton_vertices = std::max(4 * num_keyframes, 16);
+    Eigen::MatrixXd SV(num_skeleton_vertices, 3);
+    for (int i = 0; i < num_skeleton_vertices; i++) {
+        const double t = double(i) / double(num_skeleton_vertices - 1);
+        SV(i, 0) = size * (0.15 + 0.7 * t);
+        SV(i, 1) = size * (0.5 + 0.15 * std::sin(2.0 * pi * t));
+        SV(i, 2) = size * (0.5 + 0.1 * std::cos(pi * t));
+    }
+    const double rad = 0.2 * size;
+    if (!cage.set_skeleton_vertices(SV, 2, Eigen::Vector4d(-rad, rad, -rad, rad))) {
+        return false;
+    }
+
+    // Keyframes at fractional indices never coincide with the ones fitted to the skeleton
+    for (int i = 1; cage.num_keyframes() < num_keyframes && i < num_keyframes; i++) {
+        const double t = (double(i) - 0.5) / double(num_keyframes - 1);
+        cage.insert_keyframe(cage.min_index() + t * (cage.max_index() - cage.min_index()));
+    }
+    return true;
+}
+
+// Video memory in use by the whole system, see available_video_memory(). Peak usage is only reported where
+// the free memory can be queried.
+class VideoMemoryTracker {
+    std::size_t _baseline = 0;
+    std::size_t _min_available = std::numeric_limits<std::size_t>::max();
+
+public:
+    bool init() { return init_video_memory_query(); }
+
+    bool supported() const { return video_memory_query_supported(); }
+
+    void reset() {
+        if (supported()) {
+            glFinish();
+            _baseline = available_video_memory();
+            _min_available = _baseline;
+        }
+    }
+
+    void sample() {
+        if (supported()) {
+            _min_available = std::min(_min_available, available_video_memory());
+        }
+    }
+
+    // Most memory allocated since reset(), by this process or any other
+    double peak_mib() const {
+        return supported() && _baseline > _min_available ? to_mib(_baseline - _min_available) : 0.0;
+    }
+};
+
+struct RunResult {
+    double render_seconds = 0.0;  // update(), zero for tiled exports which render while writing
+    double write_seconds = 0.0;
+    double peak_vram_mib = 0.0;
+};
+
+bool run_export(VolumeExporter& exporter, BoundingCage& cage, GLuint volume_texture, const BenchmarkOptions& options,
+                const glm::ivec3& output_dims, VideoMemoryTracker& vram, RunResult& result,
+                std::shared_ptr<spdlog::logger> logger) {
+    using clock = std::chrono::high_resolution_clock;
+    const glm::ivec3 volume_dims(options.volume_size);
+
+    vram.reset();
+    const clock::time_point start = clock::now();
+    if (options.tiled) {
+        if (!exporter.begin_tiled_write(cage, volume_texture, nullptr, volume_dims, output_dims,
+                                        options.output_filename, logger)) {
+            return false;
+        }
+    } else {
+        exporter.update(cage, volume_texture, volume_dims);
+        glFinish();
+        vram.sample();
+        result.render_seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (!exporter.begin_write(options.output_filename, logger)) {
+            return false;
+        }
+    }
+
+    const clock::time_point write_start = clock::now();
+    while (exporter.poll_write()) {
+        vram.sample();
+        std::this_thread::yield();
+    }
+    result.write_seconds = std::chrono::duration<double>(clock::now() - write_start).count();
+    result.peak_vram_mib = vram.peak_mib();
+    return exporter.write_succeeded();
+}
+
+void write_json_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool write_results(const BenchmarkOptions& options, const glm::ivec3& output_dims, const std::vector<RunResult>& runs,
+                   std::shared_ptr<spdlog::logger> logger) {
+    std::ofstream out(options.results_filename);
+    out << "{\n  \"label\": ";
+    write_json_string(out, options.label);
+    out << ",\n  \"options\": {"
+        << "\"size\": " << options.volume_size
+        << ", \"keyframes\": " << options.num_keyframes
+        << ", \"scale\": " << options.scale
+        << ", \"tiled\": " << (options.tiled ? "true" : "false")
+        << ", \"filter\": " << int(options.filter)
+        << ", \"output\": ";
+    write_json_string(out, options.output_filename);
+    out << "},\n";
+    out << "  \"output_dims\": [" << output_dims.x << ", " << output_dims.y << ", " << output_dims.z << "],\n";
+    out << "  \"exports\": [\n";
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        out << "    {\"render_seconds\": " << runs[i].render_seconds << ", \"write_seconds\": " << runs[i].write_seconds
+            << ", \"peak_vram_mib\": " << runs[i].peak_vram_mib << "}" << (i + 1 < runs.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    if (!out) {
+        logger->error("Cannot write the results to '{}'", options.results_filename);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    if (!parse_arguments(argc, argv, options)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_mt("unwind-export-bench");
+    trace::init(logger);
+
+    if (!glfwInit()) {
+        logger->error("Failed to initialize GLFW");
+        return EXIT_FAILURE;
+    }
+    // Same context as the viewer, but the window is never shown
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "unwind-export-bench", nullptr, nullptr);
+    if (!window) {
+        logger->error("Failed to create an OpenGL 3.2 core context");
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        logger->error("Failed to load the OpenGL functions");
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    logger->info("Renderer: {} ({})", reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+                 reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+
+    BoundingCage cage;
+    cage.set_logger(logger);
+    if (!build_synthetic_cage(options.volume_size, options.num_keyframes, cage)) {
+        logger->error("Failed to fit the synthetic cage");
+        return EXIT_FAILURE;
+    }
+    std::vector<double> kf_depths;
+    cage.keyframe_depths(kf_depths);
+    const Eigen::Vector4d kfbb = cage.keyframe_bounding_box();
+    const glm::ivec3 output_dims(std::max(int((kfbb[1] - kfbb[0]) * options.scale), 1),
+                                 std::max(int((kfbb[3] - kfbb[2]) * options.scale), 1),
+                                 std::max(int(kf_depths.back() * options.scale), 1));
+    const double output_bytes = double(output_dims.x) * double(output_dims.y) * double(output_dims.z);
+
+    VideoMemoryTracker vram;
+    if (!vram.init()) {
+        logger->warn("Neither GL_NVX_gpu_memory_info nor GL_ATI_meminfo is available, peak VRAM is not measured");
+    }
+    memory_tracker().set_logger(logger);
+    // An export texture that does not fit in the video memory left is not worth timing, write it in slabs instead
+    if (!options.tiled && !memory_tracker().check("The export texture", 0, std::size_t(output_bytes))) {
+        logger->warn("Falling back to a tiled export");
+        options.tiled = true;
+    }
+
+    const GLuint volume_texture = create_synthetic_volume(options.volume_size);
+    VolumeExporter exporter;
+    // Tiled exports never touch the export texture, so it does not need the full size
+    if (options.tiled) {
+        exporter.init(1, 1, 1);
+    } else {
+        exporter.init(output_dims.x, output_dims.y, output_dims.z);
+    }
+    exporter.set_filter(options.filter);
+
+    logger->info("Exporting a {}^3 volume through {} keyframes into {} x {} x {} ({:.1f} MiB), {} export",
+                 options.volume_size, cage.num_keyframes(), output_dims.x, output_dims.y, output_dims.z,
+                 output_bytes / (1024.0 * 1024.0), options.tiled ? "tiled" : "full");
+
+    // An untimed run compiles the driver's shader variants and warms the file cache
+    RunResult warmup;
+    bool ok = run_export(exporter, cage, volume_texture, options, output_dims, vram, warmup, logger);
+
+    double best_seconds = std::numeric_limits<double>::max(), total_seconds = 0.0;
+    double best_write_seconds = std::numeric_limits<double>::max(), total_write_seconds = 0.0;
+    double peak_vram_mib = 0.0;
+    std::vector<RunResult> runs;
+    for (int r = 0; ok && r < options.num_repeats; r++) {
+        RunResult result;
+        ok = run_export(exporter, cage, volume_texture, options, output_dims, vram, result, logger);
+        if (!ok) {
+            break;
+        }
+        runs.push_back(result);
+        const double seconds = result.render_seconds + result.write_seconds;
+        best_seconds = std::min(best_seconds, seconds);
+        total_seconds += seconds;
+        best_write_seconds = std::min(best_write_seconds, result.write_seconds);
+        total_write_seconds += result.write_seconds;
+        peak_vram_mib = std::max(peak_vram_mib, result.peak_vram_mib);
+        logger->info("Run {}: render {:.1f} ms, read back and write {:.1f} ms, {:.1f} slices/s, {:.3f} GB/s",
+                     r + 1, 1000.0 * result.render_seconds, 1000.0 * result.write_seconds,
+                     output_dims.z / seconds, output_bytes / result.write_seconds / 1e9);
+    }
+
+    if (ok) {
+        const double mean_seconds = total_seconds / options.num_repeats;
+        logger->info("Best {:.1f} ms, mean {:.1f} ms", 1000.0 * best_seconds, 1000.0 * mean_seconds);
+        logger->info("Slices/s: {:.1f} (best), {:.1f} (mean)", output_dims.z / best_seconds, output_dims.z / mean_seconds);
+        // Tiled exports render while they read back, so their rate includes the rendering
+        logger->info("Readback GB/s: {:.3f} (best), {:.3f} (mean)", output_bytes / best_write_seconds / 1e9,
+                     output_bytes / (total_write_seconds / options.num_repeats) / 1e9);
+        if (vram.supported()) {
+            logger->info("Peak VRAM: {:.1f} MiB", peak_vram_mib);
+        }
+        if (!options.results_filename.empty()) {
+            ok = write_results(options, output_dims, runs, logger);
+        }
+    } else {
+        logger->error("Export to '{}' failed", options.output_filename);
+    }
+
+    exporter.destroy();
+    glDeleteTextures(1, &volume_texture);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    if (!options.keep_output && options.output_filename != "/dev/null") {
+        std::remove(options.output_filename.c_str());
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
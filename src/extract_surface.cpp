@@ -1,12 +1,14 @@
-#include <igl/copyleft/marching_cubes.h>
-#include <igl/components.h>
 #include <igl/readOFF.h>
 #include <igl/writeOFF.h>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include "datfile.h"
+#include "marching_cubes.h"
+#include "utils.h"
 
 
 bool compute_surface_mesh(DatFile& datfile,
@@ -22,14 +24,14 @@ bool compute_surface_mesh(DatFile& datfile,
   }
   assert(datfile.m_format == string("UINT8"));
 
-  const size_t num_datfile_bytes = datfile.w * datfile.h * datfile.d;
-  char* data = new char[num_datfile_bytes];
+  const size_t num_datfile_bytes = size_t(datfile.w) * datfile.h * datfile.d;
+  std::vector<char> data(num_datfile_bytes);
   ifstream rawfile(raw_filename, std::ifstream::binary);
   if (!rawfile.good()) {
     cerr << "ERROR: RawFile '" << raw_filename << "' does not exist." << endl;
     return false;
   }
-  rawfile.read(data, num_datfile_bytes);
+  rawfile.read(data.data(), num_datfile_bytes);
   if (!rawfile) {
     cout << "ERROR: Only read " << rawfile.gcount() <<
             " bytes from Raw File '" << datfile.m_raw_filename <<
@@ -39,34 +41,23 @@ bool compute_surface_mesh(DatFile& datfile,
   }
   rawfile.close();
 
-  cout << "Generating Marching Cubes Input..." << endl;
-  Eigen::MatrixXd GP((datfile.w+2)*(datfile.h+2)*(datfile.d+2), 3);
-  Eigen::VectorXd SV(GP.rows());
-
-  int readcount = 0;
-  int appendcount = 0;
-  for (int zi = 0; zi < datfile.d+2; zi++) {
-    for (int yi = 0; yi < datfile.h+2; yi++) {
-      for (int xi = 0; xi < datfile.w+2; xi++) {
-        if (xi == 0 || yi == 0 || zi == 0 || xi == (datfile.w+1) ||
-            yi == (datfile.h+1) || zi == (datfile.d+1)) {
-          SV[readcount] = -1.0;
-        } else {
-          SV[readcount] = double((unsigned char)(data[appendcount]));
-          appendcount += 1;
-        }
-        GP.row(readcount) = Eigen::RowVector3d(xi, yi, zi);
-        readcount += 1;
-      }
+  // The volume padded by one voxel of -1 on each side, so the surface is closed where the volume touches its
+  // boundary. Grid point (x, y, z) is voxel (x - 1, y - 1, z - 1).
+  MarchingCubesGrid grid;
+  grid.dims = Eigen::Vector3i(datfile.w+2, datfile.h+2, datfile.d+2);
+  const unsigned char* voxels = reinterpret_cast<const unsigned char*>(data.data());
+  auto padded_value = [&](int x, int y, int z) -> int {
+    if (x == 0 || y == 0 || z == 0 || x == datfile.w+1 || y == datfile.h+1 || z == datfile.d+1) {
+      return -1;
     }
-  }
-  delete data;
+    return voxels[(x-1) + size_t(datfile.w) * ((y-1) + size_t(datfile.h) * (z-1))];
+  };
 
   datfile.m_bb_min = Eigen::RowVector3d(1.0, 1.0, 1.0);
   datfile.m_bb_max = Eigen::RowVector3d(datfile.w, datfile.h, datfile.d);
 
   cout << "Running Marching Cubes..." << endl;
-  igl::copyleft::marching_cubes(SV, GP, datfile.w+2, datfile.h+2, datfile.d+2, V, F);
+  marching_cubes(grid, padded_value, 0.0, V, F);
 
   cout << "Marching cubes odel has " << V.rows() << " vertices and " <<
           F.rows() << " faces." << endl;
@@ -81,58 +72,35 @@ void remove_garbage_components(const Eigen::MatrixXd& V,
 
   cout << "Computing connected components..." << endl;
   Eigen::VectorXi components;
-  igl::components(F, components);
+  mesh_components(F, int(V.rows()), components);
 
   cout << "Counting connected components..." << endl;
   vector<int> component_count;
-  component_count.resize(components.maxCoeff());
-  for (int i = 0; i < V.rows(); i++) {
-    component_count[components[i]] += 1;
-  }
+  component_sizes(components, component_count);
   cout << "The model has " << component_count.size() <<
           " connected components." << endl;
+  if (component_count.empty()) {
+    newF.resize(0, 3);
+    return;
+  }
 
   cout << "Finding component with most vertices..." << endl;
-  int max_component = -1;
-  int min_component = -1;
-  int max_component_count = std::numeric_limits<int>::min();
-  int min_component_count = std::numeric_limits<int>::max();
-  for (int i = 0; i < component_count.size(); i++) {
-    if (max_component_count < component_count[i]) {
-      max_component = i;
-      max_component_count = component_count[i];
-    }
-    if (min_component_count > component_count[i]) {
-      min_component = i;
-      min_component_count = component_count[i];
-    }
-  }
+  const auto minmax = std::minmax_element(component_count.begin(), component_count.end());
+  const int min_component = int(minmax.first - component_count.begin());
+  const int max_component = int(minmax.second - component_count.begin());
+  const int min_component_count = *minmax.first;
+  const int max_component_count = *minmax.second;
   cout << "Component " << max_component <<
           " has the most vertices with a count of " <<
           max_component_count << endl;
   cout << "Component " << min_component << " has the fewest vertices with a count of " << min_component_count << endl;
 
   cout << "Deleting smaller components..." << endl;
-  newF.resize(F.rows(), 3);
-
   int keep_thresh_count = min_component_count + int(keep_thresh*(max_component_count - min_component_count));
-  int fcount = 0;
-  for(int i = 0; i < F.rows(); i++) {
-    bool keep = true;
-    for (int j = 0; j < 3; j++) {
-      if (component_count[components[F(i, j)]] < keep_thresh_count) {
-        keep = false;
-        break;
-      }
-    }
-    if (keep) {
-      newF.row(fcount++) = F.row(i);
-    }
-  }
+  keep_large_components(F, components, component_count, keep_thresh_count, newF);
 
-  cout << "Final model has " << fcount << " faces and " <<
-          newF.maxCoeff() << " vertices." << endl;
-  newF.conservativeResize(fcount, 3);
+  cout << "Final model has " << newF.rows() << " faces and " <<
+          (newF.size() > 0 ? newF.maxCoeff() : 0) << " vertices." << endl;
 }
 
 
@@ -8,6 +8,18 @@
 #include "ui/endpoint_selection_plugin.h"
 #include "ui/bounding_polygon_plugin.h"
 #include "ui/state.h"
+#include "ui/frame_timing_plugin.h"
+#include "ui/render_benchmark.h"
+#include "ui/input_replay.h"
+#include "utils/gl/gpu_profiler.h"
+#include "utils/gl/shader_cache.h"
+#include "utils/gl/video_memory.h"
+#include "utils/edit_latency.h"
+#include "utils/frame_timer.h"
+#include "utils/memory_tracker.h"
+#include "utils/metrics.h"
+#include "utils/task_scheduler.h"
+#include "utils/trace.h"
 #include "Logger.hpp"
 
 State _state;
@@ -18,6 +30,11 @@ Selection_Menu selection_menu(_state);
 Meshing_Menu meshing_menu(_state);
 EndPoint_Selection_Menu endpoint_selection_menu(_state);
 Bounding_Polygon_Menu bounding_polygon_menu(_state);
+FrameTimingPlugin frame_timing;
+RenderBenchmark render_benchmark(_state, initial_file_selection, bounding_polygon_menu);
+InputRecorder input_recorder(_state);
+InputReplay input_replay(_state, initial_file_selection);
+std::string record_input_filename;
 
 
 void log_opengl_debug(GLenum source, GLenum type, GLuint id, GLenum severity,
@@ -45,22 +62,106 @@ bool init(igl::opengl::glfw::Viewer& viewer) {
     meshing_menu.init(&viewer);
     endpoint_selection_menu.init(&viewer);
     bounding_polygon_menu.init(&viewer);
+    input_recorder.init(&viewer);
 
+    viewer.plugins.push_back(&input_recorder);
     viewer.plugins.push_back(&initial_file_selection);
+    frame_timing.set_screen("File selection");
+    viewer.plugins.push_back(&frame_timing);
 
     _state.logger = spdlog::stdout_color_mt(FISH_LOGGER_NAME);
     _state.logger->set_level(FISH_LOGGER_LEVEL);
     _state.cage.set_logger(_state.logger);
+    trace::init(_state.logger);
+    metrics::init(_state.logger);
+    init_task_scheduler(_state.logger);
 
     std::shared_ptr<spdlog::logger> ct_logger = spdlog::stdout_color_mt(CONTOURTREE_LOGGER_NAME);
     ct_logger->set_level(CONTOURTREE_LOGGER_LEVEL);
     contourtree::Logger::setLogger(ct_logger);
 
     init_opengl_debugging(log_opengl_debug);
+    gpu_profiler().set_logger(_state.logger);
+    memory_tracker().set_logger(_state.logger);
+    edit_latency().set_logger(_state.logger);
+    init_video_memory_query();
+    init_shader_cache(default_shader_cache_directory(), _state.logger);
+
+    // The viewer only draws when an event arrives or the scheduler posts one, at most once per refresh
+    glfwSwapInterval(1);
+    int refresh_rate = 60;
+    if (GLFWmonitor* monitor = glfwGetPrimaryMonitor()) {
+        if (const GLFWvidmode* mode = glfwGetVideoMode(monitor)) {
+            refresh_rate = mode->refreshRate;
+        }
+    }
+    _state.redraw.set_max_fps(refresh_rate);
+    // The progress of the background jobs does not need more than a few updates per second
+    _state.redraw.set_min_interval(RedrawScheduler::BackgroundJobs, 0.1);
+    _state.redraw.set_wake(glfwPostEmptyEvent);
+
+    if (render_benchmark.enabled()) {
+        frame_timing.set_frame_end_callback([&viewer]() { render_benchmark.frame_end(viewer); });
+        render_benchmark.init(viewer);
+    } else if (input_replay.enabled()) {
+        frame_timing.set_frame_end_callback([&viewer]() { input_replay.frame_end(viewer); });
+        input_replay.init(viewer);
+    } else if (!record_input_filename.empty()) {
+        input_recorder.start(record_input_filename);
+    }
+    return false;
+}
+
+bool key_down(igl::opengl::glfw::Viewer& viewer, unsigned int key, int modifiers) {
+    if (key == GLFW_KEY_F10) {
+        const bool enable = !gpu_profiler().enabled();
+        if (!gpu_profiler().set_enabled(enable)) {
+            _state.logger->warn("GPU profiling needs timer queries, which require OpenGL 3.3");
+        }
+        return true;
+    }
+    if (key == GLFW_KEY_F8) {
+        frame_timer().set_overlay_enabled(!frame_timer().overlay_enabled());
+        _state.redraw.request(RedrawScheduler::ImGui);
+        return true;
+    }
+    if (key == RECORD_INPUT_KEY && !input_replay.enabled()) {
+        if (input_recorder.recording()) {
+            input_recorder.stop();
+        } else {
+            input_recorder.start(INPUT_LOG_FILENAME);
+        }
+        return true;
+    }
+    if (key == GLFW_KEY_F7) {
+        append_camera_keyframe(viewer.core, CAMERA_PATH_FILENAME, *_state.logger);
+        return true;
+    }
+    if (key == GLFW_KEY_F9) {
+        const bool enable = !memory_tracker().overlay_enabled();
+        memory_tracker().set_overlay_enabled(enable);
+        if (enable) {
+            _state.report_memory_usage();
+            memory_tracker().log();
+        }
+        _state.redraw.request(RedrawScheduler::ImGui);
+        return true;
+    }
     return false;
 }
 
 bool pre_draw(igl::opengl::glfw::Viewer& viewer) {
+    frame_timer().begin_frame();
+    _state.redraw.begin_frame();
+    gpu_profiler().new_frame();
+    if (gpu_profiler().enabled() || frame_timer().overlay_enabled()) {
+        // Keep the timings of the overlay up to date
+        _state.redraw.request(RedrawScheduler::ImGui);
+    }
+    if (memory_tracker().overlay_enabled()) {
+        _state.report_memory_usage();
+    }
+
     if (previous_state != _state.application_state) {
 
         switch (previous_state) {
@@ -79,49 +180,89 @@ bool pre_draw(igl::opengl::glfw::Viewer& viewer) {
         }
 
         viewer.plugins.clear();
+        viewer.plugins.push_back(&input_recorder);
 
         switch (_state.application_state) {
             case Application_State::Initial_File_Selection:
                 initial_file_selection.initialize();
                 viewer.plugins.push_back(&initial_file_selection);
+                frame_timing.set_screen("File selection");
                 break;
             case Application_State::Segmentation:
                 selection_menu.initialize();
                 viewer.plugins.push_back(&selection_menu);
+                frame_timing.set_screen("Segmentation");
                 break;
             case Application_State::Meshing:
                 meshing_menu.initialize();
                 viewer.plugins.push_back(&meshing_menu);
+                frame_timing.set_screen("Meshing");
                 break;
             case Application_State::EndPointSelection:
                 endpoint_selection_menu.initialize();
                 viewer.plugins.push_back(&endpoint_selection_menu);
+                frame_timing.set_screen("Endpoint selection");
                 break;
             case Application_State::BoundingPolygon:
                 bounding_polygon_menu.initialize();
                 viewer.plugins.push_back(&bounding_polygon_menu);
+                frame_timing.set_screen("Bounding polygon");
                 break;
         }
+        viewer.plugins.push_back(&frame_timing);
 
         previous_state = _state.application_state;
 
-        glfwPostEmptyEvent();
+        _state.redraw.request(RedrawScheduler::ImGui);
         return true;
     }
 
+    render_benchmark.pre_draw(viewer);
+    input_replay.pre_draw(viewer);
+    frame_timer().mark("Application state");
+    return false;
+}
+
+bool post_draw(igl::opengl::glfw::Viewer& viewer) {
+    // Between the pre_draw and post_draw of the plugins the viewer draws its meshes
+    frame_timer().mark("Viewer meshes");
     return false;
 }
 
 int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--bench-render") {
+        RenderBenchmarkOptions options;
+        if (!parse_render_benchmark_arguments(argc - 2, argv + 2, options)) {
+            print_render_benchmark_usage();
+            return EXIT_FAILURE;
+        }
+        render_benchmark.set_options(options);
+    } else if (argc > 1 && std::string(argv[1]) == "--replay-input") {
+        InputReplayOptions options;
+        if (!parse_input_replay_arguments(argc - 2, argv + 2, options)) {
+            print_input_replay_usage();
+            return EXIT_FAILURE;
+        }
+        input_replay.set_options(options);
+    } else if (argc > 2 && std::string(argv[1]) == "--record-input") {
+        record_input_filename = argv[2];
+    }
+
     previous_state = Application_State::NoState;
     igl::opengl::glfw::Viewer viewer;
     // viewer.core.background_color = Eigen::Vector4f(0.1f, 0.1f, 0.1f, 1.f);
     viewer.core.background_color = Eigen::Vector4f(1.f, 1.f, 1.f, 1.f);
     // viewer.core.background_color = Eigen::Vector4f(0.8f, 0.8f, 0.8f, 1.f);
-    viewer.core.is_animating = true;
+    // Frames are drawn on demand, see RedrawScheduler
+    viewer.core.is_animating = false;
     viewer.callback_init = init;
     viewer.callback_pre_draw = pre_draw;
+    viewer.callback_post_draw = post_draw;
+    viewer.callback_key_down = key_down;
     viewer.launch();
+    _state.redraw.shutdown();
+    input_recorder.stop();
+    frame_timer().log(*_state.logger);
 
-    return EXIT_SUCCESS;
+    return render_benchmark.failed() || input_replay.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
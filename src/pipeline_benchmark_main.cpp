@@ -0,0 +1,534 @@
+// unwind-pipeline-bench: run the whole pipeline on a synthetic fish, without the UI
+//
+// A bent, tapering tube stands in for the scan and its voxels are split along the body into arcs of a fake
+// contour tree segmentation, next to a few blobs that are not selected. The fish then goes through the same
+// steps as in the viewer: the selected arcs are turned into dexels, dilated, sampled into a signed distance
+// field and tetrahedralized, the geodesic distance between its ends gives the skeleton, the cage is fit to the
+// skeleton and the volume is straightened through it on the CPU. The wall time, the peak resident memory and
+// the sizes of the outputs of every stage are written to a JSON file, to be compared from commit to commit.
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+#include "make_tet_mesh.h"
+#include "sdf.h"
+
+#include "utils/background_job.h"
+#include "utils/bounding_cage.h"
+#include "utils/cpu_straightener.h"
+#include "utils/dexel_meshing.h"
+#include "utils/geodesic_solver.h"
+#include "utils/metrics.h"
+#include "utils/octree_tet_mesh.h"
+#include "utils/parallel_for.h"
+#include "utils/quality_metrics.h"
+#include "utils/row_major.h"
+#include "utils/skeleton_extraction.h"
+#include "utils/tet_mesh_optimization.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+#include <vor3d/Parallel.h>
+#include <vor3d/VoronoiVorPower.h>
+
+namespace {
+
+struct BenchmarkOptions {
+    // Length of the fish, the volume is size x 3/8 size x 3/8 size voxels
+    int fish_length = 256;
+    int num_arcs = 32;
+    // Same defaults as the meshing and endpoint selection screens
+    double dilation_radius = 3.0;
+    double meshing_voxel_radius = 1.5;
+    bool adaptive_meshing = false;
+    int adaptive_max_cell_size = 8;
+    // Time budget of the tet mesh optimization, 0 skips it
+    double optimize_seconds = 0.0;
+    int num_skeleton_vertices = 100;
+    int num_smoothing_iters = 50;
+    // 0 uses every core
+    int num_threads = 0;
+    std::string output_filename = "pipeline-bench.json";
+    // Written into the results as is, e.g. the commit the benchmark was built from
+    std::string label;
+};
+
+void print_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind-pipeline-bench [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --size S          length of the synthetic fish in voxels (default: 256)" << std::endl;
+    std::cerr << "  --arcs N          number of arcs the fish is segmented into (default: 32)" << std::endl;
+    std::cerr << "  --dilation R      dilation radius in voxels (default: 3)" << std::endl;
+    std::cerr << "  --voxel-radius D  spacing of the signed distance field in voxels (default: 1.5)" << std::endl;
+    std::cerr << "  --adaptive        tetrahedralize on an octree instead of with quartet" << std::endl;
+    std::cerr << "  --max-cell C      largest octree cell in grid steps with --adaptive (default: 8)" << std::endl;
+    std::cerr << "  --optimize S      smooth the tet mesh for up to S seconds (default: 0, off)" << std::endl;
+    std::cerr << "  --skeleton N      number of skeleton vertices (default: 100)" << std::endl;
+    std::cerr << "  --smoothing N     smoothing iterations of the skeleton (default: 50)" << std::endl;
+    std::cerr << "  --threads T       threads of the dilation, 0 for every core (default: 0)" << std::endl;
+    std::cerr << "  --output FILE     JSON file the results are written to (default: pipeline-bench.json)" << std::endl;
+    std::cerr << "  --label L         label stored with the results, e.g. the commit" << std::endl;
+}
+
+bool parse_arguments(int argc, char *argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--size" && has_value) {
+            options.fish_length = std::atoi(argv[++i]);
+        } else if (arg == "--arcs" && has_value) {
+            options.num_arcs = std::atoi(argv[++i]);
+        } else if (arg == "--dilation" && has_value) {
+            options.dilation_radius = std::atof(argv[++i]);
+        } else if (arg == "--voxel-radius" && has_value) {
+            options.meshing_voxel_radius = std::atof(argv[++i]);
+        } else if (arg == "--adaptive") {
+            options.adaptive_meshing = true;
+        } else if (arg == "--max-cell" && has_value) {
+            options.adaptive_max_cell_size = std::atoi(argv[++i]);
+        } else if (arg == "--optimize" && has_value) {
+            options.optimize_seconds = std::atof(argv[++i]);
+        } else if (arg == "--skeleton" && has_value) {
+            options.num_skeleton_vertices = std::atoi(argv[++i]);
+        } else if (arg == "--smoothing" && has_value) {
+            options.num_smoothing_iters = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            options.num_threads = std::atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            options.output_filename = argv[++i];
+        } else if (arg == "--label" && has_value) {
+            options.label = argv[++i];
+        } else {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        }
+    }
+    if (options.fish_length < 64 || options.num_arcs < 1 || options.dilation_radius < 0.0 ||
+            options.meshing_voxel_radius <= 0.0 || options.adaptive_max_cell_size < 1 ||
+            options.optimize_seconds < 0.0 || options.num_skeleton_vertices < 2 || options.num_smoothing_iters < 0 ||
+            options.num_threads < 0) {
+        std::cerr << "ERROR: Need --size >= 64, --arcs >= 1, --dilation >= 0, --voxel-radius > 0, --max-cell >= 1, "
+                     "--optimize >= 0, --skeleton >= 2, --smoothing >= 0 and --threads >= 0" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Peak resident memory of the process. On Linux the peak is reset by reset_peak_rss(), so it is the peak of
+// what ran since. Elsewhere it is the peak since the process started.
+std::size_t peak_rss_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::size_t(std::strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+        }
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return std::size_t(usage.ru_maxrss);
+#else
+    return std::size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void reset_peak_rss() {
+#if defined(__linux__)
+    // Resets VmHWM to the current resident size
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+// The synthetic scan: intensities, ids of the fake segmentation (0 for the background) and the ids of the fish
+struct SyntheticFish {
+    Eigen::RowVector3i dims;
+    std::vector<std::uint8_t> volume_data;
+    std::vector<std::uint32_t> index_data;
+    std::vector<bool> fish_arcs;
+    // Ends of the centerline and the largest radius of the body, in voxels
+    Eigen::RowVector3d head, tail;
+    double max_radius = 0.0;
+};
+
+// Fish along x whose elliptic cross-section tapers towards both ends and whose centerline bends in y and z.
+// Voxels of the body get the id 1 + the index of the arc the length of the body is cut into, a few blobs
+// around it get ids above the ones of the arcs.
+void make_synthetic_fish(int length, int num_arcs, SyntheticFish& fish) {
+    const double pi = 3.14159265358979323846;
+    const int w = length, h = std::max(3 * length / 8, 16), d = h;
+    fish.dims = Eigen::RowVector3i(w, h, d);
+    fish.volume_data.assign(std::size_t(w) * h * d, 0);
+    fish.index_data.assign(std::size_t(w) * h * d, 0);
+    fish.fish_arcs.assign(num_arcs + 1, true);
+    fish.fish_arcs[0] = false;
+
+    const double ry = 0.1 * length, rz = 0.07 * length;
+    fish.max_radius = ry;
+    // s in [0, 1] from the head to the tail
+    const double x_begin = 0.05 * w, x_end = 0.95 * w;
+    auto centerline = [&](double s) {
+        return Eigen::RowVector3d(x_begin + s * (x_end - x_begin),
+                                  0.5 * h + 0.05 * length * std::sin(2.0 * pi * s),
+                                  0.5 * d + 0.03 * length * std::sin(pi * s));
+    };
+    fish.head = centerline(0.02);
+    fish.tail = centerline(0.98);
+
+    const int num_blobs = 4;
+    const double blob_radius = 0.03 * length;
+    auto blob_center = [&](int b) {
+        return Eigen::RowVector3d((0.2 + 0.2 * b) * w, b % 2 == 0 ? 0.1 * h : 0.9 * h, 0.5 * d);
+    };
+
+    parallel_for_chunks(std::size_t(d), [&](std::size_t z_begin, std::size_t z_end, std::size_t) {
+        for (int z = int(z_begin); z < int(z_end); z++) {
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    const std::size_t i = (std::size_t(z) * h + y) * w + x;
+                    const Eigen::RowVector3d p(x + 0.5, y + 0.5, z + 0.5);
+                    // Noise of a few levels on the background, from a hash of the voxel
+                    std::uint32_t hash = std::uint32_t(i) * 2654435761u;
+                    hash ^= hash >> 16;
+                    std::uint8_t value = std::uint8_t(12 + (hash & 15));
+                    std::uint32_t id = 0;
+
+                    const double s = (p[0] - x_begin) / (x_end - x_begin);
+                    if (s > 0.0 && s < 1.0) {
+                        const double profile = std::sqrt(std::sin(pi * s));
+                        const Eigen::RowVector3d c = centerline(s);
+                        const double ey = (p[1] - c[1]) / (ry * profile), ez = (p[2] - c[2]) / (rz * profile);
+                        const double e = ey * ey + ez * ez;
+                        if (e < 1.0) {
+                            value = std::uint8_t(140.0 + 100.0 * (1.0 - e));
+                            id = 1 + std::uint32_t(std::min(int(s * num_arcs), num_arcs - 1));
+                        }
+                    }
+                    for (int b = 0; id == 0 && b < num_blobs; b++) {
+                        if ((p - blob_center(b)).norm() < blob_radius) {
+                            value = 120;
+                            id = std::uint32_t(num_arcs + 1 + b);
+                        }
+                    }
+                    fish.volume_data[i] = value;
+                    fish.index_data[i] = id;
+                }
+            }
+        }
+    }, 1);
+}
+
+struct StageResult {
+    std::string name;
+    double seconds = 0.0;
+    std::size_t peak_rss = 0;
+};
+
+// Outputs of the pipeline and their sizes
+struct PipelineRun {
+    SyntheticFish fish;
+    vor3d::CompressedVolume selected_dexels, dilated_dexels;
+    Eigen::Vector3i sdf_dims = Eigen::Vector3i::Zero();
+    // Memory of the distance grid, dense for Quartet and a narrow band for the adaptive meshing
+    std::size_t sdf_bytes = 0;
+    Eigen::MatrixXd TV;
+    Eigen::MatrixXi TT;
+    Eigen::VectorXi connected_components;
+    TetMeshOptimization optimization;
+    TetMeshQuality tet_quality;
+    ComponentGeodesics geodesics;
+    std::vector<std::pair<int, int>> component_endpoints;
+    Eigen::VectorXd geodesic_dists;
+    Eigen::MatrixXd skeleton_vertices;
+    BoundingCage cage;
+    Eigen::RowVector3i output_dims = Eigen::RowVector3i::Zero();
+    std::size_t exported_bytes = 0;
+
+    // Peak memory of the stages so far, the times come from the stages of the job
+    std::vector<std::size_t> stage_peak_rss;
+};
+
+// The steps of the meshing, endpoint selection and cage screens, as their jobs run them
+bool run_pipeline(const BenchmarkOptions& options, PipelineRun& run, JobContext& context,
+                  std::shared_ptr<spdlog::logger> logger) {
+    bool in_stage = false;
+    auto begin_stage = [&](const char* name) {
+        if (in_stage) {
+            run.stage_peak_rss.push_back(peak_rss_bytes());
+        }
+        reset_peak_rss();
+        context.begin_stage(name);
+        in_stage = true;
+    };
+
+    begin_stage("Generating the synthetic fish");
+    make_synthetic_fish(options.fish_length, options.num_arcs, run.fish);
+
+    begin_stage("Extracting the selected features");
+    if (!select_index_dexels(run.fish.index_data.data(), run.fish.dims, run.fish.fish_arcs, run.selected_dexels,
+                             context)) {
+        return false;
+    }
+
+    begin_stage("Dilating the selected volume");
+    vor3d::ParallelSettings parallel_settings = vor3d::parallelSettings();
+    parallel_settings.num_threads = options.num_threads;
+    vor3d::setParallelSettings(parallel_settings);
+    vor3d::VoronoiMorphoVorPower op = vor3d::VoronoiMorphoVorPower();
+    double time_1;
+    double time_2;
+    op.dilation(run.selected_dexels, run.dilated_dexels, options.dilation_radius, time_1, time_2);
+
+    begin_stage("Computing the signed distance");
+    const float dx = float(options.meshing_voxel_radius);
+    Eigen::Vector3d grid_origin;
+    if (!dexel_distance_grid(run.dilated_dexels, dx, grid_origin, run.sdf_dims)) {
+        logger->error("The dilated volume is empty!");
+        return false;
+    }
+    const Vec3f origin(grid_origin[0], grid_origin[1], grid_origin[2]);
+    grid_origin = Eigen::Vector3d(origin[0], origin[1], origin[2]);
+    if (options.adaptive_meshing) {
+        SparseGrid<float> phi;
+        const double band = octree_band(options.adaptive_max_cell_size) * dx;
+        if (!dexels_to_sparse_signed_distance(run.dilated_dexels, grid_origin, dx, run.sdf_dims, band, phi,
+                                              context)) {
+            return false;
+        }
+        run.sdf_bytes = phi.num_bytes();
+
+        begin_stage("Tetrahedralizing");
+        SampledDistanceField field;
+        field.origin = grid_origin;
+        field.dx = dx;
+        field.dims = run.sdf_dims;
+        field.sparse_phi = &phi;
+        if (!make_octree_tet_mesh(field, options.adaptive_max_cell_size, run.TV, run.TT)) {
+            logger->error("Adaptive tet mesh of the dilated volume is empty!");
+            return false;
+        }
+    } else {
+        SDF sdf(origin, dx, run.sdf_dims[0], run.sdf_dims[1], run.sdf_dims[2]);
+        if (!dexels_to_signed_distance(run.dilated_dexels, grid_origin, dx, run.sdf_dims, &sdf.phi(0, 0, 0),
+                                       context)) {
+            return false;
+        }
+        run.sdf_bytes = std::size_t(run.sdf_dims.prod()) * sizeof(float);
+
+        begin_stage("Tetrahedralizing");
+        TetMesh mesh;
+        make_tet_mesh(mesh, sdf, false /*optimize*/, false /*intermediate*/, false /*unsafe*/);
+        quartet_to_eigen(mesh, run.TV, run.TT);
+    }
+    static metrics::Counter& tets_generated =
+        metrics::counter("unwind_tets_generated_total", "Tets of the meshes of the dilated volumes");
+    tets_generated.add(std::uint64_t(run.TT.rows()));
+    reorder_tet_mesh(run.TV, run.TT);
+    mesh_components(run.TT, int(run.TV.rows()), run.connected_components);
+    if (options.optimize_seconds > 0.0) {
+        begin_stage("Optimizing the tet mesh");
+        Eigen::MatrixXi TF;
+        tet_mesh_faces(run.TT, TF);
+        // As many sweeps as the meshing screen allows
+        const int max_sweeps = 50;
+        if (!optimize_tet_mesh(run.TV, run.TT, TF, options.optimize_seconds, max_sweeps, run.optimization, context)) {
+            return false;
+        }
+    }
+    run.tet_quality = tet_mesh_quality(run.TV, run.TT);
+
+    // The endpoints are the vertices closest to the ends of the centerline, where a user would click
+    begin_stage("Computing the geodesic distances");
+    const int head = nearest_vertex(run.TV, run.fish.head), tail = nearest_vertex(run.TV, run.fish.tail);
+    const int comp = run.connected_components[head];
+    if (run.connected_components[tail] != comp) {
+        logger->error("The ends of the fish are in different components of the tet mesh!");
+        return false;
+    }
+    ComponentGeodesics& g = run.geodesics;
+    remesh_connected_components(comp, run.connected_components, run.TV, run.TT, g.CMap, g.TV, g.TT);
+    run.component_endpoints = { std::make_pair(g.CMap[head], g.CMap[tail]) };
+    if (!g.solver.compute(g.TV, g.TT, logger) || !g.solver.solve(run.component_endpoints, run.geodesic_dists)) {
+        logger->error("The geodesic distances failed!");
+        return false;
+    }
+
+    begin_stage("Extracting the skeleton");
+    compute_skeleton(g.TV, g.TT, run.geodesic_dists, run.component_endpoints, Eigen::VectorXi::Zero(g.TV.rows()),
+                     options.num_skeleton_vertices, run.skeleton_vertices);
+
+    begin_stage("Fitting the cage");
+    const double rad = 1.25 * run.fish.max_radius;
+    run.cage.set_logger(logger);
+    if (!run.cage.set_skeleton_vertices(run.skeleton_vertices, unsigned(options.num_smoothing_iters),
+                                        Eigen::Vector4d(-rad, rad, -rad, rad))) {
+        logger->error("Failed to fit the cage to the skeleton!");
+        return false;
+    }
+
+    begin_stage("Straightening the volume");
+    std::vector<double> kf_depths;
+    run.cage.keyframe_depths(kf_depths);
+    const Eigen::Vector4d kfbb = run.cage.keyframe_bounding_box();
+    run.output_dims = Eigen::RowVector3i(std::max(int(kfbb[1] - kfbb[0]), 1), std::max(int(kfbb[3] - kfbb[2]), 1),
+                                         std::max(int(kf_depths.back()), 1));
+    const std::size_t slice_bytes = std::size_t(run.output_dims[0]) * std::size_t(run.output_dims[1]);
+    if (!straighten_volume(run.cage, run.fish.dims, run.fish.volume_data.data(), run.fish.dims, run.output_dims,
+                           [&](const std::uint8_t*, int, int num_slices) {
+                               run.exported_bytes += slice_bytes * std::size_t(num_slices);
+                               return !context.cancelled();
+                           }, logger)) {
+        return false;
+    }
+    run.stage_peak_rss.push_back(peak_rss_bytes());
+    return true;
+}
+
+void write_json_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool write_results(const BenchmarkOptions& options, const PipelineRun& run, const std::vector<StageResult>& stages,
+                   std::shared_ptr<spdlog::logger> logger) {
+    std::ofstream out(options.output_filename);
+    const double mib = 1.0 / (1024.0 * 1024.0);
+    double total_seconds = 0.0;
+    std::size_t peak_rss = 0;
+    for (const StageResult& stage : stages) {
+        total_seconds += stage.seconds;
+        peak_rss = std::max(peak_rss, stage.peak_rss);
+    }
+
+    out << "{\n  \"label\": ";
+    write_json_string(out, options.label);
+    out << ",\n  \"options\": {"
+        << "\"size\": " << options.fish_length
+        << ", \"arcs\": " << options.num_arcs
+        << ", \"dilation_radius\": " << options.dilation_radius
+        << ", \"meshing_voxel_radius\": " << options.meshing_voxel_radius
+        << ", \"adaptive_meshing\": " << (options.adaptive_meshing ? "true" : "false")
+        << ", \"adaptive_max_cell_size\": " << options.adaptive_max_cell_size
+        << ", \"optimize_seconds\": " << options.optimize_seconds
+        << ", \"skeleton_vertices\": " << options.num_skeleton_vertices
+        << ", \"smoothing_iters\": " << options.num_smoothing_iters
+        << ", \"threads\": " << options.num_threads
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << "},\n";
+    out << "  \"stages\": [\n";
+    for (std::size_t i = 0; i < stages.size(); i++) {
+        out << "    {\"name\": ";
+        write_json_string(out, stages[i].name);
+        out << ", \"seconds\": " << stages[i].seconds << ", \"peak_rss_mib\": " << stages[i].peak_rss * mib << "}"
+            << (i + 1 < stages.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n";
+    out << "  \"counts\": {"
+        << "\"volume_voxels\": " << run.fish.volume_data.size()
+        << ", \"selected_segments\": " << run.selected_dexels.numSegments()
+        << ", \"dilated_segments\": " << run.dilated_dexels.numSegments()
+        << ", \"sdf_samples\": " << std::size_t(run.sdf_dims[0]) * run.sdf_dims[1] * run.sdf_dims[2]
+        << ", \"sdf_bytes\": " << run.sdf_bytes
+        << ", \"tet_vertices\": " << run.TV.rows()
+        << ", \"tets\": " << run.TT.rows()
+        << ", \"min_tet_quality\": " << run.tet_quality.min_quality
+        << ", \"tet_slivers\": " << run.tet_quality.num_slivers
+        << ", \"optimization_sweeps\": " << run.optimization.num_sweeps
+        << ", \"component_vertices\": " << run.geodesics.TV.rows()
+        << ", \"skeleton_vertices\": " << run.skeleton_vertices.rows()
+        << ", \"keyframes\": " << run.cage.num_keyframes()
+        << ", \"exported_voxels\": " << run.exported_bytes << "},\n";
+    out << "  \"total_seconds\": " << total_seconds << ",\n";
+    out << "  \"peak_rss_mib\": " << peak_rss * mib << "\n}\n";
+    if (!out) {
+        logger->error("Cannot write the results to '{}'", options.output_filename);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    if (!parse_arguments(argc, argv, options)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_mt("unwind-pipeline-bench");
+    trace::init(logger);
+    metrics::init(logger);
+
+    // The stages run in a job like in the viewer, which times them
+    PipelineRun run;
+    BackgroundJob job;
+    job.start([&](JobContext& context) { return run_pipeline(options, run, context, logger); });
+    while (job.is_running()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const std::vector<JobStage> job_stages = job.stages();
+    if (job.poll() != JobStatus::Succeeded) {
+        logger->error("The pipeline failed in stage '{}'", job_stages.empty() ? "" : job_stages.back().name);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<StageResult> stages(job_stages.size());
+    for (std::size_t i = 0; i < stages.size(); i++) {
+        stages[i].name = job_stages[i].name;
+        stages[i].seconds = job_stages[i].seconds;
+        stages[i].peak_rss = i < run.stage_peak_rss.size() ? run.stage_peak_rss[i] : 0;
+        logger->info("{}: {:.1f} ms, peak RSS {:.1f} MiB", stages[i].name, 1000.0 * stages[i].seconds,
+                     double(stages[i].peak_rss) / (1024.0 * 1024.0));
+    }
+    logger->info("Tet mesh has {} vertices and {} tets, the straightened volume is {} x {} x {}",
+                 run.TV.rows(), run.TT.rows(), run.output_dims[0], run.output_dims[1], run.output_dims[2]);
+    if (!write_results(options, run, stages, logger)) {
+        return EXIT_FAILURE;
+    }
+    logger->info("Wrote the results to '{}'", options.output_filename);
+    return EXIT_SUCCESS;
+}
@@ -2,14 +2,18 @@
 
 #include "state.h"
 #include <utils/colors.h>
+#include <utils/edit_latency.h>
 #include <utils/utils.h>
 #include <utils/open_file_dialog.h>
 #include <utils/path_utils.h>
 
+#include <igl/PI.h>
 #include <igl/edges.h>
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
 
+#include <thread>
+
 Bounding_Polygon_Menu::Bounding_Polygon_Menu(State& state)
     : state(state)
     , widget_2d(Bounding_Polygon_Widget(state))
@@ -40,7 +44,9 @@ void Bounding_Polygon_Menu::initialize() {
     widget_3d.initialize(viewer, this);
     widget_3d.volume_renderer.set_transfer_function(tf_widget.transfer_function());
 
-    exporter.init(128, 128, 1024);
+    if (!exporter.is_initialized()) {
+        exporter.init(128, 128, 1024);
+    }
 
     state.logger->trace("Done initializing bounding polygon plugin!");
 
@@ -51,11 +57,27 @@ void Bounding_Polygon_Menu::initialize() {
     }
 }
 
+void Bounding_Polygon_Menu::set_draw_straight(bool straight) {
+    draw_straight = straight;
+    if (draw_straight) {
+        widget_3d.center_straight_mesh();
+    } else {
+        widget_3d.center_bounding_cage_mesh();
+    }
+}
+
 void Bounding_Polygon_Menu::deinitialize() {
     viewer->core.viewport = old_viewport;
     widget_2d.deinitialize();
     widget_3d.deinitialize();
-    exporter.destroy();
+    // The export is only read back while the screen is drawn, finish it here. The programs and the export
+    // texture are kept for the next visit.
+    while (exporter.poll_write()) {
+        std::this_thread::yield();
+    }
+    // The volume may change before the next visit, which starts a new update anyway
+    exporter.cancel_update();
+    exporter.clear_label_data();
 }
 
 bool Bounding_Polygon_Menu::is_2d_widget_in_focus()  {
@@ -72,7 +94,15 @@ bool Bounding_Polygon_Menu::mouse_move(int mouse_x, int mouse_y) {
     // Because of this we compute focus based on the latest mouse position
     bool in_focus = widget_2d.is_point_in_widget(glm::ivec2(mouse_x, mouse_y)) && !mouse_in_popup;
 
+    // The widget marks the cage dirty when the move dragged a KeyFrame, which is where an edit starts
+    const EditLatency::Clock::time_point edit_start = EditLatency::Clock::now();
+    const bool was_dirty = cage_dirty;
+    cage_dirty = false;
     ret = ret || widget_2d.mouse_move(mouse_x, mouse_y, in_focus);
+    if (cage_dirty) {
+        edit_latency().edit("KeyFrame edit", edit_start);
+    }
+    cage_dirty = cage_dirty || was_dirty;
     return ret;
 }
 
@@ -132,7 +162,8 @@ void Bounding_Polygon_Menu::post_draw_save(int window_width) {
             const std::string save_file_name = std::string(save_name_buf);
             const std::string save_project_path = state.input_metadata.output_dir + "/" + save_file_name + ".fish.pro";
             const std::string save_datfile_path = state.input_metadata.output_dir + "/" + save_file_name + ".dat";
-            const std::string save_rawfile_path = state.input_metadata.output_dir + "/" + save_file_name + ".raw";
+            const std::string save_rawfile_name = save_file_name + (output_compressed ? ".fishvol" : ".raw");
+        const std::string save_rawfile_path = state.input_metadata.output_dir + "/" + save_rawfile_name;
             if (get_file_type(save_project_path.c_str()) != FT_DOES_NOT_EXIST) {
                 save_name_error_message = "Warning: A file named " + save_file_name + ".fish.pro exists. Saving will overwrite it.";
                 save_name_overwrite = true;
@@ -238,6 +269,20 @@ void Bounding_Polygon_Menu::post_draw_save(int window_width) {
     if (ImGui::Button("Reset Dims")) {
         reset_dims();
     }
+    ImGui::Checkbox("Compressed (.fishvol)", &output_compressed);
+    if (output_compressed) {
+        // Levels of 2x downsampled copies stored in the same file, 1 is only the full resolution
+        ImGui::Text("Pyramid Levels:");
+        ImGui::PushItemWidth(-1);
+        ImGui::SliderInt("##Pyramid Levels", &output_num_levels, 1, 8);
+        ImGui::PopItemWidth();
+    }
+    ImGui::Checkbox("Export Feature Labels and Selection Mask", &output_labels);
+    ImGui::Text("Resampling Filter:");
+    ImGui::PushItemWidth(-1);
+    // Same order as ResampleFilter
+    ImGui::Combo("##Resampling Filter", &output_filter, "Trilinear\0Tricubic (B-spline)\0Box (for smaller exports)\0");
+    ImGui::PopItemWidth();
     if (std::string(save_name_buf).size() == 0) {
         disabled = true;
     }
@@ -256,35 +301,39 @@ void Bounding_Polygon_Menu::post_draw_save(int window_width) {
         const std::string save_file_name = std::string(save_name_buf);
         const std::string save_project_path = state.input_metadata.output_dir + "/" + save_file_name + ".fish.pro";
         const std::string save_datfile_path = state.input_metadata.output_dir + "/" + save_file_name + ".dat";
-        const std::string save_rawfile_path = state.input_metadata.output_dir + "/" + save_file_name + ".raw";
+        const std::string save_rawfile_name = save_file_name + (output_compressed ? ".fishvol" : ".raw");
+        const std::string save_rawfile_path = state.input_metadata.output_dir + "/" + save_rawfile_name;
 
         state.input_metadata.project_name = save_file_name;
 
-        igl::serialize(state, "state", save_project_path, true);
+        state.save_project(save_project_path);
         DatFile out_datfile;
         out_datfile.w = output_dims[0];
         out_datfile.h = output_dims[1];
         out_datfile.d = output_dims[2];
-        out_datfile.m_raw_filename = save_file_name + ".raw";
-        out_datfile.m_format = "UINT8";
+        out_datfile.m_raw_filename = save_rawfile_name;
+        // 16 bit scans are exported at 16 bits, the brick atlas keeps their full precision
+        const bool export_16bit = state.hi_res_volume.metadata.bytes_per_voxel() == 2;
+        out_datfile.m_format = export_16bit ? "UINT16" : "UINT8";
         out_datfile.serialize(save_datfile_path, state.logger);
 
         {
-            glBindTexture(GL_TEXTURE_3D, state.hi_res_volume.volume_texture);
-            GLint old_min_filter, old_mag_filter;
-            glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, &old_min_filter);
-            glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, &old_mag_filter);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glBindTexture(GL_TEXTURE_3D, 0);
-            exporter.set_export_dims(output_dims[0], output_dims[1], output_dims[2]);
-            exporter.update(state.cage, state.hi_res_volume.volume_texture, G3f(state.low_res_volume.dims()));
-            exporter.write_texture_data_to_file(save_rawfile_path);
-            cage_dirty = true;
-            glBindTexture(GL_TEXTURE_3D, state.hi_res_volume.volume_texture);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, old_min_filter);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, old_mag_filter);
-            glBindTexture(GL_TEXTURE_3D, 0);
+            // The brick atlas is always linearly filtered so there is no filter state to swap here
+            state.hi_res_bricks.request_cage(state.cage, G3f(state.low_res_volume.dims()));
+            // Rendered and written slab by slab over the next frames, the full output never lives on the GPU
+            exporter.set_filter(ResampleFilter(output_filter));
+            exporter.set_num_levels(output_compressed ? output_num_levels : 1);
+            exporter.set_intensity_16bit(export_16bit);
+            // Written next to the volume as <name>.features and <name>.selection in the same pass
+            if (output_labels && state.low_res_volume.index_texture != 0) {
+                exporter.set_label_data(state.low_res_volume.index_texture, state.segmented_features.buffer_data,
+                                        state.segmented_features.selected_features);
+            } else {
+                exporter.clear_label_data();
+            }
+            exporter.begin_tiled_write(state.cage, 0, &state.hi_res_bricks, G3i(state.low_res_volume.dims()),
+                                       glm::ivec3(output_dims[0], output_dims[1], output_dims[2]),
+                                       save_rawfile_path, state.logger);
         }
 
         show_save_popup = false;
@@ -307,7 +356,18 @@ void Bounding_Polygon_Menu::post_draw_save(int window_width) {
 }
 
 bool Bounding_Polygon_Menu::post_draw() {
-    if (cage_dirty) {
+    // A running export samples the resident bricks, so the preview must not page others in until it is written
+    exporter.poll_write();
+    if (exporter.is_writing()) {
+        // The export goes on for as many frames as it has slabs
+        state.redraw.request(RedrawScheduler::VolumeView);
+    }
+    if (exporter.has_label_data() && !exporter.is_writing()) {
+        // The preview only shows the intensities, stop rendering the labels once their export is written
+        exporter.clear_label_data();
+    }
+    if (cage_dirty && !exporter.is_writing()) {
+        EditLatency::Scope latency_scope("Straightening");
         double depth = 0, width, height;
         Eigen::RowVector3d last_centroid = state.cage.keyframes.begin()->centroid_3d();
         for (const BoundingCage::KeyFrame& kf : state.cage.keyframes) {
@@ -320,22 +380,25 @@ bool Bounding_Polygon_Menu::post_draw() {
         width = std::max(round(fabs(cage_bbox[1] - cage_bbox[0])), 1.0) * widget_3d.export_rescale_factor;
         height = std::max(round(fabs(cage_bbox[3] - cage_bbox[2])), 1.0) * widget_3d.export_rescale_factor;
 
-        glBindTexture(GL_TEXTURE_3D, state.low_res_volume.volume_texture);
-        GLint old_min_filter, old_mag_filter;
-        glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, &old_min_filter);
-        glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, &old_mag_filter);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         exporter.set_export_dims(width, height, depth);
-        GLuint tex = use_hires_texture ? state.hi_res_volume.volume_texture : state.low_res_volume.volume_texture;
-        exporter.update(state.cage, tex, G3i(state.low_res_volume.dims()));
-
-        glBindTexture(GL_TEXTURE_3D, state.low_res_volume.volume_texture);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, old_min_filter);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, old_mag_filter);
-        glBindTexture(GL_TEXTURE_3D, 0);
+        if (use_hires_texture && state.hi_res_bricks.is_initialized()) {
+            // Page in the full resolution bricks covered by the edited cage before sampling them
+            state.hi_res_bricks.request_cage(state.cage, G3f(state.low_res_volume.dims()));
+            exporter.update(state.cage, state.hi_res_bricks, G3i(state.low_res_volume.dims()));
+        } else {
+            exporter.update(state.cage, state.low_res_volume.volume_texture, G3i(state.low_res_volume.dims()));
+        }
         cage_dirty = false;
     }
+    if (exporter.is_updating()) {
+        if (exporter.poll_update()) {
+            // The straightened volume is rendered into the back buffer over the next frames
+            state.redraw.request(RedrawScheduler::VolumeView);
+        } else {
+            // The buffers were swapped, so the empty space grid of the texture now shown is stale
+            VolumeResource::invalidate(exporter.export_texture());
+        }
+    }
 
     if (tf_widget.transfer_function_dirty()) {
         widget_3d.volume_renderer.set_transfer_function(tf_widget.transfer_function());
@@ -434,7 +497,7 @@ bool Bounding_Polygon_Menu::post_draw() {
     BoundingCage::KeyFrameIterator kf = state.cage.keyframe_for_index(current_cut_index);
     if (ImGui::Button("Insert KF")) {
         state.cage.insert_keyframe(current_cut_index);
-        glfwPostEmptyEvent();
+        state.redraw.request(RedrawScheduler::Widget3d);
         cage_dirty = true;
     }
     ImGui::SameLine();
@@ -446,7 +509,7 @@ bool Bounding_Polygon_Menu::post_draw() {
         if (next != state.cage.keyframes.end()) {
             current_cut_index = next->index();
         }
-        glfwPostEmptyEvent();
+        state.redraw.request(RedrawScheduler::Widget3d);
         cage_dirty = true;
     }
     ImGui::SameLine();
@@ -454,23 +517,56 @@ bool Bounding_Polygon_Menu::post_draw() {
         if (kf->in_bounding_cage()) {
             kf->set_angle(0.0);
         }
-        glfwPostEmptyEvent();
+        state.redraw.request(RedrawScheduler::Widget3d);
+        cage_dirty = true;
+    }
+
+
+    if (ImGui::Button("Fit KFs")) {
+        state.cage.fit_keyframes(double(fit_max_turn_degrees) * igl::PI / 180.0);
+        state.redraw.request(RedrawScheduler::Widget3d);
         cage_dirty = true;
     }
+    ImGui::SameLine();
+    ImGui::PushItemWidth(text_button_w);
+    if (ImGui::InputFloat("Max Turn (deg)", &fit_max_turn_degrees, 1.0f, 5.0f, 1)) {
+        fit_max_turn_degrees = std::max(0.5f, std::min(fit_max_turn_degrees, 90.0f));
+    }
+    ImGui::PopItemWidth();
 
     ImGui::Separator();
     ImGui::Text("Display Options");
-    if (ImGui::Checkbox("Show Straight View", &draw_straight)) {
-        if (draw_straight) {
-            widget_3d.center_straight_mesh();
-        } else {
-            widget_3d.center_bounding_cage_mesh();
-        }
+    bool straight = draw_straight;
+    if (ImGui::Checkbox("Show Straight View", &straight)) {
+        set_draw_straight(straight);
     }
     ImGui::SameLine();
     if (ImGui::Checkbox("Show Hi-Res Texture", &use_hires_texture)) {
         cage_dirty = true;
     }
+    if (ImGui::Checkbox("Full Precision Rendering", &full_precision_rendering)) {
+        widget_3d.volume_renderer.set_half_precision(!full_precision_rendering);
+    }
+    ImGui::PushItemWidth(ImGui::GetFontSize() * 6.0f);
+    if (ImGui::SliderFloat("Ray Step (pixels)", &state.ray_step_pixels, 0.f, 4.f, "%.2f")) {
+        state.ray_step_pixels = std::max(state.ray_step_pixels, 0.f);
+    }
+    ImGui::PopItemWidth();
+    bool track_edit_latency = edit_latency().enabled();
+    if (ImGui::Checkbox("Track Edit Latency", &track_edit_latency)) {
+        edit_latency().set_enabled(track_edit_latency);
+    }
+    if (track_edit_latency) {
+        ImGui::SameLine();
+        float budget_ms = float(edit_latency().budget_ms());
+        ImGui::PushItemWidth(ImGui::GetFontSize() * 6.0f);
+        if (ImGui::InputFloat("Budget (ms)", &budget_ms, 1.0f, 4.0f, 1)) {
+            edit_latency().set_budget_ms(std::max(budget_ms, 1.0f));
+        }
+        ImGui::PopItemWidth();
+        ImGui::Text("Last edit %.1f ms, %d of %d edits over budget", edit_latency().last_ms(),
+                    edit_latency().num_over_budget(), edit_latency().num_edits());
+    }
 
     bool pushed_disabled_style = false;
     if (show_edit_transfer_function) {
@@ -594,12 +690,18 @@ bool Bounding_Polygon_Menu::post_draw() {
     }
 
     ImGui::NewLine();
+    if (exporter.is_updating()) {
+        // The straightened view keeps showing the previous cage until this is done
+        ImGui::ProgressBar(exporter.update_progress(), ImVec2(-1.f, 0.f), "Straightening...");
+    }
     ImGui::Separator();
     if (ImGui::Button("Back")) {
         state.set_application_state(Application_State::EndPointSelection);
     }
     ImGui::SameLine();
-    if (ImGui::Button("Save")) {
+    if (exporter.is_writing()) {
+        ImGui::ProgressBar(exporter.write_progress(), ImVec2(-1.f, 0.f), "Writing volume...");
+    } else if (ImGui::Button("Save")) {
         show_save_popup = true;
     }
     if (show_save_popup) {
@@ -628,6 +730,15 @@ bool Bounding_Polygon_Menu::post_draw() {
 
 
     ImGui::Render();
+
+    if (edit_latency().pending()) {
+        {
+            // Wait for the GPU so that the rendering of the edit counts towards its latency
+            EditLatency::Scope latency_scope("GPU");
+            glFinish();
+        }
+        edit_latency().frame_done();
+    }
     return ret;
 }
 
@@ -33,6 +33,9 @@ public:
     VolumeExporter exporter;
 
     bool use_hires_texture = true;
+
+    // Show the straightened volume instead of the cage in the 3d view and center the camera on it
+    void set_draw_straight(bool straight);
 private:
 
     void post_draw_save(int window_width);
@@ -58,7 +61,9 @@ private:
 
     float current_cut_index = 0;
     float keyframe_nudge_amount = 0.1;
+    float fit_max_turn_degrees = 10.0f; // Largest turn of the skeleton within a Cell when fitting KeyFrames
     bool draw_straight = false;
+    bool full_precision_rendering = false; // 32 bit float render targets for the 3d view
     bool show_edit_transfer_function = false;
     bool mouse_in_popup = false;
 
@@ -69,6 +74,10 @@ private:
     std::string save_name_error_message;
     int output_dims[3] = {-1, -1, -1};
     bool output_preserve_aspect_ratio = true;
+    bool output_compressed = false; // Export a chunked .fishvol file instead of a .raw file
+    int output_filter = RESAMPLE_TRILINEAR; // ResampleFilter of the export
+    bool output_labels = false; // Also export the feature ids and the selection mask
+    int output_num_levels = 1; // Levels of the .fishvol pyramid, including the full resolution
 
     double front_bump_amount = 0.0;
     double back_bump_amount = 0.0;
@@ -2,7 +2,6 @@
 
 #include "bounding_polygon_plugin.h"
 
-#include <igl/opengl/create_shader_program.h>
 #include <igl/opengl/glfw/Viewer.h>
 #include <imgui/imgui.h>
 #include <utils/glm_conversion.h>
@@ -13,9 +12,12 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#include <algorithm>
 #include <vector>
 
 #include <utils/gl/volume_exporter.h>
+#include <utils/gl/gpu_profiler.h>
+#include <utils/gl/shader_cache.h>
 
 #pragma optimize ("", off)
 
@@ -65,14 +67,19 @@ void main() {
 }
 )";
 
-constexpr const char* PlaneFragmentShader = R"(
+// The brick cache functions are inserted between the version line and the body
+constexpr const char* PlaneFragmentShaderVersion = R"(
 #version 150
+)";
+
+constexpr const char* PlaneFragmentShader = R"(
 in vec3 uv;
 
 out vec4 out_color;
 
 uniform sampler3D tex;
 uniform sampler1D tf;
+uniform bool use_brick_cache;
 
 void main() {
     // All areas outside the actual texture area should be black
@@ -80,7 +87,7 @@ void main() {
         out_color = vec4(0.0, 0.0, 0.0, 0.0);
     }
     else {
-        float v = texture(tex, uv).r;
+        float v = use_brick_cache ? sample_brick_cache(uv) : texture(tex, uv).r;
         out_color = vec4(vec3(v), 1.0);
     }
 }
@@ -173,7 +180,7 @@ bool Bounding_Polygon_Widget::is_point_in_widget(glm::ivec2 p) const {
 
 void Bounding_Polygon_Widget::update_selection() {
     // Helper function to find the closest vertex in vertices to p
-    auto closest_vertex = [](const glm::vec2& p, const Eigen::MatrixXd& vertices) -> std::pair<int, float> {
+    auto closest_vertex = [](const glm::vec2& p, const BoundingCage::KeyFrame::BoxVertices2d& vertices) -> std::pair<int, float> {
         float min_dist = std::numeric_limits<float>::max();
         int index = -1;
 
@@ -214,6 +221,11 @@ void Bounding_Polygon_Widget::update_selection() {
 }
 
 void Bounding_Polygon_Widget::deinitialize() {
+    // The cage or the volume may change before the next visit, the programs and render targets are kept
+    slice.valid = false;
+}
+
+void Bounding_Polygon_Widget::destroy() {
     std::vector<GLuint> vertex_arrays = {
         empty_vao,
         polygon.vao,
@@ -226,18 +238,33 @@ void Bounding_Polygon_Widget::deinitialize() {
 
     glDeleteProgram(plane.program);
     glDeleteProgram(polygon.program);
+    glDeleteProgram(blit.program);
     glDeleteVertexArrays(vertex_arrays.size(), vertex_arrays.data());
     glDeleteBuffers(buffers.size(), buffers.data());
     glDeleteTextures(1, &offscreen.texture);
     glDeleteFramebuffers(1, &offscreen.fbo);
+    glDeleteTextures(1, &slice.texture);
+    glDeleteFramebuffers(1, &slice.fbo);
+    offscreen.texture = offscreen.fbo = 0;
+    offscreen.texture_size = glm::ivec2(0);
+    slice.texture = slice.fbo = 0;
+    slice.texture_size = glm::ivec2(0);
+    slice.valid = false;
+    plane.program = polygon.program = blit.program = 0;
+    empty_vao = polygon.vao = polygon.vbo = blit.vao = blit.vbo = 0;
 }
 
 void Bounding_Polygon_Widget::initialize(igl::opengl::glfw::Viewer* viewer, Bounding_Polygon_Menu *parent) {
     this->viewer = viewer;
     this->parent = parent;
+    if (plane.program != 0) {
+        // Created on an earlier visit of the screen
+        return;
+    }
 
-    igl::opengl::create_shader_program(PlaneVertexShader,
-                                       PlaneFragmentShader, {}, plane.program);
+    const std::string plane_fragment_shader = std::string(PlaneFragmentShaderVersion) + VolumeBrickCache::GLSL + PlaneFragmentShader;
+    create_cached_shader_program(PlaneVertexShader,
+                                 plane_fragment_shader, {}, plane.program);
 
     plane.window_size_location = glGetUniformLocation(plane.program, "window_size");
     plane.ll_location = glGetUniformLocation(plane.program, "ll");
@@ -246,12 +273,14 @@ void Bounding_Polygon_Widget::initialize(igl::opengl::glfw::Viewer* viewer, Boun
     plane.ur_location = glGetUniformLocation(plane.program, "ur");
     plane.texture_location = glGetUniformLocation(plane.program, "tex");
     plane.tf_location = glGetUniformLocation(plane.program, "tf");
+    plane.use_brick_cache_location = glGetUniformLocation(plane.program, "use_brick_cache");
+    plane.brick_cache_locations = VolumeBrickCache::uniform_locations(plane.program);
 
     glGenVertexArrays(1, &empty_vao);
 
 
-    igl::opengl::create_shader_program(PolygonVertexShader, PolygonFragmentShader, {},
-                                       polygon.program);
+    create_cached_shader_program(PolygonVertexShader, PolygonFragmentShader, {},
+                                 polygon.program);
 
     polygon.color_location = glGetUniformLocation(polygon.program, "color");
 
@@ -265,7 +294,7 @@ void Bounding_Polygon_Widget::initialize(igl::opengl::glfw::Viewer* viewer, Boun
     glBindVertexArray(0);
 
 
-    igl::opengl::create_shader_program(BlitVertexShader, BlitFragmentShader, {}, blit.program);
+    create_cached_shader_program(BlitVertexShader, BlitFragmentShader, {}, blit.program);
     blit.texture_location = glGetUniformLocation(blit.program, "tex");
 
     glGenVertexArrays(1, &blit.vao);
@@ -280,19 +309,154 @@ void Bounding_Polygon_Widget::initialize(igl::opengl::glfw::Viewer* viewer, Boun
     glBindVertexArray(0);
 
 
-    glGenTextures(1, &offscreen.texture);
-    glBindTexture(GL_TEXTURE_2D, offscreen.texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, offscreen.texture_size.x,
-                 offscreen.texture_size.y, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     glGenFramebuffers(1, &offscreen.fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, offscreen.fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           offscreen.texture, 0);
+    glGenFramebuffers(1, &slice.fbo);
+    // The textures are sized to the widget on the first draw
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void Bounding_Polygon_Widget::update_render_targets() {
+    // Render at the pixel density of the framebuffer, which is larger than the window on high dpi screens
+    int window_width, window_height;
+    int framebuffer_width, framebuffer_height;
+    glfwGetWindowSize(viewer->window, &window_width, &window_height);
+    glfwGetFramebufferSize(viewer->window, &framebuffer_width, &framebuffer_height);
+    const glm::vec2 pixel_ratio = glm::vec2(framebuffer_width, framebuffer_height) /
+                                  glm::max(glm::vec2(window_width, window_height), glm::vec2(1.f));
+    const glm::ivec2 pixel_size = glm::max(glm::ivec2(glm::round(size * pixel_ratio)), glm::ivec2(1));
+    if (pixel_size == offscreen.texture_size) {
+        return;
+    }
+
+    auto allocate = [](GLuint& texture, GLuint fbo, glm::ivec2 texture_size, bool mipmapped) {
+        glDeleteTextures(1, &texture);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, mipmapped ? GL_RGBA8 : GL_RGB, texture_size.x, texture_size.y, 0,
+                     mipmapped ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    };
+
+    GLint max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+    offscreen.texture_size = pixel_size;
+    allocate(offscreen.texture, offscreen.fbo, offscreen.texture_size, false);
+
+    // The slice covers SlicePadding times the view at the same texel density
+    slice.texture_size = glm::min(glm::ivec2(glm::vec2(pixel_size) * SlicePadding), glm::ivec2(max_texture_size));
+    allocate(slice.texture, slice.fbo, slice.texture_size, true);
+    slice.valid = false;
+}
+
+void Bounding_Polygon_Widget::update_slice(BoundingCage::KeyFrameIterator kf, bool hi_res_available) {
+    const std::uint64_t brick_residency_version = state.hi_res_bricks.residency_version();
+
+    // The slice only depends on the plane of the keyframe, not on its bounding box or torsion angle, so
+    // dragging the polygon around leaves it alone
+    const bool same_source = slice.valid &&
+        slice.origin == kf->origin() && slice.right == kf->right_3d() && slice.up == kf->up_3d() &&
+        slice.volume_texture == state.low_res_volume.volume_texture &&
+        slice.hi_res_available == hi_res_available &&
+        (!slice.use_brick_cache || slice.brick_residency_version == brick_residency_version);
+
+    // Zooming in past the density the slice was rendered at makes it blurry, zooming or panning out of the
+    // square it covers leaves a border
+    const glm::vec2 view_distance = glm::abs(view.offset - slice.center) + glm::vec2(view.zoom);
+    const bool covers_view = view.zoom * SlicePadding >= slice.half_extent &&
+                             view_distance.x <= slice.half_extent && view_distance.y <= slice.half_extent;
+
+    if (same_source && covers_view) {
+        return;
+    }
+
+    slice.valid = true;
+    slice.center = view.offset;
+    slice.half_extent = view.zoom * SlicePadding;
+    slice.origin = kf->origin();
+    slice.right = kf->right_3d();
+    slice.up = kf->up_3d();
+    slice.volume_texture = state.low_res_volume.volume_texture;
+    slice.hi_res_available = hi_res_available;
+
+    // The keyframe is in voxels of the low resolution volume. The full resolution scan only adds detail once
+    // the texels of the slice are smaller than those voxels, so zoomed out the low resolution texture is
+    // sampled and no bricks are paged in.
+    const float texel_size = 2.f * slice.half_extent / float(std::max(slice.texture_size.x, 1));
+    const bool use_brick_cache = hi_res_available && texel_size < 1.f;
+    slice.use_brick_cache = use_brick_cache;
+
+    glm::vec3 volume_dims = G3f(state.low_res_volume.dims()); //glm::vec3(state.volume_rendering.parameters.volume_dimensions);
+
+    Eigen::Vector2d offset(slice.center.x, slice.center.y);
+    Eigen::Vector2d LL = Eigen::Vector2d(-1.0, -1.0) * slice.half_extent + offset;
+    Eigen::Vector2d UL = Eigen::Vector2d(-1.0,  1.0) * slice.half_extent + offset;
+    Eigen::Vector2d LR = Eigen::Vector2d( 1.0, -1.0) * slice.half_extent + offset;
+    Eigen::Vector2d UR = Eigen::Vector2d( 1.0,  1.0) * slice.half_extent + offset;
+
+    Eigen::Vector3d LL3 = kf->origin() + LL[0]*kf->right_3d() + LL[1]*kf->up_3d();
+    Eigen::Vector3d UL3 = kf->origin() + UL[0]*kf->right_3d() + UL[1]*kf->up_3d();
+    Eigen::Vector3d LR3 = kf->origin() + LR[0]*kf->right_3d() + LR[1]*kf->up_3d();
+    Eigen::Vector3d UR3 = kf->origin() + UR[0]*kf->right_3d() + UR[1]*kf->up_3d();
+
+    glm::vec3 ll = G3f(LL3) / volume_dims;
+    glm::vec3 ul = G3f(UL3) / volume_dims;
+    glm::vec3 lr = G3f(LR3) / volume_dims;
+    glm::vec3 ur = G3f(UR3) / volume_dims;
+
+    // Page in the bricks the slice crosses, a running export samples the resident bricks so then the slice
+    // makes do with them
+    if (use_brick_cache && !parent->exporter.is_writing()) {
+        state.hi_res_bricks.request_plane(ll, lr, ul);
+    }
+    slice.brick_residency_version = state.hi_res_bricks.residency_version();
+
+    push_opengl_debug_group("Render Slice");
+    gpu_profiler().begin("Widget 2D slice");
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, slice.fbo);
+        glViewport(0, 0, slice.texture_size.x, slice.texture_size.y);
+        glClearColor(0.f, 0.f, 0.f, 0.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_BLEND);
+
+        glUseProgram(plane.program);
+        glBindVertexArray(empty_vao);
+
+        glUniform3fv(plane.ll_location, 1, glm::value_ptr(ll));
+        glUniform3fv(plane.lr_location, 1, glm::value_ptr(lr));
+        glUniform3fv(plane.ul_location, 1, glm::value_ptr(ul));
+        glUniform3fv(plane.ur_location, 1, glm::value_ptr(ur));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, state.low_res_volume.volume_texture);
+        glUniform1i(plane.texture_location, 0);
+        glUniform1i(plane.use_brick_cache_location, use_brick_cache);
+        if (use_brick_cache) {
+            state.hi_res_bricks.bind(plane.brick_cache_locations, 1);
+        } else {
+            VolumeBrickCache::set_sampler_units(plane.brick_cache_locations, 1);
+        }
+
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+        glUseProgram(0);
+
+        glBindTexture(GL_TEXTURE_2D, slice.texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glEnable(GL_BLEND);
+    }
+    gpu_profiler().end();
+    pop_opengl_debug_group();
 }
 
 bool Bounding_Polygon_Widget::mouse_move(int mouse_x, int mouse_y, bool in_focus) {
@@ -503,21 +667,16 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
         glUseProgram(polygon.program);
         glBindVertexArray(polygon.vao);
 
-        std::vector<glm::vec2> vertex_data;
-
+        std::vector<glm::vec2> vertex_data(pixel_space_points.size());
         for (int i = 0; i < pixel_space_points.size(); i++) {
-            vertex_data.push_back(convert_position_keyframe_to_ndc(pixel_space_points[i]));
-        }
-
-        std::vector<float> vertex_data_data;
-        for (const glm::vec2& v : vertex_data) {
-            vertex_data_data.push_back(v.x);
-            vertex_data_data.push_back(v.y);
+            vertex_data[i] = convert_position_keyframe_to_ndc(pixel_space_points[i]);
         }
 
+        // The buffer is refilled for every polygon drawn in a frame, orphaning it lets the driver hand
+        // out fresh storage instead of waiting for the previous draw
         glBindBuffer(GL_ARRAY_BUFFER, polygon.vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertex_data_data.size() * sizeof(float),
-                     vertex_data_data.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertex_data.size() * sizeof(glm::vec2),
+                     vertex_data.data(), GL_STREAM_DRAW);
 
         glPointSize(point_size);
         glLineWidth(line_width);
@@ -542,6 +701,51 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
         }
     };
 
+    // Draws texture over the rectangle [ll_ndc, ur_ndc] of the bound framebuffer
+    auto draw_texture = [&](GLuint texture, glm::vec2 ll_ndc, glm::vec2 ur_ndc) {
+        glUseProgram(blit.program);
+        glBindVertexArray(blit.vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, blit.vbo);
+        {
+            BlitData box_ll = {
+                ll_ndc.x, ll_ndc.y,
+                0.f, 0.f
+            };
+
+            BlitData box_lr = {
+                ur_ndc.x, ll_ndc.y,
+                1.f, 0.f
+            };
+
+            BlitData box_ul = {
+                ll_ndc.x, ur_ndc.y,
+                0.f, 1.f
+            };
+
+            BlitData box_ur = {
+                ur_ndc.x, ur_ndc.y,
+                1.f, 1.f
+            };
+
+            std::array<BlitData, 6> blit_data = {
+                box_ll, box_lr, box_ur, box_ll, box_ur, box_ul
+
+            };
+
+            glBufferData(GL_ARRAY_BUFFER, blit_data.size() * sizeof(BlitData),
+                         blit_data.data(), GL_STREAM_DRAW);
+
+
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glUniform1i(blit.texture_location, 0);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    };
+
     selection.current_active_keyframe = kf;
 
 
@@ -552,54 +756,30 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
     glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+    glDisable(GL_DEPTH_TEST);
+
+    //
+    // Resample the volume on the plane of this keyframe, unless the cached slice still covers the view
+    //
+    update_render_targets();
+    // The full resolution scan is only available through its brick cache
+    const bool hi_res_available = parent->use_hires_texture && state.hi_res_bricks.is_initialized();
+    update_slice(kf, hi_res_available);
 
     // All 2D UI gets rendered into a framebuffer texture which we then blit to the screen
     glBindFramebuffer(GL_FRAMEBUFFER, offscreen.fbo);
     glViewport(0, 0, offscreen.texture_size.x, offscreen.texture_size.y);
     glClearColor(0.f, 0.f, 0.f, 0.f);
     glClear(GL_COLOR_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST);
 
-    //
-    // Render the slice of the volume for this keyframe into an OpenGL texture
-    //
-    push_opengl_debug_group("Render Slice");
+    push_opengl_debug_group("Composite Slice");
+    gpu_profiler().begin("Widget 2D slice composite");
     {
-        glUseProgram(plane.program);
-        glBindVertexArray(empty_vao);
-
-        glm::vec3 volume_dims = G3f(state.low_res_volume.dims()); //glm::vec3(state.volume_rendering.parameters.volume_dimensions);
-
-        Eigen::Vector2d offset(view.offset.x, view.offset.y);
-        Eigen::Vector2d LL = Eigen::Vector2d(-1.0, -1.0) * view.zoom + offset;
-        Eigen::Vector2d UL = Eigen::Vector2d(-1.0,  1.0) * view.zoom + offset;
-        Eigen::Vector2d LR = Eigen::Vector2d( 1.0, -1.0) * view.zoom + offset;
-        Eigen::Vector2d UR = Eigen::Vector2d( 1.0,  1.0) * view.zoom + offset;
-
-        Eigen::Vector3d LL3 = kf->origin() + LL[0]*kf->right_3d() + LL[1]*kf->up_3d();
-        Eigen::Vector3d UL3 = kf->origin() + UL[0]*kf->right_3d() + UL[1]*kf->up_3d();
-        Eigen::Vector3d LR3 = kf->origin() + LR[0]*kf->right_3d() + LR[1]*kf->up_3d();
-        Eigen::Vector3d UR3 = kf->origin() + UR[0]*kf->right_3d() + UR[1]*kf->up_3d();
-
-        glm::vec3 ll = G3f(LL3) / volume_dims;
-        glm::vec3 ul = G3f(UL3) / volume_dims;
-        glm::vec3 lr = G3f(LR3) / volume_dims;
-        glm::vec3 ur = G3f(UR3) / volume_dims;
-
-        glUniform3fv(plane.ll_location, 1, glm::value_ptr(ll));
-        glUniform3fv(plane.lr_location, 1, glm::value_ptr(lr));
-        glUniform3fv(plane.ul_location, 1, glm::value_ptr(ul));
-        glUniform3fv(plane.ur_location, 1, glm::value_ptr(ur));
-
-        glActiveTexture(GL_TEXTURE0);
-        GLuint tex = parent->use_hires_texture ? state.hi_res_volume.volume_texture : state.low_res_volume.volume_texture;
-        glBindTexture(GL_TEXTURE_3D, tex);
-        glUniform1i(plane.texture_location, 0);
-
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-        glUseProgram(0);
+        const glm::vec2 slice_ll = slice.center - glm::vec2(slice.half_extent);
+        const glm::vec2 slice_ur = slice.center + glm::vec2(slice.half_extent);
+        draw_texture(slice.texture, convert_position_keyframe_to_ndc(slice_ll), convert_position_keyframe_to_ndc(slice_ur));
     }
+    gpu_profiler().end();
     pop_opengl_debug_group();
 
 
@@ -607,6 +787,7 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
     // Render the bounding-box, center, and axes into the same texture
     //
     push_opengl_debug_group("Render Polygon");
+    gpu_profiler().begin("Widget 2D polygon");
     {
         const glm::vec2 centroid_2d = G2f(kf->centroid_2d());
         const glm::vec2 r_axis = G2f(kf->right_rotated_2d()), u_axis = G2f(kf->up_rotated_2d());
@@ -619,7 +800,7 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
         draw_polygon(selected_vertices_2d, ctr_color, ctr_point_size, 1.f, PolygonDrawMode::Points);
 
         // Render the rotated bounding box
-        Eigen::MatrixXd bbox_v = kf->bounding_box_vertices_rotated_2d();
+        const BoundingCage::KeyFrame::BoxVertices2d bbox_v = kf->bounding_box_vertices_rotated_2d();
         std::vector<glm::vec2> bbox_vertices;
         for (int i = 0; i < bbox_v.rows(); i++) { bbox_vertices.push_back(G2f(bbox_v.row(i))); }
         draw_polygon(bbox_vertices, bbox_color, 5.f, 2.f, PolygonDrawMode::PointsAndLines);
@@ -647,6 +828,7 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
             }
         }
     }
+    gpu_profiler().end();
     pop_opengl_debug_group();
 
     // Restore the framebuffer and viewport
@@ -659,56 +841,17 @@ bool Bounding_Polygon_Widget::post_draw(BoundingCage::KeyFrameIterator kf, bool
     // Blit the texture we just rendered to the screen
     //
     push_opengl_debug_group("Texture Blit");
+    gpu_profiler().begin("Widget 2D blit");
     {
         int width;
         int height;
         glfwGetWindowSize(viewer->window, &width, &height);
 
-        glUseProgram(blit.program);
-        glBindVertexArray(blit.vao);
-
-        glBindBuffer(GL_ARRAY_BUFFER, blit.vbo);
-        {
-            glm::vec2 size_ndc = size / glm::vec2(width, height) * 2.f;
-            glm::vec2 pos_ndc = (position / glm::vec2(width, height) - glm::vec2(0.5)) * 2.f;
-
-            BlitData box_ll = {
-                pos_ndc.x, pos_ndc.y,
-                0.f, 0.f
-            };
-
-            BlitData box_lr = {
-                pos_ndc.x + size_ndc.x, pos_ndc.y,
-                1.f, 0.f
-            };
-
-            BlitData box_ul = {
-                pos_ndc.x, pos_ndc.y + size_ndc.y,
-                0.f, 1.f
-            };
-
-            BlitData box_ur = {
-                pos_ndc.x + size_ndc.x,  pos_ndc.y + size_ndc.y,
-                1.f, 1.f
-            };
-
-            std::array<BlitData, 6> blit_data = {
-                box_ll, box_lr, box_ur, box_ll, box_ur, box_ul
-
-            };
-
-            glBufferData(GL_ARRAY_BUFFER, blit_data.size() * sizeof(BlitData),
-                         blit_data.data(), GL_STATIC_DRAW);
-
-
-        }
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, offscreen.texture);
-        glUniform1i(blit.texture_location, 0);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-        glUseProgram(0);
+        glm::vec2 size_ndc = size / glm::vec2(width, height) * 2.f;
+        glm::vec2 pos_ndc = (position / glm::vec2(width, height) - glm::vec2(0.5)) * 2.f;
+        draw_texture(offscreen.texture, pos_ndc, pos_ndc + size_ndc);
     }
+    gpu_profiler().end();
     pop_opengl_debug_group();
     glEnable(GL_DEPTH_TEST);
 
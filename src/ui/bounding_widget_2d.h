@@ -14,8 +14,10 @@ class Bounding_Polygon_Widget {
 public:
     Bounding_Polygon_Widget(State& state);
 
+    // The GL resources are created on the first initialize and kept when the screen is left, destroy releases them
     void initialize(igl::opengl::glfw::Viewer* viewer, Bounding_Polygon_Menu* parent);
     void deinitialize();
+    void destroy();
 
     bool mouse_move(int mouse_x, int mouse_y, bool in_focus);
     bool mouse_down(int button, int modifier, bool in_focus);
@@ -57,6 +59,13 @@ private:
 
     void update_selection();
 
+    // Resize the offscreen targets to the pixel size of the widget
+    void update_render_targets();
+    // Resample the volume on the plane of kf into the slice cache unless the cached slice still covers the view.
+    // If hi_res_available, the slice is sampled from the bricks of the full resolution scan it crosses once it
+    // is zoomed in past the low resolution volume.
+    void update_slice(BoundingCage::KeyFrameIterator kf, bool hi_res_available);
+
     State& state;
     igl::opengl::glfw::Viewer* viewer;
 
@@ -102,6 +111,8 @@ private:
 
         GLint texture_location = -1;
         GLint tf_location = -1;
+        GLint use_brick_cache_location = -1;
+        VolumeBrickCache::UniformLocations brick_cache_locations;
     } plane;
 
     struct {
@@ -112,12 +123,34 @@ private:
         GLint color_location = -1;
     } polygon;
 
+    // The 2D UI at the pixel size of the widget, blitted to the screen every frame
     struct {
         GLuint fbo = 0;
         GLuint texture = 0;
-        glm::ivec2 texture_size = { 1024, 1024 };
+        glm::ivec2 texture_size = { 0, 0 };
     } offscreen;
 
+    // The volume resampled on the plane of the keyframe over a square around the view which is SlicePadding
+    // times larger, so panning and zooming out reuse it (minified through its mipmaps) until the view
+    // leaves the square or asks for more texels than it has.
+    static constexpr const float SlicePadding = 2.f;
+    struct {
+        GLuint fbo = 0;
+        GLuint texture = 0;
+        glm::ivec2 texture_size = { 0, 0 };
+
+        bool valid = false;
+        glm::vec2 center = { 0.f, 0.f }; // in kf
+        float half_extent = 0.f;         // in kf
+        Eigen::RowVector3d origin;
+        Eigen::RowVector3d right;
+        Eigen::RowVector3d up;
+        GLuint volume_texture = 0;
+        bool hi_res_available = false;
+        bool use_brick_cache = false;
+        std::uint64_t brick_residency_version = 0;
+    } slice;
+
     struct {
         GLuint program = 0;
         GLuint vao = 0;
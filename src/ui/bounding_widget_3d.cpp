@@ -1,10 +1,14 @@
 #include "bounding_widget_3d.h"
 #include "state.h"
 
+#include <algorithm>
 #include <iomanip>
 
 #include <utils/colors.h>
+#include <utils/edit_latency.h>
 #include <utils/glm_conversion.h>
+#include <utils/parallel_for.h>
+#include <utils/row_major.h>
 #include <igl/opengl/glfw/Viewer.h>
 #include <igl/edges.h>
 
@@ -24,17 +28,28 @@ void Bounding_Widget_3d::initialize(igl::opengl::glfw::Viewer* viewer, Bounding_
     _parent = parent;
     glm::ivec2 viewport_size = glm::ivec2(_viewer->core.viewport[2], _viewer->core.viewport[3]);
 
-    volume_renderer.init(viewport_size);
+    if (!volume_renderer.is_initialized()) {
+        volume_renderer.init(viewport_size);
+        // The render targets are sized by the first draw
+        _last_viewport = glm::vec4(-1.f);
 
-    renderer_2d.init();
-    cage_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
-    current_kf_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
-    skeleton_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
+        renderer_2d.init();
+        cage_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
+        current_kf_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
+        skeleton_polyline_id = renderer_2d.add_polyline_3d(nullptr, nullptr, 0, PointLineRenderer::PolylineStyle());
+        _cage_num_vertices = -1;
+    }
 
     center_bounding_cage_mesh();
 }
 
 void Bounding_Widget_3d::deinitialize() {
+    // The cage lines are written again on the next visit, the renderers are kept
+    _cage_line_versions.clear();
+}
+
+void Bounding_Widget_3d::destroy() {
+    _cage_line_versions.clear();
     renderer_2d.destroy();
     volume_renderer.destroy();
 }
@@ -51,9 +66,9 @@ void Bounding_Widget_3d::center_bounding_cage_mesh() {
     glm::mat4 model_matrix = GM4f(_viewer->core.model);
 
     int num_vertices = 0;
-    Eigen::MatrixXd V(_state.cage.mesh_vertices().rows(), 3);
+    Eigen::MatrixXd V(_state.cage.num_keyframes()*4, 3);
     for (BoundingCage::KeyFrame& kf : _state.cage.keyframes) {
-        Eigen::MatrixXd kfV = kf.bounding_box_vertices_3d();
+        const BoundingCage::KeyFrame::BoxVertices3d& kfV = kf.bounding_box_vertices_3d();
         for (int i = 0; i < kfV.rows(); i++) {
             glm::vec4 v(kfV(i, 0) / volume_size[0], kfV(i, 1) / volume_size[1], kfV(i, 2) / volume_size[2], 1.0);
             glm::vec4 vtx = scaling * translate * v;
@@ -82,54 +97,89 @@ void Bounding_Widget_3d::center_straight_mesh() {
     _viewer->core.align_camera_center(V);
 }
 
-void Bounding_Widget_3d::update_volume_geometry(const Eigen::RowVector3d& volume_size, const Eigen::MatrixXd& cage_V, const Eigen::MatrixXi& cage_F) {
-    std::size_t num_vertices = cage_V.rows();
-    std::size_t num_faces = cage_F.rows();
-    std::vector<glm::vec3> V(num_vertices);
-    std::vector<glm::ivec3> F(num_faces);
-    for (int i = 0; i < num_vertices; i++) {
-        double x = cage_V(i, 0) / volume_size[0];
-        double y = cage_V(i, 1) / volume_size[1];
-        double z = cage_V(i, 2) / volume_size[2];
-        V[i] = glm::vec3(x, y, z);
+void Bounding_Widget_3d::update_volume_geometry(const Eigen::RowVector3d& volume_size) {
+    int dirty_begin, dirty_end;
+    const EditLatency::Clock::time_point mesh_start = EditLatency::Clock::now();
+    const std::vector<GLfloat>& V = _state.cage.mesh_vertex_buffer(volume_size, dirty_begin, dirty_end);
+    edit_latency().add("Cage mesh", mesh_start);
+    const GLsizei num_vertices = GLsizei(V.size() / 3);
+
+    EditLatency::Scope latency_scope("3d geometry");
+
+    // The faces only depend on the number of KeyFrames. As long as it stays the same, only the
+    // vertices of the KeyFrames which changed since the last frame are uploaded.
+    if (num_vertices != _cage_num_vertices) {
+        // Laid out like the index buffer
+        const RowMatrixX3i F = _state.cage.mesh_faces();
+        const GLsizei num_faces = GLsizei(F.rows());
+
+        volume_renderer.set_bounding_geometry(const_cast<GLfloat*>(V.data()), num_vertices,
+                                              const_cast<GLint*>(F.data()), num_faces);
+        _cage_num_vertices = num_vertices;
+    } else {
+        volume_renderer.update_bounding_vertices(V.data() + 3*dirty_begin, dirty_begin, dirty_end - dirty_begin);
     }
-    for (int i = 0; i < num_faces; i++) {
-        F[i] = glm::ivec3(cage_F(i, 0), cage_F(i, 1), cage_F(i, 2));
-    }
-
-    volume_renderer.set_bounding_geometry((GLfloat*)V.data(), num_vertices, (GLint*)F.data(), num_faces);
 }
 
 void Bounding_Widget_3d::update_2d_geometry_curved(BoundingCage::KeyFrameIterator current_kf) {
     typedef Eigen::Matrix<GLfloat, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixXfRm;
     const Eigen::RowVector3f volume_size = _state.low_res_volume.dims().cast<float>();
 
-    std::vector<GLfloat> cageV;
-    int num_vertices = 0;
-    for (BoundingCage::Cell& cell : _state.cage.cells) {
-        BoundingCage::KeyFrameIterator lkf = cell.left_keyframe(), rkf = cell.right_keyframe();
-        Eigen::MatrixXd lkfV = lkf->bounding_box_vertices_3d();
-        Eigen::MatrixXd rkfV = rkf->bounding_box_vertices_3d();
-
-        for (int i = 0; i < lkfV.rows(); i++) {
-            int next_i = (i + 1) % lkfV.rows();
-            for (int j = 0; j < 3; j++) { cageV.push_back(lkfV(i, j) / volume_size[j]); }
-            for (int j = 0; j < 3; j++) { cageV.push_back(lkfV(next_i, j) / volume_size[j]); }
-            for (int j = 0; j < 3; j++) { cageV.push_back(rkfV(i, j) / volume_size[j]); }
-            for (int j = 0; j < 3; j++) { cageV.push_back(rkfV(next_i, j) / volume_size[j]); }
-            for (int j = 0; j < 3; j++) { cageV.push_back(lkfV(i, j) / volume_size[j]); }
-            for (int j = 0; j < 3; j++) { cageV.push_back(rkfV(i, j) / volume_size[j]); }
-
-            num_vertices += 6;
-        }
-    }
+    // Each Cell is drawn with 24 line vertices. Only the Cells next to a KeyFrame whose geometry changed since
+    // the last frame are written again, so dragging a KeyFrame rewrites the 2 Cells around it.
+    constexpr int VERTICES_PER_CELL = 24;
+    constexpr std::size_t CELLS_PER_CHUNK = 1024;
+    const int num_keyframes = _state.cage.num_keyframes();
+    const int num_cells = _state.cage.num_cells();
     glm::vec4 cage_color(0.2, 0.2, 0.8, 0.5);
     PointLineRenderer::PolylineStyle cage_style;
     cage_style.primitive = PointLineRenderer::LINES;
     cage_style.render_points = true;
     cage_style.line_width = 1.0f;
     cage_style.point_size = 4.0f;
-    renderer_2d.update_polyline_3d(cage_polyline_id, cageV.data(),cage_color, num_vertices, cage_style);
+    renderer_2d.resize_polyline_3d(cage_polyline_id, cage_color, num_cells * VERTICES_PER_CELL, cage_style);
+    if (int(_cage_line_versions.size()) != num_keyframes || volume_size != _cage_line_scale) {
+        _cage_line_versions.assign(num_keyframes, 0);
+        _cage_line_scale = volume_size;
+    }
+
+    // The Cells between the first and the last one touching a changed KeyFrame are written in parallel into one
+    // buffer and uploaded at once, the GL calls stay on this thread
+    int first_cell = num_cells, last_cell = -1;
+    for (int kf_i = 0; kf_i < num_keyframes; kf_i++) {
+        const BoundingCage::KeyFrame& kf = _state.cage.keyframe(kf_i);
+        if (kf.geometry_version() != _cage_line_versions[kf_i]) {
+            first_cell = std::min(first_cell, std::max(kf_i - 1, 0));
+            last_cell = std::min(kf_i, num_cells - 1);
+            _cage_line_versions[kf_i] = kf.geometry_version();
+        }
+    }
+
+    if (first_cell <= last_cell) {
+        const int num_dirty_cells = last_cell - first_cell + 1;
+        _cage_line_buffer.resize(std::size_t(num_dirty_cells) * VERTICES_PER_CELL * 3);
+        parallel_for_chunks(std::size_t(num_dirty_cells), [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t c = begin; c < end; c++) {
+                const int cell_i = first_cell + int(c);
+                const BoundingCage::KeyFrame::BoxVertices3d& lkfV = _state.cage.keyframe(cell_i).bounding_box_vertices_3d();
+                const BoundingCage::KeyFrame::BoxVertices3d& rkfV = _state.cage.keyframe(cell_i + 1).bounding_box_vertices_3d();
+
+                GLfloat* cellV = &_cage_line_buffer[c * VERTICES_PER_CELL * 3];
+                int count = 0;
+                for (int i = 0; i < lkfV.rows(); i++) {
+                    int next_i = (i + 1) % lkfV.rows();
+                    for (int j = 0; j < 3; j++) { cellV[count++] = lkfV(i, j) / volume_size[j]; }
+                    for (int j = 0; j < 3; j++) { cellV[count++] = lkfV(next_i, j) / volume_size[j]; }
+                    for (int j = 0; j < 3; j++) { cellV[count++] = rkfV(i, j) / volume_size[j]; }
+                    for (int j = 0; j < 3; j++) { cellV[count++] = rkfV(next_i, j) / volume_size[j]; }
+                    for (int j = 0; j < 3; j++) { cellV[count++] = lkfV(i, j) / volume_size[j]; }
+                    for (int j = 0; j < 3; j++) { cellV[count++] = rkfV(i, j) / volume_size[j]; }
+                }
+            }
+        }, CELLS_PER_CHUNK);
+        renderer_2d.update_polyline_3d_range(cage_polyline_id, _cage_line_buffer.data(),
+                                             first_cell * VERTICES_PER_CELL, num_dirty_cells * VERTICES_PER_CELL);
+    }
 
     MatrixXfRm kfV = current_kf->bounding_box_vertices_3d().cast<GLfloat>();
     kfV.array().rowwise() /= volume_size.array();
@@ -141,11 +191,12 @@ void Bounding_Widget_3d::update_2d_geometry_curved(BoundingCage::KeyFrameIterato
     kf_style.point_size = 4.0f;
     renderer_2d.update_polyline_3d(current_kf_polyline_id, kfV.data(), kf_color, kfV.rows(), kf_style);
 
-    MatrixXfRm skV(_state.cage.num_keyframes(), 3);
-    int count = 0;
-    for (const BoundingCage::KeyFrame& kf : _state.cage.keyframes) {
-        skV.row(count++) = kf.centroid_3d().cast<GLfloat>().array() / volume_size.array();
-    }
+    MatrixXfRm skV(num_keyframes, 3);
+    parallel_for_chunks(std::size_t(num_keyframes), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            skV.row(i) = _state.cage.keyframe(int(i)).centroid_3d().cast<GLfloat>().array() / volume_size.array();
+        }
+    }, CELLS_PER_CHUNK);
     PointLineRenderer::PolylineStyle sk_style;
     sk_style.primitive = PointLineRenderer::LINE_STRIP;
     sk_style.render_points = false;
@@ -210,6 +261,8 @@ void Bounding_Widget_3d::update_2d_geometry_straight(BoundingCage::KeyFrameItera
     cage_style.line_width = 1.0f;
     cage_style.point_size = 4.0f;
     renderer_2d.update_polyline_3d(cage_polyline_id, cageV.data(),cage_color, num_vertices, cage_style);
+    // The curved view has to write all of its Cells again
+    _cage_line_versions.clear();
 
 
     MatrixXfRm kfV(4, 3);
@@ -246,7 +299,10 @@ bool Bounding_Widget_3d::post_draw_straight(const glm::vec4 &viewport, BoundingC
     GLint old_viewport[4];
     glGetIntegerv(GL_VIEWPORT, old_viewport);
 
-    update_2d_geometry_straight(current_kf);
+    {
+        EditLatency::Scope latency_scope("3d geometry");
+        update_2d_geometry_straight(current_kf);
+    }
 
     glm::ivec2 viewport_size = glm::ivec2(viewport[2], viewport[3]);
     glm::ivec2 viewport_pos = glm::ivec2(viewport[0], viewport[1]);
@@ -271,40 +327,19 @@ bool Bounding_Widget_3d::post_draw_straight(const glm::vec4 &viewport, BoundingC
     glm::mat4 proj_matrix = GM4f(_viewer->core.proj);
     glm::vec3 light_position = G3f(_viewer->core.light_position);
 
-    constexpr GLsizei NUM_VERTICES = 8;
-    constexpr GLsizei NUM_FACES = 12;
-    std::array<GLfloat, NUM_VERTICES*3> vertex_data = {
-        0.f, 0.f, 0.f,
-        0.f, 0.f, 1.f,
-        0.f, 1.f, 0.f,
-        0.f, 1.f, 1.f,
-        1.f, 0.f, 0.f,
-        1.f, 0.f, 1.f,
-        1.f, 1.f, 0.f,
-        1.f, 1.f, 1.f
-    };
-    std::array<GLint, NUM_FACES*3> index_data = {
-        0, 6, 4,
-        0, 2, 6,
-        0, 3, 2,
-        0, 1, 3,
-        2, 7, 6,
-        2, 3, 7,
-        4, 6, 7,
-        4, 7, 5,
-        0, 4, 5,
-        0, 5, 1,
-        1, 5, 7,
-        1, 7, 3
-    };
-
 //    volume_renderer.set_step_size(1.0 / glm::length(G3f(_state.low_res_volume.dims())));
-    volume_renderer.set_step_size(1.0 / glm::length(glm::vec3(volume_dims)));
-    volume_renderer.begin(volume_dims, straight_tex);
-    volume_renderer.set_bounding_geometry(vertex_data.data(), NUM_VERTICES, index_data.data(), NUM_FACES);
-    volume_renderer.render_pass(model_matrix, view_matrix, proj_matrix, light_position, true /* final */);
-
-    renderer_2d.draw(model_matrix, view_matrix, proj_matrix);
+    volume_renderer.set_step_size(TransferFunctionTexture::STEP_SCALE / glm::length(glm::vec3(volume_dims)));
+    volume_renderer.set_footprint_scale(_state.ray_step_pixels);
+    volume_renderer.set_interactive(_viewer->down);
+    {
+        EditLatency::Scope latency_scope("Volume rendering");
+        volume_renderer.begin(volume_dims, straight_tex);
+        // The straightened volume fills the unit cube, its ray endpoints are computed analytically
+        volume_renderer.set_bounding_box();
+        volume_renderer.render_pass(model_matrix, view_matrix, proj_matrix, light_position, true /* final */);
+
+        renderer_2d.draw(model_matrix, view_matrix, proj_matrix);
+    }
     glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
     return false;
 }
@@ -314,7 +349,10 @@ bool Bounding_Widget_3d::post_draw_curved(const glm::vec4& viewport, BoundingCag
     GLint old_viewport[4];
     glGetIntegerv(GL_VIEWPORT, old_viewport);
 
-    update_2d_geometry_curved(current_kf);
+    {
+        EditLatency::Scope latency_scope("3d geometry");
+        update_2d_geometry_curved(current_kf);
+    }
 
     glm::ivec2 viewport_size = glm::ivec2(viewport[2], viewport[3]);
     glm::ivec2 viewport_pos = glm::ivec2(viewport[0], viewport[1]);
@@ -338,48 +376,23 @@ bool Bounding_Widget_3d::post_draw_curved(const glm::vec4& viewport, BoundingCag
     glm::vec3 light_position = G3f(_viewer->core.light_position);
 
 
-    // Sort the cells of the bounding cage front to back
-    std::vector<BoundingCage::CellIterator> sorted_cells;
-    for (auto it = _state.cage.cells.begin(); it != _state.cage.cells.end(); it++) {
-        sorted_cells.push_back(it);
-    }
-    auto comp_cells = [&](BoundingCage::CellIterator c1, BoundingCage::CellIterator c2) -> bool {
-        glm::vec4 volume_dims = glm::vec4(G3i(_state.low_res_volume.dims()), 1.0);
-        glm::vec4 c1l = glm::vec4(G3f(c1->left_keyframe()->centroid_3d()), 1.0) / volume_dims;
-        glm::vec4 c1r = glm::vec4(G3f(c1->right_keyframe()->centroid_3d()), 1.0) / volume_dims;
-        glm::vec4 c2l = glm::vec4(G3f(c2->left_keyframe()->centroid_3d()), 1.0) / volume_dims;
-        glm::vec4 c2r = glm::vec4(G3f(c2->right_keyframe()->centroid_3d()), 1.0) / volume_dims;
-
-        glm::vec4 cam_ctr = glm::vec4(G3f(_viewer->core.camera_center), 1.0);
-
-        c1l = model_matrix*c1l;
-        c1r = model_matrix*c1r;
-        c2l = model_matrix*c2l;
-        c2r = model_matrix*c2r;
-
-        float d1 = glm::max(glm::distance(c1l, cam_ctr), glm::distance(c1r, cam_ctr));
-        float d2 = glm::max(glm::distance(c2l, cam_ctr), glm::distance(c2r, cam_ctr));
-
-        return d1 < d2;
-    };
-    std::sort(sorted_cells.begin(), sorted_cells.end(), comp_cells);
-
-
     glViewport(viewport_pos.x, viewport_pos.y, viewport_size.x, viewport_size.y);
 
-    volume_renderer.set_step_size(1.0 / glm::length(glm::vec3(volume_dims)));
-    volume_renderer.begin(volume_dims, _state.low_res_volume.volume_texture);
-    for (int i = 0; i < sorted_cells.size(); i++) {
-        auto cell = sorted_cells[i];
-        Eigen::MatrixXd cV = cell->mesh_vertices();
-        Eigen::MatrixXi cF = cell->mesh_faces();
-        update_volume_geometry(_state.low_res_volume.dims().cast<double>(), cV, cF);
+    // The boundary of the whole cage is depth peeled and ray cast in a single pass, so the cost
+    // does not grow with the number of cells and no front to back sort of the cells is needed
+    update_volume_geometry(_state.low_res_volume.dims().cast<double>());
 
-        bool final = (i == sorted_cells.size()-1);
-        volume_renderer.render_pass(model_matrix, view_matrix, proj_matrix, light_position, final);
-    }
+    volume_renderer.set_step_size(TransferFunctionTexture::STEP_SCALE / glm::length(glm::vec3(volume_dims)));
+    volume_renderer.set_footprint_scale(_state.ray_step_pixels);
+    // Render at a reduced quality while the camera is being dragged
+    volume_renderer.set_interactive(_viewer->down);
+    {
+        EditLatency::Scope latency_scope("Volume rendering");
+        volume_renderer.begin(volume_dims, _state.low_res_volume.volume_texture);
+        volume_renderer.render_peeled(model_matrix, view_matrix, proj_matrix, light_position);
 
-    renderer_2d.draw(model_matrix, view_matrix, proj_matrix);
+        renderer_2d.draw(model_matrix, view_matrix, proj_matrix);
+    }
 
     // Restore the previous viewport
     glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
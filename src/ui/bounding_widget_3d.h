@@ -14,8 +14,10 @@ class Bounding_Widget_3d {
 public:
     Bounding_Widget_3d(State& state);
 
+    // The renderers are created on the first initialize and kept when the screen is left, destroy releases them
     void initialize(igl::opengl::glfw::Viewer* viewer, Bounding_Polygon_Menu* parent);
     void deinitialize();
+    void destroy();
     bool pre_draw(float current_cut_index);
     bool post_draw_curved(const glm::vec4& viewport, BoundingCage::KeyFrameIterator current_kf);
     bool post_draw_straight(const glm::vec4& viewport, BoundingCage::KeyFrameIterator current_kf);
@@ -30,7 +32,7 @@ public:
 
 private:
 
-    void update_volume_geometry(const Eigen::RowVector3d& volume_size, const Eigen::MatrixXd& cage_V, const Eigen::MatrixXi& cage_F);
+    void update_volume_geometry(const Eigen::RowVector3d& volume_size);
     void update_2d_geometry_curved(BoundingCage::KeyFrameIterator current_kf);
     void update_2d_geometry_straight(BoundingCage::KeyFrameIterator current_kf);
 
@@ -43,6 +45,16 @@ private:
     Bounding_Polygon_Menu* _parent;
 
     glm::vec4 _last_viewport;
+
+    // Number of vertices of the cage mesh last given to set_bounding_geometry
+    GLsizei _cage_num_vertices = -1;
+
+    // Geometry version of each KeyFrame when the lines of its Cells were last written to the cage polyline,
+    // and the volume size they were scaled by
+    std::vector<std::uint64_t> _cage_line_versions;
+    Eigen::RowVector3f _cage_line_scale = Eigen::RowVector3f::Zero();
+    // Line vertices of the Cells written on the last frame
+    std::vector<GLfloat> _cage_line_buffer;
 };
 
 #endif // BOUNDING_WIDGET_3D_H
@@ -1,11 +1,13 @@
 #include "endpoint_selection_plugin.h"
 
+#include "meshing_plugin.h"
 #include "state.h"
 #include "utils/colors.h"
+#include "utils/dexel_meshing.h"
+#include "utils/glm_conversion.h"
+#include "utils/skeleton_extraction.h"
 #include "utils/utils.h"
 
-#include <igl/boundary_facets.h>
-#include <igl/marching_tets.h>
 #include <igl/unproject_onto_mesh.h>
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
@@ -39,57 +41,30 @@ bool validate_endpoint_pairs(const std::vector<std::pair<int, int>>& endpoints,
 }
 
 
-void compute_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
-                      const Eigen::VectorXd normalized_distances,
-                      const std::vector<std::pair<int, int>>& endpoint_pairs,
-                      const Eigen::VectorXi& connected_components,
-                      int num_skeleton_vertices,
-                      Eigen::MatrixXd& skeleton_vertices) {
-    std::vector<Eigen::MatrixXi> TT_comps;
-    split_mesh_components(TT, connected_components, TT_comps);
-
-    Eigen::MatrixXd LV;
-    Eigen::MatrixXi LF;
-
-    int vertex_count = 0;
-    skeleton_vertices.resize(num_skeleton_vertices, 3);
-
-    for (int ep_i = 0; ep_i < endpoint_pairs.size(); ep_i++) {
-        const int component = connected_components[endpoint_pairs[ep_i].first];
-        skeleton_vertices.row(vertex_count) = TV.row(endpoint_pairs[ep_i].first);
-        vertex_count++;
-
-        const double nd_ep0 = normalized_distances[endpoint_pairs[ep_i].first];
-        const double nd_ep1 = normalized_distances[endpoint_pairs[ep_i].second];
-        const double isoval_incr = (nd_ep1 - nd_ep0) / num_skeleton_vertices;
-
-        double isovalue = normalized_distances[endpoint_pairs[ep_i].first] + isoval_incr;
-        for (int i = 0; i < num_skeleton_vertices - 2; i++) {
-            igl::marching_tets(TV, TT_comps[component], normalized_distances, isovalue, LV, LF);
-            if (LV.rows() == 0) {
-                isovalue += isoval_incr;
-                continue;
-            }
-            Eigen::RowVector3d c = LV.colwise().sum() / LV.rows();
-            skeleton_vertices.row(vertex_count) = c;
-            vertex_count += 1;
-            isovalue += isoval_incr;
-        }
+} // namespace
 
-        skeleton_vertices.row(vertex_count) = TV.row(endpoint_pairs[ep_i].second);
-        vertex_count += 1;
-    }
+extern Meshing_Menu meshing_menu;
 
-    skeleton_vertices.conservativeResize(vertex_count, 3);
-}
 
+struct EndPoint_Selection_Menu::SkeletonRun {
+    State::SkeletonEstimationParameters parameters;
+    Eigen::MatrixXd skeleton_vertices;
+    Eigen::VectorXd geodesic_dists;
+    SkeletonExtractionCache cache;
+};
 
-} // namespace
 
-EndPoint_Selection_Menu::EndPoint_Selection_Menu(State& state) : state(state) {
-  extracting_skeleton = false;
-  done_extracting_skeleton = false;
-}
+struct EndPoint_Selection_Menu::DistancePreview {
+    std::shared_ptr<const GraphGeodesics> graph;
+    Eigen::VectorXd geodesic_dists;
+    // The distances are the geodesic field of extract_skeleton rather than the graph distances, and the cache
+    // holds the stages it computed
+    bool accurate = false;
+    SkeletonExtractionCache cache;
+};
+
+
+EndPoint_Selection_Menu::EndPoint_Selection_Menu(State& state) : state(state) {}
 
 
 void EndPoint_Selection_Menu::initialize() {
@@ -104,8 +79,15 @@ void EndPoint_Selection_Menu::initialize() {
 
     const Eigen::MatrixXd& TV = state.dilated_tet_mesh.TV;
     const Eigen::MatrixXi& TF = state.dilated_tet_mesh.TF;
-    viewer->data().set_mesh(TV, TF);
+    if (!mesh_renderer_initialized) {
+        mesh_renderer.init();
+        mesh_renderer_initialized = true;
+    }
+    upload_tet_mesh();
     viewer->core.align_camera_center(TV, TF);
+    build_picking_index();
+    stop_distance_preview();
+    edge_graph.reset();
 
     viewer->append_mesh();
     points_overlay_id = static_cast<int>(viewer->selected_data_index);
@@ -131,15 +113,135 @@ void EndPoint_Selection_Menu::initialize() {
     current_endpoints = { -1, -1 };
 
     done_extracting_skeleton = false;
-    extracting_skeleton = false;
     debug.drew_debug_state = false;
+    slim_preview = false;
+    slim_mesh_id = -1;
+}
+
+void EndPoint_Selection_Menu::upload_tet_mesh() {
+    mesh_renderer.set_mesh(state.dilated_tet_mesh.TV, state.dilated_tet_mesh.TF);
+    mesh_renderer.set_scalars(state.dilated_tet_mesh.geodesic_dists);
+    mesh_renderer.show_faces = true;
+}
+
+void EndPoint_Selection_Menu::refresh_tet_mesh() {
+    upload_tet_mesh();
+    build_picking_index();
+    stop_distance_preview();
+    edge_graph.reset();
+
+    // Endpoints picked halfway are vertices of the old mesh, the pairs were moved to the new one
+    current_endpoint_idx = 0;
+    current_endpoints = { -1, -1 };
+    if (state.skeleton_estimation_parameters.endpoint_pairs.empty()) {
+        state.dirty_flags.endpoints_dirty = false;
+        selecting_endpoints = true;
+    }
+    debug.drew_debug_state = false;
+}
+
+void EndPoint_Selection_Menu::build_picking_index() {
+    picking_index.reset();
+    std::shared_ptr<ResultHandoff<SurfaceRayIndex>> result = std::make_shared<ResultHandoff<SurfaceRayIndex>>();
+    picking_index_result = result;
+    // The mesh of the state can be replaced while the job runs, the index is built from its own copy
+    picking_index_job.start([result, TV = state.dilated_tet_mesh.TV, TF = state.dilated_tet_mesh.TF](JobContext& context) {
+        context.begin_stage("Building the picking hierarchy");
+        result->publish(std::make_shared<SurfaceRayIndex>(TV, TF));
+        return true;
+    }, std::function<void()>(), TaskLane::Interactive);
+}
+
+void EndPoint_Selection_Menu::start_distance_preview() {
+    std::shared_ptr<DistancePreview> run = std::make_shared<DistancePreview>();
+    run->graph = edge_graph;
+    run->cache = state.dilated_tet_mesh.skeleton_cache;
+    std::shared_ptr<ResultHandoff<DistancePreview>> result = std::make_shared<ResultHandoff<DistancePreview>>();
+    distance_preview_result = result;
+    // A cancelled preview can still be in the skeleton extraction when the mesh of the state is replaced, so the
+    // job works on its own copy of the mesh
+    distance_preview_job.start([run, result, parameters = state.skeleton_estimation_parameters,
+                                TV = state.dilated_tet_mesh.TV, TT = state.dilated_tet_mesh.TT,
+                                components = state.dilated_tet_mesh.connected_components,
+                                logger = state.logger](JobContext& context) {
+        if (!run->graph) {
+            context.begin_stage("Building the edge graph");
+            std::shared_ptr<GraphGeodesics> graph = std::make_shared<GraphGeodesics>();
+            if (!graph->compute(TV, TT)) {
+                return false;
+            }
+            run->graph = graph;
+        }
+        if (context.cancelled()) {
+            return false;
+        }
+        context.begin_stage("Computing the graph distances");
+        if (!run->graph->solve(parameters.endpoint_pairs, run->geodesic_dists)) {
+            return false;
+        }
+        // The preview is handed over while the geodesic field is computed
+        result->publish(std::make_shared<DistancePreview>(*run));
+        if (context.cancelled()) {
+            return false;
+        }
+        if (parameters.voxel_skeleton) {
+            // The skeleton is traced through the dexels, there is no geodesic field to compute
+            return true;
+        }
+
+        // Cannot be interrupted, like the skeleton job
+        context.begin_stage("Computing the geodesic distances");
+        Eigen::MatrixXd skeleton_vertices;
+        if (!::extract_skeleton(TV, TT, components, parameters.endpoint_pairs, parameters.num_subdivisions,
+                                skeleton_vertices, run->geodesic_dists, run->cache, parameters.heat_geodesics,
+                                logger)) {
+            return false;
+        }
+        run->accurate = true;
+        result->publish(run);
+        return true;
+    }, [this]() { state.redraw.request(RedrawScheduler::BackgroundJobs); }, TaskLane::Interactive);
+}
+
+void EndPoint_Selection_Menu::stop_distance_preview() {
+    distance_preview_job.cancel();
+    distance_preview_result.reset();
+}
+
+void EndPoint_Selection_Menu::poll_distance_preview() {
+    const JobStatus status = distance_preview_job.poll();
+    if (!distance_preview_result) {
+        return;
+    }
+    // The graph distances are taken while the job runs, the geodesic field once it is done
+    std::shared_ptr<DistancePreview> preview = distance_preview_result->take();
+    if (preview) {
+        edge_graph = preview->graph;
+        state.dilated_tet_mesh.geodesic_dists = std::move(preview->geodesic_dists);
+        mesh_renderer.set_scalars(state.dilated_tet_mesh.geodesic_dists);
+        if (preview->accurate) {
+            state.dilated_tet_mesh.skeleton_cache = std::move(preview->cache);
+        }
+    }
+    if (status != JobStatus::Running) {
+        distance_preview_result.reset();
+    }
 }
 
 void EndPoint_Selection_Menu::deinitialize() {
+    stop_slim_preview();
+    picking_index_job.cancel();
+    picking_index_result.reset();
+    picking_index.reset();
+    stop_distance_preview();
     for (size_t i = viewer->data_list.size() - 1; i > 0; i--) {
         viewer->erase_mesh(i);
     }
     viewer->data().clear();
+    if (mesh_renderer_initialized) {
+        mesh_renderer.destroy();
+        mesh_renderer_initialized = false;
+    }
     viewer->core.viewport = old_viewport;
 }
 
@@ -169,20 +271,55 @@ bool EndPoint_Selection_Menu::pre_draw() {
     }
     viewer->selected_data_index = push_mesh_id;
 
+    if (slim_preview && slim_mesh_id >= 0) {
+        std::shared_ptr<Eigen::MatrixXd> V = slim_deformer.take_vertices();
+        if (V) {
+            viewer->data_list[slim_mesh_id].set_vertices(*V);
+        }
+    }
+
     return ret;
 }
 
+void EndPoint_Selection_Menu::start_slim_preview() {
+    const Eigen::MatrixXd& TV = state.dilated_tet_mesh.TV;
+    const Eigen::MatrixXi& TT = state.dilated_tet_mesh.TT;
+
+    Eigen::VectorXi b;
+    Eigen::MatrixXd bc;
+    straight_skeleton_constraints(TV, state.cage.smooth_skeleton_vertices(), b, bc);
+
+    int push_mesh_id = static_cast<int>(viewer->selected_data_index);
+    slim_mesh_id = static_cast<int>(viewer->append_mesh() - 1);
+    viewer->data().set_mesh(TV, state.dilated_tet_mesh.TF);
+    viewer->data().show_lines = false;
+    viewer->selected_data_index = push_mesh_id;
+
+    // Stream the iterates at the rate of the screen, the solver keeps going between frames
+    SlimOptions options;
+    options.max_publish_rate = 30.0;
+    options.use_arap = slim_use_arap;
+    slim_deformer.start(TV, TT, options, [this]() { state.redraw.request(RedrawScheduler::BackgroundJobs); });
+    slim_deformer.set_constraints(b, bc);
+}
+
+void EndPoint_Selection_Menu::stop_slim_preview() {
+    slim_deformer.stop();
+    if (slim_mesh_id >= 0 && slim_mesh_id < static_cast<int>(viewer->data_list.size())) {
+        viewer->erase_mesh(slim_mesh_id);
+    }
+    slim_mesh_id = -1;
+}
+
 void EndPoint_Selection_Menu::debug_draw_intermediate_state() {
     if (debug.drew_debug_state) {
         return;
     }
 
+    // Only the edges of the tet mesh are drawn, colored by the geodesic distances if there are any
     viewer->data().clear();
-    const Eigen::MatrixXd& TV = state.dilated_tet_mesh.TV;
-    const Eigen::MatrixXi& TF = state.dilated_tet_mesh.TF;
+    mesh_renderer.show_faces = false;
     Eigen::MatrixXd V1, V2;
-    edge_endpoints(TV, TF, V1, V2);
-    viewer->data().add_edges(V1, V2, ColorRGB::SILVER);
 
     size_t skel_mesh = viewer->append_mesh() - 1;
     viewer->selected_data_index = skel_mesh;
@@ -219,25 +356,27 @@ void EndPoint_Selection_Menu::debug_draw_intermediate_state() {
     size_t kf_mesh = viewer->append_mesh() - 1;
     viewer->selected_data_index = kf_mesh;
     {
-        Eigen::MatrixXd kf_centers(state.cage.num_keyframes(), 3);
-        Eigen::MatrixXd kf_centroids(state.cage.num_keyframes(), 3);
+        // Gather the axes and boxes of all the KeyFrames so each goes to the viewer in one call
+        const int num_keyframes = state.cage.num_keyframes();
+        Eigen::MatrixXd kf_centers(num_keyframes, 3);
+        Eigen::MatrixXd kf_centroids(num_keyframes, 3);
+        Eigen::MatrixXd axis_p1(2*num_keyframes, 3), axis_p2(2*num_keyframes, 3), axis_c(2*num_keyframes, 3);
+        Eigen::MatrixXd bboxv(4*num_keyframes, 3);
         int count = 0;
         for (BoundingCage::KeyFrame& kf : state.cage.keyframes) {
             kf_centers.row(count) = kf.origin();
             kf_centroids.row(count) = kf.centroid_3d();
 
-            Eigen::MatrixXd p1(2, 3), p2(2, 3);
-            Eigen::MatrixXd c(2, 3);
-            c.row(0) = ColorRGB::RED;
-            c.row(0) = ColorRGB::GREEN;
-            p1.row(0) = kf.origin(); p2.row(0) = kf.origin() + 10.0*kf.up_rotated_3d();
-            p1.row(1) = kf.origin(); p2.row(1) = kf.origin() + 10.0*kf.right_rotated_3d();
+            axis_c.row(2*count) = ColorRGB::RED;
+            axis_c.row(2*count+1) = ColorRGB::GREEN;
+            axis_p1.row(2*count) = kf.origin(); axis_p2.row(2*count) = kf.origin() + 10.0*kf.up_rotated_3d();
+            axis_p1.row(2*count+1) = kf.origin(); axis_p2.row(2*count+1) = kf.origin() + 10.0*kf.right_rotated_3d();
 
-            viewer->data().add_edges(p1, p2, c);
-            Eigen::MatrixXd bboxv = kf.bounding_box_vertices_3d();
-            viewer->data().add_points(bboxv, ColorRGB::CYAN);
+            bboxv.block<4, 3>(4*count, 0) = kf.bounding_box_vertices_3d();
             count += 1;
         }
+        viewer->data().add_edges(axis_p1, axis_p2, axis_c);
+        viewer->data().add_points(bboxv, ColorRGB::CYAN);
 
         viewer->data().point_size = 10.0;
         viewer->data().line_width = 2.0;
@@ -252,23 +391,15 @@ void EndPoint_Selection_Menu::debug_draw_intermediate_state() {
     viewer->data().line_color = Eigen::Vector4f(1.0f, 1.0f, 1.0f, 1.0f);
     viewer->data().line_width = 2.0;
 
-    size_t pts_mesh = viewer->append_mesh() - 1;
-    viewer->selected_data_index = pts_mesh;
-    {
-        Eigen::MatrixXd C;
-        double min_z = state.dilated_tet_mesh.geodesic_dists.minCoeff();
-        double max_z = state.dilated_tet_mesh.geodesic_dists.maxCoeff();
-        igl::colormap(igl::COLOR_MAP_TYPE_PARULA, state.dilated_tet_mesh.geodesic_dists, min_z, max_z, C);
-
-        viewer->data().add_points(TV, C);
-        viewer->data().point_size = 4.0;
-    }
-
     debug.drew_debug_state = true;
 }
 
 
 bool EndPoint_Selection_Menu::post_draw() {
+    // The viewer has just drawn its meshes into the viewport with these matrices
+    mesh_renderer.draw(GM4f(viewer->core.model), GM4f(viewer->core.view), GM4f(viewer->core.proj),
+                       G3f(viewer->core.light_position));
+
     bool ret = FishUIViewerPlugin::post_draw();
     int window_width, window_height;
     glfwGetWindowSize(viewer->window, &window_width, &window_height);
@@ -287,10 +418,64 @@ bool EndPoint_Selection_Menu::post_draw() {
                  ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoTitleBar |
                  ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_AlwaysAutoResize);
 
+    if (picking_index_job.poll() == JobStatus::Succeeded && picking_index_result) {
+        picking_index = picking_index_result->take();
+        picking_index_result.reset();
+    }
+
+    poll_distance_preview();
+
+    // The final mesh of a preview replaces it while no job reads it
+    if (!skeleton_job.is_running() && !slim_deformer.is_running() && meshing_menu.update_refinement()) {
+        refresh_tet_mesh();
+    }
+
+    switch (skeleton_job.poll()) {
+    case JobStatus::Succeeded: {
+        std::shared_ptr<SkeletonRun> run = skeleton_result->take();
+        skeleton_result.reset();
+        state.dilated_tet_mesh.geodesic_dists = std::move(run->geodesic_dists);
+        mesh_renderer.set_scalars(state.dilated_tet_mesh.geodesic_dists);
+        state.dilated_tet_mesh.skeleton_cache = std::move(run->cache);
+        // The cage is fit with the parameters the skeleton was extracted with
+        const double rad = run->parameters.cage_bbox_radius;
+        Eigen::Vector4d bbox(-rad, rad, -rad, rad);
+        state.cage.set_skeleton_vertices(run->skeleton_vertices, run->parameters.num_smoothing_iters, bbox);
+        done_extracting_skeleton = true;
+        break;
+    }
+    case JobStatus::Failed:
+    case JobStatus::Cancelled:
+        // Stay on the endpoint selection, the cage has to be extracted again
+        skeleton_result.reset();
+        state.dirty_flags.bounding_cage_dirty = true;
+        break;
+    default:
+        break;
+    }
+
     if (done_extracting_skeleton) {
         if (debug.enabled) {
             debug_draw_intermediate_state();
+            if (ImGui::Checkbox("Parallel ARAP Solver", &slim_use_arap) && slim_preview) {
+                stop_slim_preview();
+                start_slim_preview();
+            }
+            if (ImGui::Checkbox("SLIM Straightening", &slim_preview)) {
+                if (slim_preview) {
+                    start_slim_preview();
+                } else {
+                    stop_slim_preview();
+                }
+            }
+            if (slim_preview) {
+                ImGui::Text("%d iterations, %.1f ms each%s", slim_deformer.num_iterations(),
+                            slim_deformer.average_iteration_ms(), slim_deformer.converged() ? ", converged" : "");
+                ImGui::Text("Energy: %.4g", slim_deformer.energy());
+            }
             if (ImGui::Button("COOL?")) {
+                slim_preview = false;
+                stop_slim_preview();
                 state.set_application_state(Application_State::BoundingPolygon);
             }
         } else {
@@ -298,11 +483,20 @@ bool EndPoint_Selection_Menu::post_draw() {
         }
     }
 
-    if (extracting_skeleton) {
+    if (skeleton_job.is_running()) {
         ImGui::OpenPopup("Extracting Skeleton");
         ImGui::BeginPopupModal("Extracting Skeleton");
         ImGui::Text("Extracting Fish Skeleton. Please wait, this may take a few seconds.");
         ImGui::NewLine();
+        draw_job_stages(skeleton_job);
+        // Keep the stage timings ticking while the job runs
+        state.redraw.request(RedrawScheduler::BackgroundJobs);
+        ImGui::NewLine();
+        if (ImGui::Button("Cancel")) {
+            skeleton_job.cancel();
+            skeleton_result.reset();
+            state.dirty_flags.bounding_cage_dirty = true;
+        }
         ImGui::EndPopup();
     }
 
@@ -384,6 +578,14 @@ bool EndPoint_Selection_Menu::post_draw() {
             state.dirty_flags.bounding_cage_dirty = true;
         }
         ImGui::PopItemWidth();
+
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Heat Method Geodesics", &state.skeleton_estimation_parameters.heat_geodesics)) {
+            state.dirty_flags.bounding_cage_dirty = true;
+        }
+        if (ImGui::Checkbox("Voxel Medial Axis Skeleton", &state.skeleton_estimation_parameters.voxel_skeleton)) {
+            state.dirty_flags.bounding_cage_dirty = true;
+        }
     }
 
     ImGui::NewLine();
@@ -393,7 +595,10 @@ bool EndPoint_Selection_Menu::post_draw() {
         state.set_application_state(Application_State::Segmentation);
     }
     ImGui::SameLine();
-    if (state.skeleton_estimation_parameters.endpoint_pairs.empty()) {
+    // The cage is only fit to the final mesh
+    const bool can_continue = !state.skeleton_estimation_parameters.endpoint_pairs.empty() &&
+            !meshing_menu.is_refining();
+    if (!can_continue) {
         ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
         ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
     }
@@ -402,14 +607,16 @@ bool EndPoint_Selection_Menu::post_draw() {
             extract_skeleton();
             state.dirty_flags.bounding_cage_dirty = false;
         } else {
-            extracting_skeleton = false;
             done_extracting_skeleton = true;
         }
     }
-    if (state.skeleton_estimation_parameters.endpoint_pairs.empty()) {
+    if (!can_continue) {
         ImGui::PopItemFlag();
         ImGui::PopStyleVar();
     }
+    if (meshing_menu.is_refining()) {
+        ImGui::Text("Refining the tet mesh...");
+    }
     ImGui::End();
 
     ImGui::Render();
@@ -430,10 +637,13 @@ bool EndPoint_Selection_Menu::key_down(int key, int modifier) {
     double x = viewer->current_mouse_x;
     double y = viewer->core.viewport(3) - viewer->current_mouse_y;
 
-    if (igl::unproject_onto_mesh(Eigen::Vector2f(x, y),
-            viewer->core.view * viewer->core.model,
-            viewer->core.proj, viewer->core.viewport,
-            state.dilated_tet_mesh.TV, state.dilated_tet_mesh.TF, fid, bc))
+    const Eigen::Matrix4f model = viewer->core.view * viewer->core.model;
+    const bool hit = picking_index ?
+        picking_index->unproject_onto_mesh(Eigen::Vector2f(x, y), model, viewer->core.proj, viewer->core.viewport,
+                                           fid, bc) :
+        igl::unproject_onto_mesh(Eigen::Vector2f(x, y), model, viewer->core.proj, viewer->core.viewport,
+                                 state.dilated_tet_mesh.TV, state.dilated_tet_mesh.TF, fid, bc);
+    if (hit)
     {
         int max;
         bc.maxCoeff(&max);
@@ -466,6 +676,7 @@ bool EndPoint_Selection_Menu::key_down(int key, int modifier) {
                 state.skeleton_estimation_parameters.endpoint_pairs = old_endpoints;
             } else {
                 state.dirty_flags.bounding_cage_dirty = true;
+                start_distance_preview();
             }
         }
     }
@@ -475,52 +686,55 @@ bool EndPoint_Selection_Menu::key_down(int key, int modifier) {
 
 
 void EndPoint_Selection_Menu::extract_skeleton() {
-    auto thread_fun = [&]() {
-        extracting_skeleton = true;
-        glfwPostEmptyEvent();
-
-        const Eigen::MatrixXd& TV = state.dilated_tet_mesh.TV;
-        const Eigen::MatrixXi& TT = state.dilated_tet_mesh.TT;
-        const Eigen::VectorXi& C = state.dilated_tet_mesh.connected_components;
-        const int comp = C[state.skeleton_estimation_parameters.endpoint_pairs[0].first];
-
-        Eigen::MatrixXd TV2;
-        Eigen::MatrixXi TT2;
-        Eigen::VectorXi C2;
-        Eigen::VectorXi CMap;
-        Eigen::VectorXd geodesic_dists2;
-        std::vector<std::pair<int, int>> selected_endpoints_2;
-        remesh_connected_components(comp, C, TV, TT, CMap, TV2, TT2);
-        C2 = Eigen::VectorXi::Zero(TV2.rows());
-        for (const std::pair<int, int>& p : state.skeleton_estimation_parameters.endpoint_pairs) {
-            std::pair<int, int> p2 = std::make_pair(CMap[p.first], CMap[p.second]);
-            selected_endpoints_2.push_back(p2);
-        }
-        Eigen::MatrixXd skeleton_vertices;
-
-        const bool normalized = true;
-        geodesic_distances(TV2, TT2, selected_endpoints_2, geodesic_dists2, normalized);
-        compute_skeleton(TV2, TT2, geodesic_dists2,
-            selected_endpoints_2, C2,
-            state.skeleton_estimation_parameters.num_subdivisions, skeleton_vertices);
-
-        state.dilated_tet_mesh.geodesic_dists.resize(TV.rows());
-        for (int i = 0; i < TV.rows(); i++) {
-            if (CMap[i] >= 0) {
-                state.dilated_tet_mesh.geodesic_dists[i] = geodesic_dists2[CMap[i]];
-            } else {
-                state.dilated_tet_mesh.geodesic_dists[i] = -1.0;
+    // The stages the preview computed so far are in the cache, the skeleton job takes it from there
+    stop_distance_preview();
+    std::shared_ptr<SkeletonRun> run = std::make_shared<SkeletonRun>();
+    // The job starts from the stages of the last runs and hands back the cache it updated, the state only
+    // picks it up once the job succeeds. Only the stages whose inputs changed are computed again, so a change of
+    // the smoothing or of the cage radius goes straight to set_skeleton_vertices.
+    run->cache = state.dilated_tet_mesh.skeleton_cache;
+    // Endpoints can be picked again while the job runs, so it works on a copy of the parameters. The tet mesh is
+    // only replaced by the meshing screen and is read in place.
+    run->parameters = state.skeleton_estimation_parameters;
+    std::shared_ptr<ResultHandoff<SkeletonRun>> result = std::make_shared<ResultHandoff<SkeletonRun>>();
+    skeleton_result = result;
+    skeleton_job.start([this, run, result](JobContext& context) {
+        if (run->parameters.voxel_skeleton && !state.dilated_tet_mesh.dilated_dexels.empty()) {
+            // The dexels the tet mesh was made from are in its frame, the endpoints are looked up in it
+            const std::vector<std::uint8_t>& data = state.dilated_tet_mesh.dilated_dexels;
+            vor3d::CompressedVolume dexels;
+            if (!dexels.loadCompact(data.data(), data.size())) {
+                state.logger->error("Could not read the dexels of the dilated volume");
+                return false;
             }
+            const Eigen::MatrixXd& TV = state.dilated_tet_mesh.TV;
+            std::vector<std::pair<Eigen::RowVector3d, Eigen::RowVector3d>> endpoints;
+            for (const std::pair<int, int>& pair : run->parameters.endpoint_pairs) {
+                endpoints.emplace_back(TV.row(pair.first), TV.row(pair.second));
+            }
+            if (!dexel_skeleton(dexels, state.dilated_tet_mesh.meshing_voxel_radius, endpoints,
+                                run->parameters.num_subdivisions, run->skeleton_vertices, context)) {
+                if (!context.cancelled()) {
+                    state.logger->error("Could not trace the skeleton through the dilated volume");
+                }
+                return false;
+            }
+            // There are no geodesic distances on the tet mesh to show
+            run->geodesic_dists.resize(0);
+            result->publish(run);
+            return true;
         }
-        const double rad = state.skeleton_estimation_parameters.cage_bbox_radius;
-        Eigen::Vector4d bbox(-rad, rad, -rad, rad);
-        state.cage.set_skeleton_vertices(skeleton_vertices, state.skeleton_estimation_parameters.num_smoothing_iters, bbox);
 
-        extracting_skeleton = false;
-        done_extracting_skeleton = true;
-        glfwPostEmptyEvent();
-    };
-
-    extract_skeleton_thread = std::thread(thread_fun);
-    extract_skeleton_thread.detach();
+        // The skeleton extraction itself cannot be interrupted, a cancelled job is only dropped once it returns
+        context.begin_stage("Extracting the skeleton");
+        if (!::extract_skeleton(state.dilated_tet_mesh.TV, state.dilated_tet_mesh.TT,
+                                state.dilated_tet_mesh.connected_components,
+                                run->parameters.endpoint_pairs, run->parameters.num_subdivisions,
+                                run->skeleton_vertices, run->geodesic_dists, run->cache,
+                                run->parameters.heat_geodesics, state.logger)) {
+            return false;
+        }
+        result->publish(run);
+        return true;
+    }, [this]() { state.redraw.request(RedrawScheduler::BackgroundJobs); }, TaskLane::Interactive);
 }
@@ -4,8 +4,15 @@
 #include "fish_ui_viewer_plugin.h"
 
 #include <array>
-#include <atomic>
-#include <thread>
+#include <memory>
+
+#include <utils/background_job.h>
+#include <utils/gl/scalar_mesh_renderer.h>
+#include <utils/graph_geodesics.h>
+#include <utils/result_handoff.h>
+#include <utils/skeleton_extraction.h>
+#include <utils/slim_deformer.h>
+#include <utils/surface_ray_index.h>
 
 struct State;
 
@@ -26,6 +33,15 @@ private:
     } debug;
     void debug_draw_intermediate_state();
 
+    // Volumetric straightening of the tet mesh along the skeleton with SLIM, previewed in the debug view as
+    // an alternative to the cage
+    SlimDeformer slim_deformer;
+    bool slim_preview = false;
+    bool slim_use_arap = true;
+    int slim_mesh_id = -1;
+    void start_slim_preview();
+    void stop_slim_preview();
+
 
     State& state;
 
@@ -35,9 +51,24 @@ private:
 
     bool selecting_endpoints = false;
 
-    std::atomic_bool extracting_skeleton;
-    std::atomic_bool done_extracting_skeleton;
-    std::thread extract_skeleton_thread;
+    // Parameters and output of the skeleton extraction job, published by the job once it is done and handed
+    // to the state when the job succeeds
+    struct SkeletonRun;
+    BackgroundJob skeleton_job;
+    std::shared_ptr<ResultHandoff<SkeletonRun>> skeleton_result;
+    bool done_extracting_skeleton = false;
+
+    // Colormap of the endpoints just picked: their distances along the edges of the tet mesh are shown right
+    // away, then replaced by the geodesic field of the skeleton extraction, which the job goes on to compute and
+    // whose stages it hands to the skeleton cache, so that Next finds them there. The edge graph is built by the
+    // first preview on a mesh and kept until the mesh changes.
+    struct DistancePreview;
+    BackgroundJob distance_preview_job;
+    std::shared_ptr<ResultHandoff<DistancePreview>> distance_preview_result;
+    std::shared_ptr<const GraphGeodesics> edge_graph;
+    void start_distance_preview();
+    void stop_distance_preview();
+    void poll_distance_preview();
 
 
     bool bad_selection = false; // Flag set to true if user selects invalid endpoint pair
@@ -49,7 +80,22 @@ private:
     int mesh_overlay_id;
     int points_overlay_id;
 
+    // The boundary of the tet mesh, drawn by its own renderer rather than an igl ViewerData so that only the
+    // GPU holds a copy and the geodesic distances are colormapped in the shader
+    ScalarMeshRenderer mesh_renderer;
+    bool mesh_renderer_initialized = false;
+    void upload_tet_mesh();
+
     void extract_skeleton();
+    // Show the tet mesh of the state again after the meshing screen replaced it
+    void refresh_tet_mesh();
+
+    // Hierarchy over the boundary faces for picking the endpoints, built in the background whenever the tet
+    // mesh is shown. Clicks fall back to igl::unproject_onto_mesh until it is ready.
+    BackgroundJob picking_index_job;
+    std::shared_ptr<ResultHandoff<SurfaceRayIndex>> picking_index_result;
+    std::shared_ptr<SurfaceRayIndex> picking_index;
+    void build_picking_index();
 };
 
 #endif // __FISH_DEFORMATION_ENDPOINT_SELECTION_STATE__
@@ -5,6 +5,13 @@
 #include <imgui_impl_glfw_gl3.h>
 #include <imgui_fonts_droid_sans.h>
 #include <GLFW/glfw3.h>
+#include <cstdio>
+#include <algorithm>
+#include <utils/frame_timer.h>
+#include <utils/gl/gpu_profiler.h>
+#include <utils/gl/video_memory.h>
+#include <utils/memory_tracker.h>
+#include "input_replay.h"
 
 void FishUIViewerPlugin::init(igl::opengl::glfw::Viewer* _viewer) {
     ViewerPlugin::init(_viewer);
@@ -51,13 +58,179 @@ bool FishUIViewerPlugin::pre_draw() {
     }
 
     ImGui_ImplGlfwGL3_NewFrame();
+    if (replaying_input()) {
+        // The window is hidden, so ImGui polled no mouse
+        ImGuiIO& io = ImGui::GetIO();
+        io.MousePos = ImVec2(viewer->current_mouse_x / pixel_ratio_, viewer->current_mouse_y / pixel_ratio_);
+        for (int i = 0; i < 3; i++) {
+            io.MouseDown[i] = io.MouseDown[i] || replayed_mouse_button_down(i);
+        }
+    }
     return false;
 }
 
 bool FishUIViewerPlugin::post_draw() {
+    if (frame_timer().overlay_enabled()) {
+        draw_frame_timing_window();
+    }
+    if (gpu_profiler().enabled()) {
+        draw_gpu_profiler_window();
+    }
+    if (memory_tracker().overlay_enabled()) {
+        draw_memory_window();
+    }
     return false;
 }
 
+void FishUIViewerPlugin::draw_gpu_profiler_window() {
+    const float scaling = menu_scaling();
+    ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - 320.f * scaling, 10.f), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(310.f * scaling, 0.f), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowBgAlpha(0.8f);
+    ImGui::Begin("GPU Timings", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Columns(3, "gpu_timings");
+    ImGui::Text("Pass"); ImGui::NextColumn();
+    ImGui::Text("Average"); ImGui::NextColumn();
+    ImGui::Text("Last"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (const GpuProfiler::Section& section : gpu_profiler().sections()) {
+        ImGui::Indent(float(section.depth + 1) * 10.f * scaling);
+        ImGui::Text("%s", section.name.c_str());
+        ImGui::Unindent(float(section.depth + 1) * 10.f * scaling);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f ms", section.average_ms); ImGui::NextColumn();
+        ImGui::Text("%.3f ms", section.last_ms); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+namespace {
+
+// Frames shown in the plots of the frame timing overlay
+constexpr std::size_t PLOTTED_FRAMES = 240;
+
+void plot_frame_times(const char* label, const FrameTimer::Section& section, float scaling) {
+    const std::vector<float> samples = FrameTimer::recent_samples(section, PLOTTED_FRAMES);
+    if (samples.empty()) {
+        return;
+    }
+    std::vector<float> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    char overlay[96];
+    snprintf(overlay, sizeof(overlay), "%s: %.2f ms median, %.2f ms 99%%", section.name.c_str(),
+             sorted[sorted.size() / 2], sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)]);
+    // Scaled to the slowest frame shown, but at least one frame at 60 Hz
+    ImGui::PlotHistogram(label, samples.data(), int(samples.size()), 0, overlay, 0.f,
+                         std::max(sorted.back(), 1000.f / 60.f), ImVec2(300.f * scaling, 60.f * scaling));
+}
+
+} // namespace
+
+void FishUIViewerPlugin::draw_frame_timing_window() {
+    const float scaling = menu_scaling();
+    ImGui::SetNextWindowPos(ImVec2(10.f, ImGui::GetIO().DisplaySize.y - 400.f * scaling), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(320.f * scaling, 0.f), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowBgAlpha(0.8f);
+    ImGui::Begin("Frame Timings", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    plot_frame_times("##frame", frame_timer().frame(), scaling);
+    plot_frame_times("##interval", frame_timer().interval(), scaling);
+
+    ImGui::Columns(3, "frame_timings");
+    ImGui::Text("CPU"); ImGui::NextColumn();
+    ImGui::Text("Average"); ImGui::NextColumn();
+    ImGui::Text("Last"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (const FrameTimer::Section& section : frame_timer().sections()) {
+        if (&section == &frame_timer().interval()) {
+            continue;
+        }
+        ImGui::Text("%s", section.name.c_str()); ImGui::NextColumn();
+        ImGui::Text("%.3f ms", section.average_ms); ImGui::NextColumn();
+        ImGui::Text("%.3f ms", section.last_ms); ImGui::NextColumn();
+    }
+    if (gpu_profiler().enabled()) {
+        ImGui::Separator();
+        ImGui::Text("GPU"); ImGui::NextColumn();
+        ImGui::NextColumn();
+        ImGui::NextColumn();
+        for (const GpuProfiler::Section& section : gpu_profiler().sections()) {
+            if (section.depth > 0) {
+                continue;
+            }
+            ImGui::Text("%s", section.name.c_str()); ImGui::NextColumn();
+            ImGui::Text("%.3f ms", section.average_ms); ImGui::NextColumn();
+            ImGui::Text("%.3f ms", section.last_ms); ImGui::NextColumn();
+        }
+    }
+    ImGui::Columns(1);
+    if (!gpu_profiler().enabled()) {
+        ImGui::TextDisabled("F10 adds the GPU time of the render passes");
+    }
+    ImGui::End();
+}
+
+void FishUIViewerPlugin::draw_memory_window() {
+    const float scaling = menu_scaling();
+    ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - 420.f * scaling, 200.f * scaling), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(410.f * scaling, 0.f), ImGuiSetCond_FirstUseEver);
+    ImGui::SetNextWindowBgAlpha(0.8f);
+    ImGui::Begin("Memory", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Columns(3, "memory_usage");
+    ImGui::Text("Subsystem"); ImGui::NextColumn();
+    ImGui::Text("Memory"); ImGui::NextColumn();
+    ImGui::Text("Video memory"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (const MemoryTracker::Usage& usage : memory_tracker().usage()) {
+        ImGui::Text("%s", usage.name.c_str()); ImGui::NextColumn();
+        ImGui::Text("%.1f MiB", to_mib(usage.host_bytes)); ImGui::NextColumn();
+        ImGui::Text("%.1f MiB", to_mib(usage.device_bytes)); ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    ImGui::Text("Total"); ImGui::NextColumn();
+    ImGui::Text("%.1f MiB", to_mib(memory_tracker().total_host_bytes())); ImGui::NextColumn();
+    ImGui::Text("%.1f MiB", to_mib(memory_tracker().total_device_bytes())); ImGui::NextColumn();
+
+    const std::size_t host_available = available_host_memory();
+    const std::size_t device_available = available_video_memory();
+    ImGui::Text("Available"); ImGui::NextColumn();
+    if (host_available > 0) {
+        ImGui::Text("%.1f MiB", to_mib(host_available));
+    } else {
+        ImGui::Text("unknown");
+    }
+    ImGui::NextColumn();
+    if (device_available > 0) {
+        ImGui::Text("%.1f MiB", to_mib(device_available));
+    } else {
+        ImGui::Text("unknown");
+    }
+    ImGui::NextColumn();
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+void FishUIViewerPlugin::draw_job_stages(const BackgroundJob& job) {
+    for (const JobStage& stage : job.stages()) {
+        if (stage.done) {
+            ImGui::Text("%s: %.1f s", stage.name.c_str(), stage.seconds);
+        } else if (stage.progress >= 0.f) {
+            ImGui::Text("%s...", stage.name.c_str());
+            char label[64];
+            if (stage.work_total > 0 && stage.seconds > 0.0) {
+                // Work counted through the progress channel, with how fast it goes
+                snprintf(label, sizeof(label), "%.0f%% (%.1f s, %.0f/s)", 100.f * stage.progress, stage.seconds,
+                         double(stage.work_done) / stage.seconds);
+            } else {
+                snprintf(label, sizeof(label), "%.0f%% (%.1f s)", 100.f * stage.progress, stage.seconds);
+            }
+            ImGui::ProgressBar(stage.progress, ImVec2(-1.f, 0.f), label);
+        } else {
+            ImGui::Text("%s... (%.1f s)", stage.name.c_str(), stage.seconds);
+        }
+    }
+}
+
 void FishUIViewerPlugin::post_resize(int width, int height) {
     if (context_) {
         ImGui::GetIO().DisplaySize.x = float(width);
@@ -3,6 +3,7 @@
 
 #include <igl/opengl/glfw/Viewer.h>
 #include <igl/opengl/glfw/ViewerPlugin.h>
+#include <utils/background_job.h>
 
 struct ImGuiContext;
 
@@ -29,6 +30,18 @@ public:
     virtual bool key_down(int key, int modifiers) override;
     virtual bool key_up(int key, int modifiers) override;
 
+    // Overlay with the GPU time of the render passes, toggled with F10
+    void draw_gpu_profiler_window();
+
+    // Overlay with the CPU time of the frames and of their parts, toggled with F8
+    void draw_frame_timing_window();
+
+    // Overlay with the memory held by each subsystem and the memory left, toggled with F9
+    void draw_memory_window();
+
+    // Stages of a background job with their timings, for the modal shown while it runs
+    void draw_job_stages(const BackgroundJob& job);
+
     void draw_labels_window();
     void draw_labels(const igl::opengl::ViewerData& data);
     void draw_text(Eigen::Vector3d pos, Eigen::Vector3d normal,
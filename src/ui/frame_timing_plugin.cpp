@@ -0,0 +1,22 @@
+#include "frame_timing_plugin.h"
+
+#include <utils/frame_timer.h>
+
+void FrameTimingPlugin::set_screen(const std::string& name) {
+    _pre_draw_section = name + " pre_draw";
+    _post_draw_section = name + " post_draw";
+}
+
+bool FrameTimingPlugin::pre_draw() {
+    frame_timer().mark(_pre_draw_section);
+    return false;
+}
+
+bool FrameTimingPlugin::post_draw() {
+    frame_timer().mark(_post_draw_section);
+    frame_timer().end_frame();
+    if (_frame_end_callback) {
+        _frame_end_callback();
+    }
+    return false;
+}
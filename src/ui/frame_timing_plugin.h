@@ -0,0 +1,28 @@
+#ifndef FRAME_TIMING_PLUGIN_H
+#define FRAME_TIMING_PLUGIN_H
+
+#include <igl/opengl/glfw/ViewerPlugin.h>
+
+#include <functional>
+#include <string>
+
+// Placed after the plugin of the current screen, so that the viewer calls it once that plugin is done with
+// pre_draw and post_draw. It marks both in frame_timer() and ends the frame after post_draw, which is the last
+// thing the viewer does before swapping the buffers.
+class FrameTimingPlugin : public igl::opengl::glfw::ViewerPlugin {
+public:
+    // Sections are named after the screen, e.g. "Segmentation post_draw"
+    void set_screen(const std::string& name);
+    // Called after every frame is ended, while its image is still in the back buffer
+    void set_frame_end_callback(std::function<void()> callback) { _frame_end_callback = std::move(callback); }
+
+    bool pre_draw() override;
+    bool post_draw() override;
+
+private:
+    std::string _pre_draw_section;
+    std::string _post_draw_section;
+    std::function<void()> _frame_end_callback;
+};
+
+#endif // FRAME_TIMING_PLUGIN_H
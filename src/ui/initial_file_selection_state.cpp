@@ -8,6 +8,9 @@
 #include <imgui/imgui.h>
 #include <GLFW/glfw3.h>
 #include <utils/path_utils.h>
+#include <utils/glm_conversion.h>
+#include <utils/image_stack_ingest.h>
+#include <utils/memory_tracker.h>
 #include <utils/open_file_dialog.h>
 #include <utils/string_utils.h>
 #include <imgui/imgui_internal.h>
@@ -24,16 +27,140 @@ void fix_path(char* path) {
     strcpy(path, trimmed_path.c_str());
 }
 
+// Atlas of the full resolution brick cache, shrunk to what the video memory has room for
+std::size_t brick_cache_budget() {
+    return memory_tracker().device_budget("The full resolution brick cache", VolumeBrickCache::DEFAULT_MAX_RESIDENT_BYTES,
+                                          VolumeBrickCache::MIN_RESIDENT_BYTES);
 }
 
+// Warn if the textures of the low resolution volume do not fit in the video memory left. The volume texture is
+// mipmapped, the index texture takes at most 32 bits per voxel.
+void check_low_res_upload(const State::LoadedVolume& volume) {
+    const std::size_t index_bytes = volume.index_data.size() > 0 ? volume.num_voxels() * sizeof(uint32_t) : 0;
+    memory_tracker().check("Uploading the low resolution volume", 0,
+                           volume.num_voxels() * sizeof(uint8_t) * 8 / 7 + index_bytes);
+}
+
+}
+
+
+struct Initial_File_Selection_Menu::LoadRun {
+    // The job loads into a state of its own, which starts out with the inputs of the state
+    State state;
+    bool load_project = false;
+    std::string project_path;
+    // Set to open the project at its cage, the job then clears it if the project has no cage
+    bool open_at_cage = false;
+    bool reuse_full_res = false;
+    // Only load the topology of the volume of the state
+    bool topology_only = false;
+
+    std::vector<uint8_t> low_res_byte_data;
+    RawVolumeView high_res_volume_view;
+
+    // Set when the job fails
+    std::string error;
+};
+
+
 void Initial_File_Selection_Menu::initialize() {
     _state.logger->debug("Initializing File Selection View");
+    if (_state.topology_next_state != Application_State::NoState) {
+        start_topology_load();
+    }
+}
+
+void Initial_File_Selection_Menu::start_topology_load() {
+    std::shared_ptr<LoadRun> run = std::make_shared<LoadRun>();
+    std::shared_ptr<ResultHandoff<LoadRun>> result = std::make_shared<ResultHandoff<LoadRun>>();
+    run->topology_only = true;
+    run->state.logger = _state.logger;
+    run->state.input_metadata = _state.input_metadata;
+    run->state.low_res_volume.metadata = _state.low_res_volume.metadata;
+    run->state.low_res_volume.volume_data = _state.low_res_volume.volume_data;
+    run->state.segmented_features.num_selected_features = _state.segmented_features.num_selected_features;
+    const std::vector<uint32_t> selected_features = _state.segmented_features.selected_features;
+
+    auto load = [run, result, selected_features](JobContext& context) {
+        State& state = run->state;
+        context.begin_stage("Loading the segmentation");
+        state.load_topology(state.low_res_volume, state.input_metadata.low_res_prefix());
+        // load_topology clears the selection, which belongs to the project
+        state.segmented_features.selected_features = selected_features;
+        result->publish(run);
+        return true;
+    };
+    is_loading = true;
+    done_loading = false;
+    loading_result = result;
+    loading_job.start(load, [this]() { _state.redraw.request(RedrawScheduler::BackgroundJobs); });
 }
 
 void Initial_File_Selection_Menu::deinitialize() {
     _state.logger->debug("De-Initializing File Selection View");
 }
 
+void Initial_File_Selection_Menu::take_loaded_state(LoadRun& run) {
+    State& loaded = run.state;
+    uploading_topology_only = run.topology_only;
+    if (run.topology_only) {
+        _state.low_res_volume.index_data = std::move(loaded.low_res_volume.index_data);
+        _state.low_res_volume.content_hash = loaded.low_res_volume.content_hash;
+        _state.low_res_volume.topology_loaded = true;
+        _state.segmented_features = std::move(loaded.segmented_features);
+        next_screen = _state.topology_next_state;
+        _state.topology_next_state = Application_State::NoState;
+        return;
+    }
+    next_screen = run.open_at_cage ? Application_State::BoundingPolygon : Application_State::Segmentation;
+    _state.input_metadata = std::move(loaded.input_metadata);
+
+    // Only the voxels and metadata, the textures are created by the upload that follows
+    _state.low_res_volume.metadata = std::move(loaded.low_res_volume.metadata);
+    _state.low_res_volume.index_data = std::move(loaded.low_res_volume.index_data);
+    _state.low_res_volume.volume_data = std::move(loaded.low_res_volume.volume_data);
+    _state.low_res_volume.histogram = std::move(loaded.low_res_volume.histogram);
+    _state.low_res_volume.min_value = loaded.low_res_volume.min_value;
+    _state.low_res_volume.max_value = loaded.low_res_volume.max_value;
+    _state.low_res_volume.content_hash = loaded.low_res_volume.content_hash;
+    _state.low_res_volume.topology_loaded = loaded.low_res_volume.topology_loaded;
+    _state.hi_res_volume.metadata = std::move(loaded.hi_res_volume.metadata);
+    _state.segmented_features = std::move(loaded.segmented_features);
+
+    // A new scan starts from the mesh and cage parameters of the state. A project brings its own.
+    if (run.load_project) {
+        const int dilation_num_threads = _state.dilated_tet_mesh.dilation_num_threads;
+        const bool radius_sweep = _state.dilated_tet_mesh.radius_sweep;
+        _state.dilated_tet_mesh = std::move(loaded.dilated_tet_mesh);
+        _state.dilated_tet_mesh.dilation_num_threads = dilation_num_threads;
+        _state.dilated_tet_mesh.radius_sweep = radius_sweep;
+        _state.skeleton_estimation_parameters = std::move(loaded.skeleton_estimation_parameters);
+        _state.dirty_flags = loaded.dirty_flags;
+        _state.cage.assign(loaded.cage);
+    } else {
+        // The dilated volume of the previous scan
+        std::vector<std::uint8_t>().swap(_state.dilated_tet_mesh.dilated_dexels);
+        _state.dilated_tet_mesh.dilated_dexels_key = 0;
+    }
+
+    low_res_byte_data = std::move(run.low_res_byte_data);
+    high_res_volume_view = std::move(run.high_res_volume_view);
+    _state.volume_generation++;
+}
+
+void Initial_File_Selection_Menu::open_project(const std::string& path) {
+    if (path.size() >= PATH_BUFFER_SIZE) {
+        _state.logger->error("The project path '{}' is too long", path);
+        return;
+    }
+    strcpy(existing_project_path_buf, path.c_str());
+    fix_path(existing_project_path_buf);
+    show_new_scan_menu = false;
+    _state.dirty_flags.file_loading_dirty = true;
+    open_requested = true;
+    _state.redraw.request(RedrawScheduler::ImGui);
+}
+
 bool Initial_File_Selection_Menu::post_draw() {
     bool ret = FishUIViewerPlugin::post_draw();
 
@@ -48,6 +175,26 @@ bool Initial_File_Selection_Menu::post_draw() {
         ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove |
         ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoTitleBar);
 
+    switch (loading_job.poll()) {
+    case JobStatus::Succeeded:
+        take_loaded_state(*loading_result->take());
+        loading_result.reset();
+        done_loading = true;
+        break;
+    case JobStatus::Failed:
+    case JobStatus::Cancelled: {
+        std::shared_ptr<LoadRun> run = loading_result->take();
+        loading_result.reset();
+        is_loading = false;
+        show_error_popup = true;
+        error_message = run ? run->error : std::string();
+        _state.topology_next_state = Application_State::NoState;
+        break;
+    }
+    default:
+        break;
+    }
+
     if (show_error_popup) {
         ImGui::OpenPopup("Invalid Selection");
         ImGui::BeginPopupModal("Invalid Selection");
@@ -65,35 +212,72 @@ bool Initial_File_Selection_Menu::post_draw() {
         ImGui::BeginPopupModal("Loading CT Scan");
         ImGui::Text("Loading CT Scan. Please wait as this can take a few seconds.");
         ImGui::NewLine();
+        draw_job_stages(loading_job);
+        // Keep the stage timings ticking while the job runs
+        _state.redraw.request(RedrawScheduler::BackgroundJobs);
+        if (is_uploading) {
+            ImGui::Text("Uploading volume to the GPU...");
+            ImGui::ProgressBar(0.5f * (volume_uploader.progress() + index_uploader.progress()));
+        }
         ImGui::EndPopup();
 
-        if (done_loading) {
-            // Volume texture
-            if (_state.low_res_volume.volume_texture == 0) {
-                _state.logger->debug("Creating low resolution volume texture...");
-                glGenTextures(1, &_state.low_res_volume.volume_texture);
+        if (done_loading && !is_uploading) {
+            bool ok = true;
+            if (!uploading_topology_only) {
+                check_low_res_upload(_state.low_res_volume);
+                _state.logger->debug("Streaming low resolution volume texture...");
+                ok = _state.low_res_volume.begin_gl_volume_upload(volume_uploader, std::move(low_res_byte_data), _state.logger);
             }
-            _state.logger->debug("Creating low resolution volume texture...");
-            _state.low_res_volume.load_gl_volume_texture(low_res_byte_data);
 
-            _state.logger->debug("Creating low resolution index texture...");
-            _state.low_res_volume.load_gl_index_texture();
+            // Without the topology the index texture of the previous volume has to go, nothing would replace it
+            if (!_state.low_res_volume.topology_loaded && _state.low_res_volume.index_texture != 0) {
+                glDeleteTextures(1, &_state.low_res_volume.index_texture);
+                _state.low_res_volume.index_texture = 0;
+            }
+            _state.logger->debug("Streaming low resolution index texture...");
+            ok = ok && _state.low_res_volume.begin_gl_index_upload(index_uploader, _state.logger);
+            low_res_byte_data.clear();
 
-            if (_state.hi_res_volume.volume_texture == 0) {
-                _state.logger->debug("Creating high resolution volume texture...");
-                glGenTextures(1, &_state.hi_res_volume.volume_texture);
+            if (!ok) {
+                volume_uploader.destroy();
+                index_uploader.destroy();
+                is_loading = false;
+                done_loading = false;
+                show_error_popup = true;
+                error_message = "Error: Failed to upload the volume to the GPU. See the log for details.";
+            } else if (uploading_topology_only) {
+                is_uploading = true;
+            } else {
+                // The brick cache only allocates its textures, bricks are paged in once there is a cage
+                _state.logger->debug("Creating high resolution brick cache...");
+                _state.hi_res_bricks.init(std::move(high_res_volume_view), G3i(_state.hi_res_volume.dims()),
+                                          _state.hi_res_volume.metadata.bytes_per_voxel(), compress_hi_res_bricks,
+                                          _state.logger,
+                                          brick_cache_budget());
+                is_uploading = true;
             }
-            _state.logger->debug("Creating high resolution volume texture...");
-            _state.hi_res_volume.load_gl_volume_texture(high_res_byte_data);
+        }
 
-            low_res_byte_data.clear();
-            high_res_byte_data.clear();
+        if (is_uploading) {
+            // One slab of each texture per frame keeps the UI responsive
+            volume_uploader.step();
+            index_uploader.step();
+            if (!volume_uploader.is_done() || !index_uploader.is_done()) {
+                _state.redraw.request(RedrawScheduler::VolumeView);
+            }
+        }
 
+        if (is_uploading && volume_uploader.is_done() && index_uploader.is_done()) {
+            is_uploading = false;
             is_loading = false;
             done_loading = false;
             glBindTexture(GL_TEXTURE_3D, 0);
             _state.dirty_flags.file_loading_dirty = false;
-            _state.set_application_state(Application_State::Segmentation);
+            if (uploading_topology_only) {
+                // The screens derived what they show from the volume without its topology
+                _state.volume_generation++;
+            }
+            _state.set_application_state(next_screen);
             ImGui::End();
             ImGui::Render();
             return ret;
@@ -172,6 +356,10 @@ bool Initial_File_Selection_Menu::post_draw() {
             _state.dirty_flags.file_loading_dirty = true;
         }
         ImGui::PopItemWidth();
+        // Changing the factor of a scan then only takes a pass over its full resolution volume
+        if (ImGui::Checkbox("Reuse the Full Resolution Volume", &reuse_full_res)) {
+            _state.dirty_flags.file_loading_dirty = true;
+        }
         ImGui::NewLine();
 
     } else {
@@ -200,6 +388,11 @@ bool Initial_File_Selection_Menu::post_draw() {
                 fix_path(existing_project_path_buf);
             }
         }
+        ImGui::PopItemWidth();
+        // The segmentation is only loaded once the segmentation screen is shown
+        if (ImGui::Checkbox("Open at the Bounding Cage", &open_at_cage)) {
+            _state.dirty_flags.file_loading_dirty = true;
+        }
     } else {
         show_new_scan_menu = true;
     }
@@ -229,12 +422,14 @@ bool Initial_File_Selection_Menu::post_draw() {
             _state.logger->trace("Hacking rawfile {}", debug.rawfile_path);
             _state.low_res_volume.metadata = DatFile(debug.rawfile_path, _state.logger);
             std::string rawfile_path = pathinfo.first + std::string("/") + _state.low_res_volume.metadata.m_raw_filename;
-            load_rawfile(rawfile_path, _state.low_res_volume.dims(),
-                         _state.low_res_volume.volume_data, _state.logger, true /* normalize */);
+            load_rawfile(rawfile_path, _state.low_res_volume.dims(), _state.low_res_volume.volume_data, _state.logger, &_state.low_res_volume.histogram);
+            _state.low_res_volume.min_value = _state.low_res_volume.histogram.min_value;
+            _state.low_res_volume.max_value = _state.low_res_volume.histogram.max_value;
             _state.low_res_volume.preprocess_volume_texture(low_res_byte_data);
             _state.hi_res_volume = _state.low_res_volume;
 
-            load_rawfile(rawfile_path, _state.hi_res_volume.dims(), high_res_byte_data, _state.logger);
+            high_res_volume_view.open(rawfile_path, _state.hi_res_volume.dims(), _state.logger,
+                                      _state.hi_res_volume.metadata.bytes_per_voxel());
             load_rawfile(rawfile_path, _state.hi_res_volume.dims(), low_res_byte_data, _state.logger);
 
             _state.logger->trace("Hacking metadata");
@@ -246,6 +441,7 @@ bool Initial_File_Selection_Menu::post_draw() {
             _state.input_metadata.start_index = 0;
             _state.input_metadata.end_index = 0;
 
+            check_low_res_upload(_state.low_res_volume);
             if (_state.low_res_volume.volume_texture == 0) {
                 _state.logger->debug("Creating low resolution volume texture...");
                 glGenTextures(1, &_state.low_res_volume.volume_texture);
@@ -254,20 +450,20 @@ bool Initial_File_Selection_Menu::post_draw() {
             _state.low_res_volume.load_gl_volume_texture(low_res_byte_data);
 
             _state.logger->debug("Hacking low resolution index texture...");
-            _state.low_res_volume.load_gl_index_texture();
+            _state.low_res_volume.load_gl_index_texture(_state.logger);
 
-            if (_state.hi_res_volume.volume_texture == 0) {
-                _state.logger->debug("Creating high resolution volume texture...");
-                glGenTextures(1, &_state.hi_res_volume.volume_texture);
-            }
-            _state.logger->debug("Hacking high resolution volume texture...");
-            _state.hi_res_volume.load_gl_volume_texture(high_res_byte_data);
+            _state.logger->debug("Hacking high resolution brick cache...");
+            _state.hi_res_bricks.init(std::move(high_res_volume_view), G3i(_state.hi_res_volume.dims()),
+                                      _state.hi_res_volume.metadata.bytes_per_voxel(), compress_hi_res_bricks,
+                                      _state.logger,
+                                      brick_cache_budget());
 
             low_res_byte_data.clear();
-            high_res_byte_data.clear();
 
             meshing_menu.debug.masking_volume_hack = _state.hi_res_volume.volume_data;
             meshing_menu.debug.enabled = true;
+            // The debug volume is meshed as is, there is no segmentation to load
+            _state.low_res_volume.topology_loaded = true;
             _state.dirty_flags.file_loading_dirty = false;
             _state.set_application_state(Application_State::Meshing);
             ImGui::End();
@@ -276,6 +472,10 @@ bool Initial_File_Selection_Menu::post_draw() {
         }
     }
     ImGui::NewLine();
+    // Fits about twice as much of the full resolution scan in video memory at a slight loss of detail
+    if (ImGui::Checkbox("Compress the Full Resolution Scan on the GPU", &compress_hi_res_bricks)) {
+        _state.dirty_flags.file_loading_dirty = true;
+    }
     ImGui::Separator();
 
     bool next_disabled = false;
@@ -297,7 +497,8 @@ bool Initial_File_Selection_Menu::post_draw() {
         }
     }
 
-    if (ImGui::Button("Next")) {
+    if (ImGui::Button("Next") || open_requested) {
+        open_requested = false;
 
         if (!_state.dirty_flags.file_loading_dirty) {
             is_loading = false;
@@ -308,50 +509,78 @@ bool Initial_File_Selection_Menu::post_draw() {
             return ret;
         }
 
-        auto thread_fun = [&]() {
-            // load_volume_data clears _state.segmented_features.selected_features which we don't want to do
+        // The job only touches its run, the loaded state is moved into the state once it succeeds
+        std::shared_ptr<LoadRun> run = std::make_shared<LoadRun>();
+        std::shared_ptr<ResultHandoff<LoadRun>> result = std::make_shared<ResultHandoff<LoadRun>>();
+
+        auto load = [run, result](JobContext& context) {
+            State& state = run->state;
+            auto fail = [&](const std::string& error) {
+                run->error = error;
+                result->publish(run);
+                return false;
+            };
+
+            // load_volume_data clears state.segmented_features.selected_features which we don't want to do
             // if we're deserializing. So we'll back it up and restore it.
             std::vector<uint32_t> selected_features_backup;
 
-            if (show_new_scan_menu) {
-                mkpath(_state.input_metadata.output_dir.c_str(), 0777 /* mode */);
-                ImageData::writeOutput(_state.input_metadata.input_dir, _state.input_metadata.prefix,
-                                       _state.input_metadata.start_index, _state.input_metadata.end_index,
-                                       _state.input_metadata.file_extension, _state.input_metadata.output_dir,
-                                       _state.input_metadata.full_res_prefix(),
-                                       _state.input_metadata.low_res_prefix(),
-                                       _state.input_metadata.downsample_factor,
-                                       true /* write_original */);
-                _state.input_metadata.project_name = "";
+            if (!run->load_project) {
+                context.begin_stage("Reading scan images");
+                mkpath(state.input_metadata.output_dir.c_str(), 0777 /* mode */);
+
+                ImageStackIngestParameters ingest_params;
+                ingest_params.input_dir = state.input_metadata.input_dir;
+                ingest_params.prefix = state.input_metadata.prefix;
+                ingest_params.file_extension = state.input_metadata.file_extension;
+                ingest_params.start_index = state.input_metadata.start_index;
+                ingest_params.end_index = state.input_metadata.end_index;
+                ingest_params.index_width = state.input_metadata.index_width;
+                ingest_params.output_dir = state.input_metadata.output_dir;
+                ingest_params.full_res_prefix = state.input_metadata.full_res_prefix();
+                ingest_params.low_res_prefix = state.input_metadata.low_res_prefix();
+                ingest_params.downsample_factor = state.input_metadata.downsample_factor;
+                ingest_params.write_full_res = true;
+                ingest_params.reuse_full_res = run->reuse_full_res;
+                if (!ingest_image_stack(ingest_params, state.logger)) {
+                    return fail("Error: Failed to read the scan images. See the log for details.");
+                }
+                state.input_metadata.project_name = "";
             } else {
-                if (!igl::deserialize(_state, "state", std::string(existing_project_path_buf))) {
-                    show_error_popup = true;
-                    error_message = "Existing project must be a valid project file";
-                    return;
+                context.begin_stage("Loading project");
+                if (!state.load_project(run->project_path)) {
+                    return fail("Existing project must be a valid project file");
                 }
 
                 // Backup selected features
-                selected_features_backup = _state.segmented_features.selected_features;
+                selected_features_backup = state.segmented_features.selected_features;
 
                 // Set paths so we load from the loaded directory not the original one
-                std::pair<std::string, std::string> existing_project_dbn = dir_and_base_name(existing_project_path_buf);
-                _state.input_metadata.output_dir = existing_project_dbn.first;
-                _state.input_metadata.input_dir = "";
-                _state.input_metadata.file_extension = "";
+                std::pair<std::string, std::string> existing_project_dbn = dir_and_base_name(run->project_path);
+                state.input_metadata.output_dir = existing_project_dbn.first;
+                state.input_metadata.input_dir = "";
+                state.input_metadata.file_extension = "";
             }
 
-            _state.load_volume_data(_state.low_res_volume, _state.input_metadata.low_res_prefix(), true /* load topological features */);
-            _state.low_res_volume.preprocess_volume_texture(low_res_byte_data);
-
-            _state.hi_res_volume.metadata = DatFile(_state.input_metadata.full_res_path_prefix() + ".dat", _state.logger);
-            load_rawfile(_state.input_metadata.full_res_path_prefix() + ".raw", _state.hi_res_volume.dims(), high_res_byte_data, _state.logger);
-
-             if (!show_new_scan_menu) {
-                 _state.segmented_features.selected_features = selected_features_backup;
-             }
+            // The cage editor only samples the volumes, the segmentation is loaded once a screen needs it
+            run->open_at_cage = run->open_at_cage && run->load_project && !state.dirty_flags.bounding_cage_dirty &&
+                                state.cage.num_keyframes() > 1;
+            context.begin_stage("Loading volume");
+            state.load_volume_data(state.low_res_volume, state.input_metadata.low_res_prefix(), !run->open_at_cage);
+            state.low_res_volume.preprocess_volume_texture(run->low_res_byte_data);
+
+            context.begin_stage("Mapping full resolution scan");
+            state.hi_res_volume.metadata = DatFile(state.input_metadata.full_res_path_prefix() + ".dat", state.logger);
+            // Map the full resolution scan, the brick cache pages bricks in from the mapping on demand
+            run->high_res_volume_view.open(state.input_metadata.full_res_path_prefix() + ".raw", state.hi_res_volume.dims(),
+                                           state.logger, state.hi_res_volume.metadata.bytes_per_voxel());
+
+            if (run->load_project) {
+                state.segmented_features.selected_features = selected_features_backup;
+            }
 
-            done_loading = true;
-            glfwPostEmptyEvent();
+            result->publish(run);
+            return true;
         };
 
         if (show_new_scan_menu) {
@@ -372,8 +601,17 @@ bool Initial_File_Selection_Menu::post_draw() {
 
         is_loading = true;
         done_loading = false;
-        loading_thread = std::thread(thread_fun);
-        loading_thread.detach();
+        // The inputs are copied once the form filled them in
+        run->state.logger = _state.logger;
+        run->state.cage.set_logger(_state.logger);
+        run->state.input_metadata = _state.input_metadata;
+        run->state.segmented_features.num_selected_features = _state.segmented_features.num_selected_features;
+        run->load_project = !show_new_scan_menu;
+        run->project_path = existing_project_path_buf;
+        run->open_at_cage = open_at_cage;
+        run->reuse_full_res = reuse_full_res;
+        loading_result = result;
+        loading_job.start(load, [this]() { _state.redraw.request(RedrawScheduler::BackgroundJobs); });
 
         if (show_new_scan_menu) {
             existing_project_path_buf[0] = '\0';
@@ -454,6 +692,12 @@ bool Initial_File_Selection_Menu::process_new_project_form() {
     try {
         first_index = std::stoi(first_index_str);
         last_index = std::stoi(last_index_str);
+
+        // Slices are zero padded if the index string is wider than the number it encodes
+        _state.input_metadata.index_width = 0;
+        if (first_index_str.size() == last_index_str.size() && first_index_str != std::to_string(first_index)) {
+            _state.input_metadata.index_width = static_cast<int>(first_index_str.size());
+        }
     } catch(std::invalid_argument) {
         show_error_popup = true;
         error_message = "Error: Invalid scan image pair must be of the form <prefix><number>.<extension>.";
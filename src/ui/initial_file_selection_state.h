@@ -3,10 +3,11 @@
 
 #include "fish_ui_viewer_plugin.h"
 
-#include <atomic>
-#include <thread>
-
+#include <utils/background_job.h>
+#include <utils/result_handoff.h>
 #include <utils/utils.h>
+#include <utils/raw_volume_view.h>
+#include <utils/gl/volume_texture_uploader.h>
 
 struct State;
 
@@ -18,6 +19,11 @@ public:
     void deinitialize();
     bool post_draw() override;
 
+    // Load the project at path as if it was picked in the form and Next was pressed, on the next frame
+    void open_project(const std::string& path);
+    // Whether the error popup is up, e.g. because the project could not be loaded
+    bool showing_error() const { return show_error_popup; }
+
 private:
     State& _state;
 
@@ -30,12 +36,40 @@ private:
     std::string error_message;
 
     bool show_new_scan_menu = true;
+    bool open_requested = false;
 
     std::vector<uint8_t> low_res_byte_data;
-    std::vector<uint8_t> high_res_byte_data;
-    std::atomic_bool done_loading;
-    std::atomic_bool is_loading;
-    std::thread loading_thread;
+    RawVolumeView high_res_volume_view;
+    bool done_loading = false;
+    bool is_loading = false;
+    // Reads the scan or the project into a run of its own, whose state is moved into the state once the job
+    // succeeds, see take_loaded_state
+    struct LoadRun;
+    BackgroundJob loading_job;
+    std::shared_ptr<ResultHandoff<LoadRun>> loading_result;
+    void take_loaded_state(LoadRun& run);
+
+    // Once the loading job is done the low resolution textures are streamed in over several frames
+    bool is_uploading = false;
+    // The loading job only brought in the topology, so only the index texture is uploaded
+    bool uploading_topology_only = false;
+    // Screen shown once the textures are uploaded
+    Application_State next_screen = Application_State::Segmentation;
+    VolumeTextureUploader volume_uploader;
+    VolumeTextureUploader index_uploader;
+
+    // Keep the bricks of the full resolution scan BC4 compressed, see VolumeBrickCache
+    bool compress_hi_res_bricks = false;
+    // Go straight to the bounding cage of a project which has one, leaving out the topology of the volume until a
+    // screen which needs it is shown
+    bool open_at_cage = false;
+    // Only compute the low resolution volume of a new project from the full resolution one an earlier project of
+    // the same scan left in the output folder, see ImageStackIngestParameters::reuse_full_res
+    bool reuse_full_res = false;
+
+    // Load the topology of the volume which a project opened at the cage left out, then show the screen which
+    // asked for it, see State::set_application_state
+    void start_topology_load();
 
     bool process_new_project_form();
 
@@ -0,0 +1,508 @@
+#include "input_replay.h"
+
+#include "initial_file_selection_state.h"
+#include "render_benchmark.h"
+#include <utils/background_job.h>
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// The log starts with a header
+//
+//   unwind-input 1
+//   window <width> <height>
+//   screen <Application_State>
+//   snapshot <project file>        (only if the recording started from a project)
+//   events
+//
+// followed by one event per line as
+//
+//   <frame gap> <ms> <screen> <jobs pending> <type> <a> <b>
+//
+// where the scroll stores its delta in place of a.
+
+namespace {
+
+constexpr int INPUT_LOG_VERSION = 1;
+
+struct {
+    bool active = false;
+    bool buttons[3] = { false, false, false };
+} replayed_mouse;
+
+const char* screen_name(Application_State screen) {
+    switch (screen) {
+    case Application_State::Initial_File_Selection:
+        return "File selection";
+    case Application_State::Segmentation:
+        return "Segmentation";
+    case Application_State::Meshing:
+        return "Meshing";
+    case Application_State::EndPointSelection:
+        return "Endpoint selection";
+    case Application_State::BoundingPolygon:
+        return "Bounding polygon";
+    default:
+        return "None";
+    }
+}
+
+bool parse_event_type(const std::string& name, InputEvent::Type& type) {
+    for (int i = 0; i < InputEvent::NumTypes; i++) {
+        if (name == input_event_name(InputEvent::Type(i))) {
+            type = InputEvent::Type(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+} // namespace
+
+
+const char* input_event_name(InputEvent::Type type) {
+    switch (type) {
+    case InputEvent::MouseMove:
+        return "mouse_move";
+    case InputEvent::MouseDown:
+        return "mouse_down";
+    case InputEvent::MouseUp:
+        return "mouse_up";
+    case InputEvent::MouseScroll:
+        return "mouse_scroll";
+    case InputEvent::KeyDown:
+        return "key_down";
+    case InputEvent::KeyUp:
+        return "key_up";
+    case InputEvent::KeyPressed:
+        return "key_pressed";
+    default:
+        return "unknown";
+    }
+}
+
+bool write_input_log(const std::string& filename, const InputLog& log, spdlog::logger& logger) {
+    std::ofstream out(filename);
+    out << "unwind-input " << INPUT_LOG_VERSION << "\n";
+    out << "window " << log.window_width << " " << log.window_height << "\n";
+    out << "screen " << int(log.screen) << "\n";
+    if (!log.snapshot_path.empty()) {
+        out << "snapshot " << log.snapshot_path << "\n";
+    }
+    out << "events\n";
+    for (const InputEvent& event : log.events) {
+        out << event.frame_gap << " " << event.ms << " " << int(event.screen) << " " << int(event.jobs_pending)
+            << " " << input_event_name(event.type) << " ";
+        if (event.type == InputEvent::MouseScroll) {
+            out << event.scroll_delta;
+        } else {
+            out << event.a;
+        }
+        out << " " << event.b << "\n";
+    }
+    if (!out) {
+        logger.error("Cannot write the input log '{}'", filename);
+        return false;
+    }
+    return true;
+}
+
+bool read_input_log(const std::string& filename, InputLog& log, spdlog::logger& logger) {
+    std::ifstream in(filename);
+    if (!in) {
+        logger.error("Cannot open the input log '{}'", filename);
+        return false;
+    }
+    log = InputLog();
+
+    std::string line;
+    int version = 0;
+    if (!std::getline(in, line) || std::sscanf(line.c_str(), "unwind-input %d", &version) != 1) {
+        logger.error("'{}' is not an input log", filename);
+        return false;
+    }
+    if (version != INPUT_LOG_VERSION) {
+        logger.error("The input log '{}' has version {}, expected {}", filename, version, INPUT_LOG_VERSION);
+        return false;
+    }
+
+    int line_number = 1;
+    bool in_events = false;
+    while (std::getline(in, line)) {
+        line_number += 1;
+        std::istringstream fields(line);
+        if (!in_events) {
+            std::string key;
+            fields >> key;
+            int screen = 0;
+            bool ok = true;
+            if (key == "window") {
+                ok = bool(fields >> log.window_width >> log.window_height);
+            } else if (key == "screen") {
+                ok = bool(fields >> screen) && screen >= 0 && screen < int(Application_State::NoState);
+                log.screen = Application_State(screen);
+            } else if (key == "snapshot") {
+                std::getline(fields >> std::ws, log.snapshot_path);
+                ok = !log.snapshot_path.empty();
+            } else if (key == "events") {
+                in_events = true;
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                logger.error("Malformed header on line {} of the input log '{}'", line_number, filename);
+                return false;
+            }
+            continue;
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        InputEvent event;
+        int screen = 0;
+        int jobs_pending = 0;
+        std::string type;
+        double a = 0.0;
+        if (!(fields >> event.frame_gap >> event.ms >> screen >> jobs_pending >> type >> a >> event.b) ||
+            !parse_event_type(type, event.type) || event.frame_gap < 0 ||
+            screen < 0 || screen > int(Application_State::NoState)) {
+            logger.error("Malformed event on line {} of the input log '{}'", line_number, filename);
+            return false;
+        }
+        if (event.type == InputEvent::MouseScroll) {
+            event.scroll_delta = float(a);
+        } else {
+            event.a = int(a);
+        }
+        event.screen = Application_State(screen);
+        event.jobs_pending = jobs_pending != 0;
+        log.events.push_back(event);
+    }
+    if (!in_events || log.window_width < 1 || log.window_height < 1) {
+        logger.error("The input log '{}' has no window size or no events", filename);
+        return false;
+    }
+    return true;
+}
+
+void print_input_replay_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind --replay-input LOG [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --output FILE  CSV file the latencies are written to (default: input-latencies.csv)" << std::endl;
+    std::cerr << "  --visible      keep the window on screen" << std::endl;
+}
+
+bool parse_input_replay_arguments(int argc, char** argv, InputReplayOptions& options) {
+    for (int i = 0; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            options.output_filename = argv[++i];
+        } else if (arg == "--visible") {
+            options.visible = true;
+        } else if (arg.size() > 0 && arg[0] != '-' && options.log_filename.empty()) {
+            options.log_filename = arg;
+        } else {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        }
+    }
+    if (options.log_filename.empty()) {
+        std::cerr << "ERROR: No input log to replay" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool replaying_input() {
+    return replayed_mouse.active;
+}
+
+bool replayed_mouse_button_down(int button) {
+    return button >= 0 && button < 3 && replayed_mouse.buttons[button];
+}
+
+
+bool InputRecorder::start(const std::string& filename) {
+    if (_recording) {
+        return true;
+    }
+    _filename = filename;
+    _log = InputLog();
+    glfwGetWindowSize(viewer->window, &_log.window_width, &_log.window_height);
+    _log.screen = _state.application_state;
+
+    if (_state.application_state != Application_State::Initial_File_Selection) {
+        // The volumes are loaded from the directory of the project, so the snapshot has to go there
+        std::string base_name = filename;
+        const std::string::size_type separator = base_name.find_last_of("/\\");
+        if (separator != std::string::npos) {
+            base_name = base_name.substr(separator + 1);
+        }
+        _log.snapshot_path = _state.input_metadata.output_dir + "/" + base_name + ".fish.pro";
+        if (!_state.save_project(_log.snapshot_path)) {
+            _state.logger->error("Cannot save the snapshot '{}' of the input log", _log.snapshot_path);
+            return false;
+        }
+    }
+
+    _recording = true;
+    _start = Clock::now();
+    _frames_since_event = 0;
+    _state.logger->info("Recording the input to '{}', press F6 to stop", filename);
+    return true;
+}
+
+bool InputRecorder::stop() {
+    if (!_recording) {
+        return true;
+    }
+    _recording = false;
+    if (!write_input_log(_filename, _log, *_state.logger)) {
+        return false;
+    }
+    _state.logger->info("Wrote {} input events to '{}'", _log.events.size(), _filename);
+    return true;
+}
+
+void InputRecorder::record(InputEvent::Type type, int a, int b, float scroll_delta) {
+    if (!_recording) {
+        return;
+    }
+    InputEvent event;
+    event.type = type;
+    event.a = a;
+    event.b = b;
+    event.scroll_delta = scroll_delta;
+    event.frame_gap = _frames_since_event;
+    event.ms = std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+    event.screen = _state.application_state;
+    event.jobs_pending = BackgroundJob::num_pending() > 0;
+    _log.events.push_back(event);
+    _frames_since_event = 0;
+}
+
+bool InputRecorder::post_draw() {
+    _frames_since_event += 1;
+    return false;
+}
+
+bool InputRecorder::mouse_down(int button, int modifier) {
+    record(InputEvent::MouseDown, button, modifier);
+    return false;
+}
+
+bool InputRecorder::mouse_up(int button, int modifier) {
+    record(InputEvent::MouseUp, button, modifier);
+    return false;
+}
+
+bool InputRecorder::mouse_move(int mouse_x, int mouse_y) {
+    record(InputEvent::MouseMove, mouse_x, mouse_y);
+    return false;
+}
+
+bool InputRecorder::mouse_scroll(float delta_y) {
+    record(InputEvent::MouseScroll, 0, 0, delta_y);
+    return false;
+}
+
+bool InputRecorder::key_pressed(unsigned int key, int modifiers) {
+    record(InputEvent::KeyPressed, int(key), modifiers);
+    return false;
+}
+
+bool InputRecorder::key_down(int key, int modifiers) {
+    if (key != RECORD_INPUT_KEY) {
+        record(InputEvent::KeyDown, key, modifiers);
+    }
+    return false;
+}
+
+bool InputRecorder::key_up(int key, int modifiers) {
+    if (key != RECORD_INPUT_KEY) {
+        record(InputEvent::KeyUp, key, modifiers);
+    }
+    return false;
+}
+
+
+void InputReplay::set_options(const InputReplayOptions& options) {
+    _options = options;
+    _enabled = true;
+}
+
+bool InputReplay::init(igl::opengl::glfw::Viewer& viewer) {
+    if (!read_input_log(_options.log_filename, _log, *_state.logger)) {
+        finish(viewer, true);
+        return false;
+    }
+    set_up_benchmark_window(viewer, _state, _log.window_width, _log.window_height, _options.visible);
+    replayed_mouse.active = true;
+    _state.logger->info("Replaying {} input events from '{}'", _log.events.size(), _options.log_filename);
+    return true;
+}
+
+void InputReplay::inject(igl::opengl::glfw::Viewer& viewer, const InputEvent& event) {
+    typedef igl::opengl::glfw::Viewer::MouseButton MouseButton;
+    switch (event.type) {
+    case InputEvent::MouseMove:
+        viewer.mouse_move(event.a, event.b);
+        break;
+    case InputEvent::MouseDown:
+        if (event.a >= 0 && event.a < 3) {
+            replayed_mouse.buttons[event.a] = true;
+        }
+        viewer.mouse_down(MouseButton(event.a), event.b);
+        break;
+    case InputEvent::MouseUp:
+        if (event.a >= 0 && event.a < 3) {
+            replayed_mouse.buttons[event.a] = false;
+        }
+        viewer.mouse_up(MouseButton(event.a), event.b);
+        break;
+    case InputEvent::MouseScroll:
+        viewer.mouse_scroll(event.scroll_delta);
+        break;
+    case InputEvent::KeyDown:
+        viewer.key_down(event.a, event.b);
+        break;
+    case InputEvent::KeyUp:
+        viewer.key_up(event.a, event.b);
+        break;
+    case InputEvent::KeyPressed:
+        viewer.key_pressed((unsigned int)event.a, event.b);
+        break;
+    default:
+        break;
+    }
+}
+
+void InputReplay::pre_draw(igl::opengl::glfw::Viewer& viewer) {
+    if (!_enabled || _phase == Done) {
+        return;
+    }
+    _state.redraw.request(RedrawScheduler::ImGui);
+
+    if (_phase == Loading) {
+        if (_log.snapshot_path.empty()) {
+            _phase = Replaying;
+        } else if (!_project_opened) {
+            _file_selection.open_project(_log.snapshot_path);
+            _project_opened = true;
+            return;
+        } else if (_file_selection.showing_error()) {
+            _state.logger->error("Input replay: failed to load the snapshot '{}'", _log.snapshot_path);
+            finish(viewer, true);
+            return;
+        } else if (_state.application_state == Application_State::Initial_File_Selection) {
+            return;
+        } else if (_state.application_state != _log.screen) {
+            // The screen is switched at the start of the next frame
+            _state.set_application_state(_log.screen);
+            return;
+        } else {
+            _phase = Replaying;
+        }
+        _state.logger->info("Input replay: replaying from the {} screen", screen_name(_log.screen));
+    }
+
+    while (_next_event < _log.events.size()) {
+        const InputEvent& event = _log.events[_next_event];
+        if (_frames_since_event < event.frame_gap || (!event.jobs_pending && BackgroundJob::num_pending() > 0)) {
+            break;
+        }
+        Latency latency;
+        latency.injected = Clock::now();
+        _latencies.push_back(latency);
+        inject(viewer, event);
+        _next_event += 1;
+        _frames_since_event = 0;
+    }
+}
+
+void InputReplay::frame_end(igl::opengl::glfw::Viewer& viewer) {
+    if (_phase != Replaying) {
+        return;
+    }
+    const Clock::time_point now = Clock::now();
+    const bool settled = BackgroundJob::num_pending() == 0;
+    for (std::size_t i = _first_unsettled; i < _latencies.size(); i++) {
+        Latency& latency = _latencies[i];
+        const double ms = std::chrono::duration<double, std::milli>(now - latency.injected).count();
+        if (latency.frame_ms < 0.0) {
+            latency.frame_ms = ms;
+        }
+        if (settled) {
+            latency.settle_ms = ms;
+        }
+    }
+    if (settled) {
+        _first_unsettled = _latencies.size();
+    }
+    _frames_since_event += 1;
+
+    if (_next_event == _log.events.size() && _first_unsettled == _latencies.size()) {
+        finish(viewer, false);
+    }
+}
+
+bool InputReplay::write_results() {
+    std::ofstream out(_options.output_filename);
+    out << "event,screen,type,a,b,recorded_ms,frame_ms,settle_ms\n";
+    std::vector<std::vector<double>> frame_ms(InputEvent::NumTypes);
+    for (std::size_t i = 0; i < _latencies.size(); i++) {
+        const InputEvent& event = _log.events[i];
+        const Latency& latency = _latencies[i];
+        out << i << "," << screen_name(event.screen) << "," << input_event_name(event.type) << ",";
+        if (event.type == InputEvent::MouseScroll) {
+            out << event.scroll_delta;
+        } else {
+            out << event.a;
+        }
+        out << "," << event.b << "," << event.ms << "," << latency.frame_ms << "," << latency.settle_ms << "\n";
+        frame_ms[event.type].push_back(latency.frame_ms);
+    }
+    if (!out) {
+        _state.logger->error("Cannot write the input latencies to '{}'", _options.output_filename);
+        return false;
+    }
+    _state.logger->info("Wrote the latencies of {} events to '{}'", _latencies.size(), _options.output_filename);
+    for (int type = 0; type < InputEvent::NumTypes; type++) {
+        if (frame_ms[type].empty()) {
+            continue;
+        }
+        _state.logger->info("  {}: {} events, median {:.2f} ms, max {:.2f} ms to the end of their frame",
+                            input_event_name(InputEvent::Type(type)), frame_ms[type].size(), median(frame_ms[type]),
+                            *std::max_element(frame_ms[type].begin(), frame_ms[type].end()));
+    }
+    return true;
+}
+
+void InputReplay::finish(igl::opengl::glfw::Viewer& viewer, bool failed) {
+    if (!_latencies.empty() && !write_results()) {
+        failed = true;
+    }
+    _phase = Done;
+    _failed = failed;
+    replayed_mouse.active = false;
+    glfwSetWindowShouldClose(viewer.window, GLFW_TRUE);
+    // The viewer waits for events once the frame is done
+    glfwPostEmptyEvent();
+}
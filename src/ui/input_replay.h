@@ -0,0 +1,174 @@
+#ifndef INPUT_REPLAY_H
+#define INPUT_REPLAY_H
+
+#include <igl/opengl/glfw/Viewer.h>
+#include <igl/opengl/glfw/ViewerPlugin.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "state.h"
+
+class Initial_File_Selection_Menu;
+
+// Toggles the recording of the input into INPUT_LOG_FILENAME, see InputRecorder
+constexpr int RECORD_INPUT_KEY = GLFW_KEY_F6;
+constexpr const char* INPUT_LOG_FILENAME = "input-log.txt";
+
+// An event as the plugins of the viewer received it
+struct InputEvent {
+    enum Type {
+        MouseMove = 0,
+        MouseDown,
+        MouseUp,
+        MouseScroll,
+        KeyDown,
+        KeyUp,
+        KeyPressed,
+        NumTypes
+    };
+
+    Type type = MouseMove;
+    // Mouse position, button or key, then the modifiers. The scroll stores its delta in scroll_delta
+    int a = 0;
+    int b = 0;
+    float scroll_delta = 0.0f;
+
+    // Frames drawn since the previous event, or since the recording started
+    int frame_gap = 0;
+    // Time since the recording started
+    double ms = 0.0;
+    // Screen whose plugin received the event
+    Application_State screen = Application_State::NoState;
+    // Whether a background job was running. Events that were not made while one ran are only replayed once
+    // the jobs are done, so the replay does not depend on how long they take.
+    bool jobs_pending = false;
+};
+
+// What was recorded: the events, the window they were made in and the project they started from
+struct InputLog {
+    int window_width = 0;
+    int window_height = 0;
+    Application_State screen = Application_State::Initial_File_Selection;
+    // Project saved when the recording started, empty if it started on the file selection screen
+    std::string snapshot_path;
+    std::vector<InputEvent> events;
+};
+
+// Text file with a header followed by one event per line, see input_replay.cpp
+bool write_input_log(const std::string& filename, const InputLog& log, spdlog::logger& logger);
+bool read_input_log(const std::string& filename, InputLog& log, spdlog::logger& logger);
+
+const char* input_event_name(InputEvent::Type type);
+
+struct InputReplayOptions {
+    std::string log_filename;
+    std::string output_filename = "input-latencies.csv";
+    // Keep the window on screen, some drivers do not draw into hidden windows
+    bool visible = false;
+};
+
+void print_input_replay_usage();
+// Parses the arguments that follow --replay-input, returns false if they are malformed
+bool parse_input_replay_arguments(int argc, char** argv, InputReplayOptions& options);
+
+// While input is replayed the window is hidden and ImGui cannot poll the mouse, FishUIViewerPlugin hands it
+// the replayed mouse instead
+bool replaying_input();
+bool replayed_mouse_button_down(int button);
+
+// Placed first among the plugins of the viewer so that it sees every event before a plugin consumes it.
+// Recording starts with start() or RECORD_INPUT_KEY. If a project is loaded it is saved into its output
+// directory first, as the snapshot the replay starts from. The log is written when the recording stops.
+class InputRecorder : public igl::opengl::glfw::ViewerPlugin {
+public:
+    explicit InputRecorder(State& state) : _state(state) {}
+
+    bool start(const std::string& filename);
+    bool stop();
+    bool recording() const { return _recording; }
+
+    bool post_draw() override;
+
+    bool mouse_down(int button, int modifier) override;
+    bool mouse_up(int button, int modifier) override;
+    bool mouse_move(int mouse_x, int mouse_y) override;
+    bool mouse_scroll(float delta_y) override;
+    bool key_pressed(unsigned int key, int modifiers) override;
+    bool key_down(int key, int modifiers) override;
+    bool key_up(int key, int modifiers) override;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void record(InputEvent::Type type, int a, int b, float scroll_delta = 0.0f);
+
+    State& _state;
+    std::string _filename;
+    bool _recording = false;
+    InputLog _log;
+    Clock::time_point _start;
+    int _frames_since_event = 0;
+};
+
+// Replays an input log in a hidden window of the recorded size and measures how long the app takes to respond
+// to every event: the time from the injection of the event to the end of the frame that handled it, and to the
+// end of the first frame after which no background job is pending any more. The latencies are written as CSV
+// and summarized per type of event in the log. The viewer is closed once all the events are replayed.
+//
+// Events are injected at the start of a frame once as many frames were drawn since the previous one as when it
+// was recorded, and events recorded while no job ran wait for the jobs to finish.
+class InputReplay {
+public:
+    InputReplay(State& state, Initial_File_Selection_Menu& file_selection)
+        : _state(state), _file_selection(file_selection) {}
+
+    void set_options(const InputReplayOptions& options);
+    bool enabled() const { return _enabled; }
+    bool failed() const { return _failed; }
+
+    bool init(igl::opengl::glfw::Viewer& viewer);
+    // Call at the start of every frame once the screen of the application state is set up
+    void pre_draw(igl::opengl::glfw::Viewer& viewer);
+    // Call once the frame is drawn, before the buffers are swapped
+    void frame_end(igl::opengl::glfw::Viewer& viewer);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Phase {
+        Loading = 0,
+        Replaying,
+        Done
+    };
+
+    struct Latency {
+        Clock::time_point injected;
+        double frame_ms = -1.0;
+        double settle_ms = -1.0;
+    };
+
+    void inject(igl::opengl::glfw::Viewer& viewer, const InputEvent& event);
+    void finish(igl::opengl::glfw::Viewer& viewer, bool failed);
+    bool write_results();
+
+    State& _state;
+    Initial_File_Selection_Menu& _file_selection;
+
+    InputReplayOptions _options;
+    bool _enabled = false;
+    bool _failed = false;
+
+    InputLog _log;
+    Phase _phase = Loading;
+    bool _project_opened = false;
+    std::size_t _next_event = 0;
+    int _frames_since_event = 0;
+    // Latency of every injected event, the ones from _first_unsettled on wait for the jobs
+    std::vector<Latency> _latencies;
+    std::size_t _first_unsettled = 0;
+};
+
+#endif // INPUT_REPLAY_H
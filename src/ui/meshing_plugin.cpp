@@ -1,183 +1,541 @@
 #include "meshing_plugin.h"
 
 #include "make_tet_mesh.h"
-#include "make_signed_distance.h"
+#include "sdf.h"
 #include "state.h"
 #include "trimesh.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <Eigen/Core>
 #include <GLFW/glfw3.h>
-#include <igl/boundary_facets.h>
-#include <igl/components.h>
 #include <igl/readOBJ.h>
 #include <igl/writeOBJ.h>
-#include <igl/copyleft/marching_cubes.h>
 #include <imgui/imgui.h>
+#include <utility>
+#include <utils/dexel_meshing.h>
+#include <utils/memory_tracker.h>
+#include <utils/metrics.h>
+#include <utils/octree_tet_mesh.h>
+#include <utils/row_major.h>
+#include <utils/stage_cache.h>
+#include <utils/task_scheduler.h>
+#include <utils/tet_mesh_optimization.h>
+#include <utils/utils.h>
 #include <vector>
 #include <vor3d/CompressedVolume.h>
+#include <vor3d/Parallel.h>
 #include <vor3d/VoronoiVorPower.h>
 
 namespace {
 
-void volume_to_dexels(const Eigen::VectorXf& scalars, Eigen::RowVector3i volume_size,
+template <typename T>
+void volume_to_dexels(const VolumeBuffer<T>& scalars, Eigen::RowVector3i volume_size,
                       vor3d::CompressedVolume& dexels)
 {
     const int w = volume_size[0], h = volume_size[1], d = volume_size[2];
     dexels = vor3d::CompressedVolume(Eigen::Vector3d(0.0, 0.0, 0.0),
         Eigen::Vector3d(d, h, w), 1.0, 0);
 
+    vor3d::CompressedVolume::Builder builder(dexels);
     int start_idx = 0;
     for (int z = 0; z < d; z++) {
         for (int y = 0; y < h; y++) {
             bool outside = true;
             int seg_entry = 0;
             for (int x = 0; x < w; x++) {
-                if (outside && scalars[start_idx] > 0.0) {
+                if (outside && scalars[start_idx] > T(0)) {
                     seg_entry = x;
                     outside = false;
                 }
-                else if (!outside && scalars[start_idx] <= 0.0) {
-                    dexels.appendSegment(z, y, seg_entry, x, -1);
+                else if (!outside && scalars[start_idx] <= T(0)) {
+                    builder.appendSegment(z, y, seg_entry, x, -1);
                     outside = true;
                 }
                 start_idx += 1;
             }
         }
     }
+    dexels.assemble(builder);
 
 }
 
-void dexels_to_mesh(int n_samples, const vor3d::CompressedVolume& dexels,
-                    Eigen::MatrixXd& V, Eigen::MatrixXi& F)
-{
-    std::vector<Eigen::Vector3d> grid_pts;
-    std::vector<double> grid_vals;
-
-    for (int x = -1; x < dexels.gridSize()[0] + 1; ++x) { // z axis
-        for (int y = -1; y < dexels.gridSize()[1] + 1; ++y) {   // y axis
-            for (int z = -1; z < n_samples + 1; ++z) {                // x axis
-                if (x == -1 || y == -1 || z == -1 || x == dexels.gridSize()[0] || y == dexels.gridSize()[1] || z == n_samples) {
-                    Eigen::Vector3d grid_ctr;
-                    grid_ctr[0] = dexels.origin()[2] + (z + 0.5) * (dexels.extent()[2] / n_samples);
-                    grid_ctr[1] = dexels.origin()[1] + (y + 0.5) * (dexels.extent()[1] / dexels.gridSize()[1]);
-                    grid_ctr[2] = dexels.origin()[0] + (x + 0.5) * (dexels.extent()[0] / dexels.gridSize()[0]);
-                    grid_pts.push_back(grid_ctr);
-                    grid_vals.push_back(1);
-                    continue;
-                }
-                Eigen::Vector3d grid_ctr;
-                grid_ctr[0] = dexels.origin()[2] + (z + 0.5) * (dexels.extent()[2] / n_samples);
-                grid_ctr[1] = dexels.origin()[1] + (y + 0.5) * (dexels.extent()[1] / dexels.gridSize()[1]);
-                grid_ctr[2] = dexels.origin()[0] + (x + 0.5) * (dexels.extent()[0] / dexels.gridSize()[0]);
-
-                grid_pts.push_back(grid_ctr);
-
-                const std::vector<vor3d::Scalar>& d = dexels.at(x, y);
-                int idx = -1;
-                for (int i = 0; i < d.size(); i++) {
-                    if (grid_ctr[0] < d[i]) {
-                        idx = i - 1;
-                        break;
-                    }
-                }
+// Bump this whenever the cleanup, the dilation or the meshing change what they produce, the stage cache entries
+// of the previous version are then never looked up again
+constexpr std::uint32_t STAGE_CACHE_VERSION = 2;
+const char* DILATED_VOLUME_STAGE = "dilated";
+const char* TET_MESH_STAGE = "tetmesh";
 
-                if (idx < 0) {
-                    grid_vals.push_back(1);
-                    continue;
-                }
+// Largest radius the distance field of a radius sweep starting at dilation_radius is built for
+double distance_field_radius(double dilation_radius) {
+    // Room for larger radii, the next ones are most likely close to this one
+    return std::max(2.0 * dilation_radius, dilation_radius + 4.0);
+}
 
-                if (idx % 2 == 0) {
-                    grid_vals.push_back(-1);
-                }
-                else {
-                    grid_vals.push_back(1);
-                }
+// The surface vertex of TV closest to p, -1 if TF is empty
+int closest_surface_vertex(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TF, const Eigen::RowVector3d& p) {
+    int best = -1;
+    double best_distance = std::numeric_limits<double>::infinity();
+    for (int f = 0; f < TF.rows(); f++) {
+        for (int c = 0; c < TF.cols(); c++) {
+            const double d = (TV.row(TF(f, c)) - p).squaredNorm();
+            if (d < best_distance) {
+                best_distance = d;
+                best = TF(f, c);
             }
         }
     }
-
-    Eigen::MatrixXd pts(grid_vals.size(), 3);
-    Eigen::VectorXd vals(grid_vals.size());
-    for (int i = 0; i < grid_vals.size(); i++) {
-        pts.row(i) = grid_pts[i];
-        vals[i] = grid_vals[i];
-    }
-
-    igl::copyleft::marching_cubes(vals, pts, n_samples + 2, dexels.gridSize()[1] + 2,
-        dexels.gridSize()[0] + 2, V, F);
+    return best;
 }
 
 } // namespace
 
 
+struct Meshing_Menu::Run {
+    // Parameters and outputs of the run, the dilated tet mesh of the state is replaced by this one once
+    // the run succeeds
+    State::DilatedTetMesh mesh;
+    // Zero-based indices of the selected features, and all the features they index
+    std::vector<uint32_t> feature_list;
+    std::vector<contourtree::Feature> features;
+
+    // Box of the volume, in (x, y, z), that is dexelized, cleaned up and dilated. It holds the selected features
+    // and everything the cleanup and the dilation can reach from them, so the rest of the volume is left out.
+    Eigen::RowVector3i crop_begin = Eigen::RowVector3i::Zero();
+    Eigen::RowVector3i crop_end = Eigen::RowVector3i::Zero();
+    // Voxels belonging to the selected features, as runs along x in the dexels of the (z, y) grid of the crop
+    vor3d::CompressedVolume selected_dexels;
+    // selected_dexels dilated by the dilation radius, the volume that gets tetrahedralized
+    vor3d::CompressedVolume dilated_dexels;
+
+    // With radius_sweep, the distance to the selected volume and the selection_key it was built for. A run
+    // starting with a field reached by its radius skips the export and the cleanup and thresholds it.
+    std::shared_ptr<const vor3d::DistanceField> distance_field;
+    std::uint64_t selection_key = 0;
+
+    // Stage cache of the project, disabled in debug mode or if the volume could not be hashed, and the keys of
+    // the dilated volume and of the tet mesh of the run in it
+    StageCache stage_cache;
+    std::uint64_t dilated_volume_cache_key = 0;
+    std::uint64_t tet_mesh_cache_key = 0;
+};
+
+
 Meshing_Menu::Meshing_Menu(State& state) : _state(state) {}
 
 
+std::uint64_t Meshing_Menu::meshing_key() const {
+    KeyHash key;
+    const State::DilatedTetMesh& mesh = _state.dilated_tet_mesh;
+    key.add(dilation_key());
+    key.add(mesh.meshing_voxel_radius);
+    key.add(mesh.adaptive_meshing);
+    key.add(mesh.adaptive_max_cell_size);
+    key.add(mesh.optimize_mesh);
+    if (mesh.optimize_mesh) {
+        key.add(mesh.optimize_seconds);
+    }
+    return key.hash;
+}
+
+
+std::uint64_t Meshing_Menu::dilation_key() const {
+    KeyHash key;
+    key.add(selection_key());
+    key.add(_state.dilated_tet_mesh.dilation_radius);
+    return key.hash;
+}
+
+
+std::uint64_t Meshing_Menu::selection_key() const {
+    KeyHash key;
+    key.add(_state.dilated_tet_mesh.cleanup_radius);
+    key.add(_state.segmented_features.num_selected_features);
+    for (uint32_t feature : _state.segmented_features.selected_features) {
+        key.add(feature);
+    }
+    return key.hash;
+}
+
+
 void Meshing_Menu::initialize() {
     done_meshing = false;
 
-    auto thread_fun = [&]() {
-        is_meshing = true;
-        glfwPostEmptyEvent();
-
-        if (!debug.enabled) {
-            std::vector<uint32_t> feature_list = _state.segmented_features.selected_features;
-            // The feature list used in export_selected_volume uses a zero-based indexing, we use
-            // 0 for the non-feature, so we have to convert into the zero-based indexing here
-            std::transform(feature_list.begin(), feature_list.end(), feature_list.begin(),
-                [](uint32_t v) { return v - 1; });
-            export_selected_volume(feature_list);
-        } else {
-            skeleton_masking_volume = debug.masking_volume_hack;
-            for (int i = 0; i < skeleton_masking_volume.size(); ++i) {
-                unsigned int idx = _state.low_res_volume.index_data[i];
-                if (skeleton_masking_volume[i] != 0.0) {
-                    skeleton_masking_volume[i] = 1.0;
-                }
-                else {
-                    skeleton_masking_volume[i] = -1.0;
-                }
-            }
+    if (!_state.dirty_flags.mesh_dirty) {
+        done_meshing = true;
+        return;
+    }
+
+    // The speculative job meshed the same selection, use its mesh or wait for it in the modal
+    const std::uint64_t key = meshing_key();
+    if (!debug.enabled && key == run_key) {
+        if (speculative_run) {
+            _state.logger->info("Reusing the speculative meshing job.");
+            take_run(*speculative_run);
+            speculative_run.reset();
+            coarse_result.reset();
+            done_meshing = true;
+            return;
         }
-        dilate_volume();
-        if (extracted_surface.V_fat.rows() == 0) {
-            _state.logger->error("Extracted empty mesh after dilation! Something went wrong!");
-            abort();
+        if (meshing_job.is_running()) {
+            _state.logger->info("Waiting for the speculative meshing job...");
+            _state.dilated_tet_mesh.clear();
+            return;
         }
-        tetrahedralize_surface_mesh();
-        igl::components(_state.dilated_tet_mesh.TT, _state.dilated_tet_mesh.connected_components);
+    }
 
-        is_meshing = false;
-        done_meshing = true;
+    _state.dilated_tet_mesh.clear();
+    start_meshing(false);
+}
+
+
+void Meshing_Menu::update_speculative_meshing() {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const std::uint64_t key = meshing_key();
+    if (key != last_key) {
+        last_key = key;
+        last_key_change = now;
+    }
+    if (key != run_key && meshing_job.is_running()) {
+        // The selection changed under the speculative job
+        meshing_job.cancel();
+        meshing_result.reset();
+        coarse_result.reset();
+        run_key = 0;
+    }
 
-        _state.dirty_flags.endpoints_dirty = true;
+    if (refining) {
+        // Back from the endpoint selection before the fine mesh landed, nothing here reads the tet mesh
+        update_refinement();
+        return;
+    }
 
-        _state.logger->info("Done meshing background thread.");
-        glfwPostEmptyEvent();
-    };
+    switch (meshing_job.poll()) {
+    case JobStatus::Succeeded:
+        // A job cancelled too late to stop still succeeds, its result was dropped along with the handoff
+        if (meshing_result) {
+            speculative_run = meshing_result->take();
+            meshing_result.reset();
+            _state.logger->debug("Speculative meshing job done.");
+        }
+        break;
+    case JobStatus::Failed:
+    case JobStatus::Cancelled:
+        // Not tried again for the same key, the meshing screen runs it and reports what went wrong
+        meshing_result.reset();
+        break;
+    default:
+        break;
+    }
 
-    if (_state.dirty_flags.mesh_dirty) {
-        extracted_surface.V_thin.resize(0, 0);
-        extracted_surface.F_thin.resize(0, 0);
-        extracted_surface.V_fat.resize(0, 0);
-        extracted_surface.F_fat.resize(0, 0);
+    if (key == run_key || debug.enabled || !_state.dirty_flags.mesh_dirty ||
+            _state.segmented_features.selected_features.empty()) {
+        return;
+    }
+    if (std::chrono::duration<double>(now - last_key_change).count() < SPECULATION_DELAY) {
+        // Ask for a frame once the delay is over, the selection screen may be idle by then
+        _state.redraw.request(RedrawScheduler::BackgroundJobs);
+        return;
+    }
 
-        _state.dilated_tet_mesh.clear();
+    speculative_run.reset();
+    start_meshing(true);
+}
 
-        _state.logger->info("Starting meshing background thread...");
-        bg_thread = std::thread(thread_fun);
-        bg_thread.detach();
-    } else {
-        done_meshing = true;
-        is_meshing = false;
+
+void Meshing_Menu::cancel_speculative_meshing() {
+    meshing_job.cancel();
+    meshing_result.reset();
+    coarse_result.reset();
+    speculative_run.reset();
+    refining = false;
+    run_key = 0;
+    // The selection key does not tell volumes apart, the next one may be another scan
+    distance_field.reset();
+    distance_field_key = 0;
+}
+
+
+void Meshing_Menu::take_run(Run& run) {
+    State::DilatedTetMesh& mesh = _state.dilated_tet_mesh;
+    mesh.TV = std::move(run.mesh.TV);
+    mesh.TT = std::move(run.mesh.TT);
+    mesh.TF = std::move(run.mesh.TF);
+    mesh.connected_components = std::move(run.mesh.connected_components);
+    mesh.geodesic_dists.resize(0);
+    mesh.skeleton_cache.clear();
+    _state.dirty_flags.endpoints_dirty = true;
+
+    if (run.distance_field) {
+        distance_field = std::move(run.distance_field);
+        distance_field_key = run.selection_key;
+    }
+    if (!run.mesh.dilated_dexels.empty()) {
+        mesh.dilated_dexels = std::move(run.mesh.dilated_dexels);
+        mesh.dilated_dexels_key = run.mesh.dilated_dexels_key;
+    }
+}
+
+
+bool Meshing_Menu::update_refinement() {
+    if (!refining) {
+        return false;
+    }
+    switch (meshing_job.poll()) {
+    case JobStatus::Succeeded:
+        refining = false;
+        if (!meshing_result) {
+            break;
+        }
+        {
+            std::shared_ptr<Run> run = meshing_result->take();
+            meshing_result.reset();
+            // The endpoints move to the closest surface vertices of the fine mesh, the pairs are dropped if they
+            // no longer lie in one component each
+            const State::DilatedTetMesh& coarse = _state.dilated_tet_mesh;
+            std::vector<std::pair<int, int>> endpoint_pairs;
+            std::vector<int> used_components;
+            bool valid = true;
+            for (const std::pair<int, int>& pair : _state.skeleton_estimation_parameters.endpoint_pairs) {
+                const int first = closest_surface_vertex(run->mesh.TV, run->mesh.TF, coarse.TV.row(pair.first));
+                const int second = closest_surface_vertex(run->mesh.TV, run->mesh.TF, coarse.TV.row(pair.second));
+                if (first < 0 || second < 0 || first == second) {
+                    valid = false;
+                    break;
+                }
+                const int component = run->mesh.connected_components[first];
+                if (component != run->mesh.connected_components[second] ||
+                        std::find(used_components.begin(), used_components.end(), component) != used_components.end()) {
+                    valid = false;
+                    break;
+                }
+                used_components.push_back(component);
+                endpoint_pairs.emplace_back(first, second);
+            }
+            take_run(*run);
+            if (valid) {
+                _state.skeleton_estimation_parameters.endpoint_pairs = std::move(endpoint_pairs);
+                _state.dirty_flags.endpoints_dirty = false;
+            } else {
+                _state.logger->warn("The endpoints do not fit the refined tet mesh, pick them again.");
+                _state.skeleton_estimation_parameters.endpoint_pairs.clear();
+            }
+            _state.dirty_flags.bounding_cage_dirty = true;
+            _state.logger->info("Replaced the preview tet mesh with the final one.");
+        }
+        return true;
+    case JobStatus::Failed:
+    case JobStatus::Cancelled:
+        // Keep working on the coarse mesh, the next visit of the meshing screen meshes again
+        refining = false;
+        meshing_result.reset();
+        _state.dirty_flags.mesh_dirty = true;
+        _state.logger->warn("Refining the tet mesh stopped, keeping the preview mesh.");
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+
+void Meshing_Menu::start_meshing(bool speculative) {
+    // Copy the parameters into the run, the job must not touch the dilated tet mesh of the state
+    std::shared_ptr<Run> run = std::make_shared<Run>();
+    run->mesh.dilation_radius = _state.dilated_tet_mesh.dilation_radius;
+    run->mesh.cleanup_radius = _state.dilated_tet_mesh.cleanup_radius;
+    run->mesh.meshing_voxel_radius = _state.dilated_tet_mesh.meshing_voxel_radius;
+    run->mesh.adaptive_meshing = _state.dilated_tet_mesh.adaptive_meshing;
+    run->mesh.adaptive_max_cell_size = _state.dilated_tet_mesh.adaptive_max_cell_size;
+    run->mesh.coarse_preview = _state.dilated_tet_mesh.coarse_preview && !debug.enabled;
+    run->mesh.optimize_mesh = _state.dilated_tet_mesh.optimize_mesh;
+    run->mesh.optimize_seconds = _state.dilated_tet_mesh.optimize_seconds;
+    run->mesh.dilation_num_threads = _state.dilated_tet_mesh.dilation_num_threads;
+    if (speculative) {
+        // Leave half of the cores to the selection view while the user may still change their mind
+        const int num_cores = std::max(task_threads(), 2);
+        const int max_threads = num_cores / 2;
+        int& num_threads = run->mesh.dilation_num_threads;
+        num_threads = num_threads == 0 ? max_threads : std::min(num_threads, max_threads);
+    }
+    run->feature_list = _state.segmented_features.selected_features;
+    // The feature list used in export_selected_volume uses a zero-based indexing, we use
+    // 0 for the non-feature, so we have to convert into the zero-based indexing here
+    std::transform(run->feature_list.begin(), run->feature_list.end(), run->feature_list.begin(),
+        [](uint32_t v) { return v - 1; });
+    run->features = _state.segmented_features.topological_features.getFeatures(_state.segmented_features.num_selected_features, 0.f);
+    run->mesh.radius_sweep = _state.dilated_tet_mesh.radius_sweep && !debug.enabled;
+    run->selection_key = selection_key();
+    run->mesh.dilated_dexels_key = dilation_key();
+    if (!debug.enabled && _state.dilated_tet_mesh.dilated_dexels_key == run->mesh.dilated_dexels_key) {
+        run->mesh.dilated_dexels = _state.dilated_tet_mesh.dilated_dexels;
+    }
+    if (!run->mesh.radius_sweep) {
+        distance_field.reset();
+        distance_field_key = 0;
+    } else if (distance_field && distance_field_key == run->selection_key &&
+               distance_field->maxRadius() >= run->mesh.dilation_radius) {
+        run->distance_field = distance_field;
+    }
+
+    // The closing of the cleanup reaches twice its radius out from the selection before eroding it back, the
+    // dilation (or the largest radius of its distance field) reaches on top of that. A voxel of margin on
+    // either side leaves the outermost dilated voxels clear of the border of the crop.
+    run->crop_begin = Eigen::RowVector3i::Zero();
+    run->crop_end = _state.low_res_volume.dims();
+    const IndexStatistics selection = _state.segmented_features.selection_statistics();
+    if (!selection.empty()) {
+        const double dilation_reach = run->mesh.radius_sweep ? distance_field_radius(run->mesh.dilation_radius) :
+                run->mesh.dilation_radius;
+        const double reach = 2.0 * std::max(run->mesh.cleanup_radius, 0.0) + dilation_reach;
+        run->crop_begin = selection.min_corner;
+        run->crop_end = selection.max_corner;
+        pad_voxel_box(run->crop_begin, run->crop_end, int(std::ceil(reach)) + 2, _state.low_res_volume.dims());
     }
+
+    // The selection keys only hold feature ids, those of another scan are other voxels
+    const std::uint64_t volume_hash = _state.low_res_volume.content_hash;
+    if (!debug.enabled && volume_hash != 0 && !_state.input_metadata.output_dir.empty()) {
+        run->stage_cache = StageCache(_state.input_metadata.output_dir + "/stage_cache", STAGE_CACHE_BYTES);
+        const auto cache_key = [volume_hash](std::uint64_t stage_key) {
+            KeyHash key;
+            key.add(STAGE_CACHE_VERSION);
+            key.add(volume_hash);
+            key.add(stage_key);
+            return key.hash;
+        };
+        run->dilated_volume_cache_key = cache_key(run->mesh.dilated_dexels_key);
+        run->tet_mesh_cache_key = cache_key(meshing_key());
+    }
+
+    std::shared_ptr<ResultHandoff<Run>> result = std::make_shared<ResultHandoff<Run>>();
+    meshing_result = result;
+    const bool preview = run->mesh.coarse_preview || run->mesh.optimize_mesh;
+    std::shared_ptr<ResultHandoff<Run>> coarse = preview ? std::make_shared<ResultHandoff<Run>>() : nullptr;
+    coarse_result = coarse;
+    refining = false;
+    run_key = meshing_key();
+
+    // Besides the run, the job only reads the index volume, which stays the same until the next scan is loaded
+    _state.logger->info(speculative ? "Starting speculative meshing background job..." : "Starting meshing background job...");
+    meshing_job.start([this, run, result, coarse](JobContext& context) {
+        if (load_cached_tet_mesh(*run, context)) {
+            _state.logger->info("Reusing the cached tet mesh of this selection.");
+            result->publish(run);
+            return true;
+        }
+        if (load_dilated_volume(*run, context)) {
+            _state.logger->info("Reusing the dilated volume of the last run.");
+        } else {
+            if (run->distance_field) {
+                _state.logger->info("Reusing the distance to the selected volume.");
+            } else if (!debug.enabled) {
+                if (!export_selected_volume(*run, context)) {
+                    return false;
+                }
+            } else {
+                context.begin_stage("Converting the debug volume");
+                volume_to_dexels(debug.masking_volume_hack, _state.low_res_volume.dims(), run->selected_dexels);
+            }
+            if (!run->distance_field && (context.cancelled() || !clean_up_volume(*run, context))) {
+                return false;
+            }
+            if (context.cancelled() || !dilate_volume(*run, context)) {
+                return false;
+            }
+            if (!debug.enabled) {
+                context.begin_stage("Compressing the dilated volume");
+                run->dilated_dexels.saveCompact(run->mesh.dilated_dexels);
+                ProjectFileWriter writer;
+                writer.add_vector("dilated_dexels", run->mesh.dilated_dexels);
+                run->stage_cache.store(DILATED_VOLUME_STAGE, run->dilated_volume_cache_key, writer, _state.logger);
+            }
+        }
+        if (run->dilated_dexels.numSegments() == 0) {
+            _state.logger->error("Extracted empty volume after dilation! Something went wrong!");
+            return false;
+        }
+        if (run->mesh.coarse_preview) {
+            // A mesh of larger cells first, the endpoint selection starts on it while the fine one is made
+            std::shared_ptr<Run> coarse_run = std::make_shared<Run>();
+            coarse_run->mesh.adaptive_meshing = run->mesh.adaptive_meshing;
+            coarse_run->mesh.adaptive_max_cell_size = run->mesh.adaptive_max_cell_size;
+            const double dx = COARSE_MESHING_FACTOR * run->mesh.meshing_voxel_radius;
+            if (context.cancelled() || !tetrahedralize_dilated_volume(*coarse_run, run->dilated_dexels, dx, context)) {
+                return false;
+            }
+            mesh_components(coarse_run->mesh.TT, int(coarse_run->mesh.TV.rows()), coarse_run->mesh.connected_components);
+            coarse->publish(coarse_run);
+            _state.redraw.request(RedrawScheduler::BackgroundJobs);
+        }
+        if (context.cancelled() ||
+                !tetrahedralize_dilated_volume(*run, run->dilated_dexels, run->mesh.meshing_voxel_radius, context)) {
+            return false;
+        }
+        run->dilated_dexels.clear();
+        mesh_components(run->mesh.TT, int(run->mesh.TV.rows()), run->mesh.connected_components);
+        if (run->mesh.optimize_mesh) {
+            if (!run->mesh.coarse_preview) {
+                // The endpoint selection starts on the mesh as it was made while it gets smoothed
+                std::shared_ptr<Run> unoptimized_run = std::make_shared<Run>();
+                unoptimized_run->mesh.TV = run->mesh.TV;
+                unoptimized_run->mesh.TT = run->mesh.TT;
+                unoptimized_run->mesh.TF = run->mesh.TF;
+                unoptimized_run->mesh.connected_components = run->mesh.connected_components;
+                coarse->publish(unoptimized_run);
+                _state.redraw.request(RedrawScheduler::BackgroundJobs);
+            }
+            if (context.cancelled() || !optimize_dilated_tet_mesh(*run, context)) {
+                return false;
+            }
+        }
+        store_cached_tet_mesh(*run);
+        result->publish(run);
+        return true;
+    }, [this]() { _state.redraw.request(RedrawScheduler::BackgroundJobs); });
 }
 
 
 bool Meshing_Menu::post_draw() {
     bool ret = FishUIViewerPlugin::post_draw();
 
-    if (is_meshing) {
+    if (coarse_result) {
+        // The endpoint selection takes over, it picks up the final mesh with update_refinement()
+        std::shared_ptr<Run> coarse = coarse_result->take();
+        if (coarse) {
+            coarse_result.reset();
+            take_run(*coarse);
+            refining = true;
+            _state.logger->info("Preview tet mesh done, making the final one in the background.");
+            done_meshing = true;
+        }
+    }
+
+    switch (refining ? JobStatus::Running : meshing_job.poll()) {
+    case JobStatus::Succeeded: {
+        if (!meshing_result) {
+            // Cancelled as it finished
+            break;
+        }
+        take_run(*meshing_result->take());
+        meshing_result.reset();
+        _state.logger->info("Done meshing background job.");
+        done_meshing = true;
+        break;
+    }
+    case JobStatus::Failed:
+    case JobStatus::Cancelled:
+        // Go back to the segmentation, the mesh stays dirty so the next visit meshes again
+        meshing_result.reset();
+        _state.logger->info("Meshing background job stopped before the tet mesh was done.");
+        _state.set_application_state(Application_State::Segmentation);
+        break;
+    default:
+        break;
+    }
+
+    if (meshing_job.is_running() && !refining) {
         int width;
         int height;
         glfwGetWindowSize(viewer->window, &width, &height);
@@ -195,6 +553,17 @@ bool Meshing_Menu::post_draw() {
         ImGui::BeginPopupModal("Processing Fish Segments");
         ImGui::Text("Processing Fish Segments. Please wait as this can take a few minutes.");
         ImGui::NewLine();
+        draw_job_stages(meshing_job);
+        // Keep the stage timings ticking while the job runs
+        _state.redraw.request(RedrawScheduler::BackgroundJobs);
+        ImGui::NewLine();
+        if (ImGui::Button("Cancel")) {
+            meshing_job.cancel();
+            meshing_result.reset();
+            coarse_result.reset();
+            _state.logger->info("Meshing cancelled.");
+            _state.set_application_state(Application_State::Segmentation);
+        }
         ImGui::EndPopup();
         ImGui::End();
     }
@@ -203,7 +572,6 @@ bool Meshing_Menu::post_draw() {
         _state.set_application_state(Application_State::EndPointSelection);
         done_meshing = false;
         _state.dirty_flags.mesh_dirty = false;
-        glfwPostEmptyEvent();
     }
 
     ImGui::Render();
@@ -211,144 +579,261 @@ bool Meshing_Menu::post_draw() {
 }
 
 
-void Meshing_Menu::dilate_volume() {
-    vor3d::CompressedVolume input;
-    volume_to_dexels(skeleton_masking_volume, _state.low_res_volume.dims(), input);
+bool Meshing_Menu::clean_up_volume(Run& run, JobContext& context) {
+    if (run.mesh.cleanup_radius <= 0.0) {
+        return true;
+    }
+    vor3d::ParallelSettings parallel_settings = vor3d::parallelSettings();
+    parallel_settings.num_threads = run.mesh.dilation_num_threads;
+    vor3d::setParallelSettings(parallel_settings);
 
+    // Closing first, so the gaps the opening would widen into holes are filled before the thin bridges go
     vor3d::VoronoiMorphoVorPower op = vor3d::VoronoiMorphoVorPower();
+    op.setProgress(&context.progress_channel());
     double time_1;
     double time_2;
-    vor3d::CompressedVolume output;
-    op.dilation(input, output, _state.dilated_tet_mesh.dilation_radius, time_1, time_2);
-
-    dexels_to_mesh(2 * _state.low_res_volume.dims()[0], output, extracted_surface.V_fat, extracted_surface.F_fat);
-}
-
-
-void Meshing_Menu::tetrahedralize_surface_mesh() {
-    const Eigen::MatrixXd& V = extracted_surface.V_fat;
-    const Eigen::MatrixXi& F = extracted_surface.F_fat;
-
-    std::vector<Vec3i> surf_tri(F.rows());
-    for (int i = 0; i < F.rows(); i++) {
-        surf_tri[i] = Vec3i(F.row(i)[0], F.row(i)[1], F.row(i)[2]);
+    context.begin_stage("Closing the selected volume");
+    vor3d::CompressedVolume closed;
+    op.closing(std::move(run.selected_dexels), closed, run.mesh.cleanup_radius, time_1, time_2);
+    if (context.cancelled()) {
+        return false;
     }
-
-    std::vector<Vec3f> surf_x(V.rows());
-    for (int i = 0; i < V.rows(); i++) {
-        surf_x[i] = Vec3f(V.row(i)[0], V.row(i)[1], V.row(i)[2]);
+    context.begin_stage("Opening the selected volume");
+    op.opening(std::move(closed), run.selected_dexels, run.mesh.cleanup_radius, time_1, time_2);
+    if (context.cancelled()) {
+        return false;
     }
+    if (run.selected_dexels.numSegments() == 0) {
+        _state.logger->error("The cleanup radius {} removed the whole selected volume!", run.mesh.cleanup_radius);
+        return false;
+    }
+    return true;
+}
 
-    // Compute the bounding box of the mesh
-    const Eigen::RowVector3f v_min = V.colwise().minCoeff().cast<float>();
-    Vec3f xmin(v_min[0], v_min[1], v_min[2]);
 
-    const Eigen::RowVector3f v_max = V.colwise().maxCoeff().cast<float>();
-    Vec3f xmax(v_max[0], v_max[1], v_max[2]);
+bool Meshing_Menu::dilate_volume(Run& run, JobContext& context) {
+    vor3d::ParallelSettings parallel_settings = vor3d::parallelSettings();
+    parallel_settings.num_threads = run.mesh.dilation_num_threads;
+    vor3d::setParallelSettings(parallel_settings);
+    _state.logger->debug("Dilating on {} threads", vor3d::parallelNumThreads());
+
+    if (run.mesh.radius_sweep) {
+        if (!run.distance_field) {
+            const double max_radius = distance_field_radius(run.mesh.dilation_radius);
+            context.begin_stage("Computing the distance to the selected volume");
+            std::shared_ptr<vor3d::DistanceField> field = std::make_shared<vor3d::DistanceField>();
+            field->build(run.selected_dexels, max_radius);
+            run.selected_dexels.clear();
+            if (context.cancelled()) {
+                return false;
+            }
+            run.distance_field = field;
+        }
+        context.begin_stage("Thresholding the distance to the selected volume");
+        run.distance_field->dilation(run.mesh.dilation_radius, run.dilated_dexels);
+        return true;
+    }
 
-    // Make the level set
-    // Determining dimensions of voxel grid.
-    // Round up to ensure voxel grid completely contains bounding box.
-    // Also add padding of 2 grid points around the bounding box.
-    // NOTE: We add 5 here so as to add 4 grid points of padding, as well as
-    // 1 grid point at the maximal boundary of the bounding box
-    // ie: (xmax-xmin)/dx + 1 grid points to cover one axis of the bounding box
-    const float dx = _state.dilated_tet_mesh.meshing_voxel_radius; //0.8f;
-    Vec3f origin = xmin - 2*Vec3f(dx, dx, dx);
-    int ni = static_cast<int>(std::ceil((xmax[0] - xmin[0]) / dx) + 4);
-    int nj = static_cast<int>(std::ceil((xmax[1] - xmin[1]) / dx) + 4);
-    int nk = static_cast<int>(std::ceil((xmax[2] - xmin[2]) / dx) + 4);
+    context.begin_stage("Dilating the selected volume");
+    vor3d::VoronoiMorphoVorPower op = vor3d::VoronoiMorphoVorPower();
+    op.setProgress(&context.progress_channel());
+    double time_1;
+    double time_2;
+    op.dilation(run.selected_dexels, run.dilated_dexels, run.mesh.dilation_radius, time_1, time_2);
+    run.selected_dexels.clear();
+    return !context.cancelled();
+}
 
-    SDF sdf(origin, dx, ni, nj, nk); // Initialize signed distance field.
-    
-    _state.logger->info("making {}x{}x{} level set", ni, nj, nk);
-    make_signed_distance(surf_tri, surf_x, sdf);
 
-    // Then the tet mesh
-    TetMesh mesh;
+bool Meshing_Menu::load_dilated_volume(Run& run, JobContext& context) {
+    if (run.mesh.dilated_dexels.empty()) {
+        ProjectFile file;
+        if (!run.stage_cache.load(DILATED_VOLUME_STAGE, run.dilated_volume_cache_key, file, _state.logger) ||
+                !file.read_vector("dilated_dexels", run.mesh.dilated_dexels)) {
+            run.mesh.dilated_dexels.clear();
+            return false;
+        }
+        _state.logger->info("Found the dilated volume in the stage cache.");
+    }
+    context.begin_stage("Loading the dilated volume");
+    vor3d::ParallelSettings parallel_settings = vor3d::parallelSettings();
+    parallel_settings.num_threads = run.mesh.dilation_num_threads;
+    vor3d::setParallelSettings(parallel_settings);
+    const std::vector<std::uint8_t>& data = run.mesh.dilated_dexels;
+    if (!run.dilated_dexels.loadCompact(data.data(), data.size())) {
+        _state.logger->warn("The stored dilated volume is corrupt, dilating the selection again.");
+        run.mesh.dilated_dexels.clear();
+        return false;
+    }
+    return true;
+}
 
-    // Make tet mesh without features
-    const bool optimize = false;
-    const bool intermediate = false;
-    const bool unsafe = false;
-    make_tet_mesh(mesh, sdf, optimize, intermediate, unsafe);
 
-    _state.dilated_tet_mesh.TV.resize(mesh.verts().size(), 3);
-    for (int i = 0; i < mesh.verts().size(); i++) {
-        Eigen::Vector3d vi(mesh.verts()[i][0], mesh.verts()[i][1], mesh.verts()[i][2]);
-        _state.dilated_tet_mesh.TV.row(i) = vi;
+bool Meshing_Menu::load_cached_tet_mesh(Run& run, JobContext& context) {
+    if (!run.stage_cache.enabled()) {
+        return false;
+    }
+    ProjectFile file;
+    if (!run.stage_cache.load(TET_MESH_STAGE, run.tet_mesh_cache_key, file, _state.logger)) {
+        return false;
     }
-    _state.dilated_tet_mesh.TT.resize(mesh.tets().size(), 4);
-    for (int i = 0; i < mesh.tets().size(); i++) {
-        _state.dilated_tet_mesh.TT.row(i) =
-            Eigen::Vector4i(mesh.tets()[i][0], mesh.tets()[i][2], mesh.tets()[i][1], mesh.tets()[i][3]);
+    context.begin_stage("Loading the cached tet mesh");
+    State::DilatedTetMesh& mesh = run.mesh;
+    bool ok = file.read_matrix("TV", mesh.TV) && file.read_matrix("TT", mesh.TT) && file.read_matrix("TF", mesh.TF) &&
+              file.read_matrix("connected_components", mesh.connected_components);
+    ok = ok && mesh.TV.cols() == 3 && mesh.TT.cols() == 4 && mesh.TF.cols() == 3 &&
+         mesh.connected_components.size() == mesh.TV.rows() && mesh.TT.rows() > 0;
+    ok = ok && mesh.TT.minCoeff() >= 0 && mesh.TT.maxCoeff() < mesh.TV.rows();
+    if (!ok) {
+        _state.logger->warn("The cached tet mesh is corrupt, meshing again.");
+        mesh.clear();
+        return false;
     }
+    // Kept with the mesh so that meshing it again with other meshing parameters does not dilate again
+    if (mesh.dilated_dexels.empty()) {
+        ProjectFile dilated_file;
+        if (!run.stage_cache.load(DILATED_VOLUME_STAGE, run.dilated_volume_cache_key, dilated_file, _state.logger) ||
+                !dilated_file.read_vector("dilated_dexels", mesh.dilated_dexels)) {
+            mesh.dilated_dexels.clear();
+        }
+    }
+    return true;
+}
+
 
-    igl::boundary_facets(_state.dilated_tet_mesh.TT, _state.dilated_tet_mesh.TF);
+void Meshing_Menu::store_cached_tet_mesh(const Run& run) {
+    if (!run.stage_cache.enabled()) {
+        return;
+    }
+    ProjectFileWriter writer;
+    writer.add_matrix("TV", run.mesh.TV);
+    writer.add_matrix("TT", run.mesh.TT);
+    writer.add_matrix("TF", run.mesh.TF);
+    writer.add_matrix("connected_components", run.mesh.connected_components);
+    run.stage_cache.store(TET_MESH_STAGE, run.tet_mesh_cache_key, writer, _state.logger);
 }
 
 
-void Meshing_Menu::extract_surface_mesh() {
-    const Eigen::RowVector3i volume_dims = _state.low_res_volume.dims();
-    const int w = volume_dims[0], h = volume_dims[1], d = volume_dims[2];
+bool Meshing_Menu::tetrahedralize_dilated_volume(Run& run, const vor3d::CompressedVolume& dexels, double voxel_radius,
+                                                 JobContext& context) {
+    context.begin_stage("Computing the signed distance");
 
-    // Grid positions and scalar values
-    Eigen::MatrixXd GP((w + 2)*(h + 2)*(d + 2), 3);
-    Eigen::VectorXd SV(GP.rows());
+    // Make the level set on a grid covering the dilated volume, in the (ray, y, x) frame of the dexels
+    const float dx = voxel_radius;
+    Eigen::Vector3d grid_origin;
+    Eigen::Vector3i grid_dims;
+    if (!dexel_distance_grid(dexels, dx, grid_origin, grid_dims)) {
+        _state.logger->error("The dilated volume is empty!");
+        return false;
+    }
+    // Quartet samples the grid in single precision, the distance is sampled at the same points
+    const Vec3f origin(grid_origin[0], grid_origin[1], grid_origin[2]);
+    grid_origin = Eigen::Vector3d(origin[0], origin[1], origin[2]);
+    const int ni = grid_dims[0], nj = grid_dims[1], nk = grid_dims[2];
+    if (run.mesh.adaptive_meshing) {
+        // The octree only looks at the distance near the surface, a narrow band is enough
+        SparseGrid<float> phi;
+        _state.logger->info("making {}x{}x{} narrow band level set", ni, nj, nk);
+        const double band = octree_band(run.mesh.adaptive_max_cell_size) * dx;
+        if (!dexels_to_sparse_signed_distance(dexels, grid_origin, dx, grid_dims, band, phi, context)) {
+            return false;
+        }
+        _state.logger->info("Narrow band level set has {} leaves and {} tiles, {} MB", phi.num_leaves(),
+                            phi.num_tiles(), phi.num_bytes() >> 20);
+
+        context.begin_stage("Tetrahedralizing");
+        SampledDistanceField field;
+        field.origin = grid_origin;
+        field.dx = dx;
+        field.dims = grid_dims;
+        field.sparse_phi = &phi;
+        if (!make_octree_tet_mesh(field, run.mesh.adaptive_max_cell_size, run.mesh.TV, run.mesh.TT)) {
+            _state.logger->error("Adaptive tet mesh of the dilated volume is empty!");
+            return false;
+        }
+        _state.logger->info("Adaptive tet mesh has {} vertices and {} tets",
+                            run.mesh.TV.rows(), run.mesh.TT.rows());
+    } else {
+        memory_tracker().check("Computing the signed distance", std::size_t(ni) * std::size_t(nj) * std::size_t(nk) * sizeof(float), 0);
+        SDF sdf(origin, dx, ni, nj, nk); // Initialize signed distance field.
 
-    int readcount = 0;
-    int appendcount = 0;
-    for (int zi = 0; zi < d + 2; zi++) {
-        for (int yi = 0; yi < h + 2; yi++) {
-            for (int xi = 0; xi < w + 2; xi++) {
-                if (xi == 0 || yi == 0 || zi == 0 ||
-                    xi == (w + 1) || yi == (h + 1) || zi == (d + 1)) {
-                    SV[readcount] = -1.0;
-                }
-                else {
-                    SV[readcount] = skeleton_masking_volume[appendcount];
-                    appendcount += 1;
-                }
-                GP.row(readcount) = Eigen::RowVector3d(xi, yi, zi);
-                readcount += 1;
-            }
+        _state.logger->info("making {}x{}x{} level set", ni, nj, nk);
+        if (!dexels_to_signed_distance(dexels, grid_origin, dx, grid_dims, &sdf.phi(0, 0, 0), context)) {
+            return false;
         }
-    }
 
-    igl::copyleft::marching_cubes(SV, GP, w + 2, h + 2, d + 2,
-        extracted_surface.V_thin,
-        extracted_surface.F_thin);
+        // Then the tet mesh
+        context.begin_stage("Tetrahedralizing");
+        TetMesh mesh;
+
+        // Make tet mesh without features. Quartet cannot be interrupted, a cancelled job only stops once
+        // it returns.
+        const bool optimize = false;
+        const bool intermediate = false;
+        const bool unsafe = false;
+        make_tet_mesh(mesh, sdf, optimize, intermediate, unsafe);
+        if (context.cancelled()) {
+            return false;
+        }
+
+        quartet_to_eigen(mesh, run.mesh.TV, run.mesh.TT);
+    }
+    static metrics::Counter& tets_generated =
+        metrics::counter("unwind_tets_generated_total", "Tets of the meshes of the dilated volumes");
+    tets_generated.add(std::uint64_t(run.mesh.TT.rows()));
+
+    // Neither mesher numbers its vertices in space order. No selection refers to the mesh yet, the endpoints are
+    // picked on it and moved to the refined meshes by position, so the new numbering is not needed.
+    reorder_tet_mesh(run.mesh.TV, run.mesh.TT);
+    tet_mesh_faces(run.mesh.TT, run.mesh.TF);
+    return true;
+}
 
 
-    if (extracted_surface.V_thin.rows() < 4 || extracted_surface.F_thin.rows() < 4) {
-        _state.logger->error("Extracted mesh has too few tets, aborting!");
-        exit(EXIT_FAILURE);
+bool Meshing_Menu::optimize_dilated_tet_mesh(Run& run, JobContext& context) {
+    context.begin_stage("Optimizing the tet mesh");
+    TetMeshOptimization optimization;
+    if (!optimize_tet_mesh(run.mesh.TV, run.mesh.TT, run.mesh.TF, run.mesh.optimize_seconds, MAX_OPTIMIZATION_SWEEPS,
+                           optimization, context)) {
+        return false;
     }
+    _state.logger->info("Optimized the tet mesh in {} sweeps ({}): worst mean ratio {:.3f} -> {:.3f}, "
+                        "{} -> {} slivers", optimization.num_sweeps,
+                        optimization.converged ? "converged" : "out of time or sweeps",
+                        optimization.before.min_quality, optimization.after.min_quality,
+                        optimization.before.num_slivers, optimization.after.num_slivers);
+    return true;
 }
 
 
-void Meshing_Menu::export_selected_volume(const std::vector<uint32_t>& feature_list)
+bool Meshing_Menu::export_selected_volume(Run& run, JobContext& context)
 {
+    context.begin_stage("Extracting the selected features");
+    const std::vector<uint32_t>& feature_list = run.feature_list;
     _state.logger->debug("Feature list size: {}", feature_list.size());
-    skeleton_masking_volume.resize(_state.low_res_volume.volume_data.size());
-    std::vector<contourtree::Feature> features = _state.segmented_features.topological_features.getFeatures(_state.segmented_features.num_selected_features, 0.f);
+    const std::vector<contourtree::Feature>& features = run.features;
 
-    std::vector<uint32_t> good_arcs;
+    // One bit per arc of the contour tree, set for the arcs of the selected features
+    std::vector<bool> selected_arcs;
     for (uint32_t f : feature_list) {
         _state.logger->debug("Feature: {}", f);
         _state.logger->debug("Feature arcs size: {}", features[f].arcs.size());
-        good_arcs.insert(good_arcs.end(), features[f].arcs.begin(), features[f].arcs.end());
-        _state.logger->debug("Good arcs size: {}", good_arcs.size());
+        for (uint32_t arc : features[f].arcs) {
+            if (arc >= selected_arcs.size()) {
+                selected_arcs.resize(arc + 1, false);
+            }
+            selected_arcs[arc] = true;
+        }
     }
-    std::sort(good_arcs.begin(), good_arcs.end());
 
-    for (int i = 0; i < skeleton_masking_volume.size(); ++i) {
-        unsigned int idx = _state.low_res_volume.index_data[i];
-        if (std::binary_search(good_arcs.begin(), good_arcs.end(), idx)) {
-            skeleton_masking_volume[i] = 1.0;
-        }
-        else {
-            skeleton_masking_volume[i] = -1.0;
-        }
+    const Eigen::RowVector3i crop_size = run.crop_end - run.crop_begin;
+    _state.logger->debug("Meshing the {} x {} x {} voxels at ({}, {}, {})", crop_size[0], crop_size[1], crop_size[2],
+                         run.crop_begin[0], run.crop_begin[1], run.crop_begin[2]);
+    const IndexVoxelRuns& arc_runs = _state.segmented_features.arc_runs;
+    if (!arc_runs.empty() && arc_runs.volume_dims == _state.low_res_volume.dims()) {
+        return select_run_dexels(arc_runs, selected_arcs, run.crop_begin, run.crop_end, run.selected_dexels,
+                                 context);
     }
+    return select_index_dexels(_state.low_res_volume.index_data.data(), _state.low_res_volume.dims(), selected_arcs,
+                               run.crop_begin, run.crop_end, run.selected_dexels, context);
 }
@@ -3,8 +3,15 @@
 
 #include "fish_ui_viewer_plugin.h"
 
-#include <atomic>
-#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <utils/background_job.h>
+#include <utils/result_handoff.h>
+#include <utils/volume_buffer.h>
+#include <vor3d/CompressedVolume.h>
+#include <vor3d/DistanceField.h>
 
 struct State;
 
@@ -16,31 +23,86 @@ public:
 
     void initialize();
 
+    // Called every frame by the segment selection. Once the selection and the meshing parameters have not
+    // changed for SPECULATION_DELAY seconds, they are meshed in the background, so going to the meshing screen
+    // with the same selection picks up the running or finished job instead of starting over.
+    void update_speculative_meshing();
+    // Drop the speculative job, e.g. before the volume it reads is replaced
+    void cancel_speculative_meshing();
+
+    // With the coarse preview on, the meshing screen hands a tet mesh of COARSE_MESHING_FACTOR times larger
+    // cells to the endpoint selection and keeps making the fine one in the background. With the mesh optimization
+    // on, it hands over the mesh as it was made and keeps smoothing it. Called every frame by the endpoint
+    // selection while nothing reads the tet mesh of the state: once the final mesh is done it replaces the
+    // preview, and the endpoints move to its closest surface vertices. Returns true if the mesh changed.
+    bool update_refinement();
+    // The state holds the preview mesh and the final one is being made
+    bool is_refining() const { return refining; }
+
+    // Size of the stage cache in the project directory, which keeps the dilated volumes and tet meshes of
+    // previous selections and parameters, and the feature surfaces of the segment selection
+    static constexpr std::uint64_t STAGE_CACHE_BYTES = std::uint64_t(4) << 30;
+
     struct {
-        Eigen::VectorXf masking_volume_hack;
+        VolumeBuffer<uint8_t> masking_volume_hack;
         bool enabled = false;
     } debug;
 private:
     State& _state;
 
-    // Intermediate state of the extracted surface
-    struct ExtractedSurface {
-        Eigen::MatrixXd V_thin;
-        Eigen::MatrixXi F_thin;
-        Eigen::MatrixXd V_fat;
-        Eigen::MatrixXi F_fat;
-    } extracted_surface;
+    // Inputs and outputs of one run of the meshing job. The job builds it on its own and publishes it once the
+    // tet mesh is done, it is moved into the state when the run succeeds.
+    struct Run;
+
+    BackgroundJob meshing_job;
+    std::shared_ptr<ResultHandoff<Run>> meshing_result;
+    bool done_meshing = false;
+    // Coarse or unoptimized mesh of the current job when the coarse preview or the optimization is on, published
+    // before the final one
+    std::shared_ptr<ResultHandoff<Run>> coarse_result;
+    bool refining = false;
+
+    static constexpr double SPECULATION_DELAY = 2.0;
+    static constexpr double COARSE_MESHING_FACTOR = 3.0;
+    // Most sweeps of the mesh optimization, which usually settles well before
+    static constexpr int MAX_OPTIMIZATION_SWEEPS = 50;
+    // Hash of the selection and meshing parameters of the job started last, and the run of a speculative job
+    // which succeeded before the meshing screen was shown
+    std::uint64_t run_key = 0;
+    std::shared_ptr<Run> speculative_run;
+    // Key seen by the last update_speculative_meshing and when it last changed
+    std::uint64_t last_key = 0;
+    std::chrono::steady_clock::time_point last_key_change;
 
-    std::thread bg_thread;
-    std::atomic_bool is_meshing;
-    std::atomic_bool done_meshing;
+    // Distance to the selected volume of the last run with radius_sweep on, and the selection_key of that volume.
+    // Shared with the runs that reuse it, which only read it.
+    std::shared_ptr<const vor3d::DistanceField> distance_field;
+    std::uint64_t distance_field_key = 0;
 
-    Eigen::VectorXf skeleton_masking_volume;
+    std::uint64_t meshing_key() const;
+    // Hash of what the selected volume depends on, i.e. the meshing key without the dilation and meshing parameters
+    std::uint64_t selection_key() const;
+    // Hash of what the dilated volume depends on, the selection key and the dilation radius
+    std::uint64_t dilation_key() const;
+    void start_meshing(bool speculative);
+    void take_run(Run& run);
 
-    void export_selected_volume(const std::vector<uint32_t>& feature_list);
-    void tetrahedralize_surface_mesh();
-    void dilate_volume();
-    void extract_surface_mesh();
+    bool export_selected_volume(Run& run, JobContext& context);
+    // Closing then opening of the selected volume by the cleanup radius, when it is set
+    bool clean_up_volume(Run& run, JobContext& context);
+    // Dilation of the selected volume, or threshold of the distance field of the run when radius_sweep is on
+    bool dilate_volume(Run& run, JobContext& context);
+    // Decode the dilated volume the run was given, or the one of the stage cache, returns false if there is none
+    // or it cannot be decoded
+    bool load_dilated_volume(Run& run, JobContext& context);
+    // Tet mesh and components of the stage cache for the parameters of the run, returns false if there are none
+    bool load_cached_tet_mesh(Run& run, JobContext& context);
+    void store_cached_tet_mesh(const Run& run);
+    // Tet mesh of dexels on a lattice of spacing voxel_radius into the mesh of the run
+    bool tetrahedralize_dilated_volume(Run& run, const vor3d::CompressedVolume& dexels, double voxel_radius,
+                                       JobContext& context);
+    // Smooth the tet mesh of the run for up to its optimize_seconds, see optimize_tet_mesh
+    bool optimize_dilated_tet_mesh(Run& run, JobContext& context);
 };
 
 #endif // __FISH_DEFORMATION_MESHING_STATE__
@@ -0,0 +1,363 @@
+#include "render_benchmark.h"
+
+#include "state.h"
+#include "initial_file_selection_state.h"
+#include "bounding_polygon_plugin.h"
+#include <utils/frame_timer.h>
+#include <utils/path_utils.h>
+#include <utils/gl/gpu_profiler.h>
+
+#include <GLFW/glfw3.h>
+#include <igl/PI.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+
+void print_render_benchmark_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind --bench-render PROJECT [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --frames N         frames timed in each view (default: 240)" << std::endl;
+    std::cerr << "  --warmup N         frames drawn before the timing of each view starts (default: 30)" << std::endl;
+    std::cerr << "  --size WxH         size of the window (default: 1280x800)" << std::endl;
+    std::cerr << "  --camera-path FILE keyframes of the camera, recorded with F7 (default: one orbit)" << std::endl;
+    std::cerr << "  --images N         reference images saved in each view (default: 4)" << std::endl;
+    std::cerr << "  --output DIR       directory the frame times and the images are written to (default: render-bench)" << std::endl;
+    std::cerr << "  --visible          keep the window on screen" << std::endl;
+}
+
+bool parse_render_benchmark_arguments(int argc, char** argv, RenderBenchmarkOptions& options) {
+    for (int i = 0; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--frames" && has_value) {
+            options.num_frames = std::atoi(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            options.num_warmup_frames = std::atoi(argv[++i]);
+        } else if (arg == "--size" && has_value) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+                std::cerr << "ERROR: The size must be given as WxH, e.g. 1280x800" << std::endl;
+                return false;
+            }
+        } else if (arg == "--camera-path" && has_value) {
+            options.camera_path_filename = argv[++i];
+        } else if (arg == "--images" && has_value) {
+            options.num_reference_images = std::atoi(argv[++i]);
+        } else if (arg == "--output" && has_value) {
+            options.output_dir = argv[++i];
+        } else if (arg == "--visible") {
+            options.visible = true;
+        } else if (arg.size() > 0 && arg[0] != '-' && options.project_path.empty()) {
+            options.project_path = arg;
+        } else {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        }
+    }
+    if (options.project_path.empty()) {
+        std::cerr << "ERROR: No project to load" << std::endl;
+        return false;
+    }
+    if (options.num_frames < 1 || options.num_warmup_frames < 0 || options.num_reference_images < 0 ||
+        options.width < 1 || options.height < 1) {
+        std::cerr << "ERROR: The frames, the warmup frames, the images and the size must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void set_up_benchmark_window(igl::opengl::glfw::Viewer& viewer, State& state, int width, int height, bool visible) {
+    glfwSetWindowSize(viewer.window, width, height);
+    if (!visible) {
+        glfwHideWindow(viewer.window);
+    }
+    glfwSwapInterval(0);
+    state.redraw.set_max_fps(0.0);
+}
+
+bool read_camera_path(const std::string& filename, std::vector<CameraKeyframe>& keyframes,
+                      spdlog::logger& logger) {
+    std::ifstream in(filename);
+    if (!in) {
+        logger.error("Cannot open the camera path '{}'", filename);
+        return false;
+    }
+    keyframes.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        line_number += 1;
+        const std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        CameraKeyframe kf;
+        float w, x, y, z;
+        if (!(fields >> w >> x >> y >> z >> kf.zoom) || kf.zoom <= 0.0f) {
+            logger.error("Malformed keyframe on line {} of the camera path '{}'", line_number, filename);
+            return false;
+        }
+        kf.rotation = Eigen::Quaternionf(w, x, y, z).normalized();
+        keyframes.push_back(kf);
+    }
+    if (keyframes.empty()) {
+        logger.error("The camera path '{}' has no keyframes", filename);
+        return false;
+    }
+    return true;
+}
+
+bool append_camera_keyframe(const igl::opengl::ViewerCore& core, const std::string& filename,
+                            spdlog::logger& logger) {
+    std::ofstream out(filename, std::ios::app);
+    const Eigen::Quaternionf& q = core.trackball_angle;
+    if (!(out << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << " " << core.camera_zoom << "\n")) {
+        logger.error("Cannot write the camera to '{}'", filename);
+        return false;
+    }
+    logger.info("Appended the camera to '{}'", filename);
+    return true;
+}
+
+
+RenderBenchmark::RenderBenchmark(State& state, Initial_File_Selection_Menu& file_selection,
+                                 Bounding_Polygon_Menu& bounding_polygon)
+    : _state(state)
+    , _file_selection(file_selection)
+    , _bounding_polygon(bounding_polygon)
+{}
+
+void RenderBenchmark::set_options(const RenderBenchmarkOptions& options) {
+    _options = options;
+    _enabled = true;
+}
+
+const char* RenderBenchmark::view_name(Phase view) {
+    switch (view) {
+    case Selection:
+        return "segmentation";
+    case CurvedCage:
+        return "cage-curved";
+    case StraightCage:
+        return "cage-straight";
+    default:
+        return "none";
+    }
+}
+
+bool RenderBenchmark::init(igl::opengl::glfw::Viewer& viewer) {
+    if (!_options.camera_path_filename.empty() &&
+        !read_camera_path(_options.camera_path_filename, _camera_path, *_state.logger)) {
+        finish(viewer, true);
+        return false;
+    }
+    mkpath(_options.output_dir.c_str(), 0777);
+    if (get_file_type(_options.output_dir.c_str()) != FT_DIRECTORY) {
+        _state.logger->error("Cannot create the output directory '{}'", _options.output_dir);
+        finish(viewer, true);
+        return false;
+    }
+
+    set_up_benchmark_window(viewer, _state, _options.width, _options.height, _options.visible);
+    if (!gpu_profiler().set_enabled(true)) {
+        _state.logger->warn("Timer queries are not supported, the render benchmark only records CPU times");
+    }
+    _state.logger->info("Render benchmark of '{}', {} frames per view", _options.project_path, _options.num_frames);
+    return true;
+}
+
+CameraKeyframe RenderBenchmark::camera_at(double t) const {
+    CameraKeyframe camera;
+    if (_camera_path.empty()) {
+        // One orbit around the vertical axis of the volume
+        const float angle = float(2.0 * igl::PI * t);
+        camera.rotation = Eigen::Quaternionf(Eigen::AngleAxisf(angle, Eigen::Vector3f::UnitY()));
+        return camera;
+    }
+    if (_camera_path.size() == 1) {
+        return _camera_path.front();
+    }
+    const double s = std::min(std::max(t, 0.0), 1.0) * double(_camera_path.size() - 1);
+    const std::size_t i = std::min(std::size_t(s), _camera_path.size() - 2);
+    const float alpha = float(s - double(i));
+    camera.rotation = _camera_path[i].rotation.slerp(alpha, _camera_path[i + 1].rotation);
+    camera.zoom = (1.0f - alpha) * _camera_path[i].zoom + alpha * _camera_path[i + 1].zoom;
+    return camera;
+}
+
+CameraKeyframe RenderBenchmark::camera_for_frame(int frame) const {
+    // The orbit ends where it started, so its last frame stops one step short of a full turn
+    const int steps = _camera_path.empty() ? _options.num_frames : std::max(_options.num_frames - 1, 1);
+    return camera_at(double(frame) / double(steps));
+}
+
+void RenderBenchmark::start_view(igl::opengl::glfw::Viewer& viewer, Phase view) {
+    if ((view == CurvedCage || view == StraightCage) && _state.cage.num_keyframes() == 0) {
+        _state.logger->warn("The project has no bounding cage, skipping the views of the bounding polygon screen");
+        finish(viewer, false);
+        return;
+    }
+    _phase = view;
+    _frame = 0;
+    _state.logger->info("Render benchmark: {} view", view_name(view));
+}
+
+void RenderBenchmark::pre_draw(igl::opengl::glfw::Viewer& viewer) {
+    _frame_prepared = false;
+    if (!_enabled || _phase == Done) {
+        return;
+    }
+    _state.redraw.request(RedrawScheduler::VolumeView);
+
+    if (_phase == Loading) {
+        if (!_project_opened) {
+            _file_selection.open_project(_options.project_path);
+            _project_opened = true;
+        } else if (_state.application_state == Application_State::Segmentation) {
+            start_view(viewer, Selection);
+        } else if (_file_selection.showing_error()) {
+            _state.logger->error("Render benchmark: failed to load '{}'", _options.project_path);
+            finish(viewer, true);
+        }
+        return;
+    }
+
+    const Application_State screen = _phase == Selection ? Application_State::Segmentation
+                                                         : Application_State::BoundingPolygon;
+    if (_state.application_state != screen) {
+        // The screen is switched at the start of the next frame
+        _state.set_application_state(screen);
+        return;
+    }
+    if (_frame == 0 && _phase != Selection) {
+        _bounding_polygon.set_draw_straight(_phase == StraightCage);
+    }
+
+    const int timed_frame = _frame - _options.num_warmup_frames;
+    CameraKeyframe camera;
+    if (timed_frame < 0) {
+        camera = camera_for_frame(0);
+    } else if (timed_frame < _options.num_frames) {
+        camera = camera_for_frame(timed_frame);
+    } else {
+        const int image = timed_frame - _options.num_frames;
+        camera = camera_for_frame(image * _options.num_frames / std::max(_options.num_reference_images, 1));
+    }
+    viewer.core.trackball_angle = camera.rotation;
+    viewer.core.camera_zoom = camera.zoom;
+    _frame_prepared = true;
+}
+
+void RenderBenchmark::record_frame(int frame) {
+    for (const FrameTimer::Section& section : frame_timer().sections()) {
+        if (&section == &frame_timer().frame() || &section == &frame_timer().interval()) {
+            _rows.push_back(Row{_phase, frame, "cpu", section.name, section.last_ms});
+        } else if (section.marked) {
+            _rows.push_back(Row{_phase, frame, "cpu", section.name, section.frame_ms});
+        }
+    }
+    if (gpu_profiler().enabled()) {
+        for (const GpuProfiler::Section& section : gpu_profiler().sections()) {
+            _rows.push_back(Row{_phase, frame, "gpu", section.name, section.last_ms});
+        }
+    }
+}
+
+bool RenderBenchmark::save_reference_image(igl::opengl::glfw::Viewer& viewer, int index) {
+    int width, height;
+    glfwGetFramebufferSize(viewer.window, &width, &height);
+    std::vector<unsigned char> pixels(std::size_t(width) * height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    const std::string filename = _options.output_dir + "/" + view_name(_phase) + "-" + std::to_string(index) + ".ppm";
+    std::ofstream out(filename, std::ios::binary);
+    out << "P6\n" << width << " " << height << "\n255\n";
+    // The rows of the framebuffer start at the bottom
+    for (int y = height - 1; y >= 0; y--) {
+        out.write(reinterpret_cast<const char*>(pixels.data() + std::size_t(y) * width * 3), std::streamsize(width) * 3);
+    }
+    if (!out) {
+        _state.logger->error("Cannot write the reference image '{}'", filename);
+        return false;
+    }
+    return true;
+}
+
+void RenderBenchmark::frame_end(igl::opengl::glfw::Viewer& viewer) {
+    if (!_frame_prepared) {
+        return;
+    }
+    _frame_prepared = false;
+
+    const int timed_frame = _frame - _options.num_warmup_frames;
+    if (timed_frame >= 0 && timed_frame < _options.num_frames) {
+        record_frame(timed_frame);
+    } else if (timed_frame >= _options.num_frames) {
+        // Saved after the timed frames so that the reads do not stall them
+        if (!save_reference_image(viewer, timed_frame - _options.num_frames)) {
+            finish(viewer, true);
+            return;
+        }
+    }
+
+    _frame += 1;
+    if (_frame < _options.num_warmup_frames + _options.num_frames + _options.num_reference_images) {
+        return;
+    }
+    if (_phase == StraightCage) {
+        finish(viewer, false);
+    } else {
+        start_view(viewer, Phase(_phase + 1));
+    }
+}
+
+bool RenderBenchmark::write_results() {
+    const std::string filename = _options.output_dir + "/frame-times.csv";
+    std::ofstream out(filename);
+    out << "view,frame,source,section,ms\n";
+    for (const Row& row : _rows) {
+        out << view_name(row.view) << "," << row.frame << "," << row.source << "," << row.section << "," << row.ms << "\n";
+    }
+    if (!out) {
+        _state.logger->error("Cannot write the frame times to '{}'", filename);
+        return false;
+    }
+    _state.logger->info("Wrote the frame times to '{}'", filename);
+
+    for (int view = Selection; view < Done; view++) {
+        std::vector<double> frame_ms;
+        for (const Row& row : _rows) {
+            if (row.view == view && row.section == frame_timer().frame().name) {
+                frame_ms.push_back(row.ms);
+            }
+        }
+        if (frame_ms.empty()) {
+            continue;
+        }
+        std::nth_element(frame_ms.begin(), frame_ms.begin() + frame_ms.size() / 2, frame_ms.end());
+        _state.logger->info("  {}: median CPU frame time {:.2f} ms", view_name(Phase(view)), frame_ms[frame_ms.size() / 2]);
+    }
+    return true;
+}
+
+void RenderBenchmark::finish(igl::opengl::glfw::Viewer& viewer, bool failed) {
+    if (!_rows.empty() && !write_results()) {
+        failed = true;
+    }
+    _phase = Done;
+    _failed = failed;
+    glfwSetWindowShouldClose(viewer.window, GLFW_TRUE);
+    // The viewer waits for events once the frame is done
+    glfwPostEmptyEvent();
+}
@@ -0,0 +1,126 @@
+#ifndef RENDER_BENCHMARK_H
+#define RENDER_BENCHMARK_H
+
+#include <igl/opengl/glfw/Viewer.h>
+#include <spdlog/spdlog.h>
+#include <Eigen/Geometry>
+
+#include <string>
+#include <vector>
+
+class Initial_File_Selection_Menu;
+class Bounding_Polygon_Menu;
+struct State;
+
+// File the camera is appended to with F7, to record a path for --camera-path
+constexpr const char* CAMERA_PATH_FILENAME = "camera-path.txt";
+
+struct RenderBenchmarkOptions {
+    std::string project_path;
+    // Frames timed in each view
+    int num_frames = 240;
+    // Frames drawn after each switch of the view before the timing starts
+    int num_warmup_frames = 30;
+    int width = 1280;
+    int height = 800;
+    // Keyframes of the camera, see read_camera_path. Without it the camera orbits the volume once
+    std::string camera_path_filename;
+    std::string output_dir = "render-bench";
+    // Images saved in each view along the camera path, to diff the quality of renderer changes
+    int num_reference_images = 4;
+    // Keep the window on screen, some drivers do not draw into hidden windows
+    bool visible = false;
+};
+
+void print_render_benchmark_usage();
+// Parses the arguments that follow --bench-render, returns false if they are malformed
+bool parse_render_benchmark_arguments(int argc, char** argv, RenderBenchmarkOptions& options);
+
+// Give the window a fixed size, hide it unless visible and draw as fast as possible instead of once per
+// refresh, for the runs that measure the frames
+void set_up_benchmark_window(igl::opengl::glfw::Viewer& viewer, State& state, int width, int height, bool visible);
+
+struct CameraKeyframe {
+    Eigen::Quaternionf rotation = Eigen::Quaternionf::Identity();
+    float zoom = 1.0f;
+};
+
+// One keyframe per line as "qw qx qy qz zoom", the trackball rotation and the zoom of the viewer.
+// Empty lines and lines starting with # are skipped.
+bool read_camera_path(const std::string& filename, std::vector<CameraKeyframe>& keyframes,
+                      spdlog::logger& logger);
+// Append the current camera of the viewer to filename as a keyframe
+bool append_camera_keyframe(const igl::opengl::ViewerCore& core, const std::string& filename,
+                            spdlog::logger& logger);
+
+// Loads a project, then flies the camera along the same path through the segmentation screen and through the
+// curved and the straight views of the bounding polygon screen. Every view is drawn for a fixed number of frames
+// in a window of fixed size without waiting for the refresh, and the CPU time of the parts of each frame and
+// the GPU time of the render passes are written to frame-times.csv in the output directory as rows of
+// "view,frame,source,section,ms". Reference images of the views are saved next to it as binary PPM files.
+//
+// The GPU times of a frame are only known a few frames later, see GpuProfiler, so the GPU rows of a frame are
+// the latest timings known when it was drawn. The viewer is closed once all the views are done.
+class RenderBenchmark {
+public:
+    RenderBenchmark(State& state, Initial_File_Selection_Menu& file_selection,
+                    Bounding_Polygon_Menu& bounding_polygon);
+
+    void set_options(const RenderBenchmarkOptions& options);
+    bool enabled() const { return _enabled; }
+    bool failed() const { return _failed; }
+
+    // Sizes the window and stops throttling the frames, call once the viewer is initialized
+    bool init(igl::opengl::glfw::Viewer& viewer);
+    // Call at the start of every frame once the screen of the application state is set up
+    void pre_draw(igl::opengl::glfw::Viewer& viewer);
+    // Call once the frame is drawn, before the buffers are swapped
+    void frame_end(igl::opengl::glfw::Viewer& viewer);
+
+private:
+    enum Phase {
+        Loading = 0,
+        Selection,
+        CurvedCage,
+        StraightCage,
+        Done
+    };
+
+    struct Row {
+        Phase view;
+        int frame;
+        const char* source;
+        std::string section;
+        double ms;
+    };
+
+    static const char* view_name(Phase view);
+
+    CameraKeyframe camera_at(double t) const;
+    // Camera of the i-th frame of the timed frames of a view
+    CameraKeyframe camera_for_frame(int frame) const;
+
+    void start_view(igl::opengl::glfw::Viewer& viewer, Phase view);
+    void record_frame(int frame);
+    bool save_reference_image(igl::opengl::glfw::Viewer& viewer, int index);
+    void finish(igl::opengl::glfw::Viewer& viewer, bool failed);
+    bool write_results();
+
+    State& _state;
+    Initial_File_Selection_Menu& _file_selection;
+    Bounding_Polygon_Menu& _bounding_polygon;
+
+    RenderBenchmarkOptions _options;
+    std::vector<CameraKeyframe> _camera_path;
+    bool _enabled = false;
+    bool _failed = false;
+
+    Phase _phase = Loading;
+    bool _project_opened = false;
+    // Frames of the current view so far, the warmup frames, then the timed ones, then the reference images
+    int _frame = 0;
+    bool _frame_prepared = false;
+    std::vector<Row> _rows;
+};
+
+#endif // RENDER_BENCHMARK_H
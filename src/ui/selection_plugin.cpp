@@ -1,12 +1,14 @@
 #include "selection_plugin.h"
 
 #include "state.h"
+#include "meshing_plugin.h"
 
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
 #include <GLFW/glfw3.h>
 
 #include "utils/glm_conversion.h"
+#include "utils/stage_cache.h"
 
 #include <glm/glm.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
@@ -14,33 +16,80 @@
 
 #pragma optimize ("", off)
 
+extern Meshing_Menu meshing_menu;
+
+namespace {
+
+// Bump this whenever extract_feature_surfaces changes what it produces
+constexpr std::uint32_t FEATURE_SURFACES_VERSION = 1;
+const char* FEATURE_SURFACES_STAGE = "surfaces";
+
+} // namespace
+
 Selection_Menu::Selection_Menu(State& state) : _state(state) {}
 
 void Selection_Menu::deinitialize() {
-    selection_renderer.destroy();
+    // The meshing screen picks up the speculative job, anywhere else it would outlive the volume it reads
+    if (_state.application_state != Application_State::Meshing) {
+        meshing_menu.cancel_speculative_meshing();
+    }
+    // The renderer keeps its programs, render targets and uploaded features for the next visit of the screen
+    feature_picker.clear();
+    // The job reads its own copy of the features, but its surfaces would not be picked up before the next visit
+    if (surface_result) {
+        surface_job.cancel();
+        surface_result.reset();
+        surface_key = 0;
+        surfaces_dirty = true;
+    }
     viewer->core.viewport = old_viewport;
 }
 
 void Selection_Menu::initialize() {
-    selection_renderer.initialize(glm::ivec2(viewer->core.viewport[2], viewer->core.viewport[3]));
+    // Created on the first visit. Later visits only upload what changed while the screen was not shown, which is
+    // nothing unless a new scan or project was loaded.
+    bool new_volume = renderer_volume_generation != _state.volume_generation;
+    if (!selection_renderer.is_initialized()) {
+        selection_renderer.initialize(glm::ivec2(viewer->core.viewport[2], viewer->core.viewport[3]));
+        feature_mesh_renderer.init();
+        // The render targets are sized by the first draw
+        target_viewport_size = { -1.f, -1.f, -1.f, -1.f };
+        transfer_function_dirty = !transfer_function.empty();
+        new_volume = true;
+    }
+    renderer_volume_generation = _state.volume_generation;
 
     const glm::ivec3 volume_dims = G3i(_state.low_res_volume.dims());
     rendering_params.volume_dimensions = volume_dims;
+    feature_picker.set_volume(_state.low_res_volume.volume_data.data(), _state.low_res_volume.index_data.data(),
+                              volume_dims, static_cast<uint8_t>(_state.low_res_volume.min_value),
+                              static_cast<uint8_t>(_state.low_res_volume.max_value));
+    picking_direction = glm::vec3(0.f);
+    if (new_volume) {
+        bounding_hull.set_volume(_state.low_res_volume.volume_data.data(), _state.low_res_volume.index_data.data(),
+                                 volume_dims, static_cast<uint8_t>(_state.low_res_volume.min_value),
+                                 static_cast<uint8_t>(_state.low_res_volume.max_value));
+        feature_mesh_renderer.clear();
+        surface_key = 0;
+        surfaces_dirty = true;
+    }
+    bounding_hull_dirty = true;
 
     number_features_is_dirty = false;
     selection_list_is_dirty = false;
     {
         uint32_t* buffer_data = _state.segmented_features.buffer_data.data();
         size_t num_features =_state.segmented_features.buffer_data.size();
-        selection_renderer.set_contour_data(buffer_data, num_features);
+        feature_picker.set_contour_data(buffer_data, num_features);
+        if (new_volume) {
+            selection_renderer.set_contour_data(buffer_data, num_features);
 
-        std::vector<uint32_t> selected = _state.segmented_features.selected_features;
-        selected.insert(selected.begin(), static_cast<uint32_t>(selected.size()));
-        selection_renderer.set_selection_data(selected.data(), selected.size());
+            std::vector<uint32_t> selected = _state.segmented_features.selected_features;
+            selected.insert(selected.begin(), static_cast<uint32_t>(selected.size()));
+            selection_renderer.set_selection_data(selected.data(), selected.size());
+        }
     }
 
-    target_viewport_size = { -1.f, -1.f, -1.f, -1.f };
-
     int window_width, window_height;
     glfwGetWindowSize(viewer->window, &window_width, &window_height);
 
@@ -79,13 +128,11 @@ void Selection_Menu::initialize() {
     viewer->core.align_camera_center(volume_bbox_v, volume_bbox_i);
 
     if (transfer_function.empty()) {
-        // Create the initial nodes
-        TfNode first = { 0.f, { 0.f, 0.f, 0.f, 0.f } };
-        TfNode last = { 1.f, { 1.f, 1.f, 1.f, 1.f } };
-        transfer_function.push_back(std::move(first));
-        transfer_function.push_back(std::move(last));
+        // The initial nodes, a ramp over the whole range
+        transfer_function = tf_widget.transfer_function();
         transfer_function_dirty = true;
     }
+    update_feature_histogram();
 
     old_viewport = viewer->core.viewport;
 
@@ -93,6 +140,94 @@ void Selection_Menu::initialize() {
     viewer->core.viewport = viewport;
 }
 
+void Selection_Menu::update_bounding_hull() {
+    const std::vector<uint32_t>& buffer_data = _state.segmented_features.buffer_data;
+    const size_t num_features = buffer_data.empty() ? 0 : buffer_data[0];
+
+    // Only a highlight factor of 0 makes the emphasized features fully transparent, see selection_factor() of
+    // the volume pass. Features are numbered from 1 in the selection list.
+    std::vector<bool> shown(num_features + 1, true);
+    const std::vector<uint32_t>& selected = _state.segmented_features.selected_features;
+    if (!selected.empty() && highlight_factor <= 0.f && emphasize_by_selection != Emphasis::None) {
+        const bool show_selected = emphasize_by_selection == Emphasis::OnSelection;
+        shown.assign(num_features + 1, !show_selected);
+        for (uint32_t feature : selected) {
+            if (feature < shown.size()) {
+                shown[feature] = show_selected;
+            }
+        }
+    }
+
+    bounding_hull.update(buffer_data.data(), buffer_data.size(), shown, transfer_function, color_by_id);
+    const std::vector<GLfloat>& vertices = bounding_hull.vertices();
+    const std::vector<GLuint>& indices = bounding_hull.indices();
+    selection_renderer.set_bounding_geometry(vertices.data(), GLsizei(vertices.size() / 3), indices.data(),
+                                             GLsizei(indices.size() / 3));
+}
+
+void Selection_Menu::update_feature_surfaces() {
+    if (surface_job.poll() == JobStatus::Succeeded && surface_result) {
+        std::shared_ptr<FeatureSurfaces> surfaces = surface_result->take();
+        if (surfaces) {
+            feature_mesh_renderer.set_surfaces(*surfaces);
+        }
+    }
+    if (!surface_job.is_running()) {
+        surface_result.reset();
+    }
+    if (!mesh_rendering || !surfaces_dirty) {
+        return;
+    }
+    surfaces_dirty = false;
+
+    // The surfaces depend on the voxels of the arcs and on the features they are merged into
+    const std::vector<uint32_t>& buffer_data = _state.segmented_features.buffer_data;
+    KeyHash key;
+    key.add(FEATURE_SURFACES_VERSION);
+    key.add(_state.low_res_volume.content_hash);
+    for (uint32_t feature : buffer_data) {
+        key.add(feature);
+    }
+    if (key.hash == surface_key) {
+        return;
+    }
+    surface_key = key.hash;
+    // Surfaces of other features would be colored and picked as the wrong ones, the volume is ray cast until
+    // the new ones are there
+    feature_mesh_renderer.clear();
+
+    StageCache stage_cache;
+    if (_state.low_res_volume.content_hash != 0 && !_state.input_metadata.output_dir.empty()) {
+        stage_cache = StageCache(_state.input_metadata.output_dir + "/stage_cache", Meshing_Menu::STAGE_CACHE_BYTES);
+    }
+    std::shared_ptr<ResultHandoff<FeatureSurfaces>> result = std::make_shared<ResultHandoff<FeatureSurfaces>>();
+    surface_result = result;
+    // The features of the state change with the segmentation, the job works on its own copy of them
+    surface_job.start([result, stage_cache, cache_key = key.hash, runs = _state.segmented_features.arc_runs,
+                       contour_features = buffer_data, logger = _state.logger](JobContext& context) {
+        std::shared_ptr<FeatureSurfaces> surfaces = std::make_shared<FeatureSurfaces>();
+        if (stage_cache.enabled()) {
+            context.begin_stage("Reading the feature surfaces");
+            ProjectFile file;
+            if (stage_cache.load(FEATURE_SURFACES_STAGE, cache_key, file, logger) && surfaces->read(file)) {
+                result->publish(surfaces);
+                return true;
+            }
+        }
+        context.begin_stage("Extracting the feature surfaces");
+        if (!extract_feature_surfaces(runs, contour_features, *surfaces, context)) {
+            return false;
+        }
+        if (stage_cache.enabled()) {
+            ProjectFileWriter writer;
+            surfaces->write(writer);
+            stage_cache.store(FEATURE_SURFACES_STAGE, cache_key, writer, logger);
+        }
+        result->publish(surfaces);
+        return true;
+    }, [this]() { _state.redraw.request(RedrawScheduler::BackgroundJobs); });
+}
+
 void Selection_Menu::draw_selection_volume() {
     int window_width, window_height;
     glfwGetWindowSize(viewer->window, &window_width, &window_height);
@@ -103,6 +238,7 @@ void Selection_Menu::draw_selection_volume() {
     if (viewer->core.viewport != target_viewport_size) {
         selection_renderer.resize_framebuffer(
                     glm::ivec2(viewer->core.viewport[2], viewer->core.viewport[3]));
+        feature_mesh_renderer.resize_framebuffer(glm::ivec2(viewer->core.viewport[2], viewer->core.viewport[3]));
         target_viewport_size = G4f(viewer->core.viewport);
     }
 
@@ -112,8 +248,14 @@ void Selection_Menu::draw_selection_volume() {
 
         uint32_t* buffer_data = _state.segmented_features.buffer_data.data();
         size_t num_features =_state.segmented_features.buffer_data.size();
-        selection_renderer.set_contour_data(buffer_data, num_features);
+        selection_renderer.update_contour_data(buffer_data, num_features, _state.segmented_features.changed_begin,
+                                               _state.segmented_features.changed_end);
+        feature_picker.set_contour_data(buffer_data, num_features);
+        picking_direction = glm::vec3(0.f);
+        update_feature_histogram();
         number_features_is_dirty = false;
+        bounding_hull_dirty = true;
+        surfaces_dirty = true;
         _state.dirty_flags.mesh_dirty = true;
     }
 
@@ -121,20 +263,42 @@ void Selection_Menu::draw_selection_volume() {
         std::vector<uint32_t> selected = _state.segmented_features.selected_features;
         selected.insert(selected.begin(), static_cast<uint32_t>(selected.size()));
         selection_renderer.set_selection_data(selected.data(), selected.size());
+        feature_mesh_renderer.invalidate_picking();
         selection_list_is_dirty = false;
         _state.dirty_flags.mesh_dirty = true;
+        bounding_hull_dirty = true;
     }
 
+    if (tf_widget.transfer_function_dirty()) {
+        transfer_function = tf_widget.transfer_function();
+        transfer_function_dirty = true;
+        tf_widget.clear_dirty_bit();
+    }
     if (transfer_function_dirty) {
         selection_renderer.set_transfer_function(transfer_function);
+        feature_picker.set_transfer_function(transfer_function);
+        picking_direction = glm::vec3(0.f);
         transfer_function_dirty = false;
+        bounding_hull_dirty = true;
     }
 
-    rendering_params.sampling_rate = 1.0 / glm::length(glm::vec3(rendering_params.volume_dimensions));
+    const int hull_key = int(color_by_id) | (static_cast<int>(emphasize_by_selection) << 1) |
+                         (int(highlight_factor <= 0.f) << 3);
+    if (bounding_hull_dirty || hull_key != bounding_hull_key) {
+        update_bounding_hull();
+        bounding_hull_key = hull_key;
+        bounding_hull_dirty = false;
+    }
+    update_feature_surfaces();
+
+    rendering_params.sampling_rate = TransferFunctionTexture::STEP_SCALE / glm::length(glm::vec3(rendering_params.volume_dimensions));
     rendering_params.light_position = G3f(viewer->core.light_position);
     rendering_params.highlight_factor = highlight_factor;
     rendering_params.emphasize_by_selection = static_cast<int>(emphasize_by_selection);
     rendering_params.color_by_id = color_by_id;
+    rendering_params.footprint_scale = _state.ray_step_pixels;
+    // Render at a reduced quality while the camera is being dragged
+    rendering_params.interactive = viewer->down;
 
     const int maxDim = glm::compMax(rendering_params.volume_dimensions);
     const float md = static_cast<float>(maxDim);
@@ -148,19 +312,66 @@ void Selection_Menu::draw_selection_volume() {
     glm::mat4 model = GM4f(viewer->core.model) * scaling * translate;
     glm::mat4 view = GM4f(viewer->core.view);
     glm::mat4 proj = GM4f(viewer->core.proj);
-    selection_renderer.geometry_pass(model, view, proj);
-    selection_renderer.volume_pass(
-                rendering_params,
-                _state.low_res_volume.index_texture,
-                _state.low_res_volume.volume_texture);
 
     glm::ivec2 inv_mouse_coords { viewer->current_mouse_x, viewer->core.viewport[3] - viewer->current_mouse_y };
-    glm::vec3 picking = selection_renderer.picking_pass(
-                rendering_params,
-                inv_mouse_coords,
-                _state.low_res_volume.index_texture,
-                _state.low_res_volume.volume_texture);
-    current_selected_feature = static_cast<int>(picking.x);
+    if (mesh_rendering && !feature_mesh_renderer.empty()) {
+        // The feature under the mouse is read back from the same pass that draws the surfaces
+        const int level = std::min(surface_level + (rendering_params.interactive ? 1 : 0),
+                                   FeatureSurfaces::NUM_LEVELS - 1);
+        const std::vector<uint32_t>& buffer_data = _state.segmented_features.buffer_data;
+        feature_mesh_renderer.draw(model, view, proj, rendering_params, level,
+                                   selection_renderer.gl_state().volume_pass.selection_features_texture,
+                                   !_state.segmented_features.selected_features.empty(),
+                                   buffer_data.empty() ? 0 : buffer_data[0], G4f(viewer->core.background_color),
+                                   inv_mouse_coords);
+        current_selected_feature = feature_mesh_renderer.picked_feature();
+        if (feature_mesh_renderer.is_picking()) {
+            // The pick is read back asynchronously, draw another frame to pick up the result
+            _state.redraw.request(RedrawScheduler::VolumeView);
+        }
+    } else {
+        selection_renderer.geometry_pass(model, view, proj);
+        selection_renderer.volume_pass(
+                    rendering_params,
+                    _state.low_res_volume.index_texture,
+                    _state.low_res_volume.volume_texture);
+        if (selection_renderer.is_refining()) {
+            // The viewer only redraws on events, keep it drawing until the image converged
+            _state.redraw.request(RedrawScheduler::VolumeView);
+        }
+
+        if (cpu_picking) {
+            // Unproject the same pixel picking_pass would read into the [0, 1]^3 coordinates of the bounding box
+            const glm::vec2 viewport_size(viewer->core.viewport[2], viewer->core.viewport[3]);
+            const glm::vec2 ndc = (glm::vec2(inv_mouse_coords) + 0.5f) / viewport_size * 2.f - 1.f;
+            const glm::mat4 inverse_mvp = glm::inverse(proj * view * model);
+            const glm::vec4 near_point = inverse_mvp * glm::vec4(ndc, -1.f, 1.f);
+            const glm::vec4 far_point = inverse_mvp * glm::vec4(ndc, 1.f, 1.f);
+            const glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+            const glm::vec3 direction = glm::vec3(far_point) / far_point.w - origin;
+            if (origin != picking_origin || direction != picking_direction) {
+                feature_picker.request(origin, direction);
+                picking_origin = origin;
+                picking_direction = direction;
+            }
+            current_selected_feature = feature_picker.result();
+            if (feature_picker.is_picking()) {
+                // The ray is cast on the worker thread, draw another frame to pick up the result
+                _state.redraw.request(RedrawScheduler::VolumeView);
+            }
+        } else {
+            glm::vec3 picking = selection_renderer.picking_pass(
+                        rendering_params,
+                        inv_mouse_coords,
+                        _state.low_res_volume.index_texture,
+                        _state.low_res_volume.volume_texture);
+            current_selected_feature = static_cast<int>(picking.x);
+            if (selection_renderer.is_picking()) {
+                // The pick is read back asynchronously, draw another frame to pick up the result
+                _state.redraw.request(RedrawScheduler::VolumeView);
+            }
+        }
+    }
 
     if (should_select) {
         if (current_selected_feature != 0) {
@@ -195,6 +406,20 @@ void Selection_Menu::draw_selection_volume() {
     glViewport(0, 0, window_width, window_height);
 }
 
+void Selection_Menu::update_feature_histogram() {
+    // The arcs of any feature, from the map of the renderer (arc i + 1 holds the feature of arc i)
+    const IndexVoxelRuns& arc_runs = _state.segmented_features.arc_runs;
+    const std::vector<uint32_t>& buffer_data = _state.segmented_features.buffer_data;
+    std::vector<bool> in_feature(arc_runs.num_ids(), false);
+    for (size_t arc = 0; arc < arc_runs.num_ids() && arc + 1 < buffer_data.size(); arc++) {
+        in_feature[arc] = buffer_data[arc + 1] != static_cast<uint32_t>(-1);
+    }
+    index_histogram(arc_runs, _state.low_res_volume.volume_data.data(), in_feature, feature_histogram);
+    tf_widget.set_histograms(_state.low_res_volume.histogram, &feature_histogram,
+                             static_cast<uint8_t>(_state.low_res_volume.min_value),
+                             static_cast<uint8_t>(_state.low_res_volume.max_value));
+}
+
 bool Selection_Menu::key_down(int key, int modifiers) {
     if (key == 32) { // SPACE
         should_select = true;
@@ -243,6 +468,18 @@ bool Selection_Menu::post_draw() {
     ImGui::NewLine();
     ImGui::Separator();
 
+    if (ImGui::CollapsingHeader("Transfer Function", nullptr, ImGuiTreeNodeFlags(0))) {
+        tf_widget.post_draw(!show_error_popup /* active */);
+        // Fit the transfer function to the values of the features, which are drawn over those of the volume
+        if (ImGui::Button("Auto Transfer Function", ImVec2(-1, 0))) {
+            tf_widget.set_transfer_function(auto_transfer_function(
+                feature_histogram, static_cast<uint8_t>(_state.low_res_volume.min_value),
+                static_cast<uint8_t>(_state.low_res_volume.max_value)));
+        }
+        ImGui::NewLine();
+        ImGui::Separator();
+    }
+
     std::string list = std::accumulate(
         _state.segmented_features.selected_features.begin(),
         _state.segmented_features.selected_features.end(), std::string(),
@@ -251,6 +488,11 @@ bool Selection_Menu::post_draw() {
     list = list.substr(0, list.size() - 2);
 
     ImGui::Text("Selected features: %s", list.c_str());
+    const IndexStatistics selection = _state.segmented_features.selection_statistics();
+    if (!selection.empty()) {
+        const Eigen::RowVector3i extent = selection.max_corner - selection.min_corner;
+        ImGui::Text("Selected voxels: %zu in %d x %d x %d", selection.num_voxels, extent[0], extent[1], extent[2]);
+    }
     ImGui::PushItemWidth(-1);
     if (ImGui::Button("Clear Selected Features", ImVec2(-1, 0))) {
         _state.segmented_features.selected_features.clear();
@@ -273,6 +515,16 @@ bool Selection_Menu::post_draw() {
         }
         ImGui::PopItemWidth();
 
+        ImGui::Spacing();
+        ImGui::Text("Cleanup Radius (0 = off):");
+        ImGui::PushItemWidth(-1);
+        float cleanup_radius = (float)_state.dilated_tet_mesh.cleanup_radius;
+        if (ImGui::InputFloat("##cleanupradius", &cleanup_radius, 0.5, 1.0)) {
+            _state.dilated_tet_mesh.cleanup_radius = std::max((double)cleanup_radius, 0.0);
+            _state.dirty_flags.mesh_dirty = true;
+        }
+        ImGui::PopItemWidth();
+
         ImGui::Spacing();
         ImGui::Text("Meshing Voxel Width:");
         ImGui::PushItemWidth(-1);
@@ -281,6 +533,78 @@ bool Selection_Menu::post_draw() {
             _state.dirty_flags.mesh_dirty = true;
         }
         ImGui::PopItemWidth();
+
+        ImGui::Spacing();
+        ImGui::Text("Dilation Threads (0 = all cores):");
+        ImGui::PushItemWidth(-1);
+        int num_threads = _state.dilated_tet_mesh.dilation_num_threads;
+        if (ImGui::InputInt("##dilationthreads", &num_threads)) {
+            _state.dilated_tet_mesh.dilation_num_threads = std::max(num_threads, 0);
+        }
+        ImGui::PopItemWidth();
+
+        ImGui::Spacing();
+        ImGui::Checkbox("Quick Radius Changes", &_state.dilated_tet_mesh.radius_sweep);
+        ImGui::Checkbox("Pick Endpoints on a Coarse Mesh", &_state.dilated_tet_mesh.coarse_preview);
+        if (ImGui::Checkbox("Optimize the Tet Mesh", &_state.dilated_tet_mesh.optimize_mesh)) {
+            _state.dirty_flags.mesh_dirty = true;
+        }
+        if (_state.dilated_tet_mesh.optimize_mesh) {
+            ImGui::Text("Optimization Time Budget (s):");
+            ImGui::PushItemWidth(-1);
+            float optimize_seconds = float(_state.dilated_tet_mesh.optimize_seconds);
+            if (ImGui::InputFloat("##optimizeseconds", &optimize_seconds, 1.0f, 5.0f)) {
+                _state.dilated_tet_mesh.optimize_seconds = std::max(double(optimize_seconds), 0.0);
+                _state.dirty_flags.mesh_dirty = true;
+            }
+            ImGui::PopItemWidth();
+        }
+
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Adaptive Tet Mesh", &_state.dilated_tet_mesh.adaptive_meshing)) {
+            _state.dirty_flags.mesh_dirty = true;
+        }
+        if (_state.dilated_tet_mesh.adaptive_meshing) {
+            ImGui::Text("Largest Interior Cell (voxel widths):");
+            ImGui::PushItemWidth(-1);
+            int max_cell_size = _state.dilated_tet_mesh.adaptive_max_cell_size;
+            if (ImGui::InputInt("##maxcellsize", &max_cell_size)) {
+                _state.dilated_tet_mesh.adaptive_max_cell_size = std::max(max_cell_size, 1);
+                _state.dirty_flags.mesh_dirty = true;
+            }
+            ImGui::PopItemWidth();
+        }
+
+        ImGui::Spacing();
+        // Half precision render targets can show banding on large volumes
+        if (ImGui::Checkbox("Full Precision Rendering", &full_precision_rendering)) {
+            selection_renderer.set_half_precision(!full_precision_rendering);
+        }
+        ImGui::Text("Ray Step (pixels):");
+        ImGui::PushItemWidth(-1);
+        if (ImGui::SliderFloat("##raysteppixels", &_state.ray_step_pixels, 0.f, 4.f, "%.2f")) {
+            _state.ray_step_pixels = std::max(_state.ray_step_pixels, 0.f);
+        }
+        ImGui::PopItemWidth();
+        // The GPU picker ray casts the pixel under the mouse every time it moves
+        if (ImGui::Checkbox("Pick on the CPU", &cpu_picking)) {
+            picking_direction = glm::vec3(0.f);
+        }
+
+        ImGui::Spacing();
+        // Rasterizing the surfaces of the features is much cheaper than ray casting them
+        ImGui::Checkbox("Draw Feature Surfaces", &mesh_rendering);
+        if (mesh_rendering) {
+            ImGui::Text("Surface Coarseness:");
+            ImGui::PushItemWidth(-1);
+            ImGui::SliderInt("##surfacelevel", &surface_level, 0, FeatureSurfaces::NUM_LEVELS - 1);
+            ImGui::PopItemWidth();
+            if (surface_job.is_running()) {
+                ImGui::Text("Extracting the surfaces...");
+            } else if (!feature_mesh_renderer.empty()) {
+                ImGui::Text("%d triangles", int(feature_mesh_renderer.num_faces(surface_level)));
+            }
+        }
     }
     ImGui::NewLine();
     ImGui::Separator();
@@ -302,6 +626,8 @@ bool Selection_Menu::post_draw() {
     }
 
     ImGui::End();
+
+    meshing_menu.update_speculative_meshing();
     ImGui::Render();
     return ret;
 }
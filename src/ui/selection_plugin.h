@@ -2,9 +2,16 @@
 #define __FISH_DEFORMATION_SELECTION_MENU__
 
 #include "fish_ui_viewer_plugin.h"
+#include "transfer_function_edit_widget.h"
 
 #include <glm/glm.hpp>
 #include <glad/glad.h>
+#include <utils/background_job.h>
+#include <utils/feature_surfaces.h>
+#include <utils/result_handoff.h>
+#include <utils/gl/feature_mesh_renderer.h>
+#include <utils/gl/feature_picker.h>
+#include <utils/gl/occupancy_hull.h>
 #include <utils/gl/selection_renderer.h>
 
 struct State;
@@ -24,12 +31,43 @@ private:
     float view_hsplit = 0.2f;
 
     void draw_selection_volume();
+    // Rebuild the bounding geometry of selection_renderer around the bricks that can show anything
+    void update_bounding_hull();
+    // Take the surfaces of a finished job, and start one if mesh_rendering is on and the features changed
+    void update_feature_surfaces();
 
     State& _state;
 
     Parameters rendering_params;
     SelectionRenderer selection_renderer;
 
+    // Picks the hovered feature with a ray cast on the CPU instead of the picking pass of selection_renderer
+    FeaturePicker feature_picker;
+    bool cpu_picking = true;
+    // Ray of the last pick requested from feature_picker
+    glm::vec3 picking_origin = glm::vec3(0.f);
+    glm::vec3 picking_direction = glm::vec3(0.f);
+
+    // Rays of selection_renderer start and end at the hull of the visible bricks instead of the volume box
+    OccupancyHull bounding_hull;
+    bool bounding_hull_dirty = true;
+    // Coloring, emphasis and whether the highlight hides features the hull was last built for
+    int bounding_hull_key = -1;
+
+    // For GPUs too slow to ray cast the volume the surfaces of the features are drawn instead. They are extracted
+    // in the background, or read from the stage cache, whenever the segmentation changes while this is on, and
+    // the volume is ray cast until they are uploaded.
+    bool mesh_rendering = false;
+    FeatureMeshRenderer feature_mesh_renderer;
+    // Level of detail of the surfaces, one coarser is drawn while the camera moves
+    int surface_level = 0;
+    BackgroundJob surface_job;
+    std::shared_ptr<ResultHandoff<FeatureSurfaces>> surface_result;
+    // The segmentation changed since the key was last computed, and the key of the surfaces uploaded or being
+    // extracted (0 for none)
+    bool surfaces_dirty = true;
+    std::uint64_t surface_key = 0;
+
     glm::vec2 clicked_mouse_position = { 0.f, 0.f };
     bool is_currently_interacting = false;
     int current_interaction_index = -1;
@@ -39,8 +77,13 @@ private:
     bool transfer_function_dirty = true;
 
     std::vector<TfNode> transfer_function;
+    TransferFunctionEditWidget tf_widget;
+    // Values of the voxels that are part of a feature, shown over the histogram of the volume in tf_widget
+    VolumeHistogram feature_histogram;
+    void update_feature_histogram();
     int current_selected_feature = -1;
     bool color_by_id = true;
+    bool full_precision_rendering = false; // 32 bit float render targets instead of 16 bit ones
 
     // Keep in sync with volume_fragment_shader.h and Combobox code generation
     enum class Emphasis {
@@ -59,6 +102,8 @@ private:
     bool selection_list_is_dirty = true;
 
     glm::vec4 target_viewport_size = { -1.f, -1.f, -1.f, -1.f };
+    // State::volume_generation of the features in selection_renderer
+    std::uint64_t renderer_volume_generation = 0;
 };
 
 #endif // __FISH_DEFORMATION_SELECTION_MENU__
@@ -1,83 +1,218 @@
 #include "state.h"
 
+#include <utils/content_hash.h>
+#include <utils/fishvol.h>
+#include <utils/glm_conversion.h>
+#include <utils/memory_tracker.h>
+#include <utils/path_utils.h>
+#include <utils/project_file.h>
+#include <utils/task_scheduler.h>
+#include <utils/trace.h>
+#include <utils/gl/volume_resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 void State::SegmentedFeatures::recompute_feature_map() {
     selected_features.clear();
-    buffer_data.clear();
     features = topological_features.getFeatures(num_selected_features, 0.f);
 
     uint32_t size = topological_features.ctdata.noArcs;
-    buffer_data.resize(size + 1 + 1, static_cast<uint32_t>(-1));
-    buffer_data[0] = static_cast<uint32_t>(features.size());
+    next_buffer_data.assign(size + 1 + 1, static_cast<uint32_t>(-1));
+    next_buffer_data[0] = static_cast<uint32_t>(features.size());
     for (size_t i = 0; i < features.size(); ++i) {
         for (uint32_t j : features[i].arcs) {
             // +1 since the first value of the vector contains the number of features
-            buffer_data[j + 1] = static_cast<uint32_t>(i);
+            next_buffer_data[j + 1] = static_cast<uint32_t>(i);
         }
     }
+
+    recompute_feature_statistics();
+
+    if (buffer_data.size() != next_buffer_data.size()) {
+        buffer_data.swap(next_buffer_data);
+        changed_begin = 1;
+        changed_end = buffer_data.size();
+        return;
+    }
+    // A step of the number of features merges or splits a few features of the simplified contour tree, most arcs
+    // keep theirs. Only the arcs between the first and the last one that changed are copied and uploaded.
+    buffer_data[0] = next_buffer_data[0];
+    std::size_t begin = 1, end = buffer_data.size();
+    while (begin < end && buffer_data[begin] == next_buffer_data[begin]) {
+        begin++;
+    }
+    while (end > begin && buffer_data[end - 1] == next_buffer_data[end - 1]) {
+        end--;
+    }
+    std::copy(next_buffer_data.begin() + begin, next_buffer_data.begin() + end, buffer_data.begin() + begin);
+    changed_begin = begin;
+    changed_end = end;
 }
 
-void State::LoadedVolume::preprocess_volume_texture(std::vector<uint8_t>& byte_data) {
-    // Pre-load and normalize data for the low res volume GL texture
-    const Eigen::RowVector3i volume_dims = dims();
-    const int size = volume_dims[0]*volume_dims[1]*volume_dims[2];
-    byte_data.clear();
-    byte_data.resize(size);
-    const double min_value = min_value;
-    const double value_range = max_value - min_value;
-    const float* texture_data = volume_data.data();
-    std::transform(
-        texture_data,
-        texture_data + size,
-        byte_data.begin(),
-        [min_value, value_range](double d) {
-            return static_cast<uint8_t>(((d - min_value)/value_range) * std::numeric_limits<uint8_t>::max());
+void State::SegmentedFeatures::recompute_feature_statistics() {
+    feature_statistics.assign(features.size(), IndexStatistics());
+    for (size_t i = 0; i < features.size(); ++i) {
+        for (uint32_t arc : features[i].arcs) {
+            if (arc < arc_statistics.size()) {
+                feature_statistics[i].merge(arc_statistics[arc]);
+            }
         }
-    );
+    }
 }
 
+IndexStatistics State::SegmentedFeatures::selection_statistics() const {
+    IndexStatistics statistics;
+    for (uint32_t feature : selected_features) {
+        // The selected features are numbered from 1, 0 is the background
+        if (feature >= 1 && feature - 1 < feature_statistics.size()) {
+            statistics.merge(feature_statistics[feature - 1]);
+        }
+    }
+    return statistics;
+}
+
+void State::LoadedVolume::preprocess_volume_texture(std::vector<uint8_t>& byte_data) {
+    // Stretch the range of the low res volume to [0, 255] for the GL texture
+    quantize_volume(volume_data, static_cast<uint8_t>(min_value), static_cast<uint8_t>(max_value), byte_data);
+}
+
+
+namespace {
+
+// Bump this whenever preProcessing changes what it writes
+constexpr int TOPOLOGY_CACHE_VERSION = 1;
+
+// Voxels of a volume, the chunked file if the project has one
+std::string volume_data_path(const DatFile& metadata, const std::string& prefix_with_path) {
+    return is_fishvol_filename(metadata.m_raw_filename) ? metadata.m_directory + "/" + metadata.m_raw_filename :
+                                                          prefix_with_path + ".raw";
+}
+
+std::string read_text_file(const std::string& filename) {
+    std::ifstream is(filename);
+    return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+}
 
 void State::load_volume_data(State::LoadedVolume& volume, std::string prefix, bool load_topology) {
+    TRACE_SCOPE("load_volume_data");
     std::string prefix_with_path = input_metadata.output_dir + "/" + prefix;
 
     // Load the volume data
     volume.metadata = DatFile(prefix_with_path + ".dat", logger);
-    load_rawfile(prefix_with_path + ".raw", volume.dims(),
-                 volume.volume_data, logger, true /* normalize */);
-    volume.max_value = volume.volume_data.maxCoeff();
-    volume.min_value = volume.volume_data.minCoeff();
-
+    memory_tracker().check("Loading '" + prefix + "'",
+                           volume.num_voxels() * (sizeof(uint8_t) + (load_topology ? sizeof(uint32_t) : 0)), 0);
+    const std::string volume_path = volume_data_path(volume.metadata, prefix_with_path);
+    load_rawfile(volume_path, volume.dims(), volume.volume_data, logger, &volume.histogram);
+    volume.min_value = volume.histogram.min_value;
+    volume.max_value = volume.histogram.max_value;
+
+    volume.topology_loaded = false;
     if (load_topology) {
-        // Compute the topological features
-        Eigen::Vector3i lrv = volume.dims();
+        this->load_topology(volume, prefix);
+    }
+}
+
+void State::load_topology(State::LoadedVolume& volume, const std::string& prefix) {
+    TRACE_SCOPE("load_topology");
+    std::string prefix_with_path = input_metadata.output_dir + "/" + prefix;
+    const std::string volume_path = volume_data_path(volume.metadata, prefix_with_path);
+
+    // Computing the contour tree is by far the slowest part of opening a project, so its
+    // outputs are reused as long as the volume and its dimensions did not change
+    Eigen::Vector3i lrv = volume.dims();
+    const std::string topology_cache_path = prefix_with_path + ".topology";
+    std::string topology_key;
+    uint64_t volume_hash = 0;
+    volume.content_hash = 0;
+    if (hash_file(volume_path, volume_hash, logger)) {
+        volume.content_hash = volume_hash;
+        topology_key = fmt::format("version {}\nhash {:016x}\ndims {} {} {}\n",
+                                   TOPOLOGY_CACHE_VERSION, volume_hash, lrv[0], lrv[1], lrv[2]);
+    }
+    const bool have_index_volume = get_file_type((prefix_with_path + ".part.fishvol").c_str()) == FT_REGULAR_FILE ||
+            get_file_type((prefix_with_path + ".part.raw").c_str()) == FT_REGULAR_FILE;
+    if (!topology_key.empty() && have_index_volume && read_text_file(topology_cache_path) == topology_key) {
+        logger->info("Reusing the cached contour tree for '{}'", prefix_with_path);
+    } else {
+        TRACE_SCOPE("contour_tree");
+#ifdef _OPENMP
+        // preProcessing runs on OpenMP threads, which the task scheduler does not own, so keep them to the
+        // share of the lane of this thread
+        omp_set_num_threads(task_lane_threads(current_task_lane()));
+#endif
         preProcessing(prefix_with_path, lrv[0], lrv[1], lrv[2]);
-        segmented_features.topological_features.loadData(prefix_with_path);
-        segmented_features.recompute_feature_map();
+        if (!topology_key.empty()) {
+            std::ofstream(topology_cache_path) << topology_key;
+        }
+    }
+    segmented_features.topological_features.loadData(prefix_with_path);
+    segmented_features.recompute_feature_map();
+
+    // The index volume is mostly long runs of the same id so we keep it as a chunked, compressed
+    // file. preProcessing writes it as raw, so convert it the first time the project is opened.
+    const std::string index_raw_path = prefix_with_path + ".part.raw";
+    const std::string index_fishvol_path = prefix_with_path + ".part.fishvol";
+    if (get_file_type(index_raw_path.c_str()) == FT_REGULAR_FILE) {
+        if (convert_rawfile_to_fishvol(index_raw_path, index_fishvol_path, volume.dims(), sizeof(uint32_t), logger)) {
+            std::remove(index_raw_path.c_str());
+        }
+    }
 
-        // Load the low-res index data
-        const size_t num_bytes = volume.num_voxels() * sizeof(uint32_t);
-        std::ifstream file;
-        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        file.open(prefix_with_path + ".part.raw", std::ifstream::binary);
-        typedef decltype(volume.index_data) IndexType;
-        volume.index_data.resize(num_bytes / sizeof(IndexType::Scalar));
-        file.read(reinterpret_cast<char*>(volume.index_data.data()), num_bytes);
+    // Load the low-res index data
+    typedef decltype(volume.index_data) IndexType;
+    volume.index_data.resize(volume.num_voxels());
+    FishVolFile file;
+    if (file.open(index_fishvol_path, logger) && file.bytes_per_voxel() == sizeof(IndexType::Scalar)) {
+        file.read_region(0, Eigen::RowVector3i::Zero(), volume.dims(),
+                         reinterpret_cast<uint8_t*>(volume.index_data.data()), logger);
+    } else {
+        RawVolumeView raw_file;
+        if (raw_file.open(index_raw_path, volume.dims(), logger, sizeof(uint32_t))) {
+            std::memcpy(volume.index_data.data(), raw_file.data(), volume.num_voxels() * sizeof(uint32_t));
+        }
     }
+
+    TRACE_SCOPE("arc_voxel_runs");
+    build_index_voxel_runs(volume.index_data.data(), volume.dims(),
+                           segmented_features.topological_features.ctdata.noArcs, segmented_features.arc_runs);
+    compute_index_statistics(segmented_features.arc_runs, volume.volume_data.data(),
+                             segmented_features.arc_statistics);
+    segmented_features.recompute_feature_statistics();
+    volume.topology_loaded = true;
 }
 
 
 void State::LoadedVolume::load_gl_volume_texture(const std::vector<uint8_t>& byte_data) {
-    if (byte_data.size() == 0) {
-        return;
-    }
-    if (volume_texture != 0) {
-        glDeleteTextures(1, &volume_texture);
-    }
+    load_gl_volume_texture(byte_data.data(), byte_data.size());
+}
 
-    const Eigen::RowVector3i volume_dims = dims();
+void State::LoadedVolume::load_gl_volume_texture(const RawVolumeView& view) {
+    load_gl_volume_texture(view.data(), view.size());
+}
 
-    glGenTextures(1, &volume_texture);
-    glBindTexture(GL_TEXTURE_3D, volume_texture);
+namespace {
+
+void create_gl_volume_texture(GLuint& texture) {
+    if (texture != 0) {
+        glDeleteTextures(1, &texture);
+    }
+
+    glGenTextures(1, &texture);
+    // The name may be the one just deleted, anything derived from the previous volume is stale
+    VolumeResource::invalidate(texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
     GLfloat transparent_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
     glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, transparent_color);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -88,32 +223,122 @@ void State::LoadedVolume::load_gl_volume_texture(const std::vector<uint8_t>& byt
     //    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    const uint8_t* volume_data = byte_data.data();
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, volume_dims[0], volume_dims[1], volume_dims[2], 0,
-                 GL_RED, GL_UNSIGNED_BYTE, volume_data);
 }
 
-void State::LoadedVolume::load_gl_index_texture() {
-    if (index_data.size() == 0) {
-        return;
+void create_gl_index_texture(GLuint& texture) {
+    if (texture != 0) {
+        glDeleteTextures(1, &texture);
     }
-    if (index_texture != 0) {
-        glDeleteTextures(1, &index_texture);
-    }
-
-    const Eigen::RowVector3i volume_dims = dims();
 
-    glBindTexture(GL_TEXTURE_3D, index_texture);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
 
-    uint32_t* idata = index_data.data();
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32UI, volume_dims[0], volume_dims[1], volume_dims[2],
-                 0, GL_RED_INTEGER, GL_UNSIGNED_INT, idata);
+}
+
+void State::LoadedVolume::load_gl_volume_texture(const uint8_t* byte_data, size_t num_bytes) {
+    if (byte_data == nullptr || num_bytes == 0) {
+        return;
+    }
+    assert(num_bytes >= num_voxels());
+
+    const Eigen::RowVector3i volume_dims = dims();
+
+    create_gl_volume_texture(volume_texture);
+
+    // Rows of the raw file are tightly packed and not necessarily 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, volume_dims[0], volume_dims[1], volume_dims[2], 0,
+                 GL_RED, GL_UNSIGNED_BYTE, byte_data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // Zoomed out views sample the coarser levels, which alias less and fetch fewer texels
+    generate_volume_mipmaps(volume_texture);
+}
+
+void State::LoadedVolume::load_gl_index_texture(std::shared_ptr<spdlog::logger> logger) {
+    VolumeTextureUploader uploader;
+    if (begin_gl_index_upload(uploader, logger)) {
+        uploader.finish();
+    }
+}
+
+bool State::LoadedVolume::begin_gl_volume_upload(VolumeTextureUploader& uploader, std::vector<uint8_t>&& byte_data,
+                                                 std::shared_ptr<spdlog::logger> logger) {
+    if (byte_data.size() < num_voxels()) {
+        logger->error("Volume data has {} bytes but the volume has {} voxels", byte_data.size(), num_voxels());
+        return false;
+    }
+    create_gl_volume_texture(volume_texture);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return uploader.begin(volume_texture, G3i(dims()), GL_R8, GL_RED, GL_UNSIGNED_BYTE, sizeof(uint8_t),
+                          std::move(byte_data), logger, VolumeTextureUploader::DEFAULT_BYTES_PER_STEP, true);
+}
+
+bool State::LoadedVolume::begin_gl_index_upload(VolumeTextureUploader& uploader, std::shared_ptr<spdlog::logger> logger) {
+    if (index_data.size() == 0) {
+        return true;
+    }
+    create_gl_index_texture(index_texture);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    // Most contour trees have far fewer than 65536 arcs. In that case the ids are stored in 16 bits
+    // which halves the memory and bandwidth of the index texture the selection shaders sample every step.
+    if (index_data.maxCoeff() <= std::numeric_limits<uint16_t>::max()) {
+        index_texture_bytes_per_voxel = sizeof(uint16_t);
+        std::vector<uint8_t> packed(index_data.size() * sizeof(uint16_t));
+        uint16_t* packed_ids = reinterpret_cast<uint16_t*>(packed.data());
+        for (Eigen::Index i = 0; i < index_data.size(); i++) {
+            packed_ids[i] = static_cast<uint16_t>(index_data[i]);
+        }
+        return uploader.begin(index_texture, G3i(dims()), GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, sizeof(uint16_t),
+                              std::move(packed), logger);
+    }
+
+    index_texture_bytes_per_voxel = sizeof(uint32_t);
+    return uploader.begin(index_texture, G3i(dims()), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, sizeof(uint32_t),
+                          reinterpret_cast<const uint8_t*>(index_data.data()), logger);
+}
+
+void State::report_memory_usage() const {
+    const std::pair<const char*, const LoadedVolume*> volumes[] = {
+        { "Low resolution volume", &low_res_volume },
+        { "Full resolution volume", &hi_res_volume },
+    };
+    for (const auto& volume : volumes) {
+        const LoadedVolume& v = *volume.second;
+        const std::size_t host_bytes = v.volume_data.size_in_bytes() + v.index_data.size() * sizeof(VectorXui::Scalar);
+        std::size_t device_bytes = 0;
+        if (v.volume_texture != 0) {
+            // The mip chain adds another 1/8 + 1/64 + ... of the voxels
+            device_bytes += v.num_voxels() * sizeof(uint8_t) * 8 / 7;
+        }
+        if (v.index_texture != 0) {
+            device_bytes += v.num_voxels() * v.index_texture_bytes_per_voxel;
+        }
+        memory_tracker().set(volume.first, host_bytes, device_bytes);
+    }
+
+    std::size_t feature_bytes = segmented_features.buffer_data.size() * sizeof(uint32_t) +
+            segmented_features.next_buffer_data.capacity() * sizeof(uint32_t) +
+            segmented_features.selected_features.size() * sizeof(uint32_t) +
+            segmented_features.arc_runs.num_bytes() +
+            (segmented_features.arc_statistics.size() + segmented_features.feature_statistics.size()) *
+            sizeof(IndexStatistics);
+    for (const contourtree::Feature& feature : segmented_features.features) {
+        feature_bytes += sizeof(feature) + feature.arcs.size() * sizeof(uint32_t);
+    }
+    memory_tracker().set("Segmentation", feature_bytes, 0);
+
+    const DilatedTetMesh& mesh = dilated_tet_mesh;
+    memory_tracker().set("Dilated tet mesh",
+                         mesh.TV.size() * sizeof(double) + (mesh.TT.size() + mesh.TF.size()) * sizeof(int) +
+                         mesh.connected_components.size() * sizeof(int) + mesh.geodesic_dists.size() * sizeof(double) +
+                         mesh.dilated_dexels.size(), 0);
 }
 
 void State::serialize(std::vector<char> &buffer) const {
@@ -194,3 +419,147 @@ void State::deserialize(const std::vector<char> &buffer) {
     // state.low_res_texture.load_gl_*()
     // and the same for the hi-res texture
 }
+
+bool State::save_project(const std::string& filename) const {
+    ProjectFileWriter writer;
+
+    writer.add_string("image_input.input_dir", input_metadata.input_dir);
+    writer.add_string("image_input.output_dir", input_metadata.output_dir);
+    writer.add_string("image_input.file_extension", input_metadata.file_extension);
+    writer.add_string("image_input.prefix", input_metadata.prefix);
+    writer.add_value("image_input.downsample_factor", std::int32_t(input_metadata.downsample_factor));
+    writer.add_value("image_input.start_index", std::int32_t(input_metadata.start_index));
+    writer.add_value("image_input.end_index", std::int32_t(input_metadata.end_index));
+    writer.add_string("image_input.project_name", input_metadata.project_name);
+
+    writer.add_matrix("dilated_tet_mesh.TV", dilated_tet_mesh.TV);
+    writer.add_matrix("dilated_tet_mesh.TT", dilated_tet_mesh.TT);
+    writer.add_matrix("dilated_tet_mesh.TF", dilated_tet_mesh.TF);
+    writer.add_matrix("dilated_tet_mesh.connected_components", dilated_tet_mesh.connected_components);
+    writer.add_value("dilated_tet_mesh.dilation_radius", dilated_tet_mesh.dilation_radius);
+    writer.add_value("dilated_tet_mesh.meshing_voxel_radius", dilated_tet_mesh.meshing_voxel_radius);
+    writer.add_value("dilated_tet_mesh.cleanup_radius", dilated_tet_mesh.cleanup_radius);
+    writer.add_value("dilated_tet_mesh.adaptive_meshing", dilated_tet_mesh.adaptive_meshing);
+    writer.add_value("dilated_tet_mesh.adaptive_max_cell_size", std::int32_t(dilated_tet_mesh.adaptive_max_cell_size));
+    writer.add_matrix("dilated_tet_mesh.geodesic_dists", dilated_tet_mesh.geodesic_dists);
+    writer.add_vector("dilated_tet_mesh.dilated_dexels", dilated_tet_mesh.dilated_dexels);
+    writer.add_value("dilated_tet_mesh.dilated_dexels_key", std::int64_t(dilated_tet_mesh.dilated_dexels_key));
+
+    writer.add_value("skeleton_estimation_parameters.num_subdivisions", std::int32_t(skeleton_estimation_parameters.num_subdivisions));
+    writer.add_value("skeleton_estimation_parameters.num_smoothing_iters", std::int32_t(skeleton_estimation_parameters.num_smoothing_iters));
+    writer.add_value("skeleton_estimation_parameters.cage_bbox_radius", skeleton_estimation_parameters.cage_bbox_radius);
+    writer.add_value("skeleton_estimation_parameters.heat_geodesics", skeleton_estimation_parameters.heat_geodesics);
+    writer.add_value("skeleton_estimation_parameters.voxel_skeleton", skeleton_estimation_parameters.voxel_skeleton);
+    const std::vector<std::pair<int, int>>& endpoint_pairs = skeleton_estimation_parameters.endpoint_pairs;
+    Eigen::MatrixXi endpoint_pairs_matrix(2, endpoint_pairs.size());
+    for (size_t i = 0; i < endpoint_pairs.size(); i++) {
+        endpoint_pairs_matrix.col(i) = Eigen::Vector2i(endpoint_pairs[i].first, endpoint_pairs[i].second);
+    }
+    writer.add_owned_matrix("skeleton_estimation_parameters.endpoint_pairs", std::move(endpoint_pairs_matrix));
+
+    writer.add_vector("segmented_features.selected_features", segmented_features.selected_features);
+    writer.add_value("segmented_features.num_selected_features", std::int32_t(segmented_features.num_selected_features));
+
+    writer.add_value("dirty_flags.file_loading_dirty", dirty_flags.file_loading_dirty);
+    writer.add_value("dirty_flags.mesh_dirty", dirty_flags.mesh_dirty);
+    writer.add_value("dirty_flags.endpoints_dirty", dirty_flags.endpoints_dirty);
+    writer.add_value("dirty_flags.bounding_cage_dirty", dirty_flags.bounding_cage_dirty);
+
+    cage.write_sections(writer, "cage.");
+
+    return writer.write(filename, logger);
+}
+
+bool State::load_project(const std::string& filename, bool load_tet_mesh) {
+    dilated_tet_mesh.skeleton_cache.clear();
+    if (!ProjectFile::is_project_file(filename)) {
+        logger->info("'{}' is not a binary project file, loading it as a legacy project", filename);
+        return igl::deserialize(*this, "state", filename);
+    }
+
+    ProjectFile file;
+    if (!file.open(filename, logger)) {
+        return false;
+    }
+
+    bool ok = true;
+    ok = ok && file.read_string("image_input.input_dir", input_metadata.input_dir);
+    ok = ok && file.read_string("image_input.output_dir", input_metadata.output_dir);
+    ok = ok && file.read_string("image_input.file_extension", input_metadata.file_extension);
+    ok = ok && file.read_string("image_input.prefix", input_metadata.prefix);
+    ok = ok && file.read_value("image_input.downsample_factor", input_metadata.downsample_factor);
+    ok = ok && file.read_value("image_input.start_index", input_metadata.start_index);
+    ok = ok && file.read_value("image_input.end_index", input_metadata.end_index);
+    ok = ok && file.read_string("image_input.project_name", input_metadata.project_name);
+
+    if (load_tet_mesh) {
+        ok = ok && file.read_matrix("dilated_tet_mesh.TV", dilated_tet_mesh.TV);
+        ok = ok && file.read_matrix("dilated_tet_mesh.TT", dilated_tet_mesh.TT);
+        ok = ok && file.read_matrix("dilated_tet_mesh.TF", dilated_tet_mesh.TF);
+        ok = ok && file.read_matrix("dilated_tet_mesh.connected_components", dilated_tet_mesh.connected_components);
+        ok = ok && file.read_matrix("dilated_tet_mesh.geodesic_dists", dilated_tet_mesh.geodesic_dists);
+    }
+    ok = ok && file.read_value("dilated_tet_mesh.dilation_radius", dilated_tet_mesh.dilation_radius);
+    ok = ok && file.read_value("dilated_tet_mesh.meshing_voxel_radius", dilated_tet_mesh.meshing_voxel_radius);
+    // Projects saved before the cleanup stage mesh the selection as is
+    if (file.has_section("dilated_tet_mesh.cleanup_radius")) {
+        ok = ok && file.read_value("dilated_tet_mesh.cleanup_radius", dilated_tet_mesh.cleanup_radius);
+    }
+    // Projects saved before adaptive meshing use the uniform lattice
+    if (file.has_section("dilated_tet_mesh.adaptive_meshing")) {
+        ok = ok && file.read_value("dilated_tet_mesh.adaptive_meshing", dilated_tet_mesh.adaptive_meshing);
+        ok = ok && file.read_value("dilated_tet_mesh.adaptive_max_cell_size", dilated_tet_mesh.adaptive_max_cell_size);
+    }
+    // Projects saved before the dilated volume was kept dilate again when they are meshed
+    if (file.has_section("dilated_tet_mesh.dilated_dexels")) {
+        std::int64_t key = 0;
+        ok = ok && file.read_vector("dilated_tet_mesh.dilated_dexels", dilated_tet_mesh.dilated_dexels);
+        ok = ok && file.read_value("dilated_tet_mesh.dilated_dexels_key", key);
+        dilated_tet_mesh.dilated_dexels_key = std::uint64_t(key);
+    }
+
+    ok = ok && file.read_value("skeleton_estimation_parameters.num_subdivisions", skeleton_estimation_parameters.num_subdivisions);
+    ok = ok && file.read_value("skeleton_estimation_parameters.num_smoothing_iters", skeleton_estimation_parameters.num_smoothing_iters);
+    ok = ok && file.read_value("skeleton_estimation_parameters.cage_bbox_radius", skeleton_estimation_parameters.cage_bbox_radius);
+    // Projects saved before the heat method use the harmonic geodesics
+    if (file.has_section("skeleton_estimation_parameters.heat_geodesics")) {
+        ok = ok && file.read_value("skeleton_estimation_parameters.heat_geodesics", skeleton_estimation_parameters.heat_geodesics);
+    }
+    if (file.has_section("skeleton_estimation_parameters.voxel_skeleton")) {
+        ok = ok && file.read_value("skeleton_estimation_parameters.voxel_skeleton", skeleton_estimation_parameters.voxel_skeleton);
+    }
+    Eigen::MatrixXi endpoint_pairs_matrix;
+    ok = ok && file.read_matrix("skeleton_estimation_parameters.endpoint_pairs", endpoint_pairs_matrix);
+    if (ok && endpoint_pairs_matrix.size() > 0 && endpoint_pairs_matrix.rows() != 2) {
+        logger->error("Project file has malformed endpoint pairs");
+        ok = false;
+    }
+    if (ok) {
+        skeleton_estimation_parameters.endpoint_pairs.clear();
+        for (int i = 0; i < endpoint_pairs_matrix.cols(); i++) {
+            skeleton_estimation_parameters.endpoint_pairs.push_back(std::make_pair(endpoint_pairs_matrix(0, i), endpoint_pairs_matrix(1, i)));
+        }
+    }
+
+    ok = ok && file.read_value("segmented_features.num_selected_features", segmented_features.num_selected_features);
+    ok = ok && file.read_vector("segmented_features.selected_features", segmented_features.selected_features);
+
+    ok = ok && file.read_value("dirty_flags.file_loading_dirty", dirty_flags.file_loading_dirty);
+    ok = ok && file.read_value("dirty_flags.mesh_dirty", dirty_flags.mesh_dirty);
+    ok = ok && file.read_value("dirty_flags.endpoints_dirty", dirty_flags.endpoints_dirty);
+    ok = ok && file.read_value("dirty_flags.bounding_cage_dirty", dirty_flags.bounding_cage_dirty);
+
+    ok = ok && cage.read_sections(file, "cage.");
+
+    if (!ok) {
+        logger->error("Failed to load project file '{}'", filename);
+        return false;
+    }
+    if (!load_tet_mesh) {
+        dilated_tet_mesh.clear();
+        dirty_flags.mesh_dirty = true;
+    }
+
+    // NOTE: As with deserialize, the GL textures still need to be loaded after this
+    return true;
+}
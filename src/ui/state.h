@@ -5,8 +5,15 @@
 #include <utils/bounding_cage.h>
 #include <utils/utils.h>
 #include <utils/datfile.h>
+#include <utils/dexel_meshing.h>
+#include <utils/raw_volume_view.h>
+#include <utils/redraw_scheduler.h>
+#include <utils/skeleton_extraction.h>
+#include <utils/gl/volume_brick_cache.h>
+#include <utils/gl/volume_texture_uploader.h>
 
 #include <array>
+#include <cstdint>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <vector>
@@ -32,6 +39,12 @@ enum class Application_State {
     NoState,
 };
 
+// Whether the screen reads the contour tree, the features and the index volume of the low res volume, which a
+// project opened at the bounding cage only loads once such a screen is shown
+inline bool screen_needs_topology(Application_State screen) {
+    return screen == Application_State::Segmentation || screen == Application_State::Meshing;
+}
+
 struct State {
     static constexpr bool Debugging = false;
 
@@ -44,11 +57,30 @@ struct State {
         bool bounding_cage_dirty = true;
     } dirty_flags;
 
+    // Increased whenever a scan or project is loaded. The screens keep their GL resources while they are not shown
+    // and rebuild what they derived from the volume when this changed since they last saw it.
+    std::uint64_t volume_generation = 0;
+
+    // Ray casting step of both 3d views in pixels, where a pixel is wider than a voxel. Lower is slower and sharper
+    // far from the camera, 0 always steps a voxel at a time.
+    float ray_step_pixels = 1.f;
+
     Application_State application_state = Application_State::Initial_File_Selection;
 
+    // Wakes up the viewer whenever something has to be drawn, see RedrawScheduler
+    RedrawScheduler redraw;
+
+    // Screen to show once the file selection screen has loaded the topology left out so far, NoState if none
+    Application_State topology_next_state = Application_State::NoState;
+
     void set_application_state(Application_State new_state) {
+        if (screen_needs_topology(new_state) && !low_res_volume.topology_loaded && !dirty_flags.file_loading_dirty) {
+            // The loading screen brings in the topology and moves on to the screen
+            topology_next_state = new_state;
+            new_state = Application_State::Initial_File_Selection;
+        }
         application_state = new_state;
-        glfwPostEmptyEvent();
+        redraw.request(RedrawScheduler::ImGui);
     }
 
     std::shared_ptr<spdlog::logger> logger;
@@ -56,13 +88,28 @@ struct State {
     struct LoadedVolume {
         DatFile metadata;
         VectorXui index_data;
-        Eigen::VectorXf volume_data;
+
+        // Voxels are kept in the native format of the scan. Use volume_data.normalized() for values in [0, 1]
+        VolumeBuffer<uint8_t> volume_data;
 
         GLuint volume_texture = 0;
         GLuint index_texture = 0;
+        // Bytes per voxel of the format of index_texture, see begin_gl_index_upload()
+        std::size_t index_texture_bytes_per_voxel = 0;
+
+        // Histogram of the voxel values, computed while loading
+        VolumeHistogram histogram;
 
-        double min_value;
-        double max_value;
+        // Range of the voxel values in native units
+        double min_value = 0.0;
+        double max_value = 0.0;
+
+        // Whether the contour tree, the features, index_data and index_texture belong to this volume
+        bool topology_loaded = false;
+
+        // Hash of the voxels the contour tree was computed from, 0 if they were not hashed. Results derived from
+        // the segmentation which are cached across runs are keyed by it.
+        std::uint64_t content_hash = 0;
 
         const Eigen::RowVector3i dims() const {
             return Eigen::RowVector3i(metadata.w, metadata.h, metadata.d);
@@ -74,13 +121,24 @@ struct State {
 
         void preprocess_volume_texture(std::vector<uint8_t>& byte_data);
         void load_gl_volume_texture(const std::vector<uint8_t> &byte_data);
-        void load_gl_index_texture();
+        void load_gl_volume_texture(const RawVolumeView& view);
+        void load_gl_volume_texture(const uint8_t* byte_data, size_t num_bytes);
+        void load_gl_index_texture(std::shared_ptr<spdlog::logger> logger);
+
+        // Create the textures and start streaming the data into them without blocking the render thread.
+        // Call uploader.step() once per frame until uploader.is_done().
+        bool begin_gl_volume_upload(VolumeTextureUploader& uploader, std::vector<uint8_t>&& byte_data,
+                                    std::shared_ptr<spdlog::logger> logger);
+        bool begin_gl_index_upload(VolumeTextureUploader& uploader, std::shared_ptr<spdlog::logger> logger);
     };
 
     // Initial volume data loaded in the first screen
     LoadedVolume low_res_volume;
     LoadedVolume hi_res_volume;
 
+    // The full resolution scan is too big to upload as one texture, only the bricks inside the cage are resident
+    VolumeBrickCache hi_res_bricks;
+
     // Topological features
     struct SegmentedFeatures {
         std::vector<uint32_t> buffer_data;
@@ -90,7 +148,23 @@ struct State {
         std::vector<uint32_t> selected_features;
         int num_selected_features = 5;
 
+        // Rebuilds buffer_data for num_selected_features. Only the arcs whose feature changed are written, they lie
+        // in [changed_begin, changed_end) of buffer_data, an empty range if none did
         void recompute_feature_map();
+        std::size_t changed_begin = 0;
+        std::size_t changed_end = 0;
+        // The map of the new number of features is built here and compared with buffer_data
+        std::vector<uint32_t> next_buffer_data;
+
+        // The voxels of every arc of the low resolution index volume, the selected volume is gathered from them
+        IndexVoxelRuns arc_runs;
+        // Extent and values of the voxels of every arc, and of every feature of features
+        std::vector<IndexStatistics> arc_statistics;
+        std::vector<IndexStatistics> feature_statistics;
+        // Merges the arc statistics of every feature, recompute_feature_map calls it
+        void recompute_feature_statistics();
+        // The merged statistics of selected_features
+        IndexStatistics selection_statistics() const;
 
     } segmented_features;
 
@@ -105,6 +179,9 @@ struct State {
         int start_index;
         int end_index;
 
+        // Number of digits the slice indices are zero padded to, 0 if they are not padded
+        int index_width = 0;
+
         std::string full_res_prefix() {
             std::string str = prefix + std::string("-") + std::to_string(start_index) + std::string("-") + std::to_string(end_index);
             return str;
@@ -133,17 +210,50 @@ struct State {
         Eigen::VectorXi connected_components;
 
         double dilation_radius = 3.0;
+        // Radius of the closing then opening that cleans up the selected volume before the dilation, filling
+        // thin gaps and removing thin bridges and small specks of the segmentation. 0 skips the cleanup.
+        double cleanup_radius = 0.0;
         double meshing_voxel_radius = 1.5;
+        // Mesh the inside with cells growing up to adaptive_max_cell_size times meshing_voxel_radius
+        // away from the surface instead of running Quartet on the uniform lattice
+        bool adaptive_meshing = false;
+        int adaptive_max_cell_size = 8;
+        // Threads of the dilation sweeps, 0 uses every core. Not stored in the project.
+        int dilation_num_threads = 0;
+        // Keep the distance to the selected volume between runs, so that meshing the same selection with another
+        // dilation radius only thresholds it instead of dilating again. Costs a float per voxel around the
+        // selection. Not stored in the project.
+        bool radius_sweep = false;
+        // Hand a coarser tet mesh to the endpoint selection first and swap in the one at meshing_voxel_radius
+        // once it is done. Not stored in the project.
+        bool coarse_preview = false;
+        // Smooth the tet mesh for up to optimize_seconds once it is made, which removes most of the slivers that
+        // slow the geodesic solves down. The endpoint selection starts on the mesh as it was made and the smoothed
+        // one is swapped in like the fine mesh of the coarse preview. Not stored in the project.
+        bool optimize_mesh = false;
+        double optimize_seconds = 10.0;
+
+        // The dilated volume the mesh was made from, in the form of vor3d::CompressedVolume::saveCompact, and the
+        // hash of the selection, cleanup and dilation radius it belongs to. Meshing them again, e.g. with another
+        // meshing_voxel_radius, starts from it instead of exporting and dilating the selection. Kept by clear().
+        std::vector<std::uint8_t> dilated_dexels;
+        std::uint64_t dilated_dexels_key = 0;
 
         // Geodesic distances stored at each tet vertex
         Eigen::VectorXd geodesic_dists;
 
+        // Stages of the last skeleton extractions (the factored geodesic operators of the component the
+        // endpoints were picked in, the recent geodesic fields and the skeleton), reused while the endpoints and
+        // the skeleton parameters change. Not stored in the project, cleared whenever TV or TT change.
+        SkeletonExtractionCache skeleton_cache;
+
         void clear() {
             TV.resize(0, 0);
             TF.resize(0, 0);
             TT.resize(0, 0);
             connected_components.resize(0);
             geodesic_dists.resize(0);
+            skeleton_cache.clear();
         }
     } dilated_tet_mesh;
 
@@ -156,18 +266,42 @@ struct State {
 
         double cage_bbox_radius = 7.5;
 
+        // Slice the skeleton along heat method geodesics (see HeatGeodesicSolver) instead of the harmonic
+        // approximation
+        bool heat_geodesics = false;
+
+        // Trace the skeleton along the medial axis of the dilated dexels (see dexel_skeleton) instead of slicing
+        // the tet mesh along geodesics. Much faster on large meshes, the endpoints are still picked on the mesh.
+        bool voxel_skeleton = false;
+
         // Selected pairs of endpoints
         std::vector<std::pair<int, int>> endpoint_pairs;
     } skeleton_estimation_parameters;
 
 
 
+    // Loads the volume of prefix. With load_topology the contour tree of the volume is computed by preProcessing, or
+    // reused from the .topology cache, and its features and index volume are loaded as well. preProcessing builds
+    // the tree of the whole grid in memory, so the topology is only computed for the low resolution volume and
+    // the downsample factor bounds how thin a feature can be and still be segmented.
     void load_volume_data(LoadedVolume& volume, std::string prefix, bool load_topology);
+    // The topology part of load_volume_data, for a volume loaded without it
+    void load_topology(LoadedVolume& volume, const std::string& prefix);
+
+    // Report the volumes, the segmentation and the tet mesh to memory_tracker(). The skeleton cache is left out,
+    // the size of its factorizations is not known.
+    void report_memory_usage() const;
 
     BoundingCage cage;
 
     void serialize(std::vector<char>& buffer) const;
     void deserialize(const std::vector<char>& buffer);
+
+    // Save/load a binary project file (see utils/project_file.h). load_project also accepts
+    // legacy projects written by igl::serialize. If load_tet_mesh is false the dilated tet mesh
+    // is not read, which is most of the file for large projects.
+    bool save_project(const std::string& filename) const;
+    bool load_project(const std::string& filename, bool load_tet_mesh = true);
 };
 
 namespace igl {
@@ -3,6 +3,71 @@
 #include <imgui/imgui_internal.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Lowest value below which at least fraction of the voxels of histogram lie
+int histogram_percentile(const VolumeHistogram& histogram, std::uint64_t total, double fraction) {
+    const double target = fraction * double(total);
+    std::uint64_t count = 0;
+    for (int v = 0; v < 256; v++) {
+        count += histogram.bins[v];
+        if (double(count) >= target) {
+            return v;
+        }
+    }
+    return 255;
+}
+
+void draw_histogram(ImDrawList* draw_list, const VolumeHistogram& histogram, std::uint8_t min_value,
+                    std::uint8_t max_value, const ImVec2& pos, const ImVec2& size, ImU32 color) {
+    const std::uint64_t max_count = *std::max_element(histogram.bins.begin(), histogram.bins.end());
+    if (max_count == 0) {
+        return;
+    }
+    // Logarithmic, so that the few voxels of the brighter values still show next to the background
+    const float log_max_count = std::log1p(float(max_count));
+    const float value_range = std::max(float(max_value) - float(min_value), 1.f);
+    for (int v = 0; v < 256; v++) {
+        if (histogram.bins[v] == 0) {
+            continue;
+        }
+        const float t0 = std::min(std::max((v - float(min_value)) / value_range, 0.f), 1.f);
+        const float t1 = std::min(std::max((v + 1 - float(min_value)) / value_range, 0.f), 1.f);
+        const float height = size.y * std::log1p(float(histogram.bins[v])) / log_max_count;
+        const float x0 = pos.x + size.x * t0;
+        // At least a pixel wide, also for the values outside of the stretched range that pile up at its ends
+        const float x1 = std::max(pos.x + size.x * t1, x0 + 1.f);
+        draw_list->AddRectFilled(ImVec2(x0, pos.y + size.y - height), ImVec2(x1, pos.y + size.y), color);
+    }
+}
+
+} // namespace
+
+std::vector<TfNode> auto_transfer_function(const VolumeHistogram& histogram, std::uint8_t min_value,
+                                           std::uint8_t max_value) {
+    std::uint64_t total = 0;
+    for (std::uint64_t count : histogram.bins) {
+        total += count;
+    }
+    std::vector<TfNode> transfer_function;
+    transfer_function.push_back({ 0.f, glm::vec4(0.f) });
+    if (total > 0) {
+        const float value_range = std::max(float(max_value) - float(min_value), 1.f);
+        auto stretch = [&](int v) { return std::min(std::max((v - float(min_value)) / value_range, 0.f), 1.f); };
+        const float step = 1.f / 255.f;
+        const float t_low = std::min(stretch(histogram_percentile(histogram, total, 0.02)), 1.f - 2.f * step);
+        const float t_high = std::min(std::max(stretch(histogram_percentile(histogram, total, 0.5)), t_low + step),
+                                      1.f - step);
+        if (t_low > 0.f) {
+            transfer_function.push_back({ t_low, glm::vec4(glm::vec3(t_low), 0.f) });
+        }
+        transfer_function.push_back({ t_high, glm::vec4(glm::vec3(t_high), 1.f) });
+    }
+    transfer_function.push_back({ 1.f, glm::vec4(1.f) });
+    return transfer_function;
+}
 
 TransferFunctionEditWidget::TransferFunctionEditWidget() {
     TfNode n1 = {0.0, glm::vec4(0.0)};
@@ -11,6 +76,26 @@ TransferFunctionEditWidget::TransferFunctionEditWidget() {
     _transfer_function.push_back(n2);
 }
 
+void TransferFunctionEditWidget::set_transfer_function(const std::vector<TfNode>& transfer_function) {
+    _transfer_function = transfer_function;
+    _current_interaction_index = -1;
+    _is_currently_interacting = false;
+    _transfer_function_dirty = true;
+}
+
+void TransferFunctionEditWidget::set_histograms(const VolumeHistogram& histogram,
+                                                const VolumeHistogram* highlight_histogram,
+                                                std::uint8_t min_value, std::uint8_t max_value) {
+    _histogram = histogram;
+    _has_histogram = true;
+    _has_highlight_histogram = highlight_histogram != nullptr;
+    if (highlight_histogram) {
+        _highlight_histogram = *highlight_histogram;
+    }
+    _histogram_min_value = min_value;
+    _histogram_max_value = max_value;
+}
+
 bool TransferFunctionEditWidget::post_draw(bool active) {
     constexpr float click_scale = 2.5f;
 
@@ -38,6 +123,14 @@ bool TransferFunctionEditWidget::post_draw(bool active) {
                 ImVec2(canvas_pos.x, canvas_pos.y),
                 ImVec2(canvas_pos.x + canvas_size.x, canvas_pos.y + canvas_size.y),
         IM_COL32(255, 255, 255, 255));
+    if (_has_histogram) {
+        draw_histogram(draw_list, _histogram, _histogram_min_value, _histogram_max_value, canvas_pos, canvas_size,
+                       IM_COL32(100, 100, 110, 255));
+    }
+    if (_has_highlight_histogram) {
+        draw_histogram(draw_list, _highlight_histogram, _histogram_min_value, _histogram_max_value, canvas_pos,
+                       canvas_size, IM_COL32(200, 140, 60, 160));
+    }
 
     ImGui::SetCursorScreenPos(canvas_scale_pos);
     ImGui::InvisibleButton("canvas", canvas_capture_size);
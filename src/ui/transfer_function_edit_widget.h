@@ -4,6 +4,14 @@
 #include <vector>
 #include <glm/glm.hpp>
 #include <utils/gl/volume_renderer.h>
+#include <utils/volume_buffer.h>
+
+// A transfer function that is transparent below the darkest few percent of the voxels of histogram and ramps up
+// to opaque at their median, so that the voxels it was counted over (e.g. those of the features) show and a
+// darker background does not. Its t is in [0, 1] over [min_value, max_value] of the volume, like the values of
+// the volume texture.
+std::vector<TfNode> auto_transfer_function(const VolumeHistogram& histogram, std::uint8_t min_value,
+                                           std::uint8_t max_value);
 
 class TransferFunctionEditWidget
 {
@@ -23,6 +31,14 @@ class TransferFunctionEditWidget
 
     float _node_radius = 10.0f;
 
+    // Drawn behind the nodes, see set_histograms
+    VolumeHistogram _histogram;
+    VolumeHistogram _highlight_histogram;
+    bool _has_histogram = false;
+    bool _has_highlight_histogram = false;
+    std::uint8_t _histogram_min_value = 0;
+    std::uint8_t _histogram_max_value = 255;
+
 public:
     TransferFunctionEditWidget();
 
@@ -36,6 +52,13 @@ public:
     void set_padding_width(float width) { _padding_width = width; }
     void set_color_edit_as_popup(bool enabled) { _color_edit_as_popup = enabled; }
     void clear_dirty_bit() { _transfer_function_dirty = false; }
+    // Replace the nodes, which must be sorted by t and span [0, 1]
+    void set_transfer_function(const std::vector<TfNode>& transfer_function);
+    // Draw the histogram, and a highlighted one such as that of the features if given, behind the nodes. Their
+    // bins are values of the volume, stretched from [min_value, max_value] over the width like the volume
+    // texture. Each one is scaled logarithmically to its own highest bin.
+    void set_histograms(const VolumeHistogram& histogram, const VolumeHistogram* highlight_histogram,
+                        std::uint8_t min_value, std::uint8_t max_value);
     bool post_draw(bool active);
 };
 
@@ -0,0 +1,178 @@
+#include "arap_solver.h"
+#include "parallel_for.h"
+#include "trace.h"
+
+#include <Eigen/Dense>
+#include <Eigen/SVD>
+
+#include <cmath>
+
+
+bool ArapSolver::compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& b,
+                         double weight, std::shared_ptr<spdlog::logger> logger) {
+    TRACE_SCOPE("arap_compute");
+    _num_vertices = 0;
+    const int num_vertices = int(TV.rows());
+    const int num_tets = int(TT.rows());
+    if (num_vertices == 0 || num_tets == 0) {
+        return false;
+    }
+
+    _tets = TT;
+    _b = b;
+    _bc.resize(b.size(), 3);
+    for (int i = 0; i < b.size(); i++) {
+        _bc.row(i) = TV.row(b[i]);
+    }
+    _weight = weight;
+    _weighted_gradients.assign(std::size_t(num_tets) * 12, 0.0);
+    _volumes.assign(num_tets, 0.0);
+    _rotations.assign(std::size_t(num_tets) * 9, 0.0);
+
+    parallel_for_chunks(std::size_t(num_tets), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t t = begin; t < end; t++) {
+            Eigen::Matrix3d Dm;
+            for (int j = 0; j < 3; j++) {
+                Dm.col(j) = (TV.row(TT(t, j + 1)) - TV.row(TT(t, 0))).transpose();
+            }
+            const double volume = std::abs(Dm.determinant()) / 6.0;
+            // Degenerate tets carry no energy
+            if (!(volume > 0.0)) {
+                continue;
+            }
+            // The rows of Dm^-1 are the gradients of the hat functions of corners 1 to 3
+            const Eigen::Matrix3d Dm_inv = Dm.inverse();
+            double* g = _weighted_gradients.data() + 12 * t;
+            for (int c = 0; c < 3; c++) {
+                g[c] = -volume * Dm_inv.col(c).sum();
+            }
+            for (int j = 0; j < 3; j++) {
+                for (int c = 0; c < 3; c++) {
+                    g[3 * (j + 1) + c] = volume * Dm_inv(j, c);
+                }
+            }
+            _volumes[t] = volume;
+        }
+    }, 1 << 12);
+
+    // The cotangent Laplacian of the rest mesh: vol_t grad N_i . grad N_j
+    std::vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(std::size_t(num_tets) * 16 + b.size());
+    for (int t = 0; t < num_tets; t++) {
+        if (_volumes[t] == 0.0) {
+            continue;
+        }
+        const double* g = _weighted_gradients.data() + 12 * t;
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                const double value = (g[3 * i] * g[3 * j] + g[3 * i + 1] * g[3 * j + 1] +
+                                      g[3 * i + 2] * g[3 * j + 2]) / _volumes[t];
+                triplets.emplace_back(TT(t, i), TT(t, j), value);
+            }
+        }
+    }
+    for (int i = 0; i < b.size(); i++) {
+        triplets.emplace_back(b[i], b[i], weight);
+    }
+    Eigen::SparseMatrix<double> A(num_vertices, num_vertices);
+    A.setFromTriplets(triplets.begin(), triplets.end());
+    if (!_solver.compute(A, logger, "ARAP global step")) {
+        return false;
+    }
+
+    // Count then fill the (tet, corner) pairs around each vertex
+    _incidence_offsets.assign(num_vertices + 1, 0);
+    for (int t = 0; t < num_tets; t++) {
+        for (int c = 0; c < 4; c++) {
+            _incidence_offsets[TT(t, c) + 1] += 1;
+        }
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        _incidence_offsets[v + 1] += _incidence_offsets[v];
+    }
+    _incidence.resize(_incidence_offsets.back());
+    std::vector<int> fill(_incidence_offsets.begin(), _incidence_offsets.end() - 1);
+    for (int t = 0; t < num_tets; t++) {
+        for (int c = 0; c < 4; c++) {
+            _incidence[fill[TT(t, c)]++] = 4 * t + c;
+        }
+    }
+
+    _num_vertices = num_vertices;
+    return true;
+}
+
+void ArapSolver::set_targets(const Eigen::MatrixXd& bc) {
+    _bc = bc;
+}
+
+double ArapSolver::iterate(Eigen::MatrixXd& V) {
+    if (!is_valid() || V.rows() != _num_vertices) {
+        return 0.0;
+    }
+    const std::size_t num_tets = _volumes.size();
+
+    // Local step: the rotation closest to the deformation gradient of each tet
+    double energy = 0.0;
+    {
+        TRACE_SCOPE("arap_local_step");
+        const std::size_t num_chunks = parallel_num_chunks(num_tets, 1 << 12);
+        std::vector<double> chunk_energy(num_chunks, 0.0);
+        parallel_for_chunks(num_tets, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+            double chunk_sum = 0.0;
+            for (std::size_t t = begin; t < end; t++) {
+                Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> R(_rotations.data() + 9 * t);
+                if (_volumes[t] == 0.0) {
+                    R.setIdentity();
+                    continue;
+                }
+                const double* g = _weighted_gradients.data() + 12 * t;
+                Eigen::Matrix3d F = Eigen::Matrix3d::Zero();
+                for (int c = 0; c < 4; c++) {
+                    F += V.row(_tets(t, c)).transpose() *
+                         Eigen::RowVector3d(g[3 * c], g[3 * c + 1], g[3 * c + 2]);
+                }
+                F /= _volumes[t];
+
+                Eigen::JacobiSVD<Eigen::Matrix3d> svd(F, Eigen::ComputeFullU | Eigen::ComputeFullV);
+                Eigen::Matrix3d U = svd.matrixU();
+                const Eigen::Matrix3d& W = svd.matrixV();
+                // Flip the axis of the smallest singular value of inverted tets to stay a rotation
+                if ((U * W.transpose()).determinant() < 0.0) {
+                    U.col(2) = -U.col(2);
+                }
+                R = U * W.transpose();
+                chunk_sum += _volumes[t] * (F - R).squaredNorm();
+            }
+            chunk_energy[chunk] = chunk_sum;
+        }, 1 << 12);
+        for (double e : chunk_energy) {
+            energy += e;
+        }
+        for (int i = 0; i < _b.size(); i++) {
+            energy += _weight * (V.row(_b[i]) - _bc.row(i)).squaredNorm();
+        }
+    }
+
+    // Global step: gather vol_t R_t grad N_i around each vertex and solve
+    TRACE_SCOPE("arap_global_step");
+    Eigen::MatrixXd rhs(_num_vertices, 3);
+    parallel_for_chunks(std::size_t(_num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+            for (int k = _incidence_offsets[v]; k < _incidence_offsets[v + 1]; k++) {
+                const int t = _incidence[k] / 4;
+                const int c = _incidence[k] % 4;
+                const double* g = _weighted_gradients.data() + 12 * t + 3 * c;
+                Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> R(_rotations.data() + 9 * t);
+                sum += R * Eigen::Vector3d(g[0], g[1], g[2]);
+            }
+            rhs.row(v) = sum.transpose();
+        }
+    }, 1 << 12);
+    for (int i = 0; i < _b.size(); i++) {
+        rhs.row(_b[i]) += _weight * _bc.row(i);
+    }
+    V = _solver.solve(rhs);
+    return energy;
+}
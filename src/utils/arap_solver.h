@@ -0,0 +1,62 @@
+#ifndef ARAP_SOLVER_H
+#define ARAP_SOLVER_H
+
+#include "sparse_solver.h"
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <vector>
+
+// As-rigid-as-possible deformation of a tet mesh with soft positional constraints, solved with local-global
+// iterations:
+//
+//   E(x) = sum_t vol_t |F_t(x) - R_t|^2 + w sum_b |x_b - bc_b|^2
+//
+// The local step fits the rotation R_t closest to the deformation gradient F_t of every tet, the global step
+// solves for the positions with the rotations fixed. Both steps run on every core: the tets of the local step are
+// independent, and the right hand side of the global step is gathered per vertex from the tets around it.
+//
+// The matrix of the global step, the cotangent Laplacian of the rest mesh plus the constraint weights, only depends
+// on the rest mesh and on which vertices are constrained. It is factored once in compute() and reused by every
+// iteration and by set_targets(), moving the constraints only costs back-substitutions.
+class ArapSolver {
+public:
+    // Factor the global step of TV, TT with the vertices b constrained with weight. Returns false if the mesh is
+    // empty or the factorization fails.
+    bool compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& b, double weight,
+                 std::shared_ptr<spdlog::logger> logger = nullptr);
+
+    bool is_valid() const { return _num_vertices > 0; }
+    // The constrained vertices compute() was called with
+    const Eigen::VectorXi& constrained_vertices() const { return _b; }
+
+    // Target positions of the constrained vertices, a row per entry of b
+    void set_targets(const Eigen::MatrixXd& bc);
+
+    // One local and one global step from the positions V, which are replaced by the result. Returns the energy
+    // of the rotations of the local step, i.e. of V before the global step.
+    double iterate(Eigen::MatrixXd& V);
+
+private:
+    int _num_vertices = 0;
+    double _weight = 0.0;
+    Eigen::VectorXi _b;
+    Eigen::MatrixXd _bc;
+    Eigen::MatrixXi _tets;
+
+    // Volume of each tet times the gradients of its 4 hat functions, a 4x3 block per tet, stored as 12
+    // consecutive doubles (row major) so the local step streams through them
+    std::vector<double> _weighted_gradients;
+    std::vector<double> _volumes;
+    // (tet, corner) pairs around each vertex, in compressed rows, for the gather of the global step
+    std::vector<int> _incidence_offsets;
+    std::vector<int> _incidence;
+    // Rotations of the local step, 9 doubles (row major) per tet
+    std::vector<double> _rotations;
+
+    SparseSolver _solver;
+};
+
+#endif // ARAP_SOLVER_H
@@ -0,0 +1,172 @@
+#include "background_job.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace {
+
+std::atomic_int num_pending_jobs{ 0 };
+
+} // namespace
+
+struct JobContext::Run {
+    // Cancel flag and work counters of the current stage
+    vor3d::ProgressChannel channel;
+    // Progress the current stage set, negative until it does
+    std::atomic<float> progress{ -1.f };
+    std::atomic_bool finished{ false };
+    // Written by the job thread before finished is set
+    JobStatus status = JobStatus::Running;
+
+    std::function<void()> notify;
+
+    mutable std::mutex mutex;
+    std::vector<JobStage> stages;
+    std::chrono::steady_clock::time_point stage_start;
+    std::uint64_t trace_stage_start = 0;
+
+    // Must be called with the mutex held
+    void end_stage() {
+        if (!stages.empty() && !stages.back().done) {
+            read_progress(stages.back());
+            stages.back().done = true;
+            if (trace_stage_start != 0) {
+                trace::record(trace::intern(stages.back().name), trace_stage_start, trace::now());
+            }
+        }
+    }
+
+    double seconds_in_stage() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count();
+    }
+
+    // Copy the progress of the current stage into stage, must be called with the mutex held
+    void read_progress(JobStage& stage) const {
+        stage.seconds = seconds_in_stage();
+        stage.work_done = channel.done.load(std::memory_order_relaxed);
+        stage.work_total = channel.total.load(std::memory_order_relaxed);
+        stage.progress = stage.work_total > 0 ? std::min(float(double(stage.work_done) / stage.work_total), 1.f)
+                                              : progress.load(std::memory_order_relaxed);
+    }
+};
+
+
+bool JobContext::cancelled() const {
+    return _run->channel.isCancelled();
+}
+
+void JobContext::begin_stage(const std::string& name) {
+    {
+        std::lock_guard<std::mutex> lock(_run->mutex);
+        _run->end_stage();
+        JobStage stage;
+        stage.name = name;
+        _run->stages.push_back(stage);
+        _run->channel.reset();
+        _run->progress = -1.f;
+        _run->stage_start = std::chrono::steady_clock::now();
+        _run->trace_stage_start = trace::enabled() ? trace::now() : 0;
+    }
+    if (_run->notify) {
+        _run->notify();
+    }
+}
+
+void JobContext::set_progress(float progress) {
+    _run->progress.store(progress, std::memory_order_relaxed);
+    if (_run->notify) {
+        _run->notify();
+    }
+}
+
+vor3d::ProgressChannel& JobContext::progress_channel() {
+    return _run->channel;
+}
+
+
+BackgroundJob::~BackgroundJob() {
+    cancel();
+    for (auto& thread : _threads) {
+        thread.second.join();
+    }
+}
+
+void BackgroundJob::start(std::function<bool(JobContext&)> work, std::function<void()> notify, TaskLane lane) {
+    cancel();
+    join_finished_threads();
+
+    std::shared_ptr<JobContext::Run> run = std::make_shared<JobContext::Run>();
+    run->notify = std::move(notify);
+    _run = run;
+    num_pending_jobs += 1;
+    _threads.emplace_back(run, std::thread([run, work, lane]() {
+        TaskLaneScope lane_scope(lane);
+        JobContext context(run);
+        const bool ok = work(context);
+        {
+            std::lock_guard<std::mutex> lock(run->mutex);
+            run->end_stage();
+        }
+        run->status = run->channel.isCancelled() ? JobStatus::Cancelled : (ok ? JobStatus::Succeeded : JobStatus::Failed);
+        run->finished = true;
+        if (run->notify) {
+            run->notify();
+        }
+    }));
+}
+
+void BackgroundJob::cancel() {
+    if (_run) {
+        _run->channel.cancelled = true;
+        _run.reset();
+        num_pending_jobs -= 1;
+    }
+}
+
+bool BackgroundJob::is_running() const {
+    return _run && !_run->finished;
+}
+
+JobStatus BackgroundJob::poll() {
+    join_finished_threads();
+    if (!_run) {
+        return JobStatus::Idle;
+    }
+    if (!_run->finished) {
+        return JobStatus::Running;
+    }
+    const JobStatus status = _run->status;
+    _run.reset();
+    num_pending_jobs -= 1;
+    return status;
+}
+
+int BackgroundJob::num_pending() {
+    return num_pending_jobs;
+}
+
+std::vector<JobStage> BackgroundJob::stages() const {
+    if (!_run) {
+        return std::vector<JobStage>();
+    }
+    std::lock_guard<std::mutex> lock(_run->mutex);
+    std::vector<JobStage> stages = _run->stages;
+    if (!stages.empty() && !stages.back().done) {
+        _run->read_progress(stages.back());
+    }
+    return stages;
+}
+
+void BackgroundJob::join_finished_threads() {
+    for (size_t i = 0; i < _threads.size();) {
+        if (_threads[i].first->finished) {
+            _threads[i].second.join();
+            _threads.erase(_threads.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef BACKGROUND_JOB_H
+#define BACKGROUND_JOB_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "task_scheduler.h"
+
+#include <vor3d/Progress.h>
+
+// Progress of one stage of a background job
+struct JobStage {
+    std::string name;
+    // Fraction of the stage that is done, negative if the stage does not report its progress
+    float progress = -1.f;
+    // Time spent in the stage so far
+    double seconds = 0.0;
+    // Units of work done out of the total reported through the progress channel, 0 out of 0 if the stage does
+    // not count its work
+    std::uint64_t work_done = 0;
+    std::uint64_t work_total = 0;
+    bool done = false;
+};
+
+enum class JobStatus {
+    Idle,
+    Running,
+    Succeeded,
+    Failed,
+    Cancelled,
+};
+
+// Handed to the work function of a BackgroundJob to report progress and check for cancellation.
+// Cancellation is cooperative: the work function checks cancelled() between its stages and in its long
+// loops, and returns as soon as it is set.
+//
+// Progress and cancellation go through atomics, the workers never wait on the UI reading them once per frame.
+// Only starting a stage takes a lock.
+class JobContext {
+public:
+    struct Run;
+
+    bool cancelled() const;
+
+    // End the current stage, if any, and start a new one
+    void begin_stage(const std::string& name);
+    // Progress of the current stage in [0, 1]
+    void set_progress(float progress);
+
+    // Channel of the current stage, for the routines without a JobContext such as the vor3d sweeps. Its
+    // cancel flag is the one of the job, and the work it counts overrides set_progress. It is reset by
+    // begin_stage.
+    vor3d::ProgressChannel& progress_channel();
+
+private:
+    friend class BackgroundJob;
+    explicit JobContext(std::shared_ptr<Run> run) : _run(std::move(run)) {}
+
+    std::shared_ptr<Run> _run;
+};
+
+// Runs a work function on a background thread, one job at a time. Starting a job cancels the one in flight
+// and forgets it: its thread winds down on its own and its outcome is never reported, so poll() only ever
+// returns the outcome of the last job started. Work functions should therefore write their results into
+// storage of their own and leave the shared state alone, the owner picks the results up on its thread once
+// poll() reports success.
+class BackgroundJob {
+public:
+    BackgroundJob() = default;
+    BackgroundJob(const BackgroundJob&) = delete;
+    BackgroundJob& operator=(const BackgroundJob&) = delete;
+
+    // Cancel the current job and wait for every thread still running
+    ~BackgroundJob();
+
+    // Run work on a new thread. work returns false when it fails. notify is called from the job thread
+    // whenever the progress changes and once the job has finished, to wake up the UI. The parallel loops of
+    // work run in lane, jobs the user waits on to continue interacting go into the interactive lane.
+    void start(std::function<bool(JobContext&)> work, std::function<void()> notify = std::function<void()>(),
+               TaskLane lane = TaskLane::Bulk);
+
+    // Ask the current job to stop, without waiting for it
+    void cancel();
+
+    bool is_running() const;
+
+    // Running while the current job runs. Once it has finished its outcome is returned a single time,
+    // then the job is forgotten and the status is Idle until the next start().
+    JobStatus poll();
+
+    // Stages of the current job so far, with the time spent in each of them
+    std::vector<JobStage> stages() const;
+
+    // Jobs of all the BackgroundJobs that were started and whose outcome poll() did not return yet, i.e. the
+    // UI still waits for them
+    static int num_pending();
+
+private:
+    std::shared_ptr<JobContext::Run> _run;
+    // Threads of the current and of the cancelled jobs, joined once they are done
+    std::vector<std::pair<std::shared_ptr<JobContext::Run>, std::thread>> _threads;
+
+    void join_finished_threads();
+};
+
+#endif // BACKGROUND_JOB_H
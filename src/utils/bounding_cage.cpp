@@ -1,13 +1,26 @@
 #include "bounding_cage.h"
+#include "parallel_for.h"
+#include "project_file.h"
+#include "trace.h"
 
 #include <Eigen/Core>
+#include <Eigen/Eigenvalues>
 #include <Eigen/Geometry>
 
-#include <igl/copyleft/cgal/convex_hull.h>
-#include <igl/per_face_normals.h>
 #include <igl/triangle/triangulate.h>
 #include <igl/segment_segment_intersect.h>
 
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+// KeyFrames or skeleton vertices per chunk of the parallel loops over the cage, smaller cages are walked on
+// the calling thread
+constexpr std::size_t KEYFRAMES_PER_CHUNK = 1024;
+
+} // namespace
 
 // Parallel transport a coordinate system from a KeyFrame along a curve to a point with normal, to_n
 //static Eigen::Matrix3d parallel_transport(const BoundingCage::KeyFrame& from_kf, Eigen::RowVector3d to_n) {
@@ -26,6 +39,39 @@ static Eigen::Matrix3d parallel_transport(const Eigen::MatrixXd& kf_coord_frame,
     return coord_system;
 }
 
+// Smooth the polyline SV with its endpoints fixed by minimizing |X - SV|^2 + lambda |D X|^2, D the differences
+// of consecutive vertices. The normal equations (I + lambda L) X = SV, L the Laplacian of the path, are
+// tridiagonal and are solved exactly in O(n) by forward elimination and back substitution. Their smoothing kernel
+// has the variance of num_iters passes of replacing each vertex by the mean of its neighbors for
+// lambda = num_iters / 2, without the passes.
+static Eigen::MatrixXd smooth_polyline(const Eigen::MatrixXd& SV, unsigned num_iters) {
+    const int n = static_cast<int>(SV.rows());
+    Eigen::MatrixXd X = SV;
+    if (n <= 2 || num_iters == 0) {
+        return X;
+    }
+    const double lambda = 0.5 * num_iters;
+    const double diagonal = 1.0 + 2.0 * lambda;
+
+    // The interior vertices 1 to n-2 are the unknowns, the fixed ends move to the right hand side
+    X.row(1) += lambda * SV.row(0);
+    X.row(n - 2) += lambda * SV.row(n - 1);
+
+    // Forward elimination of the sub-diagonal, c[i] is the super-diagonal of row i once its pivot is 1
+    std::vector<double> c(n, 0.0);
+    c[1] = -lambda / diagonal;
+    X.row(1) /= diagonal;
+    for (int i = 2; i < n - 1; i++) {
+        const double pivot = diagonal + lambda * c[i - 1];
+        c[i] = -lambda / pivot;
+        X.row(i) = (X.row(i) + lambda * X.row(i - 1)) / pivot;
+    }
+    for (int i = n - 3; i >= 1; i--) {
+        X.row(i) -= c[i] * X.row(i + 1);
+    }
+    return X;
+}
+
 // Construct a 3x3 rotation matrix whose 3rd row is normal
 static Eigen::Matrix3d local_coordinate_system(const Eigen::RowVector3d& normal) {
     Eigen::RowVector3d plane_normal = normal;
@@ -79,7 +125,6 @@ BoundingCage::KeyFrame::KeyFrame(const Eigen::RowVector3d& normal,
                                  const double angle,
                                  const Eigen::MatrixXd& pts,
                                  const Eigen::RowVector2d& centroid,
-                                 std::shared_ptr<BoundingCage::Cell> cell,
                                  double idx,
                                  BoundingCage* cage) {
     _cage = cage;
@@ -90,10 +135,8 @@ BoundingCage::KeyFrame::KeyFrame(const Eigen::RowVector3d& normal,
     _origin = center;
     _vertices_2d = pts;
 
-    _left_cell = cell;
-    _right_cell = cell;
-
     logger = _cage->logger;
+    update_cached_geometry();
 }
 
 BoundingCage::KeyFrame::KeyFrame(const Eigen::RowVector3d& center,
@@ -101,7 +144,6 @@ BoundingCage::KeyFrame::KeyFrame(const Eigen::RowVector3d& center,
                                  const double angle,
                                  const Eigen::MatrixXd& pts,
                                  const Eigen::RowVector2d& centroid,
-                                 std::shared_ptr<BoundingCage::Cell> cell,
                                  double idx,
                                  BoundingCage *cage) {
     _cage = cage;
@@ -111,13 +153,31 @@ BoundingCage::KeyFrame::KeyFrame(const Eigen::RowVector3d& center,
     _origin = center;
     _vertices_2d = pts;
     _centroid_2d = centroid;
-    _left_cell = cell;
-    _right_cell = cell;
 
     logger = _cage->logger;
+    update_cached_geometry();
 }
 
 
+void BoundingCage::KeyFrame::update_cached_geometry() {
+    Eigen::AngleAxisd R(-_angle, _orientation.row(2));
+    _orientation_rotated = (R*_orientation.transpose()).transpose();
+
+    const Eigen::RowVector4d bbox = _cage->keyframe_bounding_box();
+    const double min_u = bbox[0], max_u = bbox[1], min_v = bbox[2], max_v = bbox[3];
+    const Eigen::RowVector3d right = _orientation_rotated.row(0), up = _orientation_rotated.row(1);
+    _bounding_box_vertices_3d.row(0) = right*min_u + up*min_v;
+    _bounding_box_vertices_3d.row(1) = right*max_u + up*min_v;
+    _bounding_box_vertices_3d.row(2) = right*max_u + up*max_v;
+    _bounding_box_vertices_3d.row(3) = right*min_u + up*max_v;
+    _bounding_box_vertices_3d.rowwise() += centroid_3d();
+
+    // Only KeyFrames in the cage are stamped, the detached ones are created by const queries
+    if (_in_cage) {
+        _geometry_version = ++_cage->_next_geometry_version;
+    }
+}
+
 bool BoundingCage::KeyFrame::move_centroid_2d(const Eigen::RowVector2d& new_centroid_2d) {
     if (!in_bounding_cage()) {
         logger->warn("Cannot move KeyFrame centroid if KeyFrame is not in bounding cage");
@@ -125,6 +185,7 @@ bool BoundingCage::KeyFrame::move_centroid_2d(const Eigen::RowVector2d& new_cent
     }
 
     _centroid_2d = new_centroid_2d;
+    update_cached_geometry();
     return true;
 }
 
@@ -135,6 +196,7 @@ bool BoundingCage::KeyFrame::rotate_about_normal(double d_angle) {
     }
 
     _angle += d_angle;
+    update_cached_geometry();
     return true;
 }
 
@@ -147,6 +209,7 @@ bool BoundingCage::KeyFrame::rotate_about_right(double d_angle) {
     Eigen::AngleAxisd R(d_angle, _orientation.row(0));
     Eigen::Matrix3d O = _orientation;
     _orientation = O*R;
+    update_cached_geometry();
     return true;
 }
 
@@ -159,6 +222,7 @@ bool BoundingCage::KeyFrame::rotate_about_up(double d_angle) {
     Eigen::AngleAxisd R(d_angle, _orientation.row(1));
     Eigen::Matrix3d O = _orientation;
     _orientation = O*R;
+    update_cached_geometry();
     return true;
 }
 
@@ -169,6 +233,7 @@ bool BoundingCage::KeyFrame::set_angle(double angle) {
     }
 
     _angle = angle;
+    update_cached_geometry();
     return true;
 }
 
@@ -199,41 +264,9 @@ void BoundingCage::KeyFrame::deserialize(const std::vector<char>& buffer) {
 // |                            | //
 // |============================| //
 
-BoundingCage::Cell::Cell(std::shared_ptr<KeyFrame> left_kf,
-                         std::shared_ptr<KeyFrame> right_kf, std::weak_ptr<Cell> parent,
-                         const BoundingCage* cage)
-    : _cage(cage)
-    , _left_keyframe(left_kf)
-    , _right_keyframe(right_kf)
-    , _parent_cell(parent)
-    , logger(cage->logger) {}
-
-std::shared_ptr<BoundingCage::Cell> BoundingCage::Cell::make_cell(std::shared_ptr<KeyFrame> left_kf,
-                                                                  std::shared_ptr<KeyFrame> right_kf,
-                                                                  const BoundingCage* cage,
-                                                                  std::weak_ptr<Cell> parent) {
-    std::shared_ptr<Cell> ret(new Cell(left_kf, right_kf, parent, cage));
-
-    if (!left_kf || !right_kf) {
-        std::shared_ptr<spdlog::logger> logger = ret->logger;
-        logger->warn("Cell::make_cell failed to construct Cell. "
-                     "One or both of left_kf or right_kf was null.");
-        ret.reset();
-        return ret;
-    }
-
-    left_kf->_right_cell = ret;
-    right_kf->_left_cell = ret;
-
-    // TODO: AABB tree Self intersection test
-
-    return ret;
-}
-
-const Eigen::MatrixXi BoundingCage::Cell::mesh_faces() const {
-    Eigen::MatrixXi F(12, 3);
-
-    F << 3, 0, 1,
+const BoundingCage::Cell::MeshFaces& BoundingCage::Cell::mesh_faces() const {
+    static const MeshFaces F = (MeshFaces() <<
+         3, 0, 1,
          3, 1, 2,
          5, 4, 7,
          5, 7, 6,
@@ -244,114 +277,22 @@ const Eigen::MatrixXi BoundingCage::Cell::mesh_faces() const {
          2, 5, 6,
          5, 2, 1,
          1, 0, 5,
-         5, 0, 4;
+         5, 0, 4).finished();
 
     return F;
 }
 
-const Eigen::MatrixXd BoundingCage::Cell::mesh_vertices() const {
-
-    Eigen::MatrixXd lV = _left_keyframe->bounding_box_vertices_3d();
-    Eigen::MatrixXd rV = _right_keyframe->bounding_box_vertices_3d();
+const BoundingCage::Cell::MeshVertices BoundingCage::Cell::mesh_vertices() const {
 
-    Eigen::MatrixXd V(8, 3);
+    const KeyFrame::BoxVertices3d& lV = _cage->_keyframes[_position].bounding_box_vertices_3d();
+    const KeyFrame::BoxVertices3d& rV = _cage->_keyframes[_position + 1].bounding_box_vertices_3d();
 
-    V << lV(0, 0), lV(0, 1), lV(0, 2),
-         lV(1, 0), lV(1, 1), lV(1, 2),
-         lV(2, 0), lV(2, 1), lV(2, 2),
-         lV(3, 0), lV(3, 1), lV(3, 2),
-         rV(0, 0), rV(0, 1), rV(0, 2),
-         rV(1, 0), rV(1, 1), rV(1, 2),
-         rV(2, 0), rV(2, 1), rV(2, 2),
-         rV(3, 0), rV(3, 1), rV(3, 2);
+    MeshVertices V;
+    V << lV, rV;
 
     return V;
 }
 
-std::shared_ptr<BoundingCage::KeyFrame> BoundingCage::Cell::split(std::shared_ptr<KeyFrame> keyframe) {
-    // The index of the keyframe is out of range, since this method is called, internally,
-    // this should fail
-    if (keyframe->index() > max_index() || keyframe->index() < min_index()) {
-        logger->error("index of keyframe ({}) in split(), was out of range ({}, {})",
-                      keyframe->index(), min_index(), max_index());
-        assert("split index is out of range" && false);
-        return std::shared_ptr<KeyFrame>();
-    }
-
-    // This node has already been split by the keyframe
-    if (keyframe->index() == max_index()) {
-        return _right_keyframe;
-    }
-    if (keyframe->index() == min_index()) {
-        return _left_keyframe;
-    }
-
-    // This node is a leaf node, so split it
-    if (is_leaf()) {
-        // Initialize new Cells for the left and right children
-        _left_child = Cell::make_cell(_left_keyframe, keyframe, _cage, shared_from_this() /* parent */);
-        if (!_left_child) {
-            logger->warn("Cell::split() failed to construct left child.");
-            return std::shared_ptr<KeyFrame>();
-        }
-        _right_child = Cell::make_cell(keyframe, _right_keyframe, _cage, shared_from_this() /* parent */);
-        if (!_right_child) {
-            logger->warn("Cell::split() failed to construct right child.");
-            _left_child.reset();
-            return std::shared_ptr<KeyFrame>();
-        }
-
-
-        // Fix the cell pointers in the new keyframe
-        _left_keyframe->_right_cell = _left_child;
-        _right_keyframe->_left_cell = _right_child;
-        keyframe->_left_cell = _left_child;
-        keyframe->_right_cell = _right_child;
-
-        // If we added a cell with a different normal than the left key-frame, we need to recompute the
-        // the local coordinate frame of the right keyframe
-        _right_keyframe->_orientation = parallel_transport(_right_child->_left_keyframe->_orientation, _right_keyframe->_orientation.row(2));
-
-        return keyframe;
-
-        // This node is not a leaf node, split one of the children
-    } else if(keyframe->index() > _left_child->min_index() && keyframe->index() < _left_child->max_index()) {
-        return _left_child->split(keyframe);
-    } else if(keyframe->index() > _right_child->min_index() && keyframe->index() < _right_child->max_index()) {
-        return _right_child->split(keyframe);
-    } else {
-        logger->error("BoundingCage tree is in an incorrect state. split() failed."
-                      "Cell split index = {}, left_keyframe_index = {}, "
-                      "right_keyframe_index = {}, "
-                      "left_child = {0:x}, right_child = {0:x}.",
-                      keyframe->index(), _left_keyframe->index(), _right_keyframe->index(),
-                      (std::ptrdiff_t)_left_child.get(), (std::ptrdiff_t)_right_child.get());
-        assert("BoundingCage tree is in a bad state" && false);
-        assert("BoundingCage tree is in a bad state" && ((_left_child && !_right_child) || (_right_child && !_left_child)));
-        return std::shared_ptr<KeyFrame>();;
-    }
-    assert(false);
-}
-
-std::shared_ptr<BoundingCage::Cell> BoundingCage::Cell::find(double index) {
-    if (index < min_index() || index > max_index()) {
-        logger->error("find_cell_r(cell, index) index, {} was out of range ({}, {})",
-                      index, min_index(), max_index());
-        assert("find_cell_r(cell, index) out of range" && false);
-        return std::shared_ptr<Cell>();
-    } else if (is_leaf()) {
-        return shared_from_this();
-    } else if (_left_child && index >= _left_child->min_index() && index <= _left_child->max_index()) {
-        return _left_child->find(index);
-    } else if (_right_child && index >= _right_child->min_index() && index <= _right_child->max_index()) {
-        return _right_child->find(index);
-    } else {
-        logger->error("BUG!!! This branch in find_cell_r should never execute.");
-        assert("This should never happen" && false);
-        return std::shared_ptr<Cell>();
-    }
-}
-
 
 
 
@@ -362,6 +303,7 @@ std::shared_ptr<BoundingCage::Cell> BoundingCage::Cell::find(double index) {
 // |======================| //
 
 bool BoundingCage::set_skeleton_vertices(const Eigen::MatrixXd& new_SV, unsigned smoothing_iters, const Eigen::Vector4d& bounding_box) {
+    TRACE_SCOPE("build_cage");
     assert(cells.begin() == cells.end());
     assert(keyframes.begin() == keyframes.end());
     assert(cells.rbegin() == cells.rend());
@@ -370,50 +312,37 @@ bool BoundingCage::set_skeleton_vertices(const Eigen::MatrixXd& new_SV, unsigned
     const int UPSAMPLE_RATE = 4;
     const int LOOKAHEAD = 1;
 
-    std::function<void(int)> smooth_skeleton = [&](int num_iters) {
-        Eigen::MatrixXd SV_i = SV;
-        SV_smooth.resize(SV_i.rows(), 3);
-        for (int iter = 0; iter < num_iters; iter++) {
-            SV_smooth.row(0) = SV_i.row(0);
-            for (int i = 1; i < SV_i.rows()-1; i++) {
-                SV_smooth.row(i) = 0.5 * (SV_i.row(i-1) + SV_i.row(i+1));
-            }
-            SV_smooth.row(SV_i.rows()-1) = SV_i.row(SV_i.rows()-1);
-            SV_i = SV_smooth;
-        }
-    };
-
     // Fit the an initial BoundingCage to the skeleton. This will
     // attempt to construct a series of prisms which fully enclose the skeleton
     // vertices.
     //
     // If the resulting BoundingCage does not contain all the skeleton vertices,
     // this method returns false.
-    std::function<bool(std::shared_ptr<Cell>)> fit_cage_rec = [&](std::shared_ptr<Cell> cell) -> bool {
+    //
+    // The Cell is given by the position of its left KeyFrame. Splitting it inserts a KeyFrame
+    // right after that position, which shifts the positions of the following Cells.
+    std::function<bool(int)> fit_cage_rec = [&](int left) -> bool {
         // If all the skeleton vertices are in the cage node, then we're done
-        if (skeleton_in_cell(cell)) {
+        if (skeleton_in_cell(left)) {
             return true;
         }
 
         // Otherwise split the cage node and try again
-        const int mid = cell->min_index() + (cell->max_index() - cell->min_index()) / 2;
-        if (mid == cell->min_index() || mid == cell->max_index()) {
+        const KeyFrame& left_kf = _keyframes[left];
+        const KeyFrame& right_kf = _keyframes[left + 1];
+        const int mid = left_kf.index() + (right_kf.index() - left_kf.index()) / 2;
+        if (mid == left_kf.index() || mid == right_kf.index()) {
             logger->info("mid value, {}, equalled boundary ({}, {}), "
                          "while splitting cage cell in fit_cage_rec",
-                         mid, cell->min_index(), cell->max_index());
+                         mid, left_kf.index(), right_kf.index());
             return false;
         }
-        assert("Bad mid index" && (mid > 0) && (mid < SV_smooth.rows()-1));
-
-        Eigen::RowVector2d mid_centroid = 0.5 * (cell->_left_keyframe->centroid_2d() + cell->_right_keyframe->centroid_2d());
-        Eigen::RowVector3d mid_normal = (0.5 * (SV_smooth.row(mid+LOOKAHEAD) - SV_smooth.row(mid-LOOKAHEAD))).normalized();
-        Eigen::MatrixXd mid_pts_2d = 0.5 * (cell->_left_keyframe->vertices_2d() + cell->_left_keyframe->vertices_2d());
-        std::shared_ptr<KeyFrame> mid_keyframe(new KeyFrame(mid_normal, SV_smooth.row(mid), *cell->_left_keyframe, 0.0, mid_pts_2d, mid_centroid, cell, mid, this));
-        assert("Parallel transport bug" && (1.0-fabs(mid_keyframe->normal().dot(mid_normal))) < 1e-6);
 
-        if(split_internal(mid_keyframe)) {
-            bool ret = fit_cage_rec(cell->_left_child);
-            return ret && fit_cage_rec(cell->_right_child);
+        // left_kf and right_kf are invalidated by the insertion
+        if(insert_internal(skeleton_keyframe(left, mid)) >= 0) {
+            const int num_before = num_keyframes();
+            bool ret = fit_cage_rec(left);
+            return ret && fit_cage_rec(left + 1 + (num_keyframes() - num_before));
         } else {
             return false;
         }
@@ -432,7 +361,7 @@ bool BoundingCage::set_skeleton_vertices(const Eigen::MatrixXd& new_SV, unsigned
     }
 
     logger->debug("About to do smoothing pass");
-    smooth_skeleton(smoothing_iters);
+    SV_smooth = smooth_polyline(SV, smoothing_iters);
 
 //    logger->debug("Reparameterize");
 //    SV = SV_smooth;
@@ -478,242 +407,402 @@ bool BoundingCage::set_skeleton_vertices(const Eigen::MatrixXd& new_SV, unsigned
     Eigen::RowVector2d centroid = poly_template.colwise().mean();
 
     Eigen::Matrix3d front_coord_system = local_coordinate_system(front_normal);
-    std::shared_ptr<KeyFrame> front_keyframe(new KeyFrame(SV_smooth.row(0), front_coord_system, 0.0, poly_template, centroid,
-                                                          std::shared_ptr<Cell>(), 0, this));
-    std::shared_ptr<KeyFrame> back_keyframe(new KeyFrame(back_normal, SV_smooth.row(SV_smooth.rows()-1), *front_keyframe, 0.0,
-                                                         poly_template, centroid, std::shared_ptr<Cell>(),
-                                                         SV_smooth.rows()-1, this));
-    front_keyframe->_in_cage = true;
-    back_keyframe->_in_cage = true;
-    logger->debug("1-<bn, transport(fn)> = {}", 1.0-fabs(back_keyframe->normal().dot(back_normal)));
-
-    assert("Parallel transport bug" && (1.0-fabs(back_keyframe->normal().dot(back_normal))) < 1e-6);
-
-    root = Cell::make_cell(front_keyframe, back_keyframe, this);
-    if (!root) {
-        // TODO: Use the bounding box of the mesh instead
-        logger->warn("set_skeleton_vertices was unable to fit the first Cell. Using bounding box instead.");
-        assert("TODO: Use bounding box" && false);
-        return false;
-    }
-
-    cells.head = root;
-    cells.tail = cells.head;
-
-    if (!fit_cage_rec(root)) {
+    KeyFrame front_keyframe(SV_smooth.row(0), front_coord_system, 0.0, poly_template, centroid, 0, this);
+    KeyFrame back_keyframe(back_normal, SV_smooth.row(SV_smooth.rows()-1), front_keyframe, 0.0,
+                           poly_template, centroid, SV_smooth.rows()-1, this);
+    front_keyframe._in_cage = true;
+    back_keyframe._in_cage = true;
+    front_keyframe.update_cached_geometry();
+    back_keyframe.update_cached_geometry();
+    logger->debug("1-<bn, transport(fn)> = {}", 1.0-fabs(back_keyframe.normal().dot(back_normal)));
+
+    assert("Parallel transport bug" && (1.0-fabs(back_keyframe.normal().dot(back_normal))) < 1e-6);
+
+    // Each split of fit_cage_rec adds one KeyFrame
+    _keyframes.reserve(SV_smooth.rows());
+    _keyframes.push_back(front_keyframe);
+    _keyframes.push_back(back_keyframe);
+
+    if (!fit_cage_rec(0)) {
         logger->info("Initial bounding cage does not contain all the skeleton vertices.");
     } else {
         logger->info("Successfully fit all skeleton vertices inside BoundingCage.");
     }
 
     logger->info("Done constructing initial cage for skeleton.");
-    _num_keyframes += 2; // Head and tail keyframes
     return true;
 }
 
+int BoundingCage::find_cell(double index) const {
+    if (_keyframes.size() < 2 || index < min_index() || index > max_index()) {
+        return -1;
+    }
+
+    // First KeyFrame past index, the Cell containing index starts at the one before it. An index on
+    // the last KeyFrame belongs to the last Cell.
+    std::vector<KeyFrame>::const_iterator it = std::upper_bound(
+                _keyframes.begin(), _keyframes.end(), index,
+                [](double i, const KeyFrame& kf) { return i < kf.index(); });
+    const int right = std::min(int(it - _keyframes.begin()), num_keyframes() - 1);
+    return right - 1;
+}
+
 BoundingCage::KeyFrameIterator BoundingCage::keyframe_for_index(double index) const {
-    std::shared_ptr<Cell> cell = root->find(index);
+    const int left = find_cell(index);
 
-    if (!cell) {
+    if (left < 0) {
         logger->error("vertices_2d_for_index() could not find cell at index {}", index);
         assert("vertices_2d_for_index() could not find cell" && false);
         return KeyFrameIterator();
     }
 
-    // If the index matches one of the cell boundaries, return the KeyFrame on that boundary
-    if (cell->min_index() == index) {
-        return KeyFrameIterator(cell->_left_keyframe);
-    } else if (cell->max_index() == index) {
-        return KeyFrameIterator(cell->_right_keyframe);
-    }
-
-    const double coeff = (index - cell->min_index()) / (cell->max_index() - cell->min_index());
-    Eigen::MatrixXd V = (1.0-coeff)*cell->_left_keyframe->bounding_box_vertices_3d() + coeff*cell->_right_keyframe->bounding_box_vertices_3d();
-    Eigen::RowVector3d origin = (1.0-coeff)*cell->_left_keyframe->origin() + coeff*cell->_right_keyframe->origin();
-
+    BoundingCage* cage = const_cast<BoundingCage*>(this);
+    const KeyFrame& left_kf = _keyframes[left];
+    const KeyFrame& right_kf = _keyframes[left + 1];
 
-    Eigen::MatrixXd A = V.rowwise() - origin;
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeThinV);
-    Eigen::RowVector3d n = svd.matrixV().col(2).transpose();
+    // If the index matches one of the cell boundaries, return the KeyFrame on that boundary
+    if (left_kf.index() == index) {
+        return KeyFrameIterator(cage, left);
+    } else if (right_kf.index() == index) {
+        return KeyFrameIterator(cage, left + 1);
+    }
+
+    const double coeff = (index - left_kf.index()) / (right_kf.index() - left_kf.index());
+    const KeyFrame::BoxVertices3d V =
+            (1.0-coeff)*left_kf.bounding_box_vertices_3d() + coeff*right_kf.bounding_box_vertices_3d();
+    Eigen::RowVector3d origin = (1.0-coeff)*left_kf.origin() + coeff*right_kf.origin();
+
+    // Normal of the plane fit through the interpolated corners: the right singular vector of the smallest
+    // singular value of A, i.e. the eigenvector of the smallest eigenvalue of the 3x3 A^T A, which is solved
+    // in closed form instead of running an SVD on every interpolated frame
+    const KeyFrame::BoxVertices3d A = V.rowwise() - origin;
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen;
+    eigen.computeDirect(A.transpose() * A);
+    Eigen::RowVector3d n = eigen.eigenvectors().col(0).transpose();
     double sign = 1.0;
-    if (n.dot(cell->_left_keyframe->normal()) < 0.0 || n.dot(cell->_right_keyframe->normal()) < 0.0) {
+    if (n.dot(left_kf.normal()) < 0.0 || n.dot(right_kf.normal()) < 0.0) {
         sign = -1.0;
     }
     n *= sign;
 
-    double angle = (1.0-coeff)*cell->_left_keyframe->angle() + coeff*cell->_right_keyframe->angle();
+    double angle = (1.0-coeff)*left_kf.angle() + coeff*right_kf.angle();
 
-    Eigen::Matrix3d coord_frame = parallel_transport(cell->_left_keyframe->_orientation, n);
+    Eigen::Matrix3d coord_frame = parallel_transport(left_kf._orientation, n);
 
     Eigen::MatrixXd points2d(V.rows(), 2);
     points2d.col(0) = A*coord_frame.row(0).transpose();
     points2d.col(1) = A*coord_frame.row(1).transpose();
 
-    Eigen::RowVector2d centroid2d = (1.0-coeff)*cell->_left_keyframe->centroid_2d() + coeff*cell->_right_keyframe->centroid_2d();
-    std::shared_ptr<KeyFrame> kf(new KeyFrame(origin, coord_frame, angle, points2d, centroid2d, cell, index, (BoundingCage*)this));
-    return KeyFrameIterator(kf);
+    Eigen::RowVector2d centroid2d = (1.0-coeff)*left_kf.centroid_2d() + coeff*right_kf.centroid_2d();
+    std::shared_ptr<KeyFrame> kf = std::make_shared<KeyFrame>(KeyFrame(origin, coord_frame, angle, points2d, centroid2d,
+                                                                       index, cage));
+    return KeyFrameIterator(cage, left, kf);
 }
 
-bool BoundingCage::skeleton_in_cell(std::shared_ptr<Cell> cell) const {
-    int start = cell->min_index();
-    int end = cell->max_index();
-    std::shared_ptr<KeyFrame> left_kf = cell->_left_keyframe, right_kf = cell->_right_keyframe;
-
-    assert(left_kf->bounding_box_vertices_2d().rows() == right_kf->bounding_box_vertices_2d().rows());
-    Eigen::MatrixXd CHV(left_kf->bounding_box_vertices_2d().rows() + right_kf->bounding_box_vertices_2d().rows(), 3);
-    CHV.block(0, 0, left_kf->bounding_box_vertices_2d().rows(), 3) = left_kf->bounding_box_vertices_3d();
-    CHV.block(left_kf->bounding_box_vertices_2d().rows(), 0, right_kf->bounding_box_vertices_2d().rows(), 3) = right_kf->bounding_box_vertices_3d();
-
-    Eigen::MatrixXd V;
-    Eigen::MatrixXi F;
-    igl::copyleft::cgal::convex_hull(CHV, V, F);
-    if (CHV.rows() != V.rows()) {
-        logger->warn("Convex Hull of keyframes for Cell does not enclose all its points. "
-                     "There were {} input points but the convex hull had {} points.",
-                     CHV.rows(), V.rows());
-    }
+bool BoundingCage::skeleton_in_cell(int left) const {
+    const KeyFrame& left_kf = _keyframes[left];
+    const KeyFrame& right_kf = _keyframes[left + 1];
+    int start = left_kf.index();
+    int end = right_kf.index();
 
     assert(start < end);
     if ((end - start) <= 1) {
         return false;
     }
 
-    auto sgn = [](double val) -> int {
-        return (double(0) < val) - (val < double(0));
-    };
-
-    Eigen::MatrixXd C(F.rows(), 3);
-    for (int i = 0; i < F.rows(); i++) {
-        C.row(i) = (V.row(F(i, 0)) + V.row(F(i, 1)) + V.row(F(i, 2))) / 3;
-    }
-
-    // Computing the normals here is fine since this function only gets called
-    // on construction when the cage is very simple
-    Eigen::MatrixXd N;
-    igl::per_face_normals_stable(V, F, N);
-    const int check_sign = sgn(N.row(0).dot(SV_smooth.row(start+1)-C.row(0)));
-    for (int i = 0; i < end-start-1; i++) {
-        const Eigen::RowVector3d V = SV_smooth.row(start+1+i);
-        for (int j = 0; j < N.rows(); j++) {
-            const int sign = sgn(N.row(j).dot(V-C.row(j)));
-            if (sign != check_sign) {
-                return false;
+    // The Cell is the convex hull of the corners of its two bounding box quads. With only 8 points, its face
+    // planes are found directly: the plane through 3 corners bounds the hull if all the other corners lie on
+    // one side of it. The quads and the side faces of an untwisted Cell each show up more than once, which
+    // does not change the test below.
+    const KeyFrame::BoxVertices3d& L = left_kf.bounding_box_vertices_3d();
+    const KeyFrame::BoxVertices3d& R = right_kf.bounding_box_vertices_3d();
+    Eigen::Matrix<double, 8, 3> corners;
+    corners << L, R;
+    const Eigen::RowVector3d center = corners.colwise().mean();
+    const double extent = (corners.rowwise() - center).rowwise().norm().maxCoeff();
+    const double eps = 1e-9 * extent;
+
+    // Each row is an outward unit normal n and an offset o, the inside of the plane is n.p < o
+    Eigen::Matrix<double, 56, 4> planes;
+    int num_planes = 0;
+    Eigen::Matrix<bool, 8, 1> on_hull = Eigen::Matrix<bool, 8, 1>::Constant(false);
+    for (int i = 0; i < 8; i++) {
+        for (int j = i + 1; j < 8; j++) {
+            for (int k = j + 1; k < 8; k++) {
+                Eigen::RowVector3d n = (corners.row(j) - corners.row(i)).cross(corners.row(k) - corners.row(i));
+                const double norm = n.norm();
+                if (norm <= 1e-12 * extent * extent) {
+                    continue;
+                }
+                n /= norm;
+                double offset = n.dot(corners.row(i));
+                if (n.dot(center) > offset) {
+                    n = -n;
+                    offset = -offset;
+                }
+
+                const Eigen::Matrix<double, 8, 1> d = (corners * n.transpose()).array() - offset;
+                if (d.maxCoeff() > eps) {
+                    continue;
+                }
+                planes.row(num_planes++) << n, offset;
+                on_hull = on_hull.array() || (d.array() > -eps);
             }
         }
     }
 
-    return true;
+    if (!on_hull.all()) {
+        logger->warn("Convex Hull of keyframes for Cell does not enclose all its points. "
+                     "There were {} input points but the convex hull had {} points.",
+                     corners.rows(), on_hull.count());
+    }
+
+    const auto normals = planes.topRows(num_planes).leftCols<3>();
+    const auto offsets = planes.topRows(num_planes).col(3);
+
+    // Signed distances of all the skeleton vertices strictly inside the Cell to all the planes at once
+    const Eigen::MatrixXd dists =
+            (normals * SV_smooth.middleRows(start + 1, end - start - 1).transpose()).colwise() - offsets;
+    return (dists.array() < 0.0).all();
 }
 
-std::shared_ptr<BoundingCage::KeyFrame> BoundingCage::split_internal(std::shared_ptr<BoundingCage::KeyFrame> split_kf) {
-    std::shared_ptr<Cell> left_cell = split_kf->left_cell();
-    std::shared_ptr<Cell> right_cell = split_kf->right_cell();
+BoundingCage::KeyFrame BoundingCage::skeleton_keyframe(int left, int vertex) const {
+    const int LOOKAHEAD = 1;
+    assert("Bad split vertex" && (vertex >= LOOKAHEAD) && (vertex < SV_smooth.rows()-LOOKAHEAD));
+
+    const KeyFrame& left_kf = _keyframes[left];
+    const KeyFrame& right_kf = _keyframes[left + 1];
+    const double coeff = (vertex - left_kf.index()) / (right_kf.index() - left_kf.index());
+    Eigen::RowVector2d centroid = (1.0-coeff)*left_kf.centroid_2d() + coeff*right_kf.centroid_2d();
+    Eigen::MatrixXd pts_2d = (1.0-coeff)*left_kf.vertices_2d() + coeff*right_kf.vertices_2d();
+    const double angle = (1.0-coeff)*left_kf.angle() + coeff*right_kf.angle();
+    Eigen::RowVector3d normal = (0.5 * (SV_smooth.row(vertex+LOOKAHEAD) - SV_smooth.row(vertex-LOOKAHEAD))).normalized();
+
+    KeyFrame kf(normal, SV_smooth.row(vertex), left_kf, angle, pts_2d, centroid, vertex,
+                const_cast<BoundingCage*>(this));
+    assert("Parallel transport bug" && (1.0-fabs(kf.normal().dot(normal))) < 1e-6);
+    return kf;
+}
 
-    // A KeyFrame should never have both left and right Cell pointers set to null
-    if(!left_cell && !right_cell) {
-        logger->error("KeyFrame left and right cell are both null.");
-        assert(false);
-        return std::shared_ptr<KeyFrame>();
+int BoundingCage::fit_keyframes(double max_turn_angle, int max_keyframes) {
+    TRACE_SCOPE("fit_keyframes");
+    const int num_vertices = int(SV_smooth.rows());
+    if (num_keyframes() < 2 || num_vertices < 3) {
+        return 0;
     }
 
-    // If a KeyFrame is already part of the cage, we can just return it
-    if (split_kf->in_bounding_cage()) {
-        return split_kf;
+    // Unit tangent of the smoothed skeleton at every vertex, the same direction a KeyFrame split there faces
+    Eigen::MatrixXd tangents(num_vertices, 3);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (int i = int(begin); i < int(end); i++) {
+            const int prev = std::max(i - 1, 0), next = std::min(i + 1, num_vertices - 1);
+            tangents.row(i) = (SV_smooth.row(next) - SV_smooth.row(prev)).normalized();
+        }
+    }, KEYFRAMES_PER_CHUNK);
+    const double cos_max_turn = std::cos(max_turn_angle);
+
+    // Every round checks all the Cells in parallel and then splits the failing ones from left to right,
+    // which keeps the KeyFrames transported from their left neighbours as insert_internal() expects
+    int num_inserted = 0;
+    std::vector<int> splits;
+    while (num_keyframes() < max_keyframes) {
+        const int num_cells = this->num_cells();
+        splits.assign(num_cells, -1);
+        parallel_for_chunks(std::size_t(num_cells), [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (int c = int(begin); c < int(end); c++) {
+                const KeyFrame& left_kf = _keyframes[c];
+                const KeyFrame& right_kf = _keyframes[c + 1];
+                const int first = int(left_kf.index()) + 1, last = int(right_kf.index()) - 1;
+                if (first > last) {
+                    continue;
+                }
+
+                const Eigen::RowVector3d left_n = left_kf.normal(), right_n = right_kf.normal();
+                bool turns = false;
+                double max_turn = -1.0;
+                int turn_vertex = -1;
+                for (int v = first; v <= last; v++) {
+                    const double cos_left = tangents.row(v).dot(left_n);
+                    const double cos_right = tangents.row(v).dot(right_n);
+                    turns = turns || std::min(cos_left, cos_right) < cos_max_turn;
+                    const double turn = 1.0 - std::max(cos_left, cos_right);
+                    if (turn > max_turn) {
+                        max_turn = turn;
+                        turn_vertex = v;
+                    }
+                }
+                if (turns) {
+                    splits[c] = turn_vertex;
+                } else if (!skeleton_in_cell(c)) {
+                    splits[c] = first + (last - first) / 2;
+                }
+            }
+        }, 16);
+
+        int num_round = 0;
+        for (int c = 0; c < num_cells && num_keyframes() < max_keyframes; c++) {
+            if (splits[c] < 0) {
+                continue;
+            }
+            if (insert_internal(skeleton_keyframe(c + num_round, splits[c])) < 0) {
+                logger->error("Failed to split Cell {} at skeleton vertex {} while fitting KeyFrames", c, splits[c]);
+                return num_inserted + num_round;
+            }
+            num_round += 1;
+        }
+        num_inserted += num_round;
+        if (num_round == 0) {
+            break;
+        }
     }
 
-    // Otherwise, the KeyFrame has not been inserted
-    // into the BoundingCage, so insert it.
-    assert("KeyFrame cells not equal" && split_kf->left_cell() == split_kf->right_cell());
-    std::shared_ptr<Cell> cell(left_cell);
-    if (!cell->split(split_kf)) {
-        logger->error("Failed to split Cell with KeyFrame.");
-        assert(false);
-        return std::shared_ptr<KeyFrame>();
+    if (num_keyframes() >= max_keyframes) {
+        logger->warn("Stopped fitting KeyFrames at the limit of {} KeyFrames", max_keyframes);
+    }
+    logger->info("Inserted {} KeyFrames, the cage has {} KeyFrames", num_inserted, num_keyframes());
+    return num_inserted;
+}
+
+int BoundingCage::insert_internal(const KeyFrame& split_kf) {
+    const int left = find_cell(split_kf.index());
+    if (left < 0) {
+        logger->error("index of keyframe ({}) in insert_internal(), was out of range ({}, {})",
+                      split_kf.index(), min_index(), max_index());
+        assert("split index is out of range" && false);
+        return -1;
     }
 
-    // If we split the head or tail of the Cell list, then update those pointers
-    if (left_cell == cells.head) {
-        cells.head = left_cell->_left_child;
+    // The cage has already been split at this index
+    if (_keyframes[left].index() == split_kf.index()) {
+        return left;
     }
-    if (right_cell == cells.tail) {
-        cells.tail = right_cell->_right_child;
+    if (_keyframes[left + 1].index() == split_kf.index()) {
+        return left + 1;
     }
 
-    _num_keyframes += 1;
-    split_kf->_in_cage = true;
-    return split_kf;
+    const int position = left + 1;
+    _keyframes.insert(_keyframes.begin() + position, split_kf);
+    KeyFrame& kf = _keyframes[position];
+    kf._cage = this;
+    kf._in_cage = true;
+    kf.update_cached_geometry();
+
+    // If we added a cell with a different normal than the left key-frame, we need to recompute the
+    // the local coordinate frame of the right keyframe
+    KeyFrame& right_kf = _keyframes[position + 1];
+    right_kf._orientation = parallel_transport(kf._orientation, right_kf._orientation.row(2));
+    right_kf.update_cached_geometry();
+
+    return position;
 }
 
 BoundingCage::KeyFrameIterator BoundingCage::insert_keyframe(double index) {
-    return KeyFrameIterator(split_internal(keyframe_for_index(index).keyframe));
+    KeyFrameIterator it = keyframe_for_index(index);
+    return insert_keyframe(it);
 }
 
 BoundingCage::KeyFrameIterator BoundingCage::insert_keyframe(BoundingCage::KeyFrameIterator& split_kf) {
-    return KeyFrameIterator(split_internal(split_kf.keyframe));
+    // A KeyFrame which is already part of the cage can just be returned
+    if (!split_kf._detached) {
+        return split_kf;
+    }
+
+    const int position = insert_internal(*split_kf._detached);
+    if (position < 0) {
+        logger->error("Failed to split Cell with KeyFrame.");
+        return KeyFrameIterator();
+    }
+    split_kf = KeyFrameIterator(this, position);
+    return split_kf;
 }
 
 bool BoundingCage::delete_keyframe(KeyFrameIterator& it) {
-    std::shared_ptr<KeyFrame> kf = it.keyframe;
-    if (!kf->in_bounding_cage()) {
-        logger->warn("Cannot remove keyframe at index {} which is not contained in BoundingCage", kf->index());
+    if (!it->in_bounding_cage() || it._detached) {
+        logger->warn("Cannot remove keyframe at index {} which is not contained in BoundingCage", it->index());
         return false;
     }
 
-    if (kf->is_endpoint()) {
+    if (it->is_endpoint()) {
         logger->warn("Cannot remove enpoint KeyFrame");
         return false;
     }
 
-    std::shared_ptr<Cell> next_cell = kf->right_cell();
-    std::shared_ptr<Cell> prev_cell = kf->left_cell();
-    if (!next_cell || !prev_cell) {
-        logger->error("next cell or prev cell was null");
-        assert(false);
-        return false;
-    }
-
-    std::shared_ptr<KeyFrame> next_keyframe = next_cell->_right_keyframe;
-    assert(next_cell);
-    assert(prev_cell);
-
-    prev_cell->_right_keyframe = next_keyframe;
-    next_keyframe->_left_cell = prev_cell;
-
-    std::shared_ptr<Cell> next_parent = next_cell->_parent_cell.lock();
-
-    std::shared_ptr<Cell> update = next_parent;
-    while (update && update->_left_keyframe == kf) {
-        update->_left_keyframe = next_keyframe;
-        update = update->_parent_cell.lock();
-    }
-
-    update = prev_cell->_parent_cell.lock();
-    while(update && update->_right_keyframe == kf) {
-        update->_right_keyframe = next_keyframe;
-        update = update->_parent_cell.lock();
-    }
-
+    // The iterator keeps the deleted KeyFrame, which now lies in the Cell starting at the previous one
+    const int position = it._position;
+    std::shared_ptr<KeyFrame> kf = std::make_shared<KeyFrame>(std::move(_keyframes[position]));
+    _keyframes.erase(_keyframes.begin() + position);
     kf->_in_cage = false;
-    _num_keyframes -= 1;
+    it = KeyFrameIterator(this, position - 1, kf);
     return true;
 }
 
 
+const void BoundingCage::keyframe_depths(std::vector<double>& out_depths) {
+    const int num_kfs = num_keyframes();
+    out_depths.resize(num_kfs);
+    parallel_for_chunks(std::size_t(num_kfs), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            out_depths[i] = i == 0 ? 0.0 : (_keyframes[i].centroid_3d() - _keyframes[i - 1].centroid_3d()).norm();
+        }
+    }, KEYFRAMES_PER_CHUNK);
+    parallel_prefix_sum(out_depths, KEYFRAMES_PER_CHUNK);
+}
+
 const Eigen::MatrixXd BoundingCage::mesh_vertices() {
-    int num_vertices = this->num_keyframes()*4;
-    Eigen::MatrixXd ret (num_vertices, 3);
+    const int num_kfs = num_keyframes();
+    Eigen::MatrixXd ret(num_kfs*4, 3);
+    parallel_for_chunks(std::size_t(num_kfs), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            ret.middleRows<4>(Eigen::Index(i)*4) = _keyframes[i].bounding_box_vertices_3d();
+        }
+    }, KEYFRAMES_PER_CHUNK);
+    return ret;
+}
 
-    int count = 0;
-    for (KeyFrame& kf : this->keyframes) {
-        Eigen::MatrixXd bbox_v = kf.bounding_box_vertices_3d();
+const std::vector<float>& BoundingCage::mesh_vertex_buffer(const Eigen::RowVector3d& scale,
+                                                          int& dirty_begin, int& dirty_end) {
+    const int num_kfs = num_keyframes();
+    if (int(_vertex_buffer_versions.size()) != num_kfs || scale != _vertex_buffer_scale) {
+        _vertex_buffer.assign(std::size_t(num_kfs)*4*3, 0.0f);
+        // No KeyFrame has the stamp 0 once it is in the cage, so every one gets written
+        _vertex_buffer_versions.assign(num_kfs, 0);
+        _vertex_buffer_scale = scale;
+    }
+
+    // Each chunk finds the range of KeyFrames it rewrote, the dirty range spans all of them
+    std::vector<std::pair<int, int>> chunk_dirty(parallel_num_chunks(std::size_t(num_kfs), KEYFRAMES_PER_CHUNK),
+                                                 std::make_pair(num_kfs*4, 0));
+    parallel_for_chunks(std::size_t(num_kfs), [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::pair<int, int>& dirty = chunk_dirty[chunk];
+        for (int i = int(begin); i < int(end); i++) {
+            const KeyFrame& kf = _keyframes[i];
+            if (kf._geometry_version == _vertex_buffer_versions[i]) {
+                continue;
+            }
 
-        ret.row(count++) = bbox_v.row(0);
-        ret.row(count++) = bbox_v.row(1);
-        ret.row(count++) = bbox_v.row(2);
-        ret.row(count++) = bbox_v.row(3);
+            const KeyFrame::BoxVertices3d& V = kf.bounding_box_vertices_3d();
+            float* out = &_vertex_buffer[std::size_t(i)*4*3];
+            for (int v = 0; v < 4; v++) {
+                for (int c = 0; c < 3; c++) {
+                    out[v*3 + c] = float(V(v, c) / scale[c]);
+                }
+            }
+            _vertex_buffer_versions[i] = kf._geometry_version;
+            dirty.first = std::min(dirty.first, i*4);
+            dirty.second = (i + 1)*4;
+        }
+    }, KEYFRAMES_PER_CHUNK);
+    dirty_begin = num_kfs*4;
+    dirty_end = 0;
+    for (const std::pair<int, int>& dirty : chunk_dirty) {
+        dirty_begin = std::min(dirty_begin, dirty.first);
+        dirty_end = std::max(dirty_end, dirty.second);
+    }
+    if (dirty_begin >= dirty_end) {
+        dirty_begin = dirty_end = 0;
     }
 
-    return ret;
+    return _vertex_buffer;
 }
 
 const Eigen::MatrixXi BoundingCage::mesh_faces() const {
@@ -722,34 +811,42 @@ const Eigen::MatrixXi BoundingCage::mesh_faces() const {
 
     Eigen::MatrixXi ret(num_faces, 3);
 
-    int count = 0;
-    ret.row(count++) = Eigen::RowVector3i(0, 1, 2);
-    ret.row(count++) = Eigen::RowVector3i(0, 2, 3);
-    ret.row(count++) = Eigen::RowVector3i(num_vertices-3, num_vertices-4, num_vertices-2);
-    ret.row(count++) = Eigen::RowVector3i(num_vertices-4, num_vertices-1, num_vertices-2);
+    ret.row(0) = Eigen::RowVector3i(0, 1, 2);
+    ret.row(1) = Eigen::RowVector3i(0, 2, 3);
+    ret.row(2) = Eigen::RowVector3i(num_vertices-3, num_vertices-4, num_vertices-2);
+    ret.row(3) = Eigen::RowVector3i(num_vertices-4, num_vertices-1, num_vertices-2);
 
-    for (int kf_i = 0; kf_i < this->num_keyframes()-1; kf_i++) {
-        int kf1[4] = { kf_i*4+0, kf_i*4+1, kf_i*4+2, kf_i*4+3 };
-        int kf2[4] = { (kf_i+1)*4+0, (kf_i+1)*4+1, (kf_i+1)*4+2, (kf_i+1)*4+3 };
+    // The 8 faces of Cell i follow the two caps at row 4 + 8*i
+    parallel_for_chunks(std::size_t(num_cells()), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (int kf_i = int(begin); kf_i < int(end); kf_i++) {
+            int kf1[4] = { kf_i*4+0, kf_i*4+1, kf_i*4+2, kf_i*4+3 };
+            int kf2[4] = { (kf_i+1)*4+0, (kf_i+1)*4+1, (kf_i+1)*4+2, (kf_i+1)*4+3 };
 
-        for (int vi = 0; vi < 4; vi++) {
-            int v1 = kf1[vi], v2 = kf2[(vi+1)%4], v3 = kf1[(vi+1)%4];
-            ret.row(count++) = Eigen::RowVector3i(v1, v2, v3);
+            int count = 4 + 8*kf_i;
+            for (int vi = 0; vi < 4; vi++) {
+                int v1 = kf1[vi], v2 = kf2[(vi+1)%4], v3 = kf1[(vi+1)%4];
+                ret.row(count++) = Eigen::RowVector3i(v1, v2, v3);
 
-            int v4 = kf1[vi], v5 = kf2[vi], v6 = kf2[(vi+1)%4];
-            ret.row(count++) = Eigen::RowVector3i(v4, v5, v6);
+                int v4 = kf1[vi], v5 = kf2[vi], v6 = kf2[(vi+1)%4];
+                ret.row(count++) = Eigen::RowVector3i(v4, v5, v6);
+            }
         }
-    }
+    }, KEYFRAMES_PER_CHUNK);
 
     return ret;
 }
 
 void BoundingCage::serialize(std::vector<char>& buffer) const {
-    std::vector<BoundingCage::KeyFrame> kfs;
-    for (const BoundingCage::KeyFrame& kf : keyframes) {
-        kfs.push_back(kf);
-    }
-    igl::serialize(kfs, "keyframes", buffer);
+    PackedKeyFrames packed;
+    pack_keyframes(packed);
+    igl::serialize(packed.orientations, "keyframes.orientation", buffer);
+    igl::serialize(packed.origins, "keyframes.origin", buffer);
+    igl::serialize(packed.centroids, "keyframes.centroid_2d", buffer);
+    igl::serialize(packed.indices, "keyframes.index", buffer);
+    igl::serialize(packed.angles, "keyframes.angle", buffer);
+    igl::serialize(packed.in_cage, "keyframes.in_cage", buffer);
+    igl::serialize(packed.num_vertices, "keyframes.num_vertices", buffer);
+    igl::serialize(packed.vertices, "keyframes.vertices_2d", buffer);
     igl::serialize(SV, "skeleton_vertices", buffer);
     igl::serialize(SV_smooth, "smooth_skeleton_vertices", buffer);
     igl::serialize(_keyframe_bounding_box, "keyframe_bbox", buffer);
@@ -757,48 +854,168 @@ void BoundingCage::serialize(std::vector<char>& buffer) const {
 
 void BoundingCage::deserialize(const std::vector<char>& buffer) {
     clear();
-    std::vector<BoundingCage::KeyFrame> kfs;
-    igl::deserialize(kfs, "keyframes", buffer);
     igl::deserialize(SV, "skeleton_vertices", buffer);
     igl::deserialize(SV_smooth, "smooth_skeleton_vertices", buffer);
     igl::deserialize(_keyframe_bounding_box, "keyframe_bbox", buffer);
 
-    std::vector<std::shared_ptr<BoundingCage::KeyFrame>> kf_ptrs;
-    for (int i = 0; i < kfs.size(); i++) {
-        std::shared_ptr<BoundingCage::KeyFrame> kf(new BoundingCage::KeyFrame(kfs[i]));
-        kf->_cage = this;
-        kf_ptrs.push_back(kf);
-
-    }
-    std::shared_ptr<BoundingCage::KeyFrame> front_kf = kf_ptrs.front();
-    std::shared_ptr<BoundingCage::KeyFrame> back_kf = kf_ptrs.back();
-    front_kf->_left_cell = std::shared_ptr<Cell>();
-    front_kf->_right_cell = std::shared_ptr<Cell>();
-    back_kf->_left_cell = std::shared_ptr<Cell>();
-    back_kf->_right_cell = std::shared_ptr<Cell>();
-
-    root = Cell::make_cell(front_kf, back_kf, this);
-    cells.head = root;
-    cells.tail = root;
-    keyframes.cage = this;
-    if (!root) {
-        logger->error("BoundingCage deserialize was unable to fit the first Cell");
-        assert(false);
-        exit(EXIT_FAILURE);
-    }
-    cells.head = root;
-    cells.tail = cells.head;
-    _num_keyframes = 2;
-
-    for (int i = 1; i < kfs.size()-1; i++) {
-        std::shared_ptr<BoundingCage::KeyFrame> kf = kf_ptrs[i];
-        kf->_left_cell = kf_ptrs[i-1]->_right_cell;
-        kf->_right_cell = kf->_left_cell;
-        kf->_cage = this;
-        kf->_in_cage = false;
-        if (!split_internal(kf)) {
-            logger->error("BoundingCage deserialize failed to insert keyframe");
+    PackedKeyFrames packed;
+    if (igl::deserialize(packed.indices, "keyframes.index", buffer)) {
+        igl::deserialize(packed.orientations, "keyframes.orientation", buffer);
+        igl::deserialize(packed.origins, "keyframes.origin", buffer);
+        igl::deserialize(packed.centroids, "keyframes.centroid_2d", buffer);
+        igl::deserialize(packed.angles, "keyframes.angle", buffer);
+        igl::deserialize(packed.in_cage, "keyframes.in_cage", buffer);
+        igl::deserialize(packed.num_vertices, "keyframes.num_vertices", buffer);
+        igl::deserialize(packed.vertices, "keyframes.vertices_2d", buffer);
+        if (!unpack_keyframes(packed)) {
+            logger->error("Serialized BoundingCage has inconsistent sizes");
+            clear();
         }
+        return;
     }
+
+    // Older buffers serialized every KeyFrame on its own
+    std::vector<BoundingCage::KeyFrame> kfs;
+    igl::deserialize(kfs, "keyframes", buffer);
+    rebuild_from_keyframes(std::move(kfs));
+}
+
+void BoundingCage::assign(const BoundingCage& other) {
+    if (&other == this) {
+        return;
+    }
+    clear();
+    SV = other.SV;
+    SV_smooth = other.SV_smooth;
+    _keyframe_bounding_box = other._keyframe_bounding_box;
+    rebuild_from_keyframes(other._keyframes);
+}
+
+void BoundingCage::pack_keyframes(PackedKeyFrames& packed) const {
+    const int num_kfs = num_keyframes();
+    packed.orientations.resize(9, num_kfs);
+    packed.origins.resize(3, num_kfs);
+    packed.centroids.resize(2, num_kfs);
+    packed.indices.resize(num_kfs);
+    packed.angles.resize(num_kfs);
+    packed.num_vertices.resize(num_kfs);
+    packed.in_cage.resize(num_kfs);
+    for (int i = 0; i < num_kfs; i++) {
+        const KeyFrame& kf = _keyframes[i];
+        packed.num_vertices[i] = int(kf._vertices_2d.rows());
+    }
+
+    packed.vertices.resize(packed.num_vertices.sum(), 2);
+    int row = 0;
+    for (int i = 0; i < num_kfs; i++) {
+        const KeyFrame& kf = _keyframes[i];
+        packed.orientations.col(i) = Eigen::Map<const Eigen::VectorXd>(kf._orientation.data(), 9);
+        packed.origins.col(i) = kf._origin.transpose();
+        packed.centroids.col(i) = kf._centroid_2d.transpose();
+        packed.indices[i] = kf._index;
+        packed.angles[i] = kf._angle;
+        packed.in_cage[i] = kf._in_cage ? 1 : 0;
+        packed.vertices.middleRows(row, packed.num_vertices[i]) = kf._vertices_2d;
+        row += packed.num_vertices[i];
+    }
+}
+
+bool BoundingCage::unpack_keyframes(const PackedKeyFrames& packed) {
+    const Eigen::Index num_kfs = packed.indices.size();
+    if (packed.orientations.rows() != 9 || packed.origins.rows() != 3 || packed.centroids.rows() != 2 ||
+            packed.orientations.cols() != num_kfs || packed.origins.cols() != num_kfs ||
+            packed.centroids.cols() != num_kfs || packed.angles.size() != num_kfs ||
+            Eigen::Index(packed.in_cage.size()) != num_kfs || packed.num_vertices.size() != num_kfs ||
+            packed.vertices.cols() != 2 || packed.vertices.rows() != packed.num_vertices.sum() ||
+            (num_kfs > 0 && packed.num_vertices.minCoeff() < 0)) {
+        return false;
+    }
+
+    std::vector<BoundingCage::KeyFrame> kfs(num_kfs);
+    int row = 0;
+    for (Eigen::Index i = 0; i < num_kfs; i++) {
+        BoundingCage::KeyFrame& kf = kfs[i];
+        kf._orientation = Eigen::Map<const Eigen::Matrix3d>(packed.orientations.col(i).data());
+        kf._origin = packed.origins.col(i).transpose();
+        kf._centroid_2d = packed.centroids.col(i).transpose();
+        kf._index = packed.indices[i];
+        kf._angle = packed.angles[i];
+        kf._in_cage = packed.in_cage[i] != 0;
+        kf._vertices_2d = packed.vertices.middleRows(row, packed.num_vertices[i]);
+        row += packed.num_vertices[i];
+    }
+
+    rebuild_from_keyframes(std::move(kfs));
+    return true;
 }
 
+void BoundingCage::write_sections(ProjectFileWriter& writer, const std::string& prefix) const {
+    PackedKeyFrames packed;
+    pack_keyframes(packed);
+    writer.add_owned_matrix(prefix + "keyframes.orientation", std::move(packed.orientations));
+    writer.add_owned_matrix(prefix + "keyframes.origin", std::move(packed.origins));
+    writer.add_owned_matrix(prefix + "keyframes.centroid_2d", std::move(packed.centroids));
+    writer.add_owned_matrix(prefix + "keyframes.index", std::move(packed.indices));
+    writer.add_owned_matrix(prefix + "keyframes.angle", std::move(packed.angles));
+    writer.add_owned_vector(prefix + "keyframes.in_cage", std::move(packed.in_cage));
+    writer.add_owned_matrix(prefix + "keyframes.num_vertices", std::move(packed.num_vertices));
+    writer.add_owned_matrix(prefix + "keyframes.vertices_2d", std::move(packed.vertices));
+    writer.add_matrix(prefix + "skeleton_vertices", SV);
+    writer.add_matrix(prefix + "smooth_skeleton_vertices", SV_smooth);
+    writer.add_matrix(prefix + "keyframe_bbox", _keyframe_bounding_box);
+}
+
+bool BoundingCage::read_sections(const ProjectFile& file, const std::string& prefix) {
+    clear();
+
+    PackedKeyFrames packed;
+    bool ok = file.read_matrix(prefix + "keyframes.orientation", packed.orientations) &&
+            file.read_matrix(prefix + "keyframes.origin", packed.origins) &&
+            file.read_matrix(prefix + "keyframes.centroid_2d", packed.centroids) &&
+            file.read_matrix(prefix + "keyframes.index", packed.indices) &&
+            file.read_matrix(prefix + "keyframes.angle", packed.angles) &&
+            file.read_vector(prefix + "keyframes.in_cage", packed.in_cage) &&
+            file.read_matrix(prefix + "keyframes.num_vertices", packed.num_vertices) &&
+            file.read_matrix(prefix + "keyframes.vertices_2d", packed.vertices) &&
+            file.read_matrix(prefix + "skeleton_vertices", SV) &&
+            file.read_matrix(prefix + "smooth_skeleton_vertices", SV_smooth) &&
+            file.read_matrix(prefix + "keyframe_bbox", _keyframe_bounding_box);
+    if (!ok) {
+        logger->error("BoundingCage is missing sections in the project file");
+        clear();
+        return false;
+    }
+
+    if (!unpack_keyframes(packed)) {
+        logger->error("BoundingCage sections in the project file have inconsistent sizes");
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void BoundingCage::rebuild_from_keyframes(std::vector<KeyFrame> kfs) {
+    if (kfs.size() < 2) {
+        // An empty cage was saved, there is nothing to rebuild
+        return;
+    }
+
+    _keyframes = std::move(kfs);
+    for (KeyFrame& kf : _keyframes) {
+        kf._cage = this;
+        kf.logger = logger;
+        kf._in_cage = true;
+    }
+
+    // Inserting the KeyFrames one after the other transports the frame of the back KeyFrame from
+    // the KeyFrame before it, which is the last one inserted
+    if (_keyframes.size() > 2) {
+        KeyFrame& back_kf = _keyframes.back();
+        back_kf._orientation = parallel_transport(_keyframes[_keyframes.size() - 2]._orientation,
+                                                  back_kf._orientation.row(2));
+    }
+
+    for (KeyFrame& kf : _keyframes) {
+        kf.update_cached_geometry();
+    }
+}
@@ -4,12 +4,18 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
 #include <igl/serialize.h>
 
+class ProjectFile;
+class ProjectFileWriter;
+
 class BoundingCage {
 public:
     class KeyFrame;
@@ -20,30 +26,59 @@ public:
 private:
 
     /// Return true if a Cell contains the skeleton vertices corresponding
-    /// to its index range, and false otherwise.
+    /// to its index range, and false otherwise. The Cell is given by the
+    /// position of its left KeyFrame.
     ///
-    bool skeleton_in_cell(std::shared_ptr<Cell> node) const;
+    bool skeleton_in_cell(int left) const;
 
     /// Core method to split the bounding cage using the keyframe.
+    /// Returns the position of the KeyFrame in the cage or -1 on failure.
+    ///
+    int insert_internal(const KeyFrame& kf);
+
+    /// KeyFrame on the skeleton vertex inside the Cell given by the position of its
+    /// left KeyFrame, facing along the smoothed skeleton. Its shape and angle are
+    /// interpolated between the two KeyFrames of the Cell. It is not inserted.
+    ///
+    KeyFrame skeleton_keyframe(int left, int vertex) const;
+
+    /// Position of the left KeyFrame of the Cell containing index,
+    /// or -1 if the index is outside the cage. This is a binary search.
+    ///
+    int find_cell(double index) const;
+
+    /// Rebuild the cage from a list of deserialized KeyFrames ordered by index.
+    /// SV, SV_smooth and the keyframe bounding box must already be set.
+    ///
+    void rebuild_from_keyframes(std::vector<KeyFrame> kfs);
+
+    /// The KeyFrames of the cage as one array per member, with a column per KeyFrame.
+    /// The polygons can have different numbers of vertices so they are concatenated
+    /// and split up again using the vertex counts. This is what gets saved, in the
+    /// project file as well as in serialize().
+    ///
+    struct PackedKeyFrames {
+        Eigen::MatrixXd orientations, origins, centroids, vertices;
+        Eigen::VectorXd indices, angles;
+        Eigen::VectorXi num_vertices;
+        std::vector<std::uint8_t> in_cage;
+    };
+    void pack_keyframes(PackedKeyFrames& packed) const;
+
+    /// Rebuild the cage from packed KeyFrames, returns false if their sizes do not match.
+    /// SV, SV_smooth and the keyframe bounding box must already be set.
     ///
-    std::shared_ptr<KeyFrame> split_internal(std::shared_ptr<KeyFrame> kf);
+    bool unpack_keyframes(const PackedKeyFrames& packed);
 
     /// Skeleton Vertices
     ///
     Eigen::MatrixXd SV;
     Eigen::MatrixXd SV_smooth;
 
-    /// Root node of the Cell tree
-    ///
-    std::shared_ptr<Cell> root;
-
     /// Logger for this class
     /// By default this is the null logger
     std::shared_ptr<spdlog::logger> logger;
 
-    /// Number of keyframes in the bounding cage
-    int _num_keyframes = 0;
-
     Eigen::Vector4d _keyframe_bounding_box;
 
 public:
@@ -60,6 +95,9 @@ public:
         }
 
         this->_keyframe_bounding_box = bbox;
+        for (KeyFrame& kf : _keyframes) {
+            kf.update_cached_geometry();
+        }
         return true;
     }
 
@@ -67,96 +105,58 @@ public:
     /// to their distance along the skeleton of the bounding cage. A Cell's "left" keyframe always
     /// has a smaller index than its "right" keyframe.
     ///
-    /// A Cell can be split into two cells by adding a keyframe in the middle of the Cell whose
-    /// index lies between the "left" and "right" keyframes.
-    ///
-    /// Cells are organized in a binary tree structure, so splitting a cell creates two
-    /// child cells. The leaf nodes of the binary tree are the set of all prisms making up
-    /// the bounding cage. These leaves are organized in a linked-list ordered by keyframe
-    /// index.
+    /// The KeyFrames of the cage are stored contiguously in index order and Cells are implied
+    /// by adjacency: Cell i is the prism between KeyFrames i and i+1. A Cell is split into two
+    /// cells by inserting a keyframe whose index lies between its "left" and "right" keyframes.
     ///
-    /// Cells do not expose any public methods which can mutate the class and thus, can be
-    /// considered immutable.
+    /// A Cell is a view of the cage which stays valid until a KeyFrame is inserted or deleted.
+    /// Cells do not expose any public methods which can mutate the cage.
     ///
-    class Cell : public std::enable_shared_from_this<Cell> {
+    class Cell {
         friend class BoundingCage;
+        friend class CellIterator;
 
         /// Reference to the owning BoundingCage
-        const BoundingCage* _cage;
+        BoundingCage* _cage = nullptr;
 
-        /// A Cell is a binary tree and can contain sub-Cells
-        ///
-        std::shared_ptr<Cell> _left_child;
-        std::shared_ptr<Cell> _right_child;
-
-        /// Parent cell in the tree
-        ///
-        std::weak_ptr<Cell> _parent_cell;
+        /// Position of the left KeyFrame in the cage
+        int _position = -1;
 
+        Cell(BoundingCage* cage, int position) : _cage(cage), _position(position) {}
 
-        /// The "left" and "right" KeyFrames. The left has a smaller index than the right.
-        ///
-        std::shared_ptr<KeyFrame> _left_keyframe;
-        std::shared_ptr<KeyFrame> _right_keyframe;
-
-        /// Split the Cell into two cells divided by key_frame.
-        /// If the index of key_frame is outside the cell, this method
-        /// returns false and the Cell remains unchanged.
-        ///
-        std::shared_ptr<KeyFrame> split(std::shared_ptr<KeyFrame> key_frame);
-        /// Find the cell for the given index
-        ///
-        std::shared_ptr<Cell> find(double index);
-
-        /// Returns true if the cell is a leaf node
-        ///
-        bool is_leaf() const { return !_left_child && !_right_child; }
-
-        /// Logger for this class
-        ///
-        std::shared_ptr<spdlog::logger> logger;
-
-        /// Construct a new Cell. Don't call this directly, instead use the factory
-        /// function `make_cell()`.
+    public:
+        /// The 8 corners of the prism, the left KeyFrame's box followed by the right one's, and its
+        /// 12 triangles. They have a fixed size so building them for every Cell does not allocate.
         ///
-        Cell(std::shared_ptr<KeyFrame> left_kf, std::shared_ptr<KeyFrame> right_kf,
-             std::weak_ptr<Cell> parent, const BoundingCage* cage);
+        typedef Eigen::Matrix<double, 8, 3> MeshVertices;
+        typedef Eigen::Matrix<int, 12, 3> MeshFaces;
 
-        /// Construct a new Cell wrapped in a shared_ptr. Internally, this method is used
-        /// to create Cells in lieu of the constructor.
-        static std::shared_ptr<Cell> make_cell(std::shared_ptr<BoundingCage::KeyFrame> left_kf,
-                                               std::shared_ptr<BoundingCage::KeyFrame> right_kf,
-                                               const BoundingCage* _cage,
-                                               std::weak_ptr<Cell> _parent_cell=std::shared_ptr<Cell>());
+        Cell() {}
 
-    public:
-        const Eigen::MatrixXi mesh_faces() const;
-        const Eigen::MatrixXd mesh_vertices() const;
+        const MeshFaces& mesh_faces() const;
+        const MeshVertices mesh_vertices() const;
 
-        const KeyFrameIterator left_keyframe() const { return KeyFrameIterator(_left_keyframe); }
-        const KeyFrameIterator right_keyframe() const { return KeyFrameIterator(_right_keyframe); }
-        double min_index() const { return _left_keyframe->index(); }
-        double max_index() const { return _right_keyframe->index(); }
+        const KeyFrameIterator left_keyframe() const { return KeyFrameIterator(_cage, _position); }
+        const KeyFrameIterator right_keyframe() const { return KeyFrameIterator(_cage, _position + 1); }
+        double min_index() const { return _cage->_keyframes[_position].index(); }
+        double max_index() const { return _cage->_keyframes[_position + 1].index(); }
     };
 
-    /// Bidirectional Iterator class used to traverse the linked list of leaf Cells
-    /// in KeyFrame-index order.
+    /// Bidirectional Iterator class used to traverse the Cells in KeyFrame-index order.
     ///
     class CellIterator {
         friend class BoundingCage;
 
-        std::shared_ptr<Cell> cell;
+        Cell cell;
 
-        CellIterator(std::shared_ptr<Cell> c) : cell(c) {}
+        CellIterator(BoundingCage* cage, int position) : cell(cage, position) {}
 
     public:
-        CellIterator(const CellIterator& other) : cell(other.cell) {}
-        CellIterator() : cell(std::shared_ptr<Cell>()) {}
-        CellIterator& operator=(const CellIterator& other) { cell = other.cell; return *this; }
+        CellIterator() {}
 
         CellIterator operator++() {
-            if (cell && cell->_right_keyframe) {
-                cell = cell->_right_keyframe->_right_cell.lock();
+            if (cell._position >= 0) {
+                cell._position = cell._position + 1 < cell._cage->num_cells() ? cell._position + 1 : -1;
             }
             return *this;
         }
@@ -166,8 +166,8 @@ public:
         }
 
         CellIterator operator--() {
-            if (cell && cell->_left_keyframe) {
-                cell = cell->_left_keyframe->_left_cell.lock();
+            if (cell._position >= 0) {
+                cell._position -= 1;
             }
             return *this;
         }
@@ -177,39 +177,53 @@ public:
         }
 
         bool operator==(const CellIterator& other) const {
-            return cell == other.cell;
+            return cell._position == other.cell._position;
         }
 
         bool operator!=(const CellIterator& other) const {
-            return cell != other.cell;
+            return cell._position != other.cell._position;
         }
-        std::shared_ptr<Cell> operator->() {
-            return cell;
+
+        Cell* operator->() {
+            return &cell;
         }
 
         Cell& operator*() {
-            return *cell;
+            return cell;
         }
     };
 
-    /// Linked list of Cell prisms which make up the bounding cage.
-    /// These correspond to the keyframe-index ordered leaf nodes of the Cell tree.
+    /// The Cell prisms which make up the bounding cage, in KeyFrame-index order.
     ///
     class Cells {
         friend class BoundingCage;
 
-        std::shared_ptr<Cell> head;
-        std::shared_ptr<Cell> tail;
+        BoundingCage* cage;
+
     public:
-        CellIterator begin() const { return CellIterator(head); }
+        CellIterator begin() const { return cage->num_cells() > 0 ? CellIterator(cage, 0) : CellIterator(); }
         CellIterator end() const { return CellIterator(); }
-        CellIterator rbegin() const { return CellIterator(tail); }
+        CellIterator rbegin() const {
+            return cage->num_cells() > 0 ? CellIterator(cage, cage->num_cells() - 1) : CellIterator();
+        }
         CellIterator rend() const { return CellIterator(); }
     } cells;
 
     class KeyFrame {
         friend class BoundingCage;
 
+    public:
+        /// The 4 corners of the bounding box of a KeyFrame in 3d, one per row. It is not aligned
+        /// so KeyFrames can be kept in std containers and shared_ptrs.
+        ///
+        typedef Eigen::Matrix<double, 4, 3, Eigen::DontAlign> BoxVertices3d;
+
+        /// The 4 corners of the bounding box of a KeyFrame in its 2d plane, one per row.
+        ///
+        typedef Eigen::Matrix<double, 4, 2, Eigen::DontAlign> BoxVertices2d;
+
+    private:
+
         /// Parallel transport constructor:
         /// The local coordinate frame in this KeyFrame is determined
         /// by transporting the frame from from_kf
@@ -219,7 +233,6 @@ public:
                  const BoundingCage::KeyFrame& from_kf, const double angle,
                  const Eigen::MatrixXd& pts,
                  const Eigen::RowVector2d& centroid,
-                 std::shared_ptr<BoundingCage::Cell> cell,
                  double idx,
                  BoundingCage* cage);
 
@@ -230,14 +243,13 @@ public:
                  const Eigen::Matrix3d& coord_frame, const double angle,
                  const Eigen::MatrixXd& pts,
                  const Eigen::RowVector2d& centroid,
-                 std::shared_ptr<Cell> cell,
                  double idx,
                  BoundingCage *_cage);
 
 
         /// The BoundingCage which owns this KeyFrame
         ///
-        BoundingCage* _cage;
+        BoundingCage* _cage = nullptr;
 
         /// State representing the plane for this KeyFrame.
         ///
@@ -261,12 +273,20 @@ public:
         /// Store a torsion angle from -pi/2 to pi/2 radians which we use to interpolate
         double _angle = 0.0;
 
-        /// Pointers to the Cells bounidng this keyframe
+        /// The coordinate frame with the torsion rotation applied and the 3d corners of the
+        /// bounding box. These are recomputed by update_cached_geometry() whenever the state
+        /// above or the keyframe bounding box of the cage changes, so reading them is free.
+        ///
+        Eigen::Matrix3d _orientation_rotated = Eigen::Matrix3d::Identity();
+        BoxVertices3d _bounding_box_vertices_3d = BoxVertices3d::Zero();
+
+        /// Stamp taken from the cage every time the cached geometry is recomputed. Two KeyFrames
+        /// with the same stamp have the same geometry, which is how the cage finds the parts of
+        /// its vertex buffer to rewrite.
         ///
-        std::weak_ptr<Cell> _left_cell;
-        std::weak_ptr<Cell> _right_cell;
-        std::shared_ptr<Cell> left_cell() const { return _left_cell.lock(); }
-        std::shared_ptr<Cell> right_cell() const { return _right_cell.lock(); }
+        std::uint64_t _geometry_version = 0;
+
+        void update_cached_geometry();
 
         /// Logger for this class
         ///
@@ -290,7 +310,7 @@ public:
         /// True if this KeyFrame is at one of the endpoints of its BoundingCage
         ///
         bool is_endpoint() const {
-            return in_bounding_cage() && (!left_cell() || !right_cell());
+            return in_bounding_cage() && (this == &_cage->_keyframes.front() || this == &_cage->_keyframes.back());
         }
 
         /// Get the normal of the plane of this KeyFrame.
@@ -349,9 +369,8 @@ public:
         /// 2d positions, (x, y), of this keyframe represent coefficients
         /// along the first and second rows of this system.
         ///
-        const Eigen::Matrix3d orientation_rotated() const {
-            Eigen::AngleAxisd R(-_angle, _orientation.row(2));
-            return (R *_orientation.transpose()).transpose();
+        const Eigen::Matrix3d& orientation_rotated() const {
+            return _orientation_rotated;
         }
 
         /// Get the coordinate frame of this keyframe without the torsion
@@ -390,25 +409,15 @@ public:
         /// Get the 3d positions of the bounding box for this keyframe without
         /// applying the torsion rotation
         ///
-        const Eigen::MatrixXd bounding_box_vertices_3d() const {
-            Eigen::MatrixXd ret(4, 3);
-            Eigen::RowVector4d bbox = _cage->keyframe_bounding_box();
-            double min_u = bbox[0], max_u = bbox[1], min_v = bbox[2], max_v = bbox[3];
-            ret.row(0) = right_rotated_3d()*min_u + up_rotated_3d()*min_v;
-            ret.row(1) = right_rotated_3d()*max_u + up_rotated_3d()*min_v;
-            ret.row(2) = right_rotated_3d()*max_u + up_rotated_3d()*max_v;
-            ret.row(3) = right_rotated_3d()*min_u + up_rotated_3d()*max_v;
-
-            ret.rowwise() += centroid_3d();
-
-            return ret;
+        const BoxVertices3d& bounding_box_vertices_3d() const {
+            return _bounding_box_vertices_3d;
         }
 
         /// Get the 2d positions of the bounding box for this keyframe
         /// without applying the torsion rotation
         /// TODO: Maybe kill this
-        const Eigen::MatrixXd bounding_box_vertices_2d() const {
-            Eigen::MatrixXd ret(4, 2);
+        const BoxVertices2d bounding_box_vertices_2d() const {
+            BoxVertices2d ret;
             const Eigen::RowVector4d bbox = _cage->keyframe_bounding_box();
             const double min_u = bbox[0], max_u = bbox[1], min_v = bbox[2], max_v = bbox[3];
             ret << min_u, min_v,
@@ -423,8 +432,8 @@ public:
         /// Get the 2d positions of the bounding box for this keyframe rotated
         /// by the torsion angle
         ///
-        const Eigen::MatrixXd bounding_box_vertices_rotated_2d() const {
-            Eigen::MatrixXd ret(4, 2);
+        const BoxVertices2d bounding_box_vertices_rotated_2d() const {
+            BoxVertices2d ret;
             const Eigen::RowVector2d r = right_rotated_2d();
             const Eigen::RowVector2d u = up_rotated_2d();
 
@@ -444,6 +453,13 @@ public:
             return Eigen::RowVector2d(right_rotated_2d().dot(v), up_rotated_2d().dot(v));
         }
 
+        /// Changes every time the geometry of this KeyFrame in the cage changes, so callers
+        /// can tell which parts of their own buffers are out of date.
+        ///
+        std::uint64_t geometry_version() const {
+            return _geometry_version;
+        }
+
         /// Get the index value of this KeyFrame.
         ///
         const double index() const {
@@ -457,6 +473,7 @@ public:
 
         bool bump(double amount) {
             this->_origin += amount * this->normal();
+            update_cached_geometry();
             return true;
         }
 
@@ -473,31 +490,44 @@ public:
         bool set_angle(double angle);
     };
 
-    /// Bidirectional Iterator class used to traverse the linked list of KeyFrames
-    /// in index order.
+    /// Bidirectional Iterator class used to traverse the KeyFrames in index order.
+    ///
+    /// Like the iterators of a std::vector, inserting or deleting a KeyFrame invalidates the
+    /// iterators to the KeyFrames of the cage, except for the one passed to insert_keyframe() or
+    /// delete_keyframe(). An iterator to a KeyFrame which is not in the cage, as returned by
+    /// keyframe_for_index(), owns its KeyFrame and steps to the KeyFrames of its Cell.
     ///
     class KeyFrameIterator {
         friend class BoundingCage;
+        friend class Cell;
+
+        BoundingCage* _cage = nullptr;
 
-        std::shared_ptr<KeyFrame> keyframe;
+        /// Position of the KeyFrame in the cage, or of the left KeyFrame of its Cell if the
+        /// KeyFrame is not in the cage. The end iterator has position -1.
+        int _position = -1;
 
-        KeyFrameIterator(std::shared_ptr<KeyFrame> kf) : keyframe(kf) {}
+        /// KeyFrame which is not in the cage
+        std::shared_ptr<KeyFrame> _detached;
+
+        KeyFrameIterator(BoundingCage* cage, int position, std::shared_ptr<KeyFrame> detached = nullptr) :
+            _cage(cage), _position(position), _detached(std::move(detached)) {}
+
+        KeyFrame* get() const { return _detached ? _detached.get() : &_cage->_keyframes[_position]; }
 
     public:
-        KeyFrameIterator(const KeyFrameIterator& other) : keyframe(other.keyframe) {}
-        KeyFrameIterator() : keyframe(std::shared_ptr<KeyFrame>()) {}
-        KeyFrameIterator& operator=(const KeyFrameIterator& other) { if (&other != this) { keyframe = other.keyframe; } return *this; }
+        KeyFrameIterator() {}
 
         KeyFrameIterator operator++() {
-            if (!keyframe) {
+            if (_position < 0) {
                 return *this;
             }
 
-            std::shared_ptr<Cell> right_cell = keyframe->_right_cell.lock();
-            if (keyframe && right_cell) {
-                keyframe = right_cell->_right_keyframe;
-            } else if(!right_cell) {
-                keyframe.reset();
+            if (_detached) {
+                _detached.reset();
+                _position += 1;
+            } else {
+                _position = _position + 1 < _cage->num_keyframes() ? _position + 1 : -1;
             }
             return *this;
         }
@@ -507,15 +537,14 @@ public:
         }
 
         KeyFrameIterator operator--() {
-            if (!keyframe) {
+            if (_position < 0) {
                 return *this;
             }
 
-            std::shared_ptr<Cell> left_cell = keyframe->_left_cell.lock();
-            if (keyframe && left_cell) {
-                keyframe = left_cell->_left_keyframe;
-            } else if(!left_cell) {
-                keyframe.reset();
+            if (_detached) {
+                _detached.reset();
+            } else {
+                _position -= 1;
             }
             return *this;
         }
@@ -525,37 +554,32 @@ public:
         }
 
         bool operator==(const KeyFrameIterator& other) const {
-            return keyframe == other.keyframe;
+            return _position == other._position && _detached == other._detached;
         }
 
         bool operator!=(const KeyFrameIterator& other) const {
-            return keyframe != other.keyframe;
+            return !(*this == other);
         }
 
-        std::shared_ptr<KeyFrame> operator->() const {
-            return keyframe;
+        KeyFrame* operator->() const {
+            return get();
         }
 
-        KeyFrame& operator*() {
-            return *keyframe;
+        KeyFrame& operator*() const {
+            return *get();
         }
     };
 
-    /// Linked list of KeyFrames ordered by index.
-    /// This list is built upon the Cell leaf-list described above.
+    /// The KeyFrames of the cage ordered by index.
     ///
     class KeyFrames {
         friend class BoundingCage;
 
-        const BoundingCage* cage;
+        BoundingCage* cage;
 
     public:
         KeyFrameIterator begin() const {
-            if(cage->cells.head) {
-                return KeyFrameIterator(cage->cells.head->_left_keyframe);
-            } else {
-                return KeyFrameIterator();
-            }
+            return cage->num_keyframes() > 0 ? KeyFrameIterator(cage, 0) : KeyFrameIterator();
         }
 
         KeyFrameIterator end() const {
@@ -563,11 +587,7 @@ public:
         }
 
         KeyFrameIterator rbegin() const {
-            if(cage->cells.tail) {
-                return KeyFrameIterator(cage->cells.tail->_right_keyframe);
-            } else {
-                return KeyFrameIterator();
-            }
+            return cage->num_keyframes() > 0 ? KeyFrameIterator(cage, cage->num_keyframes() - 1) : KeyFrameIterator();
         }
 
         KeyFrameIterator rend() const {
@@ -576,9 +596,28 @@ public:
 
     } keyframes;
 
+private:
+
+    /// KeyFrames of the cage, sorted by index. Cell i lies between KeyFrames i and i+1.
+    ///
+    std::vector<KeyFrame> _keyframes;
+
+    /// Stamps handed out to KeyFrames when their cached geometry changes
+    ///
+    std::uint64_t _next_geometry_version = 0;
+
+    /// State of mesh_vertex_buffer(): the buffer, the geometry stamp of the KeyFrame each group
+    /// of 4 vertices was written from, and the scale they were divided by
+    ///
+    std::vector<float> _vertex_buffer;
+    std::vector<std::uint64_t> _vertex_buffer_versions;
+    Eigen::RowVector3d _vertex_buffer_scale = Eigen::RowVector3d::Zero();
+
+public:
 
     BoundingCage() {
         keyframes.cage = this;
+        cells.cage = this;
     }
 
     void set_logger(std::shared_ptr<spdlog::logger> logger) {
@@ -589,43 +628,54 @@ public:
     friend class Cell;
 
     const int num_keyframes() const {
-        return _num_keyframes;
+        return int(_keyframes.size());
     }
 
     const int num_cells() const {
-        return _num_keyframes - 1;
+        return std::max(num_keyframes() - 1, 0);
     }
 
-    const void keyframe_depths(std::vector<double>& out_depths) {
-        out_depths.reserve(num_keyframes());
-        out_depths.clear();
-        Eigen::RowVector3d last_centroid = keyframes.begin()->centroid_3d();
-        double total_dist = 0.0;
-        for (const BoundingCage::KeyFrame& kf : keyframes) {
-            total_dist += (kf.centroid_3d() - last_centroid).norm();
-            last_centroid = kf.centroid_3d();
-            out_depths.push_back(total_dist);
-        }
+    /// KeyFrame i of the cage, without going through an iterator. Reading different KeyFrames from
+    /// several threads is fine as long as the cage does not change.
+    ///
+    const KeyFrame& keyframe(int i) const {
+        return _keyframes[i];
     }
 
+    /// Distance along the skeleton from the first KeyFrame to each KeyFrame, a prefix sum over the
+    /// distances between consecutive centroids
+    ///
+    const void keyframe_depths(std::vector<double>& out_depths);
+
     void serialize(std::vector<char>& buffer) const;
     void deserialize(const std::vector<char>& buffer);
 
+    /// Write the cage into a binary project file. The KeyFrames are packed into one
+    /// array per member so they can be read back without parsing each KeyFrame.
+    ///
+    void write_sections(ProjectFileWriter& writer, const std::string& prefix) const;
+    bool read_sections(const ProjectFile& file, const std::string& prefix);
+
     /// Set the skeleton vertices to whatever the user provides.
     /// There must be at least two vertices, if not the method returns false.
-    /// Upon setting the vertices, The
+    /// The smoothed skeleton is a regularized least squares fit to them with
+    /// the ends fixed, as smooth as smoothing_iters passes of neighbor
+    /// averaging, solved directly in one linear pass.
     ///
     bool set_skeleton_vertices(const Eigen::MatrixXd& new_SV,
                                unsigned smoothing_iters,
                                const Eigen::Vector4d& bounding_box);
 
+    /// Make this cage a copy of other. The KeyFrames point to other, so a cage
+    /// built somewhere else (e.g. loaded on another thread) is brought in with
+    /// this rather than with the copy constructor.
+    ///
+    void assign(const BoundingCage& other);
+
     /// Clear the bounding cage and skeleton vertices
     ///
     void clear() {
-        _num_keyframes = 0;
-        root.reset();
-        cells.head.reset();
-        cells.tail.reset();
+        _keyframes.clear();
         SV.resize(0, 0);
         SV_smooth.resize(0, 0);
     }
@@ -637,7 +687,18 @@ public:
     KeyFrameIterator insert_keyframe(double index);
     KeyFrameIterator insert_keyframe(KeyFrameIterator& it);
 
-    /// Delete a KeyFrame in the BoundingCage.
+    /// Insert KeyFrames along the smoothed skeleton until no Cell turns by more
+    /// than max_turn_angle radians between the skeleton and either of its
+    /// KeyFrames, and every Cell contains its skeleton vertices. The Cells are
+    /// checked in parallel and each failing one is split at the skeleton vertex
+    /// turned furthest from both its KeyFrames, so bends get dense KeyFrames and
+    /// straight runs keep long Cells. The cage stops growing at max_keyframes.
+    /// Returns the number of KeyFrames inserted.
+    ///
+    int fit_keyframes(double max_turn_angle, int max_keyframes = 4096);
+
+    /// Delete a KeyFrame in the BoundingCage. Afterwards it points to a copy of the
+    /// deleted KeyFrame which is no longer in the cage, so incrementing it gives the next KeyFrame.
     /// If the KeyFrame is not inserted, this method returns false
     ///
     bool delete_keyframe(KeyFrameIterator& it);
@@ -654,29 +715,35 @@ public:
     const Eigen::MatrixXd mesh_vertices();
     const Eigen::MatrixXi mesh_faces() const;
 
+    /// The vertices of mesh_vertices() divided by scale, packed as x, y, z floats for a vertex
+    /// buffer. The buffer is kept between calls and only the KeyFrames whose geometry changed
+    /// since the last call are written again. The vertices [dirty_begin, dirty_end) are the ones
+    /// which differ from the previous call (all of them if the number of KeyFrames or the scale
+    /// changed), so only that range has to be uploaded again.
+    ///
+    const std::vector<float>& mesh_vertex_buffer(const Eigen::RowVector3d& scale, int& dirty_begin, int& dirty_end);
+
     /// Get the minimum keyframe index
     ///
     double min_index() const {
-        if(!root) {
+        if(_keyframes.empty()) {
             return 0.0;
         }
-        assert(root->min_index() == cells.head->min_index());
-        return root->min_index();
+        return _keyframes.front().index();
     }
 
     /// Get the maximum keyframe index
     ///
     double max_index() const {
-        if(!root) {
+        if(_keyframes.empty()) {
             return 0.0;
         }
-        assert(root->max_index() == cells.tail->max_index());
-        return root->max_index();
+        return _keyframes.back().index();
     }
 
     /// Get a KeyFrame at the specified index.
     /// The KeyFrame may not yet be inserted into the bounding cage.
-    /// To insert it, call split()
+    /// To insert it, call insert_keyframe()
     ///
     KeyFrameIterator keyframe_for_index(double index) const;
 };
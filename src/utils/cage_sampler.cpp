@@ -0,0 +1,156 @@
+#include "cage_sampler.h"
+
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+
+#include <algorithm>
+
+
+namespace {
+
+CageSampler::Frame keyframe_to_frame(const BoundingCage::KeyFrameIterator& kf) {
+    CageSampler::Frame frame;
+    frame.orientation_rotated = kf->orientation_rotated();
+    frame.centroid_3d = kf->centroid_3d();
+    const BoundingCage::KeyFrame::BoxVertices3d& V = kf->bounding_box_vertices_3d();
+    for (int c = 0; c < 4; c++) {
+        frame.bounding_box_vertices_3d[c] = V.row(c);
+    }
+    frame.angle = kf->angle();
+    frame.index = kf->index();
+    return frame;
+}
+
+} // namespace
+
+
+void CageSampler::build(const BoundingCage& cage) {
+    clear();
+    const Eigen::Vector4d bbox = cage.keyframe_bounding_box();
+    _min_u = bbox[0];
+    _max_u = bbox[1];
+    _min_v = bbox[2];
+    _max_v = bbox[3];
+
+    _cells.reserve(std::max(cage.num_cells(), 0));
+    _max_indices.reserve(std::max(cage.num_cells(), 0));
+    for (const BoundingCage::Cell& cell : cage.cells) {
+        const BoundingCage::KeyFrameIterator lkf = cell.left_keyframe();
+        const BoundingCage::KeyFrameIterator rkf = cell.right_keyframe();
+
+        CellFrames c;
+        c.min_index = cell.min_index();
+        c.max_index = cell.max_index();
+        const BoundingCage::KeyFrame::BoxVertices3d& LV = lkf->bounding_box_vertices_3d();
+        const BoundingCage::KeyFrame::BoxVertices3d& RV = rkf->bounding_box_vertices_3d();
+        for (int i = 0; i < 4; i++) {
+            c.left_vertices[i] = LV.row(i);
+            c.right_vertices[i] = RV.row(i);
+        }
+        c.left_origin = lkf->origin();
+        c.right_origin = rkf->origin();
+        c.left_normal = lkf->normal();
+        c.right_normal = rkf->normal();
+        c.left_orientation = lkf->orientation();
+        c.left_centroid_2d[0] = lkf->centroid_2d()[0];
+        c.left_centroid_2d[1] = lkf->centroid_2d()[1];
+        c.right_centroid_2d[0] = rkf->centroid_2d()[0];
+        c.right_centroid_2d[1] = rkf->centroid_2d()[1];
+        c.left_angle = lkf->angle();
+        c.right_angle = rkf->angle();
+        c.left_frame = keyframe_to_frame(lkf);
+        c.right_frame = keyframe_to_frame(rkf);
+
+        _cells.push_back(c);
+        _max_indices.push_back(c.max_index);
+    }
+}
+
+int CageSampler::find_cell(double index, int hint) const {
+    if (empty() || index < min_index() || index > max_index()) {
+        return -1;
+    }
+    // Indices usually increase from one query to the next, so check the last cell and its successor first
+    if (hint >= 0 && hint < int(_cells.size())) {
+        if (index >= _cells[hint].min_index && index <= _cells[hint].max_index) {
+            return hint;
+        }
+        if (hint + 1 < int(_cells.size()) && index >= _cells[hint + 1].min_index && index <= _cells[hint + 1].max_index) {
+            return hint + 1;
+        }
+    }
+    return int(std::lower_bound(_max_indices.begin(), _max_indices.end(), index) - _max_indices.begin());
+}
+
+void CageSampler::interpolate(const CellFrames& cell, double index, Frame& out) const {
+    // On a cell boundary keyframe_for_index returns the KeyFrame itself
+    if (index == cell.min_index) {
+        out = cell.left_frame;
+        return;
+    } else if (index == cell.max_index) {
+        out = cell.right_frame;
+        return;
+    }
+
+    const double coeff = (index - cell.min_index) / (cell.max_index - cell.min_index);
+    const Eigen::RowVector3d origin = (1.0-coeff)*cell.left_origin + coeff*cell.right_origin;
+
+    // The plane normal is the right singular vector of the smallest singular value of the centered
+    // corners, i.e. the eigenvector of the smallest eigenvalue of their 3x3 scatter matrix
+    Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+    for (int c = 0; c < 4; c++) {
+        const Eigen::RowVector3d a = (1.0-coeff)*cell.left_vertices[c] + coeff*cell.right_vertices[c] - origin;
+        scatter += a.transpose() * a;
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver;
+    eigen_solver.computeDirect(scatter);
+    Eigen::RowVector3d n = eigen_solver.eigenvectors().col(0).transpose();
+    if (n.dot(cell.left_normal) < 0.0 || n.dot(cell.right_normal) < 0.0) {
+        n *= -1.0;
+    }
+
+    // Parallel transport the frame of the left KeyFrame to the new normal
+    const Eigen::RowVector3d left_normal = cell.left_orientation.row(2);
+    const Eigen::Matrix3d R = Eigen::Quaterniond::FromTwoVectors(left_normal.normalized(), n.normalized()).matrix();
+    Eigen::Matrix3d coord_frame = (R*cell.left_orientation.transpose()).transpose();
+    for (int i = 0; i < 3; i++) { coord_frame.row(i) /= coord_frame.row(i).norm(); }
+
+    const double angle = (1.0-coeff)*cell.left_angle + coeff*cell.right_angle;
+    const double cx = (1.0-coeff)*cell.left_centroid_2d[0] + coeff*cell.right_centroid_2d[0];
+    const double cy = (1.0-coeff)*cell.left_centroid_2d[1] + coeff*cell.right_centroid_2d[1];
+
+    const Eigen::AngleAxisd torsion(-angle, coord_frame.row(2).transpose());
+    out.orientation_rotated = (torsion*coord_frame.transpose()).transpose();
+    out.centroid_3d = origin + coord_frame.row(0)*cx + coord_frame.row(1)*cy;
+
+    const Eigen::RowVector3d right = out.orientation_rotated.row(0);
+    const Eigen::RowVector3d up = out.orientation_rotated.row(1);
+    out.bounding_box_vertices_3d[0] = out.centroid_3d + right*_min_u + up*_min_v;
+    out.bounding_box_vertices_3d[1] = out.centroid_3d + right*_max_u + up*_min_v;
+    out.bounding_box_vertices_3d[2] = out.centroid_3d + right*_max_u + up*_max_v;
+    out.bounding_box_vertices_3d[3] = out.centroid_3d + right*_min_u + up*_max_v;
+    out.angle = angle;
+    out.index = index;
+}
+
+bool CageSampler::sample(double index, Frame& out) const {
+    const int cell = find_cell(index, -1);
+    if (cell < 0) {
+        return false;
+    }
+    interpolate(_cells[cell], index, out);
+    return true;
+}
+
+bool CageSampler::sample(const std::vector<double>& indices, std::vector<Frame>& out) const {
+    out.resize(indices.size());
+    int cell = -1;
+    for (std::size_t i = 0; i < indices.size(); i++) {
+        cell = find_cell(indices[i], cell);
+        if (cell < 0) {
+            return false;
+        }
+        interpolate(_cells[cell], indices[i], out[i]);
+    }
+    return true;
+}
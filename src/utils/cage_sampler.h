@@ -0,0 +1,66 @@
+#ifndef CAGE_SAMPLER_H
+#define CAGE_SAMPLER_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+#include "bounding_cage.h"
+
+// Evaluates the interpolated KeyFrames of a BoundingCage at arbitrary fractional indices.
+// BoundingCage::keyframe_for_index runs an SVD and allocates a new KeyFrame on every call. The
+// sampler copies what it reads from the Cells into an array once and computes the same frames in
+// closed form, so exporting thousands of slices costs no allocations.
+//
+// The sampler is a snapshot, it has to be rebuilt whenever the cage changes.
+class CageSampler {
+public:
+    struct Frame {
+        // Rows are the right, up and normal directions with the torsion rotation applied
+        Eigen::Matrix3d orientation_rotated;
+        Eigen::RowVector3d centroid_3d;
+        // Corners of the keyframe bounding box, in the order ll, lr, ur, ul
+        Eigen::RowVector3d bounding_box_vertices_3d[4];
+        double angle;
+        double index;
+    };
+
+    CageSampler() = default;
+    explicit CageSampler(const BoundingCage& cage) { build(cage); }
+
+    void build(const BoundingCage& cage);
+    void clear() { _cells.clear(); _max_indices.clear(); }
+
+    bool empty() const { return _cells.empty(); }
+    double min_index() const { return empty() ? 0.0 : _cells.front().min_index; }
+    double max_index() const { return empty() ? 0.0 : _cells.back().max_index; }
+
+    // Same frame as cage.keyframe_for_index(index). Returns false if index lies outside the cage.
+    bool sample(double index, Frame& out) const;
+
+    // Evaluate all indices at once, out is resized to match. Increasing indices (the common case
+    // when slicing the cage) are located by walking the cells instead of searching for each one.
+    bool sample(const std::vector<double>& indices, std::vector<Frame>& out) const;
+
+private:
+    // Everything keyframe_for_index reads from the two KeyFrames bounding a Cell
+    struct CellFrames {
+        double min_index, max_index;
+        Eigen::RowVector3d left_vertices[4], right_vertices[4];
+        Eigen::RowVector3d left_origin, right_origin;
+        Eigen::RowVector3d left_normal, right_normal;
+        Eigen::Matrix3d left_orientation;
+        double left_centroid_2d[2], right_centroid_2d[2];
+        double left_angle, right_angle;
+        Frame left_frame, right_frame;
+    };
+
+    int find_cell(double index, int hint) const;
+    void interpolate(const CellFrames& cell, double index, Frame& out) const;
+
+    std::vector<CellFrames> _cells;
+    std::vector<double> _max_indices;
+    double _min_u = 0.0, _max_u = 0.0, _min_v = 0.0, _max_v = 0.0;
+};
+
+#endif // CAGE_SAMPLER_H
@@ -0,0 +1,77 @@
+#include "content_hash.h"
+
+#include <cstring>
+#include <vector>
+
+#include "parallel_for.h"
+#include "raw_volume_view.h"
+
+
+namespace {
+
+constexpr std::size_t BLOCK_SIZE = std::size_t(1) << 20;
+constexpr std::uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+
+inline std::uint64_t rotl(std::uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t mix(std::uint64_t h, std::uint64_t word) {
+    h ^= rotl(word * PRIME_2, 31) * PRIME_1;
+    return rotl(h, 27) * PRIME_1 + PRIME_2;
+}
+
+inline std::uint64_t avalanche(std::uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME_2;
+    h ^= h >> 29;
+    h *= PRIME_1;
+    h ^= h >> 32;
+    return h;
+}
+
+std::uint64_t hash_block(const std::uint8_t* data, std::size_t size, std::uint64_t seed) {
+    std::uint64_t h = seed ^ (std::uint64_t(size) * PRIME_1);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = mix(h, word);
+    }
+    if (i < size) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, data + i, size - i);
+        h = mix(h, word);
+    }
+    return avalanche(h);
+}
+
+} // namespace
+
+
+std::uint64_t hash_bytes(const std::uint8_t* data, std::size_t size) {
+    const std::size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<std::uint64_t> block_hashes(num_blocks);
+    parallel_for_chunks(num_blocks, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t b = begin; b < end; b++) {
+            const std::size_t offset = b * BLOCK_SIZE;
+            block_hashes[b] = hash_block(data + offset, std::min(BLOCK_SIZE, size - offset), std::uint64_t(b));
+        }
+    }, 4);
+
+    std::uint64_t h = std::uint64_t(size) * PRIME_2;
+    for (std::uint64_t block_hash : block_hashes) {
+        h = mix(h, block_hash);
+    }
+    return avalanche(h);
+}
+
+bool hash_file(const std::string& filename, std::uint64_t& out_hash, std::shared_ptr<spdlog::logger> logger) {
+    RawVolumeView view;
+    if (!view.open(filename, logger)) {
+        return false;
+    }
+    out_hash = hash_bytes(view.data(), view.size());
+    return true;
+}
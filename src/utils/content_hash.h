@@ -0,0 +1,18 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Fast non-cryptographic 64 bit hash used to detect whether a file changed since an expensive result
+// derived from it was cached. The input is hashed in fixed size blocks in parallel and the block hashes
+// are then combined in order, so the result does not depend on the number of threads.
+std::uint64_t hash_bytes(const std::uint8_t* data, std::size_t size);
+
+// Hash the contents of filename, returns false if the file could not be read
+bool hash_file(const std::string& filename, std::uint64_t& out_hash, std::shared_ptr<spdlog::logger> logger);
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,387 @@
+#include "cpu_straightener.h"
+
+#include "cage_sampler.h"
+#include "fishvol.h"
+#include "parallel_for.h"
+#include "raw_volume_view.h"
+#include "trace.h"
+#include "volume_slab_writer.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+constexpr std::size_t STRAIGHTEN_SLAB_BYTES = std::size_t(16) * 1024 * 1024;
+// Slabs straightened and waiting for the disk, once the writer has this many the straightening waits for it
+constexpr std::size_t MAX_QUEUED_SLABS = 4;
+
+// The box [origin, origin + extent) of voxels of a volume_dims sized 8 bit volume
+struct VoxelRegion {
+    const std::uint8_t* data = nullptr;
+    Eigen::RowVector3i origin = Eigen::RowVector3i::Zero();
+    Eigen::RowVector3i extent = Eigen::RowVector3i::Zero();
+    Eigen::RowVector3i volume_dims = Eigen::RowVector3i::Zero();
+};
+
+inline float region_voxel(const VoxelRegion& r, int x, int y, int z) {
+    const std::size_t i = (std::size_t(z - r.origin[2]) * std::size_t(r.extent[1]) + std::size_t(y - r.origin[1])) *
+                          std::size_t(r.extent[0]) + std::size_t(x - r.origin[0]);
+    return float(r.data[i]);
+}
+
+// Trilinear sample at the normalized volume coordinate (u, v, w), same as sample_brick_cache()
+inline float sample_trilinear(const VoxelRegion& r, float u, float v, float w) {
+    if (u < 0.f || v < 0.f || w < 0.f || u >= 1.f || v >= 1.f || w >= 1.f) {
+        return 0.f;
+    }
+
+    const float uvw[3] = { u, v, w };
+    int i0[3], i1[3];
+    float f[3];
+    for (int c = 0; c < 3; c++) {
+        const float p = uvw[c] * float(r.volume_dims[c]) - 0.5f;
+        const float fl = std::floor(p);
+        f[c] = p - fl;
+        i0[c] = std::max(0, std::min(int(fl), r.volume_dims[c] - 1));
+        i1[c] = std::max(0, std::min(int(fl) + 1, r.volume_dims[c] - 1));
+    }
+
+    const float c00 = region_voxel(r, i0[0], i0[1], i0[2]) * (1.f - f[0]) + region_voxel(r, i1[0], i0[1], i0[2]) * f[0];
+    const float c10 = region_voxel(r, i0[0], i1[1], i0[2]) * (1.f - f[0]) + region_voxel(r, i1[0], i1[1], i0[2]) * f[0];
+    const float c01 = region_voxel(r, i0[0], i0[1], i1[2]) * (1.f - f[0]) + region_voxel(r, i1[0], i0[1], i1[2]) * f[0];
+    const float c11 = region_voxel(r, i0[0], i1[1], i1[2]) * (1.f - f[0]) + region_voxel(r, i1[0], i1[1], i1[2]) * f[0];
+    const float c0 = c00 * (1.f - f[1]) + c10 * f[1];
+    const float c1 = c01 * (1.f - f[1]) + c11 * f[1];
+    return c0 * (1.f - f[2]) + c1 * f[2];
+}
+
+// Cubic B-spline at the normalized coordinate uv from 8 trilinear samples, same as sample_tricubic() in the
+// export shader. Along each axis the four B-spline weights are folded into two linear fetches.
+inline float sample_tricubic_bspline(const VoxelRegion& r, const Eigen::RowVector3f& uv) {
+    float h0[3], h1[3], g1[3];
+    for (int c = 0; c < 3; c++) {
+        const float size = float(r.volume_dims[c]);
+        const float coord = uv[c] * size - 0.5f;
+        const float index = std::floor(coord);
+        const float f = coord - index;
+        const float one_f = 1.f - f;
+        const float w0 = one_f * one_f * one_f / 6.f;
+        const float w1 = (3.f * f * f * f - 6.f * f * f + 4.f) / 6.f;
+        const float w3 = f * f * f / 6.f;
+        const float w2 = 1.f - w0 - w1 - w3;
+        const float g0 = w0 + w1;
+        g1[c] = w2 + w3;
+        h0[c] = (index - 1.f + w1 / g0 + 0.5f) / size;
+        h1[c] = (index + 1.f + w3 / g1[c] + 0.5f) / size;
+    }
+
+    float z[2];
+    for (int k = 0; k < 2; k++) {
+        const float w = k == 0 ? h0[2] : h1[2];
+        float y[2];
+        for (int j = 0; j < 2; j++) {
+            const float v = j == 0 ? h0[1] : h1[1];
+            const float x0 = sample_trilinear(r, h0[0], v, w);
+            const float x1 = sample_trilinear(r, h1[0], v, w);
+            y[j] = x0 + (x1 - x0) * g1[0];
+        }
+        z[k] = y[0] + (y[1] - y[0]) * g1[1];
+    }
+    return z[0] + (z[1] - z[0]) * g1[2];
+}
+
+constexpr int MAX_BOX_TAPS = 4;
+
+// Number of taps needed to cover axis, the footprint of one output voxel, at one tap per input voxel
+inline int box_taps(const Eigen::RowVector3f& axis, const Eigen::RowVector3i& dims) {
+    const float voxels = axis.cwiseProduct(dims.cast<float>()).norm();
+    // The tolerance keeps 1:1 exports from picking up a second tap through rounding
+    return std::max(1, std::min(int(std::ceil(voxels - 0.01f)), MAX_BOX_TAPS));
+}
+
+// Average of trilinear taps spread evenly over the parallelepiped spanned by ax, ay and az around uv,
+// same as sample_box() in the export shader
+inline float sample_box(const VoxelRegion& r, const Eigen::RowVector3f& uv,
+                        const Eigen::RowVector3f& ax, const Eigen::RowVector3f& ay, const Eigen::RowVector3f& az) {
+    const int nx = box_taps(ax, r.volume_dims), ny = box_taps(ay, r.volume_dims), nz = box_taps(az, r.volume_dims);
+    float sum = 0.f;
+    for (int k = 0; k < nz; k++) {
+        for (int j = 0; j < ny; j++) {
+            for (int i = 0; i < nx; i++) {
+                const Eigen::RowVector3f p = uv + ax * ((float(i) + 0.5f) / float(nx) - 0.5f) +
+                                                  ay * ((float(j) + 0.5f) / float(ny) - 0.5f) +
+                                                  az * ((float(k) + 0.5f) / float(nz) - 0.5f);
+                sum += sample_trilinear(r, p[0], p[1], p[2]);
+            }
+        }
+    }
+    return sum / float(nx * ny * nz);
+}
+
+// Voxels [begin, end) read by samples anywhere in the normalized box [lo, hi], with margin extra voxels
+// on each side for filters wider than trilinear
+void sampled_voxel_range(const Eigen::RowVector3f& lo, const Eigen::RowVector3f& hi, const Eigen::RowVector3i& dims,
+                         int margin, Eigen::RowVector3i& begin, Eigen::RowVector3i& end) {
+    for (int c = 0; c < 3; c++) {
+        const float l = std::max(0.f, std::min(lo[c], 1.f)) * float(dims[c]) - 0.5f;
+        const float h = std::max(0.f, std::min(hi[c], 1.f)) * float(dims[c]) - 0.5f;
+        // One extra voxel on each side in case rounding moves a sample across a voxel boundary
+        begin[c] = std::max(0, std::min(int(std::floor(l)) - 1 - margin, dims[c] - 1));
+        end[c] = std::max(0, std::min(int(std::floor(h)) + 2 + margin, dims[c] - 1)) + 1;
+    }
+}
+
+// Resample rows [row_begin, row_end) of a w x h slice with normalized corners ll, lr, ur, ul into out. Pixels
+// are sampled at their centers and interpolated over the triangles (ll, lr, ur) and (ll, ur, ul) like the
+// screen filling quad of the slice shader. steps holds the offsets from each corner to the same corner of
+// a neighbouring slice, which the box filter uses as the depth of the output voxel.
+void resample_slice_rows(const Eigen::RowVector3f* corners, const Eigen::RowVector3f* steps, ResampleFilter filter,
+                         const VoxelRegion& region, int w, int h, int row_begin, int row_end, std::uint8_t* out) {
+    const Eigen::RowVector3f& ll = corners[0];
+    const Eigen::RowVector3f& lr = corners[1];
+    const Eigen::RowVector3f& ur = corners[2];
+    const Eigen::RowVector3f& ul = corners[3];
+
+    // Footprint of one output pixel in each triangle, the equivalent of dFdx and dFdy in the shader
+    const Eigen::RowVector3f lower_dx = (lr - ll) / float(w), lower_dy = (ur - lr) / float(h);
+    const Eigen::RowVector3f upper_dx = (ur - ul) / float(w), upper_dy = (ul - ll) / float(h);
+
+    for (int y = row_begin; y < row_end; y++) {
+        const float t = (float(y) + 0.5f) / float(h);
+        // Along a row the coordinate is affine within each triangle, so it advances by a constant step
+        const Eigen::RowVector3f lower_origin = ll + t * (ur - lr);
+        const Eigen::RowVector3f lower_step = lr - ll;
+        const Eigen::RowVector3f upper_origin = ll + t * (ul - ll);
+        const Eigen::RowVector3f upper_step = ur - ul;
+
+        std::uint8_t* row = out + std::size_t(y) * std::size_t(w);
+        for (int x = 0; x < w; x++) {
+            const float s = (float(x) + 0.5f) / float(w);
+            const bool lower = s >= t;
+            const Eigen::RowVector3f uv = lower ? Eigen::RowVector3f(lower_origin + s * lower_step) :
+                                                  Eigen::RowVector3f(upper_origin + s * upper_step);
+            float v = 0.f;
+            if (filter == RESAMPLE_TRICUBIC_BSPLINE) {
+                v = sample_tricubic_bspline(region, uv);
+            } else if (filter == RESAMPLE_BOX_MINIFY) {
+                const Eigen::RowVector3f dz = lower ?
+                            Eigen::RowVector3f(steps[0] + t * (steps[2] - steps[1]) + s * (steps[1] - steps[0])) :
+                            Eigen::RowVector3f(steps[0] + t * (steps[3] - steps[0]) + s * (steps[2] - steps[3]));
+                v = lower ? sample_box(region, uv, lower_dx, lower_dy, dz) : sample_box(region, uv, upper_dx, upper_dy, dz);
+            } else {
+                v = sample_trilinear(region, uv[0], uv[1], uv[2]);
+            }
+            row[x] = std::uint8_t(std::max(0.f, std::min(255.f, v + 0.5f)));
+        }
+    }
+}
+
+// Resample all slabs of the output. fetch_region(lo, hi, margin, region) makes the voxels sampled by the
+// normalized box [lo, hi], plus margin voxels around it, available in region and returns false on errors.
+template <typename FetchRegion>
+bool straighten_slabs(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims, const Eigen::RowVector3i& output_dims,
+                      const StraightenSlabCallback& slab_callback, std::shared_ptr<spdlog::logger> logger,
+                      const StraightenOptions& options, FetchRegion fetch_region) {
+    if (output_dims.minCoeff() <= 0 || cage_volume_dims.minCoeff() <= 0) {
+        logger->error("Cannot straighten into a volume of size {}x{}x{}", output_dims[0], output_dims[1], output_dims[2]);
+        return false;
+    }
+    const int w = output_dims[0], h = output_dims[1], d = output_dims[2];
+
+    std::vector<Eigen::RowVector3f> corners;
+    straightened_slice_corners(cage, d, corners);
+    const Eigen::RowVector3f cage_dims = cage_volume_dims.cast<float>();
+    for (Eigen::RowVector3f& c : corners) {
+        c = c.cwiseQuotient(cage_dims);
+    }
+    const int num_cage_slices = int(corners.size() / 4);
+
+    // Offset from each corner to the same corner of the next slice (the previous one for the last slice)
+    std::vector<Eigen::RowVector3f> steps(corners.size(), Eigen::RowVector3f::Zero());
+    for (int i = 0; num_cage_slices > 1 && i < num_cage_slices; i++) {
+        const int neighbour = i + 1 < num_cage_slices ? i + 1 : i - 1;
+        for (int c = 0; c < 4; c++) {
+            steps[4 * i + c] = corners[4 * neighbour + c] - corners[4 * i + c];
+        }
+    }
+    // Voxels beyond the trilinear footprint read by the wider filters
+    const int margin = options.filter == RESAMPLE_TRICUBIC_BSPLINE ? 2 : 0;
+
+    const std::size_t slice_bytes = std::size_t(w) * std::size_t(h);
+    const int slices_per_slab = options.slices_per_slab > 0 ? std::min(options.slices_per_slab, d) :
+            int(std::max<std::size_t>(1, std::min<std::size_t>(STRAIGHTEN_SLAB_BYTES / slice_bytes, std::size_t(d))));
+    std::vector<std::uint8_t> slab(slice_bytes * std::size_t(slices_per_slab));
+
+    for (int first = 0; first < d; first += slices_per_slab) {
+        const int num_slices = std::min(slices_per_slab, d - first);
+        const int num_sampled = std::max(0, std::min(num_slices, num_cage_slices - first));
+        // Slices past the end of the cage stay empty, like the cleared layers of the export texture
+        std::fill(slab.begin(), slab.begin() + std::ptrdiff_t(slice_bytes) * num_slices, std::uint8_t(0));
+
+        if (num_sampled > 0) {
+            // The coordinate is affine over each triangle, so the corners bound every sample of the slab. The box
+            // filter reaches halfway to the neighbouring slices, so their corners are included as well.
+            const int lo_slice = std::max(first - 1, 0);
+            const int hi_slice = std::min(first + num_sampled + 1, num_cage_slices);
+            Eigen::RowVector3f lo = corners[4 * lo_slice], hi = corners[4 * lo_slice];
+            for (int i = 4 * lo_slice; i < 4 * hi_slice; i++) {
+                lo = lo.cwiseMin(corners[i]);
+                hi = hi.cwiseMax(corners[i]);
+            }
+            VoxelRegion region;
+            if (!fetch_region(lo, hi, margin, region)) {
+                return false;
+            }
+
+            // Split over rows rather than slices so slabs of a few huge slices still use every core
+            const std::size_t num_rows = std::size_t(num_sampled) * std::size_t(h);
+            parallel_for_chunks(num_rows, [&](std::size_t begin, std::size_t end, std::size_t) {
+                for (std::size_t row = begin; row < end;) {
+                    const int slice = int(row / std::size_t(h));
+                    const int y = int(row % std::size_t(h));
+                    const int y_end = int(std::min<std::size_t>(std::size_t(h), y + (end - row)));
+                    resample_slice_rows(&corners[4 * (first + slice)], &steps[4 * (first + slice)], options.filter,
+                                        region, w, h, y, y_end, slab.data() + slice_bytes * std::size_t(slice));
+                    row += std::size_t(y_end - y);
+                }
+            }, 16);
+        }
+
+        if (!slab_callback(slab.data(), first, num_slices)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+void straightened_slice_indices(BoundingCage& cage, int depth, std::vector<double>& indices) {
+    std::vector<double> kf_depths;
+    cage.keyframe_depths(kf_depths);
+    double cage_length = kf_depths.back();
+
+    // The slices are spaced evenly along the length of the cage
+    indices.clear();
+    indices.reserve(std::size_t(std::max(depth, 0)));
+    int kf_i = 0;
+    for (const BoundingCage::Cell& cell : cage.cells) {
+        double start_depth = kf_depths[kf_i];
+        double end_depth = kf_depths[kf_i + 1];
+
+        int start_frame = int(depth * (start_depth / cage_length));
+        int end_frame = int(depth * (end_depth / cage_length));
+
+        double start_index = cell.left_keyframe()->index();
+        double end_index = cell.right_keyframe()->index();
+
+        for (int i = start_frame; i < end_frame; i++) {
+            double lam = double(i-start_frame)/double(end_frame-start_frame);
+            indices.push_back((1.0-lam)*start_index + lam*end_index);
+        }
+
+        kf_i += 1;
+    }
+}
+
+void straightened_slice_corners(BoundingCage& cage, int depth, std::vector<Eigen::RowVector3f>& corners) {
+    corners.clear();
+    corners.reserve(4 * std::size_t(std::max(depth, 0)));
+
+    std::vector<double> indices;
+    straightened_slice_indices(cage, depth, indices);
+    CageSampler sampler(cage);
+    std::vector<CageSampler::Frame> frames;
+    if (!sampler.sample(indices, frames)) {
+        return;
+    }
+    for (const CageSampler::Frame& frame : frames) {
+        // Corners in the order ll, lr, ur, ul
+        for (int c = 0; c < 4; c++) {
+            corners.push_back(frame.bounding_box_vertices_3d[c].cast<float>());
+        }
+    }
+}
+
+bool straighten_volume(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims,
+                       const std::uint8_t* volume, const Eigen::RowVector3i& volume_dims,
+                       const Eigen::RowVector3i& output_dims, const StraightenSlabCallback& slab_callback,
+                       std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options) {
+    if (volume == nullptr || volume_dims.minCoeff() <= 0) {
+        logger->error("Cannot straighten an empty volume");
+        return false;
+    }
+
+    VoxelRegion whole_volume;
+    whole_volume.data = volume;
+    whole_volume.extent = volume_dims;
+    whole_volume.volume_dims = volume_dims;
+    return straighten_slabs(cage, cage_volume_dims, output_dims, slab_callback, logger, options,
+                            [&](const Eigen::RowVector3f&, const Eigen::RowVector3f&, int, VoxelRegion& region) {
+        region = whole_volume;
+        return true;
+    });
+}
+
+bool straighten_volume(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims, FishVolFile& volume,
+                       const Eigen::RowVector3i& output_dims, const StraightenSlabCallback& slab_callback,
+                       std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options) {
+    if (!volume.is_open() || volume.bytes_per_voxel() != 1) {
+        logger->error("Can only straighten open 8 bit .fishvol files");
+        return false;
+    }
+
+    const Eigen::RowVector3i volume_dims = volume.dims(0);
+    std::vector<std::uint8_t> voxels;
+    return straighten_slabs(cage, cage_volume_dims, output_dims, slab_callback, logger, options,
+                            [&](const Eigen::RowVector3f& lo, const Eigen::RowVector3f& hi, int margin, VoxelRegion& region) {
+        Eigen::RowVector3i begin, end;
+        sampled_voxel_range(lo, hi, volume_dims, margin, begin, end);
+        const Eigen::RowVector3i extent = end - begin;
+        voxels.resize(std::size_t(extent[0]) * std::size_t(extent[1]) * std::size_t(extent[2]));
+        if (!volume.read_region(0, begin, end, voxels.data(), logger)) {
+            return false;
+        }
+        region.data = voxels.data();
+        region.origin = begin;
+        region.extent = extent;
+        region.volume_dims = volume_dims;
+        return true;
+    });
+}
+
+bool straighten_volume_file(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims,
+                            const std::string& input_filename, const Eigen::RowVector3i& volume_dims,
+                            const Eigen::RowVector3i& output_dims, const std::string& output_filename,
+                            std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options) {
+    TRACE_SCOPE("straighten_volume_file");
+    VolumeSlabWriter writer;
+    FishVolWriteOptions write_options;
+    write_options.num_levels = options.num_levels;
+    if (!writer.begin(output_filename, output_dims, sizeof(std::uint8_t), logger, write_options)) {
+        return false;
+    }
+    const std::size_t slice_bytes = std::size_t(output_dims[0]) * std::size_t(output_dims[1]);
+    auto write_slab = [&](const std::uint8_t* voxels, int, int num_slices) {
+        writer.wait_for_queue(MAX_QUEUED_SLABS);
+        writer.push_slab(std::vector<std::uint8_t>(voxels, voxels + slice_bytes * std::size_t(num_slices)));
+        return true;
+    };
+
+    bool ok = false;
+    if (is_fishvol_filename(input_filename)) {
+        FishVolFile volume;
+        ok = volume.open(input_filename, logger) &&
+             straighten_volume(cage, cage_volume_dims, volume, output_dims, write_slab, logger, options);
+    } else {
+        RawVolumeView volume;
+        ok = volume.open(input_filename, volume_dims, logger) &&
+             straighten_volume(cage, cage_volume_dims, volume.data(), volume_dims, output_dims, write_slab, logger, options);
+    }
+
+    writer.finish();
+    return writer.wait() && ok;
+}
@@ -0,0 +1,75 @@
+#ifndef CPU_STRAIGHTENER_H
+#define CPU_STRAIGHTENER_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bounding_cage.h"
+
+class FishVolFile;
+
+// Straightens the volume inside a BoundingCage on the CPU, without an OpenGL context. The output matches
+// VolumeExporter: slice z of a w x h x d output is the keyframe bounding box at depth z, the pixels are
+// interpolated over its two triangles like the slice shader and the volume is sampled with the same filter, with
+// the edge handling of the brick cache (zero outside of the volume, clamped to the edge inside of it).
+// Results can differ from the GPU by one intensity level, since texture units filter in fixed point.
+
+// Keyframe index of each of the depth output slices, to be evaluated by a CageSampler of the cage
+void straightened_slice_indices(BoundingCage& cage, int depth, std::vector<double>& indices);
+
+// Corners ll, lr, ur, ul of each of the depth output slices, in the voxel coordinates of the volume the
+// cage was built on. VolumeExporter renders the same slices.
+void straightened_slice_corners(BoundingCage& cage, int depth, std::vector<Eigen::RowVector3f>& corners);
+
+// Reconstruction filter used to resample the volume, shared with VolumeExporter
+enum ResampleFilter {
+    // Hardware style trilinear interpolation
+    RESAMPLE_TRILINEAR = 0,
+    // Cubic B-spline evaluated with 8 trilinear fetches. Smooth when the output is magnified, at the cost
+    // of a slight blur since the B-spline does not interpolate the voxels.
+    RESAMPLE_TRICUBIC_BSPLINE,
+    // Average of up to 4x4x4 trilinear taps over the footprint of each output voxel. Removes the aliasing
+    // of exports that are smaller than the volume and matches trilinear otherwise.
+    RESAMPLE_BOX_MINIFY,
+};
+
+struct StraightenOptions {
+    // Number of output slices resampled at once, 0 picks slabs of about 16 MiB
+    int slices_per_slab = 0;
+    ResampleFilter filter = RESAMPLE_TRILINEAR;
+    // Levels of the 2x downsampled pyramid written into .fishvol outputs of straighten_volume_file, including
+    // the full resolution
+    int num_levels = 1;
+};
+
+// Called with each slab of num_slices resampled slices (x fastest, then y, then z), in order. Returning
+// false stops the resampling.
+using StraightenSlabCallback = std::function<bool(const std::uint8_t* voxels, int first_slice, int num_slices)>;
+
+// Resample an 8 bit volume held in memory (or mapped with a RawVolumeView) into output_dims. The cage
+// coordinates are in units of cage_volume_dims, the volume may have a different (e.g. full) resolution.
+bool straighten_volume(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims,
+                       const std::uint8_t* volume, const Eigen::RowVector3i& volume_dims,
+                       const Eigen::RowVector3i& output_dims, const StraightenSlabCallback& slab_callback,
+                       std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options = StraightenOptions());
+
+// Same as above for the full resolution level of a .fishvol file. Only the bricks around each slab are
+// decompressed, so the volume never has to fit in memory.
+bool straighten_volume(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims, FishVolFile& volume,
+                       const Eigen::RowVector3i& output_dims, const StraightenSlabCallback& slab_callback,
+                       std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options = StraightenOptions());
+
+// Straighten the .raw or .fishvol file input_filename into output_filename (.raw or .fishvol). volume_dims
+// is only used for .raw inputs, .fishvol files store their dimensions.
+bool straighten_volume_file(BoundingCage& cage, const Eigen::RowVector3i& cage_volume_dims,
+                            const std::string& input_filename, const Eigen::RowVector3i& volume_dims,
+                            const Eigen::RowVector3i& output_dims, const std::string& output_filename,
+                            std::shared_ptr<spdlog::logger> logger, const StraightenOptions& options = StraightenOptions());
+
+#endif // CPU_STRAIGHTENER_H
@@ -176,3 +176,6 @@ bool DatFile::deserialize(const std::string& filename, std::shared_ptr<spdlog::l
     return true;
 }
 
+std::size_t DatFile::bytes_per_voxel() const {
+    return (m_format == "UINT16" || m_format == "USHORT") ? 2 : 1;
+}
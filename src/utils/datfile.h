@@ -35,6 +35,9 @@ public:
 
   bool serialize(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
   bool deserialize(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+
+  // Size of a voxel of the raw file given its Format, 2 for UINT16 (or USHORT) and 1 otherwise
+  std::size_t bytes_per_voxel() const;
 };
 
 namespace igl {
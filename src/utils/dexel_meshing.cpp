@@ -0,0 +1,645 @@
+#include "dexel_meshing.h"
+#include "metrics.h"
+#include "parallel_for.h"
+
+#include <vor3d/DistanceTransform.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+
+vor3d::CompressedVolume cropped_dexels(const Eigen::RowVector3i& crop_begin, const Eigen::RowVector3i& crop_end) {
+    const Eigen::RowVector3i size = crop_end - crop_begin;
+    return vor3d::CompressedVolume(Eigen::Vector3d(crop_begin[2], crop_begin[1], crop_begin[0]),
+                                   Eigen::Vector3d(size[2], size[1], size[0]), 1.0, 0);
+}
+
+void pad_voxel_box(Eigen::RowVector3i& begin, Eigen::RowVector3i& end, int padding,
+                   const Eigen::RowVector3i& volume_dims) {
+    begin = (begin.array() - padding).max(0).matrix();
+    end = (end.array() + padding).min(volume_dims.array()).matrix();
+}
+
+bool select_index_dexels(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                         const std::vector<bool>& selected, vor3d::CompressedVolume& dexels,
+                         JobContext& context) {
+    return select_index_dexels(index_data, volume_dims, selected, Eigen::RowVector3i::Zero(), volume_dims,
+                               dexels, context);
+}
+
+bool select_index_dexels(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                         const std::vector<bool>& selected, const Eigen::RowVector3i& crop_begin,
+                         const Eigen::RowVector3i& crop_end, vor3d::CompressedVolume& dexels,
+                         JobContext& context) {
+    // Run length encode the selected voxels of each (z, y) row of the index volume straight into dexels,
+    // without building the voxel mask first. Rows are split between threads, one builder per thread.
+    const int w = volume_dims[0], h = volume_dims[1];
+    const int x0 = crop_begin[0], x1 = crop_end[0];
+    const int y0 = crop_begin[1], ny = crop_end[1] - crop_begin[1];
+    const int z0 = crop_begin[2], nz = crop_end[2] - crop_begin[2];
+    dexels = cropped_dexels(crop_begin, crop_end);
+
+    const size_t num_rows = size_t(nz) * size_t(ny);
+    const size_t min_rows_per_chunk = 64;
+    auto is_selected = [&](std::uint32_t id) { return id < selected.size() && selected[id]; };
+    std::vector<vor3d::CompressedVolume::Builder> builders(parallel_num_chunks(num_rows, min_rows_per_chunk),
+        vor3d::CompressedVolume::Builder(dexels));
+    parallel_for_chunks(num_rows, [&](size_t begin, size_t end, size_t chunk) {
+        vor3d::CompressedVolume::Builder& builder = builders[chunk];
+        for (size_t row = begin; row < end && !context.cancelled(); row++) {
+            const int z = int(row / ny), y = int(row % ny);
+            const std::uint32_t* idx = index_data + (size_t(z0 + z) * h + size_t(y0 + y)) * w;
+            int x = x0;
+            while (x < x1) {
+                while (x < x1 && !is_selected(idx[x])) {
+                    x++;
+                }
+                const int seg_entry = x;
+                while (x < x1 && is_selected(idx[x])) {
+                    x++;
+                }
+                if (seg_entry < x) {
+                    builder.appendSegment(z, y, seg_entry, x, -1);
+                }
+            }
+        }
+    }, min_rows_per_chunk);
+    if (context.cancelled()) {
+        return false;
+    }
+    dexels.assemble(builders);
+
+    static metrics::Counter& segments =
+        metrics::counter("unwind_dexel_segments_total", "Dexel segments of the selected volumes");
+    segments.add(std::uint64_t(dexels.numSegments()));
+    return true;
+}
+
+
+void IndexVoxelRuns::clear() {
+    volume_dims = Eigen::RowVector3i::Zero();
+    offsets.clear();
+    runs.clear();
+}
+
+void build_index_voxel_runs(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                            std::uint32_t num_ids, IndexVoxelRuns& runs) {
+    const int w = volume_dims[0];
+    const size_t num_rows = size_t(volume_dims[1]) * size_t(volume_dims[2]);
+    // Calls f(id, row, begin, end) for the runs of every row in order
+    auto for_each_run = [&](auto f) {
+        for (size_t row = 0; row < num_rows; row++) {
+            const std::uint32_t* idx = index_data + row * w;
+            int x = 0;
+            while (x < w) {
+                const std::uint32_t id = idx[x];
+                const int begin = x;
+                while (x < w && idx[x] == id) {
+                    x++;
+                }
+                if (id < num_ids) {
+                    f(id, row, begin, x);
+                }
+            }
+        }
+    };
+
+    // Count the runs of every id first, then put them in place
+    runs.volume_dims = volume_dims;
+    runs.offsets.assign(size_t(num_ids) + 1, 0);
+    for_each_run([&](std::uint32_t id, size_t, int, int) { runs.offsets[id + 1] += 1; });
+    for (size_t i = 0; i < num_ids; i++) {
+        runs.offsets[i + 1] += runs.offsets[i];
+    }
+    runs.runs.resize(runs.offsets.back());
+    std::vector<size_t> next(runs.offsets.begin(), runs.offsets.end() - 1);
+    for_each_run([&](std::uint32_t id, size_t row, int begin, int end) {
+        runs.runs[next[id]++] = IndexVoxelRuns::Run{ std::uint32_t(row), std::uint32_t(begin), std::uint32_t(end) };
+    });
+}
+
+bool select_run_dexels(const IndexVoxelRuns& runs, const std::vector<bool>& selected,
+                       vor3d::CompressedVolume& dexels, JobContext& context) {
+    return select_run_dexels(runs, selected, Eigen::RowVector3i::Zero(), runs.volume_dims, dexels, context);
+}
+
+bool select_run_dexels(const IndexVoxelRuns& runs, const std::vector<bool>& selected,
+                       const Eigen::RowVector3i& crop_begin, const Eigen::RowVector3i& crop_end,
+                       vor3d::CompressedVolume& dexels, JobContext& context) {
+    const int h = runs.volume_dims[1];
+    dexels = cropped_dexels(crop_begin, crop_end);
+
+    // The builder finishes a ray once another one is written to, so the runs of all the selected ids are
+    // sorted into the order of the rows first. Runs of different ids that touch are merged by appendSegment.
+    std::vector<IndexVoxelRuns::Run> selected_runs;
+    const size_t num_ids = std::min(selected.size(), runs.num_ids());
+    size_t num_selected_runs = 0;
+    for (size_t id = 0; id < num_ids; id++) {
+        if (selected[id]) {
+            num_selected_runs += runs.offsets[id + 1] - runs.offsets[id];
+        }
+    }
+    selected_runs.reserve(num_selected_runs);
+    for (size_t id = 0; id < num_ids; id++) {
+        if (selected[id]) {
+            selected_runs.insert(selected_runs.end(), runs.runs.begin() + runs.offsets[id],
+                                 runs.runs.begin() + runs.offsets[id + 1]);
+        }
+    }
+    if (context.cancelled()) {
+        return false;
+    }
+    std::sort(selected_runs.begin(), selected_runs.end(),
+              [](const IndexVoxelRuns::Run& a, const IndexVoxelRuns::Run& b) {
+        return a.row < b.row || (a.row == b.row && a.begin < b.begin);
+    });
+    if (context.cancelled()) {
+        return false;
+    }
+
+    vor3d::CompressedVolume::Builder builder(dexels);
+    for (const IndexVoxelRuns::Run& run : selected_runs) {
+        const int z = int(run.row / h), y = int(run.row % h);
+        const int begin = std::max(int(run.begin), crop_begin[0]), end = std::min(int(run.end), crop_end[0]);
+        if (z >= crop_begin[2] && z < crop_end[2] && y >= crop_begin[1] && y < crop_end[1] && begin < end) {
+            builder.appendSegment(z - crop_begin[2], y - crop_begin[1], begin, end, -1);
+        }
+    }
+    dexels.assemble(builder);
+
+    static metrics::Counter& segments =
+        metrics::counter("unwind_dexel_segments_total", "Dexel segments of the selected volumes");
+    segments.add(std::uint64_t(dexels.numSegments()));
+    return true;
+}
+
+void IndexStatistics::merge(const IndexStatistics& other) {
+    if (other.empty()) {
+        return;
+    }
+    min_corner = min_corner.cwiseMin(other.min_corner);
+    max_corner = max_corner.cwiseMax(other.max_corner);
+    num_voxels += other.num_voxels;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+}
+
+void compute_index_statistics(const IndexVoxelRuns& runs, const std::uint8_t* volume_data,
+                              std::vector<IndexStatistics>& statistics) {
+    const int w = runs.volume_dims[0], h = runs.volume_dims[1];
+    statistics.assign(runs.num_ids(), IndexStatistics());
+    // Ids have very different numbers of runs, small chunks balance them between the threads
+    parallel_for_chunks(runs.num_ids(), [&](size_t begin, size_t end, size_t) {
+        for (size_t id = begin; id < end; id++) {
+            IndexStatistics& s = statistics[id];
+            for (size_t i = runs.offsets[id]; i < runs.offsets[id + 1]; i++) {
+                const IndexVoxelRuns::Run& run = runs.runs[i];
+                const int y = int(run.row % h), z = int(run.row / h);
+                s.min_corner = s.min_corner.cwiseMin(Eigen::RowVector3i(int(run.begin), y, z));
+                s.max_corner = s.max_corner.cwiseMax(Eigen::RowVector3i(int(run.end), y + 1, z + 1));
+                s.num_voxels += run.end - run.begin;
+                const std::uint8_t* values = volume_data + size_t(run.row) * w;
+                const auto range = std::minmax_element(values + run.begin, values + run.end);
+                s.min_value = std::min(s.min_value, *range.first);
+                s.max_value = std::max(s.max_value, *range.second);
+            }
+        }
+    }, 64);
+}
+
+void index_histogram(const IndexVoxelRuns& runs, const std::uint8_t* volume_data, const std::vector<bool>& selected,
+                     VolumeHistogram& histogram) {
+    const int w = runs.volume_dims[0];
+    const size_t num_ids = std::min(selected.size(), runs.num_ids());
+    std::vector<VolumeHistogram> partial(parallel_num_chunks(num_ids, 64));
+    parallel_for_chunks(num_ids, [&](size_t begin, size_t end, size_t chunk) {
+        VolumeHistogram& h = partial[chunk];
+        for (size_t id = begin; id < end; id++) {
+            if (!selected[id]) {
+                continue;
+            }
+            for (size_t i = runs.offsets[id]; i < runs.offsets[id + 1]; i++) {
+                const IndexVoxelRuns::Run& run = runs.runs[i];
+                const std::uint8_t* values = volume_data + size_t(run.row) * w;
+                for (std::uint32_t x = run.begin; x < run.end; x++) {
+                    h.bins[values[x]] += 1;
+                }
+            }
+        }
+    }, 64);
+
+    histogram.clear();
+    for (const VolumeHistogram& h : partial) {
+        for (int v = 0; v < 256; v++) {
+            histogram.bins[v] += h.bins[v];
+        }
+    }
+    histogram.update_range();
+}
+
+
+bool dexel_distance_grid(const vor3d::CompressedVolume& dexels, double dx,
+                         Eigen::Vector3d& origin, Eigen::Vector3i& dims) {
+    const int nx = dexels.gridSize()[0], ny = dexels.gridSize()[1];
+    const double sx = dexels.extent()[0] / nx, sy = dexels.extent()[1] / ny;
+
+    Eigen::Vector3d v_min = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+    Eigen::Vector3d v_max = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+    for (int y = 0; y < ny; y++) {
+        for (int x = 0; x < nx; x++) {
+            const vor3d::RayView<vor3d::Scalar> r = dexels.at(x, y);
+            if (r.empty()) {
+                continue;
+            }
+            const Eigen::Vector3d cell_min(r.front(), dexels.origin()[1] + y * sy, dexels.origin()[0] + x * sx);
+            const Eigen::Vector3d cell_max(r.back(), cell_min[1] + sy, cell_min[2] + sx);
+            v_min = v_min.cwiseMin(cell_min);
+            v_max = v_max.cwiseMax(cell_max);
+        }
+    }
+    if (!(v_min.array() <= v_max.array()).all()) {
+        return false;
+    }
+
+    // Round up so the grid contains the bounding box, then add 2 samples of padding on each side, which
+    // makes 4 more samples per axis
+    origin = v_min - Eigen::Vector3d::Constant(2.0 * dx);
+    for (int a = 0; a < 3; a++) {
+        dims[a] = int(std::ceil((v_max[a] - v_min[a]) / dx)) + 4;
+    }
+    return true;
+}
+
+
+bool dexels_to_signed_distance(const vor3d::CompressedVolume& dexels, const Eigen::Vector3d& origin, double dx,
+                               const Eigen::Vector3i& dims, float* phi, JobContext& context) {
+    typedef vor3d::Scalar Scalar;
+    const int ni = dims[0], nj = dims[1], nk = dims[2];
+    const int nx = dexels.gridSize()[0], ny = dexels.gridSize()[1];
+    const double sx = dexels.extent()[0] / nx, sy = dexels.extent()[1] / ny;
+
+    // Squared distances to the solid go in phi and squared distances to its complement in dist_in,
+    // first along the rays of the dexel cells holding the grid columns. Every pass transforms independent
+    // lines of the grid, so the lines are split between threads.
+    std::vector<float> dist_in(size_t(ni) * size_t(nj) * size_t(nk));
+    auto index = [&](int i, int j, int k) { return size_t(i) + size_t(ni) * (size_t(j) + size_t(nj) * size_t(k)); };
+    // One step per pass, the two distances are transformed along j and along k and then combined
+    const int num_passes = 6;
+    int pass = 0;
+    auto end_pass = [&]() {
+        pass++;
+        context.set_progress(float(pass) / num_passes);
+        return !context.cancelled();
+    };
+
+    parallel_for_chunks(nk, [&](size_t k_begin, size_t k_end, size_t) {
+        for (int k = int(k_begin); k < int(k_end) && !context.cancelled(); k++) {
+            const int cx = int(std::floor((origin[2] + k * dx - dexels.origin()[0]) / sx));
+            for (int j = 0; j < nj; j++) {
+                const int cy = int(std::floor((origin[1] + j * dx - dexels.origin()[1]) / sy));
+                const vor3d::RayView<Scalar> r = (cx < 0 || cy < 0 || cx >= nx || cy >= ny) ?
+                    vor3d::RayView<Scalar>() : dexels.at(cx, cy);
+                vor3d::squaredDistanceToSegments(r, origin[0], dx, ni, phi + index(0, j, k),
+                                                 dist_in.data() + index(0, j, k));
+            }
+        }
+    }, 1);
+    if (!end_pass()) {
+        return false;
+    }
+
+    // Then across the rays, along j and along k
+    const std::array<int, 3> grid_dims = { { ni, nj, nk } };
+    for (float* dist : { phi, dist_in.data() }) {
+        for (size_t axis = 1; axis < 3; axis++) {
+            vor3d::squaredDistanceTransformAxis(dist, grid_dims, axis, dx);
+            if (!end_pass()) {
+                return false;
+            }
+        }
+    }
+
+    parallel_for_chunks(nk, [&](size_t k_begin, size_t k_end, size_t) {
+        for (int k = int(k_begin); k < int(k_end); k++) {
+            for (int j = 0; j < nj; j++) {
+                for (int i = 0; i < ni; i++) {
+                    const size_t s = index(i, j, k);
+                    phi[s] = std::sqrt(phi[s]) - std::sqrt(dist_in[s]);
+                }
+            }
+        }
+    }, 1);
+    return end_pass();
+}
+
+
+namespace {
+
+// Squared distance transform along axis 1 or 2 of the brick data of dims, serially with the scratch buffers of
+// the thread, see vor3d::squaredDistanceTransformAxis
+void transform_brick_axis(float* data, const std::array<int, 3>& dims, int axis, double dx,
+                          std::vector<float>& line, vor3d::DistanceTransformScratch& scratch) {
+    const int n = dims[axis];
+    const std::size_t stride = axis == 1 ? std::size_t(dims[0]) : std::size_t(dims[0]) * std::size_t(dims[1]);
+    const int other = axis == 1 ? dims[2] : dims[1];
+    const std::size_t other_stride = axis == 1 ? std::size_t(dims[0]) * std::size_t(dims[1]) : std::size_t(dims[0]);
+    line.resize(std::size_t(n));
+    for (int o = 0; o < other; o++) {
+        for (int i = 0; i < dims[0]; i++) {
+            float* base = data + std::size_t(o) * other_stride + std::size_t(i);
+            for (int t = 0; t < n; t++) {
+                line[t] = base[std::size_t(t) * stride];
+            }
+            vor3d::squaredDistance1D(line.data(), n, dx, scratch);
+            for (int t = 0; t < n; t++) {
+                base[std::size_t(t) * stride] = line[t];
+            }
+        }
+    }
+}
+
+// A block of the sparse distance, a leaf if it has samples, a tile otherwise
+struct DistanceBlock {
+    Eigen::Vector3i block;
+    float tile;
+    std::vector<float> samples;
+};
+
+} // namespace
+
+
+bool dexels_to_sparse_signed_distance(const vor3d::CompressedVolume& dexels, const Eigen::Vector3d& origin, double dx,
+                                      const Eigen::Vector3i& dims, double band, SparseGrid<float>& phi,
+                                      JobContext& context) {
+    typedef vor3d::Scalar Scalar;
+    typedef SparseGrid<float> Grid;
+    const int nx = dexels.gridSize()[0], ny = dexels.gridSize()[1];
+    const double sx = dexels.extent()[0] / nx, sy = dexels.extent()[1] / ny;
+    const int pad = std::max(1, int(std::ceil(band / dx - 1e-6)));
+    const float clamp = float(pad * dx);
+    phi.reset(dims, clamp);
+    const Eigen::Vector3i block_dims = phi.block_dims();
+
+    // Ray of the dexel cell holding grid column (j, k), like dexels_to_signed_distance
+    auto column_ray = [&](int j, int k) {
+        const int cx = int(std::floor((origin[2] + k * dx - dexels.origin()[0]) / sx));
+        const int cy = int(std::floor((origin[1] + j * dx - dexels.origin()[1]) / sy));
+        return (cx < 0 || cy < 0 || cx >= nx || cy >= ny) ? vor3d::RayView<Scalar>() : dexels.at(cx, cy);
+    };
+
+    // The slabs of blocks along k are split between threads, each keeps its blocks in order
+    std::vector<std::vector<DistanceBlock>> slabs(block_dims[2]);
+    std::atomic<int> num_slabs_done(0);
+    parallel_for_chunks(std::size_t(block_dims[2]), [&](std::size_t bk_begin, std::size_t bk_end, std::size_t) {
+        std::vector<float> outside, inside, line;
+        vor3d::DistanceTransformScratch scratch;
+        for (int bk = int(bk_begin); bk < int(bk_end) && !context.cancelled(); bk++) {
+            for (int bj = 0; bj < block_dims[1]; bj++) {
+                for (int bi = 0; bi < block_dims[0]; bi++) {
+                    // The block and the samples within pad of it
+                    const Eigen::Vector3i b0 = Eigen::Vector3i(bi, bj, bk) * Grid::BLOCK_SIZE;
+                    const Eigen::Vector3i b1 = (b0.array() + Grid::BLOCK_SIZE).min(dims.array());
+                    const Eigen::Vector3i p0 = (b0.array() - pad).max(0);
+                    const Eigen::Vector3i p1 = (b1.array() + pad).min(dims.array());
+
+                    // Blocks without a segment end within pad along their rays and with the same side at every
+                    // column are further than pad from the surface
+                    const double t0 = origin[0] + p0[0] * dx, t1 = origin[0] + (p1[0] - 1) * dx;
+                    int side = -1;
+                    bool uniform = true;
+                    for (int k = p0[2]; k < p1[2] && uniform; k++) {
+                        for (int j = p0[1]; j < p1[1] && uniform; j++) {
+                            const vor3d::RayView<Scalar> r = column_ray(j, k);
+                            const std::size_t before = std::size_t(
+                                std::lower_bound(r.begin(), r.end(), Scalar(t0)) - r.begin());
+                            const std::size_t through = std::size_t(
+                                std::upper_bound(r.begin(), r.end(), Scalar(t1)) - r.begin());
+                            const int column_side = int(before % 2);
+                            uniform = before == through && (side < 0 || side == column_side);
+                            side = column_side;
+                        }
+                    }
+                    if (uniform) {
+                        if (side == 1) {
+                            slabs[bk].push_back({ Eigen::Vector3i(bi, bj, bk), -clamp, std::vector<float>() });
+                        }
+                        continue;
+                    }
+
+                    const std::array<int, 3> brick = { { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] } };
+                    auto index = [&](int i, int j, int k) {
+                        return std::size_t(i) +
+                               std::size_t(brick[0]) * (std::size_t(j) + std::size_t(brick[1]) * std::size_t(k));
+                    };
+                    outside.resize(index(0, 0, brick[2]));
+                    inside.resize(index(0, 0, brick[2]));
+                    for (int k = 0; k < brick[2]; k++) {
+                        for (int j = 0; j < brick[1]; j++) {
+                            vor3d::squaredDistanceToSegments(column_ray(p0[1] + j, p0[2] + k), t0, dx, brick[0],
+                                                             outside.data() + index(0, j, k),
+                                                             inside.data() + index(0, j, k));
+                        }
+                    }
+                    for (float* dist : { outside.data(), inside.data() }) {
+                        transform_brick_axis(dist, brick, 1, dx, line, scratch);
+                        transform_brick_axis(dist, brick, 2, dx, line, scratch);
+                    }
+
+                    DistanceBlock block = { Eigen::Vector3i(bi, bj, bk), clamp,
+                                            std::vector<float>(Grid::BLOCK_SAMPLES, clamp) };
+                    // Blocks whose samples all clamp to the same value are tiles
+                    bool is_tile = true;
+                    for (int k = b0[2]; k < b1[2]; k++) {
+                        for (int j = b0[1]; j < b1[1]; j++) {
+                            for (int i = b0[0]; i < b1[0]; i++) {
+                                const std::size_t s = index(i - p0[0], j - p0[1], k - p0[2]);
+                                const float value = std::sqrt(outside[s]) - std::sqrt(inside[s]);
+                                const float clamped = std::min(std::max(value, -clamp), clamp);
+                                const bool first = i == b0[0] && j == b0[1] && k == b0[2];
+                                is_tile = is_tile && std::abs(clamped) == clamp && (first || clamped == block.tile);
+                                block.tile = clamped;
+                                block.samples[std::size_t((i - b0[0]) + Grid::BLOCK_SIZE *
+                                        ((j - b0[1]) + Grid::BLOCK_SIZE * (k - b0[2])))] = clamped;
+                            }
+                        }
+                    }
+                    if (is_tile) {
+                        block.samples.clear();
+                    }
+                    slabs[bk].push_back(std::move(block));
+                }
+            }
+            context.set_progress(0.9f * float(++num_slabs_done) / float(block_dims[2]));
+        }
+    }, 1);
+    if (context.cancelled()) {
+        return false;
+    }
+
+    for (std::vector<DistanceBlock>& slab : slabs) {
+        for (DistanceBlock& block : slab) {
+            if (block.samples.empty()) {
+                phi.set_tile(block.block[0], block.block[1], block.block[2], block.tile);
+            } else {
+                phi.set_leaf(block.block[0], block.block[1], block.block[2], block.samples.data());
+            }
+        }
+        std::vector<DistanceBlock>().swap(slab);
+    }
+    context.set_progress(1.f);
+    return !context.cancelled();
+}
+
+namespace {
+
+// n points evenly spaced by arc length along the polyline points, written to rows [row, row + n) of out
+void resample_polyline(const std::vector<Eigen::RowVector3d>& points, int n, Eigen::MatrixXd& out, int row) {
+    std::vector<double> arc_length(points.size(), 0.0);
+    for (size_t i = 1; i < points.size(); i++) {
+        arc_length[i] = arc_length[i - 1] + (points[i] - points[i - 1]).norm();
+    }
+    size_t s = 0;
+    for (int i = 0; i < n; i++) {
+        const double t = n > 1 ? arc_length.back() * i / (n - 1) : 0.0;
+        while (s + 2 < points.size() && arc_length[s + 1] < t) {
+            s++;
+        }
+        if (points.size() == 1) {
+            out.row(row + i) = points[0];
+            continue;
+        }
+        const double length = arc_length[s + 1] - arc_length[s];
+        const double a = length > 0.0 ? std::min(std::max((t - arc_length[s]) / length, 0.0), 1.0) : 0.0;
+        out.row(row + i) = (1.0 - a) * points[s] + a * points[s + 1];
+    }
+}
+
+} // namespace
+
+
+bool dexel_skeleton(const vor3d::CompressedVolume& dexels, double dx,
+                    const std::vector<std::pair<Eigen::RowVector3d, Eigen::RowVector3d>>& endpoints,
+                    int num_skeleton_vertices, Eigen::MatrixXd& skeleton_vertices, JobContext& context) {
+    Eigen::Vector3d origin;
+    Eigen::Vector3i dims;
+    if (endpoints.empty() || !dexel_distance_grid(dexels, dx, origin, dims)) {
+        return false;
+    }
+    const int ni = dims[0], nj = dims[1], nk = dims[2];
+    const size_t num_samples = size_t(ni) * size_t(nj) * size_t(nk);
+    std::vector<float> phi(num_samples);
+    if (!dexels_to_signed_distance(dexels, origin, dx, dims, phi.data(), context)) {
+        return false;
+    }
+    auto index = [&](int i, int j, int k) { return size_t(i) + size_t(ni) * (size_t(j) + size_t(nj) * size_t(k)); };
+    auto position = [&](size_t s) {
+        const int i = int(s % ni), j = int((s / ni) % nj), k = int(s / (size_t(ni) * nj));
+        return Eigen::RowVector3d(origin[0] + i * dx, origin[1] + j * dx, origin[2] + k * dx);
+    };
+
+    // The inside sample closest to p, the one p falls on if it is inside
+    auto closest_inside_sample = [&](const Eigen::RowVector3d& p) {
+        Eigen::Vector3i c;
+        for (int a = 0; a < 3; a++) {
+            c[a] = std::min(std::max(int(std::lround((p[a] - origin[a]) / dx)), 0), dims[a] - 1);
+        }
+        size_t best = index(c[0], c[1], c[2]);
+        if (phi[best] < 0.f) {
+            return best;
+        }
+        double best_distance = std::numeric_limits<double>::infinity();
+        for (size_t s = 0; s < num_samples; s++) {
+            if (phi[s] < 0.f) {
+                const double d = (position(s) - p).squaredNorm();
+                if (d < best_distance) {
+                    best_distance = d;
+                    best = s;
+                }
+            }
+        }
+        return best;
+    };
+
+    // The 26 neighbors and the length of the step to each of them. The padding of the grid is outside, so the
+    // paths never reach its border.
+    std::vector<std::ptrdiff_t> offsets;
+    std::vector<float> step_lengths;
+    for (int dk = -1; dk <= 1; dk++) {
+        for (int dj = -1; dj <= 1; dj++) {
+            for (int di = -1; di <= 1; di++) {
+                if (di == 0 && dj == 0 && dk == 0) {
+                    continue;
+                }
+                offsets.push_back(std::ptrdiff_t(di) + std::ptrdiff_t(ni) * (dj + std::ptrdiff_t(nj) * dk));
+                step_lengths.push_back(float(std::sqrt(double(di * di + dj * dj + dk * dk))));
+            }
+        }
+    }
+
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> cost(num_samples);
+    std::vector<std::int64_t> parent(num_samples);
+    const int vertices_per_pair = std::max(num_skeleton_vertices / int(endpoints.size()), 2);
+    skeleton_vertices.resize(vertices_per_pair * int(endpoints.size()), 3);
+
+    for (size_t p = 0; p < endpoints.size(); p++) {
+        context.begin_stage("Tracing the skeleton");
+        const size_t source = closest_inside_sample(endpoints[p].first);
+        const size_t target = closest_inside_sample(endpoints[p].second);
+        if (phi[source] >= 0.f || phi[target] >= 0.f) {
+            return false;
+        }
+
+        std::fill(cost.begin(), cost.end(), inf);
+        std::fill(parent.begin(), parent.end(), -1);
+        typedef std::pair<float, size_t> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        cost[source] = 0.f;
+        queue.emplace(0.f, source);
+        size_t num_settled = 0;
+        while (!queue.empty()) {
+            const Entry e = queue.top();
+            queue.pop();
+            const size_t s = e.second;
+            if (e.first > cost[s]) {
+                continue;
+            }
+            if (s == target) {
+                break;
+            }
+            if (++num_settled % (1 << 16) == 0 && context.cancelled()) {
+                return false;
+            }
+            for (size_t n = 0; n < offsets.size(); n++) {
+                const size_t t = size_t(std::ptrdiff_t(s) + offsets[n]);
+                if (!(phi[t] < 0.f)) {
+                    continue;
+                }
+                // Depth in samples, half a sample at the boundary so the cost stays finite
+                const float depth = 0.5f - phi[t] / float(dx);
+                const float c = e.first + step_lengths[n] / (depth * depth);
+                if (c < cost[t]) {
+                    cost[t] = c;
+                    parent[t] = std::int64_t(s);
+                    queue.emplace(c, t);
+                }
+            }
+        }
+        if (cost[target] == inf) {
+            return false;
+        }
+
+        std::vector<Eigen::RowVector3d> path;
+        for (std::int64_t s = std::int64_t(target); s >= 0; s = parent[size_t(s)]) {
+            path.push_back(position(size_t(s)));
+        }
+        std::reverse(path.begin(), path.end());
+        resample_polyline(path, vertices_per_pair, skeleton_vertices, int(p) * vertices_per_pair);
+    }
+    return true;
+}
@@ -0,0 +1,131 @@
+#ifndef DEXEL_MESHING_H
+#define DEXEL_MESHING_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <vor3d/CompressedVolume.h>
+
+#include "background_job.h"
+#include "sparse_grid.h"
+#include "volume_buffer.h"
+
+// The steps of the meshing job that do not depend on the UI, shared by the meshing screen and the pipeline
+// benchmark. The dexels of the low resolution volume run along x in the cells of its (z, y) grid, so their
+// frame is (ray, y, x) = (x, y, z) of the volume reversed.
+
+// Empty dexels for the voxels of the box [crop_begin, crop_end) in (x, y, z) of a volume. Their grid starts at
+// (z, y) of crop_begin and the segments keep the x of the volume, so sizes and positions derived from them are
+// in the coordinates of the whole volume. Operations on them do not reach outside the box.
+vor3d::CompressedVolume cropped_dexels(const Eigen::RowVector3i& crop_begin, const Eigen::RowVector3i& crop_end);
+
+// The box [begin, end) grown by padding voxels on every side and clamped to a volume of volume_dims
+void pad_voxel_box(Eigen::RowVector3i& begin, Eigen::RowVector3i& end, int padding,
+                   const Eigen::RowVector3i& volume_dims);
+
+// Run length encode the voxels of index_data (x fastest, then y, then z) whose id is set in selected into
+// dexels, either of the whole volume or of the box [crop_begin, crop_end) (see cropped_dexels). Returns false if
+// the job was cancelled.
+bool select_index_dexels(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                         const std::vector<bool>& selected, vor3d::CompressedVolume& dexels,
+                         JobContext& context);
+bool select_index_dexels(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                         const std::vector<bool>& selected, const Eigen::RowVector3i& crop_begin,
+                         const Eigen::RowVector3i& crop_end, vor3d::CompressedVolume& dexels,
+                         JobContext& context);
+
+// The voxels of every id of an index volume as runs along x, so that the dexels of a selection of ids are
+// gathered from the runs of those ids instead of from a pass over all the voxels
+struct IndexVoxelRuns {
+    struct Run {
+        // z * height + y
+        std::uint32_t row;
+        std::uint32_t begin;
+        std::uint32_t end;
+    };
+
+    Eigen::RowVector3i volume_dims = Eigen::RowVector3i::Zero();
+    // The runs of id i are runs[offsets[i]] up to runs[offsets[i + 1]], ordered by row and then by x
+    std::vector<std::size_t> offsets;
+    std::vector<Run> runs;
+
+    bool empty() const { return offsets.empty(); }
+    std::size_t num_ids() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::size_t num_bytes() const { return offsets.size() * sizeof(std::size_t) + runs.size() * sizeof(Run); }
+    void clear();
+};
+
+// Collect the runs of the voxels of index_data (x fastest, then y, then z) with ids below num_ids
+void build_index_voxel_runs(const std::uint32_t* index_data, const Eigen::RowVector3i& volume_dims,
+                            std::uint32_t num_ids, IndexVoxelRuns& runs);
+
+// The dexels select_index_dexels makes of the index volume of runs, in time proportional to the number of runs
+// of the selected ids. Returns false if the job was cancelled.
+bool select_run_dexels(const IndexVoxelRuns& runs, const std::vector<bool>& selected,
+                       vor3d::CompressedVolume& dexels, JobContext& context);
+bool select_run_dexels(const IndexVoxelRuns& runs, const std::vector<bool>& selected,
+                       const Eigen::RowVector3i& crop_begin, const Eigen::RowVector3i& crop_end,
+                       vor3d::CompressedVolume& dexels, JobContext& context);
+
+// Extent, size and value range of the voxels of an id, or of several ids once merged
+struct IndexStatistics {
+    // Bounding box of the voxels in (x, y, z), min_corner inclusive and max_corner exclusive
+    Eigen::RowVector3i min_corner = Eigen::RowVector3i::Constant(std::numeric_limits<int>::max());
+    Eigen::RowVector3i max_corner = Eigen::RowVector3i::Constant(std::numeric_limits<int>::min());
+    std::size_t num_voxels = 0;
+    std::uint8_t min_value = std::numeric_limits<std::uint8_t>::max();
+    std::uint8_t max_value = 0;
+
+    bool empty() const { return num_voxels == 0; }
+    void merge(const IndexStatistics& other);
+};
+
+// The statistics of every id of runs, with the values of volume_data, which has the dimensions of the index
+// volume. The ids are split between the threads.
+void compute_index_statistics(const IndexVoxelRuns& runs, const std::uint8_t* volume_data,
+                              std::vector<IndexStatistics>& statistics);
+
+// Histogram of the values of volume_data over the voxels of the ids set in selected
+void index_histogram(const IndexVoxelRuns& runs, const std::uint8_t* volume_data, const std::vector<bool>& selected,
+                     VolumeHistogram& histogram);
+
+// Grid of spacing dx covering the bounding box of dexels with 2 samples of padding on each side, in the
+// (ray, y, x) frame of the dexels. Returns false if dexels is empty.
+bool dexel_distance_grid(const vor3d::CompressedVolume& dexels, double dx,
+                         Eigen::Vector3d& origin, Eigen::Vector3i& dims);
+
+// Signed distance to the solid made of the dexel segments, negative inside, sampled at origin + dx * (i, j, k)
+// into phi[i + dims[0] * (j + dims[1] * k)]. Along the rays the distance to the segment endpoints is exact.
+// Across the rays it comes from a separable distance transform of the samples, so the zero crossing between
+// two samples on either side of a ray boundary falls halfway between them.
+// Returns false if the job was cancelled, which is checked between the passes of the transform.
+bool dexels_to_signed_distance(const vor3d::CompressedVolume& dexels, const Eigen::Vector3d& origin, double dx,
+                               const Eigen::Vector3i& dims, float* phi, JobContext& context);
+
+// The signed distance of dexels_to_signed_distance within band of the surface, clamped to [-band, band] further
+// away, into a SparseGrid of dims whose background is band: only the blocks within band of the surface are leaves,
+// the other ones inside are tiles of -band. band is rounded up to whole grid steps. Each block is transformed
+// with the samples within band of it, which hold every sample closer than band, so the distances in the band are
+// the ones of the dense grid while the memory only grows with the band.
+// Returns false if the job was cancelled.
+bool dexels_to_sparse_signed_distance(const vor3d::CompressedVolume& dexels, const Eigen::Vector3d& origin, double dx,
+                                      const Eigen::Vector3i& dims, double band, SparseGrid<float>& phi,
+                                      JobContext& context);
+
+// Skeleton of the solid made of the dexel segments between each pair of endpoints, traced on the signed distance
+// grid of dexel_distance_grid instead of along geodesics of a tet mesh. The path between two endpoints is the
+// shortest path through the inside samples and their 26 neighbors with a step cost of its length over the squared
+// depth of the sample it reaches, which keeps it away from the boundary and close to the medial axis. Endpoints
+// outside the solid start from the closest inside sample.
+//
+// The polyline of each pair is resampled to the same number of vertices, num_skeleton_vertices split between the
+// pairs, and the polylines are concatenated into skeleton_vertices in the (ray, y, x) frame of the dexels, the
+// frame of the tet mesh of the dilated volume. Returns false if the solid is empty, if two endpoints are not
+// connected through it or if the job was cancelled.
+bool dexel_skeleton(const vor3d::CompressedVolume& dexels, double dx,
+                    const std::vector<std::pair<Eigen::RowVector3d, Eigen::RowVector3d>>& endpoints,
+                    int num_skeleton_vertices, Eigen::MatrixXd& skeleton_vertices, JobContext& context);
+
+#endif // DEXEL_MESHING_H
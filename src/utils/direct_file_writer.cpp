@@ -0,0 +1,178 @@
+#include "direct_file_writer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::uint8_t* allocate_aligned(std::size_t size) {
+#ifdef WIN32
+    return static_cast<std::uint8_t*>(_aligned_malloc(size, DirectFileWriter::ALIGNMENT));
+#else
+    void* ptr = nullptr;
+    return posix_memalign(&ptr, DirectFileWriter::ALIGNMENT, size) == 0 ? static_cast<std::uint8_t*>(ptr) : nullptr;
+#endif
+}
+
+void free_aligned(std::uint8_t* ptr) {
+#ifdef WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+} // namespace
+
+constexpr std::size_t DirectFileWriter::ALIGNMENT;
+
+
+DirectFileWriter::~DirectFileWriter() {
+    close();
+}
+
+bool DirectFileWriter::open(const std::string& filename, std::size_t buffer_size) {
+    close();
+    _buffer_size = std::max((buffer_size + ALIGNMENT - 1) / ALIGNMENT, std::size_t(1)) * ALIGNMENT;
+    _buffer = allocate_aligned(_buffer_size);
+    if (!_buffer) {
+        return false;
+    }
+    _buffered = 0;
+    _size = 0;
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    _direct = file != INVALID_HANDLE_VALUE;
+    if (!_direct) {
+        file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    _file_handle = file == INVALID_HANDLE_VALUE ? nullptr : file;
+#else
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    _direct = false;
+#ifdef O_DIRECT
+    _fd = ::open(filename.c_str(), flags | O_DIRECT, mode);
+    _direct = _fd >= 0;
+#endif
+    if (_fd < 0) {
+        _fd = ::open(filename.c_str(), flags, mode);
+    }
+#ifdef F_NOCACHE
+    _direct = _fd >= 0 && fcntl(_fd, F_NOCACHE, 1) == 0;
+#endif
+#endif
+
+    _ok = is_open();
+    if (!_ok) {
+        free_aligned(_buffer);
+        _buffer = nullptr;
+    }
+    return _ok;
+}
+
+bool DirectFileWriter::is_open() const {
+#ifdef WIN32
+    return _file_handle != nullptr;
+#else
+    return _fd >= 0;
+#endif
+}
+
+bool DirectFileWriter::write(const void* data, std::size_t size) {
+    const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+    while (_ok && size > 0) {
+        const std::size_t n = std::min(size, _buffer_size - _buffered);
+        std::memcpy(_buffer + _buffered, bytes, n);
+        _buffered += n;
+        _size += n;
+        bytes += n;
+        size -= n;
+        if (_buffered == _buffer_size) {
+            _ok = write_buffer(_buffered);
+            _buffered = 0;
+        }
+    }
+    return _ok;
+}
+
+bool DirectFileWriter::write_buffer(std::size_t num_bytes) {
+    std::size_t done = 0;
+    while (done < num_bytes) {
+#ifdef WIN32
+        DWORD written = 0;
+        const DWORD n = DWORD(std::min<std::size_t>(num_bytes - done, std::size_t(1) << 30));
+        if (!WriteFile(_file_handle, _buffer + done, n, &written, nullptr)) {
+            return false;
+        }
+        done += written;
+#else
+        const ssize_t n = ::write(_fd, _buffer + done, num_bytes - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+#ifdef O_DIRECT
+            // Some file systems accept O_DIRECT when the file is opened and only refuse the writes
+            if (errno == EINVAL && _direct && done == 0 && fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT) == 0) {
+                _direct = false;
+                continue;
+            }
+#endif
+            return false;
+        }
+        done += std::size_t(n);
+#endif
+    }
+    return true;
+}
+
+bool DirectFileWriter::close() {
+    if (!is_open()) {
+        return false;
+    }
+
+    bool ok = _ok;
+    // Direct writes only cover whole blocks, the padding of the last one is cut off again
+    const std::size_t padded = _direct ? (_buffered + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT : _buffered;
+    if (ok && padded > 0) {
+        std::memset(_buffer + _buffered, 0, padded - _buffered);
+        ok = write_buffer(padded);
+    }
+#ifdef WIN32
+    if (ok && padded != _buffered) {
+        FILE_END_OF_FILE_INFO end_of_file;
+        end_of_file.EndOfFile.QuadPart = LONGLONG(_size);
+        ok = SetFileInformationByHandle(_file_handle, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file)) != 0;
+    }
+    ok = CloseHandle(_file_handle) != 0 && ok;
+    _file_handle = nullptr;
+#else
+    if (ok && padded != _buffered) {
+        ok = ftruncate(_fd, off_t(_size)) == 0;
+    }
+    ok = ::close(_fd) == 0 && ok;
+    _fd = -1;
+#endif
+
+    free_aligned(_buffer);
+    _buffer = nullptr;
+    _buffered = 0;
+    _ok = false;
+    return ok;
+}
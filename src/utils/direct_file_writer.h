@@ -0,0 +1,60 @@
+#ifndef DIRECT_FILE_WRITER_H
+#define DIRECT_FILE_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Sequential writer of large files that bypasses the page cache: O_DIRECT on Linux, F_NOCACHE on macOS and
+// FILE_FLAG_NO_BUFFERING on Windows. Writing a volume of several GB through the cache would evict the volume being
+// rendered and then flush it all at once. Direct writes must cover whole blocks of aligned memory at aligned
+// offsets, so the bytes are gathered in an aligned buffer and written a number of whole blocks at a time. The last
+// block is padded, and the file is cut back to its size when it is closed.
+//
+// File systems without direct I/O, such as tmpfs, get ordinary buffered writes through the same buffer. Not
+// thread safe, each file is written from a single thread, such as the one of VolumeSlabWriter.
+class DirectFileWriter {
+public:
+    // Alignment of the buffer and of the writes, a multiple of the sector size of the disks
+    static constexpr std::size_t ALIGNMENT = 4096;
+
+    DirectFileWriter() = default;
+    DirectFileWriter(const DirectFileWriter&) = delete;
+    DirectFileWriter& operator=(const DirectFileWriter&) = delete;
+    // Closes the file, see close()
+    ~DirectFileWriter();
+
+    // Create or truncate filename, gathering buffer_size bytes (rounded up to ALIGNMENT) between writes
+    bool open(const std::string& filename, std::size_t buffer_size = std::size_t(8) << 20);
+
+    // Append size bytes, returns false once a write failed
+    bool write(const void* data, std::size_t size);
+
+    // Write what is left in the buffer and close the file. Returns whether all the bytes were written.
+    bool close();
+
+    bool is_open() const;
+    // Whether the writes bypass the page cache
+    bool is_direct() const { return _direct; }
+    // Bytes passed to write() so far
+    std::uint64_t size() const { return _size; }
+
+private:
+    // Write the first num_bytes bytes of the buffer at the end of the file
+    bool write_buffer(std::size_t num_bytes);
+
+    std::uint8_t* _buffer = nullptr;
+    std::size_t _buffer_size = 0;
+    std::size_t _buffered = 0;
+    std::uint64_t _size = 0;
+    bool _direct = false;
+    bool _ok = false;
+
+#ifdef WIN32
+    void* _file_handle = nullptr;
+#else
+    int _fd = -1;
+#endif
+};
+
+#endif // DIRECT_FILE_WRITER_H
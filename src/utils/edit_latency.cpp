@@ -0,0 +1,112 @@
+#include "edit_latency.h"
+
+#include <algorithm>
+
+
+EditLatency& edit_latency() {
+    static EditLatency latency;
+    return latency;
+}
+
+EditLatency::Scope::Scope(const char* stage)
+    : _stage(stage), _enabled(edit_latency().enabled()) {
+    if (_enabled) {
+        _start = Clock::now();
+    }
+}
+
+EditLatency::Scope::~Scope() {
+    if (_enabled && edit_latency().pending()) {
+        edit_latency().add(_stage, _start);
+    }
+}
+
+void EditLatency::set_logger(std::shared_ptr<spdlog::logger> logger) {
+    _logger = std::move(logger);
+}
+
+void EditLatency::set_enabled(bool enabled) {
+    _enabled = enabled;
+    _pending = false;
+    for (Stage& s : _stages) {
+        s.edit_ms = 0.0;
+    }
+}
+
+EditLatency::Stage& EditLatency::stage(const std::string& name) {
+    for (Stage& s : _stages) {
+        if (s.name == name) {
+            return s;
+        }
+    }
+    _stages.emplace_back();
+    _stages.back().name = name;
+    return _stages.back();
+}
+
+void EditLatency::edit(const std::string& name, Clock::time_point start) {
+    if (!_enabled) {
+        return;
+    }
+    if (!_pending) {
+        _pending = true;
+        _edit_start = start;
+    }
+    add(name, start);
+}
+
+void EditLatency::add(const std::string& name, double ms) {
+    if (!_pending) {
+        return;
+    }
+    stage(name).edit_ms += ms;
+}
+
+void EditLatency::add(const std::string& name, Clock::time_point start) {
+    add(name, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+}
+
+void EditLatency::frame_done() {
+    if (!_pending) {
+        return;
+    }
+    _pending = false;
+    const double total_ms = std::chrono::duration<double, std::milli>(Clock::now() - _edit_start).count();
+    double staged_ms = 0.0;
+    for (std::size_t i = 1; i < _stages.size(); i++) {
+        staged_ms += _stages[i].edit_ms;
+    }
+    _stages[0].edit_ms = std::max(total_ms - staged_ms, 0.0);
+
+    for (Stage& s : _stages) {
+        s.last_ms = s.edit_ms;
+        s.average_ms = _num_edits == 0 ? s.edit_ms : AVERAGE_ALPHA * s.edit_ms + (1.0 - AVERAGE_ALPHA) * s.average_ms;
+    }
+    _last_ms = total_ms;
+    _num_edits += 1;
+
+    if (total_ms > _budget_ms) {
+        _num_over_budget += 1;
+        if (_logger) {
+            std::vector<const Stage*> sorted;
+            for (const Stage& s : _stages) {
+                sorted.push_back(&s);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const Stage* a, const Stage* b) {
+                return a->edit_ms > b->edit_ms;
+            });
+            std::string breakdown;
+            for (const Stage* s : sorted) {
+                if (s->edit_ms > 0.0) {
+                    breakdown += fmt::format("{}{} {:.2f} ms", breakdown.empty() ? "" : ", ", s->name, s->edit_ms);
+                }
+            }
+            _logger->warn("Cage edit took {:.2f} ms, over the budget of {:.2f} ms, mostly in {}: {}",
+                          total_ms, _budget_ms, sorted.front()->name, breakdown);
+        }
+    }
+
+    for (Stage& s : _stages) {
+        s.edit_ms = 0.0;
+    }
+}
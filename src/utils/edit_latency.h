@@ -0,0 +1,96 @@
+#ifndef EDIT_LATENCY_H
+#define EDIT_LATENCY_H
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Time from an edit of the bounding cage to the end of the frame that shows it, split into the stages the
+// edit goes through, e.g. moving the KeyFrame, meshing the cage, uploading its geometry, straightening and
+// rendering the volume. When an edit takes longer than the budget the stages are logged with the slowest first.
+//
+// The first edit handled since the last frame starts the measurement and every stage then adds the time it
+// takes, on the render thread only. What no stage covers, e.g. the wait for the frame after the input and the
+// UI, is counted as "Other". The GPU work only shows up in the stage that waits for it at the end of the frame,
+// so the owner of the frame finishes it there while tracking is enabled.
+class EditLatency {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr double DEFAULT_BUDGET_MS = 16.0;
+    static constexpr double AVERAGE_ALPHA = 0.1;
+
+    struct Stage {
+        std::string name;
+        // Time of the stage in the last edit and averaged over the edits
+        double last_ms = 0.0;
+        double average_ms = 0.0;
+        // Time of the stage in the pending edit
+        double edit_ms = 0.0;
+    };
+
+    // Adds the time until the end of the scope to stage, if an edit is pending by then
+    class Scope {
+    public:
+        explicit Scope(const char* stage);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* _stage;
+        Clock::time_point _start;
+        bool _enabled;
+    };
+
+    EditLatency() = default;
+    EditLatency(const EditLatency&) = delete;
+    EditLatency& operator=(const EditLatency&) = delete;
+
+    // Edits over the budget are logged to logger
+    void set_logger(std::shared_ptr<spdlog::logger> logger);
+
+    bool enabled() const { return _enabled; }
+    void set_enabled(bool enabled);
+    double budget_ms() const { return _budget_ms; }
+    void set_budget_ms(double budget_ms) { _budget_ms = budget_ms; }
+
+    // An edit handled from start until now, which starts the measurement unless an edit is pending already
+    void edit(const std::string& stage, Clock::time_point start);
+    bool pending() const { return _pending; }
+    // Time spent in stage for the pending edit, given or from start until now
+    void add(const std::string& stage, double ms);
+    void add(const std::string& stage, Clock::time_point start);
+    // The frame showing the pending edit is done
+    void frame_done();
+
+    // In the order they were first seen, "Other" comes first
+    const std::vector<Stage>& stages() const { return _stages; }
+    double last_ms() const { return _last_ms; }
+    int num_edits() const { return _num_edits; }
+    int num_over_budget() const { return _num_over_budget; }
+
+private:
+    Stage& stage(const std::string& name);
+
+    std::shared_ptr<spdlog::logger> _logger;
+    bool _enabled = false;
+    double _budget_ms = DEFAULT_BUDGET_MS;
+
+    bool _pending = false;
+    Clock::time_point _edit_start;
+    std::vector<Stage> _stages = std::vector<Stage>(1, Stage{ "Other" });
+
+    double _last_ms = 0.0;
+    int _num_edits = 0;
+    int _num_over_budget = 0;
+};
+
+// Latency of the edits of the bounding cage
+EditLatency& edit_latency();
+
+#endif // EDIT_LATENCY_H
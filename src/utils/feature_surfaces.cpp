@@ -0,0 +1,262 @@
+#include "feature_surfaces.h"
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "marching_cubes.h"
+#include "task_scheduler.h"
+
+namespace {
+
+constexpr std::uint32_t NO_FEATURE = ~std::uint32_t(0);
+
+// Eigenvalues of the quadric below this fraction of the largest one are treated as 0, the vertex then stays at
+// the mean of its cluster along their directions, e.g. along a flat face
+constexpr double QUADRIC_EIGENVALUE_THRESHOLD = 1e-3;
+
+// Cells are packed into 21 bits per axis, offset so that the slightly negative cells at the border count too
+constexpr std::int64_t CELL_OFFSET = std::int64_t(1) << 20;
+
+std::int64_t cell_key(const Eigen::Vector3i& cell) {
+    return (cell[0] + CELL_OFFSET) | ((cell[1] + CELL_OFFSET) << 21) | ((cell[2] + CELL_OFFSET) << 42);
+}
+
+struct FeatureMesh {
+    Eigen::MatrixXd V[FeatureSurfaces::NUM_LEVELS];
+    Eigen::MatrixXi F[FeatureSurfaces::NUM_LEVELS];
+};
+
+// Marching cubes over the voxels of the arcs of a feature and the voxels around them, in voxel units
+void mesh_feature(const IndexVoxelRuns& runs, const std::vector<std::uint32_t>& arcs, FeatureMesh& mesh) {
+    const int height = runs.volume_dims[1];
+    Eigen::Vector3i min_corner = Eigen::Vector3i::Constant(std::numeric_limits<int>::max());
+    Eigen::Vector3i max_corner = Eigen::Vector3i::Constant(std::numeric_limits<int>::min());
+    for (std::uint32_t arc : arcs) {
+        for (std::size_t r = runs.offsets[arc]; r < runs.offsets[arc + 1]; r++) {
+            const IndexVoxelRuns::Run& run = runs.runs[r];
+            const Eigen::Vector3i begin(int(run.begin), int(run.row % height), int(run.row / height));
+            min_corner = min_corner.cwiseMin(begin);
+            max_corner = max_corner.cwiseMax(Eigen::Vector3i(int(run.end) - 1, begin[1], begin[2]));
+        }
+    }
+    if ((min_corner.array() > max_corner.array()).any()) {
+        return;
+    }
+
+    // A layer of empty voxels on every side closes the surface
+    const Eigen::Vector3i lo = min_corner.array() - 1;
+    const Eigen::Vector3i dims = max_corner - min_corner + Eigen::Vector3i::Constant(3);
+    std::vector<std::uint8_t> mask(std::size_t(dims[0]) * dims[1] * dims[2], 0);
+    for (std::uint32_t arc : arcs) {
+        for (std::size_t r = runs.offsets[arc]; r < runs.offsets[arc + 1]; r++) {
+            const IndexVoxelRuns::Run& run = runs.runs[r];
+            const int y = int(run.row % height) - lo[1], z = int(run.row / height) - lo[2];
+            std::uint8_t* row = mask.data() + (std::size_t(z) * dims[1] + y) * dims[0] - lo[0];
+            std::fill(row + run.begin, row + run.end, std::uint8_t(1));
+        }
+    }
+
+    MarchingCubesGrid grid;
+    grid.origin = lo.cast<double>().transpose().array() + 0.5;
+    grid.dims = dims;
+    Eigen::MatrixXd V;
+    Eigen::MatrixXi F;
+    marching_cubes(grid, [&](int x, int y, int z) {
+        return mask[(std::size_t(z) * dims[1] + y) * dims[0] + x];
+    }, 0.5, V, F);
+    mask = std::vector<std::uint8_t>();
+
+    for (int l = 0; l < FeatureSurfaces::NUM_LEVELS; l++) {
+        cluster_vertex_quadrics(V, F, double(1 << l), mesh.V[l], mesh.F[l]);
+    }
+}
+
+} // namespace
+
+constexpr int FeatureSurfaces::NUM_LEVELS;
+
+
+void FeatureSurfaces::write(ProjectFileWriter& writer) const {
+    for (int l = 0; l < NUM_LEVELS; l++) {
+        writer.add_matrix("V" + std::to_string(l), levels[l].V);
+        writer.add_matrix("F" + std::to_string(l), levels[l].F);
+        writer.add_vector("vertex_features" + std::to_string(l), levels[l].vertex_features);
+    }
+}
+
+bool FeatureSurfaces::read(const ProjectFile& file) {
+    for (int l = 0; l < NUM_LEVELS; l++) {
+        Level& level = levels[l];
+        bool ok = file.read_matrix("V" + std::to_string(l), level.V) &&
+                  file.read_matrix("F" + std::to_string(l), level.F) &&
+                  file.read_vector("vertex_features" + std::to_string(l), level.vertex_features);
+        ok = ok && level.V.cols() == 3 && level.F.cols() == 3 &&
+             level.vertex_features.size() == std::size_t(level.V.rows());
+        ok = ok && (level.F.rows() == 0 || (level.F.minCoeff() >= 0 && level.F.maxCoeff() < level.V.rows()));
+        if (!ok) {
+            *this = FeatureSurfaces();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool extract_feature_surfaces(const IndexVoxelRuns& runs, const std::vector<std::uint32_t>& contour_features,
+                              FeatureSurfaces& surfaces, JobContext& context) {
+    surfaces = FeatureSurfaces();
+    const std::uint32_t num_features = contour_features.empty() ? 0 : contour_features[0];
+    std::vector<std::vector<std::uint32_t>> feature_arcs(num_features);
+    for (std::size_t arc = 0; arc < runs.num_ids() && arc + 1 < contour_features.size(); arc++) {
+        const std::uint32_t feature = contour_features[arc + 1];
+        if (feature != NO_FEATURE && feature < num_features) {
+            feature_arcs[feature].push_back(std::uint32_t(arc));
+        }
+    }
+
+    // The features are spread over the threads, and the slabs of the marching cubes of a large one as well
+    std::vector<FeatureMesh> meshes(num_features);
+    std::atomic<std::uint32_t> num_done(0);
+    parallel_tasks(num_features, [&](std::size_t f) {
+        if (context.cancelled()) {
+            return;
+        }
+        mesh_feature(runs, feature_arcs[f], meshes[f]);
+        context.set_progress(float(++num_done) / float(num_features));
+    });
+    if (context.cancelled()) {
+        return false;
+    }
+
+    const Eigen::RowVector3f dims = runs.volume_dims.cast<float>();
+    for (int l = 0; l < FeatureSurfaces::NUM_LEVELS; l++) {
+        Eigen::Index num_vertices = 0, num_faces = 0;
+        for (const FeatureMesh& mesh : meshes) {
+            num_vertices += mesh.V[l].rows();
+            num_faces += mesh.F[l].rows();
+        }
+        FeatureSurfaces::Level& level = surfaces.levels[l];
+        level.V.resize(num_vertices, 3);
+        level.F.resize(num_faces, 3);
+        level.vertex_features.resize(std::size_t(num_vertices));
+        Eigen::Index vertex_offset = 0, face_offset = 0;
+        for (std::uint32_t f = 0; f < num_features; f++) {
+            const FeatureMesh& mesh = meshes[f];
+            const Eigen::Index n = mesh.V[l].rows();
+            level.V.middleRows(vertex_offset, n) =
+                    mesh.V[l].cast<float>().array().rowwise() / dims.array();
+            level.F.middleRows(face_offset, mesh.F[l].rows()) = mesh.F[l].array() + int(vertex_offset);
+            std::fill_n(level.vertex_features.begin() + vertex_offset, n, f + 1);
+            vertex_offset += n;
+            face_offset += mesh.F[l].rows();
+        }
+    }
+    return true;
+}
+
+void cluster_vertex_quadrics(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F, double cell_size,
+                             Eigen::MatrixXd& V_out, Eigen::MatrixXi& F_out) {
+    // Number the clusters in the order of their cells, which does not depend on the order of the vertices
+    std::vector<std::pair<std::int64_t, int>> keys(std::size_t(V.rows()));
+    for (Eigen::Index v = 0; v < V.rows(); v++) {
+        const Eigen::Vector3i cell = (V.row(v).transpose() / cell_size).array().floor().cast<int>();
+        keys[v] = std::make_pair(cell_key(cell), int(v));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<int> cluster(std::size_t(V.rows()));
+    std::vector<Eigen::Vector3i> cells;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            cells.push_back((V.row(keys[i].second).transpose() / cell_size).array().floor().cast<int>());
+        }
+        cluster[keys[i].second] = int(cells.size()) - 1;
+    }
+    const std::size_t num_clusters = cells.size();
+
+    // The quadric x^T A x + 2 b^T x + c of the squared distances to the planes of the faces around each cluster,
+    // weighted by the areas of the faces
+    std::vector<Eigen::Matrix3d> A(num_clusters, Eigen::Matrix3d::Zero());
+    std::vector<Eigen::Vector3d> b(num_clusters, Eigen::Vector3d::Zero());
+    std::vector<Eigen::Vector3d> sum(num_clusters, Eigen::Vector3d::Zero());
+    std::vector<int> count(num_clusters, 0);
+    for (Eigen::Index v = 0; v < V.rows(); v++) {
+        sum[cluster[v]] += V.row(v).transpose();
+        count[cluster[v]]++;
+    }
+    for (Eigen::Index f = 0; f < F.rows(); f++) {
+        const Eigen::Vector3d p0 = V.row(F(f, 0)).transpose();
+        const Eigen::Vector3d e1 = V.row(F(f, 1)).transpose() - p0;
+        const Eigen::Vector3d e2 = V.row(F(f, 2)).transpose() - p0;
+        const Eigen::Vector3d n = e1.cross(e2);
+        const double double_area = n.norm();
+        if (double_area == 0.0) {
+            continue;
+        }
+        const Eigen::Vector3d normal = n / double_area;
+        const double d = -normal.dot(p0);
+        const Eigen::Matrix3d face_A = 0.5 * double_area * normal * normal.transpose();
+        const Eigen::Vector3d face_b = 0.5 * double_area * d * normal;
+        for (int c = 0; c < 3; c++) {
+            A[cluster[F(f, c)]] += face_A;
+            b[cluster[F(f, c)]] += face_b;
+        }
+    }
+
+    V_out.resize(Eigen::Index(num_clusters), 3);
+    for (std::size_t k = 0; k < num_clusters; k++) {
+        // Minimize the quadric from the mean of the cluster, through the pseudo inverse of A
+        const Eigen::Vector3d mean = sum[k] / double(count[k]);
+        Eigen::Vector3d x = mean;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(A[k]);
+        const Eigen::Vector3d& eigenvalues = solver.eigenvalues();
+        const double largest = eigenvalues.cwiseAbs().maxCoeff();
+        if (largest > 0.0) {
+            const Eigen::Vector3d gradient = solver.eigenvectors().transpose() * (A[k] * mean + b[k]);
+            Eigen::Vector3d step = Eigen::Vector3d::Zero();
+            for (int i = 0; i < 3; i++) {
+                if (std::abs(eigenvalues[i]) > QUADRIC_EIGENVALUE_THRESHOLD * largest) {
+                    step[i] = -gradient[i] / eigenvalues[i];
+                }
+            }
+            x += solver.eigenvectors() * step;
+        }
+        // The vertex stays in its cell so that the simplified surface stays close to the original one
+        const Eigen::Vector3d cell_min = cells[k].cast<double>() * cell_size;
+        const Eigen::Vector3d cell_max = cell_min.array() + cell_size;
+        x = x.cwiseMax(cell_min).cwiseMin(cell_max);
+        V_out.row(Eigen::Index(k)) = x.transpose();
+    }
+
+    // Faces whose vertices fall into fewer than three clusters collapse, a face over the same three clusters as
+    // an earlier one is dropped as well
+    std::vector<std::pair<std::array<int, 3>, Eigen::Index>> faces;
+    faces.reserve(std::size_t(F.rows()));
+    for (Eigen::Index f = 0; f < F.rows(); f++) {
+        std::array<int, 3> corners = { { cluster[F(f, 0)], cluster[F(f, 1)], cluster[F(f, 2)] } };
+        if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]) {
+            continue;
+        }
+        std::sort(corners.begin(), corners.end());
+        faces.emplace_back(corners, f);
+    }
+    std::sort(faces.begin(), faces.end());
+    std::vector<Eigen::Index> kept;
+    kept.reserve(faces.size());
+    for (std::size_t i = 0; i < faces.size(); i++) {
+        if (i == 0 || faces[i].first != faces[i - 1].first) {
+            kept.push_back(faces[i].second);
+        }
+    }
+    std::sort(kept.begin(), kept.end());
+    F_out.resize(Eigen::Index(kept.size()), 3);
+    for (std::size_t i = 0; i < kept.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            F_out(Eigen::Index(i), c) = cluster[F(kept[i], c)];
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef FEATURE_SURFACES_H
+#define FEATURE_SURFACES_H
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <vector>
+
+#include "background_job.h"
+#include "dexel_meshing.h"
+#include "project_file.h"
+
+// Surface meshes of the features of the segmented low resolution volume, drawn instead of ray casting the index
+// volume where the GPU is too slow for it. Each feature is meshed on its own, so no vertex is shared by two
+// features and the mesh of every vertex tells which feature it belongs to, which is all picking needs.
+struct FeatureSurfaces {
+    // Levels of detail. Level l clusters the vertices into cells of 2^l voxels, level 0 mostly merges the
+    // vertices marching cubes puts close together on the staircase of the voxels.
+    static constexpr int NUM_LEVELS = 3;
+
+    struct Level {
+        // Vertices in the texture coordinates of the volume, voxel (x, y, z) is centered at (x + 0.5) / dims.x
+        // and so on, and faces pointing out of their feature
+        Eigen::MatrixXf V;
+        Eigen::MatrixXi F;
+        // Feature + 1 of every vertex, the numbering of the selection list and of the picking passes
+        std::vector<std::uint32_t> vertex_features;
+    };
+    Level levels[NUM_LEVELS];
+
+    bool empty() const { return levels[0].F.rows() == 0; }
+
+    void write(ProjectFileWriter& writer) const;
+    // Returns false if a level is missing or inconsistent
+    bool read(const ProjectFile& file);
+};
+
+// Mesh the boundary of the voxels of every feature with marching cubes, then simplify each mesh with
+// cluster_vertex_quadrics for every level. contour_features is the map of the selection renderer: arc i of runs
+// belongs to feature contour_features[i + 1], or to none if that is ~0. The features are meshed in parallel, each
+// within the bounding box of its runs. Returns false if the job was cancelled.
+bool extract_feature_surfaces(const IndexVoxelRuns& runs, const std::vector<std::uint32_t>& contour_features,
+                              FeatureSurfaces& surfaces, JobContext& context);
+
+// Quadric error based simplification by vertex clustering (Lindstrom, "Out-of-Core Simplification of Large
+// Polygonal Models"). The vertices in each cell of cell_size are merged into one, placed where the sum of the
+// squared distances to the planes of their faces is smallest within the cell, and the faces that collapse are
+// dropped. Unlike edge collapses it takes a single pass and cannot fail, at the price of non manifold edges
+// where thin parts collapse, which do not matter for drawing the mesh.
+void cluster_vertex_quadrics(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F, double cell_size,
+                             Eigen::MatrixXd& V_out, Eigen::MatrixXi& F_out);
+
+#endif // FEATURE_SURFACES_H
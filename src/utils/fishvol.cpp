@@ -0,0 +1,428 @@
+#include "fishvol.h"
+
+#include "parallel_for.h"
+#include "raw_volume_view.h"
+
+#include <QByteArray>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+
+namespace {
+
+const char FISHVOL_MAGIC[8] = { 'F', 'I', 'S', 'H', 'V', 'O', 'L', '\0' };
+
+Eigen::RowVector3i bricks_for_dims(const Eigen::RowVector3i& dims, int brick_size) {
+    return Eigen::RowVector3i((dims[0] + brick_size - 1) / brick_size,
+                              (dims[1] + brick_size - 1) / brick_size,
+                              (dims[2] + brick_size - 1) / brick_size);
+}
+
+Eigen::RowVector3i extent_of_brick(const Eigen::RowVector3i& dims, int brick_size, const Eigen::RowVector3i& b) {
+    Eigen::RowVector3i extent;
+    for (int i = 0; i < 3; i++) {
+        extent[i] = std::min(brick_size, dims[i] - b[i] * brick_size);
+    }
+    return extent;
+}
+
+template <typename T>
+void write_pod(std::ofstream& of, const T& value) {
+    of.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void read_pod(std::ifstream& is, T& value) {
+    is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+// Write the levels returned by level_data_for(l) in order, each is only read until the next one is requested
+bool write_levels(const std::string& filename, const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                  int num_levels, std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options,
+                  const std::function<const std::uint8_t*(int)>& level_data_for);
+
+} // namespace
+
+
+Eigen::RowVector3i fishvol_coarser_dims(const Eigen::RowVector3i& dims) {
+    Eigen::RowVector3i out_dims;
+    for (int i = 0; i < 3; i++) {
+        out_dims[i] = std::max((dims[i] + 1) / 2, 1);
+    }
+    return out_dims;
+}
+
+// 8 bit volumes are box filtered, anything wider is treated as labels and point sampled since averaging
+// label ids is meaningless
+void fishvol_downsample_slices(const std::uint8_t* in, const Eigen::RowVector3i& in_dims, std::size_t bytes_per_voxel,
+                               std::uint8_t* out, int z_begin, int z_end) {
+    const Eigen::RowVector3i out_dims = fishvol_coarser_dims(in_dims);
+    const std::size_t iw = std::size_t(in_dims[0]), ih = std::size_t(in_dims[1]);
+    const std::size_t ow = std::size_t(out_dims[0]), oh = std::size_t(out_dims[1]);
+    z_begin = std::max(z_begin, 0);
+    z_end = std::min(z_end, out_dims[2]);
+    if (z_end <= z_begin) {
+        return;
+    }
+
+    parallel_for_chunks(std::size_t(z_end - z_begin), [&](std::size_t chunk_begin, std::size_t chunk_end, std::size_t) {
+        for (std::size_t z = std::size_t(z_begin) + chunk_begin; z < std::size_t(z_begin) + chunk_end; z++) {
+            for (std::size_t y = 0; y < oh; y++) {
+                for (std::size_t x = 0; x < ow; x++) {
+                    std::uint8_t* dst = out + ((z * oh + y) * ow + x) * bytes_per_voxel;
+                    if (bytes_per_voxel != 1) {
+                        const std::uint8_t* src = in + ((2*z * ih + 2*y) * iw + 2*x) * bytes_per_voxel;
+                        std::memcpy(dst, src, bytes_per_voxel);
+                        continue;
+                    }
+
+                    std::uint32_t sum = 0, count = 0;
+                    for (std::size_t dz = 2*z; dz < std::min(2*z + 2, std::size_t(in_dims[2])); dz++) {
+                        for (std::size_t dy = 2*y; dy < std::min(2*y + 2, ih); dy++) {
+                            for (std::size_t dx = 2*x; dx < std::min(2*x + 2, iw); dx++) {
+                                sum += in[(dz * ih + dy) * iw + dx];
+                                count += 1;
+                            }
+                        }
+                    }
+                    *dst = static_cast<std::uint8_t>(sum / count);
+                }
+            }
+        }
+    }, 1);
+}
+
+
+bool is_fishvol_filename(const std::string& filename) {
+    static const std::string extension = ".fishvol";
+    return filename.size() >= extension.size() &&
+            filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+bool write_fishvol(const std::string& filename, const std::uint8_t* data, const Eigen::RowVector3i& dims,
+                   std::size_t bytes_per_voxel, std::shared_ptr<spdlog::logger> logger,
+                   const FishVolWriteOptions& options) {
+    // Each level is downsampled from the previous one right before it is written
+    std::vector<std::uint8_t> coarse_data, next_coarse_data;
+    const std::uint8_t* level_data = data;
+    Eigen::RowVector3i level_dims = dims;
+    return write_levels(filename, dims, bytes_per_voxel, std::max(options.num_levels, 1), logger, options, [&](int l) {
+        if (l > 0) {
+            const Eigen::RowVector3i coarse_dims = fishvol_coarser_dims(level_dims);
+            next_coarse_data.resize(std::size_t(coarse_dims.prod()) * bytes_per_voxel);
+            fishvol_downsample_slices(level_data, level_dims, bytes_per_voxel, next_coarse_data.data(), 0, coarse_dims[2]);
+            coarse_data.swap(next_coarse_data);
+            level_data = coarse_data.data();
+            level_dims = coarse_dims;
+        }
+        return level_data;
+    });
+}
+
+bool write_fishvol_levels(const std::string& filename, const std::vector<const std::uint8_t*>& levels,
+                          const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                          std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options) {
+    if (levels.empty()) {
+        logger->error("Cannot write empty volume to '{}'", filename);
+        return false;
+    }
+    return write_levels(filename, dims, bytes_per_voxel, int(levels.size()), logger, options,
+                        [&](int l) { return levels[std::size_t(l)]; });
+}
+
+namespace {
+
+bool write_levels(const std::string& filename, const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                  int num_levels, std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options,
+                  const std::function<const std::uint8_t*(int)>& level_data_for) {
+    const int brick_size = std::max(options.brick_size, 1);
+    if (dims.minCoeff() <= 0 || bytes_per_voxel == 0) {
+        logger->error("Cannot write empty volume to '{}'", filename);
+        return false;
+    }
+
+    std::ofstream of(filename, std::ofstream::binary);
+    if (!of.good()) {
+        logger->error("Failed to create fishvol file '{}'", filename);
+        return false;
+    }
+
+    // The header has a fixed size given the dimensions, so we reserve it and fill in the brick index at the end
+    std::vector<Eigen::RowVector3i> level_dims(num_levels);
+    level_dims[0] = dims;
+    std::uint64_t header_size = sizeof(FISHVOL_MAGIC) + 4 * sizeof(std::uint32_t);
+    for (int l = 0; l < num_levels; l++) {
+        if (l > 0) {
+            level_dims[l] = fishvol_coarser_dims(level_dims[l-1]);
+        }
+        header_size += 3 * sizeof(std::int32_t) + std::uint64_t(bricks_for_dims(level_dims[l], brick_size).prod()) * 16;
+    }
+    std::vector<char> zeros(header_size, 0);
+    of.write(zeros.data(), zeros.size());
+
+    struct StoredBrick {
+        QByteArray bytes;
+        std::uint32_t encoding;
+        std::uint32_t stored_size;
+    };
+    std::vector<std::vector<std::uint64_t>> offsets(num_levels);
+    std::vector<std::vector<StoredBrick>> stored(num_levels);
+
+    std::uint64_t offset = header_size;
+    for (int l = 0; l < num_levels; l++) {
+        const std::uint8_t* level_data = level_data_for(l);
+
+        const Eigen::RowVector3i ldims = level_dims[l];
+        const Eigen::RowVector3i nb = bricks_for_dims(ldims, brick_size);
+        const std::size_t num_bricks = std::size_t(nb.prod());
+        stored[l].resize(num_bricks);
+
+        // Gather and compress bricks in parallel, the writes below are serial
+        parallel_for_chunks(num_bricks, [&](std::size_t begin, std::size_t end, std::size_t) {
+            std::vector<std::uint8_t> brick;
+            for (std::size_t i = begin; i < end; i++) {
+                const Eigen::RowVector3i b(int(i % nb[0]), int((i / nb[0]) % nb[1]), int(i / (std::size_t(nb[0]) * nb[1])));
+                const Eigen::RowVector3i ext = extent_of_brick(ldims, brick_size, b);
+                const std::size_t row_bytes = std::size_t(ext[0]) * bytes_per_voxel;
+                brick.resize(std::size_t(ext.prod()) * bytes_per_voxel);
+                for (int z = 0; z < ext[2]; z++) {
+                    for (int y = 0; y < ext[1]; y++) {
+                        const std::size_t src = ((std::size_t(b[2] * brick_size + z) * ldims[1] +
+                                                  std::size_t(b[1] * brick_size + y)) * ldims[0] +
+                                                 std::size_t(b[0] * brick_size)) * bytes_per_voxel;
+                        std::memcpy(brick.data() + (std::size_t(z) * ext[1] + y) * row_bytes, level_data + src, row_bytes);
+                    }
+                }
+
+                QByteArray compressed = qCompress(brick.data(), int(brick.size()), options.compression_level);
+                if (std::size_t(compressed.size()) < brick.size()) {
+                    stored[l][i] = { compressed, FISHVOL_BRICK_ZLIB, 0 };
+                } else {
+                    stored[l][i] = { QByteArray(reinterpret_cast<const char*>(brick.data()), int(brick.size())), FISHVOL_BRICK_STORED, 0 };
+                }
+            }
+        }, 1);
+
+        // Only the index entries are kept around once a level has been written
+        offsets[l].resize(num_bricks);
+        for (std::size_t i = 0; i < num_bricks; i++) {
+            offsets[l][i] = offset;
+            of.write(stored[l][i].bytes.constData(), stored[l][i].bytes.size());
+            offset += std::uint64_t(stored[l][i].bytes.size());
+            stored[l][i].stored_size = std::uint32_t(stored[l][i].bytes.size());
+            stored[l][i].bytes = QByteArray();
+        }
+    }
+
+    of.seekp(0);
+    of.write(FISHVOL_MAGIC, sizeof(FISHVOL_MAGIC));
+    write_pod(of, FISHVOL_VERSION);
+    write_pod(of, std::uint32_t(bytes_per_voxel));
+    write_pod(of, std::uint32_t(brick_size));
+    write_pod(of, std::uint32_t(num_levels));
+    for (int l = 0; l < num_levels; l++) {
+        for (int i = 0; i < 3; i++) {
+            write_pod(of, std::int32_t(level_dims[l][i]));
+        }
+        for (std::size_t i = 0; i < stored[l].size(); i++) {
+            write_pod(of, offsets[l][i]);
+            write_pod(of, stored[l][i].stored_size);
+            write_pod(of, stored[l][i].encoding);
+        }
+    }
+
+    if (!of.good()) {
+        logger->error("Failed to write fishvol file '{}'", filename);
+        return false;
+    }
+    const std::uint64_t raw_size = std::uint64_t(dims.prod()) * bytes_per_voxel;
+    logger->info("Wrote fishvol file '{}' ({} bytes, {} bytes uncompressed)", filename, offset, raw_size);
+    return true;
+}
+
+} // namespace
+
+
+bool convert_rawfile_to_fishvol(const std::string& rawfilename, const std::string& fishvolfilename,
+                                const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                                std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options) {
+    RawVolumeView view;
+    if (!view.open(rawfilename, dims, logger, bytes_per_voxel)) {
+        return false;
+    }
+    return write_fishvol(fishvolfilename, view.data(), dims, bytes_per_voxel, logger, options);
+}
+
+
+bool FishVolFile::open(const std::string& filename, std::shared_ptr<spdlog::logger> logger) {
+    close();
+    _file.open(filename, std::ifstream::binary);
+    if (!_file.is_open()) {
+        logger->error("Fishvol file '{}' does not exist.", filename);
+        return false;
+    }
+    _filename = filename;
+
+    char magic[sizeof(FISHVOL_MAGIC)];
+    std::uint32_t version = 0, bytes_per_voxel = 0, brick_size = 0, num_levels = 0;
+    _file.read(magic, sizeof(magic));
+    read_pod(_file, version);
+    read_pod(_file, bytes_per_voxel);
+    read_pod(_file, brick_size);
+    read_pod(_file, num_levels);
+    if (!_file.good() || std::memcmp(magic, FISHVOL_MAGIC, sizeof(magic)) != 0) {
+        logger->error("'{}' is not a fishvol file.", filename);
+        close();
+        return false;
+    }
+    if (version > FISHVOL_VERSION) {
+        logger->error("Fishvol file '{}' has version {} but only versions up to {} are supported.", filename, version, FISHVOL_VERSION);
+        close();
+        return false;
+    }
+    if (bytes_per_voxel == 0 || brick_size == 0 || num_levels == 0) {
+        logger->error("Fishvol file '{}' has an invalid header.", filename);
+        close();
+        return false;
+    }
+    _bytes_per_voxel = bytes_per_voxel;
+    _brick_size = int(brick_size);
+
+    _levels.resize(num_levels);
+    for (Level& level : _levels) {
+        std::int32_t d[3] = { 0, 0, 0 };
+        read_pod(_file, d[0]);
+        read_pod(_file, d[1]);
+        read_pod(_file, d[2]);
+        level.dims = Eigen::RowVector3i(d[0], d[1], d[2]);
+        if (!_file.good() || level.dims.minCoeff() <= 0) {
+            logger->error("Fishvol file '{}' has an invalid level header.", filename);
+            close();
+            return false;
+        }
+        level.num_bricks = bricks_for_dims(level.dims, _brick_size);
+        level.bricks.resize(std::size_t(level.num_bricks.prod()));
+        for (BrickEntry& entry : level.bricks) {
+            read_pod(_file, entry.offset);
+            read_pod(_file, entry.stored_size);
+            read_pod(_file, entry.encoding);
+        }
+        if (!_file.good()) {
+            logger->error("Fishvol file '{}' has a truncated brick index.", filename);
+            close();
+            return false;
+        }
+    }
+
+    logger->trace("Opened fishvol file '{}' with {} levels of {}^3 bricks", filename, _levels.size(), _brick_size);
+    return true;
+}
+
+void FishVolFile::close() {
+    if (_file.is_open()) {
+        _file.close();
+    }
+    _file.clear();
+    _levels.clear();
+    _filename.clear();
+}
+
+Eigen::RowVector3i FishVolFile::brick_extent(int level, const Eigen::RowVector3i& b) const {
+    return extent_of_brick(_levels[level].dims, _brick_size, b);
+}
+
+bool FishVolFile::read_brick(int level, const Eigen::RowVector3i& b, std::vector<std::uint8_t>& out,
+                             std::shared_ptr<spdlog::logger> logger) {
+    const Level& lvl = _levels[level];
+    const BrickEntry& entry = lvl.bricks[(std::size_t(b[2]) * lvl.num_bricks[1] + b[1]) * lvl.num_bricks[0] + b[0]];
+    const std::size_t num_bytes = std::size_t(brick_extent(level, b).prod()) * _bytes_per_voxel;
+
+    QByteArray stored_bytes(int(entry.stored_size), Qt::Uninitialized);
+    {
+        std::lock_guard<std::mutex> lock(_file_mutex);
+        _file.seekg(std::streamoff(entry.offset));
+        _file.read(stored_bytes.data(), entry.stored_size);
+        if (!_file.good()) {
+            _file.clear();
+            logger->error("Failed to read brick ({}, {}, {}) of fishvol file '{}'", b[0], b[1], b[2], _filename);
+            return false;
+        }
+    }
+
+    if (entry.encoding == FISHVOL_BRICK_STORED) {
+        out.assign(stored_bytes.constData(), stored_bytes.constData() + stored_bytes.size());
+    } else if (entry.encoding == FISHVOL_BRICK_ZLIB) {
+        const QByteArray bytes = qUncompress(stored_bytes);
+        out.assign(bytes.constData(), bytes.constData() + bytes.size());
+    } else {
+        logger->error("Brick ({}, {}, {}) of fishvol file '{}' has unknown encoding {}", b[0], b[1], b[2], _filename, entry.encoding);
+        return false;
+    }
+
+    if (out.size() != num_bytes) {
+        logger->error("Brick ({}, {}, {}) of fishvol file '{}' has {} bytes but expected {}", b[0], b[1], b[2], _filename, out.size(), num_bytes);
+        return false;
+    }
+    return true;
+}
+
+bool FishVolFile::read_region(int level, const Eigen::RowVector3i& begin, const Eigen::RowVector3i& end,
+                              std::uint8_t* out, std::shared_ptr<spdlog::logger> logger) {
+    if (level < 0 || level >= num_levels()) {
+        logger->error("Fishvol file '{}' has no level {}", _filename, level);
+        return false;
+    }
+    const Level& lvl = _levels[level];
+    if (begin.minCoeff() < 0 || (end - lvl.dims).maxCoeff() > 0 || (end - begin).minCoeff() <= 0) {
+        logger->error("Invalid region [{} {} {}] - [{} {} {}] for fishvol file '{}'",
+                      begin[0], begin[1], begin[2], end[0], end[1], end[2], _filename);
+        return false;
+    }
+
+    const Eigen::RowVector3i region = end - begin;
+    const Eigen::RowVector3i b_begin = begin / _brick_size;
+    const Eigen::RowVector3i b_end = (end + Eigen::RowVector3i::Constant(_brick_size - 1)) / _brick_size;
+    const Eigen::RowVector3i nb = b_end - b_begin;
+    const std::size_t num_bricks = std::size_t(nb.prod());
+
+    std::atomic_bool failed(false);
+    parallel_for_chunks(num_bricks, [&](std::size_t chunk_begin, std::size_t chunk_end, std::size_t) {
+        std::vector<std::uint8_t> brick;
+        for (std::size_t i = chunk_begin; i < chunk_end && !failed; i++) {
+            const Eigen::RowVector3i b = b_begin + Eigen::RowVector3i(int(i % nb[0]), int((i / nb[0]) % nb[1]), int(i / (std::size_t(nb[0]) * nb[1])));
+            if (!read_brick(level, b, brick, logger)) {
+                failed = true;
+                return;
+            }
+
+            // Copy the part of the brick overlapping the region row by row
+            const Eigen::RowVector3i ext = brick_extent(level, b);
+            const Eigen::RowVector3i origin = b * _brick_size;
+            const Eigen::RowVector3i lo = origin.cwiseMax(begin);
+            const Eigen::RowVector3i hi = (origin + ext).cwiseMin(end);
+            const std::size_t row_bytes = std::size_t(hi[0] - lo[0]) * _bytes_per_voxel;
+            for (int z = lo[2]; z < hi[2]; z++) {
+                for (int y = lo[1]; y < hi[1]; y++) {
+                    const std::size_t src = ((std::size_t(z - origin[2]) * ext[1] + (y - origin[1])) * ext[0] + (lo[0] - origin[0])) * _bytes_per_voxel;
+                    const std::size_t dst = ((std::size_t(z - begin[2]) * region[1] + (y - begin[1])) * region[0] + (lo[0] - begin[0])) * _bytes_per_voxel;
+                    std::memcpy(out + dst, brick.data() + src, row_bytes);
+                }
+            }
+        }
+    }, 1);
+
+    return !failed;
+}
+
+bool FishVolFile::read_level(int level, std::vector<std::uint8_t>& out, std::shared_ptr<spdlog::logger> logger) {
+    if (level < 0 || level >= num_levels()) {
+        logger->error("Fishvol file '{}' has no level {}", _filename, level);
+        return false;
+    }
+    out.resize(std::size_t(_levels[level].dims.prod()) * _bytes_per_voxel);
+    return read_region(level, Eigen::RowVector3i::Zero(), _levels[level].dims, out.data(), logger);
+}
@@ -0,0 +1,139 @@
+#ifndef FISHVOL_H
+#define FISHVOL_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// .fishvol is a chunked, compressed container for scalar volumes. The volume is split into
+// cubic bricks (64^3 by default) which are compressed independently, and a header index stores
+// where each brick lives in the file. This lets readers decompress only the bricks overlapping
+// the region they need. A file can optionally hold a pyramid of 2x downsampled levels.
+//
+// Layout (little endian):
+//   char[8]  magic "FISHVOL\0"
+//   uint32   version
+//   uint32   bytes_per_voxel
+//   uint32   brick_size
+//   uint32   num_levels
+//   for each level:
+//     int32[3]  dimensions
+//     for each brick (x fastest, then y, then z):
+//       uint64  file offset
+//       uint32  stored size in bytes
+//       uint32  encoding (FISHVOL_BRICK_*)
+//   brick data...
+//
+// Brick voxels are tightly packed to the extent of the brick, which is smaller than brick_size
+// at the upper faces of the volume.
+
+static constexpr std::uint32_t FISHVOL_VERSION = 1;
+static constexpr int FISHVOL_DEFAULT_BRICK_SIZE = 64;
+
+enum FishVolBrickEncoding : std::uint32_t {
+    FISHVOL_BRICK_STORED = 0,  // Uncompressed voxels
+    FISHVOL_BRICK_ZLIB = 1,    // zlib stream (qCompress framing)
+};
+
+struct FishVolWriteOptions {
+    int brick_size = FISHVOL_DEFAULT_BRICK_SIZE;
+
+    // Total number of levels including the full resolution one
+    int num_levels = 1;
+
+    // zlib compression level in [0, 9], -1 picks the zlib default
+    int compression_level = -1;
+};
+
+// Write a dense volume (x fastest, then y, then z) with bytes_per_voxel bytes per voxel to filename.
+// Coarser levels are box filtered for 8 bit volumes and point sampled otherwise (e.g. for label volumes).
+bool write_fishvol(const std::string& filename, const std::uint8_t* data, const Eigen::RowVector3i& dims,
+                   std::size_t bytes_per_voxel, std::shared_ptr<spdlog::logger> logger,
+                   const FishVolWriteOptions& options = FishVolWriteOptions());
+
+// Write a pyramid whose levels were computed by the caller, levels[0] holding the dims sized full resolution.
+// Level l must have the dimensions of fishvol_coarser_dims applied l times, options.num_levels is ignored.
+bool write_fishvol_levels(const std::string& filename, const std::vector<const std::uint8_t*>& levels,
+                          const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                          std::shared_ptr<spdlog::logger> logger,
+                          const FishVolWriteOptions& options = FishVolWriteOptions());
+
+// Dimensions of the next coarser level of a pyramid, each dimension is halved and rounded up
+Eigen::RowVector3i fishvol_coarser_dims(const Eigen::RowVector3i& dims);
+
+// Compute the slices [z_begin, z_end) of the next coarser level of in, filtered like the levels of
+// write_fishvol. Only the input slices [2 z_begin, 2 z_end) are read, so a pyramid can be built while
+// the full resolution slices are still arriving.
+void fishvol_downsample_slices(const std::uint8_t* in, const Eigen::RowVector3i& in_dims, std::size_t bytes_per_voxel,
+                               std::uint8_t* out, int z_begin, int z_end);
+
+// Convert an existing .raw file to a .fishvol file
+bool convert_rawfile_to_fishvol(const std::string& rawfilename, const std::string& fishvolfilename,
+                                const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                                std::shared_ptr<spdlog::logger> logger,
+                                const FishVolWriteOptions& options = FishVolWriteOptions());
+
+// Returns true if filename ends with the .fishvol extension
+bool is_fishvol_filename(const std::string& filename);
+
+
+// Random access reader for .fishvol files. read_region is safe to call from multiple threads.
+class FishVolFile {
+public:
+    FishVolFile() = default;
+    FishVolFile(const FishVolFile&) = delete;
+    FishVolFile& operator=(const FishVolFile&) = delete;
+
+    bool open(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+    void close();
+    bool is_open() const { return _file.is_open(); }
+
+    int num_levels() const { return static_cast<int>(_levels.size()); }
+    int brick_size() const { return _brick_size; }
+    std::size_t bytes_per_voxel() const { return _bytes_per_voxel; }
+    Eigen::RowVector3i dims(int level = 0) const { return _levels[level].dims; }
+    Eigen::RowVector3i num_bricks(int level = 0) const { return _levels[level].num_bricks; }
+
+    // Decompress the voxels in the box [begin, end) of a level into out, which must hold
+    // (end - begin).prod() * bytes_per_voxel() bytes. Only the bricks overlapping the box are read.
+    bool read_region(int level, const Eigen::RowVector3i& begin, const Eigen::RowVector3i& end,
+                     std::uint8_t* out, std::shared_ptr<spdlog::logger> logger);
+
+    // Decompress a whole level
+    bool read_level(int level, std::vector<std::uint8_t>& out, std::shared_ptr<spdlog::logger> logger);
+
+    // Decompress the single brick at brick coordinate b. out is resized to the extent of the brick.
+    bool read_brick(int level, const Eigen::RowVector3i& b, std::vector<std::uint8_t>& out,
+                    std::shared_ptr<spdlog::logger> logger);
+
+    // Voxel extent of the brick at brick coordinate b
+    Eigen::RowVector3i brick_extent(int level, const Eigen::RowVector3i& b) const;
+
+private:
+    struct BrickEntry {
+        std::uint64_t offset = 0;
+        std::uint32_t stored_size = 0;
+        std::uint32_t encoding = FISHVOL_BRICK_STORED;
+    };
+
+    struct Level {
+        Eigen::RowVector3i dims;
+        Eigen::RowVector3i num_bricks;
+        std::vector<BrickEntry> bricks;
+    };
+
+    std::ifstream _file;
+    std::mutex _file_mutex;
+    std::string _filename;
+    std::size_t _bytes_per_voxel = 1;
+    int _brick_size = FISHVOL_DEFAULT_BRICK_SIZE;
+    std::vector<Level> _levels;
+};
+
+#endif // FISHVOL_H
@@ -0,0 +1,110 @@
+#include "frame_timer.h"
+
+#include <algorithm>
+
+
+FrameTimer& frame_timer() {
+    static FrameTimer timer;
+    return timer;
+}
+
+FrameTimer::FrameTimer() {
+    _sections[FRAME].name = "Frame";
+    _sections[INTERVAL].name = "Between frames";
+}
+
+FrameTimer::Section& FrameTimer::section(const std::string& name) {
+    for (Section& s : _sections) {
+        if (s.name == name) {
+            return s;
+        }
+    }
+    _sections.emplace_back();
+    _sections.back().name = name;
+    return _sections.back();
+}
+
+void FrameTimer::add_sample(Section& section, double ms) {
+    section.average_ms = section.samples.empty() ? ms : AVERAGE_ALPHA * ms + (1.0 - AVERAGE_ALPHA) * section.average_ms;
+    section.last_ms = ms;
+    if (section.samples.size() < MAX_SAMPLES) {
+        section.samples.push_back(float(ms));
+    } else {
+        section.samples[section.next] = float(ms);
+    }
+    section.next = (section.next + 1) % MAX_SAMPLES;
+}
+
+void FrameTimer::begin_frame() {
+    const Clock::time_point now = Clock::now();
+    if (_has_frame) {
+        add_sample(_sections[INTERVAL], std::chrono::duration<double, std::milli>(now - _frame_start).count());
+    }
+    for (Section& s : _sections) {
+        s.frame_ms = 0.0;
+        s.marked = false;
+    }
+    _frame_start = now;
+    _last_mark = now;
+    _in_frame = true;
+    _has_frame = true;
+}
+
+void FrameTimer::mark(const std::string& name) {
+    if (!_in_frame) {
+        return;
+    }
+    const Clock::time_point now = Clock::now();
+    Section& s = section(name);
+    s.frame_ms += std::chrono::duration<double, std::milli>(now - _last_mark).count();
+    s.marked = true;
+    _last_mark = now;
+}
+
+void FrameTimer::end_frame() {
+    if (!_in_frame) {
+        return;
+    }
+    _in_frame = false;
+    add_sample(_sections[FRAME], std::chrono::duration<double, std::milli>(Clock::now() - _frame_start).count());
+    for (std::size_t i = INTERVAL + 1; i < _sections.size(); i++) {
+        if (_sections[i].marked) {
+            add_sample(_sections[i], _sections[i].frame_ms);
+        }
+    }
+}
+
+std::vector<float> FrameTimer::recent_samples(const Section& section, std::size_t count) {
+    const std::size_t size = section.samples.size();
+    count = std::min(count, size);
+    std::vector<float> recent(count);
+    for (std::size_t i = 0; i < count; i++) {
+        recent[i] = section.samples[(section.next + size - count + i) % size];
+    }
+    return recent;
+}
+
+double FrameTimer::percentile(const Section& section, double p) {
+    if (section.samples.empty()) {
+        return 0.0;
+    }
+    std::vector<float> sorted = section.samples;
+    const std::size_t k = std::min(sorted.size() - 1, std::size_t(p * double(sorted.size() - 1) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+void FrameTimer::log(spdlog::logger& logger) const {
+    if (frame().samples.empty()) {
+        return;
+    }
+    logger.info("CPU time of {} frames (median / 90% / 99% / max):", frame().samples.size());
+    for (const Section& s : _sections) {
+        // The time between frames includes the time the viewer sat idle
+        if (&s == &interval() || s.samples.empty()) {
+            continue;
+        }
+        logger.info("  {}: {:.2f} / {:.2f} / {:.2f} / {:.2f} ms", s.name, percentile(s, 0.5), percentile(s, 0.9),
+                    percentile(s, 0.99), percentile(s, 1.0));
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef FRAME_TIMER_H
+#define FRAME_TIMER_H
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// CPU time spent in the parts of every frame the viewer draws, shown in the overlay toggled with F8 and logged as
+// percentiles when the viewer exits, so a slow session can be reported with numbers.
+//
+// begin_frame() starts a frame, every mark() then closes a section that took the time since the previous mark
+// and end_frame() closes the frame. A frame that is never ended, e.g. because the viewer skipped drawing it, is
+// dropped by the next begin_frame(). Sections keep the order they were first marked in. Only the render thread
+// may call it.
+class FrameTimer {
+public:
+    // Samples kept per section for the percentiles, the oldest ones are dropped after that
+    static constexpr std::size_t MAX_SAMPLES = std::size_t(1) << 18;
+    static constexpr double AVERAGE_ALPHA = 0.1;
+
+    struct Section {
+        std::string name;
+        double average_ms = 0.0;
+        double last_ms = 0.0;
+
+        // Ring of the time of every frame the section was marked in, the next one goes to samples[next]
+        std::vector<float> samples;
+        std::size_t next = 0;
+        // Time marked in the current frame
+        double frame_ms = 0.0;
+        bool marked = false;
+    };
+
+    FrameTimer();
+    FrameTimer(const FrameTimer&) = delete;
+    FrameTimer& operator=(const FrameTimer&) = delete;
+
+    void begin_frame();
+    void mark(const std::string& name);
+    void end_frame();
+
+    // The whole frame from begin_frame() to end_frame() comes first, then the time between the starts of
+    // consecutive frames, which includes the swap and the time the viewer waited for events
+    const std::vector<Section>& sections() const { return _sections; }
+    const Section& frame() const { return _sections[FRAME]; }
+    const Section& interval() const { return _sections[INTERVAL]; }
+
+    // Last count samples of section, oldest first
+    static std::vector<float> recent_samples(const Section& section, std::size_t count);
+    // p-th percentile of the samples of section in ms, p in [0, 1]
+    static double percentile(const Section& section, double p);
+
+    // Median, 90th, 99th percentile and maximum of every section
+    void log(spdlog::logger& logger) const;
+
+    bool overlay_enabled() const { return _overlay_enabled; }
+    void set_overlay_enabled(bool enabled) { _overlay_enabled = enabled; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum { FRAME = 0, INTERVAL = 1 };
+
+    Section& section(const std::string& name);
+    static void add_sample(Section& section, double ms);
+
+    std::vector<Section> _sections = std::vector<Section>(2);
+    Clock::time_point _frame_start;
+    Clock::time_point _last_mark;
+    bool _in_frame = false;
+    bool _has_frame = false;
+    bool _overlay_enabled = false;
+};
+
+// Timer of the frames of the viewer
+FrameTimer& frame_timer();
+
+#endif // FRAME_TIMER_H
@@ -0,0 +1,274 @@
+#include "geodesic_solver.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <Eigen/Dense>
+#include <igl/cotmatrix.h>
+#include <igl/edges.h>
+#include <igl/grad.h>
+#include <igl/massmatrix.h>
+#include <igl/volume.h>
+
+
+namespace {
+
+// A times scale without the row and column of vertex 0. The Laplacian like matrices of the solvers have the
+// constants as their kernel on a connected mesh, grounding vertex 0 makes them positive definite.
+Eigen::SparseMatrix<double> grounded(const Eigen::SparseMatrix<double>& A, double scale) {
+    typedef Eigen::SparseMatrix<double> SparseMatrixXd;
+    std::vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(A.nonZeros());
+    for (int k = 0; k < A.outerSize(); k++) {
+        for (SparseMatrixXd::InnerIterator it(A, k); it; ++it) {
+            if (it.row() > 0 && it.col() > 0) {
+                triplets.emplace_back(it.row() - 1, it.col() - 1, scale * it.value());
+            }
+        }
+    }
+    SparseMatrixXd K(A.rows() - 1, A.cols() - 1);
+    K.setFromTriplets(triplets.begin(), triplets.end());
+    return K;
+}
+
+// Solve K y = b[1:] for a grounded matrix K, with x[0] = 0
+Eigen::VectorXd solve_grounded(const SparseSolver& K, const Eigen::VectorXd& b) {
+    Eigen::VectorXd x(b.size());
+    x[0] = 0.0;
+    x.tail(b.size() - 1) = K.solve(Eigen::VectorXd(b.tail(b.size() - 1)));
+    return x;
+}
+
+// Same as above, iterative backends start from guess
+Eigen::VectorXd solve_grounded(const SparseSolver& K, const Eigen::VectorXd& b, const Eigen::VectorXd& guess) {
+    Eigen::VectorXd x(b.size());
+    x[0] = 0.0;
+    const Eigen::VectorXd grounded_guess = guess.tail(guess.size() - 1).array() - guess[0];
+    x.tail(b.size() - 1) = K.solve(Eigen::VectorXd(b.tail(b.size() - 1)), grounded_guess);
+    return x;
+}
+
+SparseSolver make_solver(SparseSolverBackend backend) {
+    SparseSolver solver(backend);
+    solver.set_tolerance(GEODESIC_ITERATIVE_TOLERANCE);
+    return solver;
+}
+
+} // namespace
+
+
+SparseSolverBackend geodesic_solver_backend(int num_vertices) {
+    return num_vertices >= GEODESIC_ITERATIVE_MIN_VERTICES ? SparseSolverBackend::ConjugateGradient
+                                                           : best_sparse_solver_backend();
+}
+
+
+bool GeodesicSolver::compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                             std::shared_ptr<spdlog::logger> logger, SparseSolverBackend backend) {
+    _num_vertices = 0;
+    const int n = static_cast<int>(TV.rows());
+    if (n < 2 || TT.rows() == 0) {
+        return false;
+    }
+    _grounded_laplacian = make_solver(backend);
+    _grounded_gradient_normal = make_solver(backend);
+
+    // igl::cotmatrix is negative semi-definite with the constants in its kernel, dropping vertex 0 makes
+    // its negation positive definite
+    SparseMatrixXd L;
+    igl::cotmatrix(TV, TT, L);
+    if (!_grounded_laplacian.compute(grounded(L, -1.0), logger, "grounded Laplacian")) {
+        return false;
+    }
+
+    igl::grad(TV, TT, _gradient);
+    const SparseMatrixXd GtG = _gradient.transpose() * _gradient;
+    if (!_grounded_gradient_normal.compute(grounded(GtG, 1.0), logger, "gradient normal equations")) {
+        return false;
+    }
+
+    _num_vertices = n;
+    return true;
+}
+
+
+bool GeodesicSolver::harmonic(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals,
+                              bool normalize) const {
+    using namespace Eigen;
+
+    const int n = _num_vertices;
+    const int m = 2 * static_cast<int>(endpoints.size());
+    if (n == 0 || m == 0) {
+        return false;
+    }
+
+    // Same constraints as heat_diffusion_distances
+    std::vector<int> b(m);
+    VectorXd bc(m);
+    for (int i = 0; i < static_cast<int>(endpoints.size()); i++) {
+        b[2 * i] = endpoints[i].second;
+        b[2 * i + 1] = endpoints[i].first;
+        bc[2 * i] = 1.0;
+        bc[2 * i + 1] = 0.0;
+    }
+    for (int v : b) {
+        if (v < 0 || v >= n) {
+            return false;
+        }
+    }
+
+    // Write x = c + y with y = 0 at vertex 0. Minimizing y^T K y subject to c + y[b] = bc gives K y = E lambda
+    // with E the columns of the constrained vertices, so y = W lambda with W = K^-1 E, and lambda, c solve
+    //   [ W[b]  1 ] [ lambda ]   [ bc ]
+    //   [ 1^T   0 ] [   c    ] = [ 0  ]
+    MatrixXd E = MatrixXd::Zero(n - 1, m);
+    for (int j = 0; j < m; j++) {
+        if (b[j] > 0) {
+            E(b[j] - 1, j) = 1.0;
+        }
+    }
+    const MatrixXd W = _grounded_laplacian.solve(E);
+
+    MatrixXd A = MatrixXd::Zero(m + 1, m + 1);
+    for (int i = 0; i < m; i++) {
+        if (b[i] > 0) {
+            A.block(i, 0, 1, m) = W.row(b[i] - 1);
+        }
+        A(i, m) = 1.0;
+        A(m, i) = 1.0;
+    }
+    VectorXd rhs = VectorXd::Zero(m + 1);
+    rhs.head(m) = bc;
+    const VectorXd sol = A.fullPivLu().solve(rhs);
+
+    const VectorXd y = W * sol.head(m);
+    isovals.resize(n);
+    isovals[0] = sol[m];
+    isovals.tail(n - 1) = y.array() + sol[m];
+
+    if (normalize) {
+        scale_zero_one(isovals, isovals);
+    }
+    return true;
+}
+
+
+bool GeodesicSolver::solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals,
+                           bool normalized) const {
+    if (!harmonic(endpoints, isovals, true /*normalize*/)) {
+        return false;
+    }
+
+    // Integrate the gradient of the harmonic function back in the least squares sense, up to a constant. The
+    // harmonic function is where the iterative solves start from.
+    const Eigen::VectorXd g = _gradient * isovals;
+    isovals = solve_grounded(_grounded_gradient_normal, _gradient.transpose() * g, isovals);
+    if (normalized) {
+        scale_zero_one(isovals, isovals);
+    }
+    return true;
+}
+
+
+bool HeatGeodesicSolver::compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, double time_scale,
+                                 std::shared_ptr<spdlog::logger> logger, SparseSolverBackend backend) {
+    _num_vertices = 0;
+    const int n = static_cast<int>(TV.rows());
+    if (n < 2 || TT.rows() == 0) {
+        return false;
+    }
+    _heat = make_solver(backend);
+    _grounded_laplacian = make_solver(backend);
+
+    SparseMatrixXd L;
+    igl::cotmatrix(TV, TT, L);
+    if (!_grounded_laplacian.compute(grounded(L, -1.0), logger, "grounded Laplacian")) {
+        return false;
+    }
+
+    Eigen::MatrixXi E;
+    igl::edges(TT, E);
+    double h = 0.0;
+    for (int i = 0; i < E.rows(); i++) {
+        h += (TV.row(E(i, 0)) - TV.row(E(i, 1))).norm();
+    }
+    h /= std::max<Eigen::Index>(E.rows(), 1);
+    const double t = time_scale * h * h;
+
+    SparseMatrixXd M;
+    igl::massmatrix(TV, TT, igl::MASSMATRIX_TYPE_BARYCENTRIC, M);
+    if (!_heat.compute(SparseMatrixXd(M - t * L), logger, "heat operator")) {
+        return false;
+    }
+
+    igl::grad(TV, TT, _gradient);
+    Eigen::VectorXd vol;
+    igl::volume(TV, TT, vol);
+    _volumes = vol.cwiseAbs().replicate(3, 1);
+
+    _num_vertices = n;
+    return true;
+}
+
+
+bool HeatGeodesicSolver::distances(const std::vector<int>& sources, Eigen::VectorXd& dists) const {
+    const int n = _num_vertices;
+    if (n == 0 || sources.empty()) {
+        return false;
+    }
+    Eigen::VectorXd delta = Eigen::VectorXd::Zero(n);
+    for (int s : sources) {
+        if (s < 0 || s >= n) {
+            return false;
+        }
+        delta[s] = 1.0;
+    }
+
+    // Diffuse heat from the sources and normalize its gradient, which points away from the sources as -grad u
+    const Eigen::VectorXd u = _heat.solve(delta);
+    Eigen::VectorXd X = _gradient * u;
+    const Eigen::Index num_tets = X.size() / 3;
+    for (Eigen::Index i = 0; i < num_tets; i++) {
+        const Eigen::Vector3d g(X[i], X[i + num_tets], X[i + 2 * num_tets]);
+        const double norm = g.norm();
+        const Eigen::Vector3d x = norm > 0.0 ? Eigen::Vector3d(-g / norm) : Eigen::Vector3d::Zero();
+        X[i] = x[0];
+        X[i + num_tets] = x[1];
+        X[i + 2 * num_tets] = x[2];
+    }
+
+    // The distance is the function whose gradient is closest to X, the negated cotangent Laplacian is
+    // G^T diag(vol) G so this is the Poisson problem L phi = G^T diag(vol) X
+    const Eigen::VectorXd div = _gradient.transpose() * _volumes.cwiseProduct(X);
+    dists = solve_grounded(_grounded_laplacian, div);
+
+    double offset = dists[sources[0]];
+    for (int s : sources) {
+        offset = std::min(offset, dists[s]);
+    }
+    dists.array() -= offset;
+    return true;
+}
+
+
+bool HeatGeodesicSolver::solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals) const {
+    std::vector<int> first, second;
+    for (const std::pair<int, int>& ep : endpoints) {
+        first.push_back(ep.first);
+        second.push_back(ep.second);
+    }
+    Eigen::VectorXd d0, d1;
+    if (!distances(first, d0) || !distances(second, d1)) {
+        return false;
+    }
+
+    // The distances are only accurate to the mesh resolution and may dip slightly below 0 near the sources
+    d0 = d0.cwiseMax(0.0);
+    d1 = d1.cwiseMax(0.0);
+    isovals.resize(_num_vertices);
+    for (int i = 0; i < _num_vertices; i++) {
+        const double sum = d0[i] + d1[i];
+        isovals[i] = sum > 0.0 ? d0[i] / sum : 0.5;
+    }
+    return true;
+}
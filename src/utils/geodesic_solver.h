@@ -0,0 +1,98 @@
+#ifndef GEODESIC_SOLVER_H
+#define GEODESIC_SOLVER_H
+
+#include "sparse_solver.h"
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Meshes with at least this many vertices are solved iteratively by geodesic_solver_backend()
+constexpr int GEODESIC_ITERATIVE_MIN_VERTICES = 1000000;
+// Relative residual of the iterative solves, the skeleton does not need the geodesics any more accurate
+constexpr double GEODESIC_ITERATIVE_TOLERANCE = 1e-4;
+
+// Backend the geodesic solvers of a mesh with num_vertices vertices use: the best direct one built in, or
+// ConjugateGradient from GEODESIC_ITERATIVE_MIN_VERTICES on, where the fill of the factorizations (worst for the
+// gradient normal equations) no longer fits in memory
+SparseSolverBackend geodesic_solver_backend(int num_vertices);
+
+// Approximate geodesic distances between endpoint pairs on a fixed connected tet mesh. This computes the same
+// thing as geodesic_distances, but the cotangent Laplacian and the gradient integration system are factored
+// once in compute(), so each solve() for a new set of endpoints only costs back-substitutions.
+//
+// The harmonic function is found without refactoring for each set of endpoints: the Laplacian is factored with
+// vertex 0 grounded, and the Dirichlet constraints at the endpoints are enforced through the small dense Schur
+// complement of the constrained vertices. The gradient integration is grounded at vertex 0 as well.
+//
+// The systems are factored with the SparseSolver backend given to compute(), the best one built in by default,
+// whose choice and timings go to logger. See geodesic_solver_backend() for large meshes.
+class GeodesicSolver {
+public:
+    // Factor the operators of TV, TT. Returns false if the mesh is empty or a factorization fails, which
+    // happens when the mesh is not connected.
+    bool compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                 std::shared_ptr<spdlog::logger> logger = nullptr,
+                 SparseSolverBackend backend = best_sparse_solver_backend());
+
+    bool is_valid() const { return _num_vertices > 0; }
+    int num_vertices() const { return _num_vertices; }
+
+    // Harmonic function equal to 0 at the first and 1 at the second vertex of each endpoint pair, the result
+    // of heat_diffusion_distances
+    bool harmonic(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals,
+                  bool normalize = true) const;
+
+    // Approximate geodesic distance between the endpoints, the result of geodesic_distances
+    bool solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals,
+               bool normalized = true) const;
+
+private:
+    typedef Eigen::SparseMatrix<double> SparseMatrixXd;
+
+    int _num_vertices = 0;
+    // Cotangent Laplacian without the row and column of vertex 0, positive definite on a connected mesh
+    SparseSolver _grounded_laplacian;
+    // Discrete gradient and the factored normal equations of the gradient integration, grounded the same way
+    SparseMatrixXd _gradient;
+    SparseSolver _grounded_gradient_normal;
+};
+
+// Geodesic distances on a fixed connected tet mesh with the heat method of Crane et al., "Geodesics in Heat".
+// Heat diffused from the sources for a short time t gives the direction of the distance gradient, and the
+// distance is the solution of the Poisson problem matching it. compute() factors both M + t L and the
+// Laplacian (grounded at vertex 0), so each query costs two back-substitutions.
+class HeatGeodesicSolver {
+public:
+    // t is time_scale times the squared mean edge length, 1 is the value recommended in the paper. Returns
+    // false if the mesh is empty or a factorization fails, which happens when the mesh is not connected.
+    bool compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, double time_scale = 1.0,
+                 std::shared_ptr<spdlog::logger> logger = nullptr,
+                 SparseSolverBackend backend = best_sparse_solver_backend());
+
+    bool is_valid() const { return _num_vertices > 0; }
+    int num_vertices() const { return _num_vertices; }
+
+    // Distance of every vertex to the closest source vertex
+    bool distances(const std::vector<int>& sources, Eigen::VectorXd& dists) const;
+
+    // Normalized coordinate between the endpoint pairs, d0 / (d0 + d1) with d0 the distance to the first and
+    // d1 the distance to the second endpoints. It is 0 at the first and 1 at the second endpoint of each pair.
+    bool solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals) const;
+
+private:
+    typedef Eigen::SparseMatrix<double> SparseMatrixXd;
+
+    int _num_vertices = 0;
+    SparseSolver _heat;
+    SparseSolver _grounded_laplacian;
+    // Per tet gradient, the x, y and z rows of all tets stacked, and the tet volumes repeated for each axis
+    SparseMatrixXd _gradient;
+    Eigen::VectorXd _volumes;
+};
+
+#endif // GEODESIC_SOLVER_H
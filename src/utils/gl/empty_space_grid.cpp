@@ -0,0 +1,291 @@
+#include "empty_space_grid.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "utils/utils.h"
+#include "shader_cache.h"
+
+
+const char* const EmptySpaceGrid::GLSL = R"(
+uniform sampler3D empty_space_minmax;
+uniform sampler1D empty_space_tf_prefix;
+uniform vec3 empty_space_volume_dims;
+uniform float empty_space_brick_size;
+uniform float empty_space_tf_width;
+uniform bool empty_space_enabled;
+
+bool empty_space_range_visible(vec2 range) {
+    // The transfer function is sampled with linear filtering, so a density can pick up the
+    // opacity of the texel on either side of it
+    float last = empty_space_tf_width - 1.0;
+    int lo = int(clamp(floor(range.x * empty_space_tf_width - 0.5), 0.0, last));
+    int hi = int(clamp(floor(range.y * empty_space_tf_width - 0.5) + 1.0, 0.0, last));
+    float num_opaque = texelFetch(empty_space_tf_prefix, hi + 1, 0).r - texelFetch(empty_space_tf_prefix, lo, 0).r;
+    return num_opaque > 0.5;
+}
+
+// Distance along dir (normalized volume coordinates) the ray starting at pos can advance
+// before it might hit a visible voxel. The result is a multiple of step_size so the positions of the
+// samples which are taken do not change. Returns 0.0 if pos has to be sampled.
+float empty_space_skip(vec3 pos, vec3 dir, float step_size) {
+    if (!empty_space_enabled) {
+        return 0.0;
+    }
+    if (any(lessThan(pos, vec3(0.0))) || any(greaterThanEqual(pos, vec3(1.0)))) {
+        return 0.0;
+    }
+
+    vec3 brick = floor(pos * empty_space_volume_dims / empty_space_brick_size);
+    if (empty_space_range_visible(texelFetch(empty_space_minmax, ivec3(brick), 0).rg)) {
+        return 0.0;
+    }
+
+    // Exit distance of the ray from the box of the brick
+    vec3 lo = brick * empty_space_brick_size / empty_space_volume_dims;
+    vec3 hi = (brick + vec3(1.0)) * empty_space_brick_size / empty_space_volume_dims;
+    vec3 dist = mix(pos - lo, hi - pos, greaterThanEqual(dir, vec3(0.0))) / max(abs(dir), vec3(1e-6));
+    float exit = min(dist.x, min(dist.y, dist.z));
+    return max(ceil(exit / step_size), 1.0) * step_size;
+}
+)";
+
+namespace {
+
+constexpr const char* BUILD_VERTEX_SHADER = R"(
+#version 150
+// Create two triangles that are filling the entire screen [-1, 1]
+vec2 positions[6] = vec2[](
+    vec2(-1.0, -1.0),
+    vec2( 1.0, -1.0),
+    vec2( 1.0,  1.0),
+
+    vec2(-1.0, -1.0),
+    vec2( 1.0,  1.0),
+    vec2(-1.0,  1.0)
+);
+
+void main() {
+    gl_Position = vec4(positions[gl_VertexID], 0.0, 1.0);
+}
+)";
+
+// One fragment per brick of the current layer of bricks. The range includes a one voxel
+// margin around the brick since linear filtering near its faces reads the neighbouring voxels.
+constexpr const char* BUILD_FRAGMENT_SHADER = R"(
+#version 150
+uniform sampler3D volume;
+uniform ivec3 volume_dims;
+uniform int brick_size;
+uniform int layer;
+
+out vec4 out_color;
+
+void main() {
+    ivec3 lo = ivec3(ivec2(gl_FragCoord.xy), layer) * brick_size - ivec3(1);
+    ivec3 hi = lo + ivec3(brick_size + 1);
+
+    float v_min = 1.0;
+    float v_max = 0.0;
+    for (int z = lo.z; z <= hi.z; z++) {
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+                ivec3 p = ivec3(x, y, z);
+                // Voxels outside of the volume read as the transparent border color
+                float v = 0.0;
+                if (all(greaterThanEqual(p, ivec3(0))) && all(lessThan(p, volume_dims))) {
+                    v = texelFetch(volume, p, 0).r;
+                }
+                v_min = min(v_min, v);
+                v_max = max(v_max, v);
+            }
+        }
+    }
+    out_color = vec4(v_min, v_max, 0.0, 0.0);
+}
+)";
+
+} // namespace
+
+
+void VolumeMinMaxGrid::init(int brick_size) {
+    push_opengl_debug_group("Init VolumeMinMaxGrid");
+    _brick_size = brick_size;
+
+    create_cached_shader_program(BUILD_VERTEX_SHADER, BUILD_FRAGMENT_SHADER, {}, _build_program);
+    _build_location.volume = glGetUniformLocation(_build_program, "volume");
+    _build_location.volume_dims = glGetUniformLocation(_build_program, "volume_dims");
+    _build_location.brick_size = glGetUniformLocation(_build_program, "brick_size");
+    _build_location.layer = glGetUniformLocation(_build_program, "layer");
+
+    glGenFramebuffers(1, &_build_framebuffer);
+    glGenVertexArrays(1, &_build_vao);
+
+    glGenTextures(1, &_minmax_texture);
+    glBindTexture(GL_TEXTURE_3D, _minmax_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    _volume_texture = 0;
+    _dirty = true;
+    pop_opengl_debug_group();
+}
+
+void VolumeMinMaxGrid::destroy() {
+    glDeleteTextures(1, &_minmax_texture);
+    glDeleteFramebuffers(1, &_build_framebuffer);
+    glDeleteVertexArrays(1, &_build_vao);
+    glDeleteProgram(_build_program);
+    _minmax_texture = 0;
+    _build_framebuffer = 0;
+    _build_vao = 0;
+    _build_program = 0;
+    _volume_texture = 0;
+    _volume_dims = glm::ivec3(0);
+    _num_bricks = glm::ivec3(0);
+    _dirty = true;
+}
+
+void VolumeMinMaxGrid::update(GLuint volume_texture) {
+    if (_build_program == 0 || volume_texture == 0) {
+        return;
+    }
+    if (!_dirty && volume_texture == _volume_texture) {
+        return;
+    }
+    _volume_texture = volume_texture;
+    _dirty = false;
+    rebuild();
+}
+
+void VolumeMinMaxGrid::rebuild() {
+    push_opengl_debug_group("Build VolumeMinMaxGrid");
+
+    // Callers do not always know the exact size of the texture (e.g. the straightened export volume)
+    glBindTexture(GL_TEXTURE_3D, _volume_texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_WIDTH, &_volume_dims.x);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_HEIGHT, &_volume_dims.y);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_DEPTH, &_volume_dims.z);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    const glm::ivec3 num_bricks = (_volume_dims + glm::ivec3(_brick_size - 1)) / _brick_size;
+    if (glm::any(glm::lessThanEqual(num_bricks, glm::ivec3(0)))) {
+        _num_bricks = glm::ivec3(0);
+        pop_opengl_debug_group();
+        return;
+    }
+    if (num_bricks != _num_bricks) {
+        _num_bricks = num_bricks;
+        glBindTexture(GL_TEXTURE_3D, _minmax_texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RG32F, num_bricks.x, num_bricks.y, num_bricks.z, 0, GL_RG, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    GLint old_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+    const GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+    const GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(_build_program);
+    glBindVertexArray(_build_vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, _volume_texture);
+    glUniform1i(_build_location.volume, 0);
+    glUniform3iv(_build_location.volume_dims, 1, glm::value_ptr(_volume_dims));
+    glUniform1i(_build_location.brick_size, _brick_size);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _build_framebuffer);
+    glViewport(0, 0, num_bricks.x, num_bricks.y);
+    for (int z = 0; z < num_bricks.z; z++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _minmax_texture, 0, z);
+        glUniform1i(_build_location.layer, z);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, old_framebuffer);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    if (blend_enabled) {
+        glEnable(GL_BLEND);
+    }
+    if (depth_test_enabled) {
+        glEnable(GL_DEPTH_TEST);
+    }
+    pop_opengl_debug_group();
+}
+
+EmptySpaceGrid::UniformLocations EmptySpaceGrid::uniform_locations(GLuint program) {
+    UniformLocations locations;
+    locations.minmax = glGetUniformLocation(program, "empty_space_minmax");
+    locations.tf_prefix = glGetUniformLocation(program, "empty_space_tf_prefix");
+    locations.volume_dims = glGetUniformLocation(program, "empty_space_volume_dims");
+    locations.brick_size = glGetUniformLocation(program, "empty_space_brick_size");
+    locations.tf_width = glGetUniformLocation(program, "empty_space_tf_width");
+    locations.enabled = glGetUniformLocation(program, "empty_space_enabled");
+    return locations;
+}
+
+void EmptySpaceGrid::set_sampler_units(const UniformLocations& locations, GLuint minmax_unit) {
+    glUniform1i(locations.minmax, minmax_unit);
+    glUniform1i(locations.tf_prefix, minmax_unit + 1);
+}
+
+void EmptySpaceGrid::init() {
+    glGenTextures(1, &_tf_prefix_texture);
+    glBindTexture(GL_TEXTURE_1D, _tf_prefix_texture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    _tf_width = 0;
+}
+
+void EmptySpaceGrid::destroy() {
+    glDeleteTextures(1, &_tf_prefix_texture);
+    _tf_prefix_texture = 0;
+    _tf_width = 0;
+}
+
+void EmptySpaceGrid::update_transfer_function(const std::vector<std::array<std::uint8_t, 4>>& transfer_function_data) {
+    if (_tf_prefix_texture == 0) {
+        return;
+    }
+
+    // prefix[i] is the number of texels before i with a non zero alpha. Floats count exactly up to 2^24.
+    std::vector<float> prefix(transfer_function_data.size() + 1, 0.0f);
+    for (std::size_t i = 0; i < transfer_function_data.size(); i++) {
+        prefix[i + 1] = prefix[i] + (transfer_function_data[i][3] > 0 ? 1.0f : 0.0f);
+    }
+    _tf_width = int(transfer_function_data.size());
+
+    glBindTexture(GL_TEXTURE_1D, _tf_prefix_texture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32F, GLsizei(prefix.size()), 0, GL_RED, GL_FLOAT, prefix.data());
+    glBindTexture(GL_TEXTURE_1D, 0);
+}
+
+void EmptySpaceGrid::bind(const UniformLocations& locations, GLuint minmax_unit,
+                          const VolumeMinMaxGrid& minmax_grid, bool enabled) const {
+    const bool usable = enabled && _tf_width > 0 &&
+                        glm::all(glm::greaterThan(minmax_grid.num_bricks(), glm::ivec3(0)));
+
+    glActiveTexture(GL_TEXTURE0 + minmax_unit);
+    glBindTexture(GL_TEXTURE_3D, minmax_grid.texture());
+    glActiveTexture(GL_TEXTURE0 + minmax_unit + 1);
+    glBindTexture(GL_TEXTURE_1D, _tf_prefix_texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    set_sampler_units(locations, minmax_unit);
+    glUniform3fv(locations.volume_dims, 1, glm::value_ptr(glm::vec3(minmax_grid.volume_dims())));
+    glUniform1f(locations.brick_size, float(minmax_grid.brick_size()));
+    glUniform1f(locations.tf_width, float(_tf_width));
+    glUniform1i(locations.enabled, usable ? 1 : 0);
+}
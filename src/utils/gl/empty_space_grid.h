@@ -0,0 +1,108 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Minimum and maximum density of each brick of brick_size^3 voxels of a volume texture, with a one voxel margin
+// so that linear filtering at the brick boundary is covered. It only depends on the volume, every renderer of the
+// volume shares the grid of its VolumeResource.
+class VolumeMinMaxGrid {
+public:
+    static constexpr int DEFAULT_BRICK_SIZE = 8;
+
+    VolumeMinMaxGrid() = default;
+    VolumeMinMaxGrid(const VolumeMinMaxGrid&) = delete;
+    VolumeMinMaxGrid& operator=(const VolumeMinMaxGrid&) = delete;
+    ~VolumeMinMaxGrid() = default;
+
+    void init(int brick_size = DEFAULT_BRICK_SIZE);
+    void destroy();
+
+    // Rebuild the grid if volume_texture is not the volume the grid was last built from or if the grid was
+    // invalidated. The texture must be a single channel normalized 3D texture.
+    void update(GLuint volume_texture);
+
+    // Mark the grid as stale, call this when the contents of the current volume texture changed
+    void invalidate() { _dirty = true; }
+
+    GLuint texture() const { return _minmax_texture; }
+    int brick_size() const { return _brick_size; }
+    glm::ivec3 volume_dims() const { return _volume_dims; }
+    glm::ivec3 num_bricks() const { return _num_bricks; }
+
+private:
+    void rebuild();
+
+    int _brick_size = DEFAULT_BRICK_SIZE;
+    GLuint _volume_texture = 0;
+    glm::ivec3 _volume_dims = glm::ivec3(0);
+    glm::ivec3 _num_bricks = glm::ivec3(0);
+    bool _dirty = true;
+
+    GLuint _minmax_texture = 0;
+
+    GLuint _build_program = 0;
+    GLuint _build_framebuffer = 0;
+    GLuint _build_vao = 0;
+    struct {
+        GLint volume = -1;
+        GLint volume_dims = -1;
+        GLint brick_size = -1;
+        GLint layer = -1;
+    } _build_location;
+};
+
+// Coarse min/max grid used to skip empty space while ray casting.
+//
+// The VolumeMinMaxGrid of the volume stores the minimum and maximum density of each brick. Whether a brick is
+// visible depends on the transfer function, so a 1D texture stores a prefix count of the transfer function texels
+// with a non zero alpha. A brick is empty if no texel in the density range [min, max] has any opacity, which is a
+// single subtraction of two prefix counts. Changing the transfer function only updates the small 1D table, the
+// min/max grid is only rebuilt when the volume itself changes.
+//
+// Shaders use the grid by including EmptySpaceGrid::GLSL and calling empty_space_skip(pos, dir, step_size)
+// before taking a sample. It returns the distance the ray can advance without missing any visible sample.
+class EmptySpaceGrid {
+public:
+    // GLSL declarations of the grid uniforms and empty_space_skip(). Insert this after the #version line.
+    static const char* const GLSL;
+
+    struct UniformLocations {
+        GLint minmax = -1;
+        GLint tf_prefix = -1;
+        GLint volume_dims = -1;
+        GLint brick_size = -1;
+        GLint tf_width = -1;
+        GLint enabled = -1;
+    };
+    static UniformLocations uniform_locations(GLuint program);
+
+    // Point the grid samplers of the bound program at minmax_unit and minmax_unit + 1. Call this even when the
+    // grid is disabled, otherwise the unused samplers alias unit 0 with a different sampler type.
+    static void set_sampler_units(const UniformLocations& locations, GLuint minmax_unit);
+
+    EmptySpaceGrid() = default;
+    EmptySpaceGrid(const EmptySpaceGrid&) = delete;
+    EmptySpaceGrid& operator=(const EmptySpaceGrid&) = delete;
+    ~EmptySpaceGrid() = default;
+
+    void init();
+    void destroy();
+
+    // Rebuild the opacity prefix table from the RGBA8 transfer function texels
+    void update_transfer_function(const std::vector<std::array<std::uint8_t, 4>>& transfer_function_data);
+
+    // Bind minmax_grid and the opacity table to minmax_unit and minmax_unit + 1 and set the uniforms. If enabled is
+    // false empty_space_skip() never skips, e.g. when the opacity of a sample does not come from the transfer
+    // function.
+    void bind(const UniformLocations& locations, GLuint minmax_unit, const VolumeMinMaxGrid& minmax_grid,
+              bool enabled = true) const;
+
+private:
+    GLuint _tf_prefix_texture = 0;
+    int _tf_width = 0;
+};
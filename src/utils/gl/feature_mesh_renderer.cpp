@@ -0,0 +1,467 @@
+#include "feature_mesh_renderer.h"
+#include "gpu_profiler.h"
+#include "shader_cache.h"
+#include "utils/memory_tracker.h"
+#include "utils/utils.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+constexpr const char* FeatureMeshVertexShader = R"(
+#version 150
+in vec4 in_position;
+in uint in_feature;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+uniform vec3 box_min;
+uniform vec3 box_extent;
+
+out vec3 position_eye;
+flat out uint feature;
+
+void main() {
+    vec4 position_eye4 = view * model * vec4(box_min + in_position.xyz * box_extent, 1.0);
+    position_eye = position_eye4.xyz;
+    gl_Position = proj * position_eye4;
+    feature = in_feature;
+}
+)";
+
+constexpr const char* FeatureMeshFragmentShaderVersion = R"(
+#version 150
+)";
+
+// Flat shaded from the derivatives of the position like ScalarMeshRenderer. The emphasis follows selection_factor()
+// of the volume pass of SelectionRenderer, but the faces stay opaque so they need no sorting: a feature the
+// emphasis would make transparent is drawn desaturated and darker instead, and not at all at a factor of 0.
+constexpr const char* FeatureMeshFragmentShader = R"(
+// Keep in sync with Parameters::emphasize_by_selection
+#define SELECTION_EMPHASIS_TYPE_NONE 0
+#define SELECTION_EMPHASIS_TYPE_ONSELECTION 1
+#define SELECTION_EMPHASIS_TYPE_ONNONSELECTION 2
+
+in vec3 position_eye;
+flat in uint feature;
+
+uniform vec3 light_position;
+uniform vec3 ambient;
+uniform vec3 diffuse;
+uniform vec3 specular;
+uniform float specular_exponent;
+
+uniform bool color_by_id;
+uniform vec3 color;
+uniform uint num_features;
+
+uniform int emphasis;
+uniform float highlight_factor;
+// Bitset of the selected features, bit (feature % 32) of texel (feature / 32)
+uniform usampler1D selection_features;
+
+out vec4 out_color;
+out uint out_feature;
+
+bool is_feature_selected(uint feature) {
+    int word_index = int(feature >> 5u);
+    if (word_index >= textureSize(selection_features, 0)) {
+        return false;
+    }
+    uint word = texelFetch(selection_features, word_index, 0).r;
+    return (word & (1u << (feature & 31u))) != 0u;
+}
+
+float selection_factor(uint feature) {
+    if (emphasis == SELECTION_EMPHASIS_TYPE_ONSELECTION) {
+        return is_feature_selected(feature) ? 1.0 : highlight_factor;
+    } else if (emphasis == SELECTION_EMPHASIS_TYPE_ONNONSELECTION) {
+        return is_feature_selected(feature) ? highlight_factor : 1.0;
+    }
+    return 1.0;
+}
+
+void main() {
+    float factor = selection_factor(feature);
+    if (factor <= 0.0) {
+        discard;
+    }
+    vec3 base = color_by_id ? colormap(float(feature) / float(num_features)).rgb : color;
+    base = mix(vec3(dot(base, vec3(0.299, 0.587, 0.114))), base, factor) * (0.5 + 0.5 * factor);
+
+    vec3 n = normalize(cross(dFdx(position_eye), dFdy(position_eye)));
+    vec3 l = normalize(light_position - position_eye);
+    vec3 v = normalize(-position_eye);
+    vec3 h = normalize(l + v);
+    vec3 shaded = base * ambient + base * diffuse * max(dot(n, l), 0.0) +
+                  specular * pow(max(dot(n, h), 0.0), specular_exponent);
+    out_color = vec4(shaded, 1.0);
+    out_feature = feature;
+}
+)";
+
+namespace {
+
+// Name the buffers and render targets are reported under to memory_tracker()
+const char* MEMORY_NAME = "Feature surface meshes";
+
+constexpr float QUANTIZED_MAX = 65535.f;
+
+} // namespace
+
+constexpr int FeatureMeshRenderer::NUM_PICKING_BUFFERS;
+
+
+void FeatureMeshRenderer::init() {
+    const std::string fragment_shader = std::string(FeatureMeshFragmentShaderVersion) +
+            SelectionRenderer::COLORMAP_GLSL + FeatureMeshFragmentShader;
+    create_cached_shader_program(std::string(), FeatureMeshVertexShader, fragment_shader,
+                                 {{ "in_position", 0 }, { "in_feature", 1 }}, _gl_state.program,
+                                 {{ "out_color", 0 }, { "out_feature", 1 }});
+
+    GLuint program = _gl_state.program;
+    _gl_state.uniform_location.model = glGetUniformLocation(program, "model");
+    _gl_state.uniform_location.view = glGetUniformLocation(program, "view");
+    _gl_state.uniform_location.proj = glGetUniformLocation(program, "proj");
+    _gl_state.uniform_location.box_min = glGetUniformLocation(program, "box_min");
+    _gl_state.uniform_location.box_extent = glGetUniformLocation(program, "box_extent");
+    _gl_state.uniform_location.light_position = glGetUniformLocation(program, "light_position");
+    _gl_state.uniform_location.ambient = glGetUniformLocation(program, "ambient");
+    _gl_state.uniform_location.diffuse = glGetUniformLocation(program, "diffuse");
+    _gl_state.uniform_location.specular = glGetUniformLocation(program, "specular");
+    _gl_state.uniform_location.specular_exponent = glGetUniformLocation(program, "specular_exponent");
+    _gl_state.uniform_location.color_by_id = glGetUniformLocation(program, "color_by_id");
+    _gl_state.uniform_location.color = glGetUniformLocation(program, "color");
+    _gl_state.uniform_location.num_features = glGetUniformLocation(program, "num_features");
+    _gl_state.uniform_location.emphasis = glGetUniformLocation(program, "emphasis");
+    _gl_state.uniform_location.highlight_factor = glGetUniformLocation(program, "highlight_factor");
+    _gl_state.uniform_location.selection_features = glGetUniformLocation(program, "selection_features");
+
+    glGenVertexArrays(1, &_gl_state.vao);
+    glGenBuffers(1, &_gl_state.position_buffer);
+    glGenBuffers(1, &_gl_state.feature_buffer);
+    glGenBuffers(1, &_gl_state.index_buffer);
+
+    glBindVertexArray(_gl_state.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.position_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(std::uint16_t), nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.feature_buffer);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _gl_state.index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &_gl_state.color_texture);
+    glGenTextures(1, &_gl_state.feature_texture);
+    glGenRenderbuffers(1, &_gl_state.depth_renderbuffer);
+    glGenFramebuffers(1, &_gl_state.framebuffer);
+    _framebuffer_size = glm::ivec2(0);
+
+    glGenBuffers(NUM_PICKING_BUFFERS, _gl_state.pixel_buffer);
+    for (int i = 0; i < NUM_PICKING_BUFFERS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.pixel_buffer[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _picking.dirty = true;
+}
+
+void FeatureMeshRenderer::destroy() {
+    for (GLsync& fence : _picking.fence) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    glDeleteProgram(_gl_state.program);
+    glDeleteVertexArrays(1, &_gl_state.vao);
+    const GLuint buffers[] = { _gl_state.position_buffer, _gl_state.feature_buffer, _gl_state.index_buffer };
+    glDeleteBuffers(3, buffers);
+    glDeleteBuffers(NUM_PICKING_BUFFERS, _gl_state.pixel_buffer);
+    const GLuint textures[] = { _gl_state.color_texture, _gl_state.feature_texture };
+    glDeleteTextures(2, textures);
+    glDeleteRenderbuffers(1, &_gl_state.depth_renderbuffer);
+    glDeleteFramebuffers(1, &_gl_state.framebuffer);
+    _gl_state = decltype(_gl_state)();
+
+    _framebuffer_size = glm::ivec2(0);
+    _num_vertices = 0;
+    _num_faces.fill(0);
+    _first_index.fill(0);
+    _picking.result = 0;
+    _picking.dirty = true;
+    memory_tracker().set(MEMORY_NAME, 0, 0);
+}
+
+void FeatureMeshRenderer::set_surfaces(const FeatureSurfaces& surfaces) {
+    push_opengl_debug_group("FeatureMeshRenderer::set_surfaces");
+
+    // All levels go into the same buffers, the indices of a level point at its own vertices
+    Eigen::RowVector3f box_min = Eigen::RowVector3f::Constant(std::numeric_limits<float>::max());
+    Eigen::RowVector3f box_max = Eigen::RowVector3f::Constant(std::numeric_limits<float>::lowest());
+    GLsizei num_vertices = 0, num_indices = 0;
+    for (int l = 0; l < FeatureSurfaces::NUM_LEVELS; l++) {
+        const FeatureSurfaces::Level& level = surfaces.levels[l];
+        if (level.V.rows() > 0) {
+            box_min = box_min.cwiseMin(level.V.colwise().minCoeff());
+            box_max = box_max.cwiseMax(level.V.colwise().maxCoeff());
+        }
+        _first_index[l] = num_indices;
+        _num_faces[l] = GLsizei(level.F.rows());
+        num_vertices += GLsizei(level.V.rows());
+        num_indices += 3 * GLsizei(level.F.rows());
+    }
+    if (num_vertices == 0) {
+        box_min = Eigen::RowVector3f::Zero();
+        box_max = Eigen::RowVector3f::Ones();
+    }
+    // A flat mesh still needs something to divide by
+    const Eigen::RowVector3f box_extent = (box_max - box_min).array().max(1e-6f).matrix();
+    _box_min = glm::vec3(box_min[0], box_min[1], box_min[2]);
+    _box_extent = glm::vec3(box_extent[0], box_extent[1], box_extent[2]);
+    _num_vertices = num_vertices;
+
+    std::vector<std::uint16_t> positions(4 * std::size_t(num_vertices), 0);
+    std::vector<GLuint> features(static_cast<std::size_t>(num_vertices));
+    std::vector<GLuint> indices(static_cast<std::size_t>(num_indices));
+    std::size_t vertex_offset = 0, index_offset = 0;
+    for (int l = 0; l < FeatureSurfaces::NUM_LEVELS; l++) {
+        const FeatureSurfaces::Level& level = surfaces.levels[l];
+        for (Eigen::Index i = 0; i < level.V.rows(); i++) {
+            for (int c = 0; c < 3; c++) {
+                const float t = (level.V(i, c) - box_min[c]) / box_extent[c];
+                positions[4 * (vertex_offset + i) + c] =
+                        std::uint16_t(std::min(std::max(t, 0.f), 1.f) * QUANTIZED_MAX + 0.5f);
+            }
+        }
+        std::copy(level.vertex_features.begin(), level.vertex_features.end(), features.begin() + vertex_offset);
+        for (Eigen::Index f = 0; f < level.F.rows(); f++) {
+            for (int c = 0; c < 3; c++) {
+                indices[index_offset++] = GLuint(vertex_offset + std::size_t(level.F(f, c)));
+            }
+        }
+        vertex_offset += std::size_t(level.V.rows());
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.position_buffer);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(std::uint16_t), positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.feature_buffer);
+    glBufferData(GL_ARRAY_BUFFER, features.size() * sizeof(GLuint), features.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(_gl_state.vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    _picking.dirty = true;
+    report_memory();
+    pop_opengl_debug_group();
+}
+
+void FeatureMeshRenderer::clear() {
+    set_surfaces(FeatureSurfaces());
+    _picking.result = 0;
+}
+
+void FeatureMeshRenderer::resize_framebuffer(const glm::ivec2& framebuffer_size) {
+    if (framebuffer_size == _framebuffer_size) {
+        return;
+    }
+    _framebuffer_size = glm::max(framebuffer_size, glm::ivec2(1));
+
+    glBindTexture(GL_TEXTURE_2D, _gl_state.color_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, _framebuffer_size.x, _framebuffer_size.y, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, _gl_state.feature_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, _framebuffer_size.x, _framebuffer_size.y, 0, GL_RED_INTEGER,
+                 GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, _gl_state.depth_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _framebuffer_size.x, _framebuffer_size.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _gl_state.color_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _gl_state.feature_texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _gl_state.depth_renderbuffer);
+    const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, draw_buffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    _picking.dirty = true;
+    report_memory();
+}
+
+void FeatureMeshRenderer::report_memory() const {
+    std::size_t device_bytes = std::size_t(_num_vertices) * (4 * sizeof(std::uint16_t) + sizeof(GLuint));
+    for (GLsizei n : _num_faces) {
+        device_bytes += std::size_t(n) * 3 * sizeof(GLuint);
+    }
+    // RGBA8, the feature and the depth
+    device_bytes += std::size_t(_framebuffer_size.x) * _framebuffer_size.y * (4 + 4 + 4);
+    memory_tracker().set(MEMORY_NAME, 0, device_bytes);
+}
+
+void FeatureMeshRenderer::draw(const glm::mat4& model_matrix, const glm::mat4& view_matrix,
+                               const glm::mat4& proj_matrix, const Parameters& parameters, int level,
+                               GLuint selection_texture, bool has_selection, GLuint num_features,
+                               const glm::vec4& background_color, const glm::ivec2& mouse_position) {
+    resolve_picking_readbacks();
+    level = std::min(std::max(level, 0), FeatureSurfaces::NUM_LEVELS - 1);
+    if (_num_faces[level] == 0 || _framebuffer_size.x <= 0) {
+        _picking.result = 0;
+        return;
+    }
+    push_opengl_debug_group("FeatureMeshRenderer::draw");
+    gpu_profiler().begin("Feature meshes");
+
+    GLint previous_framebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean cull_face_enabled = glIsEnabled(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.framebuffer);
+    glViewport(0, 0, _framebuffer_size.x, _framebuffer_size.y);
+    const GLuint no_feature[4] = { 0, 0, 0, 0 };
+    const GLfloat far_depth = 1.f;
+    glClearBufferfv(GL_COLOR, 0, glm::value_ptr(background_color));
+    glClearBufferuiv(GL_COLOR, 1, no_feature);
+    glClearBufferfv(GL_DEPTH, 0, &far_depth);
+
+    // Without a selection nothing is emphasized, as in the volume pass
+    const int emphasis = has_selection ? parameters.emphasize_by_selection : 0;
+    glUseProgram(_gl_state.program);
+    glUniformMatrix4fv(_gl_state.uniform_location.model, 1, GL_FALSE, glm::value_ptr(model_matrix));
+    glUniformMatrix4fv(_gl_state.uniform_location.view, 1, GL_FALSE, glm::value_ptr(view_matrix));
+    glUniformMatrix4fv(_gl_state.uniform_location.proj, 1, GL_FALSE, glm::value_ptr(proj_matrix));
+    glUniform3fv(_gl_state.uniform_location.box_min, 1, glm::value_ptr(_box_min));
+    glUniform3fv(_gl_state.uniform_location.box_extent, 1, glm::value_ptr(_box_extent));
+    glUniform3fv(_gl_state.uniform_location.light_position, 1, glm::value_ptr(parameters.light_position));
+    glUniform3fv(_gl_state.uniform_location.ambient, 1, glm::value_ptr(parameters.ambient));
+    glUniform3fv(_gl_state.uniform_location.diffuse, 1, glm::value_ptr(parameters.diffuse));
+    glUniform3fv(_gl_state.uniform_location.specular, 1, glm::value_ptr(parameters.specular));
+    glUniform1f(_gl_state.uniform_location.specular_exponent, parameters.specular_exponent);
+    glUniform1i(_gl_state.uniform_location.color_by_id, parameters.color_by_id);
+    glUniform3fv(_gl_state.uniform_location.color, 1, glm::value_ptr(face_color));
+    glUniform1ui(_gl_state.uniform_location.num_features, std::max(num_features, GLuint(1)));
+    glUniform1i(_gl_state.uniform_location.emphasis, emphasis);
+    glUniform1f(_gl_state.uniform_location.highlight_factor, parameters.highlight_factor);
+    glUniform1i(_gl_state.uniform_location.selection_features, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_1D, selection_texture);
+
+    // The surfaces are closed and face out of their features, so the back faces are always hidden
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glBindVertexArray(_gl_state.vao);
+    glDrawElements(GL_TRIANGLES, 3 * _num_faces[level], GL_UNSIGNED_INT,
+                   reinterpret_cast<const void*>(std::size_t(_first_index[level]) * sizeof(GLuint)));
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glUseProgram(0);
+
+    // Read back the feature under the mouse, unless the last pick was of the same image
+    const glm::mat4 mvp_matrix = proj_matrix * view_matrix * model_matrix;
+    const bool hide_emphasized = emphasis != 0 && parameters.highlight_factor <= 0.f;
+    const bool inside = glm::all(glm::greaterThanEqual(mouse_position, glm::ivec2(0))) &&
+                        glm::all(glm::lessThan(mouse_position, _framebuffer_size));
+    if (!inside) {
+        // Nothing can be under a cursor outside of the view, pending picks from inside are stale as well
+        for (GLsync& fence : _picking.fence) {
+            if (fence != nullptr) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+        _picking.result = 0;
+        _picking.dirty = true;
+    } else if (_picking.dirty || mouse_position != _picking.mouse_position || mvp_matrix != _picking.mvp_matrix ||
+               level != _picking.level || emphasis != _picking.emphasis ||
+               hide_emphasized != _picking.hide_emphasized) {
+        _picking.dirty = false;
+        _picking.mouse_position = mouse_position;
+        _picking.mvp_matrix = mvp_matrix;
+        _picking.level = level;
+        _picking.emphasis = emphasis;
+        _picking.hide_emphasized = hide_emphasized;
+
+        // If the ring is full the oldest read back is dropped, a newer one supersedes it anyway
+        const int buffer = _picking.next_buffer;
+        if (_picking.fence[buffer] != nullptr) {
+            glDeleteSync(_picking.fence[buffer]);
+        }
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.pixel_buffer[buffer]);
+        glReadPixels(mouse_position.x, mouse_position.y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        _picking.fence[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _picking.next_buffer = (buffer + 1) % NUM_PICKING_BUFFERS;
+    }
+
+    // The color goes into the viewport of the caller's framebuffer, which has the size of ours
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _gl_state.framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(previous_framebuffer));
+    glBlitFramebuffer(0, 0, _framebuffer_size.x, _framebuffer_size.y, viewport[0], viewport[1],
+                      viewport[0] + _framebuffer_size.x, viewport[1] + _framebuffer_size.y, GL_COLOR_BUFFER_BIT,
+                      GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previous_framebuffer));
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (depth_test_enabled == GL_FALSE) {
+        glDisable(GL_DEPTH_TEST);
+    }
+    if (cull_face_enabled == GL_FALSE) {
+        glDisable(GL_CULL_FACE);
+    }
+
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
+
+bool FeatureMeshRenderer::is_picking() const {
+    return std::any_of(std::begin(_picking.fence), std::end(_picking.fence),
+                       [](GLsync fence) { return fence != nullptr; });
+}
+
+void FeatureMeshRenderer::resolve_picking_readbacks() {
+    // Oldest to newest so the most recent finished pick ends up in the result
+    for (int i = 0; i < NUM_PICKING_BUFFERS; i++) {
+        const int buffer = (_picking.next_buffer + i) % NUM_PICKING_BUFFERS;
+        GLsync& fence = _picking.fence[buffer];
+        if (fence == nullptr) {
+            continue;
+        }
+        const GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            continue;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.pixel_buffer[buffer]);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+        if (data != nullptr) {
+            GLuint feature = 0;
+            std::memcpy(&feature, data, sizeof(feature));
+            _picking.result = int(feature);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <array>
+
+#include "selection_renderer.h"
+#include "utils/feature_surfaces.h"
+
+// Draws the FeatureSurfaces of the segmented volume instead of ray casting it, for GPUs too slow for
+// SelectionRenderer. Features are colored and emphasized as by the volume pass: by identifier with the same
+// colormap, or in a single color, and features the emphasis fades out entirely are not drawn.
+//
+// The faces are rasterized into a framebuffer of the renderer with two color attachments, the shaded color and the
+// feature + 1 of every pixel (0 where there is none). The color is copied into the framebuffer bound by the caller
+// and the pixel under the mouse is read back from the feature attachment, so picking costs no pass of its own.
+// Like the picking pass of SelectionRenderer the read back goes through a ring of pixel buffers and is picked up a
+// frame or two later.
+//
+// Every level of detail is uploaded once, so switching between them only changes the range of indices drawn.
+class FeatureMeshRenderer {
+    static constexpr int NUM_PICKING_BUFFERS = 3;
+
+public:
+    void init();
+    void destroy();
+    bool is_initialized() const { return _gl_state.program != 0; }
+
+    void set_surfaces(const FeatureSurfaces& surfaces);
+    void clear();
+    bool empty() const { return _num_faces[0] == 0; }
+    GLsizei num_faces(int level) const { return _num_faces[level]; }
+
+    void resize_framebuffer(const glm::ivec2& framebuffer_size);
+
+    // The emphasis depends on the selection, call this when it changes so that the next draw picks again
+    void invalidate_picking() { _picking.dirty = true; }
+
+    // Draw level of the surfaces with the transformation of SelectionRenderer, mapping the texture coordinates of
+    // the volume to world space, and into the viewport of the framebuffer bound by the caller. selection_texture is
+    // the bitset of SelectionRenderer::gl_state(), it is only read if has_selection. num_features is the first
+    // value of the contour data. The pixel at mouse_position (in the viewport, from its lower left corner) is
+    // picked unless neither it nor anything drawn changed since the last draw.
+    void draw(const glm::mat4& model_matrix, const glm::mat4& view_matrix, const glm::mat4& proj_matrix,
+              const Parameters& parameters, int level, GLuint selection_texture, bool has_selection,
+              GLuint num_features, const glm::vec4& background_color, const glm::ivec2& mouse_position);
+
+    // Feature + 1 under the mouse at the last read back, 0 if there is none
+    int picked_feature() const { return _picking.result; }
+    // True while a pick issued by draw has not been read back yet
+    bool is_picking() const;
+
+    // Color of the features when they are not colored by identifier
+    glm::vec3 face_color = glm::vec3(0.85f, 0.8f, 0.7f);
+
+private:
+    void resolve_picking_readbacks();
+    void report_memory() const;
+
+    struct {
+        GLuint program = 0;
+        GLuint vao = 0;
+        GLuint position_buffer = 0;
+        GLuint feature_buffer = 0;
+        GLuint index_buffer = 0;
+
+        GLuint framebuffer = 0;
+        GLuint color_texture = 0;
+        GLuint feature_texture = 0;
+        GLuint depth_renderbuffer = 0;
+
+        // Ring of pixel pack buffers the picked feature is read back into without stalling
+        GLuint pixel_buffer[NUM_PICKING_BUFFERS] = { 0, 0, 0 };
+
+        struct {
+            GLint model;
+            GLint view;
+            GLint proj;
+            GLint box_min;
+            GLint box_extent;
+            GLint light_position;
+            GLint ambient;
+            GLint diffuse;
+            GLint specular;
+            GLint specular_exponent;
+            GLint color_by_id;
+            GLint color;
+            GLint num_features;
+            GLint emphasis;
+            GLint highlight_factor;
+            GLint selection_features;
+        } uniform_location;
+    } _gl_state;
+
+    glm::ivec2 _framebuffer_size = glm::ivec2(0);
+
+    GLsizei _num_vertices = 0;
+    // Faces of every level and their first index in the index buffer
+    std::array<GLsizei, FeatureSurfaces::NUM_LEVELS> _num_faces = {};
+    std::array<GLsizei, FeatureSurfaces::NUM_LEVELS> _first_index = {};
+    // Positions are stored as fractions of the bounding box of all levels
+    glm::vec3 _box_min = glm::vec3(0.0f);
+    glm::vec3 _box_extent = glm::vec3(1.0f);
+
+    // Read backs still in flight, a fence per pixel buffer of the ring
+    struct {
+        GLsync fence[NUM_PICKING_BUFFERS] = { nullptr, nullptr, nullptr };
+        int next_buffer = 0;
+        int result = 0;
+
+        // Inputs of the last issued pick, nothing is read back if none of them changed
+        bool dirty = true;
+        glm::ivec2 mouse_position = glm::ivec2(-1);
+        glm::mat4 mvp_matrix = glm::mat4(0.f);
+        int level = -1;
+        int emphasis = -1;
+        bool hide_emphasized = false;
+    } _picking;
+};
@@ -0,0 +1,246 @@
+#include "feature_picker.h"
+
+#include "utils/parallel_for.h"
+
+#include <glm/gtx/component_wise.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr std::uint32_t NO_FEATURE = ~std::uint32_t(0);
+
+// Distance along the unit direction d from p, which lies in the box [lo, hi], to where the ray leaves the box
+float box_exit_distance(const glm::vec3& p, const glm::vec3& d, const glm::vec3& lo, const glm::vec3& hi) {
+    float exit = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; i++) {
+        if (d[i] > 0.f) {
+            exit = std::min(exit, (hi[i] - p[i]) / d[i]);
+        } else if (d[i] < 0.f) {
+            exit = std::min(exit, (lo[i] - p[i]) / d[i]);
+        }
+    }
+    return std::max(exit, 0.f);
+}
+
+// Opacity of the piecewise linear transfer function at t, as resampled by TransferFunctionTexture::update
+float transfer_function_opacity(const std::vector<TfNode>& transfer_function, float t) {
+    if (transfer_function.empty()) {
+        return 0.f;
+    }
+    if (t <= transfer_function.front().t) {
+        return transfer_function.front().rgba[3];
+    }
+    for (std::size_t i = 1; i < transfer_function.size(); i++) {
+        const TfNode& a = transfer_function[i - 1];
+        const TfNode& b = transfer_function[i];
+        if (t <= b.t) {
+            const float s = b.t > a.t ? (t - a.t) / (b.t - a.t) : 1.f;
+            return (1.f - s) * a.rgba[3] + s * b.rgba[3];
+        }
+    }
+    return transfer_function.back().rgba[3];
+}
+
+} // namespace
+
+
+FeaturePicker::FeaturePicker() {
+    for (int i = 0; i < 256; i++) {
+        _remap[i] = std::uint8_t(i);
+    }
+    _opaque.fill(false);
+    _opaque_prefix.fill(0);
+    _thread = std::thread([this]() { run(); });
+}
+
+FeaturePicker::~FeaturePicker() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _requested.notify_all();
+    _thread.join();
+}
+
+void FeaturePicker::set_volume(const std::uint8_t* volume_data, const std::uint32_t* index_data,
+                               const glm::ivec3& dims, std::uint8_t min_value, std::uint8_t max_value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _volume_data = volume_data;
+    _index_data = index_data;
+    _dims = dims;
+
+    // Same stretch as quantize_volume
+    const double value_range = std::max(double(max_value) - double(min_value), 1.0);
+    for (int i = 0; i < 256; i++) {
+        const double v = std::min(std::max((i - double(min_value)) / value_range, 0.0), 1.0);
+        _remap[i] = static_cast<std::uint8_t>(v * std::numeric_limits<std::uint8_t>::max());
+    }
+    update_bricks();
+}
+
+void FeaturePicker::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _volume_data = nullptr;
+    _index_data = nullptr;
+    _dims = glm::ivec3(0);
+    _num_bricks = glm::ivec3(0);
+    _brick_ranges.clear();
+    _result = 0;
+}
+
+void FeaturePicker::set_contour_data(const std::uint32_t* contour_features, std::size_t num_features) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Texel i of the contour texture is contour_features[i + 1]
+    if (num_features > 1) {
+        _arc_features.assign(contour_features + 1, contour_features + num_features);
+    } else {
+        _arc_features.clear();
+    }
+}
+
+void FeaturePicker::set_transfer_function(const std::vector<TfNode>& transfer_function, float opacity_threshold) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _opaque_prefix[0] = 0;
+    for (int i = 0; i < 256; i++) {
+        _opaque[i] = transfer_function_opacity(transfer_function, i / 255.f) >= opacity_threshold;
+        _opaque_prefix[i + 1] = _opaque_prefix[i] + (_opaque[i] ? 1 : 0);
+    }
+}
+
+void FeaturePicker::request(const glm::vec3& origin, const glm::vec3& direction) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _origin = origin;
+        _direction = direction;
+        _has_request = true;
+    }
+    _requested.notify_one();
+}
+
+int FeaturePicker::result() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _result;
+}
+
+bool FeaturePicker::is_picking() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _has_request || _busy;
+}
+
+int FeaturePicker::pick(const glm::vec3& origin, const glm::vec3& direction) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return cast(origin, direction);
+}
+
+void FeaturePicker::run() {
+    // The pick answers a click, its loops go ahead of the bulk work
+    TaskLaneScope lane_scope(TaskLane::Interactive);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _requested.wait(lock, [this]() { return _stopping || _has_request; });
+        if (_stopping) {
+            return;
+        }
+        _has_request = false;
+        _busy = true;
+        _result = cast(_origin, _direction);
+        _busy = false;
+    }
+}
+
+void FeaturePicker::update_bricks() {
+    _num_bricks = (_dims + glm::ivec3(BRICK_SIZE - 1)) / BRICK_SIZE;
+    _brick_ranges.assign(std::size_t(_num_bricks.x) * _num_bricks.y * _num_bricks.z, { { 255, 0 } });
+    if (_volume_data == nullptr) {
+        return;
+    }
+    // A brick slab per chunk, they do not share any bricks
+    parallel_for_chunks(std::size_t(_num_bricks.z), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (int z = int(begin) * BRICK_SIZE; z < std::min(int(end) * BRICK_SIZE, _dims.z); z++) {
+            for (int y = 0; y < _dims.y; y++) {
+                const std::uint8_t* row = _volume_data + (std::size_t(z) * _dims.y + y) * _dims.x;
+                std::array<std::uint8_t, 2>* bricks = _brick_ranges.data() +
+                        (std::size_t(z / BRICK_SIZE) * _num_bricks.y + y / BRICK_SIZE) * _num_bricks.x;
+                for (int x = 0; x < _dims.x; x++) {
+                    std::array<std::uint8_t, 2>& range = bricks[x / BRICK_SIZE];
+                    range[0] = std::min(range[0], row[x]);
+                    range[1] = std::max(range[1], row[x]);
+                }
+            }
+        }
+    }, 1);
+}
+
+bool FeaturePicker::brick_visible(const glm::ivec3& brick) const {
+    const std::array<std::uint8_t, 2>& range =
+            _brick_ranges[(std::size_t(brick.z) * _num_bricks.y + brick.y) * _num_bricks.x + brick.x];
+    if (range[0] > range[1]) {
+        return false;
+    }
+    // The stretch is monotonic, so the stretched range of the brick is that of its ends
+    return _opaque_prefix[_remap[range[1]] + 1] - _opaque_prefix[_remap[range[0]]] > 0;
+}
+
+int FeaturePicker::cast(const glm::vec3& origin, const glm::vec3& direction) const {
+    if (_volume_data == nullptr || _index_data == nullptr || glm::compMin(_dims) <= 0) {
+        return 0;
+    }
+
+    // Walk in voxel units so that a step of the ray is a whole voxel or brick
+    const glm::vec3 dims(_dims);
+    const glm::vec3 p0 = origin * dims;
+    glm::vec3 d = direction * dims;
+    const float length = glm::length(d);
+    if (length == 0.f) {
+        return 0;
+    }
+    d /= length;
+
+    // Clip the ray to the volume
+    float t_begin = 0.f;
+    float t_end = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; i++) {
+        if (d[i] == 0.f) {
+            if (p0[i] < 0.f || p0[i] > dims[i]) {
+                return 0;
+            }
+            continue;
+        }
+        float t0 = (0.f - p0[i]) / d[i];
+        float t1 = (dims[i] - p0[i]) / d[i];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        t_begin = std::max(t_begin, t0);
+        t_end = std::min(t_end, t1);
+    }
+
+    // Nudges the ray past the face of the voxel or brick it just left
+    constexpr float EPSILON = 1e-3f;
+    float t = t_begin + EPSILON;
+    while (t < t_end) {
+        const glm::vec3 p = p0 + t * d;
+        const glm::ivec3 voxel = glm::clamp(glm::ivec3(glm::floor(p)), glm::ivec3(0), _dims - 1);
+        const glm::ivec3 brick = voxel / BRICK_SIZE;
+        if (!brick_visible(brick)) {
+            const glm::vec3 lo(brick * BRICK_SIZE);
+            const glm::vec3 hi = glm::min(lo + glm::vec3(BRICK_SIZE), dims);
+            t += box_exit_distance(p, d, lo, hi) + EPSILON;
+            continue;
+        }
+
+        const std::size_t i = (std::size_t(voxel.z) * _dims.y + voxel.y) * _dims.x + voxel.x;
+        if (_opaque[_remap[_volume_data[i]]]) {
+            const std::uint32_t arc = _index_data[i];
+            const std::uint32_t feature = arc < _arc_features.size() ? _arc_features[arc] : NO_FEATURE;
+            if (feature != NO_FEATURE) {
+                return int(feature) + 1;
+            }
+        }
+        t += box_exit_distance(p, d, glm::vec3(voxel), glm::vec3(voxel + 1)) + EPSILON;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "transfer_function_texture.h"
+
+// Picks the feature under the mouse on the CPU, as an alternative to the picking pass of SelectionRenderer that
+// needs a ray cast on the GPU and a read back every time the mouse moves.
+//
+// A single ray is cast through the low resolution volume on a worker thread. It walks the voxels it crosses in
+// order and returns the feature of the first voxel that is part of a feature and at least as opaque in the
+// transfer function as the threshold. Bricks of BRICK_SIZE^3 voxels whose range of values has no such opacity
+// are stepped over whole, like the EmptySpaceGrid of the GPU ray casters.
+//
+// The volume is not copied, it must stay alive and unchanged until the next set_volume() or clear().
+class FeaturePicker {
+public:
+    static constexpr int BRICK_SIZE = 8;
+    static constexpr float DEFAULT_OPACITY_THRESHOLD = 0.05f;
+
+    FeaturePicker();
+    FeaturePicker(const FeaturePicker&) = delete;
+    FeaturePicker& operator=(const FeaturePicker&) = delete;
+    ~FeaturePicker();
+
+    // volume_data and index_data hold dims voxels, x fastest. The values are stretched from [min_value,
+    // max_value] to [0, 255] before the transfer function is applied, as for the volume texture.
+    void set_volume(const std::uint8_t* volume_data, const std::uint32_t* index_data, const glm::ivec3& dims,
+                    std::uint8_t min_value, std::uint8_t max_value);
+    void clear();
+    // The same buffer as SelectionRenderer::set_contour_data, it is copied
+    void set_contour_data(const std::uint32_t* contour_features, std::size_t num_features);
+    void set_transfer_function(const std::vector<TfNode>& transfer_function,
+                               float opacity_threshold = DEFAULT_OPACITY_THRESHOLD);
+
+    // Casts the ray from origin along direction in the texture coordinates of the volume, [0, 1]^3, on the
+    // worker thread. A ray requested while the worker is busy replaces the one waiting.
+    void request(const glm::vec3& origin, const glm::vec3& direction);
+    // The pick of the last finished ray: the feature + 1 (as SelectionRenderer::picking_pass), 0 if it hit none
+    int result() const;
+    // True while a requested ray has not been cast yet
+    bool is_picking() const;
+
+    // Casts the ray on the calling thread
+    int pick(const glm::vec3& origin, const glm::vec3& direction) const;
+
+private:
+    void run();
+    // These expect the mutex to be held
+    int cast(const glm::vec3& origin, const glm::vec3& direction) const;
+    void update_bricks();
+    bool brick_visible(const glm::ivec3& brick) const;
+
+    // Guards the volume, the tables and the bricks, and the request and result below
+    mutable std::mutex _mutex;
+    std::condition_variable _requested;
+    bool _stopping = false;
+    bool _has_request = false;
+    bool _busy = false;
+    glm::vec3 _origin = glm::vec3(0.f);
+    glm::vec3 _direction = glm::vec3(0.f);
+    int _result = 0;
+
+    const std::uint8_t* _volume_data = nullptr;
+    const std::uint32_t* _index_data = nullptr;
+    glm::ivec3 _dims = glm::ivec3(0);
+    glm::ivec3 _num_bricks = glm::ivec3(0);
+    // Voxel value -> value of the stretched range the transfer function is applied to
+    std::array<std::uint8_t, 256> _remap;
+
+    // Arc -> feature, ~0 for arcs of no feature
+    std::vector<std::uint32_t> _arc_features;
+    // Whether a stretched value is opaque enough, and the prefix count of the opaque values
+    std::array<bool, 256> _opaque;
+    std::array<int, 257> _opaque_prefix;
+    // Lowest and highest voxel value of every brick
+    std::vector<std::array<std::uint8_t, 2>> _brick_ranges;
+
+    std::thread _thread;
+};
@@ -0,0 +1,161 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+
+
+GpuProfiler& gpu_profiler() {
+    static GpuProfiler profiler;
+    return profiler;
+}
+
+bool GpuProfiler::set_enabled(bool enabled) {
+    if (enabled && !GLAD_GL_VERSION_3_3) {
+        _enabled = false;
+        return false;
+    }
+    if (!enabled) {
+        for (Frame& frame : _frames) {
+            drop(frame);
+        }
+        _open_timings.clear();
+    }
+    _enabled = enabled;
+    return true;
+}
+
+void GpuProfiler::set_logger(std::shared_ptr<spdlog::logger> logger, int log_interval) {
+    _logger = logger;
+    _log_interval = std::max(log_interval, 1);
+}
+
+void GpuProfiler::new_frame() {
+    if (!_enabled) {
+        return;
+    }
+
+    // Oldest to newest, a frame can only be done if all frames before it are
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        Frame& frame = _frames[(_current_frame + i) % NUM_FRAMES_IN_FLIGHT];
+        if (frame.pending && !collect(frame)) {
+            break;
+        }
+    }
+
+    _current_frame = (_current_frame + 1) % NUM_FRAMES_IN_FLIGHT;
+    Frame& frame = _frames[_current_frame];
+    if (frame.pending) {
+        // Still not done after NUM_FRAMES_IN_FLIGHT frames, waiting would stall
+        drop(frame);
+    }
+    _open_timings.clear();
+
+    _num_frames++;
+    if (_logger && _num_frames % std::uint64_t(_log_interval) == 0) {
+        log(*_logger);
+    }
+}
+
+void GpuProfiler::begin(const std::string& name) {
+    if (!_enabled) {
+        return;
+    }
+
+    auto it = _section_index.find(name);
+    if (it == _section_index.end()) {
+        Section section;
+        section.name = name;
+        section.depth = static_cast<int>(_open_timings.size());
+        it = _section_index.emplace(name, static_cast<int>(_sections.size())).first;
+        _sections.push_back(section);
+    }
+
+    Frame& frame = _frames[_current_frame];
+    Timing timing;
+    timing.section = it->second;
+    timing.begin_query = allocate_query(frame);
+    timing.end_query = allocate_query(frame);
+    glQueryCounter(timing.begin_query, GL_TIMESTAMP);
+
+    _open_timings.push_back(frame.timings.size());
+    frame.timings.push_back(timing);
+    frame.pending = true;
+}
+
+void GpuProfiler::end() {
+    if (!_enabled || _open_timings.empty()) {
+        return;
+    }
+    Frame& frame = _frames[_current_frame];
+    glQueryCounter(frame.timings[_open_timings.back()].end_query, GL_TIMESTAMP);
+    _open_timings.pop_back();
+}
+
+void GpuProfiler::log(spdlog::logger& logger) const {
+    for (const Section& section : _sections) {
+        logger.info("GPU {}{}: {:.3f} ms ({} calls)", std::string(2 * section.depth, ' '), section.name,
+                    section.average_ms, section.num_calls);
+    }
+}
+
+void GpuProfiler::destroy() {
+    for (Frame& frame : _frames) {
+        if (!frame.queries.empty()) {
+            glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+        }
+        frame = Frame();
+    }
+    _open_timings.clear();
+    _enabled = false;
+}
+
+GLuint GpuProfiler::allocate_query(Frame& frame) {
+    if (frame.num_used_queries == frame.queries.size()) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    return frame.queries[frame.num_used_queries++];
+}
+
+bool GpuProfiler::collect(Frame& frame) {
+    // Queries complete in order, so the frame is done once the last query allocated for it is
+    if (!frame.timings.empty()) {
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.num_used_queries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+    }
+
+    std::vector<double> frame_ms(_sections.size(), 0.0);
+    std::vector<int> num_calls(_sections.size(), 0);
+    for (const Timing& timing : frame.timings) {
+        GLuint64 begin_ns = 0, end_ns = 0;
+        glGetQueryObjectui64v(timing.begin_query, GL_QUERY_RESULT, &begin_ns);
+        glGetQueryObjectui64v(timing.end_query, GL_QUERY_RESULT, &end_ns);
+        if (end_ns > begin_ns) {
+            frame_ms[timing.section] += double(end_ns - begin_ns) * 1e-6;
+        }
+        num_calls[timing.section]++;
+    }
+
+    for (std::size_t i = 0; i < _sections.size(); i++) {
+        if (num_calls[i] == 0) {
+            continue;
+        }
+        Section& section = _sections[i];
+        section.average_ms = section.num_calls == 0 && section.average_ms == 0.0 ? frame_ms[i] :
+                             AVERAGE_ALPHA * frame_ms[i] + (1.0 - AVERAGE_ALPHA) * section.average_ms;
+        section.last_ms = frame_ms[i];
+        section.num_calls = num_calls[i];
+    }
+
+    drop(frame);
+    return true;
+}
+
+void GpuProfiler::drop(Frame& frame) {
+    frame.num_used_queries = 0;
+    frame.timings.clear();
+    frame.pending = false;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Measures how much GPU time named sections of a frame take.
+//
+// Every begin()/end() pair places a GL_TIMESTAMP query at both of its ends. Timestamps are used
+// instead of GL_TIME_ELAPSED queries because those cannot nest, and the render passes nest. The queries
+// of a frame are only read once the GPU is done with them, which is checked on the following frames,
+// so profiling never stalls the pipeline. If a frame is still not done after NUM_FRAMES_IN_FLIGHT
+// frames its timings are dropped.
+//
+// The time of a section is summed over all of its begin()/end() pairs in a frame and smoothed with an
+// exponential moving average. Timer queries need OpenGL 3.3, on older contexts the profiler stays disabled.
+class GpuProfiler {
+public:
+    static constexpr int NUM_FRAMES_IN_FLIGHT = 4;
+    static constexpr double AVERAGE_ALPHA = 0.1;
+
+    struct Section {
+        std::string name;
+        int depth = 0;            // Nesting level of the section when it was first seen
+        int num_calls = 0;        // begin()/end() pairs in the last measured frame it occurred in
+        double last_ms = 0.0;
+        double average_ms = 0.0;
+    };
+
+    GpuProfiler() = default;
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+    ~GpuProfiler() = default;
+
+    // Returns false if timer queries are not supported by the current context
+    bool set_enabled(bool enabled);
+    bool enabled() const { return _enabled; }
+
+    // Log the averages to logger every log_interval frames, a null logger disables logging
+    void set_logger(std::shared_ptr<spdlog::logger> logger, int log_interval = 300);
+
+    // Call once per frame before the first section. Collects the timings of earlier frames that
+    // have finished on the GPU and starts recording a new frame.
+    void new_frame();
+
+    void begin(const std::string& name);
+    void end();
+
+    const std::vector<Section>& sections() const { return _sections; }
+    void log(spdlog::logger& logger) const;
+
+    // Delete the queries, needs the context that they were created in to still be current
+    void destroy();
+
+private:
+    struct Timing {
+        int section;
+        GLuint begin_query;
+        GLuint end_query;
+    };
+
+    struct Frame {
+        std::vector<GLuint> queries;
+        std::size_t num_used_queries = 0;
+        std::vector<Timing> timings;
+        bool pending = false;
+    };
+
+    GLuint allocate_query(Frame& frame);
+    // Returns false if the queries of the frame are not available yet
+    bool collect(Frame& frame);
+    void drop(Frame& frame);
+
+    bool _enabled = false;
+    Frame _frames[NUM_FRAMES_IN_FLIGHT];
+    int _current_frame = 0;
+    std::vector<std::size_t> _open_timings;
+
+    std::vector<Section> _sections;
+    std::unordered_map<std::string, int> _section_index;
+
+    std::shared_ptr<spdlog::logger> _logger;
+    int _log_interval = 300;
+    std::uint64_t _num_frames = 0;
+};
+
+// Profiler shared by all renderers, disabled until set_enabled(true) is called
+GpuProfiler& gpu_profiler();
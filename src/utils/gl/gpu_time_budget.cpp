@@ -0,0 +1,89 @@
+#include "gpu_time_budget.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+std::size_t GpuTimeBudget::units(std::size_t fallback) const {
+    if (_ms_per_unit <= 0.0) {
+        return std::max<std::size_t>(fallback, 1);
+    }
+    return std::size_t(std::max(std::floor(_budget_ms / _ms_per_unit), 1.0));
+}
+
+void GpuTimeBudget::begin() {
+    _current = -1;
+    if (!GLAD_GL_VERSION_3_3) {
+        return;
+    }
+    collect();
+    Measurement& measurement = _measurements[_next];
+    if (measurement.pending) {
+        // The GPU is NUM_FRAMES_IN_FLIGHT frames behind, this frame goes unmeasured rather than waiting
+        return;
+    }
+    if (measurement.begin_query == 0) {
+        glGenQueries(1, &measurement.begin_query);
+        glGenQueries(1, &measurement.end_query);
+    }
+    glQueryCounter(measurement.begin_query, GL_TIMESTAMP);
+    _current = _next;
+    _next = (_next + 1) % NUM_FRAMES_IN_FLIGHT;
+}
+
+void GpuTimeBudget::end(std::size_t num_units) {
+    if (_current < 0) {
+        return;
+    }
+    Measurement& measurement = _measurements[_current];
+    glQueryCounter(measurement.end_query, GL_TIMESTAMP);
+    measurement.num_units = num_units;
+    measurement.pending = true;
+    _current = -1;
+}
+
+void GpuTimeBudget::collect() {
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        Measurement& measurement = _measurements[(_next + i) % NUM_FRAMES_IN_FLIGHT];
+        if (!measurement.pending) {
+            continue;
+        }
+        // Queries complete in order, so no later measurement is done either
+        GLint available = 0;
+        glGetQueryObjectiv(measurement.end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        measurement.pending = false;
+        if (measurement.num_units == 0) {
+            continue;
+        }
+        GLuint64 begin_ns = 0, end_ns = 0;
+        glGetQueryObjectui64v(measurement.begin_query, GL_QUERY_RESULT, &begin_ns);
+        glGetQueryObjectui64v(measurement.end_query, GL_QUERY_RESULT, &end_ns);
+        const double ms_per_unit = double(end_ns - begin_ns) * 1e-6 / double(measurement.num_units);
+        _ms_per_unit = _ms_per_unit <= 0.0 ? ms_per_unit :
+                       AVERAGE_ALPHA * ms_per_unit + (1.0 - AVERAGE_ALPHA) * _ms_per_unit;
+    }
+}
+
+void GpuTimeBudget::reset() {
+    // Results still in flight belong to the old work, they are read and dropped
+    for (Measurement& measurement : _measurements) {
+        measurement.num_units = 0;
+    }
+    _ms_per_unit = 0.0;
+}
+
+void GpuTimeBudget::destroy() {
+    for (Measurement& measurement : _measurements) {
+        if (measurement.begin_query != 0) {
+            glDeleteQueries(1, &measurement.begin_query);
+            glDeleteQueries(1, &measurement.end_query);
+        }
+        measurement = Measurement();
+    }
+    _next = 0;
+    _current = -1;
+    _ms_per_unit = 0.0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Spreads work that is split into units, e.g. the slices of an export, over frames so that each frame spends
+// about budget_ms of GPU time on it.
+//
+// The work of a frame is wrapped in begin()/end(), which place GL_TIMESTAMP queries around it like the sections
+// of GpuProfiler. Those are read once the GPU is done with them on a later frame, never stalling the pipeline,
+// and give a moving average of the time per unit. units() is the budget divided by that. The measurement does not
+// depend on gpu_profiler() being enabled. Timer queries need OpenGL 3.3, without them or before the first
+// measurement arrived units() returns the fallback.
+class GpuTimeBudget {
+public:
+    static constexpr int NUM_FRAMES_IN_FLIGHT = 4;
+    static constexpr double AVERAGE_ALPHA = 0.25;
+
+    explicit GpuTimeBudget(double budget_ms = 4.0) : _budget_ms(budget_ms) {}
+    GpuTimeBudget(const GpuTimeBudget&) = delete;
+    GpuTimeBudget& operator=(const GpuTimeBudget&) = delete;
+    ~GpuTimeBudget() = default;
+
+    void set_budget_ms(double budget_ms) { _budget_ms = budget_ms; }
+    double budget_ms() const { return _budget_ms; }
+
+    // Units of work which fit the budget of a frame, at least 1
+    std::size_t units(std::size_t fallback) const;
+
+    // Around the work of a frame, end() gets the number of units done since begin()
+    void begin();
+    void end(std::size_t num_units);
+
+    // Forget the measurements, e.g. when the work changes so its units cost something else
+    void reset();
+
+    // Delete the queries, needs the context that they were created in to still be current
+    void destroy();
+
+private:
+    struct Measurement {
+        GLuint begin_query = 0;
+        GLuint end_query = 0;
+        std::size_t num_units = 0;
+        bool pending = false;
+    };
+
+    // Fold the measurements the GPU finished into the average, oldest first
+    void collect();
+
+    double _budget_ms;
+    Measurement _measurements[NUM_FRAMES_IN_FLIGHT];
+    int _next = 0;
+    // The measurement begin() started, -1 if there was no free one
+    int _current = -1;
+    double _ms_per_unit = 0.0;
+};
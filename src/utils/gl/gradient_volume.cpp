@@ -0,0 +1,187 @@
+#include "gradient_volume.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "utils/utils.h"
+#include "shader_cache.h"
+
+
+namespace {
+
+constexpr const char* BUILD_VERTEX_SHADER = R"(
+#version 150
+// Create two triangles that are filling the entire screen [-1, 1]
+vec2 positions[6] = vec2[](
+    vec2(-1.0, -1.0),
+    vec2( 1.0, -1.0),
+    vec2( 1.0,  1.0),
+
+    vec2(-1.0, -1.0),
+    vec2( 1.0,  1.0),
+    vec2(-1.0,  1.0)
+);
+
+void main() {
+    gl_Position = vec4(positions[gl_VertexID], 0.0, 1.0);
+}
+)";
+
+// Central difference at the center of each voxel of the current layer. Interpolating these
+// gives the same result as taking the central difference of the interpolated volume.
+constexpr const char* BUILD_FRAGMENT_SHADER = R"(
+#version 150
+uniform sampler3D volume;
+uniform ivec3 volume_dims;
+uniform int layer;
+
+out vec4 out_color;
+
+// Largest possible length of a central difference of values in [0, 1]
+const float MAX_MAGNITUDE = 0.8660254;
+
+float fetch(ivec3 p) {
+    // Voxels outside of the volume read as the transparent border color
+    if (any(lessThan(p, ivec3(0))) || any(greaterThanEqual(p, volume_dims))) {
+        return 0.0;
+    }
+    return texelFetch(volume, p, 0).r;
+}
+
+void main() {
+    ivec3 p = ivec3(ivec2(gl_FragCoord.xy), layer);
+    vec3 gradient = vec3(
+        fetch(p + ivec3(1, 0, 0)) - fetch(p - ivec3(1, 0, 0)),
+        fetch(p + ivec3(0, 1, 0)) - fetch(p - ivec3(0, 1, 0)),
+        fetch(p + ivec3(0, 0, 1)) - fetch(p - ivec3(0, 0, 1))
+    ) / 2.0;
+
+    float magnitude = length(gradient);
+    vec3 direction = magnitude > 0.0 ? gradient / magnitude : vec3(0.0);
+    out_color = vec4(direction * 0.5 + 0.5, magnitude / MAX_MAGNITUDE);
+}
+)";
+
+} // namespace
+
+
+void GradientVolume::init() {
+    push_opengl_debug_group("Init GradientVolume");
+    create_cached_shader_program(BUILD_VERTEX_SHADER, BUILD_FRAGMENT_SHADER, {}, _build_program);
+    _build_location.volume = glGetUniformLocation(_build_program, "volume");
+    _build_location.volume_dims = glGetUniformLocation(_build_program, "volume_dims");
+    _build_location.layer = glGetUniformLocation(_build_program, "layer");
+
+    glGenFramebuffers(1, &_build_framebuffer);
+    glGenVertexArrays(1, &_build_vao);
+
+    glGenTextures(1, &_gradient_texture);
+    glBindTexture(GL_TEXTURE_3D, _gradient_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    _volume_texture = 0;
+    _dirty = true;
+    _valid = false;
+    pop_opengl_debug_group();
+}
+
+void GradientVolume::destroy() {
+    glDeleteTextures(1, &_gradient_texture);
+    glDeleteFramebuffers(1, &_build_framebuffer);
+    glDeleteVertexArrays(1, &_build_vao);
+    glDeleteProgram(_build_program);
+    _gradient_texture = 0;
+    _build_framebuffer = 0;
+    _build_vao = 0;
+    _build_program = 0;
+    _volume_texture = 0;
+    _volume_dims = glm::ivec3(0);
+    _gradient_dims = glm::ivec3(0);
+    _dirty = true;
+    _valid = false;
+}
+
+bool GradientVolume::update(GLuint volume_texture) {
+    if (_build_program == 0 || volume_texture == 0) {
+        return false;
+    }
+    if (!_dirty && volume_texture == _volume_texture) {
+        return _valid;
+    }
+    _volume_texture = volume_texture;
+    _dirty = false;
+    rebuild();
+    return _valid;
+}
+
+void GradientVolume::rebuild() {
+    push_opengl_debug_group("Build GradientVolume");
+    _valid = false;
+
+    glBindTexture(GL_TEXTURE_3D, _volume_texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_WIDTH, &_volume_dims.x);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_HEIGHT, &_volume_dims.y);
+    glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_DEPTH, &_volume_dims.z);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    if (glm::any(glm::lessThanEqual(_volume_dims, glm::ivec3(0)))) {
+        pop_opengl_debug_group();
+        return;
+    }
+
+    if (_volume_dims != _gradient_dims) {
+        // Drain earlier errors so an out of memory below is attributed correctly
+        while (glGetError() != GL_NO_ERROR) {}
+        glBindTexture(GL_TEXTURE_3D, _gradient_texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, _volume_dims.x, _volume_dims.y, _volume_dims.z, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        if (glGetError() != GL_NO_ERROR) {
+            _gradient_dims = glm::ivec3(0);
+            pop_opengl_debug_group();
+            return;
+        }
+        _gradient_dims = _volume_dims;
+    }
+
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    GLint old_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+    const GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+    const GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(_build_program);
+    glBindVertexArray(_build_vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, _volume_texture);
+    glUniform1i(_build_location.volume, 0);
+    glUniform3iv(_build_location.volume_dims, 1, glm::value_ptr(_volume_dims));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _build_framebuffer);
+    glViewport(0, 0, _volume_dims.x, _volume_dims.y);
+    for (int z = 0; z < _volume_dims.z; z++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _gradient_texture, 0, z);
+        glUniform1i(_build_location.layer, z);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, old_framebuffer);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    if (blend_enabled) {
+        glEnable(GL_BLEND);
+    }
+    if (depth_test_enabled) {
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    _valid = true;
+    pop_opengl_debug_group();
+}
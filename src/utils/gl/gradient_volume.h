@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+// Precomputed gradient of a 3D texture so ray casters can shade a sample with a single fetch
+// instead of six for a central difference.
+//
+// The gradient is computed on the GPU by drawing one layer of the output texture at a time.
+// Each texel stores the normalized gradient direction biased into [0, 1] in RGB and the gradient
+// magnitude (scaled so the largest possible central difference maps to 1) in A.
+//
+// Shaders decode the normal of a sample with normalize(texture(gradient_volume, uv).rgb * 2.0 - 1.0).
+class GradientVolume {
+public:
+    GradientVolume() = default;
+    GradientVolume(const GradientVolume&) = delete;
+    GradientVolume& operator=(const GradientVolume&) = delete;
+    ~GradientVolume() = default;
+
+    void init();
+    void destroy();
+
+    // Recompute the gradient if volume_texture is not the volume it was last computed from or if it
+    // was invalidated. Returns false if the gradient texture could not be allocated, in which case
+    // callers should fall back to computing the gradient per sample.
+    bool update(GLuint volume_texture);
+
+    // Mark the gradient as stale, call this when the contents of the current volume texture changed
+    void invalidate() { _dirty = true; }
+
+    bool is_valid() const { return _valid; }
+    GLuint texture() const { return _gradient_texture; }
+
+private:
+    void rebuild();
+
+    GLuint _volume_texture = 0;
+    glm::ivec3 _volume_dims = glm::ivec3(0);
+    bool _dirty = true;
+    bool _valid = false;
+
+    GLuint _gradient_texture = 0;
+    glm::ivec3 _gradient_dims = glm::ivec3(0);
+
+    GLuint _build_program = 0;
+    GLuint _build_framebuffer = 0;
+    GLuint _build_vao = 0;
+    struct {
+        GLint volume = -1;
+        GLint volume_dims = -1;
+        GLint layer = -1;
+    } _build_location;
+};
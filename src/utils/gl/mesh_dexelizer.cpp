@@ -0,0 +1,299 @@
+#include "mesh_dexelizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "utils/utils.h"
+#include "shader_cache.h"
+
+
+namespace {
+
+// Vertices are given in dexel units: x and y relative to the origin of the grid, z divided by the spacing
+constexpr const char* PEEL_VERTEX_SHADER = R"(
+#version 150
+in vec3 in_position;
+
+// Dexel of the lower left pixel and size of the tile
+uniform vec4 tile;
+// Range of z mapped to the depth range
+uniform vec2 z_range;
+
+out float z;
+
+void main() {
+    vec2 p = (in_position.xy - tile.xy) / tile.zw * 2.0 - 1.0;
+    float depth = (in_position.z - z_range.x) / (z_range.y - z_range.x) * 2.0 - 1.0;
+    z = in_position.z;
+    gl_Position = vec4(p, depth, 1.0);
+}
+)";
+
+// Keeps the fragments behind the previous layer, the depth test then keeps the nearest of them
+constexpr const char* PEEL_FRAGMENT_SHADER = R"(
+#version 150
+uniform sampler2D previous_depth;
+uniform bool first_layer;
+
+in float z;
+
+out float out_z;
+
+void main() {
+    if (!first_layer && gl_FragCoord.z <= texelFetch(previous_depth, ivec2(gl_FragCoord.xy), 0).r) {
+        discard;
+    }
+    out_z = z;
+}
+)";
+
+// Value of the pixels the layer did not reach
+constexpr float NO_CROSSING = std::numeric_limits<float>::max();
+
+} // namespace
+
+
+void MeshDexelizer::init() {
+    push_opengl_debug_group("Init MeshDexelizer");
+    create_cached_shader_program(PEEL_VERTEX_SHADER, PEEL_FRAGMENT_SHADER, {{"in_position", 0}}, _program);
+    _location.tile = glGetUniformLocation(_program, "tile");
+    _location.z_range = glGetUniformLocation(_program, "z_range");
+    _location.previous_depth = glGetUniformLocation(_program, "previous_depth");
+    _location.first_layer = glGetUniformLocation(_program, "first_layer");
+
+    glGenVertexArrays(1, &_vao);
+    glGenBuffers(1, &_vertex_buffer);
+    glGenBuffers(1, &_index_buffer);
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, false, 3 * sizeof(GLfloat), nullptr);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &_z_texture);
+    glBindTexture(GL_TEXTURE_2D, _z_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, TILE_SIZE, TILE_SIZE, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(2, _depth_textures);
+    for (GLuint texture : _depth_textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, TILE_SIZE, TILE_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _z_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenQueries(1, &_query);
+    pop_opengl_debug_group();
+}
+
+void MeshDexelizer::destroy() {
+    glDeleteProgram(_program);
+    glDeleteVertexArrays(1, &_vao);
+    glDeleteBuffers(1, &_vertex_buffer);
+    glDeleteBuffers(1, &_index_buffer);
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteTextures(1, &_z_texture);
+    glDeleteTextures(2, _depth_textures);
+    glDeleteQueries(1, &_query);
+    _program = 0;
+    _vao = 0;
+    _vertex_buffer = 0;
+    _index_buffer = 0;
+    _framebuffer = 0;
+    _z_texture = 0;
+    _depth_textures[0] = _depth_textures[1] = 0;
+    _query = 0;
+    _layers.clear();
+    _layers.shrink_to_fit();
+}
+
+bool MeshDexelizer::dexelize(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F, vor3d::CompressedVolume& dexels,
+                             std::shared_ptr<spdlog::logger> logger, int max_layers) {
+    if (V.cols() != 3 || F.cols() != 3) {
+        logger->error("Can only dexelize triangle meshes in 3D");
+        return false;
+    }
+    const Eigen::Vector2i grid_size = dexels.gridSize();
+    if (V.rows() == 0 || F.rows() == 0 || grid_size[0] <= 0 || grid_size[1] <= 0) {
+        vor3d::CompressedVolume::Builder builder(dexels);
+        dexels.assemble(builder);
+        return true;
+    }
+    push_opengl_debug_group("Dexelize Mesh");
+
+    // Convert to dexel units in double precision first, so large coordinates far from the grid origin keep
+    // their precision in the float vertex buffer
+    const double spacing = dexels.spacing();
+    const Eigen::Vector3d origin = dexels.origin();
+    std::vector<GLfloat> vertices(3 * V.rows());
+    double z_min = std::numeric_limits<double>::max(), z_max = std::numeric_limits<double>::lowest();
+    for (Eigen::Index i = 0; i < V.rows(); i++) {
+        vertices[3 * i + 0] = GLfloat((V(i, 0) - origin[0]) / spacing);
+        vertices[3 * i + 1] = GLfloat((V(i, 1) - origin[1]) / spacing);
+        vertices[3 * i + 2] = GLfloat(V(i, 2) / spacing);
+        z_min = std::min(z_min, V(i, 2) / spacing);
+        z_max = std::max(z_max, V(i, 2) / spacing);
+    }
+    std::vector<GLuint> indices(3 * F.rows());
+    for (Eigen::Index f = 0; f < F.rows(); f++) {
+        for (int c = 0; c < 3; c++) {
+            indices[3 * f + c] = GLuint(F(f, c));
+        }
+    }
+
+    // Drain earlier errors so an out of memory below is attributed correctly
+    while (glGetError() != GL_NO_ERROR) {}
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    if (glGetError() != GL_NO_ERROR) {
+        logger->error("Not enough GPU memory to dexelize a mesh of {} triangles", F.rows());
+        pop_opengl_debug_group();
+        return false;
+    }
+
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    GLint old_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+    const GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+    const GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean cull_face_enabled = glIsEnabled(GL_CULL_FACE);
+    GLint old_depth_func;
+    glGetIntegerv(GL_DEPTH_FUNC, &old_depth_func);
+    GLboolean old_depth_mask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &old_depth_mask);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    glUseProgram(_program);
+    // Keep the extreme crossings off the near and far planes
+    const float z_margin = float(std::max(1.0, 1e-3 * (z_max - z_min)));
+    glUniform2f(_location.z_range, float(z_min) - z_margin, float(z_max) + z_margin);
+    glUniform1i(_location.previous_depth, 0);
+
+    vor3d::CompressedVolume::Builder builder(dexels);
+    int num_layers = 0;
+    int num_odd_dexels = 0;
+    bool succeeded = true;
+    for (int y0 = 0; y0 < grid_size[1] && succeeded; y0 += TILE_SIZE) {
+        for (int x0 = 0; x0 < grid_size[0] && succeeded; x0 += TILE_SIZE) {
+            const int w = std::min(TILE_SIZE, grid_size[0] - x0);
+            const int h = std::min(TILE_SIZE, grid_size[1] - y0);
+            const int tile_layers = peel_tile(x0, y0, w, h, GLsizei(indices.size()), max_layers, builder, num_odd_dexels);
+            succeeded = tile_layers >= 0;
+            num_layers = std::max(num_layers, tile_layers);
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, old_framebuffer);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    if (blend_enabled) {
+        glEnable(GL_BLEND);
+    }
+    if (!depth_test_enabled) {
+        glDisable(GL_DEPTH_TEST);
+    }
+    if (cull_face_enabled) {
+        glEnable(GL_CULL_FACE);
+    }
+    glDepthFunc(old_depth_func);
+    glDepthMask(old_depth_mask);
+    pop_opengl_debug_group();
+
+    if (!succeeded) {
+        logger->error("Some dexels cross more than {} surfaces of the mesh, not dexelizing it", max_layers);
+        return false;
+    }
+    if (num_odd_dexels > 0) {
+        // Rays grazing a silhouette or crossing a hole of the mesh, their last crossing has no exit
+        logger->warn("Dropped the last crossing of {} dexels which cross the mesh an odd number of times", num_odd_dexels);
+    }
+    logger->debug("Dexelized {} triangles over {}x{} dexels in {} layers", F.rows(), grid_size[0], grid_size[1], num_layers);
+    dexels.assemble(builder);
+    return true;
+}
+
+int MeshDexelizer::peel_tile(int x0, int y0, int w, int h, GLsizei num_indices, int max_layers,
+                             vor3d::CompressedVolume::Builder& builder, int& num_odd_dexels) {
+    const size_t tile_pixels = size_t(w) * size_t(h);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glViewport(0, 0, w, h);
+    glUniform4f(_location.tile, float(x0), float(y0), float(w), float(h));
+    glBindVertexArray(_vao);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    int num_layers = 0;
+    for (;; num_layers++) {
+        GLuint depth_texture = _depth_textures[num_layers % 2];
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _depth_textures[(num_layers + 1) % 2]);
+        glUniform1i(_location.first_layer, num_layers == 0);
+
+        const GLfloat no_crossing[4] = { NO_CROSSING, 0.f, 0.f, 0.f };
+        glClearBufferfv(GL_COLOR, 0, no_crossing);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        glBeginQuery(GL_SAMPLES_PASSED, _query);
+        glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, nullptr);
+        glEndQuery(GL_SAMPLES_PASSED);
+        GLuint num_samples = 0;
+        glGetQueryObjectuiv(_query, GL_QUERY_RESULT, &num_samples);
+        if (num_samples == 0) {
+            break;
+        }
+        if (num_layers == max_layers) {
+            glBindVertexArray(0);
+            return -1;
+        }
+
+        _layers.resize((num_layers + 1) * tile_pixels);
+        glReadPixels(0, 0, w, h, GL_RED, GL_FLOAT, _layers.data() + num_layers * tile_pixels);
+    }
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+    glBindVertexArray(0);
+
+    // Row y of the layers is row y0 + y of the grid. The layers of a pixel end at its first missing crossing.
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const size_t pixel = size_t(y) * size_t(w) + size_t(x);
+            if (num_layers == 0 || _layers[pixel] == NO_CROSSING) {
+                continue;
+            }
+            std::vector<vor3d::Scalar>& ray = builder.ray(x0 + x, y0 + y);
+            for (int layer = 0; layer < num_layers; layer++) {
+                const float z = _layers[layer * tile_pixels + pixel];
+                if (z == NO_CROSSING) {
+                    break;
+                }
+                ray.push_back(vor3d::Scalar(z));
+            }
+            if (ray.size() % 2 != 0) {
+                ray.pop_back();
+                num_odd_dexels++;
+            }
+        }
+    }
+    return num_layers;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <vector>
+
+#include <vor3d/CompressedVolume.h>
+
+// Dexelizes triangle meshes on the GPU, the rasterized counterpart of vor3d::create_dexels.
+//
+// The mesh is drawn orthographically along z over the dexel grid, one pixel per dexel with the pixel centers on
+// the dexel centers, and its surfaces are peeled front to back: every pass keeps the nearest fragment behind the
+// depth of the previous pass, so pass k holds the k-th crossing of every dexel. The fill rules of the rasterizer
+// assign a ray through the edge between two abutting triangles to one of them, like the SOS tests of the ray
+// cast, and crossings at the same depth are peeled once. The passes stop once one draws no fragment, the layers
+// are then read back in front to back order, which is already the sorted order of the intersections.
+//
+// Grids larger than TILE_SIZE are peeled a tile at a time.
+class MeshDexelizer {
+public:
+    static constexpr int TILE_SIZE = 1024;
+    // Surfaces crossed by a single dexel before dexelize() gives up
+    static constexpr int DEFAULT_MAX_LAYERS = 64;
+
+    MeshDexelizer() = default;
+    MeshDexelizer(const MeshDexelizer&) = delete;
+    MeshDexelizer& operator=(const MeshDexelizer&) = delete;
+    ~MeshDexelizer() = default;
+
+    void init();
+    void destroy();
+
+    // Fill dexels, whose grid (origin, spacing and size) is already set, with the crossings of the closed triangle
+    // mesh (V, F) along z, in units of the spacing like create_dexels. Returns false if a dexel crosses more than
+    // max_layers surfaces or the GPU runs out of memory, dexels is left untouched then.
+    bool dexelize(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F, vor3d::CompressedVolume& dexels,
+                  std::shared_ptr<spdlog::logger> logger, int max_layers = DEFAULT_MAX_LAYERS);
+
+private:
+    // Peel the tile of the grid starting at dexel (x0, y0) into the builder, returns the number of layers or -1 if
+    // there are more than max_layers
+    int peel_tile(int x0, int y0, int w, int h, GLsizei num_indices, int max_layers,
+                  vor3d::CompressedVolume::Builder& builder, int& num_odd_dexels);
+
+    GLuint _program = 0;
+    struct {
+        GLint tile = -1;
+        GLint z_range = -1;
+        GLint previous_depth = -1;
+        GLint first_layer = -1;
+    } _location;
+
+    GLuint _vao = 0;
+    GLuint _vertex_buffer = 0;
+    GLuint _index_buffer = 0;
+
+    GLuint _framebuffer = 0;
+    GLuint _z_texture = 0;
+    // Depth of the current and of the previous layer, swapped after every pass
+    GLuint _depth_textures[2] = {};
+    GLuint _query = 0;
+
+    // z of every peeled layer of the current tile, layer after layer
+    std::vector<float> _layers;
+};
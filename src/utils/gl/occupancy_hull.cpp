@@ -0,0 +1,217 @@
+#include "occupancy_hull.h"
+
+#include "utils/parallel_for.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr std::uint32_t NO_FEATURE = ~std::uint32_t(0);
+
+// Stretched values a sample can be taken at around each value. Linear filtering blends a value with its
+// neighbors, and the opacity of the transfer function texture spreads by about a texel of the resampling.
+constexpr int VALUE_MARGIN = 2;
+
+// Highest opacity of the piecewise linear transfer function over [lo, hi]. It is reached at one of the ends or at
+// a node in between.
+float max_opacity(const std::vector<TfNode>& transfer_function, float lo, float hi) {
+    if (transfer_function.empty()) {
+        return 0.f;
+    }
+    auto opacity = [&](float t) {
+        if (t <= transfer_function.front().t) {
+            return transfer_function.front().rgba[3];
+        }
+        for (std::size_t i = 1; i < transfer_function.size(); i++) {
+            const TfNode& a = transfer_function[i - 1];
+            const TfNode& b = transfer_function[i];
+            if (t <= b.t) {
+                const float s = b.t > a.t ? (t - a.t) / (b.t - a.t) : 1.f;
+                return (1.f - s) * a.rgba[3] + s * b.rgba[3];
+            }
+        }
+        return transfer_function.back().rgba[3];
+    };
+    float result = std::max(opacity(lo), opacity(hi));
+    for (const TfNode& node : transfer_function) {
+        if (node.t > lo && node.t < hi) {
+            result = std::max(result, node.rgba[3]);
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+constexpr int OccupancyHull::BRICK_SIZE;
+
+
+void OccupancyHull::set_volume(const std::uint8_t* volume_data, const std::uint32_t* index_data,
+                               const glm::ivec3& dims, std::uint8_t min_value, std::uint8_t max_value) {
+    clear();
+    if (volume_data == nullptr || index_data == nullptr || dims.x <= 0 || dims.y <= 0 || dims.z <= 0) {
+        return;
+    }
+    _dims = dims;
+    _num_bricks = (dims + glm::ivec3(BRICK_SIZE - 1)) / BRICK_SIZE;
+    const std::size_t num_bricks = std::size_t(_num_bricks.x) * _num_bricks.y * _num_bricks.z;
+
+    // Same stretch as quantize_volume and FeaturePicker
+    std::array<std::uint8_t, 256> remap;
+    const double value_range = std::max(double(max_value) - double(min_value), 1.0);
+    for (int i = 0; i < 256; i++) {
+        const double v = std::min(std::max((i - double(min_value)) / value_range, 0.0), 1.0);
+        remap[i] = static_cast<std::uint8_t>(v * std::numeric_limits<std::uint8_t>::max());
+    }
+
+    _brick_ranges.assign(num_bricks, { { 255, 0 } });
+    std::vector<std::vector<std::uint32_t>> arcs(num_bricks);
+    parallel_for_chunks(num_bricks, [&](std::size_t begin, std::size_t end, std::size_t) {
+        std::vector<std::uint32_t> brick_arcs;
+        for (std::size_t b = begin; b < end; b++) {
+            const glm::ivec3 brick(int(b % _num_bricks.x), int(b / _num_bricks.x % _num_bricks.y),
+                                   int(b / _num_bricks.x / _num_bricks.y));
+            const glm::ivec3 lo = glm::max(brick * BRICK_SIZE - 1, glm::ivec3(0));
+            const glm::ivec3 hi = glm::min((brick + 1) * BRICK_SIZE + 1, dims);
+            std::array<std::uint8_t, 2>& range = _brick_ranges[b];
+            brick_arcs.clear();
+            for (int z = lo.z; z < hi.z; z++) {
+                for (int y = lo.y; y < hi.y; y++) {
+                    const std::size_t row = (std::size_t(z) * dims.y + y) * dims.x;
+                    for (int x = lo.x; x < hi.x; x++) {
+                        const std::uint8_t value = remap[volume_data[row + x]];
+                        range[0] = std::min(range[0], value);
+                        range[1] = std::max(range[1], value);
+                        // Arcs come in runs along a row, most repeats never reach the sort
+                        const std::uint32_t arc = index_data[row + x];
+                        if (brick_arcs.empty() || brick_arcs.back() != arc) {
+                            brick_arcs.push_back(arc);
+                        }
+                    }
+                }
+            }
+            std::sort(brick_arcs.begin(), brick_arcs.end());
+            brick_arcs.erase(std::unique(brick_arcs.begin(), brick_arcs.end()), brick_arcs.end());
+            arcs[b] = brick_arcs;
+        }
+    }, 64);
+
+    _arc_offsets.assign(num_bricks + 1, 0);
+    for (std::size_t b = 0; b < num_bricks; b++) {
+        _arc_offsets[b + 1] = _arc_offsets[b] + arcs[b].size();
+    }
+    _brick_arcs.resize(_arc_offsets.back());
+    parallel_for_chunks(num_bricks, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t b = begin; b < end; b++) {
+            std::copy(arcs[b].begin(), arcs[b].end(), _brick_arcs.begin() + _arc_offsets[b]);
+        }
+    }, 1 << 12);
+}
+
+void OccupancyHull::clear() {
+    _dims = glm::ivec3(0);
+    _num_bricks = glm::ivec3(0);
+    _brick_ranges.clear();
+    _arc_offsets.clear();
+    _brick_arcs.clear();
+    _num_visible_bricks = 0;
+    _vertices.clear();
+    _indices.clear();
+}
+
+void OccupancyHull::update(const std::uint32_t* contour_features, std::size_t num_features,
+                           const std::vector<bool>& shown_features, const std::vector<TfNode>& transfer_function,
+                           bool ignore_opacity) {
+    // Texel i of the contour texture is contour_features[i + 1], arcs past it belong to no feature
+    std::vector<std::uint8_t> arc_shown(num_features > 1 ? num_features - 1 : 0, 0);
+    for (std::size_t arc = 0; arc < arc_shown.size(); arc++) {
+        const std::uint32_t feature = contour_features[arc + 1];
+        arc_shown[arc] = feature != NO_FEATURE && std::size_t(feature) + 1 < shown_features.size() &&
+                         shown_features[std::size_t(feature) + 1];
+    }
+
+    // Prefix count of the stretched values around which the transfer function has any opacity
+    std::array<int, 257> opaque_prefix;
+    opaque_prefix[0] = 0;
+    for (int i = 0; i < 256; i++) {
+        const bool opaque = ignore_opacity ||
+                max_opacity(transfer_function, (i - VALUE_MARGIN) / 255.f, (i + VALUE_MARGIN) / 255.f) > 0.f;
+        opaque_prefix[i + 1] = opaque_prefix[i] + (opaque ? 1 : 0);
+    }
+
+    const std::size_t num_bricks = _brick_ranges.size();
+    std::vector<std::uint8_t> visible(num_bricks, 0);
+    parallel_for_chunks(num_bricks, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t b = begin; b < end; b++) {
+            const std::array<std::uint8_t, 2>& range = _brick_ranges[b];
+            if (range[0] > range[1] || opaque_prefix[range[1] + 1] - opaque_prefix[range[0]] == 0) {
+                continue;
+            }
+            for (std::size_t i = _arc_offsets[b]; i < _arc_offsets[b + 1]; i++) {
+                if (_brick_arcs[i] < arc_shown.size() && arc_shown[_brick_arcs[i]]) {
+                    visible[b] = 1;
+                    break;
+                }
+            }
+        }
+    }, 1 << 12);
+    _num_visible_bricks = std::size_t(std::count(visible.begin(), visible.end(), std::uint8_t(1)));
+    build_mesh(visible);
+}
+
+void OccupancyHull::build_mesh(const std::vector<std::uint8_t>& visible) {
+    _vertices.clear();
+    _indices.clear();
+    if (_num_visible_bricks == 0) {
+        return;
+    }
+
+    const glm::ivec3 num_corners = _num_bricks + 1;
+    std::vector<GLuint> corner_vertex(std::size_t(num_corners.x) * num_corners.y * num_corners.z,
+                                      std::numeric_limits<GLuint>::max());
+    auto vertex = [&](const glm::ivec3& corner) {
+        GLuint& index = corner_vertex[(std::size_t(corner.z) * num_corners.y + corner.y) * num_corners.x + corner.x];
+        if (index == std::numeric_limits<GLuint>::max()) {
+            index = GLuint(_vertices.size() / 3);
+            // The last bricks can be cut off by the end of the volume
+            const glm::vec3 position = glm::vec3(glm::min(corner * BRICK_SIZE, _dims)) / glm::vec3(_dims);
+            _vertices.insert(_vertices.end(), { position.x, position.y, position.z });
+        }
+        return index;
+    };
+    auto is_visible = [&](glm::ivec3 brick) {
+        if (glm::any(glm::lessThan(brick, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(brick, _num_bricks))) {
+            return false;
+        }
+        return visible[(std::size_t(brick.z) * _num_bricks.y + brick.y) * _num_bricks.x + brick.x] != 0;
+    };
+
+    // The face between brick - e_axis and brick wherever exactly one of them is visible
+    for (int axis = 0; axis < 3; axis++) {
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        glm::ivec3 e_axis(0), e_u(0), e_v(0);
+        e_axis[axis] = 1;
+        e_u[u] = 1;
+        e_v[v] = 1;
+        glm::ivec3 brick;
+        for (brick.z = 0; brick.z < _num_bricks.z + e_axis.z; brick.z++) {
+            for (brick.y = 0; brick.y < _num_bricks.y + e_axis.y; brick.y++) {
+                for (brick.x = 0; brick.x < _num_bricks.x + e_axis.x; brick.x++) {
+                    const bool behind = is_visible(brick - e_axis);
+                    if (behind == is_visible(brick)) {
+                        continue;
+                    }
+                    // e_u x e_v = e_axis, so the corners in this order face along +axis
+                    const GLuint c0 = vertex(brick), c1 = vertex(brick + e_u);
+                    const GLuint c2 = vertex(brick + e_u + e_v), c3 = vertex(brick + e_v);
+                    if (behind) {
+                        _indices.insert(_indices.end(), { c0, c1, c2, c0, c2, c3 });
+                    } else {
+                        _indices.insert(_indices.end(), { c0, c2, c1, c0, c3, c2 });
+                    }
+                }
+            }
+        }
+    }
+}
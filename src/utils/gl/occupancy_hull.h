@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transfer_function_texture.h"
+
+// Closed mesh around the bricks of the low resolution volume that can show anything in the selection screen, the
+// bounding geometry of SelectionRenderer. Its rays then enter and leave at the hull instead of the faces of the
+// volume box, so the empty space around the fish costs neither samples nor skips of the empty space grid.
+//
+// A brick of BRICK_SIZE^3 voxels is visible if one of its voxels is part of a shown feature and the transfer
+// function has some opacity in the range of its values. Both include a one voxel margin so that linear filtering
+// at the faces of the brick is covered, and the range is widened by the resampling of the transfer function
+// texture. The values and the arcs of every brick are gathered once per volume, so a new transfer function,
+// selection or segmentation only goes over the bricks.
+//
+// The hull consists of the faces between visible and hidden bricks. They are split at every vertex of the brick
+// lattice, so neighbouring faces share their edges and the hull does not crack when it is rasterized.
+class OccupancyHull {
+public:
+    static constexpr int BRICK_SIZE = 8;
+
+    OccupancyHull() = default;
+    OccupancyHull(const OccupancyHull&) = delete;
+    OccupancyHull& operator=(const OccupancyHull&) = delete;
+    ~OccupancyHull() = default;
+
+    // volume_data and index_data as for FeaturePicker::set_volume. They are only read by this call.
+    void set_volume(const std::uint8_t* volume_data, const std::uint32_t* index_data, const glm::ivec3& dims,
+                    std::uint8_t min_value, std::uint8_t max_value);
+    void clear();
+
+    // Rebuild the hull. contour_features is the buffer of SelectionRenderer::set_contour_data. Feature f is shown
+    // if shown_features[f + 1] is set, the numbering of the selection list and of the picking pass. With
+    // ignore_opacity, as when coloring by identifier, the transfer function does not hide any brick.
+    void update(const std::uint32_t* contour_features, std::size_t num_features,
+                const std::vector<bool>& shown_features, const std::vector<TfNode>& transfer_function,
+                bool ignore_opacity);
+
+    // Three coordinates per vertex in the texture coordinates of the volume, [0, 1]^3
+    const std::vector<GLfloat>& vertices() const { return _vertices; }
+    // Three vertices per triangle, counterclockwise seen from outside like the unit cube of SelectionRenderer
+    const std::vector<GLuint>& indices() const { return _indices; }
+
+    std::size_t num_bricks() const { return _brick_ranges.size(); }
+    std::size_t num_visible_bricks() const { return _num_visible_bricks; }
+
+private:
+    void build_mesh(const std::vector<std::uint8_t>& visible);
+
+    glm::ivec3 _dims = glm::ivec3(0);
+    glm::ivec3 _num_bricks = glm::ivec3(0);
+
+    // Lowest and highest stretched value of every brick and its margin
+    std::vector<std::array<std::uint8_t, 2>> _brick_ranges;
+    // The distinct arcs of brick b and its margin are at [_arc_offsets[b], _arc_offsets[b + 1])
+    std::vector<std::size_t> _arc_offsets;
+    std::vector<std::uint32_t> _brick_arcs;
+
+    std::size_t _num_visible_bricks = 0;
+    std::vector<GLfloat> _vertices;
+    std::vector<GLuint> _indices;
+};
@@ -0,0 +1,50 @@
+#include "pixel_footprint.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+const char* const PixelFootprint::GLSL = R"(
+layout(std140) uniform PixelFootprintBlock {
+  vec4 footprint_depth_plane;
+  float footprint_base;
+  float footprint_slope;
+};
+
+// Length of the step after the sample at pos: the width of a pixel at its depth, at least min_step
+float footprint_step(vec3 pos, float min_step) {
+    float depth = max(dot(footprint_depth_plane.xyz, pos) + footprint_depth_plane.w, 0.0);
+    return max(min_step, footprint_base + footprint_slope * depth);
+}
+
+// Mip level of the volume whose voxels are about as wide as step, min_step being the width of a full resolution
+// voxel. Sample with textureLod, the derivatives texture() needs are undefined inside the ray marching loop.
+float footprint_lod(float step, float min_step) {
+    return max(log2(step / min_step), 0.0);
+}
+)";
+
+PixelFootprint::Block PixelFootprint::block(const glm::mat4& model_view_matrix, const glm::mat4& proj_matrix,
+                                            int viewport_height, float scale) {
+    // Distance in front of the camera, the third row of the view space position negated
+    const glm::vec4 depth_plane = -glm::vec4(model_view_matrix[0][2], model_view_matrix[1][2],
+                                             model_view_matrix[2][2], model_view_matrix[3][2]);
+
+    // The footprint is measured along the axis the model view matrix stretches the most, so no axis of the
+    // volume is sampled at less than a step per pixel
+    const glm::mat3 linear(model_view_matrix);
+    const float view_scale = std::max({ glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2]),
+                                        1e-8f });
+    // Height of a pixel in view space, at unit depth with a perspective projection
+    const float pixel_size = 2.f / (std::max(std::abs(proj_matrix[1][1]), 1e-8f) *
+                                    float(std::max(viewport_height, 1)));
+    const float footprint = std::max(scale, 0.f) * pixel_size / view_scale;
+    const bool perspective = proj_matrix[2][3] != 0.f;
+
+    Block block;
+    block.depth_plane = depth_plane;
+    block.base = perspective ? 0.f : footprint;
+    block.slope = perspective ? footprint : 0.f;
+    block.padding[0] = block.padding[1] = 0.f;
+    return block;
+}
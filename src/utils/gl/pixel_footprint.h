@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+// Ray casting step from the size of a pixel on the screen. The renderers step at least one voxel at a time
+// (their step_size), but where a pixel covers several voxels, far from the camera or with the volume zoomed out,
+// samples closer than a pixel only average detail the pixel cannot show. The step then grows to the width the
+// pixel has at the depth of the sample, times a quality scale.
+//
+// Shaders include PixelFootprint::GLSL and call footprint_step(pos, min_step) for every sample, pos in the
+// coordinates the model matrix maps to world space. The opacity correction of the transfer function takes care
+// of the longer steps, and footprint_lod(step, min_step) picks the mip level of the volume matching them.
+class PixelFootprint {
+public:
+    // GLSL declarations of the uniform block BLOCK_NAME, footprint_step() and footprint_lod(). Insert this
+    // after the #version line.
+    static const char* const GLSL;
+    static constexpr const char* BLOCK_NAME = "PixelFootprintBlock";
+
+    // std140 layout of the uniform block, see UniformRing
+    struct Block {
+        glm::vec4 depth_plane;
+        float base;
+        float slope;
+        float padding[2];
+    };
+
+    // The block for a volume drawn with model_view_matrix and proj_matrix into a viewport viewport_height pixels
+    // high. Steps are scale pixels long, a scale of 0 always steps min_step.
+    static Block block(const glm::mat4& model_view_matrix, const glm::mat4& proj_matrix, int viewport_height,
+                       float scale);
+};
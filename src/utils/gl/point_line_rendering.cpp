@@ -1,267 +1,457 @@
 #include "point_line_rendering.h"
+#include "shader_cache.h"
 #include "utils/utils.h"
 
-#include <igl/opengl/create_shader_program.h>
-
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 
-constexpr const char* PolygonVertexShader = R"(
-#version 150
+// Inputs shared by both programs. Each polyline has 2 texels in the style buffer: its color, then its line
+// width and point size in pixels.
+#define POLYLINE_VERTEX_INPUTS R"(
 in vec3 in_position;
 in vec4 in_color;
-
-out vec4 color;
+in float in_polyline;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
-uniform vec4 global_color;
+uniform samplerBuffer styles;
+)"
+
+constexpr const char* LineVertexShader = "#version 150\n" POLYLINE_VERTEX_INPUTS R"(
+out vec4 vs_color;
+out float vs_half_width;
 
 void main() {
+    int polyline = int(in_polyline + 0.5);
     gl_Position = proj * view * model * vec4(in_position, 1.0);
-    color = in_color + global_color;
+    vs_color = in_color + texelFetch(styles, 2*polyline);
+    vs_half_width = 0.5 * texelFetch(styles, 2*polyline + 1).x;
 }
 )";
 
-constexpr const char* PolygonFragmentShader = R"(
+// Expand each segment into a quad of the line width in pixels. Segments crossing the near plane are clipped
+// first so their endpoints can be projected to the screen.
+constexpr const char* LineGeometryShader = R"(
 #version 150
+layout(lines) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+in vec4 vs_color[];
+in float vs_half_width[];
+
+uniform vec2 viewport_size;
+uniform bool antialias;
+
+out vec4 color;
+noperspective out float edge_distance;
+flat out float half_width;
+
+void main() {
+    vec4 p0 = gl_in[0].gl_Position;
+    vec4 p1 = gl_in[1].gl_Position;
+    float d0 = p0.z + p0.w;
+    float d1 = p1.z + p1.w;
+    if (d0 < 0.0 && d1 < 0.0) {
+        return;
+    }
+    if (d0 < 0.0) {
+        p0 = mix(p0, p1, d0 / (d0 - d1));
+    } else if (d1 < 0.0) {
+        p1 = mix(p1, p0, d1 / (d1 - d0));
+    }
+
+    vec2 s0 = 0.5 * viewport_size * p0.xy / p0.w;
+    vec2 s1 = 0.5 * viewport_size * p1.xy / p1.w;
+    vec2 dir = s1 - s0;
+    dir = length(dir) > 1e-6 ? normalize(dir) : vec2(1.0, 0.0);
+    vec2 normal = vec2(-dir.y, dir.x);
+
+    // Leave a pixel on each side for the antialiased edge
+    half_width = vs_half_width[0];
+    float expand = half_width + (antialias ? 1.0 : 0.0);
+    vec2 offset = normal * expand / (0.5 * viewport_size);
+
+    color = vs_color[0]; edge_distance = expand;
+    gl_Position = vec4(p0.xy + offset * p0.w, p0.zw); EmitVertex();
+    color = vs_color[0]; edge_distance = -expand;
+    gl_Position = vec4(p0.xy - offset * p0.w, p0.zw); EmitVertex();
+    color = vs_color[1]; edge_distance = expand;
+    gl_Position = vec4(p1.xy + offset * p1.w, p1.zw); EmitVertex();
+    color = vs_color[1]; edge_distance = -expand;
+    gl_Position = vec4(p1.xy - offset * p1.w, p1.zw); EmitVertex();
+    EndPrimitive();
+}
+)";
 
+constexpr const char* LineFragmentShader = R"(
+#version 150
 in vec4 color;
+noperspective in float edge_distance;
+flat in float half_width;
+
+uniform bool antialias;
+
 out vec4 fragcolor;
 
 void main() {
-  fragcolor = color;
+    float coverage = antialias ? clamp(half_width + 0.5 - abs(edge_distance), 0.0, 1.0) : 1.0;
+    fragcolor = vec4(color.rgb, color.a * coverage);
 }
 )";
 
-void PointLineRenderer::init() {
-    igl::opengl::create_shader_program(PolygonVertexShader,
-                                       PolygonFragmentShader,
-                                       {{ "in_position", 0}, {"in_color", 1}},
-                                       _gl_state.program);
-    _gl_state.uniform_location.global_color = glGetUniformLocation(_gl_state.program, "global_color");
-    _gl_state.uniform_location.model = glGetUniformLocation(_gl_state.program, "model");
-    _gl_state.uniform_location.view = glGetUniformLocation(_gl_state.program, "view");
-    _gl_state.uniform_location.proj = glGetUniformLocation(_gl_state.program, "proj");
+constexpr const char* PointVertexShader = "#version 150\n" POLYLINE_VERTEX_INPUTS R"(
+out vec4 color;
+
+void main() {
+    int polyline = int(in_polyline + 0.5);
+    gl_Position = proj * view * model * vec4(in_position, 1.0);
+    gl_PointSize = texelFetch(styles, 2*polyline + 1).y;
+    color = in_color + texelFetch(styles, 2*polyline);
 }
+)";
 
-void PointLineRenderer::destroy() {
-    glDeleteProgram(_gl_state.program);
+constexpr const char* PointFragmentShader = R"(
+#version 150
+
+in vec4 color;
+out vec4 fragcolor;
+
+void main() {
+  fragcolor = color;
+}
+)";
 
-    std::vector<GLuint> buffers;
-    std::vector<GLuint> vertex_arrays;
+#undef POLYLINE_VERTEX_INPUTS
 
-    for (int i = 0; i < _polylines.size(); i++) {
-        buffers.push_back(_polylines[i].pos_vbo);
-        buffers.push_back(_polylines[i].clr_vbo);
-        vertex_arrays.push_back(_polylines[i].vao);
-    }
+namespace {
+
+// Per vertex color of the polylines drawn with a single color. The color of a vertex is its own plus the
+// one of its polyline.
+const glm::vec4 NoVertexColor = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+} // namespace
 
-    glDeleteBuffers(buffers.size(), buffers.data());
-    glDeleteVertexArrays(vertex_arrays.size(), vertex_arrays.data());
+
+void PointLineRenderer::init() {
+    const std::map<std::string, GLuint> attributes = {{ "in_position", 0}, {"in_color", 1}, {"in_polyline", 2}};
+    create_cached_shader_program(LineGeometryShader, LineVertexShader, LineFragmentShader, attributes,
+                                 _gl_state.line_program);
+    create_cached_shader_program(PointVertexShader, PointFragmentShader, attributes, _gl_state.point_program);
+
+    auto locate_uniforms = [](GLuint program, decltype(_gl_state.line_uniform_location)& location) {
+        location.model = glGetUniformLocation(program, "model");
+        location.view = glGetUniformLocation(program, "view");
+        location.proj = glGetUniformLocation(program, "proj");
+        location.styles = glGetUniformLocation(program, "styles");
+        location.viewport_size = glGetUniformLocation(program, "viewport_size");
+        location.antialias = glGetUniformLocation(program, "antialias");
+    };
+    locate_uniforms(_gl_state.line_program, _gl_state.line_uniform_location);
+    locate_uniforms(_gl_state.point_program, _gl_state.point_uniform_location);
+
+    glGenVertexArrays(1, &_gl_state.vao);
+    _gl_state.vao_buffer = 0;
+
+    glGenBuffers(1, &_gl_state.style_buffer);
+    glGenTextures(1, &_gl_state.style_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, _gl_state.style_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * 2, nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, _gl_state.style_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _gl_state.style_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void PointLineRenderer::destroy() {
+    glDeleteProgram(_gl_state.line_program);
+    glDeleteProgram(_gl_state.point_program);
+    glDeleteVertexArrays(1, &_gl_state.vao);
+    glDeleteTextures(1, &_gl_state.style_texture);
+    glDeleteBuffers(1, &_gl_state.style_buffer);
+    _gl_state.vao = 0;
+    _gl_state.vao_buffer = 0;
+
+    _vertices.destroy();
+    _vertices.resize(0);
+    _num_packed_vertices = 0;
+    _num_unused_vertices = 0;
 
     _polylines.clear();
     _free_list.clear();
 }
 
 
-bool PointLineRenderer::update_polyline_3d(int polyline_id, GLfloat* vertices, GLfloat* colors, GLsizei num_vertices, PolylineStyle style) {
-    push_opengl_debug_group("update_polyline_3d");
-    if (polyline_id >= _polylines.size() || polyline_id < 0) {
-        return false;
+bool PointLineRenderer::is_valid(int polyline_id) const {
+    return polyline_id >= 0 && polyline_id < int(_polylines.size()) && _polylines[polyline_id].in_use;
+}
+
+int PointLineRenderer::new_polyline() {
+    int polyline_id;
+    if (_free_list.size() > 0) {
+        polyline_id = _free_list[_free_list.size()-1];
+        _free_list.pop_back();
+    } else {
+        polyline_id = _polylines.size();
+        _polylines.push_back(Polyline());
     }
 
-    Polyline& polyline = _polylines[polyline_id];
+    _polylines[polyline_id] = Polyline();
+    _polylines[polyline_id].in_use = true;
+    _polylines[polyline_id].global_color = glm::vec4(0.0);
+    return polyline_id;
+}
 
-    if (polyline.vao == 0) {
-        return false;
+void PointLineRenderer::reserve(Polyline& polyline, int polyline_id, GLsizei num_vertices) {
+    if (num_vertices <= polyline.capacity) {
+        return;
+    }
+
+    // Move the polyline to the end of the buffer with room to grow, keeping its vertices
+    const std::vector<GLfloat>& data = _vertices.data();
+    const std::vector<GLfloat> old_vertices(data.begin() + polyline.first * FLOATS_PER_VERTEX,
+                                            data.begin() + (polyline.first + GLint(polyline.num_vertices)) * FLOATS_PER_VERTEX);
+    _num_unused_vertices += polyline.capacity;
+    polyline.first = _num_packed_vertices;
+    polyline.capacity = std::max(num_vertices, polyline.capacity * 2);
+    _num_packed_vertices += polyline.capacity;
+    _vertices.resize(std::size_t(_num_packed_vertices) * FLOATS_PER_VERTEX);
+    _vertices.write(std::size_t(polyline.first) * FLOATS_PER_VERTEX, old_vertices.data(), old_vertices.size());
+
+    if (_num_unused_vertices > _num_packed_vertices / 2) {
+        repack();
     }
+}
 
-    GLsizei num_vertices_bytes = sizeof(GLfloat)*num_vertices*3;
-    GLsizei num_colors_bytes = sizeof(GLfloat)*num_vertices*4;
+void PointLineRenderer::repack() {
+    const std::vector<GLfloat>& data = _vertices.data();
+    std::vector<GLfloat> packed;
+    packed.reserve(std::size_t(_num_packed_vertices - _num_unused_vertices) * FLOATS_PER_VERTEX);
+    for (Polyline& polyline : _polylines) {
+        if (!polyline.in_use) {
+            continue;
+        }
+        const GLint first = GLint(packed.size() / FLOATS_PER_VERTEX);
+        packed.insert(packed.end(), data.begin() + polyline.first * FLOATS_PER_VERTEX,
+                      data.begin() + (polyline.first + polyline.capacity) * FLOATS_PER_VERTEX);
+        polyline.first = first;
+    }
 
-    polyline.style = style;
-    polyline.num_vertices = num_vertices;
+    _num_packed_vertices = GLint(packed.size() / FLOATS_PER_VERTEX);
+    _num_unused_vertices = 0;
+    _vertices.resize(packed.size());
+    _vertices.write(0, packed.data(), packed.size());
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.pos_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices_bytes, vertices, GL_STATIC_DRAW);
+void PointLineRenderer::write_vertices(const Polyline& polyline, int polyline_id, const GLfloat* vertices,
+                                       const GLfloat* colors, GLsizei first, GLsizei count) {
+    if (count <= 0) {
+        return;
+    }
+
+    std::vector<GLfloat> packed(std::size_t(count) * FLOATS_PER_VERTEX);
+    for (GLsizei i = 0; i < count; i++) {
+        GLfloat* v = &packed[std::size_t(i) * FLOATS_PER_VERTEX];
+        for (int j = 0; j < 3; j++) {
+            v[j] = vertices != nullptr ? vertices[3*i + j] : 0.0f;
+        }
+        for (int j = 0; j < 4; j++) {
+            v[3 + j] = colors != nullptr ? colors[4*i + j] : NoVertexColor[j];
+        }
+        v[7] = GLfloat(polyline_id);
+    }
+    _vertices.write(std::size_t(polyline.first + first) * FLOATS_PER_VERTEX, packed.data(), packed.size());
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.clr_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_colors_bytes, colors, GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+bool PointLineRenderer::update_polyline_3d(int polyline_id, GLfloat* vertices, GLfloat* colors, GLsizei num_vertices, PolylineStyle style) {
+    if (!is_valid(polyline_id)) {
+        return false;
+    }
 
-    pop_opengl_debug_group();
+    Polyline& polyline = _polylines[polyline_id];
+    reserve(polyline, polyline_id, num_vertices);
+    polyline.style = style;
+    polyline.num_vertices = num_vertices;
+    write_vertices(polyline, polyline_id, vertices, colors, 0, num_vertices);
     return true;
 }
 
 bool PointLineRenderer::update_polyline_3d(int polyline_id, GLfloat* vertices, glm::vec4 color, GLsizei num_vertices, PolylineStyle style) {
-    push_opengl_debug_group("update_polyline_3d");
-    if (polyline_id >= _polylines.size() || polyline_id < 0) {
+    if (!is_valid(polyline_id)) {
         return false;
     }
 
     Polyline& polyline = _polylines[polyline_id];
+    reserve(polyline, polyline_id, num_vertices);
+    polyline.style = style;
+    polyline.num_vertices = num_vertices;
+    polyline.global_color = color;
+    write_vertices(polyline, polyline_id, vertices, nullptr, 0, num_vertices);
+    return true;
+}
 
-    if (polyline.vao == 0) {
+bool PointLineRenderer::resize_polyline_3d(int polyline_id, glm::vec4 color, GLsizei num_vertices, PolylineStyle style) {
+    if (!is_valid(polyline_id)) {
         return false;
     }
 
-    GLsizei num_vertices_bytes = sizeof(GLfloat)*num_vertices*3;
-
+    Polyline& polyline = _polylines[polyline_id];
+    const GLsizei old_num_vertices = GLsizei(polyline.num_vertices);
+    reserve(polyline, polyline_id, num_vertices);
     polyline.style = style;
     polyline.num_vertices = num_vertices;
     polyline.global_color = color;
-
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.pos_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices_bytes, vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glBindVertexArray(polyline.vao);
-    glDisableVertexAttribArray(1);
-    glBindVertexArray(0);
-
-    pop_opengl_debug_group();
+    // New vertices start out at the origin
+    write_vertices(polyline, polyline_id, nullptr, nullptr, old_num_vertices, num_vertices - old_num_vertices);
     return true;
 }
 
+bool PointLineRenderer::update_polyline_3d_range(int polyline_id, const GLfloat* vertices, GLsizei first, GLsizei count) {
+    if (!is_valid(polyline_id)) {
+        return false;
+    }
 
-int PointLineRenderer::add_polyline_3d(GLfloat* vertices, GLfloat* colors, GLsizei num_vertices, PolylineStyle style) {
-    push_opengl_debug_group("add_polyline_3d");
-
-    Polyline polyline;
-
-    glGenVertexArrays(1, &polyline.vao);
-    glBindVertexArray(polyline.vao);
-
-    GLsizei num_vertices_bytes = sizeof(GLfloat)*num_vertices*3;
-    GLsizei num_colors_bytes = sizeof(GLfloat)*num_vertices*4;
-
-    glGenBuffers(1, &polyline.pos_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.pos_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices_bytes, vertices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-
-    glGenBuffers(1, &polyline.clr_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.clr_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_colors_bytes, colors, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*4, nullptr);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-
-    polyline.global_color = glm::vec4(0.0);
-    polyline.style = style;
-    polyline.num_vertices = num_vertices;
+    const Polyline& polyline = _polylines[polyline_id];
+    if (first < 0 || count < 0 || std::size_t(first + count) > polyline.num_vertices) {
+        return false;
+    }
 
-    int polyline_id;
-    if (_free_list.size() > 0) {
-        polyline_id = _free_list[_free_list.size()-1];
-        _free_list.pop_back();
-        _polylines[polyline_id] = polyline;
-    } else {
-        polyline_id = _polylines.size();
-        _polylines.push_back(polyline);
+    // Only the positions change, the colors and polyline index are kept
+    const std::size_t begin = std::size_t(polyline.first + first) * FLOATS_PER_VERTEX;
+    std::vector<GLfloat> packed(_vertices.data().begin() + begin,
+                                _vertices.data().begin() + begin + std::size_t(count) * FLOATS_PER_VERTEX);
+    for (GLsizei i = 0; i < count; i++) {
+        for (int j = 0; j < 3; j++) {
+            packed[std::size_t(i) * FLOATS_PER_VERTEX + j] = vertices[3*i + j];
+        }
     }
+    _vertices.write(begin, packed.data(), packed.size());
+    return true;
+}
 
-    pop_opengl_debug_group();
 
+int PointLineRenderer::add_polyline_3d(GLfloat* vertices, GLfloat* colors, GLsizei num_vertices, PolylineStyle style) {
+    const int polyline_id = new_polyline();
+    update_polyline_3d(polyline_id, vertices, colors, num_vertices, style);
     return polyline_id;
 }
 
 int PointLineRenderer::add_polyline_3d(GLfloat* vertices, glm::vec4 color, GLsizei num_vertices, PolylineStyle style) {
-    push_opengl_debug_group("add_polyline_3d");
-
-    Polyline polyline;
-
-    glGenVertexArrays(1, &polyline.vao);
-    glBindVertexArray(polyline.vao);
-
-    GLsizei num_vertices_bytes = sizeof(GLfloat)*num_vertices*3;
-    GLsizei num_colors_bytes = sizeof(GLfloat)*num_vertices*4;
-
-    glGenBuffers(1, &polyline.pos_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, polyline.pos_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices_bytes, vertices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-
-    polyline.global_color = color;
-    polyline.style = style;
-    polyline.num_vertices = num_vertices;
+    const int polyline_id = new_polyline();
+    update_polyline_3d(polyline_id, vertices, color, num_vertices, style);
+    return polyline_id;
+}
 
-    int polyline_id;
-    if (_free_list.size() > 0) {
-        polyline_id = _free_list[_free_list.size()-1];
-        _free_list.pop_back();
-        _polylines[polyline_id] = polyline;
-    } else {
-        polyline_id = _polylines.size();
-        _polylines.push_back(polyline);
+bool PointLineRenderer::delete_polyline(int polyline_id) {
+    if (!is_valid(polyline_id)) {
+        return false;
     }
 
-    pop_opengl_debug_group();
-
-    return polyline_id;
+    Polyline& polyline = _polylines[polyline_id];
+    _num_unused_vertices += polyline.capacity;
+    polyline = Polyline();
+    _free_list.push_back(polyline_id);
+    return true;
 }
 
 
 void PointLineRenderer::draw(glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix) {
-    GLfloat old_line_width, old_point_size;
-    GLboolean old_line_smooth;
-    glGetFloatv(GL_LINE_WIDTH, &old_line_width);
-    glGetFloatv(GL_POINT_SIZE, &old_point_size);
-    glGetBooleanv(GL_LINE_SMOOTH, &old_line_smooth);
-
-    if (_line_antialiasing_enabled) {
-        glEnable(GL_LINE_SMOOTH);
-    } else {
-        glDisable(GL_LINE_SMOOTH);
-    }
-
-    glUseProgram(_gl_state.program);
-
-    glUniformMatrix4fv(_gl_state.uniform_location.model, 1, GL_FALSE, glm::value_ptr(model_matrix));
-    glUniformMatrix4fv(_gl_state.uniform_location.view, 1, GL_FALSE, glm::value_ptr(view_matrix));
-    glUniformMatrix4fv(_gl_state.uniform_location.proj, 1, GL_FALSE, glm::value_ptr(proj_matrix));
+    enum { Lines, LineStrip, LineLoop, Points, NumBatches };
+    const GLenum batch_primitive[NumBatches] = { GL_LINES, GL_LINE_STRIP, GL_LINE_LOOP, GL_POINTS };
+    std::vector<GLint> firsts[NumBatches];
+    std::vector<GLsizei> counts[NumBatches];
 
+    std::vector<glm::vec4> styles(2 * std::max<std::size_t>(_polylines.size(), 1), glm::vec4(0.0f));
     for (int i = 0; i < _polylines.size(); i++) {
-        Polyline polyline = _polylines[i];
-
-        if (polyline.vao == 0) { continue; }
+        const Polyline& polyline = _polylines[i];
+        if (!polyline.in_use || polyline.num_vertices == 0) { continue; }
+
+        styles[2*i] = polyline.global_color;
+        styles[2*i + 1] = glm::vec4(polyline.style.line_width, polyline.style.point_size, 0.0f, 0.0f);
+
+        int batch;
+        switch (polyline.style.primitive) {
+        case LINES: batch = Lines; break;
+        case LINE_STRIP: batch = LineStrip; break;
+        case LINE_LOOP: batch = LineLoop; break;
+        default: batch = Points; break;
+        }
+        firsts[batch].push_back(polyline.first);
+        counts[batch].push_back(GLsizei(polyline.num_vertices));
+        if (batch != Points && polyline.style.render_points) {
+            firsts[Points].push_back(polyline.first);
+            counts[Points].push_back(GLsizei(polyline.num_vertices));
+        }
+    }
 
-        GLenum primitive_type = polyline.style.primitive;
-        glLineWidth(polyline.style.line_width);
-        glPointSize(polyline.style.point_size);
+    push_opengl_debug_group("PointLineRenderer::draw");
 
-        glBindVertexArray(polyline.vao);
-        glUniform4fv(_gl_state.uniform_location.global_color, 1, glm::value_ptr(polyline.global_color));
+    // The current segment of the vertex buffer starts at base
+    const GLint base = GLint(_vertices.commit() / FLOATS_PER_VERTEX);
+    for (std::vector<GLint>& batch_firsts : firsts) {
+        for (GLint& first : batch_firsts) { first += base; }
+    }
 
-        glDrawArrays(primitive_type, 0, polyline.num_vertices);
+    glBindVertexArray(_gl_state.vao);
+    if (_gl_state.vao_buffer != _vertices.buffer()) {
+        _gl_state.vao_buffer = _vertices.buffer();
+        glBindBuffer(GL_ARRAY_BUFFER, _gl_state.vao_buffer);
+        const GLsizei stride = sizeof(GLfloat) * FLOATS_PER_VERTEX;
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(sizeof(GLfloat) * 3));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(sizeof(GLfloat) * 7));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 
-        if (primitive_type != PointLineRenderer::POINTS && polyline.style.render_points) {
-            glDrawArrays(GL_POINTS, 0, polyline.num_vertices);
+    glBindBuffer(GL_TEXTURE_BUFFER, _gl_state.style_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * styles.size(), styles.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, _gl_state.style_texture);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    auto set_uniforms = [&](GLuint program, const decltype(_gl_state.line_uniform_location)& location) {
+        glUseProgram(program);
+        glUniformMatrix4fv(location.model, 1, GL_FALSE, glm::value_ptr(model_matrix));
+        glUniformMatrix4fv(location.view, 1, GL_FALSE, glm::value_ptr(view_matrix));
+        glUniformMatrix4fv(location.proj, 1, GL_FALSE, glm::value_ptr(proj_matrix));
+        glUniform1i(location.styles, 0);
+        glUniform2f(location.viewport_size, GLfloat(viewport[2]), GLfloat(viewport[3]));
+        glUniform1i(location.antialias, _line_antialiasing_enabled ? 1 : 0);
+    };
+
+    if (!counts[Lines].empty() || !counts[LineStrip].empty() || !counts[LineLoop].empty()) {
+        set_uniforms(_gl_state.line_program, _gl_state.line_uniform_location);
+        for (int batch = Lines; batch <= LineLoop; batch++) {
+            if (!counts[batch].empty()) {
+                glMultiDrawArrays(batch_primitive[batch], firsts[batch].data(), counts[batch].data(), GLsizei(counts[batch].size()));
+            }
         }
     }
 
-    if (old_line_smooth) {
-        glEnable(GL_LINE_SMOOTH);
-    } else {
-        glDisable(GL_LINE_SMOOTH);
+    if (!counts[Points].empty()) {
+        const GLboolean old_program_point_size = glIsEnabled(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        set_uniforms(_gl_state.point_program, _gl_state.point_uniform_location);
+        glMultiDrawArrays(GL_POINTS, firsts[Points].data(), counts[Points].data(), GLsizei(counts[Points].size()));
+        if (!old_program_point_size) {
+            glDisable(GL_PROGRAM_POINT_SIZE);
+        }
     }
-    glLineWidth(old_line_width);
-    glPointSize(old_point_size);
+
+    _vertices.fence();
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
     glBindVertexArray(0);
     glUseProgram(0);
+    pop_opengl_debug_group();
 }
@@ -6,7 +6,14 @@
 
 #include <glm/glm.hpp>
 
+#include "streaming_vertex_buffer.h"
 
+
+// Draws a set of polylines in a single batch. The vertices of all the polylines are packed into one
+// StreamingVertexBuffer, each with the index of its polyline, whose style (color, line width and point size)
+// is read from a texture buffer. draw() then issues one glMultiDrawArrays per primitive type, so the number of
+// draw calls does not depend on the number of polylines. Lines are expanded into screen space quads by a
+// geometry shader, since core profiles only support 1 pixel wide GL lines.
 class PointLineRenderer {
 public:
     enum LineSpec {
@@ -24,32 +31,54 @@ public:
     };
 
     struct Polyline {
-        GLuint pos_vbo;
-        GLuint clr_vbo;
-        GLuint vao;
+        // Vertices [first, first + capacity) of the packed buffer belong to this polyline
+        GLint first = 0;
+        GLsizei capacity = 0;
+        bool in_use = false;
 
         glm::vec4 global_color;
 
         PolylineStyle style;
-        size_t num_vertices;
+        size_t num_vertices = 0;
     };
 
 private:
+    // Position, color and polyline index of each vertex
+    static constexpr int FLOATS_PER_VERTEX = 8;
+
     struct {
-        GLuint program;
+        GLuint line_program;
+        GLuint point_program;
+        GLuint vao = 0;
+        GLuint vao_buffer = 0;
+        GLuint style_buffer = 0;
+        GLuint style_texture = 0;
 
         struct {
             GLint model;
             GLint view;
             GLint proj;
-            GLint global_color;
-        } uniform_location;
+            GLint styles;
+            GLint viewport_size;
+            GLint antialias;
+        } line_uniform_location, point_uniform_location;
     } _gl_state;
 
     bool _line_antialiasing_enabled = true;
     std::vector<Polyline> _polylines;
     std::vector<int> _free_list;
 
+    StreamingVertexBuffer _vertices;
+    GLint _num_packed_vertices = 0;
+    GLint _num_unused_vertices = 0;
+
+    int new_polyline();
+    bool is_valid(int polyline_id) const;
+    void reserve(Polyline& polyline, int polyline_id, GLsizei num_vertices);
+    void write_vertices(const Polyline& polyline, int polyline_id, const GLfloat* vertices, const GLfloat* colors,
+                        GLsizei first, GLsizei count);
+    void repack();
+
 public:
     void init();
     void destroy();
@@ -61,10 +90,14 @@ public:
     bool update_polyline_3d(int polyline_id, GLfloat* vertices, GLfloat* colors, GLsizei num_vertices, PolylineStyle style);
     bool update_polyline_3d(int polyline_id, GLfloat* vertices, glm::vec4 color, GLsizei num_vertices, PolylineStyle style);
 
+    // Change the number of vertices and the style of a polyline without touching its first vertices, for
+    // callers which then only rewrite the parts that changed with update_polyline_3d_range
+    bool resize_polyline_3d(int polyline_id, glm::vec4 color, GLsizei num_vertices, PolylineStyle style);
+    // Overwrite the positions of the vertices [first, first + count) of a polyline
+    bool update_polyline_3d_range(int polyline_id, const GLfloat* vertices, GLsizei first, GLsizei count);
+
     bool delete_polyline(int polyline_id);
 
-    void draw(int polyline_id, glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix);
-    void draw(int* polyline_ids, std::size_t num_polylines, glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix);
     void draw(glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix);
 };
 
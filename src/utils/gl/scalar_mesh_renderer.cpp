@@ -0,0 +1,270 @@
+#include "scalar_mesh_renderer.h"
+#include "shader_cache.h"
+#include "utils/memory_tracker.h"
+#include "utils/utils.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <igl/colormap.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+constexpr const char* ScalarMeshVertexShader = R"(
+#version 150
+in vec4 in_position;
+in float in_scalar;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+uniform vec3 box_min;
+uniform vec3 box_extent;
+uniform vec2 scalar_range;
+
+out vec3 position_eye;
+out float colormap_coord;
+
+void main() {
+    vec4 position_eye4 = view * model * vec4(box_min + in_position.xyz * box_extent, 1.0);
+    position_eye = position_eye4.xyz;
+    gl_Position = proj * position_eye4;
+    float range = scalar_range.y - scalar_range.x;
+    colormap_coord = range > 0.0 ? clamp((in_scalar - scalar_range.x) / range, 0.0, 1.0) : 0.0;
+}
+)";
+
+// The faces are flat, so their normal is the same for every fragment and follows from the derivatives of the
+// position, which is what saves the per corner normals of igl::opengl::ViewerData
+constexpr const char* ScalarMeshFragmentShader = R"(
+#version 150
+in vec3 position_eye;
+in float colormap_coord;
+
+uniform vec3 light_position;
+uniform bool use_scalars;
+uniform bool shade;
+uniform vec4 color;
+uniform sampler1D colormap;
+
+out vec4 fragcolor;
+
+void main() {
+    vec4 base = use_scalars ? vec4(texture(colormap, colormap_coord).rgb, color.a) : color;
+    if (!shade) {
+        fragcolor = base;
+        return;
+    }
+    vec3 n = normalize(cross(dFdx(position_eye), dFdy(position_eye)));
+    vec3 l = normalize(light_position - position_eye);
+    vec3 v = normalize(-position_eye);
+    // Light both sides, the boundary of the tet mesh is seen from inside when the camera is in it
+    if (dot(n, v) < 0.0) {
+        n = -n;
+    }
+    float diffuse = max(dot(n, l), 0.0);
+    float specular = pow(max(dot(reflect(-l, n), v), 0.0), 35.0);
+    fragcolor = vec4(base.rgb * (0.3 + 0.7 * diffuse) + vec3(0.2 * specular), base.a);
+}
+)";
+
+namespace {
+
+// Name the vertex and index buffers are reported under to memory_tracker()
+const char* MEMORY_NAME = "Tet surface mesh";
+
+// Texels of the colormap texture
+constexpr int COLORMAP_SIZE = 256;
+
+constexpr double QUANTIZED_MAX = 65535.0;
+
+} // namespace
+
+
+void ScalarMeshRenderer::init() {
+    const std::map<std::string, GLuint> attributes = {{ "in_position", 0 }, { "in_scalar", 1 }};
+    create_cached_shader_program(ScalarMeshVertexShader, ScalarMeshFragmentShader, attributes, _gl_state.program);
+
+    GLuint program = _gl_state.program;
+    _gl_state.uniform_location.model = glGetUniformLocation(program, "model");
+    _gl_state.uniform_location.view = glGetUniformLocation(program, "view");
+    _gl_state.uniform_location.proj = glGetUniformLocation(program, "proj");
+    _gl_state.uniform_location.light_position = glGetUniformLocation(program, "light_position");
+    _gl_state.uniform_location.box_min = glGetUniformLocation(program, "box_min");
+    _gl_state.uniform_location.box_extent = glGetUniformLocation(program, "box_extent");
+    _gl_state.uniform_location.scalar_range = glGetUniformLocation(program, "scalar_range");
+    _gl_state.uniform_location.use_scalars = glGetUniformLocation(program, "use_scalars");
+    _gl_state.uniform_location.shade = glGetUniformLocation(program, "shade");
+    _gl_state.uniform_location.color = glGetUniformLocation(program, "color");
+    _gl_state.uniform_location.colormap = glGetUniformLocation(program, "colormap");
+
+    glGenVertexArrays(1, &_gl_state.vao);
+    glGenBuffers(1, &_gl_state.position_buffer);
+    glGenBuffers(1, &_gl_state.scalar_buffer);
+    glGenBuffers(1, &_gl_state.index_buffer);
+
+    glBindVertexArray(_gl_state.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.position_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(std::uint16_t), nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.scalar_buffer);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(GLfloat), nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _gl_state.index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The same map igl::colormap gives the CPU side
+    std::vector<GLfloat> colormap(3 * COLORMAP_SIZE);
+    for (int i = 0; i < COLORMAP_SIZE; i++) {
+        igl::colormap(igl::COLOR_MAP_TYPE_PARULA, GLfloat(i) / GLfloat(COLORMAP_SIZE - 1), &colormap[3 * i]);
+    }
+    glGenTextures(1, &_gl_state.colormap_texture);
+    glBindTexture(GL_TEXTURE_1D, _gl_state.colormap_texture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, COLORMAP_SIZE, 0, GL_RGB, GL_FLOAT, colormap.data());
+    glBindTexture(GL_TEXTURE_1D, 0);
+}
+
+void ScalarMeshRenderer::destroy() {
+    glDeleteProgram(_gl_state.program);
+    glDeleteVertexArrays(1, &_gl_state.vao);
+    glDeleteBuffers(1, &_gl_state.position_buffer);
+    glDeleteBuffers(1, &_gl_state.scalar_buffer);
+    glDeleteBuffers(1, &_gl_state.index_buffer);
+    glDeleteTextures(1, &_gl_state.colormap_texture);
+    _gl_state.program = 0;
+    _gl_state.vao = 0;
+    _gl_state.position_buffer = 0;
+    _gl_state.scalar_buffer = 0;
+    _gl_state.index_buffer = 0;
+    _gl_state.colormap_texture = 0;
+
+    _num_vertices = 0;
+    _num_faces = 0;
+    _has_scalars = false;
+    memory_tracker().set(MEMORY_NAME, 0, 0);
+}
+
+void ScalarMeshRenderer::set_mesh(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F) {
+    push_opengl_debug_group("ScalarMeshRenderer::set_mesh");
+    _num_vertices = GLsizei(V.rows());
+    _num_faces = GLsizei(F.rows());
+
+    Eigen::RowVector3d box_min = Eigen::RowVector3d::Zero(), box_extent = Eigen::RowVector3d::Ones();
+    if (V.rows() > 0) {
+        box_min = V.colwise().minCoeff();
+        box_extent = V.colwise().maxCoeff() - box_min;
+        // A flat mesh still needs something to divide by
+        box_extent = (box_extent.array() > 0.0).select(box_extent, 1.0);
+    }
+    _box_min = glm::vec3(box_min[0], box_min[1], box_min[2]);
+    _box_extent = glm::vec3(box_extent[0], box_extent[1], box_extent[2]);
+
+    std::vector<std::uint16_t> positions(4 * std::size_t(_num_vertices), 0);
+    for (Eigen::Index i = 0; i < V.rows(); i++) {
+        for (int c = 0; c < 3; c++) {
+            const double t = (V(i, c) - box_min[c]) / box_extent[c];
+            positions[4 * i + c] = std::uint16_t(std::min(std::max(t, 0.0), 1.0) * QUANTIZED_MAX + 0.5);
+        }
+    }
+    const Eigen::Matrix<GLuint, Eigen::Dynamic, 3, Eigen::RowMajor> indices = F.cast<GLuint>();
+
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.position_buffer);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(std::uint16_t), positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(_gl_state.vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    clear_scalars();
+    pop_opengl_debug_group();
+}
+
+bool ScalarMeshRenderer::set_scalars(const Eigen::VectorXd& S) {
+    if (S.size() != _num_vertices || S.size() == 0) {
+        clear_scalars();
+        return false;
+    }
+
+    const Eigen::VectorXf scalars = S.cast<float>();
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.scalar_buffer);
+    glBufferData(GL_ARRAY_BUFFER, scalars.size() * sizeof(GLfloat), scalars.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(_gl_state.vao);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+
+    _has_scalars = true;
+    _scalar_range = glm::vec2(scalars.minCoeff(), scalars.maxCoeff());
+    report_memory();
+    return true;
+}
+
+void ScalarMeshRenderer::clear_scalars() {
+    _has_scalars = false;
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.scalar_buffer);
+    glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(_gl_state.vao);
+    glDisableVertexAttribArray(1);
+    glVertexAttrib1f(1, 0.0f);
+    glBindVertexArray(0);
+    report_memory();
+}
+
+void ScalarMeshRenderer::report_memory() const {
+    const std::size_t device_bytes = std::size_t(_num_vertices) * 4 * sizeof(std::uint16_t) +
+            (_has_scalars ? std::size_t(_num_vertices) * sizeof(GLfloat) : 0) +
+            std::size_t(_num_faces) * 3 * sizeof(GLuint);
+    memory_tracker().set(MEMORY_NAME, 0, device_bytes);
+}
+
+void ScalarMeshRenderer::draw(const glm::mat4& model, const glm::mat4& view, const glm::mat4& proj,
+                              const glm::vec3& light_position) {
+    if (_num_faces == 0 || (!show_faces && !show_lines)) {
+        return;
+    }
+    push_opengl_debug_group("ScalarMeshRenderer::draw");
+
+    glUseProgram(_gl_state.program);
+    glUniformMatrix4fv(_gl_state.uniform_location.model, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(_gl_state.uniform_location.view, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(_gl_state.uniform_location.proj, 1, GL_FALSE, glm::value_ptr(proj));
+    glUniform3fv(_gl_state.uniform_location.light_position, 1, glm::value_ptr(light_position));
+    glUniform3fv(_gl_state.uniform_location.box_min, 1, glm::value_ptr(_box_min));
+    glUniform3fv(_gl_state.uniform_location.box_extent, 1, glm::value_ptr(_box_extent));
+    glUniform2fv(_gl_state.uniform_location.scalar_range, 1, glm::value_ptr(_scalar_range));
+    glUniform1i(_gl_state.uniform_location.colormap, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_1D, _gl_state.colormap_texture);
+
+    glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(_gl_state.vao);
+    if (show_faces) {
+        // Pushed back so the lines drawn over them win the depth test
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.0f, 1.0f);
+        glUniform1i(_gl_state.uniform_location.use_scalars, _has_scalars);
+        glUniform1i(_gl_state.uniform_location.shade, GL_TRUE);
+        glUniform4fv(_gl_state.uniform_location.color, 1, glm::value_ptr(face_color));
+        glDrawElements(GL_TRIANGLES, 3 * _num_faces, GL_UNSIGNED_INT, nullptr);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+    if (show_lines) {
+        // Over the faces the lines keep their color, on their own they show the scalars
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        glUniform1i(_gl_state.uniform_location.use_scalars, _has_scalars && !show_faces);
+        glUniform1i(_gl_state.uniform_location.shade, GL_FALSE);
+        glUniform4fv(_gl_state.uniform_location.color, 1, glm::value_ptr(line_color));
+        glDrawElements(GL_TRIANGLES, 3 * _num_faces, GL_UNSIGNED_INT, nullptr);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glUseProgram(0);
+
+    pop_opengl_debug_group();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Eigen/Core>
+
+// Draws a triangle mesh colored by a scalar per vertex, for showing the boundary of the tet mesh. Unlike
+// igl::opengl::ViewerData, which keeps double copies of the vertices, the faces, the normals and the colors and
+// expands them to one vertex per face corner for flat shading, only the GPU holds the mesh: the vertices once, as
+// 16 bit positions within the bounding box of the mesh, the scalar as one float per vertex and the faces as an
+// index buffer. The faces are flat shaded from screen space derivatives and the scalar is mapped to the parula
+// colormap in the fragment shader, so changing the scalar range recolors the mesh without uploading anything.
+class ScalarMeshRenderer {
+public:
+    void init();
+    void destroy();
+
+    // Upload a new mesh. The scalars are dropped and the mesh is drawn in the face color until set_scalars().
+    void set_mesh(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F);
+
+    // One scalar per vertex of the mesh, colormapped between their minimum and maximum. Returns false and keeps
+    // the face color if there is not one per vertex.
+    bool set_scalars(const Eigen::VectorXd& S);
+    void clear_scalars();
+    bool has_scalars() const { return _has_scalars; }
+
+    // Scalars at or below min get the first color of the map, at or above max the last one
+    void set_scalar_range(float min, float max) { _scalar_range = glm::vec2(min, max); }
+    glm::vec2 scalar_range() const { return _scalar_range; }
+
+    bool show_faces = true;
+    bool show_lines = true;
+    glm::vec4 face_color = glm::vec4(1.0f, 0.9f, 0.2f, 1.0f);
+    glm::vec4 line_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    GLsizei num_faces() const { return _num_faces; }
+
+    void draw(const glm::mat4& model, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& light_position);
+
+private:
+    struct {
+        GLuint program = 0;
+        GLuint vao = 0;
+        GLuint position_buffer = 0;
+        GLuint scalar_buffer = 0;
+        GLuint index_buffer = 0;
+        GLuint colormap_texture = 0;
+
+        struct {
+            GLint model;
+            GLint view;
+            GLint proj;
+            GLint light_position;
+            GLint box_min;
+            GLint box_extent;
+            GLint scalar_range;
+            GLint use_scalars;
+            GLint shade;
+            GLint color;
+            GLint colormap;
+        } uniform_location;
+    } _gl_state;
+
+    GLsizei _num_vertices = 0;
+    GLsizei _num_faces = 0;
+    // Positions are stored as fractions of the bounding box of the mesh
+    glm::vec3 _box_min = glm::vec3(0.0f);
+    glm::vec3 _box_extent = glm::vec3(1.0f);
+
+    bool _has_scalars = false;
+    glm::vec2 _scalar_range = glm::vec2(0.0f, 1.0f);
+
+    void report_memory() const;
+};
@@ -3,15 +3,20 @@
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <string>
 
 #include <igl/opengl/load_shader.h>
-#include <igl/opengl/create_shader_program.h>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "utils/utils.h"
+#include "gpu_profiler.h"
+#include "shader_cache.h"
+#include "uniform_ring.h"
 
 namespace {
 
@@ -79,37 +84,40 @@ constexpr const char* VOLUME_PASS_VERTEX_SHADER = R"(
 // 6. Perform front-to-back compositing
 // 7. Stop if either the ray is exhausted or the combined transparency is above an
 //    early-ray termination threshold (0.99 in this case)
-constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
+// The defines of the variant, the empty space skipping functions and the colormap are inserted between the version
+// line and the body. Each variant is compiled with COLOR_BY_IDENTIFIER, SELECTION_EMPHASIS and USE_GRADIENT_VOLUME set,
+// see SelectionRenderer::volume_program().
+constexpr const char* SELECTION_RENDERING_FRAG_SHADER_VERSION = R"(
   #version 150
-  // Keep in sync with main.cpp UI_State::Emphasis
-  const int SELECTION_EMPHASIS_TYPE_NONE = 0;
-  const int SELECTION_EMPHASIS_TYPE_ONSELECTION = 1;
-  const int SELECTION_EMPHASIS_TYPE_ONNONSELECTION = 2;
+)";
+
+constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
+  // Keep in sync with Parameters::emphasize_by_selection
+  #define SELECTION_EMPHASIS_TYPE_NONE 0
+  #define SELECTION_EMPHASIS_TYPE_ONSELECTION 1
+  #define SELECTION_EMPHASIS_TYPE_ONNONSELECTION 2
 
   in vec2 uv;
   out vec4 out_color;
 
-  uniform uint num_contour_features;
   uniform usampler1D contour_features;
 
-  uniform uint num_selection_features;
+  // Bitset of the selected features, bit (feature % 32) of texel (feature / 32)
   uniform usampler1D selection_features;
 
   uniform sampler2D entry_texture;
   uniform sampler2D exit_texture;
 
   uniform sampler3D volume_texture;
-  uniform sampler1D transfer_function;
+  // Preintegrated over the segment between (previous sample, sample), see TransferFunctionTexture
+  uniform sampler2D transfer_function;
 
   uniform usampler3D index_volume;
-  uniform int color_by_identifier;
 
-  uniform ivec3 volume_dimensions;
-  uniform vec3 volume_dimensions_rcp;
-  uniform float sampling_rate;
+  // Normalized gradient direction biased into [0, 1], see GradientVolume
+  uniform sampler3D gradient_volume;
 
-  uniform int selection_emphasis_type;
-  uniform float highlight_factor;
+  uniform sampler2D previous_frame;
 
   struct Light_Parameters {
     vec3 position;
@@ -118,69 +126,49 @@ constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
     vec3 specular_color;
     float specular_exponent;
   };
-  uniform Light_Parameters light_parameters;
 
-  uniform int id;
+  // Everything but the samplers, written once per frame. Keep in sync with SelectionPassBlock.
+  layout(std140) uniform SelectionPassBlock {
+    Light_Parameters light_parameters;
+    ivec3 volume_dimensions;
+    float sampling_rate;
+    vec3 volume_dimensions_rcp;
+    float highlight_factor;
+    uint num_contour_features;
+    // Progressive refinement: the new frame is blended into previous_frame with frame_weight and
+    // the first sample of each ray is offset by a per pixel jitter (no offset if jitter is 0)
+    float frame_weight;
+    float jitter;
+  };
 
   // Early-ray termination
   const float ERT_THRESHOLD = 0.99;
   const float REF_SAMPLING_INTERVAL = 150.0;
 
-  // Code from https://raw.githubusercontent.com/kbinani/glsl-colormap/master/shaders/transform_rainbow.frag
-  // Under MIT license
-  vec4 colormap(float x) {
-    float r = 0.0, g = 0.0, b = 0.0;
-
-    if (x < 0.0) {
-      r = 127.0 / 255.0;
-    } else if (x <= 1.0 / 9.0) {
-      r = 1147.5 * (1.0 / 9.0 - x) / 255.0;
-    } else if (x <= 5.0 / 9.0) {
-      r = 0.0;
-    } else if (x <= 7.0 / 9.0) {
-      r = 1147.5 * (x - 5.0 / 9.0) / 255.0;
-    } else {
-      r = 1.0;
-    }
-
-    if (x <= 1.0 / 9.0) {
-      g = 0.0;
-    } else if (x <= 3.0 / 9.0) {
-      g = 1147.5 * (x - 1.0 / 9.0) / 255.0;
-    } else if (x <= 7.0 / 9.0) {
-      g = 1.0;
-    } else if (x <= 1.0) {
-      g = 1.0 - 1147.5 * (x - 7.0 / 9.0) / 255.0;
-    } else {
-      g = 0.0;
-    }
-
-    if (x <= 3.0 / 9.0) {
-      b = 1.0;
-    } else if (x <= 5.0 / 9.0) {
-      b = 1.0 - 1147.5 * (x - 3.0 / 9.0) / 255.0;
-    } else {
-      b = 0.0;
-    }
-
-    return vec4(r, g, b, 1.0);
-  }
-
-
   vec3 centralDifferenceGradient(vec3 pos) {
     vec3 f;
-    f.x = texture(volume_texture, pos + vec3(volume_dimensions_rcp.x, 0.0, 0.0)).r;
-    f.y = texture(volume_texture, pos + vec3(0.0, volume_dimensions_rcp.y, 0.0)).r;
-    f.z = texture(volume_texture, pos + vec3(0.0, 0.0, volume_dimensions_rcp.z)).r;
+    f.x = textureLod(volume_texture, pos + vec3(volume_dimensions_rcp.x, 0.0, 0.0), 0.0).r;
+    f.y = textureLod(volume_texture, pos + vec3(0.0, volume_dimensions_rcp.y, 0.0), 0.0).r;
+    f.z = textureLod(volume_texture, pos + vec3(0.0, 0.0, volume_dimensions_rcp.z), 0.0).r;
 
     vec3 b;
-    b.x = texture(volume_texture, pos - vec3(volume_dimensions_rcp.x, 0.0, 0.0)).r;
-    b.y = texture(volume_texture, pos - vec3(0.0, volume_dimensions_rcp.y, 0.0)).r;
-    b.z = texture(volume_texture, pos - vec3(0.0, 0.0, volume_dimensions_rcp.z)).r;
+    b.x = textureLod(volume_texture, pos - vec3(volume_dimensions_rcp.x, 0.0, 0.0), 0.0).r;
+    b.y = textureLod(volume_texture, pos - vec3(0.0, volume_dimensions_rcp.y, 0.0), 0.0).r;
+    b.z = textureLod(volume_texture, pos - vec3(0.0, 0.0, volume_dimensions_rcp.z), 0.0).r;
 
     return (f - b) / 2.0;
   }
 
+  vec3 sample_normal(vec3 pos) {
+  #if USE_GRADIENT_VOLUME
+    // One fetch from the precomputed gradient instead of six for the central difference
+    vec3 gradient = texture(gradient_volume, pos).rgb * 2.0 - 1.0;
+  #else
+    vec3 gradient = centralDifferenceGradient(pos);
+  #endif
+    return gradient / max(length(gradient), 0.001);
+  }
+
   vec3 blinn_phong(Light_Parameters light, vec3 material_ambient_color,
                    vec3 material_diffuse_color, vec3 material_specular_color,
                    vec3 position, vec3 normal, vec3 direction_to_camera)
@@ -200,46 +188,35 @@ constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
   }
 
   bool is_feature_selected(uint feature) {
-    for (uint i = uint(0); i < num_selection_features; ++i) {
-      if (texelFetch(selection_features, int(i), 0).r == feature) {
-        return true;
-      }
+    int word_index = int(feature >> 5u);
+    if (word_index >= textureSize(selection_features, 0)) {
+      return false;
     }
-    return false;
+    uint word = texelFetch(selection_features, word_index, 0).r;
+    return (word & (1u << (feature & 31u))) != 0u;
   }
 
-  float selection_factor(bool is_selected) {
-    if (num_selection_features == uint(0)) {
-      return 1.f;
-    }
+  // Without a selection the variant without emphasis is used, so the bitset is not read at all
+  float selection_factor(uint feature) {
+  #if SELECTION_EMPHASIS == SELECTION_EMPHASIS_TYPE_ONSELECTION
+    return is_feature_selected(feature) ? 1.0 : highlight_factor;
+  #elif SELECTION_EMPHASIS == SELECTION_EMPHASIS_TYPE_ONNONSELECTION
+    return is_feature_selected(feature) ? highlight_factor : 1.0;
+  #else
+    return 1.0;
+  #endif
+  }
 
-    if (selection_emphasis_type == SELECTION_EMPHASIS_TYPE_NONE) {
-      return 1.f;
-    }
-    else if (selection_emphasis_type == SELECTION_EMPHASIS_TYPE_ONSELECTION) {
-      if (is_selected) {
-        return 1.f;
-      }
-      else {
-        return highlight_factor;
-      }
-    }
-    else if (selection_emphasis_type == SELECTION_EMPHASIS_TYPE_ONNONSELECTION) {
-      if (is_selected) {
-        return highlight_factor;
-      }
-      else {
-        return 1.f;
-      }
-    }
+  // Interleaved gradient noise, cheap and well distributed between neighbouring pixels
+  float pixel_noise(vec2 p) {
+    return fract(52.9829189 * fract(dot(p, vec2(0.06711056, 0.00583715))));
   }
 
-  void main() {
+  vec4 cast_ray() {
     vec3 entry = texture(entry_texture, uv).rgb;
     vec3 exit = texture(exit_texture, uv).rgb;
     if (entry == exit) {
-      out_color = vec4(0.0);
-      return;
+      return vec4(0.0);
     }
 
     // Combined final color that the volume rendering computed
@@ -248,32 +225,42 @@ constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
     vec3 ray_direction = exit - entry;
 
     float t_end = length(ray_direction);
-    float t_incr = sampling_rate;
+    float t_incr = footprint_step(entry, sampling_rate);
 
     vec3 normalized_ray_direction = normalize(ray_direction);
 
-    float t = 0.0;
+    float t = jitter > 0.0 ? fract(jitter + pixel_noise(gl_FragCoord.xy)) * t_incr : 0.0;
+    // Density at the previous sample inside a feature, negative when there is none
+    float previous_value = -1.0;
     while (t < t_end) {
       vec3 sample_pos = entry + t * normalized_ray_direction;
+      // sampling_rate is the step at full resolution, farther samples step the width of their pixel
+      t_incr = footprint_step(sample_pos, sampling_rate);
+      float skip = empty_space_skip(sample_pos, normalized_ray_direction, t_incr);
+      if (skip > 0.0) {
+        t += skip;
+        previous_value = -1.0;
+        continue;
+      }
 
       uint segVoxel = texture(index_volume, sample_pos).r;
       uint feature = texelFetch(contour_features, int(segVoxel), 0).r + uint(1);
 
       if (feature != uint(0)) {
-        float value = texture(volume_texture, sample_pos).r;
+        float value = textureLod(volume_texture, sample_pos, footprint_lod(t_incr, sampling_rate)).r;
         vec4 color;
-        if (color_by_identifier == 1) {
-            float normFeature = float(feature) / float(num_contour_features);
-            color.rgb = colormap(normFeature).rgb;
-            color.a = selection_factor(is_feature_selected(feature));
-        } else {
-          color = texture(transfer_function, value);
-          color.a *= selection_factor(is_feature_selected(feature));
-        }
+      #if COLOR_BY_IDENTIFIER
+        float normFeature = float(feature) / float(num_contour_features);
+        color.rgb = colormap(normFeature).rgb;
+        color.a = selection_factor(feature);
+      #else
+        color = texture(transfer_function, vec2(previous_value < 0.0 ? value : previous_value, value));
+        color.a *= selection_factor(feature);
+      #endif
+        previous_value = value;
         if (color.a > 0) {
           // Gradient
-          vec3 gradient = centralDifferenceGradient(sample_pos);
-          vec3 normal = gradient / max(length(gradient), 0.001);
+          vec3 normal = sample_normal(sample_pos);
           // Lighting
           color.rgb = blinn_phong(light_parameters, color.rgb, color.rgb, vec3(1.0),
                                   sample_pos, normal, -normalized_ray_direction);
@@ -283,6 +270,8 @@ constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
           result.rgb = result.rgb + (1.0 - result.a) * color.a * color.rgb;
           result.a = result.a + (1.0 - result.a) * color.a;
         }
+      } else {
+        previous_value = -1.0;
       }
 
       if (result.a > ERT_THRESHOLD) {
@@ -294,10 +283,35 @@ constexpr const char* SELECTION_RENDERING_FRAG_SHADER = R"(
     }
 
     //result.a = 1.0;
+    return result;
+  }
+
+  void main() {
+    vec4 result = cast_ray();
+    if (frame_weight < 1.0) {
+      result = mix(texelFetch(previous_frame, ivec2(gl_FragCoord.xy), 0), result, frame_weight);
+    }
     out_color = result;
   }
 )";
 
+// Draws the accumulated volume rendering into the current framebuffer. While interacting only the
+// lower left 1/downsample part of the accumulation texture is filled, uv_scale selects that part.
+constexpr const char* COMPOSITE_FRAG_SHADER = R"(
+  #version 150
+  in vec2 uv;
+  out vec4 out_color;
+
+  uniform sampler2D frame;
+  uniform vec2 uv_scale;
+
+  void main() {
+    // Do not filter across the edge of the rendered part
+    vec2 half_texel = 0.5 / vec2(textureSize(frame, 0));
+    out_color = texture(frame, min(uv * uv_scale, uv_scale - half_texel));
+  }
+)";
+
 // Shader that performs a light-weight volume rendering and stores the position of the
 // first hit point
 // Steps:
@@ -370,8 +384,94 @@ constexpr const char* SELECTION_PICKING_PASS_FRAG_SHADER = R"(
   }
 )";
 
+// Binding points of the uniform blocks of the volume pass
+constexpr GLuint SELECTION_PASS_BLOCK_BINDING = 0;
+constexpr GLuint FOOTPRINT_BLOCK_BINDING = 1;
+
+// std140 layout of SelectionPassBlock in SELECTION_RENDERING_FRAG_SHADER
+struct SelectionPassBlock {
+    glm::vec3 light_position;
+    float padding0;
+    glm::vec3 light_color_ambient;
+    float padding1;
+    glm::vec3 light_color_diffuse;
+    float padding2;
+    glm::vec3 light_color_specular;
+    float light_exponent_specular;
+    glm::ivec3 volume_dimensions;
+    float sampling_rate;
+    glm::vec3 volume_dimensions_rcp;
+    float highlight_factor;
+    GLuint num_contour_features;
+    float frame_weight;
+    float jitter;
+    float padding3;
+};
+static_assert(sizeof(SelectionPassBlock) == 112, "SelectionPassBlock does not match the std140 layout of the shader");
+
+bool same_rendering_parameters(const Parameters& a, const Parameters& b) {
+    return a.volume_dimensions == b.volume_dimensions &&
+           a.light_position == b.light_position &&
+           a.highlight_factor == b.highlight_factor &&
+           a.sampling_rate == b.sampling_rate &&
+           a.ambient == b.ambient &&
+           a.diffuse == b.diffuse &&
+           a.specular == b.specular &&
+           a.specular_exponent == b.specular_exponent &&
+           a.emphasize_by_selection == b.emphasize_by_selection &&
+           a.color_by_id == b.color_by_id &&
+           a.precomputed_gradients == b.precomputed_gradients &&
+           a.interactive_downsample == b.interactive_downsample &&
+           a.interactive_step_scale == b.interactive_step_scale &&
+           a.footprint_scale == b.footprint_scale &&
+           a.progressive_frames == b.progressive_frames;
+}
+
 } // namespace
 
+
+const char* const SelectionRenderer::COLORMAP_GLSL = R"(
+// Code from https://raw.githubusercontent.com/kbinani/glsl-colormap/master/shaders/transform_rainbow.frag
+// Under MIT license
+vec4 colormap(float x) {
+  float r = 0.0, g = 0.0, b = 0.0;
+
+  if (x < 0.0) {
+    r = 127.0 / 255.0;
+  } else if (x <= 1.0 / 9.0) {
+    r = 1147.5 * (1.0 / 9.0 - x) / 255.0;
+  } else if (x <= 5.0 / 9.0) {
+    r = 0.0;
+  } else if (x <= 7.0 / 9.0) {
+    r = 1147.5 * (x - 5.0 / 9.0) / 255.0;
+  } else {
+    r = 1.0;
+  }
+
+  if (x <= 1.0 / 9.0) {
+    g = 0.0;
+  } else if (x <= 3.0 / 9.0) {
+    g = 1147.5 * (x - 1.0 / 9.0) / 255.0;
+  } else if (x <= 7.0 / 9.0) {
+    g = 1.0;
+  } else if (x <= 1.0) {
+    g = 1.0 - 1147.5 * (x - 7.0 / 9.0) / 255.0;
+  } else {
+    g = 0.0;
+  }
+
+  if (x <= 3.0 / 9.0) {
+    b = 1.0;
+  } else if (x <= 5.0 / 9.0) {
+    b = 1.0 - 1147.5 * (x - 3.0 / 9.0) / 255.0;
+  } else {
+    b = 0.0;
+  }
+
+  return vec4(r, g, b, 1.0);
+}
+)";
+
 using namespace igl::opengl;
 
 void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
@@ -406,8 +506,8 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
     glGenBuffers(1, &_gl_state.geometry_pass.ibo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _gl_state.geometry_pass.ibo);
 
-    // Specifying the 12 faces of the unit cube
-    const GLubyte iboData[] = {
+    // Specifying the 12 faces of the unit cube, until set_bounding_geometry replaces it
+    const GLuint iboData[] = {
         0, 6, 4,
         0, 2, 6,
         0, 3, 2,
@@ -422,13 +522,15 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
         1, 7, 3
     };
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(iboData), iboData, GL_STATIC_DRAW);
+    _gl_state.geometry_pass.num_indices = GLsizei(sizeof(iboData) / sizeof(iboData[0]));
 
     glBindVertexArray(0);
 
-    _gl_state.geometry_pass.program = igl::opengl::create_shader_program(
+    create_cached_shader_program(
         VertexShader,
         RAY_ENDPOINT_PASS_FRAGMENT_SHADER,
-        { { "in_position", 0 } }
+        { { "in_position", 0 } },
+        _gl_state.geometry_pass.program
     );
 
     _gl_state.geometry_pass.uniform_location.model_matrix = glGetUniformLocation(
@@ -439,56 +541,42 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
         glGetUniformLocation(_gl_state.geometry_pass.program, "projection_matrix");
 
 
-    // If the user specified a fragment shader, use that, otherwise, use the default one
-    igl::opengl::create_shader_program(VOLUME_PASS_VERTEX_SHADER, SELECTION_RENDERING_FRAG_SHADER, {},
-        _gl_state.volume_pass.program_object);
+    // The volume pass programs are built when a combination of options is first drawn
+    _gl_state.volume_pass.programs.init([](const ShaderDefines& defines, GLState::VolumePass::Program& program) {
+        const std::string fragment_shader =
+            std::string(SELECTION_RENDERING_FRAG_SHADER_VERSION) + shader_defines_source(defines) +
+            EmptySpaceGrid::GLSL + PixelFootprint::GLSL + COLORMAP_GLSL + SELECTION_RENDERING_FRAG_SHADER;
+        if (!create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER, fragment_shader, {}, program.program)) {
+            return false;
+        }
 
-    _gl_state.volume_pass.uniform_location.entry_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "entry_texture");
-    _gl_state.volume_pass.uniform_location.exit_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "exit_texture");
-    _gl_state.volume_pass.uniform_location.volume_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "volume_texture");
-    _gl_state.volume_pass.uniform_location.volume_dimensions = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "volume_dimensions");
-    _gl_state.volume_pass.uniform_location.volume_dimensions_rcp =
-        glGetUniformLocation(
-            _gl_state.volume_pass.program_object, "volume_dimensions_rcp"
-        );
-    _gl_state.volume_pass.uniform_location.transfer_function = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "transfer_function");
-    _gl_state.volume_pass.uniform_location.sampling_rate = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "sampling_rate");
-    _gl_state.volume_pass.uniform_location.light_position = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "light_parameters.position");
-    _gl_state.volume_pass.uniform_location.light_color_ambient = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "light_parameters.ambient_color");
-    _gl_state.volume_pass.uniform_location.light_color_diffuse = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "light_parameters.diffuse_color");
-    _gl_state.volume_pass.uniform_location.light_color_specular = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "light_parameters.specular_color");
-    _gl_state.volume_pass.uniform_location.light_exponent_specular = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "light_parameters.specular_exponent");
-
-    _gl_state.volume_pass.uniform_location.index_volume = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "index_volume");
-    _gl_state.volume_pass.uniform_location.color_by_identifier = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "color_by_identifier");
-    _gl_state.volume_pass.uniform_location.selection_emphasis_type = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "selection_emphasis_type");
-    _gl_state.volume_pass.uniform_location.highlight_factor = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "highlight_factor");
-
-    _gl_state.volume_pass.uniform_location.contour_features_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "contour_features");
-    _gl_state.volume_pass.uniform_location.selection_features_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "selection_features");
-    _gl_state.volume_pass.uniform_location.num_contour_features = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "num_contour_features");
-    _gl_state.volume_pass.uniform_location.num_selection_features = glGetUniformLocation(
-        _gl_state.volume_pass.program_object, "num_selection_features");
-
-    igl::opengl::create_shader_program(VOLUME_PASS_VERTEX_SHADER,
+        const GLuint id = program.program;
+        program.uniform_location.entry_texture = glGetUniformLocation(id, "entry_texture");
+        program.uniform_location.exit_texture = glGetUniformLocation(id, "exit_texture");
+        program.uniform_location.volume_texture = glGetUniformLocation(id, "volume_texture");
+        program.uniform_location.transfer_function = glGetUniformLocation(id, "transfer_function");
+        program.uniform_location.index_volume = glGetUniformLocation(id, "index_volume");
+        program.uniform_location.contour_features_texture = glGetUniformLocation(id, "contour_features");
+        program.uniform_location.selection_features_texture = glGetUniformLocation(id, "selection_features");
+        program.uniform_location.empty_space = EmptySpaceGrid::uniform_locations(id);
+        program.uniform_location.gradient_volume = glGetUniformLocation(id, "gradient_volume");
+        program.uniform_location.previous_frame = glGetUniformLocation(id, "previous_frame");
+        // The other parameters come from the uniform blocks written by ray_cast_pass()
+        bind_uniform_block(id, "SelectionPassBlock", SELECTION_PASS_BLOCK_BINDING);
+        bind_uniform_block(id, PixelFootprint::BLOCK_NAME, FOOTPRINT_BLOCK_BINDING);
+        return true;
+    });
+
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER, COMPOSITE_FRAG_SHADER, {},
+        _gl_state.composite_pass.program_object);
+    _gl_state.composite_pass.uniform_location.frame = glGetUniformLocation(
+        _gl_state.composite_pass.program_object, "frame");
+    _gl_state.composite_pass.uniform_location.uv_scale = glGetUniformLocation(
+        _gl_state.composite_pass.program_object, "uv_scale");
+
+    _empty_space.init();
+
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER,
         SELECTION_PICKING_PASS_FRAG_SHADER, {},
         _gl_state.picking_pass.program_object);
     _gl_state.picking_pass.uniform_location.entry_texture =
@@ -531,21 +619,31 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
     // Entry point texture and frame buffer
     glGenTextures(1, &_gl_state.geometry_pass.entry_texture);
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.entry_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0, GL_RGB,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0, GL_RGB,
         GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // Depth texture that keeps the nearest entry and the farthest exit point
+    glGenTextures(1, &_gl_state.geometry_pass.depth_texture);
+    glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, viewport_size.x, viewport_size.y, 0,
+        GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
     glGenFramebuffers(1, &_gl_state.geometry_pass.entry_framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.geometry_pass.entry_framebuffer);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
         _gl_state.geometry_pass.entry_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+        _gl_state.geometry_pass.depth_texture, 0);
 
 
     // Exit point texture and frame buffer
     glGenTextures(1, &_gl_state.geometry_pass.exit_texture);
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.exit_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0, GL_RGB,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0, GL_RGB,
         GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -554,6 +652,8 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
     glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.geometry_pass.exit_framebuffer);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
         _gl_state.geometry_pass.exit_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+        _gl_state.geometry_pass.depth_texture, 0);
 
 
     // Picking texture and framebuffer
@@ -570,22 +670,52 @@ void SelectionRenderer::initialize(const glm::ivec2& viewport_size)
         _gl_state.picking_pass.picking_texture, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    glGenBuffers(NUM_PICKING_BUFFERS, _gl_state.picking_pass.pixel_buffer);
+    for (int i = 0; i < NUM_PICKING_BUFFERS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.picking_pass.pixel_buffer[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLfloat) * 3, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _picking.dirty = true;
+
+
+    // Accumulation textures and framebuffers for the progressive refinement
+    const glm::vec4 color_transparent(0.0);
+    for (int i = 0; i < 2; i++) {
+        glGenTextures(1, &_gl_state.composite_pass.texture[i]);
+        glBindTexture(GL_TEXTURE_2D, _gl_state.composite_pass.texture[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, color_format(), viewport_size.x, viewport_size.y, 0, GL_RGBA,
+            GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &_gl_state.composite_pass.framebuffer[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.composite_pass.framebuffer[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+            _gl_state.composite_pass.texture[i], 0);
+        glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    _progressive.size = viewport_size;
+    restart_refinement();
+
 
     // Initialize transfer function
-    // Texture
-    glGenTextures(1, &_gl_state.volume_pass.transfer_function_texture);
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    _transfer_function.init();
 
     glGenTextures(1, &_gl_state.volume_pass.contour_features_texture);
+    _gl_state.volume_pass.contour_features_width = 0;
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.contour_features_texture);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 
     glGenTextures(1, &_gl_state.volume_pass.selection_features_texture);
+    _gl_state.volume_pass.selection_features_width = 0;
+    _selection_bits.clear();
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.selection_features_texture);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -597,117 +727,103 @@ void SelectionRenderer::destroy() {
     std::vector<GLuint> buffers = {
         _gl_state.geometry_pass.vbo,
         _gl_state.geometry_pass.ibo };
+    buffers.insert(buffers.end(), std::begin(_gl_state.picking_pass.pixel_buffer),
+                   std::end(_gl_state.picking_pass.pixel_buffer));
+    for (GLsync& fence : _picking.fence) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
     std::vector<GLuint> textures = {
         _gl_state.geometry_pass.entry_texture,
         _gl_state.geometry_pass.exit_texture,
-        _gl_state.volume_pass.transfer_function_texture,
+        _gl_state.geometry_pass.depth_texture,
         _gl_state.picking_pass.picking_texture,
         _gl_state.volume_pass.contour_features_texture,
-        _gl_state.volume_pass.selection_features_texture
+        _gl_state.volume_pass.selection_features_texture,
+        _gl_state.composite_pass.texture[0],
+        _gl_state.composite_pass.texture[1]
     };
     std::vector<GLuint> framebuffers = {
         _gl_state.geometry_pass.entry_framebuffer,
-        _gl_state.geometry_pass.exit_texture,
-        _gl_state.picking_pass.picking_framebuffer
+        _gl_state.geometry_pass.exit_framebuffer,
+        _gl_state.picking_pass.picking_framebuffer,
+        _gl_state.composite_pass.framebuffer[0],
+        _gl_state.composite_pass.framebuffer[1]
     };
 
     glDeleteBuffers(buffers.size(), buffers.data());
     glDeleteTextures(textures.size(), textures.data());
     glDeleteFramebuffers(framebuffers.size(), framebuffers.data());
-    glDeleteProgram(_gl_state.volume_pass.program_object);
+    _gl_state.volume_pass.programs.destroy();
     glDeleteProgram(_gl_state.picking_pass.program_object);
     glDeleteProgram(_gl_state.geometry_pass.program);
+    glDeleteProgram(_gl_state.composite_pass.program_object);
+    _empty_space.destroy();
+    _transfer_function.destroy();
+    _uniforms.destroy();
+    _volume.reset();
 
     _gl_state = GLState();
+    _progressive.displayed_buffer = -1;
+    _progressive.endpoints_valid = false;
+    _picking.dirty = true;
+    restart_refinement();
 }
 
 void SelectionRenderer::set_transfer_function(const std::vector<TfNode> &tf) {
-    push_opengl_debug_group("Update Transfer Function");
-
-    constexpr const int TRANSFER_FUNCTION_WIDTH = 512;
-
-    assert(
-        std::is_sorted(
-            tf.begin(),
-            tf.end(),
-            [](const TfNode& a, const TfNode& b) {
-                return a.t < b.t;
-            }
-        )
-    );
-    assert(tf.size() >= 2);
-    assert(tf.front().t == 0.f);
-    assert(tf.back().t == 1.f);
-
-
-    std::vector<TfNode>::const_iterator current = tf.begin();
-    std::vector<TfNode>::const_iterator next = current + 1;
-
-    //    a
-    //    l  ^
-    //    p  |                     a[4]
-    //    h  |                      o
-    //    a  |                     / \
-    //       |   a[1]     a[2]    /   \
-    //       |     o-------o     /     \
-    //       |    /    ^    \   /       \
-    //       |   /     |     \ /         \
-    //       |  /      |      o           \
-    //       | /       |     a[3]          \
-    //       |/        |                    \
-    //       o---------|---------------------o---------------o>     t \in [0, 1]
-    //       ^         |                    a[5]             ^
-    //     first       |                                    last
-    //      a[0]       |                                    a[6]
-    //
-    //        local t' renormalized \in [0 = a[1], 1 = a[2]]
-    //        linear interpolation using t' by (1 - t') * a[1] + t' * a[2]
-    //
-
-
-    std::vector<std::array<uint8_t, 4>> transfer_function_data(TRANSFER_FUNCTION_WIDTH);
-    for (int i = 0; i < TRANSFER_FUNCTION_WIDTH; ++i) {
-        const float t = static_cast<float>(i) / (TRANSFER_FUNCTION_WIDTH - 1);
-
-        if (t > next->t) {
-            current = next;
-            next++;
-        }
-
-        const float t_prime = (t - current->t) / (next->t - current->t);
-
-        const float rgba[] = {
-            (1 - t_prime) * current->rgba[0] + t_prime * next->rgba[0],
-            (1 - t_prime) * current->rgba[1] + t_prime * next->rgba[1],
-            (1 - t_prime) * current->rgba[2] + t_prime * next->rgba[2],
-            (1 - t_prime) * current->rgba[3] + t_prime * next->rgba[3]
-        };
+    _empty_space.update_transfer_function(_transfer_function.update(tf));
+    _picking.dirty = true;
+    restart_refinement();
+}
 
-        transfer_function_data[i] = {
-            static_cast<uint8_t>(rgba[0] * 255.f),
-            static_cast<uint8_t>(rgba[1] * 255.f),
-            static_cast<uint8_t>(rgba[2] * 255.f),
-            static_cast<uint8_t>(rgba[3] * 255.f)
-        };
-    }
+void SelectionRenderer::set_bounding_geometry(const GLfloat* vertices, GLsizei num_vertices, const GLuint* indices,
+                                              GLsizei num_faces) {
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.geometry_pass.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * num_vertices * 3, vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, TRANSFER_FUNCTION_WIDTH, 0, GL_RGBA,
-        GL_UNSIGNED_BYTE, transfer_function_data.data());
-    glBindTexture(GL_TEXTURE_1D, 0);
+    // The element buffer is part of the vertex array state
+    glBindVertexArray(_gl_state.geometry_pass.vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * num_faces * 3, indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    _gl_state.geometry_pass.num_indices = num_faces * 3;
 
-    pop_opengl_debug_group();
+    _progressive.endpoints_valid = false;
+    _picking.dirty = true;
+    restart_refinement();
 }
 
 void SelectionRenderer::geometry_pass(glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix)
 {
     push_opengl_debug_group("Render Bounding Box");
 
+    if (model_matrix != _progressive.model_matrix || view_matrix != _progressive.view_matrix ||
+            proj_matrix != _progressive.proj_matrix) {
+        _progressive.model_matrix = model_matrix;
+        _progressive.view_matrix = view_matrix;
+        _progressive.proj_matrix = proj_matrix;
+        _progressive.endpoints_valid = false;
+        restart_refinement();
+    }
+
+    // The camera did not move, the entry and exit points of the last frame are still correct
+    if (_progressive.endpoints_valid) {
+        pop_opengl_debug_group();
+        return;
+    }
+    gpu_profiler().begin("Selection ray endpoints");
 
     const glm::vec4 color_transparent(0.0);
 
-    // Back up face culling state so we can restore it when we're done
+    // Back up face culling and depth state so we can restore it when we're done
     GLboolean face_culling_enabled = glIsEnabled(GL_CULL_FACE);
+    GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean depth_mask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depth_mask);
+    GLint depth_func;
+    glGetIntegerv(GL_DEPTH_FUNC, &depth_func);
 
     // Backup the previous viewport so we can restore it when we're done
     GLint old_viewport[4];
@@ -722,8 +838,10 @@ void SelectionRenderer::geometry_pass(glm::mat4 model_matrix, glm::mat4 view_mat
 
 
 
-    // We need face culling to render
+    // We need face culling to render, and depth testing where a ray crosses the geometry more than twice
     glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
 
     // Set the viewport to match the entry and exit framebuffer textures
     glViewport(0, 0, fb_tex_w, fb_tex_h);
@@ -740,17 +858,23 @@ void SelectionRenderer::geometry_pass(glm::mat4 model_matrix, glm::mat4 view_mat
     glUniformMatrix4fv(_gl_state.geometry_pass.uniform_location.projection_matrix,
         1, GL_FALSE, glm::value_ptr(proj_matrix));
 
-    // Render entry points of bounding box
+    // Render the nearest entry points of the bounding geometry
+    const GLfloat far_depth = 1.f, near_depth = 0.f;
     glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.geometry_pass.entry_framebuffer);
     glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
+    glClearBufferfv(GL_DEPTH, 0, &far_depth);
+    glDepthFunc(GL_LESS);
     glCullFace(GL_FRONT);
-    glDrawElements(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_BYTE, nullptr);
+    glDrawElements(GL_TRIANGLES, _gl_state.geometry_pass.num_indices, GL_UNSIGNED_INT, nullptr);
 
-    // Render exit points of bounding box
+    // Render the farthest exit points of the bounding geometry
     glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.geometry_pass.exit_framebuffer);
     glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
+    glClearBufferfv(GL_DEPTH, 0, &near_depth);
+    glDepthFunc(GL_GREATER);
     glCullFace(GL_BACK);
-    glDrawElements(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_BYTE, nullptr);
+    glDrawElements(GL_TRIANGLES, _gl_state.geometry_pass.num_indices, GL_UNSIGNED_INT, nullptr);
+    _progressive.endpoints_valid = true;
 
     // Restore OpenGL state
     glBindVertexArray(0);
@@ -760,12 +884,19 @@ void SelectionRenderer::geometry_pass(glm::mat4 model_matrix, glm::mat4 view_mat
     if (face_culling_enabled == GL_FALSE) {
         glDisable(GL_CULL_FACE);
     }
+    if (depth_test_enabled == GL_FALSE) {
+        glDisable(GL_DEPTH_TEST);
+    }
+    glDepthMask(depth_mask);
+    glDepthFunc(depth_func);
 
+    gpu_profiler().end();
     pop_opengl_debug_group();
 }
 
 void SelectionRenderer::volume_pass(Parameters parameters, GLuint index_texture, GLuint volume_texture) {
     push_opengl_debug_group("Render Volume");
+    gpu_profiler().begin("Selection ray casting");
 //    std::cout << "Begin render volume" << std::endl;
 
     //
@@ -774,76 +905,156 @@ void SelectionRenderer::volume_pass(Parameters parameters, GLuint index_texture,
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Restart the refinement whenever the accumulated image is out of date. Interactive frames are
+    // never accumulated, so the first frame after an interaction starts over as well.
+    if (parameters.interactive || _progressive.parameters.interactive ||
+            !same_rendering_parameters(parameters, _progressive.parameters) ||
+            index_texture != _progressive.index_texture || volume_texture != _progressive.volume_texture) {
+        restart_refinement();
+    }
+    _progressive.parameters = parameters;
+    _progressive.index_texture = index_texture;
+    _progressive.volume_texture = volume_texture;
+
+    // Once converged the accumulated image is drawn again without casting any rays
+    if (is_refining()) {
+        ray_cast_pass(parameters, index_texture, volume_texture);
+    }
+    composite_pass();
+
+//    std::cout << "End render volume" << std::endl;
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
+
+bool SelectionRenderer::is_refining() const {
+    return _progressive.parameters.interactive ||
+           _progressive.num_frames < std::max(_progressive.parameters.progressive_frames, 1);
+}
+
+const SelectionRenderer::GLState::VolumePass::Program* SelectionRenderer::volume_program(
+        bool color_by_id, int emphasize_by_selection, bool use_gradient_volume) {
+    const std::uint32_t key = std::uint32_t(color_by_id) | (std::uint32_t(emphasize_by_selection) << 1) |
+                              (std::uint32_t(use_gradient_volume) << 3);
+    return _gl_state.volume_pass.programs.get(key, {
+        { "COLOR_BY_IDENTIFIER", color_by_id ? 1 : 0 },
+        { "SELECTION_EMPHASIS", emphasize_by_selection },
+        { "USE_GRADIENT_VOLUME", use_gradient_volume ? 1 : 0 },
+    });
+}
+
+void SelectionRenderer::ray_cast_pass(const Parameters& parameters, GLuint index_texture, GLuint volume_texture) {
+    // The grid and the gradient are only built when the volume changed, by whichever renderer draws it first
+    if (!_volume || _volume->volume_texture() != volume_texture) {
+        _volume = VolumeResource::acquire(volume_texture);
+    }
+    _volume->update_minmax_grid();
+    const bool use_gradient_volume = parameters.precomputed_gradients && _volume->update_gradient();
+
+    // Emphasizing nothing and emphasizing an empty selection look the same, so both use the variant which
+    // does not read the selection
+    const int emphasis = _gl_state.volume_pass.num_selection_features == 0 ? 0 :
+                         glm::clamp(parameters.emphasize_by_selection, 0, 2);
+    const GLState::VolumePass::Program* program = volume_program(parameters.color_by_id, emphasis,
+                                                                 use_gradient_volume);
+    if (program == nullptr) {
+        return;
+    }
+    const auto& location = program->uniform_location;
 
     //
     //  Volume rendering
     //
-    glUseProgram(_gl_state.volume_pass.program_object);
+    glUseProgram(program->program);
 
-    // Parameters to tweak rendering
-    glUniform1i(_gl_state.volume_pass.uniform_location.color_by_identifier, parameters.color_by_id ? 1 : 0);
-    glUniform1i(_gl_state.volume_pass.uniform_location.selection_emphasis_type, parameters.emphasize_by_selection);
-    glUniform1f(_gl_state.volume_pass.uniform_location.highlight_factor, parameters.highlight_factor);
+    // Parameters to tweak rendering, copied into the uniform ring before the draw
+    SelectionPassBlock block = {};
+    block.highlight_factor = parameters.highlight_factor;
 
     // Entry points texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.entry_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.entry_texture, 0);
+    glUniform1i(location.entry_texture, 0);
 
     // Exit points texture
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.exit_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.entry_texture, 1);
+    glUniform1i(location.entry_texture, 1);
 
     // Volume texture
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, volume_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.volume_texture, 2);
+    glUniform1i(location.volume_texture, 2);
 
-    // Transfer function texture
+    // Preintegrated transfer function table
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.transfer_function, 3);
+    glBindTexture(GL_TEXTURE_2D, _transfer_function.preintegrated_texture());
+    glUniform1i(location.transfer_function, 3);
 
     // Index Texture
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_3D, index_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.index_volume, 4);
+    glUniform1i(location.index_volume, 4);
 
     // Selection and Contour Texture data
     glActiveTexture(GL_TEXTURE5);
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.contour_features_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.contour_features_texture, 5);
+    glUniform1i(location.contour_features_texture, 5);
 
     glActiveTexture(GL_TEXTURE6);
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.selection_features_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.selection_features_texture, 6);
+    glUniform1i(location.selection_features_texture, 6);
 
-    glUniform1ui(_gl_state.volume_pass.uniform_location.num_contour_features, _gl_state.volume_pass.num_contour_features);
-    glUniform1ui(_gl_state.volume_pass.uniform_location.num_selection_features, _gl_state.volume_pass.num_selection_features);
+    // Empty space grid. Coloring by identifier ignores the opacity of the transfer function so nothing can be skipped.
+    _empty_space.bind(location.empty_space, 7, _volume->minmax_grid(),
+                      !parameters.color_by_id);
 
-    glUniform1f(_gl_state.volume_pass.uniform_location.sampling_rate, parameters.sampling_rate);
+    // Precomputed gradient, bound even when unused so the sampler does not alias another unit
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_3D, _volume->gradient_texture());
+    glUniform1i(location.gradient_volume, 9);
 
+    block.num_contour_features = GLuint(_gl_state.volume_pass.num_contour_features);
 
-    // Rendering parameters
-    glUniform3iv(_gl_state.volume_pass.uniform_location.volume_dimensions, 1,
-        glm::value_ptr(parameters.volume_dimensions));
+    const float step_scale = parameters.interactive ? parameters.interactive_step_scale : 1.f;
+    block.sampling_rate = parameters.sampling_rate * step_scale;
 
-    glm::vec3 volume_dimensions_rcp = glm::vec3(1.f) / glm::vec3(parameters.volume_dimensions);
-    glUniform3fv(_gl_state.volume_pass.uniform_location.volume_dimensions_rcp, 1,
-        glm::value_ptr(volume_dimensions_rcp));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.light_position, 1,
-        glm::value_ptr(parameters.light_position));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.light_color_ambient, 1,
-                 glm::value_ptr(parameters.ambient));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.light_color_diffuse, 1,
-                 glm::value_ptr(parameters.diffuse));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.light_color_specular, 1,
-                 glm::value_ptr(parameters.specular));
-    glUniform1f(_gl_state.volume_pass.uniform_location.light_exponent_specular,
-                parameters.specular_exponent);
+    // Blend the new frame into the running average of the previous ones. The first frame after a restart
+    // is not jittered so it matches the regular rendering, later ones are offset by a golden ratio sequence.
+    const int read_buffer = 1 - _progressive.next_buffer;
+    const int frame = _progressive.num_frames;
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, _gl_state.composite_pass.texture[read_buffer]);
+    glUniform1i(location.previous_frame, 10);
+    block.frame_weight = 1.f / float(frame + 1);
+    block.jitter = frame == 0 ? 0.f : glm::fract(float(frame) * 0.6180339887f);
+
+
+    // Rendering parameters
+    block.volume_dimensions = parameters.volume_dimensions;
+    block.volume_dimensions_rcp = glm::vec3(1.f) / glm::vec3(parameters.volume_dimensions);
+    block.light_position = parameters.light_position;
+    block.light_color_ambient = parameters.ambient;
+    block.light_color_diffuse = parameters.diffuse;
+    block.light_color_specular = parameters.specular;
+    block.light_exponent_specular = parameters.specular_exponent;
+
+    // Render into the accumulation texture, while interacting only into its lower left part
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    GLint old_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+
+    const int downsample = parameters.interactive ? std::max(parameters.interactive_downsample, 1) : 1;
+    const glm::ivec2 size = glm::max(_progressive.size / downsample, glm::ivec2(1));
+    _uniforms.write(SELECTION_PASS_BLOCK_BINDING, block);
+    _uniforms.write(FOOTPRINT_BLOCK_BINDING,
+                    PixelFootprint::block(_progressive.view_matrix * _progressive.model_matrix,
+                                          _progressive.proj_matrix, size.y, parameters.footprint_scale));
+    const int write_buffer = _progressive.next_buffer;
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.composite_pass.framebuffer[write_buffer]);
+    glViewport(0, 0, size.x, size.y);
 
     // Bind a vao so we can render
     glBindVertexArray(_gl_state.geometry_pass.vao);
@@ -852,20 +1063,100 @@ void SelectionRenderer::volume_pass(Parameters parameters, GLuint index_texture,
 
     glBindVertexArray(0);
 
-//    std::cout << "End render volume" << std::endl;
-    pop_opengl_debug_group();
+    glBindFramebuffer(GL_FRAMEBUFFER, old_framebuffer);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+
+    _progressive.displayed_buffer = write_buffer;
+    _progressive.displayed_uv_scale = glm::vec2(size) / glm::vec2(glm::max(_progressive.size, glm::ivec2(1)));
+    _progressive.next_buffer = 1 - write_buffer;
+    if (!parameters.interactive) {
+        _progressive.num_frames++;
+    }
+}
+
+void SelectionRenderer::composite_pass() {
+    if (_progressive.displayed_buffer < 0) {
+        return;
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgram(_gl_state.composite_pass.program_object);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _gl_state.composite_pass.texture[_progressive.displayed_buffer]);
+    glUniform1i(_gl_state.composite_pass.uniform_location.frame, 0);
+    glUniform2fv(_gl_state.composite_pass.uniform_location.uv_scale, 1,
+                 glm::value_ptr(_progressive.displayed_uv_scale));
+
+    glBindVertexArray(_gl_state.geometry_pass.vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+    glUseProgram(0);
 }
 
 glm::vec3 SelectionRenderer::picking_pass(Parameters parameters, glm::ivec2 mouse_position, GLuint index_texture, GLuint volume_texture) {
+    // Pick up the results of earlier frames that are ready by now
+    resolve_picking_readbacks();
+
+    if (!_picking.dirty && mouse_position == _picking.mouse_position &&
+            _progressive.model_matrix == _picking.model_matrix && _progressive.view_matrix == _picking.view_matrix &&
+            _progressive.proj_matrix == _picking.proj_matrix && parameters.sampling_rate == _picking.sampling_rate &&
+            index_texture == _picking.index_texture && volume_texture == _picking.volume_texture) {
+        return _picking.result;
+    }
+    _picking.dirty = false;
+    _picking.mouse_position = mouse_position;
+    _picking.model_matrix = _progressive.model_matrix;
+    _picking.view_matrix = _progressive.view_matrix;
+    _picking.proj_matrix = _progressive.proj_matrix;
+    _picking.sampling_rate = parameters.sampling_rate;
+    _picking.index_texture = index_texture;
+    _picking.volume_texture = volume_texture;
+
+    GLint fb_tex_w, fb_tex_h;
+    glBindTexture(GL_TEXTURE_2D, _gl_state.picking_pass.picking_texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &fb_tex_w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &fb_tex_h);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (mouse_position.x < 0 || mouse_position.y < 0 || mouse_position.x >= fb_tex_w || mouse_position.y >= fb_tex_h) {
+        // Nothing can be under a cursor outside of the view, pending picks from inside are stale as well
+        for (GLsync& fence : _picking.fence) {
+            if (fence != nullptr) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+        _picking.result = glm::vec3(0.f);
+        return _picking.result;
+    }
+
+    // If the ring is full the oldest read back is dropped, a newer one supersedes it anyway
+    const int buffer = _picking.next_buffer;
+    if (_picking.fence[buffer] != nullptr) {
+        glDeleteSync(_picking.fence[buffer]);
+        _picking.fence[buffer] = nullptr;
+    }
+
     glUseProgram(_gl_state.picking_pass.program_object);
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_3D, index_texture);
     glUniform1i(_gl_state.picking_pass.uniform_location.index_volume, 4);
 
     push_opengl_debug_group("Pick Volume");
+    gpu_profiler().begin("Selection picking");
 //    std::cout << "Begin pick volume" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.picking_pass.picking_framebuffer);
 
+    // Only ray cast the few pixels around the cursor, the clear is limited by the scissor rectangle as well
+    constexpr GLint PICKING_RADIUS = 1;
+    const GLboolean scissor_test_enabled = glIsEnabled(GL_SCISSOR_TEST);
+    GLint old_scissor_box[4];
+    glGetIntegerv(GL_SCISSOR_BOX, old_scissor_box);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(mouse_position.x - PICKING_RADIUS, mouse_position.y - PICKING_RADIUS,
+              2 * PICKING_RADIUS + 1, 2 * PICKING_RADIUS + 1);
+
     glClear(GL_COLOR_BUFFER_BIT);
 
     glUseProgram(_gl_state.picking_pass.program_object);
@@ -887,7 +1178,7 @@ glm::vec3 SelectionRenderer::picking_pass(Parameters parameters, glm::ivec2 mous
 
     // Transfer function texture
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
+    glBindTexture(GL_TEXTURE_1D, _transfer_function.texture());
     glUniform1i(_gl_state.picking_pass.uniform_location.transfer_function, 3);
 
     glUniform1f(_gl_state.picking_pass.uniform_location.sampling_rate,
@@ -911,45 +1202,185 @@ glm::vec3 SelectionRenderer::picking_pass(Parameters parameters, glm::ivec2 mous
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glUseProgram(0);
 
-    GLfloat colors[3];
-    glReadPixels(mouse_position.x, mouse_position.y, 1, 1, GL_RGB, GL_FLOAT, colors);
+    // Copy the pixel into the pixel buffer on the GPU, it is mapped once the fence signals
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.picking_pass.pixel_buffer[buffer]);
+    glReadPixels(mouse_position.x, mouse_position.y, 1, 1, GL_RGB, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _picking.fence[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _picking.next_buffer = (buffer + 1) % NUM_PICKING_BUFFERS;
 
+    glScissor(old_scissor_box[0], old_scissor_box[1], old_scissor_box[2], old_scissor_box[3]);
+    if (scissor_test_enabled == GL_FALSE) {
+        glDisable(GL_SCISSOR_TEST);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glBindVertexArray(0);
 
+    gpu_profiler().end();
     pop_opengl_debug_group();
 
-    return {
-        colors[0],
-        colors[1],
-        colors[2]
-    };
+    return _picking.result;
+}
+
+bool SelectionRenderer::is_picking() const {
+    return std::any_of(std::begin(_picking.fence), std::end(_picking.fence),
+                       [](GLsync fence) { return fence != nullptr; });
+}
+
+void SelectionRenderer::resolve_picking_readbacks() {
+    // Oldest to newest so the most recent finished pick ends up in the result
+    for (int i = 0; i < NUM_PICKING_BUFFERS; i++) {
+        const int buffer = (_picking.next_buffer + i) % NUM_PICKING_BUFFERS;
+        GLsync& fence = _picking.fence[buffer];
+        if (fence == nullptr) {
+            continue;
+        }
+        const GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            continue;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _gl_state.picking_pass.pixel_buffer[buffer]);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLfloat) * 3, GL_MAP_READ_BIT);
+        if (data != nullptr) {
+            GLfloat colors[3];
+            std::memcpy(colors, data, sizeof(colors));
+            _picking.result = glm::vec3(colors[0], colors[1], colors[2]);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
 }
 
 void SelectionRenderer::set_contour_data(uint32_t* contour_features, size_t num_features) {
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.contour_features_texture);
     glTexImage1D(GL_TEXTURE_1D, 0, GL_R32UI, num_features-1, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, (const GLvoid*) (&contour_features[1]));
     glBindTexture(GL_TEXTURE_1D, 0);
+    _gl_state.volume_pass.contour_features_width = num_features - 1;
+    _gl_state.volume_pass.num_contour_features = contour_features[0];
+    _picking.dirty = true;
+    restart_refinement();
+}
+
+void SelectionRenderer::update_contour_data(uint32_t* contour_features, size_t num_features, size_t changed_begin,
+                                            size_t changed_end) {
+    if (num_features - 1 != _gl_state.volume_pass.contour_features_width) {
+        set_contour_data(contour_features, num_features);
+        return;
+    }
+    if (changed_begin < changed_end) {
+        // Texel i holds contour_features[i + 1]
+        glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.contour_features_texture);
+        glTexSubImage1D(GL_TEXTURE_1D, 0, GLint(changed_begin - 1), GLsizei(changed_end - changed_begin),
+                        GL_RED_INTEGER, GL_UNSIGNED_INT, (const GLvoid*) (&contour_features[changed_begin]));
+        glBindTexture(GL_TEXTURE_1D, 0);
+    }
     _gl_state.volume_pass.num_contour_features = contour_features[0];
+    _picking.dirty = true;
+    restart_refinement();
 }
 
 void SelectionRenderer::set_selection_data(uint32_t* selection_list, size_t num_features) {
+    // The shader tests membership with a single fetch from a bitset indexed by the feature, instead of
+    // searching the list of selected features for every sample
+    const std::uint32_t num_selected = num_features > 0 ? selection_list[0] : 0;
+    // The bitset covers every feature of the contour data, so that it keeps its size while features are
+    // (de)selected and an update is a sub image of the words that changed
+    std::uint32_t max_feature = _gl_state.volume_pass.num_contour_features;
+    for (std::uint32_t i = 0; i < num_selected; i++) {
+        max_feature = std::max(max_feature, selection_list[i + 1]);
+    }
+    const std::size_t num_words = std::max<std::size_t>(max_feature / 32 + 1,
+                                                        _gl_state.volume_pass.selection_features_width);
+    _next_selection_bits.assign(num_words, 0);
+    for (std::uint32_t i = 0; i < num_selected; i++) {
+        const std::uint32_t feature = selection_list[i + 1];
+        _next_selection_bits[feature / 32] |= std::uint32_t(1) << (feature % 32);
+    }
+
     glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.selection_features_texture);
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32UI, num_features, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, (const GLvoid*) (&selection_list[1]));
+    if (num_words != _gl_state.volume_pass.selection_features_width || _selection_bits.size() != num_words) {
+        glTexImage1D(GL_TEXTURE_1D, 0, GL_R32UI, num_words, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                     (const GLvoid*) _next_selection_bits.data());
+        _gl_state.volume_pass.selection_features_width = num_words;
+    } else {
+        std::size_t changed_begin = 0;
+        while (changed_begin < num_words && _next_selection_bits[changed_begin] == _selection_bits[changed_begin]) {
+            changed_begin++;
+        }
+        std::size_t changed_end = num_words;
+        while (changed_end > changed_begin && _next_selection_bits[changed_end - 1] == _selection_bits[changed_end - 1]) {
+            changed_end--;
+        }
+        if (changed_begin < changed_end) {
+            glTexSubImage1D(GL_TEXTURE_1D, 0, GLint(changed_begin), GLsizei(changed_end - changed_begin),
+                            GL_RED_INTEGER, GL_UNSIGNED_INT, (const GLvoid*) (&_next_selection_bits[changed_begin]));
+        }
+    }
     glBindTexture(GL_TEXTURE_1D, 0);
-    _gl_state.volume_pass.num_selection_features = selection_list[0];
+    _selection_bits.swap(_next_selection_bits);
+    _gl_state.volume_pass.num_selection_features = num_selected;
+    restart_refinement();
+}
+
+GLenum SelectionRenderer::endpoint_format() const {
+    return _half_precision ? GL_RGBA16F : GL_RGBA32F;
+}
+
+GLenum SelectionRenderer::color_format() const {
+    return _half_precision ? GL_RGBA16F : GL_RGBA32F;
+}
+
+void SelectionRenderer::set_half_precision(bool half_precision) {
+    if (half_precision == _half_precision) {
+        return;
+    }
+    _half_precision = half_precision;
+    if (_gl_state.geometry_pass.entry_texture != 0) {
+        // Reallocate the render targets in the new format
+        resize_framebuffer(_progressive.size);
+    }
 }
 
 void SelectionRenderer::resize_framebuffer(glm::ivec2 framebuffer_size) {
     // Entry point texture and frame buffer
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.entry_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, framebuffer_size.x, framebuffer_size.y, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), framebuffer_size.x, framebuffer_size.y, 0,
         GL_RGBA, GL_FLOAT, nullptr);
 
     // Exit point texture and frame buffer
     glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.exit_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, framebuffer_size.x, framebuffer_size.y, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), framebuffer_size.x, framebuffer_size.y, 0,
         GL_RGBA, GL_FLOAT, nullptr);
 
+    glBindTexture(GL_TEXTURE_2D, _gl_state.geometry_pass.depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, framebuffer_size.x, framebuffer_size.y, 0,
+        GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
     glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Picking texture
+    glBindTexture(GL_TEXTURE_2D, _gl_state.picking_pass.picking_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, framebuffer_size.x, framebuffer_size.y, 0,
+        GL_RGB, GL_FLOAT, nullptr);
+
+    // Accumulation textures, the old contents do not match the new size anymore
+    const glm::vec4 color_transparent(0.0);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, _gl_state.composite_pass.texture[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, color_format(), framebuffer_size.x, framebuffer_size.y, 0,
+            GL_RGBA, GL_FLOAT, nullptr);
+        glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.composite_pass.framebuffer[i]);
+        glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _progressive.size = framebuffer_size;
+    _progressive.displayed_buffer = -1;
+    _progressive.endpoints_valid = false;
+    _picking.dirty = true;
+    restart_refinement();
 }
@@ -2,10 +2,16 @@
 #define __VOLUME_RENDERING_H__
 
 #include <glad/glad.h>
+#include <memory>
 #include <vector>
 #include <glm/glm.hpp>
 
 #include "volume_renderer.h"
+#include "empty_space_grid.h"
+#include "pixel_footprint.h"
+#include "shader_variants.h"
+#include "uniform_ring.h"
+#include "volume_resource.h"
 
 struct Parameters {
     glm::ivec3 volume_dimensions = { 0, 0, 0 };
@@ -27,9 +33,27 @@ struct Parameters {
 
     // Color components based on their identifier
     bool color_by_id = true;
+
+    // Shade with a gradient volume computed once per volume instead of a central difference per sample
+    bool precomputed_gradients = true;
+
+    // While interactive (e.g. the camera is being dragged) the volume is rendered at 1/interactive_downsample
+    // of the resolution with interactive_step_scale times larger steps and upsampled. Afterwards
+    // progressive_frames full resolution frames with jittered ray offsets are averaged, and the converged
+    // image is reused without ray casting until the camera or a parameter changes.
+    bool interactive = false;
+    int interactive_downsample = 2;
+    float interactive_step_scale = 2.f;
+    int progressive_frames = 8;
+
+    // Where a pixel covers several voxels the step grows to footprint_scale times its width, but never below
+    // sampling_rate. 0 always steps sampling_rate.
+    float footprint_scale = 1.f;
 };
 
 class SelectionRenderer {
+    static constexpr int NUM_PICKING_BUFFERS = 3;
+
     struct GLState {
         struct GeometryPass {
             GLuint vao = 0;
@@ -42,6 +66,10 @@ class SelectionRenderer {
             GLuint exit_framebuffer = 0;
             GLuint exit_texture = 0;
 
+            // Shared by both framebuffers, the bounding geometry need not be convex
+            GLuint depth_texture = 0;
+            GLsizei num_indices = 0;
+
             GLuint program = 0;
             struct {
                 GLint model_matrix = 0;
@@ -51,42 +79,51 @@ class SelectionRenderer {
         } geometry_pass;
 
         struct VolumePass {
-            GLuint program_object = 0;
-            GLuint transfer_function_texture;
+            // One program per combination of the options compiled into the shader, see volume_program()
+            struct Program {
+                GLuint program = 0;
+                struct {
+                    GLint entry_texture = 0;
+                    GLint exit_texture = 0;
+                    GLint volume_texture = 0;
+                    GLint transfer_function = 0;
+
+                    GLint contour_features_texture;
+                    GLint selection_features_texture;
+
+                    GLuint index_volume = 0;
+
+                    EmptySpaceGrid::UniformLocations empty_space;
+                    GLint gradient_volume = -1;
+
+                    GLint previous_frame = -1;
+                } uniform_location;
+            };
+            ShaderVariants<Program> programs;
 
             GLuint contour_features_texture;
             GLuint selection_features_texture;
 
             GLuint num_contour_features;
             GLuint num_selection_features;
+            // Texels of contour_features_texture, 0 until set_contour_data uploaded it
+            size_t contour_features_width = 0;
+            // Texels of selection_features_texture, it only grows so most selections upload just the changed words
+            size_t selection_features_width = 0;
+        } volume_pass;
 
-            struct {
-                GLint entry_texture = 0;
-                GLint exit_texture = 0;
-                GLint volume_texture = 0;
-                GLint transfer_function = 0;
-
-                GLint volume_dimensions = 0;
-                GLint volume_dimensions_rcp = 0;
-                GLint sampling_rate = 0;
-
-                GLint light_position = 0;
-                GLint light_color_ambient = 0;
-                GLint light_color_diffuse = 0;
-                GLint light_color_specular = 0;
-                GLint light_exponent_specular = 0;
+        struct CompositePass {
+            GLuint program_object = 0;
 
-                GLint contour_features_texture;
-                GLint selection_features_texture;
-                GLint num_contour_features;
-                GLint num_selection_features;
+            // Ping-pong accumulation of the progressively refined frames
+            GLuint framebuffer[2] = { 0, 0 };
+            GLuint texture[2] = { 0, 0 };
 
-                GLuint index_volume = 0;
-                GLuint color_by_identifier = 0;
-                GLuint selection_emphasis_type = 0;
-                GLuint highlight_factor = 0;
+            struct {
+                GLint frame = -1;
+                GLint uv_scale = -1;
             } uniform_location;
-        } volume_pass;
+        } composite_pass;
 
         struct PickingPass {
             GLuint program_object = 0;
@@ -94,6 +131,9 @@ class SelectionRenderer {
             GLuint picking_framebuffer = 0;
             GLuint picking_texture = 0;
 
+            // Ring of pixel pack buffers the picked pixel is read back into without stalling
+            GLuint pixel_buffer[NUM_PICKING_BUFFERS] = { 0, 0, 0 };
+
             struct {
                 GLint entry_texture = 0;
                 GLint exit_texture = 0;
@@ -111,22 +151,113 @@ class SelectionRenderer {
         } picking_pass;
     } _gl_state;
 
+    // The selection bitset last uploaded to selection_features_texture and the one being built
+    std::vector<std::uint32_t> _selection_bits;
+    std::vector<std::uint32_t> _next_selection_bits;
+
+    EmptySpaceGrid _empty_space;
+    TransferFunctionTexture _transfer_function;
+    // The parameters of the volume pass, see ray_cast_pass()
+    UniformRing _uniforms;
+    // Min/max grid and gradient of the volume last ray cast, shared with the other renderers of the volume
+    std::shared_ptr<VolumeResource> _volume;
+
+    struct {
+        glm::ivec2 size = { 0, 0 };
+        int num_frames = 0;
+        int next_buffer = 0;
+        int displayed_buffer = -1;
+        glm::vec2 displayed_uv_scale = { 1.f, 1.f };
+
+        // Inputs of the accumulated image, a change restarts the refinement
+        glm::mat4 model_matrix = glm::mat4(0.f);
+        glm::mat4 view_matrix = glm::mat4(0.f);
+        glm::mat4 proj_matrix = glm::mat4(0.f);
+        Parameters parameters;
+        GLuint index_texture = 0;
+        GLuint volume_texture = 0;
+
+        // The entry and exit point textures hold the bounding geometry for the matrices above
+        bool endpoints_valid = false;
+    } _progressive;
+
+    // Read backs of the picking pass still in flight, a fence per pixel buffer of the ring
+    struct {
+        GLsync fence[NUM_PICKING_BUFFERS] = { nullptr, nullptr, nullptr };
+        int next_buffer = 0;
+        glm::vec3 result = glm::vec3(0.f);
+
+        // Inputs of the last issued pick, the pass is skipped if none of them changed
+        bool dirty = true;
+        glm::ivec2 mouse_position = glm::ivec2(-1);
+        glm::mat4 model_matrix = glm::mat4(0.f);
+        glm::mat4 view_matrix = glm::mat4(0.f);
+        glm::mat4 proj_matrix = glm::mat4(0.f);
+        float sampling_rate = 0.f;
+        GLuint index_texture = 0;
+        GLuint volume_texture = 0;
+    } _picking;
+
+    // Entry and exit points and the accumulated frames are stored in 16 bit floats unless disabled.
+    // The picking texture always stays at full precision so feature numbers are exact.
+    bool _half_precision = true;
+    GLenum endpoint_format() const;
+    GLenum color_format() const;
+
+    void restart_refinement() { _progressive.num_frames = 0; }
+    void resolve_picking_readbacks();
+    // The variant of the volume pass for these options, built the first time they are used
+    const GLState::VolumePass::Program* volume_program(bool color_by_id, int emphasize_by_selection,
+                                                      bool use_gradient_volume);
+    void ray_cast_pass(const Parameters& parameters, GLuint index_texture, GLuint volume_texture);
+    void composite_pass();
+
 public:
+    // GLSL of colormap(x), the rainbow features are colored with by their identifier. Insert this after the
+    // #version line, FeatureMeshRenderer uses it as well so both show a feature in the same color.
+    static const char* const COLORMAP_GLSL;
+
     const GLState& gl_state() const { return _gl_state; }
 
     // Buffer contents:
     // [0]: number of features
     // [...]: A linearized map from voxel identifier -> feature number
     void set_contour_data(uint32_t* contour_features, size_t num_features);
+    // Like set_contour_data for a buffer of the same size of which only [changed_begin, changed_end) changed.
+    // Only that range is uploaded, unless the size differs from the last upload.
+    void update_contour_data(uint32_t* contour_features, size_t num_features, size_t changed_begin,
+                             size_t changed_end);
+    // [0]: number of selected features
+    // [...]: The selected feature numbers
+    // Only the words of the selection bitset that changed since the last call are uploaded.
     void set_selection_data(uint32_t* selection_list, size_t num_features);
     void resize_framebuffer(glm::ivec2 framebuffer_size);
+    // See VolumeRenderer::set_half_precision
+    void set_half_precision(bool half_precision);
+    bool half_precision() const { return _half_precision; }
     void set_transfer_function(const std::vector<TfNode>& tf);
+    // Replace the unit cube rays enter and leave the volume at by a closed mesh inside of it, e.g. the hull of an
+    // OccupancyHull. Vertices are in [0, 1]^3 and faces counterclockwise seen from outside. The geometry does not
+    // have to be convex: rays start at its nearest front face and end at its farthest back face.
+    void set_bounding_geometry(const GLfloat* vertices, GLsizei num_vertices, const GLuint* indices,
+                               GLsizei num_faces);
 
     void initialize(const glm::ivec2& viewport_size);
     void destroy();
+    // True between initialize and destroy. The renderer can stay initialized while its screen is not shown, the
+    // programs, render targets and uploaded data are used again when it is.
+    bool is_initialized() const { return _gl_state.geometry_pass.program != 0; }
 
     void geometry_pass(glm::mat4 model_matrix, glm::mat4 view_matrix, glm::mat4 proj_matrix);
     void volume_pass(Parameters parameters, GLuint index_texture, GLuint volume_texture);
+    // True while the progressive refinement has not converged yet, i.e. another frame should be drawn
+    bool is_refining() const;
+
+    // Picks the feature under mouse_position. Only a few pixels around the cursor are ray cast and the result is
+    // read back asynchronously, so the returned value is the pick of an earlier frame (usually the previous one).
+    // Nothing is rendered if neither the mouse, the camera nor the picking inputs changed.
+    // True while a pick issued by picking_pass has not been read back yet
+    bool is_picking() const;
     glm::vec3 picking_pass(Parameters parameters, glm::ivec2 mouse_position, GLuint index_texture, GLuint volume_texture);
 
 };
@@ -0,0 +1,303 @@
+#include "shader_cache.h"
+
+#include <GLFW/glfw3.h>
+#include <igl/opengl/load_shader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "utils/metrics.h"
+#include "utils/path_utils.h"
+#include "utils/trace.h"
+
+// The viewer only asks for a 3.2 context, so the program binary entry points are looked up at runtime
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint, GLenum, const void*, GLsizei);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint, GLenum, GLint);
+
+// Start of every cache file, followed by the binary format and the binary
+constexpr std::uint32_t CACHE_FILE_MAGIC = 0x43485346; // "FSHC"
+
+struct ShaderCache {
+    std::string directory;
+    // Vendor, renderer and version of the driver, binaries only load on the driver that built them
+    std::string driver;
+    std::shared_ptr<spdlog::logger> logger;
+    GetProgramBinaryProc get_program_binary = nullptr;
+    ProgramBinaryProc program_binary = nullptr;
+    ProgramParameteriProc program_parameteri = nullptr;
+};
+
+ShaderCache& shader_cache() {
+    static ShaderCache cache;
+    return cache;
+}
+
+// FNV-1a over the bytes and then the length of s, so that consecutive strings cannot run into each other
+void hash_string(std::uint64_t& hash, const std::string& s) {
+    for (unsigned char c : s) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    const std::uint64_t length = s.size();
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ ((length >> (8 * i)) & 0xff)) * 1099511628211ull;
+    }
+}
+
+std::string cache_filename(const std::string& geom_source, const std::string& vert_source,
+                           const std::string& frag_source, const std::map<std::string, GLuint>& attrib,
+                           const std::map<std::string, GLuint>& frag_data) {
+    std::uint64_t hash = 14695981039346656037ull;
+    hash_string(hash, shader_cache().driver);
+    hash_string(hash, geom_source);
+    hash_string(hash, vert_source);
+    hash_string(hash, frag_source);
+    for (const std::map<std::string, GLuint>* bindings : { &attrib, &frag_data }) {
+        hash_string(hash, std::to_string(bindings->size()));
+        for (const auto& b : *bindings) {
+            hash_string(hash, b.first);
+            hash_string(hash, std::to_string(b.second));
+        }
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+    return shader_cache().directory + "/" + name;
+}
+
+bool is_linked(GLuint program) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked == GL_TRUE;
+}
+
+void log_link_error(GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    std::string log(std::size_t(std::max(length, 1)), '\0');
+    glGetProgramInfoLog(program, GLsizei(log.size()), nullptr, &log[0]);
+    if (shader_cache().logger) {
+        shader_cache().logger->error("Failed to link shader program: {}", log.c_str());
+    } else {
+        std::cerr << "Failed to link shader program: " << log.c_str() << std::endl;
+    }
+}
+
+// Link a program from the binary in filename, returns 0 if there is none or the driver rejects it
+GLuint load_program_binary(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    std::uint32_t magic = 0;
+    GLenum format = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&format), sizeof(format));
+    if (!in || magic != CACHE_FILE_MAGIC) {
+        return 0;
+    }
+    const std::vector<char> binary((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (binary.empty()) {
+        return 0;
+    }
+
+    const GLuint program = glCreateProgram();
+    shader_cache().program_binary(program, format, binary.data(), GLsizei(binary.size()));
+    if (!is_linked(program)) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void store_program_binary(const std::string& filename, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(static_cast<std::size_t>(length));
+    GLsizei written = 0;
+    GLenum format = 0;
+    shader_cache().get_program_binary(program, length, &written, &format, binary.data());
+    if (written <= 0) {
+        return;
+    }
+
+    // Written next to the cache file and renamed over it, so a crash never leaves a truncated binary behind
+    const std::string temp_filename = filename + ".tmp";
+    {
+        std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&CACHE_FILE_MAGIC), sizeof(CACHE_FILE_MAGIC));
+        out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        out.write(binary.data(), written);
+        if (!out) {
+            shader_cache().logger->warn("Could not write the shader cache file '{}'", temp_filename);
+            return;
+        }
+    }
+    // rename does not replace an existing file on Windows
+    std::remove(filename.c_str());
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        shader_cache().logger->warn("Could not write the shader cache file '{}'", filename);
+        std::remove(temp_filename.c_str());
+    }
+}
+
+// Like igl::opengl::create_shader_program, and the binary can be read back if the cache is on
+GLuint compile_program(const std::string& geom_source, const std::string& vert_source,
+                       const std::string& frag_source, const std::map<std::string, GLuint>& attrib,
+                       const std::map<std::string, GLuint>& frag_data) {
+    const GLuint program = glCreateProgram();
+    std::vector<GLuint> shaders;
+    if (!geom_source.empty()) {
+        shaders.push_back(igl::opengl::load_shader(geom_source, GL_GEOMETRY_SHADER));
+    }
+    if (!vert_source.empty()) {
+        shaders.push_back(igl::opengl::load_shader(vert_source, GL_VERTEX_SHADER));
+    }
+    if (!frag_source.empty()) {
+        shaders.push_back(igl::opengl::load_shader(frag_source, GL_FRAGMENT_SHADER));
+    }
+    for (GLuint shader : shaders) {
+        glAttachShader(program, shader);
+    }
+    for (const auto& a : attrib) {
+        glBindAttribLocation(program, a.second, a.first.c_str());
+    }
+    for (const auto& f : frag_data) {
+        glBindFragDataLocation(program, f.second, f.first.c_str());
+    }
+    if (shader_cache().program_parameteri) {
+        shader_cache().program_parameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    for (GLuint shader : shaders) {
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    return program;
+}
+
+} // namespace
+
+
+bool init_shader_cache(const std::string& directory, std::shared_ptr<spdlog::logger> logger) {
+    ShaderCache& cache = shader_cache();
+    cache.logger = logger;
+    cache.directory.clear();
+
+    std::string cache_directory = directory;
+    if (const char* override_directory = std::getenv("FISH_SHADER_CACHE")) {
+        cache_directory = override_directory;
+    }
+    if (cache_directory.empty()) {
+        logger->debug("The shader cache is off");
+        return false;
+    }
+
+    GLint num_formats = 0;
+    if (glfwExtensionSupported("GL_ARB_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+        cache.get_program_binary = reinterpret_cast<GetProgramBinaryProc>(glfwGetProcAddress("glGetProgramBinary"));
+        cache.program_binary = reinterpret_cast<ProgramBinaryProc>(glfwGetProcAddress("glProgramBinary"));
+        cache.program_parameteri = reinterpret_cast<ProgramParameteriProc>(glfwGetProcAddress("glProgramParameteri"));
+    }
+    if (num_formats <= 0 || !cache.get_program_binary || !cache.program_binary) {
+        logger->info("The driver cannot store program binaries, shaders are compiled every time");
+        cache.get_program_binary = nullptr;
+        cache.program_binary = nullptr;
+        cache.program_parameteri = nullptr;
+        return false;
+    }
+
+    mkpath(cache_directory.c_str());
+    if (get_file_type(cache_directory.c_str()) != FT_DIRECTORY) {
+        logger->warn("Could not create the shader cache directory '{}', shaders are compiled every time", cache_directory);
+        return false;
+    }
+
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION }) {
+        const GLubyte* value = glGetString(name);
+        cache.driver += value ? reinterpret_cast<const char*>(value) : "";
+        cache.driver += '\n';
+    }
+    cache.directory = cache_directory;
+    logger->debug("Caching shader programs in '{}'", cache.directory);
+    return true;
+}
+
+std::string default_shader_cache_directory() {
+#ifdef _WIN32
+    if (const char* local_app_data = std::getenv("LOCALAPPDATA")) {
+        return std::string(local_app_data) + "/fish/shaders";
+    }
+#else
+    const char* xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+    if (xdg_cache_home && xdg_cache_home[0] != '\0') {
+        return std::string(xdg_cache_home) + "/fish/shaders";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/fish/shaders";
+    }
+#endif
+    return std::string();
+}
+
+bool shader_cache_enabled() {
+    return !shader_cache().directory.empty();
+}
+
+bool create_cached_shader_program(const std::string& geom_source, const std::string& vert_source,
+                                  const std::string& frag_source, const std::map<std::string, GLuint>& attrib,
+                                  GLuint& id, const std::map<std::string, GLuint>& frag_data) {
+    TRACE_SCOPE("create_shader_program");
+    static metrics::Counter& hits = metrics::counter("unwind_shader_cache_hits_total",
+                                                     "Shader programs loaded from the shader cache");
+    static metrics::Counter& misses = metrics::counter("unwind_shader_cache_misses_total",
+                                                       "Shader programs compiled while the shader cache is on");
+
+    const bool cached = shader_cache_enabled();
+    const std::string filename = cached ? cache_filename(geom_source, vert_source, frag_source, attrib, frag_data)
+                                        : std::string();
+    if (cached) {
+        id = load_program_binary(filename);
+        if (id != 0) {
+            hits.add();
+            return true;
+        }
+        misses.add();
+    }
+
+    id = compile_program(geom_source, vert_source, frag_source, attrib, frag_data);
+    if (!is_linked(id)) {
+        log_link_error(id);
+        return false;
+    }
+    if (cached) {
+        store_program_binary(filename, id);
+    }
+    return true;
+}
+
+bool create_cached_shader_program(const std::string& vert_source, const std::string& frag_source,
+                                  const std::map<std::string, GLuint>& attrib, GLuint& id) {
+    return create_cached_shader_program(std::string(), vert_source, frag_source, attrib, id);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+// On-disk cache of linked shader programs, through GL_ARB_get_program_binary. Compiling the shaders is what
+// makes the first frame of a screen slow, especially on Windows drivers, while loading a binary the driver built
+// before only takes a moment.
+//
+// A program is cached under a hash of its sources, its attribute bindings and the vendor, renderer and version
+// strings of the driver, so a driver update or an edit of a shader misses the cache and compiles the sources
+// again. Binaries the driver rejects are compiled again and overwritten. Without the extension, or if the
+// directory cannot be created, every program is compiled as before.
+
+// Cache linked programs in directory, an empty directory turns the cache off. The environment variable
+// FISH_SHADER_CACHE overrides the directory, set it to an empty value to turn the cache off. Needs a current
+// context, programs created before this are compiled from the sources.
+bool init_shader_cache(const std::string& directory, std::shared_ptr<spdlog::logger> logger);
+
+// Per user directory for the cache: %LOCALAPPDATA%/fish/shaders on Windows, $XDG_CACHE_HOME/fish/shaders
+// or ~/.cache/fish/shaders elsewhere. Empty if none of the variables is set.
+std::string default_shader_cache_directory();
+
+bool shader_cache_enabled();
+
+// Same as igl::opengl::create_shader_program, but the program is loaded from the cache if it is there and stored
+// in it otherwise. Returns false, and logs the info log, if the program fails to link. The outputs in frag_data
+// are bound to their color attachments before linking, a program loaded from a binary cannot be linked again.
+bool create_cached_shader_program(const std::string& geom_source, const std::string& vert_source,
+                                  const std::string& frag_source, const std::map<std::string, GLuint>& attrib,
+                                  GLuint& id,
+                                  const std::map<std::string, GLuint>& frag_data = std::map<std::string, GLuint>());
+bool create_cached_shader_program(const std::string& vert_source, const std::string& frag_source,
+                                  const std::map<std::string, GLuint>& attrib, GLuint& id);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// #defines of one variant of a shader as (name, value) pairs
+typedef std::vector<std::pair<std::string, int>> ShaderDefines;
+
+// The defines as GLSL, one line each, to be placed after the #version line of a shader
+inline std::string shader_defines_source(const ShaderDefines& defines) {
+    std::string source;
+    for (const std::pair<std::string, int>& define : defines) {
+        source += "#define " + define.first + " " + std::to_string(define.second) + "\n";
+    }
+    return source;
+}
+
+// Programs built from the same sources for different values of a few options. The shaders test the options
+// with #if instead of branching on uniforms, so the inner loop of each variant only does the work of its own
+// configuration. A variant is built the first time it is asked for, the program binary cache (see
+// shader_cache.h) makes that cheap from the second run on, and is kept until destroy().
+//
+// Program is a struct holding the GLuint program and whatever uniform locations its users need.
+template<typename Program>
+class ShaderVariants {
+public:
+    // Compile and link the variant with the given defines into program.program and look up its uniforms.
+    // Returns false if it failed to link.
+    typedef std::function<bool(const ShaderDefines& defines, Program& program)> BuildFunction;
+
+    void init(BuildFunction build) { _build = std::move(build); }
+
+    void destroy() {
+        for (std::pair<const std::uint32_t, Program>& variant : _variants) {
+            glDeleteProgram(variant.second.program);
+        }
+        _variants.clear();
+        _build = nullptr;
+    }
+
+    // The variant identified by key, which must stand for exactly these defines. It is built on the first call
+    // for key. nullptr if it failed to build, it is not built again.
+    const Program* get(std::uint32_t key, const ShaderDefines& defines) {
+        typename std::map<std::uint32_t, Program>::iterator it = _variants.find(key);
+        if (it == _variants.end()) {
+            Program program;
+            if (!_build || !_build(defines, program)) {
+                glDeleteProgram(program.program);
+                program.program = 0;
+            }
+            it = _variants.emplace(key, program).first;
+        }
+        return it->second.program != 0 ? &it->second : nullptr;
+    }
+
+    std::size_t num_built() const { return _variants.size(); }
+
+private:
+    BuildFunction _build;
+    std::map<std::uint32_t, Program> _variants;
+};
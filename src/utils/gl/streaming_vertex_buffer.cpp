@@ -0,0 +1,147 @@
+#include "streaming_vertex_buffer.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstring>
+
+// The viewer only asks for a 3.2 context, so glBufferStorage is looked up at runtime
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace {
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+BufferStorageProc buffer_storage() {
+    static BufferStorageProc proc = glfwExtensionSupported("GL_ARB_buffer_storage") ?
+                reinterpret_cast<BufferStorageProc>(glfwGetProcAddress("glBufferStorage")) : nullptr;
+    return proc;
+}
+
+constexpr std::size_t MIN_CAPACITY = 1024;
+
+} // namespace
+
+
+void StreamingVertexBuffer::destroy() {
+    for (GLsync& fence : _fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (_buffer != 0) {
+        // Deleting the buffer also unmaps it
+        glDeleteBuffers(1, &_buffer);
+        _buffer = 0;
+    }
+    _persistent_ptr = nullptr;
+    _capacity = 0;
+    _current = 0;
+}
+
+void StreamingVertexBuffer::resize(std::size_t num_floats) {
+    const std::size_t old_size = _data.size();
+    _data.resize(num_floats, 0.0f);
+    if (num_floats > old_size) {
+        mark_dirty(old_size, num_floats);
+    }
+}
+
+void StreamingVertexBuffer::write(std::size_t first, const GLfloat* values, std::size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (first + count > _data.size()) {
+        resize(first + count);
+    }
+    std::copy(values, values + count, _data.begin() + first);
+    mark_dirty(first, first + count);
+}
+
+void StreamingVertexBuffer::mark_dirty(std::size_t begin, std::size_t end) {
+    for (DirtyRange& dirty : _dirty) {
+        if (dirty.begin >= dirty.end) {
+            dirty.begin = begin;
+            dirty.end = end;
+        } else {
+            dirty.begin = std::min(dirty.begin, begin);
+            dirty.end = std::max(dirty.end, end);
+        }
+    }
+}
+
+void StreamingVertexBuffer::allocate(std::size_t capacity) {
+    destroy();
+    _capacity = capacity;
+    const GLsizeiptr num_bytes = GLsizeiptr(sizeof(GLfloat) * _capacity * NUM_SEGMENTS);
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+    if (BufferStorageProc storage = buffer_storage()) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        storage(GL_ARRAY_BUFFER, num_bytes, nullptr, flags);
+        _persistent_ptr = static_cast<GLfloat*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, num_bytes, flags));
+        if (_persistent_ptr == nullptr) {
+            // Storage allocated with glBufferStorage is immutable, start over with a regular buffer
+            glDeleteBuffers(1, &_buffer);
+            glGenBuffers(1, &_buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        }
+    }
+    if (_persistent_ptr == nullptr) {
+        glBufferData(GL_ARRAY_BUFFER, num_bytes, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The new buffer holds nothing yet
+    for (DirtyRange& dirty : _dirty) {
+        dirty.begin = 0;
+        dirty.end = _data.size();
+    }
+}
+
+std::size_t StreamingVertexBuffer::commit() {
+    if (_buffer == 0 || _data.size() > _capacity) {
+        allocate(std::max({ _data.size(), 2 * _capacity, MIN_CAPACITY }));
+    }
+
+    _current = (_current + 1) % NUM_SEGMENTS;
+    DirtyRange& dirty = _dirty[_current];
+    const std::size_t offset = std::size_t(_current) * _capacity;
+    if (dirty.begin < dirty.end) {
+        const std::size_t count = dirty.end - dirty.begin;
+        if (_persistent_ptr != nullptr) {
+            // Wait for the draws which last read this segment before overwriting it
+            if (_fences[_current] != nullptr) {
+                glClientWaitSync(_fences[_current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+                glDeleteSync(_fences[_current]);
+                _fences[_current] = nullptr;
+            }
+            std::memcpy(_persistent_ptr + offset + dirty.begin, _data.data() + dirty.begin, sizeof(GLfloat) * count);
+        } else {
+            glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, GLintptr(sizeof(GLfloat) * (offset + dirty.begin)),
+                            GLsizeiptr(sizeof(GLfloat) * count), _data.data() + dirty.begin);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        dirty = DirtyRange();
+    }
+
+    return offset;
+}
+
+void StreamingVertexBuffer::fence() {
+    if (_persistent_ptr == nullptr) {
+        return;
+    }
+    if (_fences[_current] != nullptr) {
+        glDeleteSync(_fences[_current]);
+    }
+    _fences[_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
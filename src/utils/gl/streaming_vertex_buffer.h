@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Vertex data which changes a few pieces at a time every frame, such as the lines of the cage while one of
+// its KeyFrames is being dragged.
+//
+// The data is kept in a CPU copy and in NUM_SEGMENTS segments of one GL buffer. Each frame, commit() moves
+// on to the next segment and copies into it only the floats written since that segment was last in use, so
+// updating never waits on the draws of the previous frame, which read the other segment. With
+// ARB_buffer_storage the buffer is persistently mapped and a fence guards each segment, otherwise the
+// segment is updated with glBufferSubData.
+//
+// Draws read the current segment, which starts at the float returned by commit(). Call fence() once they
+// are issued.
+class StreamingVertexBuffer {
+public:
+    static constexpr int NUM_SEGMENTS = 2;
+
+    StreamingVertexBuffer() = default;
+    StreamingVertexBuffer(const StreamingVertexBuffer&) = delete;
+    StreamingVertexBuffer& operator=(const StreamingVertexBuffer&) = delete;
+    ~StreamingVertexBuffer() { destroy(); }
+
+    // Free the GL buffer. The data is kept and uploaded again by the next commit().
+    void destroy();
+
+    // Resize the data to num_floats floats, keeping the floats which were already there
+    void resize(std::size_t num_floats);
+    std::size_t size() const { return _data.size(); }
+    const std::vector<GLfloat>& data() const { return _data; }
+
+    // Overwrite the floats [first, first + count)
+    void write(std::size_t first, const GLfloat* values, std::size_t count);
+
+    // Make the next segment current and bring it up to date. Returns the index of its first float in buffer().
+    std::size_t commit();
+
+    // Call after issuing the draws which read the current segment
+    void fence();
+
+    GLuint buffer() const { return _buffer; }
+
+private:
+    struct DirtyRange {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+
+    void allocate(std::size_t capacity);
+    void mark_dirty(std::size_t begin, std::size_t end);
+
+    std::vector<GLfloat> _data;
+
+    GLuint _buffer = 0;
+    std::size_t _capacity = 0; // Floats per segment
+    GLfloat* _persistent_ptr = nullptr;
+    std::array<GLsync, NUM_SEGMENTS> _fences = {};
+    std::array<DirtyRange, NUM_SEGMENTS> _dirty = {};
+    int _current = 0;
+};
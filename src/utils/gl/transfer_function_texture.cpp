@@ -0,0 +1,180 @@
+#include "transfer_function_texture.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "utils/utils.h"
+
+
+namespace {
+
+// Fully opaque nodes would have an infinite extinction, they are clamped to this transparency instead
+constexpr float MIN_TRANSPARENCY = 1e-4f;
+
+// Linearly interpolate the per texel values at the normalized position s
+template <typename T>
+T interpolate(const std::vector<T>& values, float s) {
+    const float x = glm::clamp(s, 0.f, 1.f) * float(values.size() - 1);
+    const std::size_t i = std::min(std::size_t(x), values.size() - 2);
+    const float f = x - float(i);
+    return values[i] * (1.f - f) + values[i + 1] * f;
+}
+
+} // namespace
+
+
+void TransferFunctionTexture::init() {
+    glGenTextures(1, &_texture);
+    glBindTexture(GL_TEXTURE_1D, _texture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, WIDTH, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    glGenTextures(1, &_preintegrated_texture);
+    glBindTexture(GL_TEXTURE_2D, _preintegrated_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, PREINTEGRATED_WIDTH, PREINTEGRATED_WIDTH, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _texels.resize(WIDTH);
+    _preintegrated_texels.resize(PREINTEGRATED_WIDTH * PREINTEGRATED_WIDTH);
+}
+
+void TransferFunctionTexture::destroy() {
+    glDeleteTextures(1, &_texture);
+    glDeleteTextures(1, &_preintegrated_texture);
+    _texture = 0;
+    _preintegrated_texture = 0;
+}
+
+const std::vector<std::array<std::uint8_t, 4>>& TransferFunctionTexture::update(const std::vector<TfNode>& transfer_function) {
+    /* The input transfer_function is a sequence of nodes on a graph as shown below.
+     * Each 'o' corresponds to a TfNode
+     *    a
+     *    l  ^
+     *    p  |                     a[4]
+     *    h  |                      o
+     *    a  |                     / \
+     *       |   a[1]     a[2]    /   \
+     *       |     o-------o     /     \
+     *       |    /    ^    \   /       \
+     *       |   /     |     \ /         \
+     *       |  /      |      o           \
+     *       | /       |     a[3]          \
+     *       |/        |                    \
+     *       o---------|---------------------o---------------o>     t \in [0, 1]
+     *       ^         |                    a[5]             ^
+     *     first       |                                    last
+     *      a[0]       |                                    a[6]
+     *
+     *        local t' renormalized \in [0 = a[1], 1 = a[2]]
+     *        linear interpolation using t' by (1 - t') * a[1] + t' * a[2]
+     */
+    assert(
+        std::is_sorted(
+            transfer_function.begin(),
+            transfer_function.end(),
+            [](const TfNode& a, const TfNode& b) {
+                return a.t < b.t;
+            }
+        )
+    );
+    assert(transfer_function.size() >= 2);
+    assert(transfer_function.front().t == 0.f);
+    assert(transfer_function.back().t == 1.f);
+
+    push_opengl_debug_group("Update Transfer Function");
+
+    std::vector<TfNode>::const_iterator current = transfer_function.begin();
+    std::vector<TfNode>::const_iterator next = current + 1;
+
+    std::vector<glm::vec4> samples(WIDTH);
+    for (int i = 0; i < WIDTH; ++i) {
+        const float t = static_cast<float>(i) / (WIDTH - 1);
+
+        while (t > next->t && next + 1 != transfer_function.end()) {
+            current = next;
+            next++;
+        }
+
+        const float t_prime = (t - current->t) / (next->t - current->t);
+        samples[i] = glm::clamp((1 - t_prime) * current->rgba + t_prime * next->rgba, glm::vec4(0.f), glm::vec4(1.f));
+
+        _texels[i] = {
+            static_cast<uint8_t>(samples[i][0] * 255.f),
+            static_cast<uint8_t>(samples[i][1] * 255.f),
+            static_cast<uint8_t>(samples[i][2] * 255.f),
+            static_cast<uint8_t>(samples[i][3] * 255.f)
+        };
+    }
+
+    glBindTexture(GL_TEXTURE_1D, _texture);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, WIDTH, GL_RGBA, GL_UNSIGNED_BYTE, _texels.data());
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    update_preintegrated(samples);
+
+    pop_opengl_debug_group();
+    return _texels;
+}
+
+void TransferFunctionTexture::update_preintegrated(const std::vector<glm::vec4>& samples) {
+    // Along a segment of one reference step the density goes linearly from front to back, so the extinction
+    // of the segment is the mean extinction of the transfer function over [front, back] and its color the
+    // mean color weighted by extinction. Both means are differences of prefix integrals over the samples,
+    // which makes every table entry O(1) and the whole table cheap enough to rebuild on every edit.
+    const float h = 1.f / float(WIDTH - 1);
+
+    std::vector<float> extinction(WIDTH);
+    std::vector<glm::vec3> color(WIDTH);
+    for (int i = 0; i < WIDTH; ++i) {
+        extinction[i] = -std::log(std::max(1.f - samples[i][3], MIN_TRANSPARENCY));
+        color[i] = glm::vec3(samples[i]);
+    }
+
+    // Trapezoidal prefix integrals of the extinction and of the extinction weighted color
+    std::vector<float> extinction_integral(WIDTH, 0.f);
+    std::vector<glm::vec3> color_integral(WIDTH, glm::vec3(0.f));
+    for (int i = 1; i < WIDTH; ++i) {
+        extinction_integral[i] = extinction_integral[i - 1] + 0.5f * h * (extinction[i - 1] + extinction[i]);
+        color_integral[i] = color_integral[i - 1] +
+                            0.5f * h * (extinction[i - 1] * color[i - 1] + extinction[i] * color[i]);
+    }
+
+    for (int b = 0; b < PREINTEGRATED_WIDTH; ++b) {
+        const float back = float(b) / float(PREINTEGRATED_WIDTH - 1);
+        for (int f = 0; f < PREINTEGRATED_WIDTH; ++f) {
+            const float front = float(f) / float(PREINTEGRATED_WIDTH - 1);
+            const float d = back - front;
+            const float middle = 0.5f * (front + back);
+
+            float segment_extinction;
+            glm::vec3 segment_color;
+            if (std::abs(d) < h) {
+                // Shorter than a sample of the transfer function, which is as good as constant there
+                segment_extinction = interpolate(extinction, middle);
+                segment_color = interpolate(color, middle);
+            } else {
+                segment_extinction = (interpolate(extinction_integral, back) - interpolate(extinction_integral, front)) / d;
+                const glm::vec3 weighted_color = (interpolate(color_integral, back) - interpolate(color_integral, front)) / d;
+                segment_color = segment_extinction > 1e-6f ? weighted_color / segment_extinction : interpolate(color, middle);
+            }
+
+            _preintegrated_texels[b * PREINTEGRATED_WIDTH + f] = glm::vec4(
+                glm::clamp(segment_color, glm::vec3(0.f), glm::vec3(1.f)),
+                1.f - std::exp(-segment_extinction)
+            );
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, _preintegrated_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PREINTEGRATED_WIDTH, PREINTEGRATED_WIDTH, GL_RGBA, GL_FLOAT,
+                    _preintegrated_texels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
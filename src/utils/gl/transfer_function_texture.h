@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct TfNode {
+    float t;
+    glm::vec4 rgba;
+};
+
+// The transfer function of the volume renderers, uploaded in two forms.
+//
+// The 1D texture holds the piecewise linear transfer function itself, sampled at WIDTH texels. The
+// preintegrated 2D table holds, for every pair of densities (front, back) at the two ends of a ray segment,
+// the color and opacity of the whole segment with the density varying linearly between them. Ray casting
+// with the table no longer misses thin features of the transfer function between two samples, so the
+// renderers can take larger steps at the same quality.
+//
+// The table is built for segments of one REFERENCE_STEP_COUNT-th of the unit volume, the interval the
+// opacities of the nodes are defined for. Shaders correct its opacity for their actual step length just as
+// they did for the 1D transfer function:
+//     color.a = 1.0 - pow(1.0 - color.a, t_incr * REF_SAMPLING_INTERVAL)
+//
+// The textures are allocated once by init(), update() only overwrites their texels.
+class TransferFunctionTexture {
+public:
+    static constexpr int WIDTH = 512;
+    static constexpr int PREINTEGRATED_WIDTH = 256;
+    static constexpr float REFERENCE_STEP_COUNT = 150.f; // REF_SAMPLING_INTERVAL of the shaders
+    // How much longer the ray casting steps can be than with the 1D transfer function at the same quality
+    static constexpr float STEP_SCALE = 2.f;
+
+    TransferFunctionTexture() = default;
+    TransferFunctionTexture(const TransferFunctionTexture&) = delete;
+    TransferFunctionTexture& operator=(const TransferFunctionTexture&) = delete;
+    ~TransferFunctionTexture() = default;
+
+    void init();
+    void destroy();
+
+    // Resample the nodes, which must be sorted by t and span [0, 1], and upload both textures. Returns the
+    // RGBA8 texels of the 1D texture, e.g. for EmptySpaceGrid::update_transfer_function.
+    const std::vector<std::array<std::uint8_t, 4>>& update(const std::vector<TfNode>& transfer_function);
+
+    // GL_TEXTURE_1D, RGBA8 with linear filtering
+    GLuint texture() const { return _texture; }
+    // GL_TEXTURE_2D, RGBA16F indexed by (front density, back density) with linear filtering
+    GLuint preintegrated_texture() const { return _preintegrated_texture; }
+
+private:
+    void update_preintegrated(const std::vector<glm::vec4>& samples);
+
+    GLuint _texture = 0;
+    GLuint _preintegrated_texture = 0;
+
+    std::vector<std::array<std::uint8_t, 4>> _texels;
+    std::vector<glm::vec4> _preintegrated_texels;
+};
@@ -0,0 +1,120 @@
+#include "uniform_ring.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// The viewer only asks for a 3.2 context, so glBufferStorage is looked up at runtime
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace {
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+BufferStorageProc buffer_storage() {
+    static BufferStorageProc proc = glfwExtensionSupported("GL_ARB_buffer_storage") ?
+                reinterpret_cast<BufferStorageProc>(glfwGetProcAddress("glBufferStorage")) : nullptr;
+    return proc;
+}
+
+} // namespace
+
+
+void UniformRing::destroy() {
+    for (GLsync& fence : _fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (_buffer != 0) {
+        // Deleting the buffer also unmaps it
+        glDeleteBuffers(1, &_buffer);
+        _buffer = 0;
+    }
+    _persistent_ptr = nullptr;
+    _current = 0;
+    _offset = 0;
+}
+
+void UniformRing::allocate() {
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _alignment = std::size_t(std::max(alignment, 1));
+    const GLsizeiptr num_bytes = GLsizeiptr(_segment_bytes * NUM_SEGMENTS);
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+    if (BufferStorageProc storage = buffer_storage()) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        storage(GL_UNIFORM_BUFFER, num_bytes, nullptr, flags);
+        _persistent_ptr = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, num_bytes, flags));
+        if (_persistent_ptr == nullptr) {
+            // Storage allocated with glBufferStorage is immutable, start over with a regular buffer
+            glDeleteBuffers(1, &_buffer);
+            glGenBuffers(1, &_buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+        }
+    }
+    if (_persistent_ptr == nullptr) {
+        glBufferData(GL_UNIFORM_BUFFER, num_bytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    _current = 0;
+    _offset = 0;
+}
+
+void UniformRing::next_segment() {
+    if (_persistent_ptr != nullptr) {
+        if (_fences[_current] != nullptr) {
+            glDeleteSync(_fences[_current]);
+        }
+        _fences[_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    _current = (_current + 1) % NUM_SEGMENTS;
+    _offset = 0;
+
+    // Wait for the draws which last read this segment before overwriting it
+    if (_fences[_current] != nullptr) {
+        glClientWaitSync(_fences[_current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+        glDeleteSync(_fences[_current]);
+        _fences[_current] = nullptr;
+    }
+}
+
+void UniformRing::write(GLuint binding, const void* data, std::size_t num_bytes) {
+    assert(num_bytes <= _segment_bytes);
+    if (_buffer == 0) {
+        allocate();
+    }
+    if (_offset + num_bytes > _segment_bytes) {
+        next_segment();
+    }
+
+    const std::size_t offset = std::size_t(_current) * _segment_bytes + _offset;
+    if (_persistent_ptr != nullptr) {
+        std::memcpy(_persistent_ptr + offset, data, num_bytes);
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, _buffer, GLintptr(offset), GLsizeiptr(num_bytes));
+    } else {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, _buffer, GLintptr(offset), GLsizeiptr(num_bytes));
+        glBufferSubData(GL_UNIFORM_BUFFER, GLintptr(offset), GLsizeiptr(num_bytes), data);
+    }
+    // Every block starts at a multiple of the offset alignment
+    _offset += (num_bytes + _alignment - 1) / _alignment * _alignment;
+}
+
+bool bind_uniform_block(GLuint program, const char* block_name, GLuint binding) {
+    const GLuint index = glGetUniformBlockIndex(program, block_name);
+    if (index == GL_INVALID_INDEX) {
+        return false;
+    }
+    glUniformBlockBinding(program, index, binding);
+    return true;
+}
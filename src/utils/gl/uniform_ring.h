@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+
+// Uniform blocks of the passes which are drawn every frame, such as the parameters of the volume ray casters.
+// Instead of a glUniform call per parameter, a pass fills a struct mirroring the std140 layout of its block and
+// write() copies it into the ring with one memcpy and binds that range of the buffer to the block's binding point.
+//
+// The ring is one GL buffer of NUM_SEGMENTS segments. Blocks are written one after the other into the current
+// segment. When it is full the ring fences it and moves on to the next one, waiting for the draws which last read
+// that one, so the blocks of the previous frames are never overwritten while the GPU still reads them. With
+// ARB_buffer_storage the buffer is persistently mapped, otherwise the blocks are copied with glBufferSubData.
+class UniformRing {
+public:
+    static constexpr int NUM_SEGMENTS = 3;
+    static constexpr std::size_t DEFAULT_SEGMENT_BYTES = 16 * 1024;
+
+    UniformRing() = default;
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+    ~UniformRing() { destroy(); }
+
+    // The buffer is allocated by the first write()
+    void destroy();
+
+    // Copy num_bytes of data into the ring and bind them to the uniform block binding point. num_bytes must
+    // not exceed the segment size.
+    void write(GLuint binding, const void* data, std::size_t num_bytes);
+
+    template <typename Block>
+    void write(GLuint binding, const Block& block) {
+        write(binding, &block, sizeof(Block));
+    }
+
+private:
+    void allocate();
+    void next_segment();
+
+    GLuint _buffer = 0;
+    std::size_t _segment_bytes = DEFAULT_SEGMENT_BYTES;
+    std::size_t _alignment = 256; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    unsigned char* _persistent_ptr = nullptr;
+    std::array<GLsync, NUM_SEGMENTS> _fences = {};
+    int _current = 0;
+    std::size_t _offset = 0; // Next free byte of the current segment
+};
+
+// Bind the uniform block block_name of program to binding. Returns false if the program has no such block,
+// e.g. because the compiler removed it as unused.
+bool bind_uniform_block(GLuint program, const char* block_name, GLuint binding);
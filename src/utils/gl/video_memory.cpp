@@ -0,0 +1,51 @@
+#include "video_memory.h"
+
+#include <cstring>
+
+namespace {
+
+// Token values of the extensions, which glad was not generated with
+constexpr GLenum GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX = 0x9049;
+constexpr GLenum TEXTURE_FREE_MEMORY_ATI = 0x87FC;
+
+GLenum video_memory_query = 0;
+
+bool has_extension(const char* name) {
+    GLint num_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (GLint i = 0; i < num_extensions; i++) {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(i)));
+        if (extension && std::strcmp(extension, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+
+bool init_video_memory_query() {
+    if (has_extension("GL_NVX_gpu_memory_info")) {
+        video_memory_query = GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX;
+    } else if (has_extension("GL_ATI_meminfo")) {
+        video_memory_query = TEXTURE_FREE_MEMORY_ATI;
+    } else {
+        video_memory_query = 0;
+    }
+    return video_memory_query_supported();
+}
+
+bool video_memory_query_supported() {
+    return video_memory_query != 0;
+}
+
+std::size_t available_video_memory() {
+    if (!video_memory_query_supported()) {
+        return 0;
+    }
+    // Both queries return KiB, the ATI query returns four values and the first is the free memory of the pool
+    GLint values[4] = { 0, 0, 0, 0 };
+    glGetIntegerv(video_memory_query, values);
+    return std::size_t(values[0] > 0 ? values[0] : 0) * 1024;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Free video memory, through GL_NVX_gpu_memory_info or GL_ATI_meminfo. There is no core query, so on other
+// drivers the free memory is unknown.
+
+// Look for one of the extensions in the current context. Returns whether the free memory can be queried.
+bool init_video_memory_query();
+
+bool video_memory_query_supported();
+
+// Video memory the system has left in bytes, by this process or any other, 0 if it cannot be queried. Needs
+// the context init_video_memory_query() was called in to be current.
+std::size_t available_video_memory();
@@ -0,0 +1,460 @@
+#include "volume_brick_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "utils/memory_tracker.h"
+#include "utils/parallel_for.h"
+#include "utils/utils.h"
+
+namespace {
+
+// Name the cache is reported under to memory_tracker()
+const char* const MEMORY_NAME = "Full resolution brick cache";
+// A node of the std::list of the LRU order holds its value and two pointers
+constexpr std::size_t LRU_NODE_BYTES = sizeof(int) + 2 * sizeof(void*);
+
+// A BC4 block holds 4x4 texels of a slice in 8 bytes
+constexpr int BC4_BLOCK_SIZE = 4;
+constexpr std::size_t BC4_BLOCK_BYTES = 8;
+
+// Encode the 4x4 voxels at src, whose rows are row_stride bytes apart, into a BC4 block. The two endpoints are
+// the extremes of the block and every voxel gets the closest of the 8 levels interpolated between them.
+void encode_bc4_block(const std::uint8_t* src, std::size_t row_stride, std::uint8_t* dst) {
+    int lo = 255, hi = 0;
+    for (int y = 0; y < BC4_BLOCK_SIZE; y++) {
+        for (int x = 0; x < BC4_BLOCK_SIZE; x++) {
+            lo = std::min(lo, int(src[y * row_stride + x]));
+            hi = std::max(hi, int(src[y * row_stride + x]));
+        }
+    }
+    // With red0 > red1 the codes are 0: red0, 1: red1 and 2 to 7: the 6 levels in between from red0 to red1.
+    // Uniform blocks store red0 = red1, whose code 0 is red0 as well.
+    dst[0] = std::uint8_t(hi);
+    dst[1] = std::uint8_t(lo);
+    std::uint64_t indices = 0;
+    if (hi > lo) {
+        const int range = hi - lo;
+        for (int i = 0; i < BC4_BLOCK_SIZE * BC4_BLOCK_SIZE; i++) {
+            const int value = src[(i / BC4_BLOCK_SIZE) * row_stride + i % BC4_BLOCK_SIZE];
+            // Level 0 is red0 and level 7 is red1
+            const int level = ((hi - value) * 7 + range / 2) / range;
+            const std::uint64_t code = level == 0 ? 0 : level == 7 ? 1 : std::uint64_t(level + 1);
+            indices |= code << (3 * i);
+        }
+    }
+    for (int b = 0; b < 6; b++) {
+        dst[2 + b] = std::uint8_t(indices >> (8 * b));
+    }
+}
+
+} // namespace
+
+
+const char* const VolumeBrickCache::GLSL = R"(
+uniform sampler3D brick_atlas;
+// The atlas of a compressed cache, with a slice of the slots per layer
+uniform sampler2DArray brick_atlas_layers;
+uniform bool brick_atlas_layered;
+uniform usampler3D brick_page_table;
+uniform vec3 brick_volume_dims;
+uniform vec3 brick_atlas_dims;
+uniform float brick_size;
+uniform vec3 brick_slot_pitch;
+
+float sample_brick_cache(vec3 uv) {
+    // Same as the transparent border of a regular volume texture
+    if (any(lessThan(uv, vec3(0.0))) || any(greaterThanEqual(uv, vec3(1.0)))) {
+        return 0.0;
+    }
+
+    vec3 p = uv * brick_volume_dims;
+    ivec3 brick = ivec3(floor(p / brick_size));
+    uvec4 page = texelFetch(brick_page_table, brick, 0);
+    if (page.w == 0u) {
+        return 0.0;
+    }
+
+    // Skip the one voxel apron around each brick in the atlas
+    vec3 local = p - vec3(brick) * brick_size;
+    vec3 atlas_texel = vec3(page.xyz) * brick_slot_pitch + vec3(1.0) + local;
+    if (brick_atlas_layered) {
+        // Layers are only filtered within the slice, blend the two slices around the sample here. Both lie in
+        // the slot, the apron covers the half voxel on either side.
+        float z = atlas_texel.z - 0.5;
+        float layer = floor(z);
+        vec2 xy = atlas_texel.xy / brick_atlas_dims.xy;
+        float below = texture(brick_atlas_layers, vec3(xy, layer)).r;
+        float above = texture(brick_atlas_layers, vec3(xy, layer + 1.0)).r;
+        return mix(below, above, z - layer);
+    }
+    return texture(brick_atlas, atlas_texel / brick_atlas_dims).r;
+}
+)";
+
+
+VolumeBrickCache::UniformLocations VolumeBrickCache::uniform_locations(GLuint program) {
+    UniformLocations locations;
+    locations.atlas = glGetUniformLocation(program, "brick_atlas");
+    locations.atlas_layers = glGetUniformLocation(program, "brick_atlas_layers");
+    locations.atlas_layered = glGetUniformLocation(program, "brick_atlas_layered");
+    locations.page_table = glGetUniformLocation(program, "brick_page_table");
+    locations.volume_dims = glGetUniformLocation(program, "brick_volume_dims");
+    locations.atlas_dims = glGetUniformLocation(program, "brick_atlas_dims");
+    locations.brick_size = glGetUniformLocation(program, "brick_size");
+    locations.slot_pitch = glGetUniformLocation(program, "brick_slot_pitch");
+    return locations;
+}
+
+void VolumeBrickCache::set_sampler_units(const UniformLocations& locations, GLuint atlas_unit) {
+    glUniform1i(locations.atlas, atlas_unit);
+    glUniform1i(locations.page_table, atlas_unit + 1);
+    glUniform1i(locations.atlas_layers, atlas_unit + 2);
+}
+
+bool VolumeBrickCache::init(RawVolumeView&& volume, const glm::ivec3& volume_dims, std::size_t bytes_per_voxel,
+                            bool compressed, std::shared_ptr<spdlog::logger> logger, std::size_t max_resident_bytes, int brick_size) {
+    destroy();
+    _logger = logger;
+    if (bytes_per_voxel != 1 && bytes_per_voxel != 2) {
+        logger->error("Cannot create a brick cache for {} byte voxels, only 8 and 16 bit volumes are supported", bytes_per_voxel);
+        return false;
+    }
+    if (!volume.is_open() ||
+            volume.size() < std::size_t(volume_dims.x) * std::size_t(volume_dims.y) * std::size_t(volume_dims.z) * bytes_per_voxel) {
+        logger->error("Cannot create a brick cache without a mapped volume");
+        return false;
+    }
+    push_opengl_debug_group("Init Brick Cache");
+
+    _volume = std::move(volume);
+    _volume_dims = volume_dims;
+    _bytes_per_voxel = bytes_per_voxel;
+    _compressed = compressed && bytes_per_voxel == 1;
+    if (compressed && !_compressed) {
+        logger->warn("Only 8 bit volumes can be block compressed, the brick cache keeps all 16 bits");
+    }
+    _brick_size = std::max(brick_size, 1);
+    _num_bricks = (volume_dims + glm::ivec3(_brick_size - 1)) / _brick_size;
+    const int num_bricks = _num_bricks.x * _num_bricks.y * _num_bricks.z;
+
+    // Lay out the slots as a roughly cubic grid which fits in the largest supported 3D (or 2D array) texture
+    const int padded = _brick_size + 2;
+    const int padded_xy = _compressed ? (padded + BC4_BLOCK_SIZE - 1) / BC4_BLOCK_SIZE * BC4_BLOCK_SIZE : padded;
+    _slot_pitch = glm::ivec3(padded_xy, padded_xy, padded);
+    const std::size_t padded_voxels = std::size_t(padded_xy) * padded_xy * padded;
+    const std::size_t slot_bytes = _compressed ? padded_voxels / (BC4_BLOCK_SIZE * BC4_BLOCK_SIZE) * BC4_BLOCK_BYTES
+                                               : padded_voxels * _bytes_per_voxel;
+    GLint max_texture_size = 0, max_layers = 0;
+    if (_compressed) {
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    } else {
+        glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+        max_layers = max_texture_size;
+    }
+    const int max_slots_xy = std::max(max_texture_size / padded_xy, 1);
+    const int max_slots_z = std::max(max_layers / padded, 1);
+    const int wanted_slots = int(std::max<std::size_t>(1, std::min<std::size_t>(std::size_t(num_bricks), max_resident_bytes / slot_bytes)));
+    const int slots_xy = std::min(max_slots_xy, int(std::ceil(std::cbrt(double(wanted_slots)))));
+    _atlas_slots = glm::ivec3(slots_xy, slots_xy, std::min(max_slots_z, (wanted_slots + slots_xy*slots_xy - 1) / (slots_xy*slots_xy)));
+    const int num_slots = _atlas_slots.x * _atlas_slots.y * _atlas_slots.z;
+
+    _slots.assign(num_slots, Slot());
+    _lru.clear();
+    _lru_position.resize(num_slots);
+    for (int i = 0; i < num_slots; i++) {
+        _lru_position[i] = _lru.insert(_lru.end(), i);
+    }
+    _brick_slots.assign(num_bricks, -1);
+    _page_table.assign(std::size_t(num_bricks) * 4, 0);
+    _staging.resize(padded_voxels * _bytes_per_voxel);
+    _blocks.resize(_compressed ? slot_bytes : 0);
+    _num_resident = 0;
+    _request_id = 0;
+    _warned_capacity = false;
+
+    const glm::ivec3 atlas_dims = _atlas_slots * _slot_pitch;
+    const GLenum atlas_target = _compressed ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_3D;
+    glGenTextures(1, &_atlas_texture);
+    glBindTexture(atlas_target, _atlas_texture);
+    glTexParameteri(atlas_target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(atlas_target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(atlas_target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(atlas_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(atlas_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (_compressed) {
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_COMPRESSED_RED_RGTC1, atlas_dims.x, atlas_dims.y, atlas_dims.z, 0,
+                               GLsizei(std::size_t(num_slots) * slot_bytes), nullptr);
+    } else {
+        glTexImage3D(GL_TEXTURE_3D, 0, _bytes_per_voxel == 2 ? GL_R16 : GL_R8, atlas_dims.x, atlas_dims.y, atlas_dims.z, 0, GL_RED,
+                     _bytes_per_voxel == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, nullptr);
+    }
+    glBindTexture(atlas_target, 0);
+
+    glGenTextures(1, &_page_table_texture);
+    glBindTexture(GL_TEXTURE_3D, _page_table_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16UI, _num_bricks.x, _num_bricks.y, _num_bricks.z, 0,
+                 GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, _page_table.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    logger->info("Created {}brick cache for {}x{}x{} {} bit volume: {} bricks of {}^3, {} resident at most ({} MB)",
+                 _compressed ? "BC4 compressed " : "", volume_dims.x, volume_dims.y, volume_dims.z, 8 * _bytes_per_voxel,
+                 num_bricks, _brick_size, num_slots, (std::size_t(num_slots) * slot_bytes) / (1024 * 1024));
+    const std::size_t host_bytes = _page_table.size() * sizeof(std::uint16_t) + _brick_slots.size() * sizeof(int) +
+            _slots.size() * (sizeof(Slot) + sizeof(_lru_position[0]) + LRU_NODE_BYTES) + _staging.size() + _blocks.size();
+    const std::size_t device_bytes = std::size_t(num_slots) * slot_bytes +
+            std::size_t(num_bricks) * 4 * sizeof(std::uint16_t);
+    memory_tracker().set(MEMORY_NAME, host_bytes, device_bytes);
+    pop_opengl_debug_group();
+    return true;
+}
+
+void VolumeBrickCache::destroy() {
+    if (_atlas_texture != 0) {
+        glDeleteTextures(1, &_atlas_texture);
+    }
+    if (_page_table_texture != 0) {
+        glDeleteTextures(1, &_page_table_texture);
+    }
+    _atlas_texture = 0;
+    _page_table_texture = 0;
+    _volume.close();
+    _slots.clear();
+    _lru.clear();
+    _lru_position.clear();
+    _brick_slots.clear();
+    _page_table.clear();
+    _staging.clear();
+    _blocks.clear();
+    _num_resident = 0;
+    _residency_version += 1;
+    memory_tracker().set(MEMORY_NAME, 0, 0);
+}
+
+void VolumeBrickCache::begin_request() {
+    _request_id += 1;
+}
+
+void VolumeBrickCache::end_request() {
+    if (!_page_table_dirty) {
+        return;
+    }
+    glBindTexture(GL_TEXTURE_3D, _page_table_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, _num_bricks.x, _num_bricks.y, _num_bricks.z,
+                    GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, _page_table.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    _page_table_dirty = false;
+    _residency_version += 1;
+}
+
+void VolumeBrickCache::request_brick_range(const glm::ivec3& b_lo, const glm::ivec3& b_hi) {
+    const glm::ivec3 lo = glm::clamp(b_lo, glm::ivec3(0), _num_bricks - 1);
+    const glm::ivec3 hi = glm::clamp(b_hi, glm::ivec3(0), _num_bricks - 1);
+    for (int z = lo.z; z <= hi.z; z++) {
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+                if (!make_resident((z * _num_bricks.y + y) * _num_bricks.x + x)) {
+                    if (!_warned_capacity) {
+                        _logger->warn("Brick cache is full ({} bricks), parts of the volume will not be displayed", _slots.size());
+                        _warned_capacity = true;
+                    }
+                    return;
+                }
+            }
+        }
+    }
+}
+
+void VolumeBrickCache::request_region(const glm::vec3& lo, const glm::vec3& hi) {
+    if (!is_initialized()) {
+        return;
+    }
+    push_opengl_debug_group("Update Brick Cache");
+    begin_request();
+    const glm::vec3 scale = glm::vec3(_volume_dims) / float(_brick_size);
+    request_brick_range(glm::ivec3(glm::floor(lo * scale)), glm::ivec3(glm::floor(hi * scale)));
+    end_request();
+    pop_opengl_debug_group();
+}
+
+void VolumeBrickCache::request_plane(const glm::vec3& ll, const glm::vec3& lr, const glm::vec3& ul) {
+    if (!is_initialized()) {
+        return;
+    }
+    push_opengl_debug_group("Update Brick Cache");
+    begin_request();
+    // In units of bricks, brick (x, y, z) covers [x, x + 1] x [y, y + 1] x [z, z + 1]
+    const glm::vec3 scale = glm::vec3(_volume_dims) / float(_brick_size);
+    const glm::vec3 p0 = ll * scale, p1 = lr * scale, p2 = ul * scale;
+    const glm::vec3 p3 = p1 + p2 - p0;
+    const glm::ivec3 lo = glm::max(glm::ivec3(glm::floor(glm::min(glm::min(p0, p1), glm::min(p2, p3)))), glm::ivec3(0));
+    const glm::ivec3 hi = glm::min(glm::ivec3(glm::floor(glm::max(glm::max(p0, p1), glm::max(p2, p3)))), _num_bricks - 1);
+    const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    // A brick is crossed by the plane if its corners are not all on one side, i.e. if its center is closer to
+    // the plane than the projection of its half diagonal on the normal
+    const float reach = 0.5f * (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+    bool full = false;
+    for (int z = lo.z; z <= hi.z && !full; z++) {
+        for (int y = lo.y; y <= hi.y && !full; y++) {
+            for (int x = lo.x; x <= hi.x && !full; x++) {
+                const glm::vec3 center = glm::vec3(x, y, z) + 0.5f;
+                if (std::abs(glm::dot(center - p0, normal)) > reach) {
+                    continue;
+                }
+                if (!make_resident((z * _num_bricks.y + y) * _num_bricks.x + x)) {
+                    if (!_warned_capacity) {
+                        _logger->warn("Brick cache is full ({} bricks), parts of the volume will not be displayed", _slots.size());
+                        _warned_capacity = true;
+                    }
+                    full = true;
+                }
+            }
+        }
+    }
+    end_request();
+    pop_opengl_debug_group();
+}
+
+void VolumeBrickCache::request_cage(const BoundingCage& cage, const glm::vec3& cage_volume_dims) {
+    if (!is_initialized()) {
+        return;
+    }
+    push_opengl_debug_group("Update Brick Cache");
+    begin_request();
+    const glm::vec3 scale = glm::vec3(_volume_dims) / (cage_volume_dims * float(_brick_size));
+    // The tricubic export filter reads up to two voxels outside of the cage
+    const glm::vec3 margin = glm::vec3(2.f / float(_brick_size));
+    for (const BoundingCage::Cell& cell : cage.cells) {
+        // Bricks overlapping the bounding box of each prism. The linear filter reads half a voxel outside
+        // of the cage which the apron of the boundary bricks already covers.
+        const BoundingCage::Cell::MeshVertices V = cell.mesh_vertices();
+        const Eigen::RowVector3d v_min = V.colwise().minCoeff();
+        const Eigen::RowVector3d v_max = V.colwise().maxCoeff();
+        const glm::vec3 lo = glm::vec3(v_min[0], v_min[1], v_min[2]) * scale - margin;
+        const glm::vec3 hi = glm::vec3(v_max[0], v_max[1], v_max[2]) * scale + margin;
+        request_brick_range(glm::ivec3(glm::floor(lo)), glm::ivec3(glm::floor(hi)));
+    }
+    end_request();
+    pop_opengl_debug_group();
+    _logger->trace("Brick cache has {} of {} bricks resident", _num_resident, _slots.size());
+}
+
+bool VolumeBrickCache::make_resident(int brick) {
+    int slot = _brick_slots[brick];
+    if (slot < 0) {
+        // Evict the least recently used slot unless it is needed by this request too
+        slot = _lru.front();
+        if (_slots[slot].brick >= 0 && _slots[slot].last_used == _request_id) {
+            return false;
+        }
+        if (_slots[slot].brick >= 0) {
+            const int evicted = _slots[slot].brick;
+            _brick_slots[evicted] = -1;
+            _page_table[std::size_t(evicted) * 4 + 3] = 0;
+            _num_resident -= 1;
+        }
+
+        upload_brick(brick, slot);
+        _slots[slot].brick = brick;
+        _brick_slots[brick] = slot;
+        const glm::ivec3 s(slot % _atlas_slots.x, (slot / _atlas_slots.x) % _atlas_slots.y, slot / (_atlas_slots.x * _atlas_slots.y));
+        std::uint16_t* entry = _page_table.data() + std::size_t(brick) * 4;
+        entry[0] = std::uint16_t(s.x);
+        entry[1] = std::uint16_t(s.y);
+        entry[2] = std::uint16_t(s.z);
+        entry[3] = 1;
+        _page_table_dirty = true;
+        _num_resident += 1;
+    }
+
+    _slots[slot].last_used = _request_id;
+    _lru.splice(_lru.end(), _lru, _lru_position[slot]);
+    return true;
+}
+
+void VolumeBrickCache::upload_brick(int brick, int slot) {
+    const int padded = _brick_size + 2;
+    const glm::ivec3 b(brick % _num_bricks.x, (brick / _num_bricks.x) % _num_bricks.y, brick / (_num_bricks.x * _num_bricks.y));
+    const glm::ivec3 origin = b * _brick_size - glm::ivec3(1);
+
+    // Gather the brick and its apron, voxels outside the volume are zero like the texture border
+    const int x_begin = std::max(origin.x, 0), x_end = std::min(origin.x + padded, _volume_dims.x);
+    std::fill(_staging.begin(), _staging.end(), 0);
+    for (int z = 0; z < padded; z++) {
+        const int vz = origin.z + z;
+        if (vz < 0 || vz >= _volume_dims.z) {
+            continue;
+        }
+        for (int y = 0; y < padded; y++) {
+            const int vy = origin.y + y;
+            if (vy < 0 || vy >= _volume_dims.y || x_begin >= x_end) {
+                continue;
+            }
+            const std::uint8_t* src = _volume.data() +
+                    ((std::size_t(vz) * _volume_dims.y + vy) * _volume_dims.x + x_begin) * _bytes_per_voxel;
+            std::uint8_t* dst = _staging.data() +
+                    ((std::size_t(z) * _slot_pitch.y + y) * _slot_pitch.x + (x_begin - origin.x)) * _bytes_per_voxel;
+            std::memcpy(dst, src, std::size_t(x_end - x_begin) * _bytes_per_voxel);
+        }
+    }
+
+    const glm::ivec3 s(slot % _atlas_slots.x, (slot / _atlas_slots.x) % _atlas_slots.y, slot / (_atlas_slots.x * _atlas_slots.y));
+    const glm::ivec3 offset = s * _slot_pitch;
+    if (_compressed) {
+        // The blocks of each slice in turn, row by row like the layers of the 2D array
+        const int blocks_x = _slot_pitch.x / BC4_BLOCK_SIZE, blocks_y = _slot_pitch.y / BC4_BLOCK_SIZE;
+        const std::size_t row = std::size_t(_slot_pitch.x);
+        parallel_for_chunks(std::size_t(_slot_pitch.z), [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t z = begin; z < end; z++) {
+                for (int by = 0; by < blocks_y; by++) {
+                    for (int bx = 0; bx < blocks_x; bx++) {
+                        const std::uint8_t* src = _staging.data() + (z * _slot_pitch.y + by * BC4_BLOCK_SIZE) * row + bx * BC4_BLOCK_SIZE;
+                        std::uint8_t* dst = _blocks.data() + ((z * blocks_y + by) * blocks_x + bx) * BC4_BLOCK_BYTES;
+                        encode_bc4_block(src, row, dst);
+                    }
+                }
+            }
+        }, 8);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _atlas_texture);
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, offset.x, offset.y, offset.z, _slot_pitch.x, _slot_pitch.y, _slot_pitch.z,
+                                  GL_COMPRESSED_RED_RGTC1, GLsizei(_blocks.size()), _blocks.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return;
+    }
+    glBindTexture(GL_TEXTURE_3D, _atlas_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, offset.x, offset.y, offset.z, padded, padded, padded,
+                    GL_RED, _bytes_per_voxel == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, _staging.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void VolumeBrickCache::bind(const UniformLocations& locations, GLuint atlas_unit) const {
+    const glm::vec3 atlas_dims = glm::vec3(_atlas_slots * _slot_pitch);
+
+    glActiveTexture(GL_TEXTURE0 + atlas_unit);
+    glBindTexture(GL_TEXTURE_3D, _compressed ? 0 : _atlas_texture);
+    glActiveTexture(GL_TEXTURE0 + atlas_unit + 1);
+    glBindTexture(GL_TEXTURE_3D, _page_table_texture);
+    glActiveTexture(GL_TEXTURE0 + atlas_unit + 2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _compressed ? _atlas_texture : 0);
+    glActiveTexture(GL_TEXTURE0);
+    set_sampler_units(locations, atlas_unit);
+    glUniform1i(locations.atlas_layered, _compressed);
+
+    glUniform3f(locations.volume_dims, float(_volume_dims.x), float(_volume_dims.y), float(_volume_dims.z));
+    glUniform3f(locations.atlas_dims, atlas_dims.x, atlas_dims.y, atlas_dims.z);
+    glUniform1f(locations.brick_size, float(_brick_size));
+    glUniform3f(locations.slot_pitch, float(_slot_pitch.x), float(_slot_pitch.y), float(_slot_pitch.z));
+}
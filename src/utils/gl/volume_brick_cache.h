@@ -0,0 +1,140 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "../bounding_cage.h"
+#include "../raw_volume_view.h"
+
+// Out-of-core cache for volumes which are too big to be uploaded as a single 3D texture.
+//
+// The volume is split into bricks of brick_size^3 voxels. A fixed number of them are resident
+// on the GPU at once in a 3D atlas texture, each padded with a one voxel apron so linear filtering
+// never reads across brick boundaries. A page table (one texel per brick) stores the atlas slot of
+// each resident brick. When new bricks are requested the least recently used ones are evicted.
+//
+// Bricks are uploaded straight out of a memory mapped .raw file so the full scan never has
+// to be held in RAM either.
+//
+// 8 bit volumes can be kept block compressed to fit about twice as many bricks in the same video memory.
+// Each slice of a brick is then encoded into BC4 (RGTC1) blocks of 4x4 voxels, which GL only supports for
+// 2D textures, so the atlas becomes a 2D array with a slice per layer and sample_brick_cache() interpolates
+// between the layers itself. BC4 is lossy, each block keeps 8 levels between its darkest and brightest voxel.
+//
+// Shaders sample the cache by including VolumeBrickCache::GLSL and calling
+// sample_brick_cache(uv) with a normalized volume coordinate.
+class VolumeBrickCache {
+public:
+    static constexpr int DEFAULT_BRICK_SIZE = 64;
+    static constexpr std::size_t DEFAULT_MAX_RESIDENT_BYTES = std::size_t(512) * 1024 * 1024;
+    // Smallest atlas worth paging through, used when the video memory is too short for the default
+    static constexpr std::size_t MIN_RESIDENT_BYTES = std::size_t(64) * 1024 * 1024;
+
+    // GLSL declarations of the cache uniforms and sample_brick_cache(). Insert this after the #version line.
+    static const char* const GLSL;
+
+    struct UniformLocations {
+        GLint atlas = -1;
+        GLint atlas_layers = -1;
+        GLint atlas_layered = -1;
+        GLint page_table = -1;
+        GLint volume_dims = -1;
+        GLint atlas_dims = -1;
+        GLint brick_size = -1;
+        GLint slot_pitch = -1;
+    };
+    static UniformLocations uniform_locations(GLuint program);
+
+    // Point the cache samplers of the bound program at atlas_unit to atlas_unit + 2. Call this even when the
+    // cache is not sampled, otherwise the unused samplers alias unit 0 with a different sampler type.
+    static void set_sampler_units(const UniformLocations& locations, GLuint atlas_unit);
+
+    VolumeBrickCache() = default;
+    VolumeBrickCache(const VolumeBrickCache&) = delete;
+    VolumeBrickCache& operator=(const VolumeBrickCache&) = delete;
+    ~VolumeBrickCache() = default;
+
+    // Takes ownership of the mapped volume and allocates the atlas and page table textures. Voxels of 2 bytes
+    // (bytes_per_voxel = 2) are kept at 16 bits in a GL_R16 atlas, otherwise the atlas is GL_R8, or BC4
+    // compressed if compressed is set. 16 bit volumes are never compressed.
+    bool init(RawVolumeView&& volume, const glm::ivec3& volume_dims, std::size_t bytes_per_voxel, bool compressed,
+              std::shared_ptr<spdlog::logger> logger,
+              std::size_t max_resident_bytes = DEFAULT_MAX_RESIDENT_BYTES, int brick_size = DEFAULT_BRICK_SIZE);
+    void destroy();
+    bool is_initialized() const { return _atlas_texture != 0; }
+    bool is_compressed() const { return _compressed; }
+
+    // Make every brick overlapping the cage resident. Cage coordinates are in units of cage_volume_dims
+    // (i.e. the low resolution volume the cage was built on).
+    void request_cage(const BoundingCage& cage, const glm::vec3& cage_volume_dims);
+
+    // Make every brick overlapping the box [lo, hi] (normalized volume coordinates) resident
+    void request_region(const glm::vec3& lo, const glm::vec3& hi);
+
+    // Make every brick crossed by the parallelogram with corners ll, lr, ul and lr + ul - ll (normalized volume
+    // coordinates) resident, e.g. a cross-section of the volume. Only the bricks the plane of the parallelogram
+    // passes through are paged in, not every brick of its bounding box.
+    void request_plane(const glm::vec3& ll, const glm::vec3& lr, const glm::vec3& ul);
+
+    // Bind the atlas and page table to the texture units atlas_unit to atlas_unit + 2 and set the uniforms
+    void bind(const UniformLocations& locations, GLuint atlas_unit) const;
+
+    glm::ivec3 volume_dims() const { return _volume_dims; }
+    std::size_t num_resident_bricks() const { return _num_resident; }
+    std::size_t capacity() const { return _slots.size(); }
+    // Changes every time bricks are paged in or out, so views sampled from the cache can tell they are stale
+    std::uint64_t residency_version() const { return _residency_version; }
+
+private:
+    struct Slot {
+        int brick = -1;
+        std::uint64_t last_used = 0;
+    };
+
+    void begin_request();
+    void request_brick_range(const glm::ivec3& b_lo, const glm::ivec3& b_hi);
+    void end_request();
+    bool make_resident(int brick);
+    void upload_brick(int brick, int slot);
+
+    std::shared_ptr<spdlog::logger> _logger;
+    RawVolumeView _volume;
+    glm::ivec3 _volume_dims = glm::ivec3(0);
+    std::size_t _bytes_per_voxel = 1;
+    bool _compressed = false;
+    int _brick_size = DEFAULT_BRICK_SIZE;
+    glm::ivec3 _num_bricks = glm::ivec3(0);
+    glm::ivec3 _atlas_slots = glm::ivec3(0);
+    // Voxels between the slots in the atlas, the padded brick size rounded up to whole BC4 blocks in x and y
+    glm::ivec3 _slot_pitch = glm::ivec3(0);
+
+    GLuint _atlas_texture = 0;
+    GLuint _page_table_texture = 0;
+
+    // CPU copy of the page table, 4 values per brick: the atlas slot and a resident flag
+    std::vector<std::uint16_t> _page_table;
+    bool _page_table_dirty = false;
+
+    // Atlas slot of each brick, -1 if the brick is not resident
+    std::vector<int> _brick_slots;
+
+    std::vector<Slot> _slots;
+
+    // Slot indices ordered from least to most recently used
+    std::list<int> _lru;
+    std::vector<std::list<int>::iterator> _lru_position;
+
+    std::uint64_t _request_id = 0;
+    std::uint64_t _residency_version = 0;
+    std::size_t _num_resident = 0;
+    bool _warned_capacity = false;
+
+    // Reused staging buffer for a single padded brick, and for its BC4 blocks if the atlas is compressed
+    std::vector<std::uint8_t> _staging;
+    std::vector<std::uint8_t> _blocks;
+};
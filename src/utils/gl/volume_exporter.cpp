@@ -4,12 +4,24 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
 
 #include <glm/gtc/type_ptr.hpp>
-#include <igl/opengl/create_shader_program.h>
 
 #include "utils/utils.h"
+#include "utils/content_hash.h"
+#include "utils/cpu_straightener.h"
+#include "utils/memory_tracker.h"
+#include "utils/trace.h"
+#include "gpu_profiler.h"
+#include "shader_cache.h"
 
+// Each instance draws one slice of the export volume. The corners of the slices of a batch are stored
+// in a texture buffer as four texels per slice (ll, lr, ur, ul).
 constexpr const char* SLICE_VERTEX_SHADER = R"(
 #version 150
 // Create two triangles that are filling the entire screen [-1, 1]
@@ -23,115 +35,947 @@ vec2 positions[6] = vec2[](
     vec2(-1.0,  1.0)
 );
 
+// Index of the corner of the slice for each vertex
+int corners[6] = int[](0, 1, 2, 0, 2, 3);
 
-uniform vec3 ll;
-uniform vec3 lr;
-uniform vec3 ul;
-uniform vec3 ur;
+uniform samplerBuffer slice_corners;
+// Number of slices in slice_corners, which can hold one more slice than the batch draws
+uniform int num_corner_slices;
+// Layer of the render target that the first slice of the batch goes to
+uniform int first_layer;
 
-out vec3 uv;
+out vec3 vertex_uv;
+out vec3 vertex_step;
+flat out int vertex_layer;
 
 void main() {
     vec2 p = positions[gl_VertexID];
     gl_Position = vec4(p, 0.0, 1.0);
 
-    switch (gl_VertexID) {
-        case 0:
-        case 3:
-            uv = ll;
-            break;
-        case 1:
-            uv = lr;
-            break;
-        case 2:
-        case 4:
-            uv = ur;
-            break;
-        case 5:
-            uv = ul;
-            break;
+    vertex_uv = texelFetch(slice_corners, 4 * gl_InstanceID + corners[gl_VertexID]).xyz;
+    vertex_layer = first_layer + gl_InstanceID;
+
+    // Distance to the neighbouring slice, the depth of the footprint of an output voxel
+    int neighbour = gl_InstanceID + 1 < num_corner_slices ? gl_InstanceID + 1 : gl_InstanceID - 1;
+    vertex_step = neighbour >= 0 ? texelFetch(slice_corners, 4 * neighbour + corners[gl_VertexID]).xyz - vertex_uv : vec3(0.0);
+}
+)";
+
+// Routes the triangles of every instance to the layer of its slice
+constexpr const char* SLICE_GEOMETRY_SHADER = R"(
+#version 150
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vertex_uv[];
+in vec3 vertex_step[];
+flat in int vertex_layer[];
+
+out vec3 uv;
+out vec3 slice_step;
+
+void main() {
+    for (int i = 0; i < 3; i++) {
+        gl_Layer = vertex_layer[0];
+        gl_Position = gl_in[i].gl_Position;
+        uv = vertex_uv[i];
+        slice_step = vertex_step[i];
+        EmitVertex();
     }
+    EndPrimitive();
 }
 )";
 
-constexpr const char* SLICE_FRAGMENT_SHADER = R"(
+// The brick cache functions are inserted between the version line and the body
+constexpr const char* SLICE_FRAGMENT_SHADER_VERSION = R"(
 #version 150
+)";
+
+// The filters match the ones of the CPU straightener, see ResampleFilter
+constexpr const char* SLICE_FRAGMENT_SHADER = R"(
 in vec3 uv;
+in vec3 slice_step;
 
+// One output per VolumeExporter::Channel, bound to the color attachment of the same number
 out vec4 out_color;
+out uint out_feature;
+out vec4 out_selection;
 
 uniform sampler3D tex;
 uniform sampler1D tf;
+uniform bool use_brick_cache;
+uniform int filter_mode;
+
+uniform bool use_labels;
+uniform usampler3D index_volume;
+// Feature of every contour tree arc, and a bitset of the selected features (bit feature % 32 of texel feature / 32)
+uniform usampler1D contour_features;
+uniform usampler1D selection_features;
+
+const int FILTER_TRICUBIC_BSPLINE = 1;
+const int FILTER_BOX_MINIFY = 2;
+const int MAX_BOX_TAPS = 4;
+
+float sample_volume(vec3 p) {
+    return use_brick_cache ? sample_brick_cache(p) : textureLod(tex, p, 0.0).r;
+}
+
+// Cubic B-spline from 8 trilinear fetches, the four weights along each axis are folded into two fetches
+float sample_tricubic(vec3 p, vec3 size) {
+    vec3 coord = p * size - 0.5;
+    vec3 index = floor(coord);
+    vec3 f = coord - index;
+    vec3 one_f = 1.0 - f;
+    vec3 w0 = one_f * one_f * one_f / 6.0;
+    vec3 w1 = (3.0 * f * f * f - 6.0 * f * f + 4.0) / 6.0;
+    vec3 w3 = f * f * f / 6.0;
+    vec3 w2 = 1.0 - w0 - w1 - w3;
+    vec3 g0 = w0 + w1;
+    vec3 g1 = w2 + w3;
+    vec3 h0 = (index - 1.0 + w1 / g0 + 0.5) / size;
+    vec3 h1 = (index + 1.0 + w3 / g1 + 0.5) / size;
+
+    float z0 = mix(mix(sample_volume(vec3(h0.x, h0.y, h0.z)), sample_volume(vec3(h1.x, h0.y, h0.z)), g1.x),
+                   mix(sample_volume(vec3(h0.x, h1.y, h0.z)), sample_volume(vec3(h1.x, h1.y, h0.z)), g1.x), g1.y);
+    float z1 = mix(mix(sample_volume(vec3(h0.x, h0.y, h1.z)), sample_volume(vec3(h1.x, h0.y, h1.z)), g1.x),
+                   mix(sample_volume(vec3(h0.x, h1.y, h1.z)), sample_volume(vec3(h1.x, h1.y, h1.z)), g1.x), g1.y);
+    return mix(z0, z1, g1.z);
+}
+
+int box_taps(vec3 axis, vec3 size) {
+    // The tolerance keeps 1:1 exports from picking up a second tap through rounding
+    return clamp(int(ceil(length(axis * size) - 0.01)), 1, MAX_BOX_TAPS);
+}
+
+// Average of trilinear taps over the footprint of the output voxel, spanned by ax, ay and az
+float sample_box(vec3 p, vec3 ax, vec3 ay, vec3 az, vec3 size) {
+    int nx = box_taps(ax, size), ny = box_taps(ay, size), nz = box_taps(az, size);
+    float sum = 0.0;
+    for (int k = 0; k < nz; k++) {
+        for (int j = 0; j < ny; j++) {
+            for (int i = 0; i < nx; i++) {
+                vec3 q = p + ax * ((float(i) + 0.5) / float(nx) - 0.5) +
+                             ay * ((float(j) + 0.5) / float(ny) - 0.5) +
+                             az * ((float(k) + 0.5) / float(nz) - 0.5);
+                sum += sample_volume(q);
+            }
+        }
+    }
+    return sum / float(nx * ny * nz);
+}
+
+uint sample_feature(vec3 p) {
+    if (any(lessThan(p, vec3(0.0))) || any(greaterThanEqual(p, vec3(1.0)))) {
+        return 0u;
+    }
+    int arc = int(texture(index_volume, p).r);
+    return arc < textureSize(contour_features, 0) ? texelFetch(contour_features, arc, 0).r + 1u : 0u;
+}
+
+// Takes the output id of sample_feature, the bitset is indexed by the feature itself
+bool is_feature_selected(uint feature_id) {
+    if (feature_id == 0u) {
+        return false;
+    }
+    uint feature = feature_id - 1u;
+    int word_index = int(feature >> 5u);
+    if (word_index >= textureSize(selection_features, 0)) {
+        return false;
+    }
+    uint word = texelFetch(selection_features, word_index, 0).r;
+    return (word & (1u << (feature & 31u))) != 0u;
+}
+
+void main() {
+    // Derivatives have to be taken outside of non-uniform control flow
+    vec3 ax = dFdx(uv);
+    vec3 ay = dFdy(uv);
+    vec3 size = use_brick_cache ? brick_volume_dims : vec3(textureSize(tex, 0));
+
+    float v;
+    if (filter_mode == FILTER_TRICUBIC_BSPLINE) {
+        v = sample_tricubic(uv, size);
+    } else if (filter_mode == FILTER_BOX_MINIFY) {
+        v = sample_box(uv, ax, ay, slice_step, size);
+    } else {
+        v = sample_volume(uv);
+    }
+    out_color = vec4(vec3(v), 1.0);
+
+    // Labels are never interpolated, the nearest voxel decides
+    uint feature = use_labels ? sample_feature(uv) : 0u;
+    out_feature = feature;
+    out_selection = vec4(is_feature_selected(feature) ? 1.0 : 0.0);
+}
+)";
+
+// Tets are drawn as lines with adjacency so that the geometry shader sees their 4 vertices
+constexpr const char* TET_VERTEX_SHADER = R"(
+#version 150
+in vec3 deformed;
+in vec3 rest;
+
+out vec3 vertex_deformed;
+out vec3 vertex_rest;
+flat out int vertex_instance;
+
+void main() {
+    vertex_deformed = deformed;
+    vertex_rest = rest;
+    vertex_instance = gl_InstanceID;
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
+)";
+
+// Slices each tet with the planes through the voxel centers of the layers it spans, layers_per_instance of them
+// per instance. The slice of a tet is a triangle or a quad, the rest position is interpolated along its edges.
+constexpr const char* TET_GEOMETRY_SHADER = R"(
+#version 150
+layout(lines_adjacency) in;
+layout(triangle_strip, max_vertices = 32) out;
+
+in vec3 vertex_deformed[];
+in vec3 vertex_rest[];
+flat in int vertex_instance[];
+
+uniform vec3 export_dims;
+// At most max_vertices / 4
+uniform int layers_per_instance;
+
+out vec3 uv;
+
+void emit_crossing(int a, int b, float z, int layer) {
+    vec3 pa = vertex_deformed[a];
+    vec3 pb = vertex_deformed[b];
+    float t = (z - pa.z) / (pb.z - pa.z);
+    vec3 p = mix(pa, pb, t);
+    gl_Layer = layer;
+    gl_Position = vec4(2.0 * p.xy / export_dims.xy - 1.0, 0.0, 1.0);
+    uv = mix(vertex_rest[a], vertex_rest[b], t);
+    EmitVertex();
+}
+
+void main() {
+    float z_min = min(min(vertex_deformed[0].z, vertex_deformed[1].z), min(vertex_deformed[2].z, vertex_deformed[3].z));
+    float z_max = max(max(vertex_deformed[0].z, vertex_deformed[1].z), max(vertex_deformed[2].z, vertex_deformed[3].z));
+    // Layer l is sampled at z = l + 0.5
+    int first = int(ceil(z_min - 0.5)) + vertex_instance[0] * layers_per_instance;
+    int last = min(min(int(floor(z_max - 0.5)), int(export_dims.z) - 1), first + layers_per_instance - 1);
+    for (int layer = max(first, 0); layer <= last; layer++) {
+        float z = float(layer) + 0.5;
+        int below[4];
+        int above[4];
+        int num_below = 0;
+        int num_above = 0;
+        for (int i = 0; i < 4; i++) {
+            if (vertex_deformed[i].z < z) {
+                below[num_below++] = i;
+            } else {
+                above[num_above++] = i;
+            }
+        }
+        if (num_below == 1) {
+            emit_crossing(below[0], above[0], z, layer);
+            emit_crossing(below[0], above[1], z, layer);
+            emit_crossing(below[0], above[2], z, layer);
+        } else if (num_above == 1) {
+            emit_crossing(above[0], below[0], z, layer);
+            emit_crossing(above[0], below[1], z, layer);
+            emit_crossing(above[0], below[2], z, layer);
+        } else if (num_below == 2) {
+            // The crossings of the quad in strip order, neighbours share a vertex of the tet
+            emit_crossing(below[0], above[0], z, layer);
+            emit_crossing(below[0], above[1], z, layer);
+            emit_crossing(below[1], above[0], z, layer);
+            emit_crossing(below[1], above[1], z, layer);
+        } else {
+            continue;
+        }
+        EndPrimitive();
+    }
+}
+)";
+
+constexpr const char* TET_FRAGMENT_SHADER = R"(
+#version 150
+in vec3 uv;
+
+out vec4 out_color;
+
+uniform sampler3D tex;
 
 void main() {
-    out_color = vec4(texture(tex, uv).rrr, 1.0);
+    out_color = vec4(vec3(texture(tex, uv).r), 1.0);
 }
 )";
 
-void VolumeExporter::write_texture_data_to_file(std::string filename) {
+// Vertices emitted per layer at most, and the max_vertices of TET_GEOMETRY_SHADER
+constexpr int TET_VERTICES_PER_LAYER = 4;
+constexpr int TET_MAX_GEOMETRY_VERTICES = 32;
+
+namespace {
+
+struct ChannelFormat {
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+    std::size_t bytes_per_voxel;
+    const char* suffix; // Inserted before the extension of the export filename
+};
+
+// Indexed by VolumeExporter::Channel
+const ChannelFormat CHANNEL_FORMATS[VolumeExporter::NUM_CHANNELS] = {
+    { GL_R8,    GL_RED,         GL_UNSIGNED_BYTE,  1, "" },
+    { GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 2, ".features" },
+    { GL_R8,    GL_RED,         GL_UNSIGNED_BYTE,  1, ".selection" },
+};
+
+// Replaces the intensity format for 16 bit exports, normalized like GL_R8 so the render shaders are the same
+const ChannelFormat INTENSITY_16_FORMAT = { GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2, "" };
+
+const ChannelFormat& channel_format(int channel, bool intensity_16bit) {
+    return channel == VolumeExporter::CHANNEL_INTENSITY && intensity_16bit ? INTENSITY_16_FORMAT : CHANNEL_FORMATS[channel];
+}
+
+// Name the export textures and read back buffers are reported under to memory_tracker()
+const char* const MEMORY_NAME = "Volume exporter";
+
+} // namespace
+
+std::string VolumeExporter::label_filename(const std::string& filename, Channel channel) {
+    const std::string::size_type slash = filename.find_last_of("/\\");
+    const std::string::size_type dot = filename.find_last_of('.');
+    const bool has_extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    if (!has_extension) {
+        return filename + CHANNEL_FORMATS[channel].suffix;
+    }
+    return filename.substr(0, dot) + CHANNEL_FORMATS[channel].suffix + filename.substr(dot);
+}
+
+bool VolumeExporter::write_texture_data_to_file(const std::string& filename, std::shared_ptr<spdlog::logger> logger) {
+    if (!begin_write(filename, logger)) {
+        return false;
+    }
+    while (poll_write()) {
+        std::this_thread::yield();
+    }
+    return _write_succeeded;
+}
+
+bool VolumeExporter::begin_write(const std::string& filename, std::shared_ptr<spdlog::logger> logger) {
+    if (!start_readback(filename, glm::ivec3(w, h, d), logger)) {
+        return false;
+    }
+    readback.tiled = false;
+    poll_write();
+    return true;
+}
+
+bool VolumeExporter::begin_tiled_write(BoundingCage& cage, GLuint volume_texture, const VolumeBrickCache* bricks,
+                                       glm::ivec3 volume_dims, glm::ivec3 dims, const std::string& filename,
+                                       std::shared_ptr<spdlog::logger> logger) {
+    GLint max_size = 0, max_layers = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    if (dims.x > max_size || dims.y > max_size) {
+        logger->error("Cannot export {}x{} slices, the maximum texture size is {}", dims.x, dims.y, max_size);
+        return false;
+    }
+    if (!start_readback(filename, dims, logger, max_layers)) {
+        return false;
+    }
+
+    // The slices are placed on a snapshot of the cage so later edits do not affect the export. Evaluating the
+    // cage at thousands of slices takes a while, so a thread does it while the first slabs render.
+    readback.tiled = true;
+    // The slices of an export cost something else than those of the previous one
+    write_budget.reset();
+    readback.volume_texture = volume_texture;
+    readback.bricks = bricks;
+    readback.filter = _filter;
+    straightened_slice_indices(cage, dims.z, readback.slice_indices);
+    readback.sampler.build(cage);
+    readback.corners.assign(4 * readback.slice_indices.size(), glm::vec4(0.f));
+    readback.num_corner_slices = 0;
+    readback.corners_done = false;
+    readback.corner_thread = std::thread(&VolumeExporter::evaluate_slice_corners, this, volume_dims);
+
+    for (int c = 0; c < readback.num_channels; c++) {
+        const ChannelFormat& format = channel_format(c, _intensity_16bit);
+        glGenTextures(NUM_READBACK_BUFFERS, readback.slab_texture[c]);
+        for (GLuint texture : readback.slab_texture[c]) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format.internal_format, dims.x, dims.y, readback.slices_per_slab, 0,
+                         format.format, format.type, nullptr);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    report_memory_usage();
+
+    poll_write();
+    return true;
+}
+
+bool VolumeExporter::start_readback(const std::string& filename, glm::ivec3 dims, std::shared_ptr<spdlog::logger> logger,
+                                    GLint max_slices_per_slab) {
+    if (readback.active) {
+        logger->error("Cannot export to '{}' while the previous export is still being written", filename);
+        return false;
+    }
+    // The label channels are written next to the intensities
+    const int num_channels = labels.enabled ? int(NUM_CHANNELS) : 1;
+    FishVolWriteOptions write_options;
+    write_options.num_levels = _num_levels;
+    for (int c = 0; c < num_channels; c++) {
+        const std::string channel_filename = c == CHANNEL_INTENSITY ? filename : label_filename(filename, Channel(c));
+        if (!writer[c].begin(channel_filename, Eigen::RowVector3i(dims.x, dims.y, dims.z),
+                             channel_format(c, _intensity_16bit).bytes_per_voxel, logger, write_options)) {
+            for (int i = 0; i < c; i++) {
+                writer[i].finish();
+                writer[i].wait();
+            }
+            return false;
+        }
+    }
+
+    const std::size_t slice_bytes = std::max<std::size_t>(std::size_t(dims.x) * std::size_t(dims.y), 1);
+    const std::size_t max_slices = std::min<std::size_t>(std::size_t(std::max(dims.z, 1)), std::size_t(std::max(max_slices_per_slab, 1)));
+    readback.dims = dims;
+    readback.slices_per_slab = GLsizei(std::max<std::size_t>(1, std::min<std::size_t>(READBACK_SLAB_BYTES / slice_bytes, max_slices)));
+    readback.num_slabs = (dims.z + readback.slices_per_slab - 1) / readback.slices_per_slab;
+    readback.num_issued = 0;
+    readback.num_slab_slices_drawn = 0;
+    readback.num_written = 0;
+    readback.num_channels = num_channels;
+    readback.active = true;
+    _write_succeeded = false;
+    report_memory_usage();
+    if (readback.num_slabs == 0) {
+        for (int c = 0; c < num_channels; c++) {
+            writer[c].finish();
+        }
+    }
+    return true;
+}
+
+void VolumeExporter::evaluate_slice_corners(glm::ivec3 volume_dims) {
+    // A slab at a time, so the first slab can render as soon as possible
+    const std::size_t num_slices = readback.slice_indices.size();
+    const std::size_t slices_per_slab = std::size_t(readback.slices_per_slab);
+    std::vector<double> indices;
+    std::vector<CageSampler::Frame> frames;
+    for (std::size_t first = 0; first < num_slices; first += slices_per_slab) {
+        const std::size_t end = std::min(first + slices_per_slab, num_slices);
+        indices.assign(readback.slice_indices.begin() + std::ptrdiff_t(first),
+                       readback.slice_indices.begin() + std::ptrdiff_t(end));
+        // The slices from the first one that misses the cage on stay empty
+        if (!readback.sampler.sample(indices, frames)) {
+            break;
+        }
+        for (std::size_t i = 0; i < frames.size(); i++) {
+            // Corners in the order ll, lr, ur, ul
+            for (int c = 0; c < 4; c++) {
+                const Eigen::RowVector3d& v = frames[i].bounding_box_vertices_3d[c];
+                readback.corners[4 * (first + i) + c] =
+                    glm::vec4(glm::vec3(float(v[0]), float(v[1]), float(v[2])) / glm::vec3(volume_dims), 0.f);
+            }
+        }
+        readback.num_corner_slices.store(int(end), std::memory_order_release);
+    }
+    readback.corners_done.store(true, std::memory_order_release);
+}
+
+bool VolumeExporter::slab_corners_ready(int slab) const {
+    if (!readback.tiled || readback.corners_done.load(std::memory_order_acquire)) {
+        return true;
+    }
+    const int end = std::min((slab + 1) * int(readback.slices_per_slab), int(readback.slice_indices.size()));
+    return readback.num_corner_slices.load(std::memory_order_acquire) >= end;
+}
+
+void VolumeExporter::issue_readback(int slab) {
+    const int buffer = slab % NUM_READBACK_BUFFERS;
+    const GLsizei first_slice = GLsizei(slab) * readback.slices_per_slab;
+    const GLsizei num_slices = std::min(readback.slices_per_slab, readback.dims.z - first_slice);
+    const std::size_t slice_voxels = std::size_t(readback.dims.x) * std::size_t(readback.dims.y);
+
+    // Tiled exports rendered the slab into the textures of its buffer, see draw_slab_slices()
+    GLuint source_textures[NUM_CHANNELS];
+    const GLint first_layer = readback.tiled ? 0 : first_slice;
+    for (int c = 0; c < readback.num_channels; c++) {
+        source_textures[c] = readback.tiled ? readback.slab_texture[c][buffer] : render_texture[c];
+    }
+
+    GLint old_read_framebuffer, old_pack_alignment;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_framebuffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &old_pack_alignment);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readback.framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int c = 0; c < readback.num_channels; c++) {
+        const ChannelFormat& format = channel_format(c, _intensity_16bit);
+        const std::size_t slice_bytes = slice_voxels * format.bytes_per_voxel;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer[c][buffer]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(slice_bytes * num_slices), nullptr, GL_STREAM_READ);
+        for (GLsizei i = 0; i < num_slices; i++) {
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, source_textures[c], 0, first_layer + i);
+            glReadPixels(0, 0, readback.dims.x, readback.dims.y, format.format, format.type,
+                         reinterpret_cast<void*>(slice_bytes * i));
+        }
+    }
+    // One fence covers the read backs of every channel
+    readback.fence[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, old_pack_alignment);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, old_read_framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool VolumeExporter::draw_slab_slices(size_t max_slices, size_t& num_drawn) {
+    const int slab = readback.num_issued;
+    const int buffer = slab % NUM_READBACK_BUFFERS;
+    const GLsizei first_slice = GLsizei(slab) * readback.slices_per_slab;
+    const GLsizei num_slices = std::min(readback.slices_per_slab, readback.dims.z - first_slice);
+    GLuint target_textures[NUM_CHANNELS];
+    for (int c = 0; c < readback.num_channels; c++) {
+        target_textures[c] = readback.slab_texture[c][buffer];
+    }
+
+    // Only the slices whose corners the thread filled, the others stay empty like the slices past the cage. Once
+    // the slab can be rendered the number of those does not change anymore.
+    const int num_ready = readback.num_corner_slices.load(std::memory_order_acquire) - first_slice;
+    const size_t num_filled = size_t(std::max(0, std::min(int(num_slices), num_ready)));
+    if (readback.num_slab_slices_drawn == 0) {
+        clear_layers(target_textures, readback.num_channels, readback.dims.x, readback.dims.y, GLint(num_filled),
+                     num_slices);
+    }
+    const size_t first = size_t(readback.num_slab_slices_drawn);
+    num_drawn = step_slices(first, num_filled, max_slices);
+    if (num_drawn > 0) {
+        draw_slices(target_textures, readback.num_channels, readback.dims.x, readback.dims.y, readback.corners,
+                    size_t(first_slice) + first, num_drawn, GLint(first), readback.volume_texture, readback.bricks,
+                    readback.filter);
+    }
+    readback.num_slab_slices_drawn += GLsizei(num_drawn);
+    if (size_t(readback.num_slab_slices_drawn) < num_filled) {
+        return false;
+    }
+    readback.num_slab_slices_drawn = 0;
+    return true;
+}
+
+bool VolumeExporter::poll_write() {
+    if (!readback.active) {
+        return false;
+    }
+
     push_opengl_debug_group("Export");
-    const size_t num_voxels = size_t(w)*size_t(h)*size_t(d);
-    std::vector<std::uint8_t> out_data;
-    out_data.resize(num_voxels*4);
+    gpu_profiler().begin("Export readback");
 
-    glBindTexture(GL_TEXTURE_3D, render_texture);
-    glGetTexImage(GL_TEXTURE_3D, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)out_data.data());
-    glBindTexture(GL_TEXTURE_3D, 0);
-    glFinish();
-
-    std::vector<uint8_t> real_data;
-    real_data.resize(num_voxels);
-    for (size_t i = 0; i < num_voxels; i++) { real_data[i] = out_data[4*i]; }
-    std::ofstream fout;
-    fout.open(filename, std::ios::binary);
-    fout.write(reinterpret_cast<char*>(real_data.data()), num_voxels*sizeof(uint8_t));
-    fout.close();
+    // Hand the slabs that arrived to the writer, in order. While the disk lags behind they stay in their pixel
+    // buffers, which holds back the next read backs, so every stage of the export keeps a bounded queue.
+    auto writers_full = [&]() {
+        for (int c = 0; c < readback.num_channels; c++) {
+            if (writer[c].num_queued() >= MAX_QUEUED_SLABS) {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (readback.num_written < readback.num_issued && !writers_full()) {
+        const int buffer = readback.num_written % NUM_READBACK_BUFFERS;
+        const GLenum status = glClientWaitSync(readback.fence[buffer], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(readback.fence[buffer]);
+        readback.fence[buffer] = nullptr;
+
+        const GLsizei first_slice = GLsizei(readback.num_written) * readback.slices_per_slab;
+        const GLsizei num_slices = std::min(readback.slices_per_slab, readback.dims.z - first_slice);
+        const std::size_t slab_voxels = std::size_t(readback.dims.x) * std::size_t(readback.dims.y) * std::size_t(num_slices);
+
+        for (int c = 0; c < readback.num_channels; c++) {
+            std::vector<std::uint8_t> slab(slab_voxels * channel_format(c, _intensity_16bit).bytes_per_voxel);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer[c][buffer]);
+            const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(slab.size()), GL_MAP_READ_BIT);
+            if (data) {
+                std::memcpy(slab.data(), data, slab.size());
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            writer[c].push_slab(std::move(slab));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.num_written++;
+        if (readback.num_written == readback.num_slabs) {
+            for (int c = 0; c < readback.num_channels; c++) {
+                writer[c].finish();
+            }
+        }
+    }
+
+    // Keep every pixel buffer busy. Tiled exports render the slices of the slabs first, as many as fit the frame
+    // budget, so a slab may take several frames.
+    const size_t max_slices = write_budget.units(size_t(readback.slices_per_slab));
+    size_t num_drawn = 0;
+    write_budget.begin();
+    while (readback.num_issued < readback.num_slabs &&
+           readback.num_issued - readback.num_written < NUM_READBACK_BUFFERS && slab_corners_ready(readback.num_issued)) {
+        if (readback.tiled) {
+            size_t num_slab_drawn = 0;
+            const bool slab_done = draw_slab_slices(max_slices - std::min(num_drawn, max_slices), num_slab_drawn);
+            num_drawn += num_slab_drawn;
+            if (!slab_done) {
+                break;
+            }
+        }
+        issue_readback(readback.num_issued++);
+        if (readback.tiled && num_drawn >= max_slices) {
+            break;
+        }
+    }
+    write_budget.end(num_drawn);
+
+    gpu_profiler().end();
     pop_opengl_debug_group();
+
+    bool writing = false;
+    for (int c = 0; c < readback.num_channels; c++) {
+        writing = writing || writer[c].is_busy();
+    }
+    if (readback.num_written == readback.num_slabs && !writing) {
+        _write_succeeded = true;
+        for (int c = 0; c < readback.num_channels; c++) {
+            _write_succeeded = writer[c].wait() && _write_succeeded;
+        }
+        readback.active = false;
+        if (readback.tiled) {
+            for (int c = 0; c < readback.num_channels; c++) {
+                glDeleteTextures(NUM_READBACK_BUFFERS, readback.slab_texture[c]);
+                std::fill(std::begin(readback.slab_texture[c]), std::end(readback.slab_texture[c]), 0);
+            }
+            readback.corner_thread.join();
+            readback.corners.clear();
+            readback.corners.shrink_to_fit();
+            readback.slice_indices.clear();
+            readback.sampler.clear();
+            readback.bricks = nullptr;
+        }
+        report_memory_usage();
+    }
+    return readback.active;
 }
 
-void VolumeExporter::set_export_dims(GLsizei w, GLsizei h, GLsizei d) {
-    this->w = w;
-    this->h = h;
-    this->d = d;
-    glBindTexture(GL_TEXTURE_3D, render_texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, w, h, d, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
+float VolumeExporter::write_progress() const {
+    return readback.num_slabs > 0 ? float(readback.num_written) / float(readback.num_slabs) : 0.f;
+}
+
+std::size_t VolumeExporter::export_texture_bytes(GLsizei w, GLsizei h, GLsizei d) const {
+    std::size_t bytes = 0;
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        if (render_texture[c] != 0) {
+            bytes += std::size_t(w) * std::size_t(h) * std::size_t(d) * channel_format(c, _intensity_16bit).bytes_per_voxel;
+        }
+    }
+    return bytes;
+}
+
+void VolumeExporter::report_memory_usage() const {
+    std::size_t device_bytes = export_texture_bytes(w, h, d) + export_texture_bytes(back.w, back.h, back.d);
+    if (readback.active) {
+        // Every buffer holds a slab of every channel written, tiled exports render it into a slab texture first
+        const std::size_t slab_voxels = std::size_t(readback.dims.x) * std::size_t(readback.dims.y) *
+                                        std::size_t(readback.slices_per_slab);
+        for (int c = 0; c < readback.num_channels; c++) {
+            const std::size_t slab_bytes = slab_voxels * channel_format(c, _intensity_16bit).bytes_per_voxel;
+            device_bytes += NUM_READBACK_BUFFERS * slab_bytes * (readback.tiled ? 2 : 1);
+        }
+    }
+    memory_tracker().set(MEMORY_NAME, 0, device_bytes);
+}
+
+GLuint VolumeExporter::create_render_texture(int channel) const {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    if (channel == CHANNEL_INTENSITY) {
+        GLfloat transparent_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, transparent_color);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    } else {
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return texture;
+}
+
+void VolumeExporter::respecify_textures(const GLuint* textures, GLsizei w, GLsizei h, GLsizei d) const {
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        if (textures[c] == 0) {
+            continue;
+        }
+        const ChannelFormat& format = channel_format(c, _intensity_16bit);
+        glBindTexture(GL_TEXTURE_3D, textures[c]);
+        glTexImage3D(GL_TEXTURE_3D, 0, format.internal_format, w, h, d, 0, format.format, format.type, 0);
+    }
     glBindTexture(GL_TEXTURE_3D, 0);
 }
 
+void VolumeExporter::resize_export_textures() {
+    respecify_textures(render_texture, w, h, d);
+    respecify_textures(back.texture, back.w, back.h, back.d);
+    report_memory_usage();
+}
+
+void VolumeExporter::resize_back_textures(GLsizei w, GLsizei h, GLsizei d) {
+    if (w == back.w && h == back.h && d == back.d) {
+        return;
+    }
+    const std::size_t old_bytes = export_texture_bytes(back.w, back.h, back.d);
+    const std::size_t new_bytes = export_texture_bytes(w, h, d);
+    if (new_bytes > old_bytes) {
+        memory_tracker().check("Resizing the export texture", 0, new_bytes - old_bytes);
+    }
+    back.w = w;
+    back.h = h;
+    back.d = d;
+    respecify_textures(back.texture, w, h, d);
+    report_memory_usage();
+}
+
+void VolumeExporter::invalidate_preview() {
+    preview = SliceSource();
+    if (rebuild.active) {
+        // The slices copied from the front buffer are stale as well, and the channels may have changed
+        rebuild.target.num_channels = labels.enabled ? int(NUM_CHANNELS) : 1;
+        plan_slices();
+    }
+}
+
+void VolumeExporter::cancel_update() {
+    rebuild.active = false;
+    rebuild.target = SliceSource();
+    rebuild.pending.clear();
+    rebuild.num_rendered = 0;
+}
+
+void VolumeExporter::set_export_dims(GLsizei w, GLsizei h, GLsizei d) {
+    next_dims = glm::ivec3(w, h, d);
+}
+
+void VolumeExporter::set_intensity_16bit(bool enabled) {
+    if (enabled == _intensity_16bit) {
+        return;
+    }
+    // A running export reads back the intensities in the current format
+    while (poll_write()) {
+        std::this_thread::yield();
+    }
+    _intensity_16bit = enabled;
+    if (render_texture[CHANNEL_INTENSITY] != 0) {
+        resize_export_textures();
+        invalidate_preview();
+    }
+}
+
+void VolumeExporter::set_label_data(GLuint index_texture, const std::vector<uint32_t>& arc_features,
+                                    const std::vector<uint32_t>& selected_features) {
+    // A running export may still read the label textures
+    while (poll_write()) {
+        std::this_thread::yield();
+    }
+    labels.index_texture = index_texture;
+    if (labels.feature_texture == 0) {
+        glGenTextures(1, &labels.feature_texture);
+        glGenTextures(1, &labels.selection_texture);
+        for (GLuint texture : { labels.feature_texture, labels.selection_texture }) {
+            glBindTexture(GL_TEXTURE_1D, texture);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        }
+    }
+
+    // The first entry of arc_features is the number of features, the shader only needs the mapping
+    std::vector<uint32_t> features;
+    if (arc_features.size() > 1) {
+        features.assign(arc_features.begin() + 1, arc_features.end());
+    } else {
+        features.push_back(std::numeric_limits<uint32_t>::max());
+    }
+    glBindTexture(GL_TEXTURE_1D, labels.feature_texture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32UI, GLsizei(features.size()), 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                 (const GLvoid*) features.data());
+
+    // Same bitset as SelectionRenderer::set_selection_data
+    std::uint32_t max_feature = 0;
+    for (std::uint32_t feature : selected_features) {
+        max_feature = std::max(max_feature, feature);
+    }
+    std::vector<std::uint32_t> selection_bits(max_feature / 32 + 1, 0);
+    for (std::uint32_t feature : selected_features) {
+        selection_bits[feature / 32] |= std::uint32_t(1) << (feature % 32);
+    }
+    glBindTexture(GL_TEXTURE_1D, labels.selection_texture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32UI, GLsizei(selection_bits.size()), 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                 (const GLvoid*) selection_bits.data());
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    for (int c = CHANNEL_FEATURE; c < NUM_CHANNELS; c++) {
+        if (render_texture[c] == 0) {
+            render_texture[c] = create_render_texture(c);
+            back.texture[c] = create_render_texture(c);
+        }
+    }
+    labels.enabled = true;
+    resize_export_textures();
+    invalidate_preview();
+}
+
+void VolumeExporter::clear_label_data() {
+    if (!labels.enabled) {
+        return;
+    }
+    // A running export may still read the label textures
+    while (poll_write()) {
+        std::this_thread::yield();
+    }
+    glDeleteTextures(1, &labels.feature_texture);
+    glDeleteTextures(1, &labels.selection_texture);
+    glDeleteTextures(NUM_CHANNELS - CHANNEL_FEATURE, &render_texture[CHANNEL_FEATURE]);
+    glDeleteTextures(NUM_CHANNELS - CHANNEL_FEATURE, &back.texture[CHANNEL_FEATURE]);
+    std::fill(std::begin(render_texture) + CHANNEL_FEATURE, std::end(render_texture), 0);
+    std::fill(std::begin(back.texture) + CHANNEL_FEATURE, std::end(back.texture), 0);
+    labels.feature_texture = 0;
+    labels.selection_texture = 0;
+    labels.index_texture = 0;
+    labels.enabled = false;
+    invalidate_preview();
+    report_memory_usage();
+}
+
 void VolumeExporter::destroy() {
+    // Finish writing, the export texture is about to go away
+    while (poll_write()) {
+        std::this_thread::yield();
+    }
+    cancel_update();
+    clear_label_data();
+    invalidate_preview();
+    glDeleteFramebuffers(1, &readback.framebuffer);
+    readback.framebuffer = 0;
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        glDeleteBuffers(NUM_READBACK_BUFFERS, readback.pixel_buffer[c]);
+        std::fill(std::begin(readback.pixel_buffer[c]), std::end(readback.pixel_buffer[c]), 0);
+    }
+
+    glDeleteProgram(tet.program);
+    glDeleteVertexArrays(1, &tet.vao);
+    glDeleteBuffers(1, &tet.vertex_buffer);
+    glDeleteBuffers(1, &tet.index_buffer);
+    tet.program = 0;
+    tet.vao = 0;
+    tet.vertex_buffer = 0;
+    tet.index_buffer = 0;
     glDeleteProgram(slice.program);
+    slice.program = 0;
+    glDeleteTextures(1, &slice.corner_texture);
+    glDeleteBuffers(1, &slice.corner_buffer);
     glDeleteFramebuffers(1, &framebuffer);
-    glDeleteTextures(1, &render_texture);
+    glDeleteTextures(1, &render_texture[CHANNEL_INTENSITY]);
+    glDeleteTextures(1, &back.texture[CHANNEL_INTENSITY]);
+    render_texture[CHANNEL_INTENSITY] = 0;
+    back.texture[CHANNEL_INTENSITY] = 0;
     glDeleteVertexArrays(1, &empty_vao);
+    glDeleteSamplers(1, &volume_sampler);
+    volume_sampler = 0;
+    update_budget.destroy();
+    write_budget.destroy();
     w = 0; h = 0; d = 0;
+    back.w = 0; back.h = 0; back.d = 0;
+    memory_tracker().set(MEMORY_NAME, 0, 0);
 }
 
 void VolumeExporter::init(GLsizei w, GLsizei h, GLsizei d) {
     push_opengl_debug_group("Init Slice");
-    igl::opengl::create_shader_program(SLICE_VERTEX_SHADER,
-                                       SLICE_FRAGMENT_SHADER, {}, slice.program);
-    slice.ll_location = glGetUniformLocation(slice.program, "ll");
-    slice.lr_location = glGetUniformLocation(slice.program, "lr");
-    slice.ul_location = glGetUniformLocation(slice.program, "ul");
-    slice.ur_location = glGetUniformLocation(slice.program, "ur");
+    const std::string fragment_shader = std::string(SLICE_FRAGMENT_SHADER_VERSION) + VolumeBrickCache::GLSL + SLICE_FRAGMENT_SHADER;
+    // GLSL 150 has no layout qualifiers on the outputs, each one is bound to the attachment of its channel
+    create_cached_shader_program(SLICE_GEOMETRY_SHADER, SLICE_VERTEX_SHADER, fragment_shader, {}, slice.program,
+                                 { { "out_color", CHANNEL_INTENSITY }, { "out_feature", CHANNEL_FEATURE },
+                                   { "out_selection", CHANNEL_SELECTION } });
+    slice.corners_location = glGetUniformLocation(slice.program, "slice_corners");
+    slice.num_corner_slices_location = glGetUniformLocation(slice.program, "num_corner_slices");
+    slice.first_layer_location = glGetUniformLocation(slice.program, "first_layer");
+    slice.filter_location = glGetUniformLocation(slice.program, "filter_mode");
     slice.texture_location = glGetUniformLocation(slice.program, "tex");
     slice.tf_location = glGetUniformLocation(slice.program, "tf");
+    slice.use_brick_cache_location = glGetUniformLocation(slice.program, "use_brick_cache");
+    slice.use_labels_location = glGetUniformLocation(slice.program, "use_labels");
+    slice.index_volume_location = glGetUniformLocation(slice.program, "index_volume");
+    slice.contour_features_location = glGetUniformLocation(slice.program, "contour_features");
+    slice.selection_features_location = glGetUniformLocation(slice.program, "selection_features");
+    slice.brick_cache_locations = VolumeBrickCache::uniform_locations(slice.program);
+
+    create_cached_shader_program(TET_GEOMETRY_SHADER, TET_VERTEX_SHADER, TET_FRAGMENT_SHADER,
+                                 { { "deformed", 0 }, { "rest", 1 } }, tet.program);
+    tet.export_dims_location = glGetUniformLocation(tet.program, "export_dims");
+    tet.layers_per_instance_location = glGetUniformLocation(tet.program, "layers_per_instance");
+    tet.texture_location = glGetUniformLocation(tet.program, "tex");
+    glGenVertexArrays(1, &tet.vao);
+    glGenBuffers(1, &tet.vertex_buffer);
+    glGenBuffers(1, &tet.index_buffer);
+    glBindVertexArray(tet.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, tet.vertex_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<const void*>(0));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<const void*>(3 * sizeof(GLfloat)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tet.index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glGenVertexArrays(1, &empty_vao);
 
-    glGenTextures(1, &render_texture);
-    glBindTexture(GL_TEXTURE_3D, render_texture);
-    GLfloat transparent_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-    glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, transparent_color);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glGenSamplers(1, &volume_sampler);
+    const GLfloat transparent_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glSamplerParameterfv(volume_sampler, GL_TEXTURE_BORDER_COLOR, transparent_color);
+    glSamplerParameteri(volume_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(volume_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(volume_sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(volume_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(volume_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenBuffers(1, &slice.corner_buffer);
+    glGenTextures(1, &slice.corner_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, slice.corner_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, slice.corner_buffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, slice.corner_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
 
-    set_export_dims(w, h, d);
+    // Both buffers start at the same dims, so the first update does not reallocate the back buffer
+    render_texture[CHANNEL_INTENSITY] = create_render_texture(CHANNEL_INTENSITY);
+    back.texture[CHANNEL_INTENSITY] = create_render_texture(CHANNEL_INTENSITY);
+    this->w = back.w = w;
+    this->h = back.h = h;
+    this->d = back.d = d;
+    next_dims = glm::ivec3(w, h, d);
+    resize_export_textures();
 
     glGenFramebuffers(1, &framebuffer);
+    glGenFramebuffers(1, &readback.framebuffer);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        glGenBuffers(NUM_READBACK_BUFFERS, readback.pixel_buffer[c]);
+    }
 
     glBindTexture(GL_TEXTURE_3D, 0);
     pop_opengl_debug_group();
@@ -139,75 +983,419 @@ void VolumeExporter::init(GLsizei w, GLsizei h, GLsizei d) {
 }
 
 void VolumeExporter::update(BoundingCage& cage, GLuint volume_texture, glm::ivec3 volume_dims) {
+    update(cage, volume_texture, nullptr, volume_dims);
+}
+
+void VolumeExporter::update(BoundingCage& cage, const VolumeBrickCache& bricks, glm::ivec3 volume_dims) {
+    update(cage, 0, &bricks, volume_dims);
+}
+
+void VolumeExporter::slice_corners(BoundingCage& cage, glm::ivec3 volume_dims, GLsizei depth, std::vector<glm::vec4>& corners) const {
+    // Shared with the CPU straightener so both render the same slices
+    std::vector<Eigen::RowVector3f> cage_corners;
+    straightened_slice_corners(cage, int(depth), cage_corners);
+
+    corners.clear();
+    corners.reserve(cage_corners.size());
+    for (const Eigen::RowVector3f& c : cage_corners) {
+        corners.push_back(glm::vec4(glm::vec3(c[0], c[1], c[2]) / glm::vec3(volume_dims), 0.f));
+    }
+}
+
+void VolumeExporter::update(BoundingCage& cage, GLuint volume_texture, const VolumeBrickCache* bricks, glm::ivec3 volume_dims) {
+    TRACE_SCOPE("straighten_volume");
+    // An update still in progress is replaced, its back buffer was never shown
+    cancel_update();
+    resize_back_textures(next_dims.x, next_dims.y, next_dims.z);
+
+    SliceSource& target = rebuild.target;
+    slice_corners(cage, volume_dims, back.d, target.corners);
+    target.valid = true;
+    target.volume_texture = volume_texture;
+    target.bricks = bricks;
+    target.residency_version = bricks != nullptr ? bricks->residency_version() : 0;
+    target.filter = _filter;
+    target.num_channels = labels.enabled ? int(NUM_CHANNELS) : 1;
+    rebuild.active = true;
+    plan_slices();
+}
+
+void VolumeExporter::plan_slices() {
+    const SliceSource& target = rebuild.target;
+    const std::vector<glm::vec4>& corners = target.corners;
+    const std::vector<glm::vec4>& old_corners = preview.corners;
+    const size_t num_slices = corners.size() / 4, old_num_slices = old_corners.size() / 4;
+    const int num_channels = target.num_channels;
+
+    // The slices of the front buffer are only still valid if they were sampled from the same data the same way
+    const bool reuse_slices = preview.valid && preview.volume_texture == target.volume_texture &&
+                              preview.bricks == target.bricks &&
+                              preview.residency_version == target.residency_version &&
+                              preview.filter == target.filter && preview.num_channels == num_channels &&
+                              w == back.w && h == back.h;
+
+    // A slice is rendered from its corners and from those of the neighbour the shader takes its depth from, the
+    // next slice or the previous one for the last slice
+    auto same_slice = [&](size_t k, size_t j) {
+        auto neighbour = [](size_t i, size_t n) { return i + 1 < n ? i + 1 : i - 1; };
+        if (!std::equal(corners.begin() + 4 * k, corners.begin() + 4 * k + 4, old_corners.begin() + 4 * j)) {
+            return false;
+        }
+        if (num_slices == 1 || old_num_slices == 1) {
+            return num_slices == old_num_slices;
+        }
+        const size_t nk = neighbour(k, num_slices), nj = neighbour(j, old_num_slices);
+        return std::equal(corners.begin() + 4 * nk, corners.begin() + 4 * nk + 4, old_corners.begin() + 4 * nj);
+    };
+    auto slice_hash = [](const std::vector<glm::vec4>& slice_corners, size_t i) {
+        return hash_bytes(reinterpret_cast<const std::uint8_t*>(slice_corners.data() + 4 * i), 4 * sizeof(glm::vec4));
+    };
+
+    // source[k] is the slice of the front buffer which slice k is copied from, or -1 to render it. Unchanged
+    // cells keep their order, so the old slice after the source of the previous slice is the usual match.
+    std::vector<std::ptrdiff_t> source(num_slices, -1);
+    if (reuse_slices) {
+        std::unordered_map<std::uint64_t, size_t> old_slices;
+        old_slices.reserve(old_num_slices);
+        for (size_t j = 0; j < old_num_slices; j++) {
+            old_slices.emplace(slice_hash(old_corners, j), j);
+        }
+        std::ptrdiff_t last_source = -1;
+        for (size_t k = 0; k < num_slices; k++) {
+            std::ptrdiff_t j = last_source + 1;
+            if (size_t(j) >= old_num_slices || !same_slice(k, size_t(j))) {
+                const auto it = old_slices.find(slice_hash(corners, k));
+                j = it != old_slices.end() && same_slice(k, it->second) ? std::ptrdiff_t(it->second) : -1;
+            }
+            if (j >= 0) {
+                source[k] = j;
+                last_source = j;
+            }
+        }
+        // A lone last slice would be drawn without the slice before it, which the shader needs for its depth
+        if (num_slices > 1 && source[num_slices - 1] < 0) {
+            source[num_slices - 2] = -1;
+        }
+    }
+
+    rebuild.pending.clear();
+    rebuild.num_rendered = 0;
+    for (size_t k = 0; k < num_slices; k++) {
+        if (source[k] < 0) {
+            rebuild.pending.push_back(k);
+        }
+    }
+
+    push_opengl_debug_group("Plan Slices");
+    gpu_profiler().begin("Copy unchanged slices");
+    GLint old_read_framebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readback.framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    for (size_t k = 0; k < num_slices; k++) {
+        if (source[k] < 0) {
+            continue;
+        }
+        for (int c = 0; c < num_channels; c++) {
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, render_texture[c], 0,
+                                      GLint(source[k]));
+            glBindTexture(GL_TEXTURE_3D, back.texture[c]);
+            glCopyTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, GLint(k), 0, 0, back.w, back.h);
+        }
+    }
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, old_read_framebuffer);
+    gpu_profiler().end();
+
+    // The layers past the last slice are empty, like those of the slabs of a tiled export
+    clear_layers(back.texture, num_channels, back.w, back.h, GLint(std::min(num_slices, size_t(back.d))), back.d);
+    pop_opengl_debug_group();
+}
+
+size_t VolumeExporter::step_slices(size_t first, size_t n, size_t max_slices) {
+    size_t end = std::min(n, first + std::max<size_t>(max_slices, 1));
+    if (end + 1 == n) {
+        end++;
+    }
+    return end - first;
+}
+
+float VolumeExporter::update_progress() const {
+    if (!rebuild.active) {
+        return 1.f;
+    }
+    return rebuild.pending.empty() ? 1.f : float(rebuild.num_rendered) / float(rebuild.pending.size());
+}
+
+void VolumeExporter::set_frame_budget_ms(double budget_ms) {
+    update_budget.set_budget_ms(budget_ms);
+    write_budget.set_budget_ms(budget_ms);
+}
+
+bool VolumeExporter::poll_update() {
+    if (!rebuild.active) {
+        return false;
+    }
+    // A write reads the front buffer back, it has to stay as it is until the write is done
+    if (readback.active && !readback.tiled) {
+        return true;
+    }
+    TRACE_SCOPE("straighten_volume_step");
+    const SliceSource& target = rebuild.target;
+    const std::vector<size_t>& pending = rebuild.pending;
+
+    const size_t end = rebuild.num_rendered + step_slices(rebuild.num_rendered, pending.size(),
+                                                          update_budget.units(SLICES_PER_UPDATE_STEP));
+    update_budget.begin();
+    for (size_t i = rebuild.num_rendered; i < end;) {
+        // Runs of consecutive slices are drawn together
+        size_t run_end = i + 1;
+        while (run_end < end && pending[run_end] == pending[run_end - 1] + 1) {
+            run_end++;
+        }
+        draw_slices(back.texture, target.num_channels, back.w, back.h, target.corners, pending[i], run_end - i,
+                    GLint(pending[i]), target.volume_texture, target.bricks, target.filter);
+        i = run_end;
+    }
+    update_budget.end(end - rebuild.num_rendered);
+    rebuild.num_rendered = end;
+    if (rebuild.num_rendered < pending.size()) {
+        return true;
+    }
+
+    std::swap_ranges(std::begin(render_texture), std::end(render_texture), std::begin(back.texture));
+    std::swap(w, back.w);
+    std::swap(h, back.h);
+    std::swap(d, back.d);
+    preview = std::move(rebuild.target);
+    cancel_update();
+    return false;
+}
+
+void VolumeExporter::update(const Eigen::MatrixXd& deformed_TV, const Eigen::MatrixXd& rest_TV,
+                            const Eigen::MatrixXi& TT, GLuint volume_texture, glm::ivec3 volume_dims) {
+    TRACE_SCOPE("resample_tet_mesh");
+    if (deformed_TV.rows() != rest_TV.rows() || TT.cols() != 4) {
+        return;
+    }
+    // The tets overwrite every layer of the front buffer at the current dims, the next cage update starts over
+    cancel_update();
+    invalidate_preview();
+    if (glm::ivec3(w, h, d) != next_dims) {
+        const std::size_t old_bytes = export_texture_bytes(w, h, d);
+        const std::size_t new_bytes = export_texture_bytes(next_dims.x, next_dims.y, next_dims.z);
+        if (new_bytes > old_bytes) {
+            memory_tracker().check("Resizing the export texture", 0, new_bytes - old_bytes);
+        }
+        w = next_dims.x;
+        h = next_dims.y;
+        d = next_dims.z;
+        respecify_textures(render_texture, w, h, d);
+        report_memory_usage();
+    }
+
+    // Interleaved deformed and rest positions, and the number of layers the tallest tet spans
+    std::vector<GLfloat> vertices(std::size_t(deformed_TV.rows()) * 6);
+    for (Eigen::Index i = 0; i < deformed_TV.rows(); i++) {
+        for (int c = 0; c < 3; c++) {
+            vertices[6 * i + c] = GLfloat(deformed_TV(i, c));
+            vertices[6 * i + 3 + c] = GLfloat(rest_TV(i, c) / volume_dims[c]);
+        }
+    }
+    std::vector<GLuint> indices(std::size_t(TT.rows()) * 4);
+    double max_span = 0.0;
+    for (Eigen::Index t = 0; t < TT.rows(); t++) {
+        double z_min = std::numeric_limits<double>::infinity();
+        double z_max = -z_min;
+        for (int c = 0; c < 4; c++) {
+            indices[4 * t + c] = GLuint(TT(t, c));
+            z_min = std::min(z_min, deformed_TV(TT(t, c), 2));
+            z_max = std::max(z_max, deformed_TV(TT(t, c), 2));
+        }
+        max_span = std::max(max_span, z_max - z_min);
+    }
+    const int layers_per_instance = TET_MAX_GEOMETRY_VERTICES / TET_VERTICES_PER_LAYER;
+    const int max_layers = int(std::ceil(max_span)) + 1;
+    const GLsizei num_instances = GLsizei((max_layers + layers_per_instance - 1) / layers_per_instance);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    const GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+
+    push_opengl_debug_group("Export Tet Mesh");
+    gpu_profiler().begin("Export tet mesh");
+
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, render_texture[CHANNEL_INTENSITY], 0);
+    for (int c = 1; c < NUM_CHANNELS; c++) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + c, 0, 0);
+    }
+    const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &draw_buffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        exit(EXIT_FAILURE);
+    }
+    glViewport(0, 0, w, h);
+    const GLfloat clear_color[4] = { 0.f, 0.f, 0.f, 0.f };
+    glClearBufferfv(GL_COLOR, 0, clear_color);
+
+    glBindBuffer(GL_ARRAY_BUFFER, tet.vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(vertices.size() * sizeof(GLfloat)), vertices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(tet.vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indices.size() * sizeof(GLuint)), indices.data(), GL_STREAM_DRAW);
+
+    glUseProgram(tet.program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, volume_texture);
+    glBindSampler(0, volume_sampler);
+    glUniform1i(tet.texture_location, 0);
+    glUniform3f(tet.export_dims_location, GLfloat(w), GLfloat(h), GLfloat(d));
+    glUniform1i(tet.layers_per_instance_location, layers_per_instance);
+    glDrawElementsInstanced(GL_LINES_ADJACENCY, GLsizei(indices.size()), GL_UNSIGNED_INT, nullptr, num_instances);
+
+    glBindSampler(0, 0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glUseProgram(0);
+    glBindVertexArray(0);
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+
+    if (cull_face) {
+        glEnable(GL_CULL_FACE);
+    }
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+}
+
+void VolumeExporter::draw_slices(const GLuint* target_textures, int num_channels, GLsizei target_w, GLsizei target_h,
+                                 const std::vector<glm::vec4>& corners, size_t first_slice, size_t num_slices,
+                                 GLint first_layer, GLuint volume_texture, const VolumeBrickCache* bricks,
+                                 ResampleFilter filter) {
+    num_slices = std::min(num_slices, corners.size() / 4 - std::min(first_slice, corners.size() / 4));
+
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
     GLint old_viewport[4];
     glGetIntegerv(GL_VIEWPORT, old_viewport);
 
     push_opengl_debug_group("Export Slice");
+    gpu_profiler().begin("Export slices");
+
+    // Attach every layer of the targets at once, the geometry shader picks the layer
+    GLenum draw_buffers[NUM_CHANNELS];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + c, c < num_channels ? target_textures[c] : 0, 0);
+        draw_buffers[c] = GL_COLOR_ATTACHMENT0 + c;
+    }
+    glDrawBuffers(num_channels, draw_buffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        exit(EXIT_FAILURE);
+    }
+
+    glViewport(0, 0, target_w, target_h);
+
     glUseProgram(slice.program);
     glBindVertexArray(empty_vao);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_3D, volume_texture);
+    glBindSampler(0, volume_sampler);
     glUniform1i(slice.texture_location, 0);
+    glUniform1i(slice.use_brick_cache_location, bricks != nullptr);
+    glUniform1i(slice.filter_location, GLint(filter));
+    if (bricks != nullptr) {
+        bricks->bind(slice.brick_cache_locations, 1);
+    } else {
+        VolumeBrickCache::set_sampler_units(slice.brick_cache_locations, 1);
+    }
 
-    std::vector<double> kf_depths;
-    cage.keyframe_depths(kf_depths);
-    double cage_length = kf_depths.back();
-    int kf_i = 0;
-    for (const BoundingCage::Cell& cell : cage.cells) {
-        double start_depth = kf_depths[kf_i];
-        double end_depth = kf_depths[kf_i + 1];
-
-        int start_frame = int(d * (start_depth / cage_length));
-        int end_frame = int(d * (end_depth / cage_length));
-
-        double start_index = cell.left_keyframe()->index();
-        double end_index = cell.right_keyframe()->index();
-
-        for (int i = start_frame; i < end_frame; i++) {
-            double lam = double(i-start_frame)/double(end_frame-start_frame);
-            double index = (1.0-lam)*start_index + lam*end_index;
-            BoundingCage::KeyFrameIterator kf = cage.keyframe_for_index(index);
-
-            Eigen::MatrixXd v3d = kf->bounding_box_vertices_3d();
-            glm::vec3 ll(v3d(0, 0), v3d(0, 1), v3d(0, 2));
-            glm::vec3 lr(v3d(1, 0), v3d(1, 1), v3d(1, 2));
-            glm::vec3 ur(v3d(2, 0), v3d(2, 1), v3d(2, 2));
-            glm::vec3 ul(v3d(3, 0), v3d(3, 1), v3d(3, 2));
-
-            ll /= glm::vec3(volume_dims);
-            ul /= glm::vec3(volume_dims);
-            lr /= glm::vec3(volume_dims);
-            ur /= glm::vec3(volume_dims);
-
-            glFramebufferTexture3D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_3D, render_texture, 0, i);
-            GLenum draw_buffers[1] = {GL_COLOR_ATTACHMENT0};
-            glDrawBuffers(1, draw_buffers);
-            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-                exit(EXIT_FAILURE);
-            }
-
-            glClearColor(0.f, 0.f, 0.f, 0.f);
-            glViewport(0, 0, w, h);
-            glClear(GL_COLOR_BUFFER_BIT);
+    // Units 1 to 3 hold the brick cache atlas, page table and compressed atlas
+    const GLint corner_unit = 4;
+    glActiveTexture(GL_TEXTURE0 + corner_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, slice.corner_texture);
+    glUniform1i(slice.corners_location, corner_unit);
 
-            glUniform3fv(slice.ll_location, 1, glm::value_ptr(ll));
-            glUniform3fv(slice.lr_location, 1, glm::value_ptr(lr));
-            glUniform3fv(slice.ul_location, 1, glm::value_ptr(ul));
-            glUniform3fv(slice.ur_location, 1, glm::value_ptr(ur));
+    // The label samplers always get their own units, samplers of different types may not share one
+    const bool use_labels = num_channels > 1 && labels.enabled;
+    const GLint index_unit = 5, contour_unit = 6, selection_unit = 7;
+    glActiveTexture(GL_TEXTURE0 + index_unit);
+    glBindTexture(GL_TEXTURE_3D, use_labels ? labels.index_texture : 0);
+    glActiveTexture(GL_TEXTURE0 + contour_unit);
+    glBindTexture(GL_TEXTURE_1D, use_labels ? labels.feature_texture : 0);
+    glActiveTexture(GL_TEXTURE0 + selection_unit);
+    glBindTexture(GL_TEXTURE_1D, use_labels ? labels.selection_texture : 0);
+    glUniform1i(slice.index_volume_location, index_unit);
+    glUniform1i(slice.contour_features_location, contour_unit);
+    glUniform1i(slice.selection_features_location, selection_unit);
+    glUniform1i(slice.use_labels_location, use_labels);
 
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
+    // Texture buffers can be as small as 65536 texels, larger exports are drawn in several batches. Each batch
+    // also uploads the slice after it (if there is one) so the box filter sees the distance to it.
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    const size_t slices_per_batch = std::max<size_t>(size_t(max_texels) / 4, 2) - 1;
+    const size_t total_slices = corners.size() / 4;
 
-        kf_i += 1;
+    glBindBuffer(GL_TEXTURE_BUFFER, slice.corner_buffer);
+    for (size_t first = 0; first < num_slices; first += slices_per_batch) {
+        const size_t count = std::min(slices_per_batch, num_slices - first);
+        const size_t num_uploaded = std::min(count + 1, total_slices - (first_slice + first));
+        glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(4 * num_uploaded * sizeof(glm::vec4)), corners.data() + 4 * (first_slice + first), GL_STREAM_DRAW);
+        glUniform1i(slice.num_corner_slices_location, GLint(num_uploaded));
+        glUniform1i(slice.first_layer_location, first_layer + GLint(first));
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, GLsizei(count));
     }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
+    glActiveTexture(GL_TEXTURE0 + selection_unit);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE0 + contour_unit);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE0 + index_unit);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0 + corner_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, 0);
     glBindVertexArray(0);
     glUseProgram(0);
     glBindTexture(GL_TEXTURE_3D, 0);
+    gpu_profiler().end();
     pop_opengl_debug_group();
 
     glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
 }
+
+void VolumeExporter::clear_layers(const GLuint* target_textures, int num_channels, GLsizei target_w, GLsizei target_h,
+                                  GLint first_layer, GLint end_layer) {
+    if (first_layer >= end_layer) {
+        return;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    glViewport(0, 0, target_w, target_h);
+    for (int c = 1; c < NUM_CHANNELS; c++) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + c, 0, 0);
+    }
+    const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &draw_buffer);
+
+    // The feature attachment is an integer texture, which glClear cannot clear
+    const GLfloat clear_color[4] = { 0.f, 0.f, 0.f, 0.f };
+    const GLuint clear_feature[4] = { 0, 0, 0, 0 };
+    for (int c = 0; c < num_channels; c++) {
+        for (GLint layer = first_layer; layer < end_layer; layer++) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target_textures[c], 0, layer);
+            if (c == CHANNEL_FEATURE) {
+                glClearBufferuiv(GL_COLOR, 0, clear_feature);
+            } else {
+                glClearBufferfv(GL_COLOR, 0, clear_color);
+            }
+        }
+    }
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+}
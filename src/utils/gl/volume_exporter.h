@@ -2,28 +2,194 @@
 
 #include <glm/glm.hpp>
 #include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "../bounding_cage.h"
+#include "../cage_sampler.h"
+#include "../cpu_straightener.h"
+#include "../volume_slab_writer.h"
 #include "glm_conversion.h"
+#include "gpu_time_budget.h"
+#include "volume_brick_cache.h"
 
 
 class VolumeExporter {
+public:
+    // Volumes rendered by a single pass. Only CHANNEL_INTENSITY is rendered unless label data is set,
+    // see set_label_data().
+    enum Channel {
+        CHANNEL_INTENSITY = 0, // 8 bit (or 16 bit, see set_intensity_16bit) straightened intensities
+        CHANNEL_FEATURE,       // 16 bit contour tree feature id, 0 outside of every feature
+        CHANNEL_SELECTION,     // 8 bit mask, 255 inside of the selected features
+        NUM_CHANNELS
+    };
+
+private:
     GLuint framebuffer;
-    GLuint render_texture;
+    // Export texture of each channel, the label channels only exist while label data is set. This is the front
+    // buffer, which holds the last finished update and is what export_texture() returns.
+    GLuint render_texture[NUM_CHANNELS] = {};
+    // Back buffer a cage update renders into over the following frames, it is swapped with the front buffer once
+    // every slice is there. The channels are the same as those of the front buffer.
+    struct {
+        GLuint texture[NUM_CHANNELS] = {};
+        GLsizei w = 0, h = 0, d = 0;
+    } back;
 
     GLuint empty_vao = 0;
+    // Sampler of the volume texture, so the passes filter it linearly whatever the texture's own parameters are
+    GLuint volume_sampler = 0;
 
     struct {
-        GLuint program;
-        GLint ll_location;
-        GLint lr_location;
-        GLint ul_location;
-        GLint ur_location;
+        GLuint program = 0;
+        // Texture buffer with the corners of every slice, see slice_corners()
+        GLuint corner_buffer = 0;
+        GLuint corner_texture = 0;
+        GLint corners_location;
+        GLint num_corner_slices_location;
+        GLint first_layer_location;
+        GLint filter_location;
         GLint texture_location;
         GLint tf_location;
+        GLint use_brick_cache_location;
+        GLint use_labels_location;
+        GLint index_volume_location;
+        GLint contour_features_location;
+        GLint selection_features_location;
+        VolumeBrickCache::UniformLocations brick_cache_locations;
     } slice;
 
+    // Resampling through a deformed tet mesh, see update(deformed_TV, ...)
+    struct {
+        GLuint program = 0;
+        GLuint vao = 0;
+        GLuint vertex_buffer = 0;
+        GLuint index_buffer = 0;
+        GLint export_dims_location;
+        GLint layers_per_instance_location;
+        GLint texture_location;
+    } tet;
+
+    // Segmentation sampled by the label channels
+    struct {
+        bool enabled = false;
+        GLuint index_texture = 0;       // Contour tree arc of every voxel, owned by the caller
+        GLuint feature_texture = 0;     // Feature id of every arc
+        GLuint selection_texture = 0;   // Bitset of the selected features
+    } labels;
+
     GLsizei w = 0, h = 0, d = 0;
+    // Dims of the next cage update, see set_export_dims()
+    glm::ivec3 next_dims = glm::ivec3(0);
+
+    // Slabs in flight between the GPU and the writer thread, see begin_write() and begin_tiled_write()
+    static constexpr int NUM_READBACK_BUFFERS = 3;
+    static constexpr std::size_t READBACK_SLAB_BYTES = std::size_t(16) * 1024 * 1024;
+    // Slabs read back and waiting for the disk, once a writer has this many the read backs wait in their buffers
+    static constexpr std::size_t MAX_QUEUED_SLABS = 3;
+    struct {
+        GLuint framebuffer = 0;
+        GLuint pixel_buffer[NUM_CHANNELS][NUM_READBACK_BUFFERS] = {};
+        GLsync fence[NUM_READBACK_BUFFERS] = {};
+
+        glm::ivec3 dims = glm::ivec3(0);
+        GLsizei slices_per_slab = 1;
+        int num_slabs = 0;
+        int num_issued = 0;    // Slabs whose read back was started
+        GLsizei num_slab_slices_drawn = 0;   // Slices of slab num_issued a tiled export rendered so far
+        int num_written = 0;   // Slabs handed to the writer, the buffer of slab i is i % NUM_READBACK_BUFFERS
+        int num_channels = 1;  // Channels written, the label channels follow the intensity
+        bool active = false;
+
+        // Tiled exports render each slab into the slab texture of its buffer instead of reading the export texture
+        bool tiled = false;
+        GLuint slab_texture[NUM_CHANNELS][NUM_READBACK_BUFFERS] = {};
+        // The corners of the slices are evaluated from a snapshot of the cage by a thread of their own, ahead of
+        // the slabs the GPU renders. corners is sized up front and the thread publishes how many slices it filled.
+        std::vector<glm::vec4> corners;
+        CageSampler sampler;
+        std::vector<double> slice_indices;
+        std::thread corner_thread;
+        std::atomic_int num_corner_slices{ 0 };
+        std::atomic_bool corners_done{ false };
+        GLuint volume_texture = 0;
+        const VolumeBrickCache* bricks = nullptr;
+        ResampleFilter filter = RESAMPLE_TRILINEAR;
+    } readback;
+
+    // How the slices of a buffer were rendered. The next cage update only renders the slices whose corners
+    // changed and copies the others from the front buffer, see plan_slices().
+    struct SliceSource {
+        bool valid = false;
+        std::vector<glm::vec4> corners;
+        GLuint volume_texture = 0;
+        const VolumeBrickCache* bricks = nullptr;
+        std::uint64_t residency_version = 0;
+        ResampleFilter filter = RESAMPLE_TRILINEAR;
+        int num_channels = 1;
+    };
+    // What the front buffer holds
+    SliceSource preview;
+
+    // Slices per poll_update() of a cage update until update_budget measured how long they take
+    static constexpr size_t SLICES_PER_UPDATE_STEP = 64;
+    // GPU time each frame spends on cage updates and on the slices of tiled exports, in slices
+    GpuTimeBudget update_budget;
+    GpuTimeBudget write_budget;
+    // The cage update in progress in the back buffer
+    struct {
+        bool active = false;
+        SliceSource target;
+        // Slices still to render by increasing index, the others were copied when the update started
+        std::vector<size_t> pending;
+        size_t num_rendered = 0;
+    } rebuild;
+
+    ResampleFilter _filter = RESAMPLE_TRILINEAR;
+    int _num_levels = 1;
+    bool _intensity_16bit = false;
+
+    VolumeSlabWriter writer[NUM_CHANNELS];
+    bool _write_succeeded = false;
+
+    bool start_readback(const std::string& filename, glm::ivec3 dims, std::shared_ptr<spdlog::logger> logger,
+                        GLint max_slices_per_slab = std::numeric_limits<GLint>::max());
+    void issue_readback(int slab);
+    // Body of the corner thread of a tiled export
+    void evaluate_slice_corners(glm::ivec3 volume_dims);
+    // Whether slab can be rendered, i.e. the corners of its slices are there
+    bool slab_corners_ready(int slab) const;
+    // Render at most max_slices of the slices of slab num_issued of a tiled export which are left, returns true
+    // once the slab is complete. num_drawn gets the number of slices rendered.
+    bool draw_slab_slices(size_t max_slices, size_t& num_drawn);
+
+    // Export texture of channel, without storage
+    GLuint create_render_texture(int channel) const;
+    // Respecify the textures of a buffer at w x h x d, their contents are undefined after this
+    void respecify_textures(const GLuint* textures, GLsizei w, GLsizei h, GLsizei d) const;
+    // Respecify the export textures of both buffers at their dims
+    void resize_export_textures();
+    // Respecify the back buffer at w x h x d if its dims differ
+    void resize_back_textures(GLsizei w, GLsizei h, GLsizei d);
+    // Forget what the front buffer holds. A cage update in progress starts over and renders every slice.
+    void invalidate_preview();
+
+    // Size of the export textures of a buffer with the current channels at w x h x d
+    std::size_t export_texture_bytes(GLsizei w, GLsizei h, GLsizei d) const;
+    // Report the export textures and the read back buffers in flight to memory_tracker()
+    void report_memory_usage() const;
+    // Number of slices out of n left to render from first on to render in this step, never leaving the last one
+    // alone for the next step since it is drawn along with the slice before it
+    static size_t step_slices(size_t first, size_t n, size_t max_slices);
 
 public:
 
@@ -31,17 +197,115 @@ public:
         return glm::ivec3(w, h, d);
     }
 
-    const GLuint export_texture() const {
-        return render_texture;
+    const GLuint export_texture(Channel channel = CHANNEL_INTENSITY) const {
+        return render_texture[channel];
     }
 
-    void write_texture_data_to_file(std::string filename);
+    // Render the contour tree features and the selection mask of the segmentation along with the intensities.
+    // index_texture holds the arc of every voxel (the index texture of a LoadedVolume) and is sampled with
+    // nearest filtering at the same coordinates as the intensity volume. arc_features maps arcs to features
+    // like SegmentedFeatures::buffer_data (the first entry is the number of features) and selected_features
+    // lists the selected feature ids. Writes then produce label_filename(filename, channel) for each label
+    // channel as well.
+    void set_label_data(GLuint index_texture, const std::vector<uint32_t>& arc_features,
+                        const std::vector<uint32_t>& selected_features);
+    void clear_label_data();
+    bool has_label_data() const { return labels.enabled; }
+
+    // File a label channel of an export to filename is written to, e.g. fish.features.raw for fish.raw
+    static std::string label_filename(const std::string& filename, Channel channel);
+
+    // Writes a .raw file, or a chunked compressed file if filename has the .fishvol extension. This blocks
+    // until the file is written, use begin_write() to write while rendering continues.
+    bool write_texture_data_to_file(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+
+    // Start writing the export texture to filename. It is read back a slab of slices at a time through pixel
+    // buffers and written by a background thread. Call poll_write() once per frame until it returns false,
+    // the export texture must not change before that.
+    bool begin_write(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+    // Never blocks, returns true while the write is still in progress
+    bool poll_write();
+    bool is_writing() const { return readback.active; }
+    // Fraction of the volume that was read back so far
+    float write_progress() const;
+    // GPU time per frame that cage updates and tiled writes spend rendering slices, each of them
+    void set_frame_budget_ms(double budget_ms);
+    double frame_budget_ms() const { return update_budget.budget_ms(); }
+    // Export a dims sized volume straight to filename without allocating it on the GPU. Each slab is rendered
+    // into a small ring of 2D array textures right before it is read back, as many slices per poll_write() as fit
+    // the frame budget (see set_frame_budget_ms()), so the output size is only bounded
+    // by the disk (and by host memory for .fishvol files, which are bricked at the end). The export texture
+    // is not touched. Poll it with poll_write() like begin_write(), bricks has to stay resident until then.
+    bool begin_tiled_write(BoundingCage& cage, GLuint volume_texture, const VolumeBrickCache* bricks,
+                           glm::ivec3 volume_dims, glm::ivec3 dims, const std::string& filename,
+                           std::shared_ptr<spdlog::logger> logger);
+    // Filter used by the following updates and writes. A tiled write keeps the filter it was started with.
+    void set_filter(ResampleFilter filter) { _filter = filter; }
+    ResampleFilter filter() const { return _filter; }
+    // Levels of the 2x downsampled pyramid stored in .fishvol exports of the following writes, including the
+    // full resolution. The pyramid is reduced on the writer thread as the slabs arrive.
+    void set_num_levels(int num_levels) { _num_levels = std::max(num_levels, 1); }
+    int num_levels() const { return _num_levels; }
+    // Keep the intensities at 16 bits, in a GL_R16 export texture and with 2 bytes per voxel in the written files,
+    // instead of quantizing them to 8 bits. Waits for a running write and reallocates the export texture.
+    void set_intensity_16bit(bool enabled);
+    bool intensity_16bit() const { return _intensity_16bit; }
 
+    // Whether the last write that finished succeeded
+    bool write_succeeded() const { return _write_succeeded; }
+
+    // Dims of the following cage updates. export_dims() keeps the dims of the front buffer until an update at the
+    // new dims is finished.
     void set_export_dims(GLsizei w, GLsizei h, GLsizei d);
 
     void init(GLsizei w, GLsizei h, GLsizei d);
 
     void destroy();
+    // True between init and destroy
+    bool is_initialized() const { return slice.program != 0; }
 
+    // Start straightening the volume along cage into the back buffer, replacing an update still in progress.
+    // Nothing is rendered before the next poll_update().
     void update(BoundingCage& cage, GLuint volume_texture, glm::ivec3 volume_dims);
+
+    // Sample an out-of-core volume through its brick cache instead of a single volume texture
+    void update(BoundingCage& cage, const VolumeBrickCache& bricks, glm::ivec3 volume_dims);
+
+    // Render the next slices of the cage update in progress, as many as fit the frame budget, and swap the
+    // buffers once it is finished, so export_texture() only ever shows complete updates. Returns true while the
+    // update is still in progress, call it once per frame until then. The volume and bricks of the update have
+    // to stay alive meanwhile.
+    bool poll_update();
+    bool is_updating() const { return rebuild.active; }
+    // Fraction of the slices of the update in progress which are there
+    float update_progress() const;
+    // Abandon the cage update in progress, the front buffer stays as it is
+    void cancel_update();
+
+    // Resample the volume through a deformed tet mesh instead of the cage, e.g. the output of SlimDeformer. Every
+    // output voxel takes the value at the rest position of the point it covers in the deformed mesh. The
+    // rows of deformed_TV are in output voxel units ([0, w] x [0, h] x [0, d]) and those of rest_TV in the
+    // voxels of the volume. Each tet is sliced on the GPU into the layers it spans, so the tets containing the
+    // output voxels are never searched for. Only the intensity channel is rendered, with trilinear filtering.
+    void update(const Eigen::MatrixXd& deformed_TV, const Eigen::MatrixXd& rest_TV, const Eigen::MatrixXi& TT,
+                GLuint volume_texture, glm::ivec3 volume_dims);
+
+private:
+    // Corners ll, lr, ur, ul of each of the depth slices in normalized volume coordinates
+    void slice_corners(BoundingCage& cage, glm::ivec3 volume_dims, GLsizei depth, std::vector<glm::vec4>& corners) const;
+
+    // Render num_slices slices starting at first_slice into the layers from first_layer on of the target texture
+    // of each channel (num_channels of them). The other layers are left alone.
+    void draw_slices(const GLuint* target_textures, int num_channels, GLsizei target_w, GLsizei target_h,
+                     const std::vector<glm::vec4>& corners, size_t first_slice, size_t num_slices, GLint first_layer,
+                     GLuint volume_texture, const VolumeBrickCache* bricks, ResampleFilter filter);
+    // Clear the layers [first_layer, end_layer) of the target texture of each channel
+    void clear_layers(const GLuint* target_textures, int num_channels, GLsizei target_w, GLsizei target_h,
+                      GLint first_layer, GLint end_layer);
+
+    // Start bringing the back buffer to rebuild.target: slices which look the same as one of the front buffer
+    // are copied from its layer, the others are left in rebuild.pending for poll_update() to render
+    void plan_slices();
+
+    void update(BoundingCage& cage, GLuint volume_texture, const VolumeBrickCache* bricks, glm::ivec3 volume_dims);
 };
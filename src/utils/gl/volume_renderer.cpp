@@ -8,8 +8,14 @@
 #include <algorithm>
 #include <iostream>
 #include <array>
+#include <string>
 
 #include "utils/utils.h"
+#include "utils/content_hash.h"
+#include "gpu_profiler.h"
+#include "pixel_footprint.h"
+#include "shader_cache.h"
+#include "uniform_ring.h"
 
 namespace {
 
@@ -59,8 +65,12 @@ constexpr const char* VOLUME_PASS_VERTEX_SHADER = R"(
 // 6. Perform front-to-back compositing
 // 7. Stop if either the ray is exhausted or the combined transparency is above an
 //    early-ray termination threshold (0.99 in this case)
-constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
+// The empty space skipping functions are inserted between the version line and the body
+constexpr const char* VOLUME_PASS_FRAGMENT_SHADER_VERSION = R"(
   #version 150
+)";
+
+constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
   in vec2 uv;
   out vec4 out_color;
 
@@ -69,11 +79,8 @@ constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
   uniform sampler2D value_init_texture;
 
   uniform sampler3D volume_texture;
-  uniform sampler1D transfer_function;
-
-  uniform ivec3 volume_dimensions;
-  uniform vec3 volume_dimensions_rcp;
-  uniform float sampling_rate;
+  // Preintegrated over the segment between (previous sample, sample), see TransferFunctionTexture
+  uniform sampler2D transfer_function;
 
   struct Light_Parameters {
     vec3 position;
@@ -82,7 +89,25 @@ constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
     vec3 specular_color;
     float specular_exponent;
   };
-  uniform Light_Parameters light_parameters;
+
+  // Everything but the samplers, written once per pass. Keep in sync with VolumePassBlock.
+  layout(std140) uniform VolumePassBlock {
+    mat4 inverse_mvp_matrix;
+    Light_Parameters light_parameters;
+    ivec3 volume_dimensions;
+    float sampling_rate;
+    vec3 volume_dimensions_rcp;
+    int num_peeled_layers;
+    // While rendering at a reduced resolution only part of value_init_texture is filled
+    vec2 value_init_uv_scale;
+    // Offset and size of the view in the render targets, see VolumeRenderer::render_views()
+    vec4 view_rect;
+  };
+
+  // Where this pixel of the view is in the render targets
+  vec2 frame_uv() {
+    return view_rect.xy + uv * view_rect.zw;
+  }
 
 
   // Early-ray termination
@@ -121,43 +146,35 @@ constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
     return ambient + diffuse + specular;
   }
 
-  void main() {
-    vec3 entry = texture(entry_texture, uv).rgb;
-    vec3 exit = texture(exit_texture, uv).rgb;
-    if (entry == exit) {
-      out_color = texture(value_init_texture, uv); // vec4(0.0);
-      return;
-    }
-
-    // Combined final color that the volume rendering computed
-    vec4 result = texture(value_init_texture, uv); // vec4(0.0);
-    if (result.a > ERT_THRESHOLD) {
-      out_color = result;
-      return;
-    }
-
+  // Front-to-back composite the samples along the ray from entry to exit on top of result
+  vec4 march_ray(vec3 entry, vec3 exit, vec4 result) {
     vec3 ray_direction = exit - entry;
 
     float t_end = length(ray_direction);
-    float t_incr = min(
-      t_end,
-      t_end / (sampling_rate * length(ray_direction * volume_dimensions))
-    );
-    t_incr = min(t_end, sampling_rate);
 
     vec3 normalized_ray_direction = normalize(ray_direction);
 
     float t = 0.0;
+    // Density at the previous sample, negative when there is none because the ray starts or skipped space
+    float previous_value = -1.0;
     while (t < t_end) {
       vec3 sample_pos = entry + t * normalized_ray_direction;
-      float value = texture(volume_texture, sample_pos).r;
-      vec4 color = texture(transfer_function, value);
-      if (color.a > 0) {
-        // Gradient
-        vec3 gradient = centralDifferenceGradient(sample_pos);
-        gradient = gradient / max(length(gradient), 0.0001);
+      // sampling_rate is the step at full resolution, farther samples step the width of their pixel
+      float t_incr = min(t_end, footprint_step(sample_pos, sampling_rate));
+      float skip = empty_space_skip(sample_pos, normalized_ray_direction, t_incr);
+      if (skip > 0.0) {
+        t += skip;
+        previous_value = -1.0;
+        continue;
+      }
 
-        // Lighting
+      float value = textureLod(volume_texture, sample_pos, footprint_lod(t_incr, sampling_rate)).r;
+      vec4 color = texture(transfer_function, vec2(previous_value < 0.0 ? value : previous_value, value));
+      previous_value = value;
+      if (color.a > 0) {
+        // Lighting is disabled, so the six fetches of centralDifferenceGradient are skipped as well
+        //vec3 gradient = centralDifferenceGradient(sample_pos);
+        //gradient = gradient / max(length(gradient), 0.0001);
         //color.rgb = blinn_phong(light_parameters, color.rgb, color.rgb, vec3(value),
         //                        sample_pos, gradient, -normalized_ray_direction);
 
@@ -175,10 +192,120 @@ constexpr const char* VOLUME_PASS_FRAGMENT_SHADER = R"(
       }
     }
 
+    return result;
+  }
+)";
+
+// Ray casts a single interval given by the entry and exit point textures on top of the
+// result of the previous passes
+constexpr const char* VOLUME_PASS_FRAGMENT_SHADER_MAIN = R"(
+  void main() {
+    vec3 entry = texture(entry_texture, frame_uv()).rgb;
+    vec3 exit = texture(exit_texture, frame_uv()).rgb;
+    if (entry == exit) {
+      out_color = texture(value_init_texture, frame_uv() * value_init_uv_scale); // vec4(0.0);
+      return;
+    }
+
+    // Combined final color that the volume rendering computed
+    vec4 result = texture(value_init_texture, frame_uv() * value_init_uv_scale); // vec4(0.0);
+    if (result.a > ERT_THRESHOLD) {
+      out_color = result;
+      return;
+    }
+
+    out_color = march_ray(entry, exit, result);
+  }
+)";
+
+// Ray casts every interval of the ray inside the bounding geometry in one pass. The depth peeled
+// layers are sorted front to back, so each even layer enters the geometry and the following odd
+// layer leaves it again.
+constexpr const char* PEELED_VOLUME_PASS_FRAGMENT_SHADER_MAIN = R"(
+  uniform sampler2DArray peeled_layers;
+
+  void main() {
+    vec4 result = vec4(0.0);
+    for (int i = 0; i + 1 < num_peeled_layers; i += 2) {
+      vec4 entry = texture(peeled_layers, vec3(frame_uv(), float(i)));
+      vec4 exit = texture(peeled_layers, vec3(frame_uv(), float(i + 1)));
+      if (entry.a == 0.0 || exit.a == 0.0 || result.a > ERT_THRESHOLD) {
+        break;
+      }
+      result = march_ray(entry.rgb, exit.rgb, result);
+    }
     out_color = result;
   }
 )";
 
+// Ray casts the part of the ray inside the unit cube on top of the result of the previous passes. The
+// entry and exit points are found with a slab test in model space, so no endpoint textures are needed.
+constexpr const char* BOX_VOLUME_PASS_FRAGMENT_SHADER_MAIN = R"(
+  void main() {
+    vec4 result = texture(value_init_texture, frame_uv() * value_init_uv_scale);
+    if (result.a > ERT_THRESHOLD) {
+      out_color = result;
+      return;
+    }
+
+    // Ray through this pixel of the view from the near to the far plane
+    vec2 ndc = uv * 2.0 - 1.0;
+    vec4 near_point = inverse_mvp_matrix * vec4(ndc, -1.0, 1.0);
+    vec4 far_point = inverse_mvp_matrix * vec4(ndc, 1.0, 1.0);
+    vec3 origin = near_point.xyz / near_point.w;
+    vec3 direction = far_point.xyz / far_point.w - origin;
+
+    // Avoid 0 * inf for rays parallel to a pair of faces
+    vec3 safe_direction = mix(direction, vec3(1e-8), lessThan(abs(direction), vec3(1e-8)));
+    vec3 t0 = (vec3(0.0) - origin) / safe_direction;
+    vec3 t1 = (vec3(1.0) - origin) / safe_direction;
+    vec3 t_min = min(t0, t1);
+    vec3 t_max = max(t0, t1);
+    float t_entry = max(max(max(t_min.x, t_min.y), t_min.z), 0.0);
+    float t_exit = min(min(min(t_max.x, t_max.y), t_max.z), 1.0);
+    if (t_entry >= t_exit) {
+      out_color = result;
+      return;
+    }
+
+    out_color = march_ray(origin + t_entry * direction, origin + t_exit * direction, result);
+  }
+)";
+
+// Stores the position of the nearest surface behind the layer peeled in the previous pass,
+// the depth of that layer is read from the other one of two ping-ponged depth textures
+constexpr const char* PEEL_PASS_FRAGMENT_SHADER = R"(
+  #version 150
+  in vec3 color;
+  out vec4 out_color;
+
+  uniform sampler2D previous_depth;
+  uniform int layer;
+
+  void main() {
+    if (layer > 0 && gl_FragCoord.z <= texelFetch(previous_depth, ivec2(gl_FragCoord.xy), 0).r) {
+      discard;
+    }
+    out_color = vec4(color, 1.0);
+  }
+)";
+
+// Upsamples the reduced resolution result of an interactive frame into the current framebuffer
+constexpr const char* COMPOSITE_FRAGMENT_SHADER = R"(
+  #version 150
+  in vec2 uv;
+  out vec4 out_color;
+
+  uniform sampler2D frame;
+  uniform vec2 uv_scale;
+
+  void main() {
+    // Do not filter across the edge of the rendered part
+    vec2 half_texel = 0.5 / vec2(textureSize(frame, 0));
+    out_color = texture(frame, min(uv * uv_scale, uv_scale - half_texel));
+  }
+)";
+
 // Shader transforming the vertices from model coordinates to clip space
 constexpr const char* RAY_ENDPOINT_PASS_VERTEX_SHADER = R"(
     #version 150
@@ -206,6 +333,31 @@ constexpr const char* RAY_ENDPOINT_PASS_FRAGMENT_SHADER = R"(
   }
 )";
 
+// Binding points of the uniform blocks of the volume pass
+constexpr GLuint VOLUME_PASS_BLOCK_BINDING = 0;
+constexpr GLuint FOOTPRINT_BLOCK_BINDING = 1;
+
+// std140 layout of VolumePassBlock in VOLUME_PASS_FRAGMENT_SHADER
+struct VolumePassBlock {
+    glm::mat4 inverse_mvp_matrix;
+    glm::vec3 light_position;
+    float padding0;
+    glm::vec3 light_color_ambient;
+    float padding1;
+    glm::vec3 light_color_diffuse;
+    float padding2;
+    glm::vec3 light_color_specular;
+    float light_exponent_specular;
+    glm::ivec3 volume_dimensions;
+    float sampling_rate;
+    glm::vec3 volume_dimensions_rcp;
+    GLint num_peeled_layers;
+    glm::vec2 value_init_uv_scale;
+    float padding3[2];
+    glm::vec4 view_rect;
+};
+static_assert(sizeof(VolumePassBlock) == 192, "VolumePassBlock does not match the std140 layout of the shader");
+
 } // namespace
 
 
@@ -215,9 +367,11 @@ void VolumeRenderer::destroy() {
     std::vector<GLuint> textures = {
         _gl_state.ray_endpoints_pass.entry_texture,
         _gl_state.ray_endpoints_pass.exit_texture,
-        _gl_state.volume_pass.transfer_function_texture,
         _gl_state.multipass.texture[0],
-        _gl_state.multipass.texture[1]
+        _gl_state.multipass.texture[1],
+        _gl_state.peel_pass.layer_texture,
+        _gl_state.peel_pass.depth_texture[0],
+        _gl_state.peel_pass.depth_texture[1]
     };
 
     std::vector<GLuint> framebuffers = {
@@ -226,6 +380,7 @@ void VolumeRenderer::destroy() {
         _gl_state.multipass.framebuffer[0],
         _gl_state.multipass.framebuffer[1],
     };
+    framebuffers.insert(framebuffers.end(), std::begin(_gl_state.peel_pass.framebuffer), std::end(_gl_state.peel_pass.framebuffer));
 
     std::vector<GLuint> buffers = {
         _gl_state.ray_endpoints_pass.vbo,
@@ -243,77 +398,58 @@ void VolumeRenderer::destroy() {
     glDeleteVertexArrays(vertex_arrays.size(), vertex_arrays.data());
     glDeleteProgram(_gl_state.ray_endpoints_pass.program);
     glDeleteProgram(_gl_state.volume_pass.program);
+    glDeleteProgram(_gl_state.volume_pass.peeled_program);
+    glDeleteProgram(_gl_state.volume_pass.box_program);
+    glDeleteProgram(_gl_state.peel_pass.program);
+    glDeleteProgram(_gl_state.composite_pass.program);
+    _empty_space.destroy();
+    _transfer_function.destroy();
+    _volume.reset();
+    _previous_volume.reset();
+    _gl_state = GLState();
+    _uniforms.destroy();
+    _has_cached_frame = false;
+    _has_endpoints = false;
 }
 
 void VolumeRenderer::set_transfer_function(const std::vector<TfNode> &transfer_function) {
-    /* The input transfer_function is a sequence of nodes on a graph as shown below.
-     * Each 'o' corresponds to a TfNode
-     *    a
-     *    l  ^
-     *    p  |                     a[4]
-     *    h  |                      o
-     *    a  |                     / \
-     *       |   a[1]     a[2]    /   \
-     *       |     o-------o     /     \
-     *       |    /    ^    \   /       \
-     *       |   /     |     \ /         \
-     *       |  /      |      o           \
-     *       | /       |     a[3]          \
-     *       |/        |                    \
-     *       o---------|---------------------o---------------o>     t \in [0, 1]
-     *       ^         |                    a[5]             ^
-     *     first       |                                    last
-     *      a[0]       |                                    a[6]
-     *
-     *        local t' renormalized \in [0 = a[1], 1 = a[2]]
-     *        linear interpolation using t' by (1 - t') * a[1] + t' * a[2]
-     */
-
-    // Generate the transfer function texture
-    constexpr const int TRANSFER_FUNCTION_WIDTH = 512;
-    std::vector<TfNode>::const_iterator current = transfer_function.begin();
-    std::vector<TfNode>::const_iterator next = current + 1;
-
-    std::vector<std::array<uint8_t, 4>> transfer_function_data(TRANSFER_FUNCTION_WIDTH);
-    for (int i = 0; i < TRANSFER_FUNCTION_WIDTH; ++i) {
-        const float t = static_cast<float>(i) / (TRANSFER_FUNCTION_WIDTH - 1);
-
-        if (t > next->t) {
-            current = next;
-            next++;
-        }
+    _empty_space.update_transfer_function(_transfer_function.update(transfer_function));
+    _content_version++;
+}
 
-        const float t_prime = (t - current->t) / (next->t - current->t);
+GLenum VolumeRenderer::endpoint_format() const {
+    // RGB16F is not required to be color renderable
+    return _half_precision ? GL_RGBA16F : GL_RGB32F;
+}
 
-        const float rgba[] = {
-            (1 - t_prime) * current->rgba[0] + t_prime * next->rgba[0],
-            (1 - t_prime) * current->rgba[1] + t_prime * next->rgba[1],
-            (1 - t_prime) * current->rgba[2] + t_prime * next->rgba[2],
-            (1 - t_prime) * current->rgba[3] + t_prime * next->rgba[3]
-        };
+GLenum VolumeRenderer::color_format() const {
+    return _half_precision ? GL_RGBA16F : GL_RGBA32F;
+}
 
-        transfer_function_data[i] = {
-            static_cast<uint8_t>(rgba[0] * 255.f),
-            static_cast<uint8_t>(rgba[1] * 255.f),
-            static_cast<uint8_t>(rgba[2] * 255.f),
-            static_cast<uint8_t>(rgba[3] * 255.f)
-        };
+void VolumeRenderer::set_half_precision(bool half_precision) {
+    if (half_precision == _half_precision) {
+        return;
+    }
+    _half_precision = half_precision;
+    if (_gl_state.ray_endpoints_pass.entry_texture != 0) {
+        // Reallocate the render targets in the new format
+        resize_framebuffer(_framebuffer_size);
     }
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, TRANSFER_FUNCTION_WIDTH, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, transfer_function_data.data());
-    glBindTexture(GL_TEXTURE_1D, 0);
 }
 
 void VolumeRenderer::resize_framebuffer(const glm::ivec2& viewport_size) {
+    _has_cached_frame = false;
+    _has_endpoints = false;
+    _framebuffer_size = viewport_size;
+
     // Entry point framebuffer textures
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.entry_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0,
         GL_RGB, GL_FLOAT, nullptr);
 
     // Exit point framebuffer textures
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.exit_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0,
         GL_RGB, GL_FLOAT, nullptr);
 
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -322,13 +458,33 @@ void VolumeRenderer::resize_framebuffer(const glm::ivec2& viewport_size) {
     if (_gl_state.multipass.framebuffer[0] == 0) { return; }
     for (int i = 0; i < 2; i++) {
         glBindTexture(GL_TEXTURE_2D, _gl_state.multipass.texture[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, viewport_size.x, viewport_size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_2D, 0, color_format(), viewport_size.x, viewport_size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+
+    // Depth peeling textures
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _gl_state.peel_pass.layer_texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, color_format(), viewport_size.x, viewport_size.y, MAX_PEELED_LAYERS, 0,
+        GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, _gl_state.peel_pass.depth_texture[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, viewport_size.x, viewport_size.y, 0,
+            GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
     }
 
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void VolumeRenderer::set_bounding_geometry(GLfloat* vertices, GLsizei num_vertices, GLint* indices, GLsizei num_faces) {
+    // Callers set the geometry every frame, only upload it if it actually changed
+    const std::uint64_t vertex_hash = hash_bytes(reinterpret_cast<const std::uint8_t*>(vertices), sizeof(GLfloat)*num_vertices*3);
+    const std::uint64_t index_hash = hash_bytes(reinterpret_cast<const std::uint8_t*>(indices), sizeof(GLint)*num_faces*3);
+    const std::uint64_t geometry_hash = vertex_hash * 31 + index_hash;
+    _analytic_box = false;
+    if (geometry_hash == _geometry_hash && _num_bounding_indices == GLuint(num_faces*3)) {
+        return;
+    }
+    _geometry_hash = geometry_hash;
     _num_bounding_indices = num_faces*3;
 
     glBindBuffer(GL_ARRAY_BUFFER, _gl_state.ray_endpoints_pass.vbo);
@@ -340,6 +496,25 @@ void VolumeRenderer::set_bounding_geometry(GLfloat* vertices, GLsizei num_vertic
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+void VolumeRenderer::update_bounding_vertices(const GLfloat* vertices, GLsizei first, GLsizei count) {
+    _analytic_box = false;
+    if (count <= 0) {
+        return;
+    }
+
+    // The hash only has to change with the geometry for the frame cache to notice
+    const std::uint64_t range_hash = hash_bytes(reinterpret_cast<const std::uint8_t*>(vertices), sizeof(GLfloat)*count*3);
+    _geometry_hash = (_geometry_hash * 31 + range_hash) * 31 + std::uint64_t(first);
+
+    glBindBuffer(GL_ARRAY_BUFFER, _gl_state.ray_endpoints_pass.vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat)*first*3, sizeof(GLfloat)*count*3, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void VolumeRenderer::set_bounding_box() {
+    _analytic_box = true;
+}
+
 void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_shader, const char *picking_shader) {
     constexpr GLsizei NUM_VERTICES = 8;
     constexpr GLsizei NUM_FACES = 12;
@@ -394,10 +569,10 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
     glBindVertexArray(0);
 
     // Shader to render the bounding box entry and exit points
-    igl::opengl::create_shader_program(RAY_ENDPOINT_PASS_VERTEX_SHADER,
-                                       RAY_ENDPOINT_PASS_FRAGMENT_SHADER,
-                                       {{ "in_position", 0 }},
-                                       _gl_state.ray_endpoints_pass.program);
+    create_cached_shader_program(RAY_ENDPOINT_PASS_VERTEX_SHADER,
+                                 RAY_ENDPOINT_PASS_FRAGMENT_SHADER,
+                                 {{ "in_position", 0 }},
+                                 _gl_state.ray_endpoints_pass.program);
     _gl_state.ray_endpoints_pass.uniform_location.model_matrix = glGetUniformLocation(
         _gl_state.ray_endpoints_pass.program, "model_matrix");
     _gl_state.ray_endpoints_pass.uniform_location.view_matrix = glGetUniformLocation(
@@ -409,42 +584,70 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
 
 
 
-    // Shader to render the actual volume
-    igl::opengl::create_shader_program(VOLUME_PASS_VERTEX_SHADER,
-                                       VOLUME_PASS_FRAGMENT_SHADER, {},
-                                       _gl_state.volume_pass.program);
-    _gl_state.volume_pass.uniform_location.entry_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program, "entry_texture");
-    _gl_state.volume_pass.uniform_location.exit_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program, "exit_texture");
-    _gl_state.volume_pass.uniform_location.volume_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program, "volume_texture");
-    _gl_state.volume_pass.uniform_location.volume_dimensions = glGetUniformLocation(
-        _gl_state.volume_pass.program, "volume_dimensions");
-    _gl_state.volume_pass.uniform_location.volume_dimensions_rcp = glGetUniformLocation(
-        _gl_state.volume_pass.program, "volume_dimensions_rcp");
-    _gl_state.volume_pass.uniform_location.transfer_function = glGetUniformLocation(
-        _gl_state.volume_pass.program, "transfer_function");
-    _gl_state.volume_pass.uniform_location.value_init_texture = glGetUniformLocation(
-        _gl_state.volume_pass.program, "value_init_texture");
-    _gl_state.volume_pass.uniform_location.sampling_rate = glGetUniformLocation(
-        _gl_state.volume_pass.program, "sampling_rate");
-    _gl_state.volume_pass.uniform_location.light_position = glGetUniformLocation(
-        _gl_state.volume_pass.program, "light_parameters.position");
-    _gl_state.volume_pass.uniform_location.light_color_ambient = glGetUniformLocation(
-        _gl_state.volume_pass.program, "light_parameters.ambient_color");
-    _gl_state.volume_pass.uniform_location.light_color_diffuse = glGetUniformLocation(
-        _gl_state.volume_pass.program, "light_parameters.diffuse_color");
-    _gl_state.volume_pass.uniform_location.light_color_specular = glGetUniformLocation(
-        _gl_state.volume_pass.program, "light_parameters.specular_color");
-    _gl_state.volume_pass.uniform_location.light_exponent_specular = glGetUniformLocation(
-        _gl_state.volume_pass.program, "light_parameters.specular_exponent");
-
+    // Shaders to render the actual volume, either one interval per pass from the endpoint textures or the
+    // unit cube, or all depth peeled intervals at once
+    const std::string volume_pass_fragment_shader_common =
+            std::string(VOLUME_PASS_FRAGMENT_SHADER_VERSION) + EmptySpaceGrid::GLSL + PixelFootprint::GLSL +
+            VOLUME_PASS_FRAGMENT_SHADER;
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER,
+                                 volume_pass_fragment_shader_common + VOLUME_PASS_FRAGMENT_SHADER_MAIN, {},
+                                 _gl_state.volume_pass.program);
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER,
+                                 volume_pass_fragment_shader_common + PEELED_VOLUME_PASS_FRAGMENT_SHADER_MAIN, {},
+                                 _gl_state.volume_pass.peeled_program);
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER,
+                                 volume_pass_fragment_shader_common + BOX_VOLUME_PASS_FRAGMENT_SHADER_MAIN, {},
+                                 _gl_state.volume_pass.box_program);
+
+    auto get_volume_pass_locations = [](GLuint program, decltype(_gl_state.volume_pass.uniform_location)& location) {
+        location.entry_texture = glGetUniformLocation(program, "entry_texture");
+        location.exit_texture = glGetUniformLocation(program, "exit_texture");
+        location.volume_texture = glGetUniformLocation(program, "volume_texture");
+        location.transfer_function = glGetUniformLocation(program, "transfer_function");
+        location.value_init_texture = glGetUniformLocation(program, "value_init_texture");
+        location.peeled_layers = glGetUniformLocation(program, "peeled_layers");
+        location.empty_space = EmptySpaceGrid::uniform_locations(program);
+        // The other parameters come from the uniform blocks written by volume_pass()
+        bind_uniform_block(program, "VolumePassBlock", VOLUME_PASS_BLOCK_BINDING);
+        bind_uniform_block(program, PixelFootprint::BLOCK_NAME, FOOTPRINT_BLOCK_BINDING);
+    };
+    get_volume_pass_locations(_gl_state.volume_pass.program, _gl_state.volume_pass.uniform_location);
+    get_volume_pass_locations(_gl_state.volume_pass.peeled_program, _gl_state.volume_pass.peeled_uniform_location);
+    get_volume_pass_locations(_gl_state.volume_pass.box_program, _gl_state.volume_pass.box_uniform_location);
+
+    // Shader to depth peel the bounding geometry
+    create_cached_shader_program(RAY_ENDPOINT_PASS_VERTEX_SHADER,
+                                 PEEL_PASS_FRAGMENT_SHADER,
+                                 {{ "in_position", 0 }},
+                                 _gl_state.peel_pass.program);
+    _gl_state.peel_pass.uniform_location.model_matrix = glGetUniformLocation(
+        _gl_state.peel_pass.program, "model_matrix");
+    _gl_state.peel_pass.uniform_location.view_matrix = glGetUniformLocation(
+        _gl_state.peel_pass.program, "view_matrix");
+    _gl_state.peel_pass.uniform_location.projection_matrix = glGetUniformLocation(
+        _gl_state.peel_pass.program, "projection_matrix");
+    _gl_state.peel_pass.uniform_location.previous_depth = glGetUniformLocation(
+        _gl_state.peel_pass.program, "previous_depth");
+    _gl_state.peel_pass.uniform_location.layer = glGetUniformLocation(
+        _gl_state.peel_pass.program, "layer");
+
+    // Shader to upsample interactive frames
+    create_cached_shader_program(VOLUME_PASS_VERTEX_SHADER,
+                                 COMPOSITE_FRAGMENT_SHADER, {},
+                                 _gl_state.composite_pass.program);
+    _gl_state.composite_pass.uniform_location.frame = glGetUniformLocation(
+        _gl_state.composite_pass.program, "frame");
+    _gl_state.composite_pass.uniform_location.uv_scale = glGetUniformLocation(
+        _gl_state.composite_pass.program, "uv_scale");
+
+    _empty_space.init();
+
+    _framebuffer_size = viewport_size;
 
     // Entry point texture and frame buffer
     glGenTextures(1, &_gl_state.ray_endpoints_pass.entry_texture);
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.entry_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0, GL_RGB,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0, GL_RGB,
         GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -458,7 +661,7 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
     // Exit point texture and frame buffer
     glGenTextures(1, &_gl_state.ray_endpoints_pass.exit_texture);
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.exit_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, viewport_size.x, viewport_size.y, 0, GL_RGB,
+    glTexImage2D(GL_TEXTURE_2D, 0, endpoint_format(), viewport_size.x, viewport_size.y, 0, GL_RGB,
         GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -485,12 +688,7 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
 
 
     // Initialize transfer function
-    // Texture
-    glGenTextures(1, &_gl_state.volume_pass.transfer_function_texture);
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    _transfer_function.init();
 
     // Generate a reasonable default transfer function
     TfNode first = { 0.f, { 0.f, 0.f, 0.f, 0.f } };
@@ -506,7 +704,7 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
     for (int i = 0; i < 2; i++) {
         glGenTextures(1, &_gl_state.multipass.texture[i]);
         glBindTexture(GL_TEXTURE_2D, _gl_state.multipass.texture[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, viewport_size.x, viewport_size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_2D, 0, color_format(), viewport_size.x, viewport_size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glBindTexture(GL_TEXTURE_2D, 0);
@@ -519,33 +717,58 @@ void VolumeRenderer::init(const glm::ivec2 &viewport_size, const char *fragment_
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
     pop_opengl_debug_group();
+
+    // Generate depth peeling buffers, one layer of the array texture per framebuffer alternating
+    // between two depth textures so the previous layer's depth can be read while writing the next
+    push_opengl_debug_group("Init VolumeRenderer Depth Peeling");
+    glGenTextures(1, &_gl_state.peel_pass.layer_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _gl_state.peel_pass.layer_texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, color_format(), viewport_size.x, viewport_size.y, MAX_PEELED_LAYERS, 0,
+        GL_RGBA, GL_FLOAT, nullptr);
+    // Interpolating across silhouettes would mix positions of unrelated surfaces
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    for (int i = 0; i < 2; i++) {
+        glGenTextures(1, &_gl_state.peel_pass.depth_texture[i]);
+        glBindTexture(GL_TEXTURE_2D, _gl_state.peel_pass.depth_texture[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, viewport_size.x, viewport_size.y, 0,
+            GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(MAX_PEELED_LAYERS, _gl_state.peel_pass.framebuffer);
+    for (int i = 0; i < MAX_PEELED_LAYERS; i++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.peel_pass.framebuffer[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _gl_state.peel_pass.layer_texture, 0, i);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+            _gl_state.peel_pass.depth_texture[i % 2], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    pop_opengl_debug_group();
 }
 
 void VolumeRenderer::ray_endpoint_pass(const glm::mat4& model_matrix, const glm::mat4& view_matrix, const glm::mat4& proj_matrix) {
+    const View view = { glm::ivec4(0, 0, _framebuffer_size.x, _framebuffer_size.y), view_matrix, proj_matrix };
+    ray_endpoint_pass(model_matrix, &view, 1);
+}
+
+void VolumeRenderer::ray_endpoint_pass(const glm::mat4& model_matrix, const View* views, int num_views) {
     push_opengl_debug_group("Render Bounding Box");
+    gpu_profiler().begin("Volume ray endpoints");
     {
         const glm::vec4 color_transparent(0.0);
 
         // Back up face culling state so we can restore it when we're done
         GLboolean face_culling_enabled = glIsEnabled(GL_CULL_FACE);
 
-        // Backup the previous viewport so we can restore it when we're done
-        GLint old_viewport[4];
-        glGetIntegerv(GL_VIEWPORT, old_viewport);
-
-        // Get the width and height of the entry and exit point textures so we can set the viewport correctly
-        GLint fb_tex_w, fb_tex_h;
-        glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.exit_texture);
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &fb_tex_w);
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &fb_tex_h);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
         // We need face culling to render
         glEnable(GL_CULL_FACE);
 
-        // Set the viewport to match the entry and exit framebuffer textures
-        glViewport(0, 0, fb_tex_w, fb_tex_h);
-
         // Bind the bounding geometry
         glBindVertexArray(_gl_state.ray_endpoints_pass.vao);
 
@@ -553,94 +776,197 @@ void VolumeRenderer::ray_endpoint_pass(const glm::mat4& model_matrix, const glm:
         glUseProgram(_gl_state.ray_endpoints_pass.program);
         glUniformMatrix4fv(_gl_state.ray_endpoints_pass.uniform_location.model_matrix, 1,
             GL_FALSE, glm::value_ptr(model_matrix));
-        glUniformMatrix4fv(_gl_state.ray_endpoints_pass.uniform_location.view_matrix, 1,
-            GL_FALSE, glm::value_ptr(view_matrix));
-        glUniformMatrix4fv(_gl_state.ray_endpoints_pass.uniform_location.projection_matrix,
-            1, GL_FALSE, glm::value_ptr(proj_matrix));
+
+        // Every view is rasterized into its own rectangle of the entry and exit framebuffer textures, which are
+        // only cleared once. The caller restores the viewport.
+        auto draw_views = [&]() {
+            for (int i = 0; i < num_views; i++) {
+                const View& view = views[i];
+                glViewport(view.rect.x, view.rect.y, view.rect.z, view.rect.w);
+                glUniformMatrix4fv(_gl_state.ray_endpoints_pass.uniform_location.view_matrix, 1,
+                    GL_FALSE, glm::value_ptr(view.view_matrix));
+                glUniformMatrix4fv(_gl_state.ray_endpoints_pass.uniform_location.projection_matrix,
+                    1, GL_FALSE, glm::value_ptr(view.proj_matrix));
+                glDrawElements(GL_TRIANGLES, _num_bounding_indices, GL_UNSIGNED_INT, nullptr);
+            }
+        };
 
         // Render entry points of bounding box
         glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.ray_endpoints_pass.entry_framebuffer);
         glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
         glCullFace(GL_FRONT);
-        glDrawElements(GL_TRIANGLES, _num_bounding_indices, GL_UNSIGNED_INT, nullptr);
+        draw_views();
 
         // Render exit points of bounding box
         glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.ray_endpoints_pass.exit_framebuffer);
         glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
         glCullFace(GL_BACK);
-        glDrawElements(GL_TRIANGLES, _num_bounding_indices * 3, GL_UNSIGNED_INT, nullptr);
+        draw_views();
 
         // Restore OpenGL state
         glBindVertexArray(0);
         glUseProgram(0);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
         if (face_culling_enabled == GL_FALSE) {
             glDisable(GL_CULL_FACE);
         }
     }
+    gpu_profiler().end();
     pop_opengl_debug_group();
 }
 
-void VolumeRenderer::volume_pass(const glm::vec3& light_position, const glm::ivec3& volume_dims, GLuint volume_tex, GLuint multipass_tex) {
+void VolumeRenderer::peel_pass(const glm::mat4& model_matrix, const glm::mat4& view_matrix, const glm::mat4& proj_matrix) {
+    push_opengl_debug_group("Depth Peel Bounding Geometry");
+    gpu_profiler().begin("Volume depth peeling");
+    {
+        const glm::vec4 color_transparent(0.0);
+        const GLfloat depth_far = 1.0f;
+
+        // Back up the state we change so we can restore it when we're done
+        GLboolean face_culling_enabled = glIsEnabled(GL_CULL_FACE);
+        GLboolean depth_test_enabled = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+        GLint old_depth_func;
+        glGetIntegerv(GL_DEPTH_FUNC, &old_depth_func);
+
+        // Front and back faces are both layers, the nearest one not peeled yet wins
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        // The caller restores the viewport
+        glViewport(0, 0, _framebuffer_size.x, _framebuffer_size.y);
+
+        glBindVertexArray(_gl_state.ray_endpoints_pass.vao);
+        glUseProgram(_gl_state.peel_pass.program);
+        glUniformMatrix4fv(_gl_state.peel_pass.uniform_location.model_matrix, 1,
+            GL_FALSE, glm::value_ptr(model_matrix));
+        glUniformMatrix4fv(_gl_state.peel_pass.uniform_location.view_matrix, 1,
+            GL_FALSE, glm::value_ptr(view_matrix));
+        glUniformMatrix4fv(_gl_state.peel_pass.uniform_location.projection_matrix,
+            1, GL_FALSE, glm::value_ptr(proj_matrix));
+        glUniform1i(_gl_state.peel_pass.uniform_location.previous_depth, 0);
+        glActiveTexture(GL_TEXTURE0);
+
+        for (int i = 0; i < MAX_PEELED_LAYERS; i++) {
+            // Layer i writes depth_texture[i % 2] and reads the depth of layer i - 1 from the other one
+            glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.peel_pass.framebuffer[i]);
+            glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
+            glClearBufferfv(GL_DEPTH, 0, &depth_far);
+            glBindTexture(GL_TEXTURE_2D, _gl_state.peel_pass.depth_texture[(i + 1) % 2]);
+            glUniform1i(_gl_state.peel_pass.uniform_location.layer, i);
+            glDrawElements(GL_TRIANGLES, _num_bounding_indices, GL_UNSIGNED_INT, nullptr);
+        }
+
+        // Restore OpenGL state
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDepthFunc(old_depth_func);
+        if (face_culling_enabled == GL_TRUE) {
+            glEnable(GL_CULL_FACE);
+        }
+        if (depth_test_enabled == GL_FALSE) {
+            glDisable(GL_DEPTH_TEST);
+        }
+        if (blend_enabled == GL_TRUE) {
+            glEnable(GL_BLEND);
+        }
+    }
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
+
+void VolumeRenderer::volume_pass(const glm::vec3& light_position, const glm::ivec3& volume_dims, GLuint volume_tex, GLuint multipass_tex,
+                                 const glm::vec2& multipass_uv_scale, bool blend, RaySource ray_source,
+                                 const glm::mat4& model_view_matrix, const glm::mat4& proj_matrix,
+                                 int viewport_height, const glm::vec4& view_rect) {
     push_opengl_debug_group("Render Volume TEST");
+    gpu_profiler().begin("Volume ray casting");
 
     //
     //  Setup
     //
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (blend) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glDisable(GL_BLEND);
+    }
 
 
-    glUseProgram(_gl_state.volume_pass.program);
+    const bool peeled = ray_source == RaySource::PEELED_LAYERS;
+    const bool analytic_box = ray_source == RaySource::ANALYTIC_BOX;
+    glUseProgram(peeled ? _gl_state.volume_pass.peeled_program :
+                 analytic_box ? _gl_state.volume_pass.box_program : _gl_state.volume_pass.program);
+    const auto& location = peeled ? _gl_state.volume_pass.peeled_uniform_location :
+                           analytic_box ? _gl_state.volume_pass.box_uniform_location : _gl_state.volume_pass.uniform_location;
     glBindVertexArray(_gl_state.volume_pass.vao);
 
     // Bind the entry points texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.entry_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.entry_texture, 0);
+    glUniform1i(location.entry_texture, 0);
 
     // Bind the exit points texture
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.exit_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.entry_texture, 1);
+    glUniform1i(location.entry_texture, 1);
 
     // Bind the volume texture
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_3D, volume_tex);
-    glUniform1i(_gl_state.volume_pass.uniform_location.volume_texture, 2);
+    glUniform1i(location.volume_texture, 2);
 
-    // Bind the transfer function texture
+    // Bind the preintegrated transfer function table
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_1D, _gl_state.volume_pass.transfer_function_texture);
-    glUniform1i(_gl_state.volume_pass.uniform_location.transfer_function, 3);
+    glBindTexture(GL_TEXTURE_2D, _transfer_function.preintegrated_texture());
+    glUniform1i(location.transfer_function, 3);
 
     // Optional Mutlipass texture
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, multipass_tex);
-    glUniform1i(_gl_state.volume_pass.uniform_location.value_init_texture, 4);
-
-    // Bind rendering parameters
-    glm::vec3 volume_dims_rcp = glm::vec3(1.0) / glm::vec3(volume_dims);
-
-//    GLfloat t_incr = 1.0 / glm::length(glm::vec3(volume_dims));
-//    glUniform1f(_gl_state.volume_pass.uniform_location.sampling_rate, _sampling_rate);
-//    glUniform1f(_gl_state.volume_pass.uniform_location.sampling_rate, t_incr);
-    glUniform1f(_gl_state.volume_pass.uniform_location.sampling_rate, _step_size);
-    glUniform3iv(_gl_state.volume_pass.uniform_location.volume_dimensions, 1, glm::value_ptr(_volume_dimensions));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.volume_dimensions_rcp, 1, glm::value_ptr(volume_dims_rcp));
-    glUniform3fv(_gl_state.volume_pass.uniform_location.light_position, 1, glm::value_ptr(light_position));
-    glUniform3f(_gl_state.volume_pass.uniform_location.light_color_ambient, 0.8f, 0.8f, 0.8f);
-    glUniform3f(_gl_state.volume_pass.uniform_location.light_color_diffuse, 0.8f, 0.8f, 0.8f);
-    glUniform3f(_gl_state.volume_pass.uniform_location.light_color_specular, 1.f, 1.f, 1.f);
-    glUniform1f(_gl_state.volume_pass.uniform_location.light_exponent_specular, 20.f);
+    glUniform1i(location.value_init_texture, 4);
+
+    // Min/max brick grid and transfer function opacity table used to skip empty space
+    _empty_space.bind(location.empty_space, 5, _volume->minmax_grid());
+
+    // Entry and exit points of every interval inside the bounding geometry
+    if (peeled) {
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _gl_state.peel_pass.layer_texture);
+        glUniform1i(location.peeled_layers, 7);
+    }
+
+    // Bind rendering parameters, one copy into the uniform ring per block
+    VolumePassBlock block = {};
+    if (analytic_box) {
+        block.inverse_mvp_matrix = glm::inverse(proj_matrix * model_view_matrix);
+    }
+    block.light_position = light_position;
+    block.light_color_ambient = glm::vec3(0.8f);
+    block.light_color_diffuse = glm::vec3(0.8f);
+    block.light_color_specular = glm::vec3(1.f);
+    block.light_exponent_specular = 20.f;
+    block.volume_dimensions = _volume_dimensions;
+    block.sampling_rate = _step_size * _step_scale;
+    block.volume_dimensions_rcp = glm::vec3(1.0) / glm::vec3(volume_dims);
+    block.num_peeled_layers = MAX_PEELED_LAYERS;
+    block.value_init_uv_scale = multipass_uv_scale;
+    block.view_rect = view_rect;
+    _uniforms.write(VOLUME_PASS_BLOCK_BINDING, block);
+    _uniforms.write(FOOTPRINT_BLOCK_BINDING, PixelFootprint::block(model_view_matrix, proj_matrix, viewport_height,
+                                                                   _footprint_scale));
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
     glBindVertexArray(0);
 
+    gpu_profiler().end();
     pop_opengl_debug_group();
 }
 
@@ -657,16 +983,82 @@ void VolumeRenderer::begin(const glm::ivec3& volume_dims, GLuint tex) {
         return;
     }
 
+    // The multipass buffers are cleared by the first pass, unless it reuses the cached frame stored in them
+
+    if (!_volume || _volume->volume_texture() != tex) {
+        std::swap(_volume, _previous_volume);
+        if (!_volume || _volume->volume_texture() != tex) {
+            _volume = VolumeResource::acquire(tex);
+        }
+    }
+    // Only builds the grid if nobody did since the volume changed
+    _volume->update_minmax_grid();
+
+    // The passes render into the offscreen buffers and restore this viewport, so it is only queried once a frame
+    glGetIntegerv(GL_VIEWPORT, _viewport);
+
+    _current_multipass_buf = 0;
+    _current_volume_tex = tex;
+    _current_volume_dims = volume_dims;
+    _num_passes = 0;
+}
+
+bool VolumeRenderer::EndpointKey::operator==(const EndpointKey& other) const {
+    return model_matrix == other.model_matrix && view_matrix == other.view_matrix &&
+           proj_matrix == other.proj_matrix && geometry_hash == other.geometry_hash;
+}
+
+bool VolumeRenderer::FrameKey::operator==(const FrameKey& other) const {
+    return model_matrix == other.model_matrix && view_matrix == other.view_matrix &&
+           proj_matrix == other.proj_matrix && light_position == other.light_position &&
+           volume_dims == other.volume_dims && volume_texture == other.volume_texture &&
+           geometry_hash == other.geometry_hash && content_version == other.content_version &&
+           volume_version == other.volume_version &&
+           step_size == other.step_size && step_scale == other.step_scale &&
+           footprint_scale == other.footprint_scale &&
+           downsample == other.downsample && ray_source == other.ray_source;
+}
+
+VolumeRenderer::FrameKey VolumeRenderer::frame_key(const glm::mat4& model_matrix, const glm::mat4& view_matrix,
+                                                   const glm::mat4& proj_matrix, const glm::vec3& light_position,
+                                                   RaySource ray_source) const {
+    FrameKey key;
+    key.model_matrix = model_matrix;
+    key.view_matrix = view_matrix;
+    key.proj_matrix = proj_matrix;
+    key.light_position = light_position;
+    key.volume_dims = _current_volume_dims;
+    key.volume_texture = _current_volume_tex;
+    key.geometry_hash = _geometry_hash;
+    key.content_version = _content_version;
+    key.volume_version = _volume ? _volume->version() : 0;
+    key.step_size = _step_size;
+    key.step_scale = _step_scale;
+    key.footprint_scale = _footprint_scale;
+    key.downsample = _downsample;
+    key.ray_source = ray_source;
+    return key;
+}
+
+bool VolumeRenderer::begin_first_pass(const FrameKey& key, bool final) {
+    if (final && _has_cached_frame && key == _cached_frame_key) {
+        composite_pass(_cached_frame_texture, _cached_frame_uv_scale);
+        _current_multipass_buf = -1;
+        _current_volume_tex = 0;
+        return true;
+    }
+
+    // The cached frame lives in one of the multipass buffers which are about to be overwritten
+    _has_cached_frame = false;
+
     // Clear the multipass accumulation buffers
     const glm::vec4 color_transparent(0.0);
     for (int i = 0; i < 2; i++) {
         glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.multipass.framebuffer[i]);
         glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color_transparent));
     }
-
-    _current_multipass_buf = 0;
-    _current_volume_tex = tex;
-    _current_volume_dims = volume_dims;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return false;
 }
 
 void VolumeRenderer::render_pass(
@@ -683,38 +1075,188 @@ void VolumeRenderer::render_pass(
     const int current_buf = _current_multipass_buf;
     const int last_buf = (_current_multipass_buf+1) % 2;
 
+    const bool single_pass = final && _num_passes == 0;
+    const RaySource ray_source = _analytic_box ? RaySource::ANALYTIC_BOX : RaySource::ENDPOINT_TEXTURES;
+    const FrameKey key = frame_key(model_matrix, view_matrix, proj_matrix, light_position, ray_source);
+    if (_num_passes == 0 && begin_first_pass(key, final)) {
+        return;
+    }
+    _num_passes++;
+
     push_opengl_debug_group("Multipass render");
+    gpu_profiler().begin("Volume render pass");
+
+    // The endpoint textures only depend on the camera and the geometry, passes sharing both reuse them
+    if (!_analytic_box) {
+        const EndpointKey endpoint_key = { model_matrix, view_matrix, proj_matrix, _geometry_hash };
+        if (!_has_endpoints || !(endpoint_key == _endpoint_key)) {
+            ray_endpoint_pass(model_matrix, view_matrix, proj_matrix);
+            _has_endpoints = true;
+            _endpoint_key = endpoint_key;
+        }
+    }
 
-    GLint old_viewport[4];
-    glGetIntegerv(GL_VIEWPORT, old_viewport);
+    // Every pass, including the final one, goes into the lower left part of the multipass buffers (all of it
+    // at full resolution). The final result is composited into the framebuffer afterwards, so it can be drawn
+    // again on the next frame if nothing changed.
+    const glm::ivec2 fb_size = _framebuffer_size;
+    const glm::ivec2 pass_size = glm::max(fb_size / _downsample, glm::ivec2(1));
+    const glm::vec2 uv_scale = glm::vec2(pass_size) / glm::vec2(glm::max(fb_size, glm::ivec2(1)));
 
-    GLint fb_tex_w, fb_tex_h;
-    glBindTexture(GL_TEXTURE_2D, _gl_state.ray_endpoints_pass.exit_texture);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &fb_tex_w);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &fb_tex_h);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLuint volume_tex = _current_volume_tex;
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.multipass.framebuffer[current_buf]);
+    glViewport(0, 0, pass_size.x, pass_size.y);
 
-    ray_endpoint_pass(model_matrix, view_matrix, proj_matrix);
+    // The final result is blended into the framebuffer by the composite pass instead
+    volume_pass(light_position, _current_volume_dims, volume_tex, _gl_state.multipass.texture[last_buf], uv_scale, !final,
+                ray_source, view_matrix * model_matrix, proj_matrix, pass_size.y);
 
-    GLuint volume_tex = _current_volume_tex;
+    glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     if (final) {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        composite_pass(_gl_state.multipass.texture[current_buf], uv_scale);
         _current_multipass_buf = -1;
         _current_volume_tex = 0;
+
+        // Earlier passes of a multipass frame are not part of the key, so only single pass frames are cached
+        _has_cached_frame = single_pass;
+        _cached_frame_key = key;
+        _cached_frame_texture = _gl_state.multipass.texture[current_buf];
+        _cached_frame_uv_scale = uv_scale;
     } else {
-        glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.multipass.framebuffer[current_buf]);
-        glViewport(0, 0, fb_tex_w, fb_tex_h);
         _current_multipass_buf = last_buf;
     }
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
+
+void VolumeRenderer::render_peeled(
+        const glm::mat4 &model_matrix, const glm::mat4 &view_matrix,
+        const glm::mat4 &proj_matrix, const glm::vec3 &light_position) {
+
+    if (_current_multipass_buf < 0 || _current_volume_tex == 0) {
+        assert("VolumeRenderer render_peeled called without calling begin" && false);
+        exit(EXIT_FAILURE);
+        return;
+    }
+
+    const FrameKey key = frame_key(model_matrix, view_matrix, proj_matrix, light_position, RaySource::PEELED_LAYERS);
+    if (_num_passes == 0 && begin_first_pass(key, true)) {
+        return;
+    }
+    _num_passes++;
 
-    volume_pass(light_position, _current_volume_dims, volume_tex, _gl_state.multipass.texture[last_buf]);
+    push_opengl_debug_group("Depth peeled render");
+    gpu_profiler().begin("Volume peeled render");
+
+    peel_pass(model_matrix, view_matrix, proj_matrix);
+
+    const glm::ivec2 fb_size = _framebuffer_size;
+    const glm::ivec2 pass_size = glm::max(fb_size / _downsample, glm::ivec2(1));
+    const glm::vec2 uv_scale = glm::vec2(pass_size) / glm::vec2(glm::max(fb_size, glm::ivec2(1)));
+
+    GLuint volume_tex = _current_volume_tex;
+    _current_multipass_buf = -1;
+    _current_volume_tex = 0;
+
+    // Every interval is composited in the shader, the multipass buffer just holds the result so it can be
+    // upsampled while interacting and drawn again on the next frame if nothing changed
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.multipass.framebuffer[0]);
+    glViewport(0, 0, pass_size.x, pass_size.y);
+    volume_pass(light_position, _current_volume_dims, volume_tex, _gl_state.multipass.texture[1], uv_scale, false,
+                RaySource::PEELED_LAYERS, view_matrix * model_matrix, proj_matrix, pass_size.y);
+
+    glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    composite_pass(_gl_state.multipass.texture[0], uv_scale);
 
-    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+    _has_cached_frame = true;
+    _cached_frame_key = key;
+    _cached_frame_texture = _gl_state.multipass.texture[0];
+    _cached_frame_uv_scale = uv_scale;
+    gpu_profiler().end();
     pop_opengl_debug_group();
 }
 
+void VolumeRenderer::render_views(const glm::mat4& model_matrix, const std::vector<View>& views,
+                                  const glm::vec3& light_position) {
 
+    if (_current_multipass_buf < 0 || _current_volume_tex == 0) {
+        assert("VolumeRenderer render_views called without calling begin" && false);
+        exit(EXIT_FAILURE);
+        return;
+    }
+
+    const int current_buf = _current_multipass_buf;
+    const int last_buf = (_current_multipass_buf+1) % 2;
+
+    // Several views are not part of the frame key, the frame is always ray cast
+    if (_num_passes == 0) {
+        begin_first_pass(FrameKey(), false);
+    }
+    _num_passes++;
+
+    push_opengl_debug_group("Multi-view render");
+    gpu_profiler().begin("Volume multi-view render");
+
+    const RaySource ray_source = _analytic_box ? RaySource::ANALYTIC_BOX : RaySource::ENDPOINT_TEXTURES;
+    if (!_analytic_box && !views.empty()) {
+        ray_endpoint_pass(model_matrix, views.data(), int(views.size()));
+        _has_endpoints = false;
+    }
+
+    const glm::ivec2 fb_size = _framebuffer_size;
+    const glm::ivec2 pass_size = glm::max(fb_size / _downsample, glm::ivec2(1));
+    const glm::vec2 uv_scale = glm::vec2(pass_size) / glm::vec2(glm::max(fb_size, glm::ivec2(1)));
+    const glm::vec2 fb_size_rcp = glm::vec2(1.f) / glm::vec2(glm::max(fb_size, glm::ivec2(1)));
+
+    GLuint volume_tex = _current_volume_tex;
+    glBindFramebuffer(GL_FRAMEBUFFER, _gl_state.multipass.framebuffer[current_buf]);
+    for (const View& view : views) {
+        // The rectangle of the view scaled to the reduced resolution of an interactive frame
+        const glm::ivec2 pass_offset = glm::ivec2(glm::vec2(view.rect.x, view.rect.y) * uv_scale);
+        const glm::ivec2 pass_rect_size = glm::max(glm::ivec2(glm::vec2(view.rect.z, view.rect.w) * uv_scale),
+                                                   glm::ivec2(1));
+        glViewport(pass_offset.x, pass_offset.y, pass_rect_size.x, pass_rect_size.y);
+
+        const glm::vec4 view_rect(view.rect.x * fb_size_rcp.x, view.rect.y * fb_size_rcp.y,
+                                  view.rect.z * fb_size_rcp.x, view.rect.w * fb_size_rcp.y);
+        volume_pass(light_position, _current_volume_dims, volume_tex, _gl_state.multipass.texture[last_buf], uv_scale,
+                    false, ray_source, view.view_matrix * model_matrix, view.proj_matrix, pass_rect_size.y, view_rect);
+    }
 
+    glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    composite_pass(_gl_state.multipass.texture[current_buf], uv_scale);
+    _current_multipass_buf = -1;
+    _current_volume_tex = 0;
+    _has_cached_frame = false;
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
 
+void VolumeRenderer::composite_pass(GLuint texture, const glm::vec2& uv_scale) {
+    push_opengl_debug_group("Upsample Volume");
+    gpu_profiler().begin("Volume composite");
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    glUseProgram(_gl_state.composite_pass.program);
+    glBindVertexArray(_gl_state.volume_pass.vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniform1i(_gl_state.composite_pass.uniform_location.frame, 0);
+    glUniform2fv(_gl_state.composite_pass.uniform_location.uv_scale, 1, glm::value_ptr(uv_scale));
 
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    gpu_profiler().end();
+    pop_opengl_debug_group();
+}
+
+void VolumeRenderer::set_interactive(bool interactive, int downsample, float step_scale) {
+    _downsample = interactive ? std::max(downsample, 1) : 1;
+    _step_scale = interactive ? step_scale : 1.f;
+}
@@ -2,18 +2,35 @@
 #define VOLUME_RENDERING_2_H
 
 #include <glad/glad.h>
-#include <igl/opengl/create_shader_program.h>
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <fstream>
 
+#include "empty_space_grid.h"
+#include "pixel_footprint.h"
+#include "transfer_function_texture.h"
+#include "uniform_ring.h"
+#include "volume_resource.h"
 
-struct TfNode {
-    float t;
-    glm::vec4 rgba;
-};
 
 class VolumeRenderer {
+public:
+    // Maximum number of depth layers of the bounding geometry, i.e. MAX_PEELED_LAYERS / 2 intervals per ray
+    static constexpr int MAX_PEELED_LAYERS = 8;
+
+    // One of several views of the volume rendered side by side by render_views()
+    struct View {
+        // Lower left corner and size of the view in pixels of the render targets, whose origin is at the
+        // viewport of begin()
+        glm::ivec4 rect;
+        glm::mat4 view_matrix;
+        glm::mat4 proj_matrix;
+    };
+
+private:
     glm::ivec3 _volume_dimensions;
     GLfloat _sampling_rate = 10.0f;
     GLuint _num_bounding_indices = 0;
@@ -24,6 +41,74 @@ class VolumeRenderer {
 
     GLfloat _step_size = 0.0;
 
+    // Render targets are allocated at half precision unless disabled, see set_half_precision()
+    bool _half_precision = true;
+    glm::ivec2 _framebuffer_size = glm::ivec2(0);
+
+    // Reduced quality while interacting, see set_interactive()
+    int _downsample = 1;
+    GLfloat _step_scale = 1.0;
+
+    // Steps grow to this many pixels where a pixel is wider than _step_size, see set_footprint_scale()
+    GLfloat _footprint_scale = 1.0;
+
+    // Where the volume pass takes the entry and exit points of the rays from
+    enum class RaySource {
+        ENDPOINT_TEXTURES,  // Rasterized front and back faces of convex bounding geometry
+        PEELED_LAYERS,      // Depth peeled layers of arbitrary bounding geometry, see render_peeled()
+        ANALYTIC_BOX        // Ray / unit cube intersection computed in the shader, see set_bounding_box()
+    };
+
+    // The unit cube is intersected analytically instead of rasterizing the bounding geometry
+    bool _analytic_box = false;
+
+    // Everything a single pass frame depends on. If it matches the last frame that frame is drawn
+    // again instead of ray casting the volume.
+    struct FrameKey {
+        glm::mat4 model_matrix = glm::mat4(0.f);
+        glm::mat4 view_matrix = glm::mat4(0.f);
+        glm::mat4 proj_matrix = glm::mat4(0.f);
+        glm::vec3 light_position = glm::vec3(0.f);
+        glm::ivec3 volume_dims = glm::ivec3(0);
+        GLuint volume_texture = 0;
+        std::uint64_t geometry_hash = 0;
+        unsigned content_version = 0;
+        std::uint64_t volume_version = 0;
+        GLfloat step_size = 0.f;
+        GLfloat step_scale = 0.f;
+        GLfloat footprint_scale = 0.f;
+        int downsample = 0;
+        RaySource ray_source = RaySource::ENDPOINT_TEXTURES;
+
+        bool operator==(const FrameKey& other) const;
+    };
+
+    // Hash of the current bounding geometry, bumped content version whenever the transfer function changes.
+    // Changes of the volume come with a new VolumeResource::version.
+    std::uint64_t _geometry_hash = 0;
+    unsigned _content_version = 0;
+
+    // Camera and geometry the endpoint textures were last rendered with, see render_pass()
+    struct EndpointKey {
+        glm::mat4 model_matrix;
+        glm::mat4 view_matrix;
+        glm::mat4 proj_matrix;
+        std::uint64_t geometry_hash;
+
+        bool operator==(const EndpointKey& other) const;
+    };
+    bool _has_endpoints = false;
+    EndpointKey _endpoint_key;
+
+    // Viewport of the framebuffer the frame is composited into, queried by begin()
+    GLint _viewport[4] = { 0, 0, 0, 0 };
+
+    int _num_passes = 0;
+    bool _has_cached_frame = false;
+    FrameKey _cached_frame_key;
+    GLuint _cached_frame_texture = 0;
+    glm::vec2 _cached_frame_uv_scale = glm::vec2(1.f);
+
     struct GLState {
         struct RayEndpointsPass {
             GLuint vao = 0;
@@ -46,7 +131,8 @@ class VolumeRenderer {
 
         struct VolumePass {
             GLuint program = 0;
-            GLuint transfer_function_texture;
+            GLuint peeled_program = 0;
+            GLuint box_program = 0;
 
             GLuint vao;
 
@@ -58,26 +144,70 @@ class VolumeRenderer {
                 GLint value_init_texture = 0;
                 GLint final = 0;
 
-                GLint volume_dimensions = 0;
-                GLint volume_dimensions_rcp = 0;
-                GLint sampling_rate = 0;
+                GLint peeled_layers = -1;
 
-                GLint light_position = 0;
-                GLint light_color_ambient = 0;
-                GLint light_color_diffuse = 0;
-                GLint light_color_specular = 0;
-                GLint light_exponent_specular = 0;
-            } uniform_location;
+                EmptySpaceGrid::UniformLocations empty_space;
+            } uniform_location, peeled_uniform_location, box_uniform_location;
         } volume_pass;
 
+        struct PeelPass {
+            GLuint program = 0;
+
+            GLuint framebuffer[MAX_PEELED_LAYERS];
+            GLuint layer_texture = 0;
+            GLuint depth_texture[2];
+
+            struct {
+                GLint model_matrix = 0;
+                GLint view_matrix = 0;
+                GLint projection_matrix = 0;
+                GLint previous_depth = 0;
+                GLint layer = 0;
+            } uniform_location;
+        } peel_pass;
+
+        struct CompositePass {
+            GLuint program = 0;
+
+            struct {
+                GLint frame = 0;
+                GLint uv_scale = 0;
+            } uniform_location;
+        } composite_pass;
+
         struct MultipassState {
             GLuint framebuffer[2];
             GLuint texture[2];
         } multipass;
     } _gl_state;
 
+    EmptySpaceGrid _empty_space;
+    TransferFunctionTexture _transfer_function;
+    // The parameters of the volume passes, see volume_pass()
+    UniformRing _uniforms;
+    // Min/max grids of the volume of the current pass and of the one drawn before it. The bounding polygon screen
+    // alternates between the cage in the scan and the straightened volume, both grids stay built.
+    std::shared_ptr<VolumeResource> _volume;
+    std::shared_ptr<VolumeResource> _previous_volume;
+
+    // Both leave the viewport at the size of the render targets, the caller restores _viewport
     void ray_endpoint_pass(const glm::mat4 &model_matrix, const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix);
-    void volume_pass(const glm::vec3& light_position, const glm::ivec3 &volume_dims, GLuint volume_tex, GLuint multipass_tex);
+    void ray_endpoint_pass(const glm::mat4 &model_matrix, const View* views, int num_views);
+    void peel_pass(const glm::mat4 &model_matrix, const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix);
+    void volume_pass(const glm::vec3& light_position, const glm::ivec3 &volume_dims, GLuint volume_tex, GLuint multipass_tex,
+                     const glm::vec2& multipass_uv_scale, bool blend, RaySource ray_source,
+                     const glm::mat4& model_view_matrix, const glm::mat4& proj_matrix, int viewport_height,
+                     const glm::vec4& view_rect = glm::vec4(0.f, 0.f, 1.f, 1.f));
+    void composite_pass(GLuint texture, const glm::vec2& uv_scale);
+
+    GLenum endpoint_format() const;
+    GLenum color_format() const;
+
+    FrameKey frame_key(const glm::mat4 &model_matrix, const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix,
+                       const glm::vec3& light_position, RaySource ray_source) const;
+    // Called by the first pass after begin(). Draws the cached frame and ends the frame if final is set and
+    // nothing changed since it was rendered, otherwise clears the multipass buffers and returns false.
+    bool begin_first_pass(const FrameKey& key, bool final);
 
 public:
     const GLState& gl_state() const { return _gl_state; }
@@ -86,6 +216,21 @@ public:
         _step_size = step_size;
     }
 
+    // Far from the camera, or with the volume zoomed out, a pixel covers several voxels and the step grows to
+    // scale times the width of the pixel at the sample. The step never drops below the step size, 0 turns this off.
+    void set_footprint_scale(float scale) {
+        _footprint_scale = std::max(scale, 0.f);
+    }
+
+    // While interactive the passes are rendered at 1/downsample of the resolution with step_scale times
+    // larger steps and the final result is upsampled into the framebuffer
+    void set_interactive(bool interactive, int downsample = 2, float step_scale = 2.f);
+
+    // Store ray endpoints and the accumulated color in 16 bit floats, which halves the bandwidth of every
+    // pass. Positions are then only accurate to about 1/2048 of the volume, disable this if that shows.
+    void set_half_precision(bool half_precision);
+    bool half_precision() const { return _half_precision; }
+
     void resize_framebuffer(const glm::ivec2& viewport_size);
 
     void init(const glm::ivec2& viewport_size,
@@ -93,22 +238,48 @@ public:
               const char* picking_shader = nullptr);
 
     void destroy();
+    // True between init and destroy
+    bool is_initialized() const { return _gl_state.volume_pass.program != 0; }
 
     void set_transfer_function(const std::vector<TfNode>& transfer_function);
 
+
     void set_bounding_geometry(GLfloat* vertices, GLsizei num_vertices, GLint* indices, GLsizei num_faces);
+    // Use the geometry of the last set_bounding_geometry again with the vertices [first, first + count)
+    // replaced. Only that range is uploaded, the number of vertices and the faces stay the same.
+    void update_bounding_vertices(const GLfloat* vertices, GLsizei first, GLsizei count);
+    // Use the unit cube as bounding geometry. Its ray entry and exit points are computed analytically in the
+    // volume pass, so render_pass skips rasterizing them into the endpoint textures.
+    void set_bounding_box();
     // TODO: Allow setting multiple geometric objects
     //    void set_bounding_geometry(const std::vector<GLfloat*>& vertices,
     //                               const std::vector<GLsizei>& num_vertices,
     //                               const std::vector<GLint*>& indices,
     //                               const std::vector<GLsizei>& num_indices);
 
+    // A frame consisting of a single final render_pass or render_peeled is not ray cast again if its
+    // inputs did not change since the last frame, the cached result is composited instead
     void begin(const glm::ivec3 &volume_dims, GLuint tex);
     void render_pass(const glm::mat4 &model_matrix,
                      const glm::mat4 &view_matrix,
                      const glm::mat4 &proj_matrix,
                      const glm::vec3& light_position,
                      bool final);
+
+    // Render the whole bounding geometry in a single pass after begin(), this ends the frame like a final render_pass.
+    // Unlike render_pass the geometry does not need to be convex, every ray is cast through up to
+    // MAX_PEELED_LAYERS / 2 front to back intervals inside of it.
+    void render_peeled(const glm::mat4 &model_matrix,
+                       const glm::mat4 &view_matrix,
+                       const glm::mat4 &proj_matrix,
+                       const glm::vec3& light_position);
+
+    // Render the convex bounding geometry, or the box of set_bounding_box(), from every view in a single pass
+    // after begin(), e.g. side by side for a presentation. This ends the frame like a final render_pass. The
+    // endpoints of all views are rasterized into one pair of endpoint textures and the result is composited
+    // once, so a view costs its own rays and little else. The render targets have to cover every view, and
+    // the frame is not cached.
+    void render_views(const glm::mat4& model_matrix, const std::vector<View>& views, const glm::vec3& light_position);
 };
 
 
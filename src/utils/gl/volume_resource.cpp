@@ -0,0 +1,69 @@
+#include "volume_resource.h"
+
+#include <GLFW/glfw3.h>
+
+#include <map>
+
+
+namespace {
+
+// Every resource that someone holds, by volume texture
+std::map<GLuint, std::weak_ptr<VolumeResource>>& volume_resources() {
+    static std::map<GLuint, std::weak_ptr<VolumeResource>> resources;
+    return resources;
+}
+
+} // namespace
+
+
+std::shared_ptr<VolumeResource> VolumeResource::acquire(GLuint volume_texture) {
+    std::map<GLuint, std::weak_ptr<VolumeResource>>& resources = volume_resources();
+    for (auto it = resources.begin(); it != resources.end();) {
+        it = it->second.expired() ? resources.erase(it) : std::next(it);
+    }
+
+    std::weak_ptr<VolumeResource>& entry = resources[volume_texture];
+    std::shared_ptr<VolumeResource> resource = entry.lock();
+    if (!resource) {
+        resource.reset(new VolumeResource(volume_texture));
+        entry = resource;
+    }
+    return resource;
+}
+
+void VolumeResource::invalidate(GLuint volume_texture) {
+    auto it = volume_resources().find(volume_texture);
+    if (it == volume_resources().end()) {
+        return;
+    }
+    if (std::shared_ptr<VolumeResource> resource = it->second.lock()) {
+        resource->_minmax_grid.invalidate();
+        resource->_gradient.invalidate();
+        resource->_version++;
+    }
+}
+
+VolumeResource::VolumeResource(GLuint volume_texture) : _volume_texture(volume_texture) {
+    _minmax_grid.init();
+}
+
+VolumeResource::~VolumeResource() {
+    // The renderers of the screens are destroyed after the window, together with its context and everything in it
+    if (glfwGetCurrentContext() == nullptr) {
+        return;
+    }
+    _minmax_grid.destroy();
+    _gradient.destroy();
+}
+
+void VolumeResource::update_minmax_grid() {
+    _minmax_grid.update(_volume_texture);
+}
+
+bool VolumeResource::update_gradient() {
+    if (!_gradient_initialized) {
+        _gradient.init();
+        _gradient_initialized = true;
+    }
+    return _gradient.update(_volume_texture);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <memory>
+
+#include "empty_space_grid.h"
+#include "gradient_volume.h"
+
+// The textures derived from a volume texture that do not depend on how it is drawn: the min/max grid of the empty
+// space skipping and the precomputed gradients. The selection renderer and the volume renderer of the bounding
+// polygon screen both draw the low resolution volume, with a resource per volume texture they share one grid and
+// one gradient instead of building and storing their own. The transfer function and its opacity table stay with
+// each renderer, the screens edit their own.
+//
+// Everything is built on the first update after the contents of the volume changed. The gradient is only
+// allocated once a renderer asks for it.
+class VolumeResource {
+public:
+    // The resource of volume_texture, created on the first call. It lives as long as a renderer holds it.
+    static std::shared_ptr<VolumeResource> acquire(GLuint volume_texture);
+
+    // Rebuild the textures of volume_texture, if anyone holds its resource, on the next update. Call this when
+    // the contents of the volume changed or the texture name was reused for a new volume.
+    static void invalidate(GLuint volume_texture);
+
+    VolumeResource(const VolumeResource&) = delete;
+    VolumeResource& operator=(const VolumeResource&) = delete;
+    ~VolumeResource();
+
+    GLuint volume_texture() const { return _volume_texture; }
+    // Increased by every invalidate, e.g. for renderers that cache a frame of the volume
+    std::uint64_t version() const { return _version; }
+
+    // Build the min/max grid if it is stale. Call this before a pass binds minmax_grid(), not during it, the
+    // build changes the framebuffer.
+    void update_minmax_grid();
+    const VolumeMinMaxGrid& minmax_grid() const { return _minmax_grid; }
+
+    // Build the gradient if it is stale. Returns false if it could not be allocated, callers then compute the
+    // gradient per sample.
+    bool update_gradient();
+    // 0 until the first update_gradient
+    GLuint gradient_texture() const { return _gradient.texture(); }
+
+private:
+    explicit VolumeResource(GLuint volume_texture);
+
+    GLuint _volume_texture = 0;
+    std::uint64_t _version = 0;
+    VolumeMinMaxGrid _minmax_grid;
+    GradientVolume _gradient;
+    bool _gradient_initialized = false;
+};
@@ -0,0 +1,213 @@
+#include "volume_texture_uploader.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/utils.h"
+
+// The viewer only asks for a 3.2 context, so the newer entry points are looked up at runtime
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace {
+
+typedef void (APIENTRYP TexStorage3DProc)(GLenum, GLsizei, GLenum, GLsizei, GLsizei, GLsizei);
+typedef void (APIENTRYP BufferStorageProc)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+TexStorage3DProc tex_storage_3d() {
+    static TexStorage3DProc proc = glfwExtensionSupported("GL_ARB_texture_storage") ?
+                reinterpret_cast<TexStorage3DProc>(glfwGetProcAddress("glTexStorage3D")) : nullptr;
+    return proc;
+}
+
+BufferStorageProc buffer_storage() {
+    static BufferStorageProc proc = glfwExtensionSupported("GL_ARB_buffer_storage") ?
+                reinterpret_cast<BufferStorageProc>(glfwGetProcAddress("glBufferStorage")) : nullptr;
+    return proc;
+}
+
+} // namespace
+
+
+bool VolumeTextureUploader::begin(GLuint texture, const glm::ivec3& dims, GLenum internal_format, GLenum format, GLenum type,
+                                  std::size_t bytes_per_voxel, std::vector<std::uint8_t>&& data, std::shared_ptr<spdlog::logger> logger,
+                                  std::size_t bytes_per_step, bool mipmapped) {
+    std::vector<std::uint8_t> owned = std::move(data);
+    if (!begin(texture, dims, internal_format, format, type, bytes_per_voxel, owned.data(), logger, bytes_per_step,
+               mipmapped)) {
+        return false;
+    }
+    // Moving a vector keeps its buffer so _data stays valid
+    _owned_data = std::move(owned);
+    return true;
+}
+
+bool VolumeTextureUploader::begin(GLuint texture, const glm::ivec3& dims, GLenum internal_format, GLenum format, GLenum type,
+                                  std::size_t bytes_per_voxel, const std::uint8_t* data, std::shared_ptr<spdlog::logger> logger,
+                                  std::size_t bytes_per_step, bool mipmapped) {
+    destroy();
+    _logger = logger;
+    if (texture == 0 || data == nullptr || dims.x <= 0 || dims.y <= 0 || dims.z <= 0) {
+        logger->error("Invalid volume texture upload of {}x{}x{} voxels", dims.x, dims.y, dims.z);
+        return false;
+    }
+
+    push_opengl_debug_group("VolumeTextureUploader::begin");
+    _texture = texture;
+    _dims = dims;
+    _format = format;
+    _type = type;
+    _mipmapped = mipmapped;
+    _data = data;
+    _slice_bytes = std::size_t(dims.x) * std::size_t(dims.y) * bytes_per_voxel;
+    _slices_per_step = int(std::max<std::size_t>(1, std::min<std::size_t>(bytes_per_step / _slice_bytes, std::size_t(dims.z))));
+    _segment_bytes = std::size_t(_slices_per_step) * _slice_bytes;
+    _next_slice = 0;
+    _next_buffer = 0;
+
+    glBindTexture(GL_TEXTURE_3D, texture);
+    if (TexStorage3DProc storage = tex_storage_3d()) {
+        storage(GL_TEXTURE_3D, mipmapped ? num_mip_levels(dims) : 1, internal_format, dims.x, dims.y, dims.z);
+    } else {
+        glTexImage3D(GL_TEXTURE_3D, 0, internal_format, dims.x, dims.y, dims.z, 0, format, type, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    glGenBuffers(NUM_BUFFERS, _buffers.data());
+    if (BufferStorageProc storage = buffer_storage()) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[0]);
+        storage(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(_segment_bytes * NUM_BUFFERS), nullptr, flags);
+        _persistent_ptr = static_cast<std::uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(_segment_bytes * NUM_BUFFERS), flags));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (_persistent_ptr == nullptr) {
+            logger->warn("Failed to persistently map the upload buffer, falling back to regular mapping");
+            glDeleteBuffers(NUM_BUFFERS, _buffers.data());
+            glGenBuffers(NUM_BUFFERS, _buffers.data());
+        }
+    }
+
+    logger->debug("Streaming {}x{}x{} volume texture in slabs of {} slices ({})", dims.x, dims.y, dims.z,
+                  _slices_per_step, _persistent_ptr != nullptr ? "persistent mapping" : "buffer orphaning");
+    pop_opengl_debug_group();
+    return true;
+}
+
+bool VolumeTextureUploader::step() {
+    if (is_done()) {
+        return true;
+    }
+
+    push_opengl_debug_group("VolumeTextureUploader::step");
+    const int num_slices = std::min(_slices_per_step, _dims.z - _next_slice);
+    const std::size_t num_bytes = std::size_t(num_slices) * _slice_bytes;
+    const std::uint8_t* src = _data + std::size_t(_next_slice) * _slice_bytes;
+    const int b = _next_buffer;
+    _next_buffer = (_next_buffer + 1) % NUM_BUFFERS;
+
+    const void* offset = nullptr;
+    if (_persistent_ptr != nullptr) {
+        // Wait for the transfer which last used this segment before overwriting it
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[0]);
+        if (_fences[b] != nullptr) {
+            glClientWaitSync(_fences[b], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(_fences[b]);
+            _fences[b] = nullptr;
+        }
+        std::memcpy(_persistent_ptr + b * _segment_bytes, src, num_bytes);
+        offset = reinterpret_cast<const void*>(b * _segment_bytes);
+    } else {
+        // Orphan the buffer so the driver never has to stall on a transfer which is still in flight
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[b]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(_segment_bytes), nullptr, GL_STREAM_DRAW);
+        void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(num_bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst == nullptr) {
+            _logger->error("Failed to map the volume upload buffer");
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            destroy();
+            pop_opengl_debug_group();
+            return true;
+        }
+        std::memcpy(dst, src, num_bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    // Slices are tightly packed and not necessarily 4 byte aligned
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, _next_slice, _dims.x, _dims.y, num_slices, _format, _type, offset);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    if (_persistent_ptr != nullptr) {
+        _fences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    _next_slice += num_slices;
+    pop_opengl_debug_group();
+
+    if (is_done()) {
+        if (_mipmapped) {
+            generate_volume_mipmaps(_texture);
+        }
+        // The buffers are not needed anymore, the driver keeps whatever is still being transferred alive
+        const glm::ivec3 dims = _dims;
+        destroy();
+        _dims = dims;
+        _next_slice = dims.z;
+        return true;
+    }
+    return false;
+}
+
+void VolumeTextureUploader::finish() {
+    while (!step()) {}
+}
+
+void VolumeTextureUploader::destroy() {
+    for (GLsync& fence : _fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (_persistent_ptr != nullptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[0]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        _persistent_ptr = nullptr;
+    }
+    if (_buffers[0] != 0) {
+        glDeleteBuffers(NUM_BUFFERS, _buffers.data());
+        _buffers = {};
+    }
+    _texture = 0;
+    _mipmapped = false;
+    _data = nullptr;
+    _owned_data = std::vector<std::uint8_t>();
+    _dims = glm::ivec3(0);
+    _next_slice = 0;
+}
+
+int num_mip_levels(const glm::ivec3& dims) {
+    int levels = 1;
+    for (int size = std::max(dims.x, std::max(dims.y, dims.z)); size > 1; size /= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+void generate_volume_mipmaps(GLuint texture) {
+    push_opengl_debug_group("generate_volume_mipmaps");
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glGenerateMipmap(GL_TEXTURE_3D);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    pop_opengl_debug_group();
+}
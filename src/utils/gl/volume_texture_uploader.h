@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Streams the contents of a 3D texture to the GPU over several frames instead of with one
+// blocking glTexImage3D.
+//
+// begin() allocates the texture storage (immutable glTexStorage3D when the driver supports
+// ARB_texture_storage) and each call to step() then copies one slab of z slices through a
+// pixel unpack buffer and issues a glTexSubImage3D for it. With ARB_buffer_storage the unpack
+// buffer is a persistently mapped ring guarded by fences, otherwise each slab orphans and maps
+// one of a few regular buffers.
+//
+// Call step() once per frame from the render thread until is_done() returns true.
+//
+// A mipmapped texture gets storage for its whole mip chain and the levels are generated once the last slab
+// arrived. Until then it is only sampled at full resolution.
+class VolumeTextureUploader {
+public:
+    static constexpr std::size_t DEFAULT_BYTES_PER_STEP = std::size_t(16) * 1024 * 1024;
+
+    VolumeTextureUploader() = default;
+    VolumeTextureUploader(const VolumeTextureUploader&) = delete;
+    VolumeTextureUploader& operator=(const VolumeTextureUploader&) = delete;
+    ~VolumeTextureUploader() { destroy(); }
+
+    // Start uploading data into texture, which must be a freshly generated texture name.
+    // The data has to stay alive until the upload is done, use the overload taking a vector to hand it over instead.
+    bool begin(GLuint texture, const glm::ivec3& dims, GLenum internal_format, GLenum format, GLenum type,
+               std::size_t bytes_per_voxel, const std::uint8_t* data, std::shared_ptr<spdlog::logger> logger,
+               std::size_t bytes_per_step = DEFAULT_BYTES_PER_STEP, bool mipmapped = false);
+    bool begin(GLuint texture, const glm::ivec3& dims, GLenum internal_format, GLenum format, GLenum type,
+               std::size_t bytes_per_voxel, std::vector<std::uint8_t>&& data, std::shared_ptr<spdlog::logger> logger,
+               std::size_t bytes_per_step = DEFAULT_BYTES_PER_STEP, bool mipmapped = false);
+
+    // Upload the next slab. Returns true once every slice has been uploaded.
+    bool step();
+
+    // Run the remaining steps right away
+    void finish();
+
+    // Stop uploading and free the staging buffers. The texture itself is left alone.
+    void destroy();
+
+    bool is_active() const { return _texture != 0; }
+    bool is_done() const { return _texture == 0 || _next_slice >= _dims.z; }
+    float progress() const { return _dims.z > 0 ? float(_next_slice) / float(_dims.z) : 1.0f; }
+
+private:
+    static constexpr int NUM_BUFFERS = 3;
+
+    std::shared_ptr<spdlog::logger> _logger;
+
+    GLuint _texture = 0;
+    glm::ivec3 _dims = glm::ivec3(0);
+    GLenum _format = GL_RED;
+    GLenum _type = GL_UNSIGNED_BYTE;
+    bool _mipmapped = false;
+    std::size_t _slice_bytes = 0;
+    int _slices_per_step = 1;
+    int _next_slice = 0;
+
+    const std::uint8_t* _data = nullptr;
+    std::vector<std::uint8_t> _owned_data;
+
+    // Pixel unpack buffers. In persistent mode only the first one is used, split into NUM_BUFFERS segments.
+    std::array<GLuint, NUM_BUFFERS> _buffers = {};
+    std::array<GLsync, NUM_BUFFERS> _fences = {};
+    std::size_t _segment_bytes = 0;
+    std::uint8_t* _persistent_ptr = nullptr;
+    int _next_buffer = 0;
+};
+
+// Number of levels of a full mip chain of a texture of dims, down to a single voxel
+int num_mip_levels(const glm::ivec3& dims);
+
+// Build the mip chain of the 3D texture from its first level and sample it trilinearly between the levels.
+// The ray casters pick the level with textureLod, everything else samples it as before.
+void generate_volume_mipmaps(GLuint texture);
@@ -0,0 +1,122 @@
+#include "graph_geodesics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include "parallel_for.h"
+#include "task_scheduler.h"
+
+namespace {
+
+constexpr std::size_t VERTICES_PER_CHUNK = 1 << 12;
+
+} // namespace
+
+
+bool GraphGeodesics::compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT) {
+    _num_vertices = 0;
+    _offsets.clear();
+    _neighbors.clear();
+    _lengths.clear();
+    if (TT.rows() == 0) {
+        return false;
+    }
+    const int num_vertices = int(TV.rows());
+
+    // Both directions of the 6 edges of every tet, then each list sorted and without the edges shared by tets
+    std::vector<int> offsets(num_vertices + 1, 0);
+    for (int t = 0; t < TT.rows(); t++) {
+        for (int c = 0; c < 4; c++) {
+            offsets[TT(t, c) + 1] += 3;
+        }
+    }
+    parallel_prefix_sum(offsets);
+    std::vector<int> neighbors(offsets.back());
+    {
+        std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+        for (int t = 0; t < TT.rows(); t++) {
+            for (int c = 0; c < 4; c++) {
+                for (int d = 0; d < 4; d++) {
+                    if (d != c) {
+                        neighbors[cursor[TT(t, c)]++] = TT(t, d);
+                    }
+                }
+            }
+        }
+    }
+
+    _offsets.assign(num_vertices + 1, 0);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            const auto first = neighbors.begin() + offsets[v], last = neighbors.begin() + offsets[v + 1];
+            std::sort(first, last);
+            _offsets[v + 1] = int(std::unique(first, last) - first);
+        }
+    }, VERTICES_PER_CHUNK);
+    parallel_prefix_sum(_offsets);
+    _neighbors.resize(_offsets.back());
+    _lengths.resize(_offsets.back());
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            for (int i = 0; i < _offsets[v + 1] - _offsets[v]; i++) {
+                const int u = neighbors[offsets[v] + i];
+                _neighbors[_offsets[v] + i] = u;
+                _lengths[_offsets[v] + i] = (TV.row(u) - TV.row(v)).norm();
+            }
+        }
+    }, VERTICES_PER_CHUNK);
+    _num_vertices = num_vertices;
+    return true;
+}
+
+void GraphGeodesics::distances(int source, Eigen::VectorXd& dists) const {
+    typedef std::pair<double, int> Entry;
+    dists.setConstant(_num_vertices, std::numeric_limits<double>::infinity());
+    // Vertices are queued again when they get closer, the stale entries are skipped
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    dists[source] = 0.0;
+    queue.emplace(0.0, source);
+    while (!queue.empty()) {
+        const Entry top = queue.top();
+        queue.pop();
+        const int v = top.second;
+        if (top.first > dists[v]) {
+            continue;
+        }
+        for (int i = _offsets[v]; i < _offsets[v + 1]; i++) {
+            const double d = top.first + _lengths[i];
+            if (d < dists[_neighbors[i]]) {
+                dists[_neighbors[i]] = d;
+                queue.emplace(d, _neighbors[i]);
+            }
+        }
+    }
+}
+
+bool GraphGeodesics::solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals) const {
+    std::vector<Eigen::VectorXd> dists(2 * endpoints.size());
+    parallel_tasks(dists.size(), [&](std::size_t i) {
+        distances(i % 2 == 0 ? endpoints[i / 2].first : endpoints[i / 2].second, dists[i]);
+    });
+
+    isovals.setConstant(_num_vertices, -1.0);
+    for (std::size_t p = 0; p < endpoints.size(); p++) {
+        const Eigen::VectorXd& d0 = dists[2 * p];
+        const Eigen::VectorXd& d1 = dists[2 * p + 1];
+        if (!std::isfinite(d0[endpoints[p].second])) {
+            return false;
+        }
+        parallel_for_chunks(std::size_t(_num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t v = begin; v < end; v++) {
+                if (std::isfinite(d0[v])) {
+                    isovals[v] = d0[v] / (d0[v] + d1[v]);
+                }
+            }
+        }, VERTICES_PER_CHUNK);
+    }
+    return true;
+}
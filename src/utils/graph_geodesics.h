@@ -0,0 +1,40 @@
+#ifndef GRAPH_GEODESICS_H
+#define GRAPH_GEODESICS_H
+
+#include <Eigen/Core>
+
+#include <utility>
+#include <vector>
+
+// Shortest path distances along the edges of a tet mesh, the fast approximation of the geodesic distances shown
+// while the endpoints are picked. Paths zigzag along the edges, so they overestimate the geodesic distances by
+// several percent, but building the graph and a query each take a pass over the mesh and a Dijkstra run instead
+// of the factorizations and solves of GeodesicSolver. The graph is built once per mesh and only read by the
+// queries, so several of them can run at once.
+class GraphGeodesics {
+public:
+    // Build the edge graph of TV, TT. Returns false if the mesh has no tets.
+    bool compute(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT);
+
+    bool is_valid() const { return _num_vertices > 0; }
+    int num_vertices() const { return _num_vertices; }
+
+    // Length of the shortest path along the edges from source to every vertex, infinite for the vertices of
+    // other components
+    void distances(int source, Eigen::VectorXd& dists) const;
+
+    // Field with the range of GeodesicSolver::solve and extract_skeleton over the component of each endpoint
+    // pair: d0 / (d0 + d1) for the distances d0 and d1 to the two endpoints of the pair, 0 at the first and 1 at
+    // the second, and -1 on the components without endpoints. The distances of all the endpoints are found in
+    // parallel. Returns false if the endpoints of a pair are not connected.
+    bool solve(const std::vector<std::pair<int, int>>& endpoints, Eigen::VectorXd& isovals) const;
+
+private:
+    int _num_vertices = 0;
+    // The neighbors of vertex v and the lengths of the edges to them are at [_offsets[v], _offsets[v + 1])
+    std::vector<int> _offsets;
+    std::vector<int> _neighbors;
+    std::vector<double> _lengths;
+};
+
+#endif // GRAPH_GEODESICS_H
@@ -0,0 +1,489 @@
+#include "image_stack_ingest.h"
+
+#include "content_hash.h"
+#include "datfile.h"
+#include "metrics.h"
+#include "parallel_for.h"
+#include "path_utils.h"
+#include "raw_volume_view.h"
+#include "slice_decoder.h"
+
+#include <QImage>
+#include <QString>
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+std::string slice_filename(const ImageStackIngestParameters& params, int index) {
+    std::ostringstream ss;
+    ss << params.input_dir << "/" << params.prefix;
+    if (params.index_width > 0) {
+        ss << std::setw(params.index_width) << std::setfill('0');
+    }
+    ss << index << "." << params.file_extension;
+    return ss.str();
+}
+
+// Decode one slice into a tightly packed 8 bit grayscale buffer, with decoder unless it does not support the file
+bool decode_slice(SliceDecoder& decoder, const std::string& filename, int& w, int& h, std::vector<uint8_t>& out) {
+    const SliceDecodeStatus status = decoder.decode(filename, w, h, out);
+    if (status != SliceDecodeStatus::Unsupported) {
+        return status == SliceDecodeStatus::Decoded;
+    }
+
+    QImage img(QString::fromStdString(filename));
+    if (img.isNull()) {
+        return false;
+    }
+    if (img.format() != QImage::Format_Grayscale8) {
+        img = img.convertToFormat(QImage::Format_Grayscale8);
+    }
+    w = img.width();
+    h = img.height();
+    out.resize(size_t(w) * size_t(h));
+
+    // Scanlines in a QImage are 4 byte aligned so we have to copy row by row
+    for (int y = 0; y < h; y++) {
+        const uint8_t* row = img.constScanLine(y);
+        std::copy(row, row + w, out.data() + size_t(y) * size_t(w));
+    }
+    return true;
+}
+
+// Size and modification time of an image, an image that changed since its slice was cached is decoded again
+std::string source_stamp(const std::string& filename) {
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) != 0) {
+        return "missing";
+    }
+    return std::to_string(static_cast<long long>(file_stat.st_size)) + "@" +
+           std::to_string(static_cast<long long>(file_stat.st_mtime));
+}
+
+// Bump this whenever the decoded slices change for the same images
+constexpr int SLICE_MANIFEST_VERSION = 1;
+
+// Which image each slice of a full resolution volume was decoded from, see
+// ImageStackIngestParameters::reuse_cached_slices
+struct SliceManifest {
+    struct Slice {
+        int offset = 0;
+        std::uint64_t hash = 0;
+        std::string stamp;
+    };
+
+    // The volume, relative to the directory of the manifest
+    std::string raw_filename;
+    int w = 0, h = 0, d = 0;
+    // By the filename of their image
+    std::unordered_map<std::string, Slice> slices;
+
+    bool read(const std::string& filename) {
+        std::ifstream is(filename);
+        std::string line;
+        int version = 0;
+        if (!std::getline(is, line) || std::sscanf(line.c_str(), "version %d", &version) != 1 ||
+            version != SLICE_MANIFEST_VERSION || !std::getline(is, line) || line.compare(0, 7, "volume ") != 0) {
+            return false;
+        }
+        raw_filename = line.substr(7);
+        if (!std::getline(is, line) || std::sscanf(line.c_str(), "dims %d %d %d", &w, &h, &d) != 3) {
+            return false;
+        }
+        // One slice per line: offset, hash, stamp and the image, which goes last as it may contain spaces
+        while (std::getline(is, line)) {
+            std::istringstream ss(line);
+            Slice slice;
+            std::string image;
+            ss >> slice.offset >> std::hex >> slice.hash >> slice.stamp;
+            if (!ss || slice.offset < 0 || slice.offset >= d || !std::getline(ss >> std::ws, image)) {
+                return false;
+            }
+            slices[image] = slice;
+        }
+        return true;
+    }
+
+    bool write(const std::string& filename, const std::vector<std::string>& images) const {
+        std::ofstream os(filename);
+        os << "version " << SLICE_MANIFEST_VERSION << "\nvolume " << raw_filename << "\ndims " << w << " " << h << " "
+           << d << "\n";
+        for (const std::string& image : images) {
+            const Slice& slice = slices.at(image);
+            os << slice.offset << " " << std::hex << std::setw(16) << std::setfill('0') << slice.hash << std::dec
+               << " " << slice.stamp << " " << image << "\n";
+        }
+        return os.good();
+    }
+};
+
+bool write_datfile(const std::string& output_dir, const std::string& prefix, int w, int h, int d,
+                   std::shared_ptr<spdlog::logger> logger) {
+    DatFile datfile;
+    datfile.w = w;
+    datfile.h = h;
+    datfile.d = d;
+    datfile.m_raw_filename = prefix + ".raw";
+    datfile.m_format = "UINT8";
+    return datfile.serialize(output_dir + "/" + prefix + ".dat", logger);
+}
+
+} // namespace
+
+
+bool ingest_image_stack(const ImageStackIngestParameters& params, std::shared_ptr<spdlog::logger> logger) {
+    const int num_slices = params.end_index - params.start_index + 1;
+    const int factor = std::max(params.downsample_factor, 1);
+    if (num_slices <= 0) {
+        logger->error("Invalid slice range [{}, {}]", params.start_index, params.end_index);
+        return false;
+    }
+
+    // Decode the first slice up front to get the dimensions of the volume
+    int w = 0, h = 0;
+    std::vector<uint8_t> first_slice;
+    SliceDecoder first_decoder(logger);
+    if (!decode_slice(first_decoder, slice_filename(params, params.start_index), w, h, first_slice)) {
+        logger->error("Failed to read image slice '{}'", slice_filename(params, params.start_index));
+        return false;
+    }
+    if (params.reuse_full_res) {
+        const std::string datfile_path = params.output_dir + "/" + params.full_res_prefix + ".dat";
+        DatFile datfile;
+        datfile.w = datfile.h = datfile.d = 0;
+        if (get_file_type(datfile_path.c_str()) == FT_REGULAR_FILE && datfile.deserialize(datfile_path, logger) &&
+            datfile.w == w && datfile.h == h && datfile.d == num_slices && datfile.bytes_per_voxel() == 1) {
+            logger->info("Reusing the full resolution volume '{}'", datfile_path);
+            return downsample_volume_file(params, logger);
+        }
+        logger->info("No full resolution volume of {}x{}x{} to reuse in '{}'", w, h, num_slices, params.output_dir);
+    }
+    const size_t slice_size = size_t(w) * size_t(h);
+
+    // The images of the slices, the size and modification time they had when they were read and the hashes of the
+    // slices, which the manifest of the volume keeps for the next ingest
+    const std::string full_res_raw = params.full_res_prefix + ".raw";
+    const std::string manifest_path = params.output_dir + "/" + params.prefix + ".slices";
+    std::vector<std::string> slice_images(static_cast<size_t>(num_slices));
+    for (int i = 0; i < num_slices; i++) {
+        slice_images[i] = slice_filename(params, params.start_index + i);
+    }
+    std::vector<std::string> slice_stamps(static_cast<size_t>(num_slices));
+    std::vector<uint64_t> slice_hashes(static_cast<size_t>(num_slices), 0);
+    slice_stamps[0] = source_stamp(slice_images[0]);
+    slice_hashes[0] = hash_bytes(first_slice.data(), slice_size);
+
+    // The volume of the last ingest, whose slices are copied where their images did not change
+    SliceManifest cached;
+    RawVolumeView cached_volume;
+    if (params.reuse_cached_slices && cached.read(manifest_path) && cached.w == w && cached.h == h &&
+        get_file_type((params.output_dir + "/" + cached.raw_filename).c_str()) == FT_REGULAR_FILE) {
+        cached_volume.open(params.output_dir + "/" + cached.raw_filename, Eigen::RowVector3i(w, h, cached.d), logger);
+    }
+    // The slice of image i in the cached volume, or nullptr if the image changed since or the slice does not hash
+    // to what was decoded from it
+    auto find_cached_slice = [&](int i) -> const uint8_t* {
+        slice_stamps[i] = source_stamp(slice_images[i]);
+        const auto it = cached.slices.find(slice_images[i]);
+        if (!cached_volume.is_open() || it == cached.slices.end() || it->second.stamp != slice_stamps[i]) {
+            return nullptr;
+        }
+        const uint8_t* data = cached_volume.data() + size_t(it->second.offset) * slice_size;
+        if (hash_bytes(data, slice_size) != it->second.hash) {
+            return nullptr;
+        }
+        slice_hashes[i] = it->second.hash;
+        return data;
+    };
+    if (cached_volume.is_open() && cached.raw_filename == full_res_raw && params.write_full_res) {
+        // The cached volume is the one about to be written, which only works out if it has every slice already,
+        // e.g. when just the downsample factor changed
+        std::atomic_bool all_cached(cached.d == num_slices);
+        parallel_for_chunks(size_t(num_slices), [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end && all_cached; i++) {
+                const auto it = cached.slices.find(slice_images[i]);
+                if (it == cached.slices.end() || it->second.offset != int(i) || !find_cached_slice(int(i))) {
+                    all_cached = false;
+                }
+            }
+        }, 1);
+        cached_volume.close();
+        if (all_cached) {
+            logger->info("Every slice is cached in the full resolution volume '{}'", full_res_raw);
+            return downsample_volume_file(params, logger);
+        }
+        std::remove(manifest_path.c_str());
+    }
+
+    const int lw = std::max(w / factor, 1), lh = std::max(h / factor, 1), ld = std::max(num_slices / factor, 1);
+    logger->info("Ingesting {} slices of size {}x{}, low resolution volume is {}x{}x{}", num_slices, w, h, lw, lh, ld);
+
+    std::ofstream full_res_file, low_res_file;
+    if (params.write_full_res) {
+        full_res_file.open(params.output_dir + "/" + params.full_res_prefix + ".raw", std::ofstream::binary);
+        if (!full_res_file.good()) {
+            logger->error("Failed to create output file '{}'", params.output_dir + "/" + params.full_res_prefix + ".raw");
+            return false;
+        }
+    }
+    low_res_file.open(params.output_dir + "/" + params.low_res_prefix + ".raw", std::ofstream::binary);
+    if (!low_res_file.good()) {
+        logger->error("Failed to create output file '{}'", params.output_dir + "/" + params.low_res_prefix + ".raw");
+        return false;
+    }
+
+    const int num_decoders = params.num_decoder_threads > 0 ? params.num_decoder_threads : int(parallel_num_threads());
+    const int max_in_flight = params.max_slices_in_flight > 0 ? params.max_slices_in_flight : std::max(2 * factor, num_decoders);
+
+    // Decoded slices waiting to be consumed, keyed by their offset from start_index, and the buffers of the slices
+    // the consumer is done with, which the decoders decode into again instead of allocating a slice each
+    std::map<int, std::vector<uint8_t>> decoded;
+    decoded[0] = std::move(first_slice);
+    std::vector<std::vector<uint8_t>> free_slices;
+    std::mutex decoded_mutex;
+    std::condition_variable slice_ready, slot_free;
+    std::atomic_int next_to_decode(1);
+    std::atomic_bool failed(false);
+    std::atomic_int slices_copied(0);
+    int next_to_consume = 0; // Only written by the consumer while holding decoded_mutex
+
+    // With fewer decoders than threads (or slices than decoders) the strips of a slice are decompressed in parallel
+    const bool parallel_strips = size_t(std::min(num_decoders, num_slices)) < parallel_num_threads();
+    auto decoder = [&]() {
+        SliceDecoder slice_decoder(logger);
+        slice_decoder.parallel_strips = parallel_strips;
+        while (!failed) {
+            const int i = next_to_decode++;
+            if (i >= num_slices) {
+                return;
+            }
+
+            // Don't run further ahead of the consumer than max_in_flight slices
+            std::vector<uint8_t> slice;
+            {
+                std::unique_lock<std::mutex> lock(decoded_mutex);
+                slot_free.wait(lock, [&]() { return failed || i < next_to_consume + max_in_flight; });
+                if (!free_slices.empty()) {
+                    slice = std::move(free_slices.back());
+                    free_slices.pop_back();
+                }
+            }
+            if (failed) {
+                return;
+            }
+
+            int sw = 0, sh = 0;
+            const std::string& filename = slice_images[i];
+            bool ok = false;
+            if (const uint8_t* cached_slice = find_cached_slice(i)) {
+                slice.assign(cached_slice, cached_slice + slice_size);
+                sw = w;
+                sh = h;
+                ok = true;
+                slices_copied++;
+            } else {
+                ok = decode_slice(slice_decoder, filename, sw, sh, slice);
+                if (ok && sw == w && sh == h) {
+                    slice_hashes[i] = hash_bytes(slice.data(), slice_size);
+                }
+            }
+            if (!ok || sw != w || sh != h) {
+                if (!ok) {
+                    logger->error("Failed to read image slice '{}'", filename);
+                } else {
+                    logger->error("Image slice '{}' has size {}x{} but expected {}x{}", filename, sw, sh, w, h);
+                }
+                failed = true;
+                slice_ready.notify_all();
+                slot_free.notify_all();
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(decoded_mutex);
+                decoded[i] = std::move(slice);
+            }
+            slice_ready.notify_all();
+        }
+    };
+
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < num_decoders; t++) {
+        decoders.emplace_back(decoder);
+    }
+
+    // Consume slices in order: stream them to the full resolution file and accumulate
+    // factor x factor x factor boxes for the low resolution volume
+    std::vector<uint32_t> low_res_accum(size_t(lw) * size_t(lh), 0);
+    std::vector<uint8_t> low_res_slice(size_t(lw) * size_t(lh));
+    const uint32_t box_count = uint32_t(factor) * uint32_t(factor) * uint32_t(factor);
+    int low_res_slices_written = 0;
+
+    static metrics::Counter& voxels_ingested =
+        metrics::counter("unwind_voxels_ingested_total", "Voxels read from the image stacks");
+    for (int i = 0; i < num_slices && !failed; i++) {
+        std::vector<uint8_t> slice;
+        {
+            std::unique_lock<std::mutex> lock(decoded_mutex);
+            slice_ready.wait(lock, [&]() { return failed || decoded.count(i) > 0; });
+            if (failed) {
+                break;
+            }
+            slice = std::move(decoded[i]);
+            decoded.erase(i);
+            next_to_consume = i + 1;
+        }
+        slot_free.notify_all();
+        voxels_ingested.add(slice_size);
+
+        if (params.write_full_res) {
+            full_res_file.write(reinterpret_cast<const char*>(slice.data()), slice_size);
+        }
+
+        if (low_res_slices_written < ld) {
+            for (int y = 0; y < std::min(h, lh * factor); y++) {
+                const uint8_t* row = slice.data() + size_t(y) * size_t(w);
+                uint32_t* accum_row = low_res_accum.data() + size_t(y / factor) * size_t(lw);
+                for (int x = 0; x < std::min(w, lw * factor); x++) {
+                    accum_row[x / factor] += row[x];
+                }
+            }
+            if ((i + 1) % factor == 0) {
+                for (size_t j = 0; j < low_res_accum.size(); j++) {
+                    low_res_slice[j] = static_cast<uint8_t>(low_res_accum[j] / box_count);
+                }
+                low_res_file.write(reinterpret_cast<const char*>(low_res_slice.data()), low_res_slice.size());
+                std::fill(low_res_accum.begin(), low_res_accum.end(), 0);
+                low_res_slices_written += 1;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(decoded_mutex);
+        free_slices.push_back(std::move(slice));
+    }
+
+    if (!failed && low_res_slices_written < ld) {
+        // Fewer slices than the downsample factor, emit the partial box we have
+        const uint32_t partial_count = uint32_t(factor) * uint32_t(factor) * uint32_t(num_slices % factor);
+        for (size_t j = 0; j < low_res_accum.size(); j++) {
+            low_res_slice[j] = static_cast<uint8_t>(low_res_accum[j] / std::max(partial_count, 1u));
+        }
+        low_res_file.write(reinterpret_cast<const char*>(low_res_slice.data()), low_res_slice.size());
+        low_res_slices_written += 1;
+    }
+
+    slot_free.notify_all();
+    for (std::thread& t : decoders) {
+        t.join();
+    }
+
+    if (failed) {
+        return false;
+    }
+    if (slices_copied > 0) {
+        logger->info("Copied {} of {} slices from '{}'", int(slices_copied), num_slices, cached.raw_filename);
+    }
+    if (!low_res_file.good() || (params.write_full_res && !full_res_file.good())) {
+        logger->error("Failed to write volume data to '{}'", params.output_dir);
+        return false;
+    }
+    full_res_file.close();
+    low_res_file.close();
+
+    if (params.write_full_res) {
+        if (!write_datfile(params.output_dir, params.full_res_prefix, w, h, num_slices, logger)) {
+            return false;
+        }
+
+        SliceManifest manifest;
+        manifest.raw_filename = full_res_raw;
+        manifest.w = w;
+        manifest.h = h;
+        manifest.d = num_slices;
+        for (int i = 0; i < num_slices; i++) {
+            SliceManifest::Slice& slice = manifest.slices[slice_images[i]];
+            slice.offset = i;
+            slice.hash = slice_hashes[i];
+            slice.stamp = slice_stamps[i];
+        }
+        if (!manifest.write(manifest_path, slice_images)) {
+            logger->warn("Failed to write the slice manifest '{}', the next ingest decodes every slice", manifest_path);
+        }
+    }
+    return write_datfile(params.output_dir, params.low_res_prefix, lw, lh, low_res_slices_written, logger);
+}
+
+bool downsample_volume_file(const ImageStackIngestParameters& params, std::shared_ptr<spdlog::logger> logger) {
+    const std::string full_res_path = params.output_dir + "/" + params.full_res_prefix;
+    DatFile datfile;
+    datfile.w = datfile.h = datfile.d = 0;
+    if (get_file_type((full_res_path + ".dat").c_str()) != FT_REGULAR_FILE ||
+        !datfile.deserialize(full_res_path + ".dat", logger)) {
+        logger->error("Failed to read '{}'", full_res_path + ".dat");
+        return false;
+    }
+    if (datfile.bytes_per_voxel() != 1) {
+        logger->error("'{}' is not an 8 bit volume", full_res_path + ".dat");
+        return false;
+    }
+    const int w = datfile.w, h = datfile.h, num_slices = datfile.d;
+    RawVolumeView volume;
+    if (!volume.open(full_res_path + ".raw", Eigen::RowVector3i(w, h, num_slices), logger)) {
+        return false;
+    }
+
+    const int factor = std::max(params.downsample_factor, 1);
+    const int lw = std::max(w / factor, 1), lh = std::max(h / factor, 1), ld = std::max(num_slices / factor, 1);
+    logger->info("Downsampling {}x{}x{} to {}x{}x{}", w, h, num_slices, lw, lh, ld);
+
+    // Each low resolution row sums the boxes of ingest_image_stack, whose last one is partial if there are fewer
+    // slices than the factor
+    std::vector<uint8_t> low_res(size_t(lw) * size_t(lh) * size_t(ld));
+    parallel_for_chunks(size_t(lh) * size_t(ld), [&](size_t begin, size_t end, size_t) {
+        std::vector<uint32_t> accum(static_cast<size_t>(lw));
+        for (size_t r = begin; r < end; r++) {
+            const int lz = int(r / size_t(lh)), ly = int(r % size_t(lh));
+            const int z_end = std::min(num_slices, (lz + 1) * factor);
+            const int y_end = std::min(h, (ly + 1) * factor);
+            const int x_end = std::min(w, lw * factor);
+            std::fill(accum.begin(), accum.end(), 0);
+            for (int z = lz * factor; z < z_end; z++) {
+                for (int y = ly * factor; y < y_end; y++) {
+                    const uint8_t* row = volume.data() + (size_t(z) * size_t(h) + size_t(y)) * size_t(w);
+                    for (int x = 0; x < x_end; x++) {
+                        accum[x / factor] += row[x];
+                    }
+                }
+            }
+            const uint32_t box_count = uint32_t(factor) * uint32_t(factor) * uint32_t(z_end - lz * factor);
+            uint8_t* out = low_res.data() + r * size_t(lw);
+            for (int x = 0; x < lw; x++) {
+                out[x] = static_cast<uint8_t>(accum[x] / box_count);
+            }
+        }
+    }, 1);
+
+    const std::string low_res_path = params.output_dir + "/" + params.low_res_prefix + ".raw";
+    std::ofstream low_res_file(low_res_path, std::ofstream::binary);
+    low_res_file.write(reinterpret_cast<const char*>(low_res.data()), std::streamsize(low_res.size()));
+    low_res_file.close();
+    if (!low_res_file.good()) {
+        logger->error("Failed to write volume data to '{}'", low_res_path);
+        return false;
+    }
+    return write_datfile(params.output_dir, params.low_res_prefix, lw, lh, ld, logger);
+}
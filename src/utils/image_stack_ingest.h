@@ -0,0 +1,52 @@
+#ifndef IMAGE_STACK_INGEST_H
+#define IMAGE_STACK_INGEST_H
+
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <string>
+
+struct ImageStackIngestParameters {
+    // Slices are read from <input_dir>/<prefix><index>.<file_extension> for index in [start_index, end_index].
+    // If index_width is greater than zero, the index is zero padded to that many digits.
+    std::string input_dir;
+    std::string prefix;
+    std::string file_extension;
+    int start_index = 0;
+    int end_index = 0;
+    int index_width = 0;
+
+    // Outputs are <output_dir>/<full_res_prefix>.{raw,dat} and <output_dir>/<low_res_prefix>.{raw,dat}
+    std::string output_dir;
+    std::string full_res_prefix;
+    std::string low_res_prefix;
+    int downsample_factor = 8;
+    bool write_full_res = true;
+    // Keep the full resolution volume an earlier ingest of the same slices left in output_dir, if it has their
+    // dimensions, and only compute the low resolution volume from it with downsample_volume_file
+    bool reuse_full_res = false;
+    // Copy the slices whose images did not change from the full resolution volume the last ingest of the same prefix
+    // wrote to output_dir, instead of decoding them again. Each ingest records in <output_dir>/<prefix>.slices
+    // which image every slice of its volume was decoded from, with the size and modification time of the image and
+    // a hash of the slice, so extending or trimming the slice range only decodes the images it adds.
+    bool reuse_cached_slices = true;
+
+    // Number of threads decoding slices, 0 means one per hardware thread
+    int num_decoder_threads = 0;
+
+    // Maximum number of decoded slices held in memory at once, 0 means a few slabs of downsample_factor slices
+    int max_slices_in_flight = 0;
+};
+
+// Convert a stack of 2D images into 8 bit full resolution and box-filtered low resolution .raw/.dat volumes.
+// Slices are decoded in parallel and streamed straight to disk, so peak memory is bounded by
+// max_slices_in_flight slices rather than the size of the whole scan.
+bool ingest_image_stack(const ImageStackIngestParameters& params, std::shared_ptr<spdlog::logger> logger);
+
+// Box filter the 8 bit volume <output_dir>/<full_res_prefix>.{raw,dat} into <output_dir>/<low_res_prefix>.{raw,dat}
+// by downsample_factor, to the same voxels ingest_image_stack computes while it reads the slices. The full
+// resolution file is mapped and the low resolution rows are reduced in parallel, so the downsample factor of a
+// scan changes without decoding its images again.
+bool downsample_volume_file(const ImageStackIngestParameters& params, std::shared_ptr<spdlog::logger> logger);
+
+#endif // IMAGE_STACK_INGEST_H
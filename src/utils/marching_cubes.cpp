@@ -0,0 +1,166 @@
+#include "marching_cubes.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <vector>
+
+namespace {
+
+// At most 12 edges of a cube are crossed, in loops of at least 3, so a cube has at most 10 triangles
+constexpr int MAX_CUBE_TRIANGLES = 10;
+
+typedef std::array<signed char, 3 * MAX_CUBE_TRIANGLES + 1> CubeTriangles;
+
+int corner(const int p[3]) {
+    return p[0] | (p[1] << 1) | (p[2] << 2);
+}
+
+void edge_corners(int e, int& c0, int& c1) {
+    int p[3];
+    marching_cubes_detail::edge_start(e, p[0], p[1], p[2]);
+    c0 = corner(p);
+    p[e / 4] = 1;
+    c1 = corner(p);
+}
+
+int edge_between(int c0, int c1) {
+    for (int e = 0; e < 12; e++) {
+        int a, b;
+        edge_corners(e, a, b);
+        if ((a == c0 && b == c1) || (a == c1 && b == c0)) {
+            return e;
+        }
+    }
+    assert(false);
+    return -1;
+}
+
+// True if the edges e and f lie on a common face of the cube
+bool on_common_face(int e, int f) {
+    int e0, e1, f0, f1;
+    edge_corners(e, e0, e1);
+    edge_corners(f, f0, f1);
+    const int common = ~(e0 ^ e1) & ~(e0 ^ f0) & ~(e0 ^ f1) & 7;
+    return common != 0;
+}
+
+// Split the loop of crossed edges into triangles, adding ears whose new side does not lie on a face of the cube.
+// Such a side would also be a side in the neighbor across the face whenever the surface crosses the face twice,
+// and the edge would be shared by four triangles.
+bool triangulate_loop(const std::vector<int>& loop, std::vector<std::array<int, 3>>& triangles) {
+    const std::size_t n = loop.size();
+    if (n == 3) {
+        triangles.push_back({ { loop[0], loop[1], loop[2] } });
+        return true;
+    }
+    for (std::size_t i = 0; i < n; i++) {
+        const int prev = loop[(i + n - 1) % n], next = loop[(i + 1) % n];
+        if (on_common_face(prev, next)) {
+            continue;
+        }
+        std::vector<int> rest;
+        for (std::size_t j = 0; j < n; j++) {
+            if (j != i) {
+                rest.push_back(loop[j]);
+            }
+        }
+        const std::size_t num_triangles = triangles.size();
+        triangles.push_back({ { prev, loop[i], next } });
+        if (triangulate_loop(rest, triangles)) {
+            return true;
+        }
+        triangles.resize(num_triangles);
+    }
+    return false;
+}
+
+// The triangle table is derived from the faces of the cube instead of being written out. On each face the surface
+// runs between the crossed edges of the face, cutting off the inside corners one by one where two of them are
+// diagonally opposite. That only depends on the corners of the face, so the two cubes sharing a face agree on it
+// and the surface has no holes. The runs on the faces chain into loops around the cube, which are triangulated
+// by triangulate_loop().
+CubeTriangles triangulate_cube(int config) {
+    auto inside = [config](int c) { return ((config >> c) & 1) != 0; };
+
+    // next[e] is the edge the surface goes to after edge e, walking the faces counterclockwise seen from outside
+    int next[12];
+    std::fill(next, next + 12, -1);
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+            // The corners of the face in counterclockwise order seen from outside
+            int face_corners[4];
+            const int uv[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+            for (int k = 0; k < 4; k++) {
+                int p[3];
+                p[axis] = side;
+                p[u] = uv[side == 1 ? k : 3 - k][0];
+                p[v] = uv[side == 1 ? k : 3 - k][1];
+                face_corners[k] = corner(p);
+            }
+
+            // The surface enters the face where the walk goes from an outside to an inside corner and leaves it
+            // where the walk goes out again, which is the next crossing along the walk
+            for (int k = 0; k < 4; k++) {
+                if (inside(face_corners[k]) || !inside(face_corners[(k + 1) % 4])) {
+                    continue;
+                }
+                int j = (k + 1) % 4;
+                while (inside(face_corners[(j + 1) % 4])) {
+                    j = (j + 1) % 4;
+                }
+                const int from = edge_between(face_corners[k], face_corners[(k + 1) % 4]);
+                const int to = edge_between(face_corners[j], face_corners[(j + 1) % 4]);
+                assert(next[from] == -1);
+                next[from] = to;
+            }
+        }
+    }
+
+    CubeTriangles triangles;
+    triangles.fill(-1);
+    int num_triangles = 0;
+    bool visited[12] = {};
+    for (int start = 0; start < 12; start++) {
+        if (next[start] < 0 || visited[start]) {
+            continue;
+        }
+        std::vector<int> loop;
+        for (int e = start; !visited[e]; e = next[e]) {
+            visited[e] = true;
+            loop.push_back(e);
+        }
+        assert(loop.size() >= 3 && loop.front() == next[loop.back()]);
+        std::vector<std::array<int, 3>> loop_triangles;
+        const bool triangulated = triangulate_loop(loop, loop_triangles);
+        assert(triangulated);
+        (void)triangulated;
+        for (const std::array<int, 3>& triangle : loop_triangles) {
+            assert(num_triangles < MAX_CUBE_TRIANGLES);
+            for (int j = 0; j < 3; j++) {
+                triangles[3 * num_triangles + j] = static_cast<signed char>(triangle[j]);
+            }
+            num_triangles++;
+        }
+    }
+    return triangles;
+}
+
+struct CubeTable {
+    std::array<CubeTriangles, 256> configs;
+
+    CubeTable() {
+        for (int config = 0; config < 256; config++) {
+            configs[config] = triangulate_cube(config);
+        }
+    }
+};
+
+} // namespace
+
+
+const signed char* marching_cubes_detail::cube_triangles(int config) {
+    static const CubeTable table;
+    return table.configs[config].data();
+}
@@ -0,0 +1,226 @@
+#ifndef MARCHING_CUBES_H
+#define MARCHING_CUBES_H
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "parallel_for.h"
+
+// Regular grid of dims[0] x dims[1] x dims[2] samples, sample (x, y, z) is at origin + spacing * (x, y, z)
+struct MarchingCubesGrid {
+    Eigen::RowVector3d origin = Eigen::RowVector3d::Zero();
+    Eigen::RowVector3d spacing = Eigen::RowVector3d::Ones();
+    Eigen::Vector3i dims = Eigen::Vector3i::Zero();
+};
+
+namespace marching_cubes_detail {
+
+// Corner c of a cube is at (c & 1, (c >> 1) & 1, (c >> 2) & 1) from its lowest corner. Edge e of a cube runs
+// along axis e / 4, from the corner at offset (x, y, z) to the next corner along that axis.
+inline void edge_start(int e, int& x, int& y, int& z) {
+    int offset[3];
+    const int axis = e / 4;
+    offset[axis] = 0;
+    offset[(axis + 1) % 3] = e & 1;
+    offset[(axis + 2) % 3] = (e >> 1) & 1;
+    x = offset[0];
+    y = offset[1];
+    z = offset[2];
+}
+
+// Triangles of the surface through a cube whose inside corners are the set bits of config, as triples of
+// edges of the cube terminated by -1. The triangles face from the inside to the outside corners.
+const signed char* cube_triangles(int config);
+
+// Cubes of the layers [z_begin, z_end) of a grid, with vertices numbered from 0
+struct Slab {
+    // 3 coordinates per vertex
+    std::vector<double> vertices;
+    // 3 vertices per triangle. Vertices of the x and y edges of layer z_end, which the next slab creates, are
+    // stored as -1 - k for the edge above_keys[k].
+    std::vector<int> triangles;
+    std::vector<std::int64_t> above_keys;
+    // The vertices of the x and y edges of layer z_begin by increasing key
+    std::vector<std::pair<std::int64_t, int>> below;
+};
+
+// Key of the edge along axis 0 or 1 from sample (x, y) of a layer
+inline std::int64_t layer_edge_key(int x, int y, int axis, int nx) {
+    return (std::int64_t(y) * nx + x) * 2 + axis;
+}
+
+template<typename Value>
+void march_slab(const MarchingCubesGrid& grid, const Value& value, double isovalue, int z_begin, int z_end,
+                Slab& slab) {
+    typedef decltype(value(0, 0, 0)) Scalar;
+    const int nx = grid.dims[0], ny = grid.dims[1], nz = grid.dims[2];
+    const std::size_t layer_size = std::size_t(nx) * ny;
+    // The last slab creates the vertices of its top layer itself
+    const bool owns_top = z_end == nz - 1;
+
+    // Two layers of samples and the vertex of the x, y and z edge from each sample of those layers, -1 if the
+    // surface does not cross the edge
+    std::vector<Scalar> values[2] = { std::vector<Scalar>(layer_size), std::vector<Scalar>(layer_size) };
+    std::vector<int> vertex[2] = { std::vector<int>(layer_size * 3), std::vector<int>(layer_size * 3) };
+
+    auto load_layer = [&](int z, std::vector<Scalar>& layer) {
+        for (int y = 0; y < ny; y++) {
+            for (int x = 0; x < nx; x++) {
+                layer[std::size_t(y) * nx + x] = value(x, y, z);
+            }
+        }
+    };
+    auto add_vertex = [&](int x, int y, int z, int axis, double a, double b) {
+        const double t = (isovalue - a) / (b - a);
+        double p[3] = { double(x), double(y), double(z) };
+        p[axis] += t;
+        for (int i = 0; i < 3; i++) {
+            slab.vertices.push_back(grid.origin[i] + grid.spacing[i] * p[i]);
+        }
+        return int(slab.vertices.size() / 3 - 1);
+    };
+    // Vertices of the edges along x and y from the samples of layer z
+    auto layer_vertices = [&](int z, const std::vector<Scalar>& layer, std::vector<int>& ids) {
+        const bool below = z == z_begin;
+        const bool above = z == z_end && !owns_top;
+        for (int y = 0; y < ny; y++) {
+            for (int x = 0; x < nx; x++) {
+                const std::size_t i = std::size_t(y) * nx + x;
+                const double a = double(layer[i]);
+                for (int axis = 0; axis < 2; axis++) {
+                    int& id = ids[i * 3 + axis];
+                    id = -1;
+                    if ((axis == 0 && x + 1 == nx) || (axis == 1 && y + 1 == ny)) {
+                        continue;
+                    }
+                    const double b = double(layer[axis == 0 ? i + 1 : i + nx]);
+                    if ((a > isovalue) == (b > isovalue)) {
+                        continue;
+                    }
+                    const std::int64_t key = layer_edge_key(x, y, axis, nx);
+                    if (above) {
+                        // -2 - k for above_keys[k], which is told apart from the -1 of an uncrossed edge
+                        id = -2 - int(slab.above_keys.size());
+                        slab.above_keys.push_back(key);
+                    } else {
+                        id = add_vertex(x, y, z, axis, a, b);
+                        if (below) {
+                            slab.below.emplace_back(key, id);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    load_layer(z_begin, values[0]);
+    layer_vertices(z_begin, values[0], vertex[0]);
+    for (int z = z_begin; z < z_end; z++) {
+        const std::vector<Scalar>& lower = values[0];
+        std::vector<Scalar>& upper = values[1];
+        load_layer(z + 1, upper);
+
+        // Edges along z between the two layers
+        for (std::size_t i = 0; i < layer_size; i++) {
+            const double a = double(lower[i]), b = double(upper[i]);
+            vertex[0][i * 3 + 2] = (a > isovalue) == (b > isovalue) ? -1 :
+                                   add_vertex(int(i % nx), int(i / nx), z, 2, a, b);
+        }
+        layer_vertices(z + 1, upper, vertex[1]);
+
+        for (int y = 0; y + 1 < ny; y++) {
+            for (int x = 0; x + 1 < nx; x++) {
+                int config = 0;
+                for (int c = 0; c < 8; c++) {
+                    const std::vector<Scalar>& layer = values[c >> 2];
+                    const std::size_t i = std::size_t(y + ((c >> 1) & 1)) * nx + x + (c & 1);
+                    if (double(layer[i]) > isovalue) {
+                        config |= 1 << c;
+                    }
+                }
+                if (config == 0 || config == 255) {
+                    continue;
+                }
+                for (const signed char* e = cube_triangles(config); *e >= 0; e++) {
+                    int ox, oy, oz;
+                    edge_start(*e, ox, oy, oz);
+                    const std::size_t i = std::size_t(y + oy) * nx + x + ox;
+                    const int id = vertex[oz][i * 3 + *e / 4];
+                    // Only crossed edges are used, so a negative id is an edge of the layer above the slab
+                    slab.triangles.push_back(id >= 0 ? id : id + 1);
+                }
+            }
+        }
+
+        std::swap(values[0], values[1]);
+        std::swap(vertex[0], vertex[1]);
+    }
+}
+
+} // namespace marching_cubes_detail
+
+// Triangle mesh of the surface where value(x, y, z) crosses isovalue, over the samples (x, y, z) of grid. Samples
+// above isovalue are inside, the faces point from the inside to the outside. value is only called for the
+// samples, which makes it work on the bytes of a volume, or on a volume padded on the fly, without a copy of the
+// grid positions or of the values as doubles.
+//
+// The layers of cubes are split into slabs along z which are processed in parallel, each numbering the vertices on
+// its edges once. The vertices on the layer between two slabs belong to the upper slab, so the slabs are merged
+// into V and F without duplicate vertices and the mesh is closed wherever the surface does not leave the grid.
+template<typename Value>
+void marching_cubes(const MarchingCubesGrid& grid, const Value& value, double isovalue,
+                    Eigen::MatrixXd& V, Eigen::MatrixXi& F) {
+    using namespace marching_cubes_detail;
+    constexpr int MIN_SLAB_LAYERS = 8;
+
+    const int num_layers = grid.dims.minCoeff() < 2 ? 0 : grid.dims[2] - 1;
+    const int num_slabs = int(parallel_num_chunks(std::size_t(std::max(num_layers, 1)), MIN_SLAB_LAYERS));
+    const int slab_layers = (num_layers + num_slabs - 1) / num_slabs;
+    std::vector<Slab> slabs(num_slabs);
+    parallel_tasks(std::size_t(num_layers > 0 ? num_slabs : 0), [&](std::size_t s) {
+        const int z_begin = int(s) * slab_layers;
+        const int z_end = std::min(num_layers, z_begin + slab_layers);
+        if (z_begin < z_end) {
+            march_slab(grid, value, isovalue, z_begin, z_end, slabs[s]);
+        }
+    });
+
+    std::vector<int> vertex_offsets(num_slabs + 1, 0);
+    std::vector<int> triangle_offsets(num_slabs + 1, 0);
+    for (int s = 0; s < num_slabs; s++) {
+        vertex_offsets[s + 1] = vertex_offsets[s] + int(slabs[s].vertices.size() / 3);
+        triangle_offsets[s + 1] = triangle_offsets[s] + int(slabs[s].triangles.size() / 3);
+    }
+
+    V.resize(vertex_offsets[num_slabs], 3);
+    F.resize(triangle_offsets[num_slabs], 3);
+    parallel_tasks(std::size_t(num_slabs), [&](std::size_t s) {
+        const Slab& slab = slabs[s];
+        const int num_vertices = int(slab.vertices.size() / 3);
+        for (int v = 0; v < num_vertices; v++) {
+            V.row(vertex_offsets[s] + v) << slab.vertices[3 * v], slab.vertices[3 * v + 1], slab.vertices[3 * v + 2];
+        }
+
+        const int num_triangles = int(slab.triangles.size() / 3);
+        for (int t = 0; t < num_triangles; t++) {
+            for (int j = 0; j < 3; j++) {
+                const int id = slab.triangles[3 * t + j];
+                if (id >= 0) {
+                    F(triangle_offsets[s] + t, j) = vertex_offsets[s] + id;
+                    continue;
+                }
+                // The next slab created the vertex on the layer between them
+                const std::int64_t key = slab.above_keys[std::size_t(-1 - id)];
+                const std::vector<std::pair<std::int64_t, int>>& below = slabs[s + 1].below;
+                const auto it = std::lower_bound(below.begin(), below.end(), std::make_pair(key, -1));
+                F(triangle_offsets[s] + t, j) = vertex_offsets[s + 1] + it->second;
+            }
+        }
+    });
+}
+
+#endif // MARCHING_CUBES_H
@@ -0,0 +1,149 @@
+#include "memory_tracker.h"
+#include "gl/video_memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+
+MemoryTracker& memory_tracker() {
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+std::size_t available_host_memory() {
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return std::size_t(status.ullAvailPhys);
+    }
+    return 0;
+#elif defined(__APPLE__)
+    vm_statistics64_data_t stats;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    if (host_statistics64(mach_host_self(), HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&stats), &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    // Inactive pages are given back without swapping
+    return (std::size_t(stats.free_count) + std::size_t(stats.inactive_count)) * std::size_t(vm_page_size);
+#else
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 13, "MemAvailable:") == 0) {
+            return std::size_t(std::strtoull(line.c_str() + 13, nullptr, 10)) * 1024;
+        }
+    }
+    return 0;
+#endif
+}
+
+void MemoryTracker::set_logger(std::shared_ptr<spdlog::logger> logger) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _logger = logger;
+}
+
+void MemoryTracker::set(const std::string& name, std::size_t host_bytes, std::size_t device_bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = std::find_if(_usage.begin(), _usage.end(), [&](const Usage& u) { return u.name == name; });
+    if (host_bytes == 0 && device_bytes == 0) {
+        if (it != _usage.end()) {
+            _usage.erase(it);
+        }
+        return;
+    }
+    if (it == _usage.end()) {
+        it = _usage.insert(_usage.end(), Usage());
+        it->name = name;
+    }
+    it->host_bytes = host_bytes;
+    it->device_bytes = device_bytes;
+}
+
+std::vector<MemoryTracker::Usage> MemoryTracker::usage() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _usage;
+}
+
+std::size_t MemoryTracker::total_host_bytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::size_t total = 0;
+    for (const Usage& u : _usage) {
+        total += u.host_bytes;
+    }
+    return total;
+}
+
+std::size_t MemoryTracker::total_device_bytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::size_t total = 0;
+    for (const Usage& u : _usage) {
+        total += u.device_bytes;
+    }
+    return total;
+}
+
+bool MemoryTracker::check(const std::string& stage, std::size_t host_bytes, std::size_t device_bytes) const {
+    const std::size_t host_available = host_bytes > 0 ? available_host_memory() : 0;
+    const std::size_t device_available = device_bytes > 0 ? available_video_memory() : 0;
+    const bool host_fits = host_available == 0 || host_bytes <= host_available;
+    const bool device_fits = device_available == 0 || device_bytes <= device_available;
+
+    std::shared_ptr<spdlog::logger> logger;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        logger = _logger;
+    }
+    if (logger && !host_fits) {
+        logger->warn("{} needs {:.1f} MiB of memory but only {:.1f} MiB are available", stage,
+                     to_mib(host_bytes), to_mib(host_available));
+    }
+    if (logger && !device_fits) {
+        logger->warn("{} needs {:.1f} MiB of video memory but only {:.1f} MiB are available", stage,
+                     to_mib(device_bytes), to_mib(device_available));
+    }
+    return host_fits && device_fits;
+}
+
+std::size_t MemoryTracker::device_budget(const std::string& stage, std::size_t wanted_bytes, std::size_t min_bytes) const {
+    const std::size_t available = available_video_memory();
+    // The other half is left to the textures of the views and to the other processes
+    if (available == 0 || wanted_bytes <= available / 2) {
+        return wanted_bytes;
+    }
+    const std::size_t budget = std::max(available / 2, std::min(min_bytes, wanted_bytes));
+    std::shared_ptr<spdlog::logger> logger;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        logger = _logger;
+    }
+    if (logger) {
+        logger->warn("Only {:.1f} MiB of video memory are available, {} is reduced from {:.1f} MiB to {:.1f} MiB",
+                     to_mib(available), stage, to_mib(wanted_bytes), to_mib(budget));
+    }
+    return budget;
+}
+
+void MemoryTracker::log() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_logger) {
+        return;
+    }
+    std::size_t host_total = 0, device_total = 0;
+    for (const Usage& u : _usage) {
+        _logger->info("Memory of {}: {:.1f} MiB, video memory: {:.1f} MiB", u.name, to_mib(u.host_bytes),
+                      to_mib(u.device_bytes));
+        host_total += u.host_bytes;
+        device_total += u.device_bytes;
+    }
+    _logger->info("Memory in total: {:.1f} MiB ({:.1f} MiB available), video memory: {:.1f} MiB", to_mib(host_total),
+                  to_mib(available_host_memory()), to_mib(device_total));
+}
@@ -0,0 +1,73 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Host and device memory held by the subsystems, shown in the overlay toggled with F9 and in the log.
+//
+// Owners of large buffers report what they hold under a name of their own whenever it changes, e.g. the
+// brick atlas when it is allocated or State when the overlay is drawn. Device sizes are estimates from the
+// dimensions and formats of the textures and buffers, the driver may pad them.
+//
+// check() compares what a stage is about to allocate with the memory the system has left, so the stage can
+// warn before it runs out, and device_budget() shrinks a cache to what fits.
+class MemoryTracker {
+public:
+    struct Usage {
+        std::string name;
+        std::size_t host_bytes = 0;
+        std::size_t device_bytes = 0;
+    };
+
+    MemoryTracker() = default;
+    MemoryTracker(const MemoryTracker&) = delete;
+    MemoryTracker& operator=(const MemoryTracker&) = delete;
+
+    // Warnings of check() and device_budget() and log() go to logger, nothing is logged without one
+    void set_logger(std::shared_ptr<spdlog::logger> logger);
+
+    // Current size of the buffers of name, replacing the last one reported. Zero sizes forget name.
+    void set(const std::string& name, std::size_t host_bytes, std::size_t device_bytes);
+
+    // In the order they were first reported
+    std::vector<Usage> usage() const;
+    std::size_t total_host_bytes() const;
+    std::size_t total_device_bytes() const;
+
+    // Returns false and warns if a stage is about to allocate more host or device memory than the system has
+    // left. Memory that cannot be queried always fits. Device memory is queried through GL, so a stage with
+    // device_bytes > 0 must run on the render thread.
+    bool check(const std::string& stage, std::size_t host_bytes, std::size_t device_bytes) const;
+
+    // Size of the device memory a cache of stage can take: wanted_bytes if it fits in half of the free video
+    // memory, else that half and at least min_bytes
+    std::size_t device_budget(const std::string& stage, std::size_t wanted_bytes, std::size_t min_bytes) const;
+
+    void log() const;
+
+    bool overlay_enabled() const { return _overlay_enabled; }
+    void set_overlay_enabled(bool enabled) { _overlay_enabled = enabled; }
+
+private:
+    mutable std::mutex _mutex;
+    std::vector<Usage> _usage;
+    std::shared_ptr<spdlog::logger> _logger;
+    bool _overlay_enabled = false;
+};
+
+// Tracker shared by all subsystems
+MemoryTracker& memory_tracker();
+
+// Physical memory that can still be allocated without swapping, 0 if it cannot be queried
+std::size_t available_host_memory();
+
+// Bytes as MiB, for messages
+inline double to_mib(std::size_t bytes) { return double(bytes) / (1024.0 * 1024.0); }
+
+#endif // MEMORY_TRACKER_H
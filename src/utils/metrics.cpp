@@ -0,0 +1,242 @@
+#include "metrics.h"
+
+#include "trace.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+namespace metrics {
+
+namespace {
+
+constexpr double DEFAULT_INTERVAL_SECONDS = 10.0;
+
+enum Kind {
+    KindCounter = 0,
+    KindSeconds,
+    KindGauge
+};
+
+struct Metric {
+    const char* name;
+    const char* help;
+    Kind kind;
+    Counter counter;
+    Gauge gauge;
+};
+
+struct StageTotals {
+    std::uint64_t nanoseconds = 0;
+    std::uint64_t calls = 0;
+};
+
+struct Exporter {
+    std::string filename;
+    std::shared_ptr<spdlog::logger> logger;
+    double interval_seconds = DEFAULT_INTERVAL_SECONDS;
+
+    // Registered metrics in the order they were first used, a deque so they never move
+    std::mutex metrics_mutex;
+    std::deque<Metric> metrics;
+
+    // Time of the trace scopes by name, the names of different scopes may be equal strings at different addresses
+    std::mutex stages_mutex;
+    std::map<std::string, StageTotals> stages;
+
+    // Serializes the writes of the thread and flush()
+    std::mutex write_mutex;
+
+    std::mutex thread_mutex;
+    std::condition_variable stop_requested;
+    bool stopping = false;
+    std::thread thread;
+};
+
+Exporter& exporter() {
+    static Exporter* instance = new Exporter();
+    return *instance;
+}
+
+Metric& metric(const char* name, const char* help, Kind kind) {
+    Exporter& e = exporter();
+    std::lock_guard<std::mutex> lock(e.metrics_mutex);
+    for (Metric& m : e.metrics) {
+        if (std::string(m.name) == name) {
+            return m;
+        }
+    }
+    e.metrics.emplace_back();
+    Metric& m = e.metrics.back();
+    m.name = name;
+    m.help = help;
+    m.kind = kind;
+    return m;
+}
+
+void observe_stage(const char* name, std::uint64_t begin, std::uint64_t end) {
+    Exporter& e = exporter();
+    std::lock_guard<std::mutex> lock(e.stages_mutex);
+    StageTotals& totals = e.stages[name];
+    totals.nanoseconds += end > begin ? end - begin : 0;
+    totals.calls += 1;
+}
+
+void write_escaped_label(std::ostream& out, const std::string& s) {
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else {
+            out << c;
+        }
+    }
+}
+
+void write_metrics(std::ostream& out) {
+    Exporter& e = exporter();
+    out << std::setprecision(9);
+    {
+        std::lock_guard<std::mutex> lock(e.metrics_mutex);
+        for (const Metric& m : e.metrics) {
+            out << "# HELP " << m.name << " " << m.help << "\n";
+            out << "# TYPE " << m.name << " " << (m.kind == KindGauge ? "gauge" : "counter") << "\n";
+            out << m.name << " ";
+            if (m.kind == KindGauge) {
+                out << m.gauge.value();
+            } else if (m.kind == KindSeconds) {
+                out << double(m.counter.value()) * 1e-9;
+            } else {
+                out << m.counter.value();
+            }
+            out << "\n";
+        }
+    }
+
+    std::map<std::string, StageTotals> stages;
+    {
+        std::lock_guard<std::mutex> lock(e.stages_mutex);
+        stages = e.stages;
+    }
+    if (stages.empty()) {
+        return;
+    }
+    out << "# HELP unwind_stage_seconds_total Time spent in the traced stages\n";
+    out << "# TYPE unwind_stage_seconds_total counter\n";
+    for (const std::pair<const std::string, StageTotals>& stage : stages) {
+        out << "unwind_stage_seconds_total{stage=\"";
+        write_escaped_label(out, stage.first);
+        out << "\"} " << double(stage.second.nanoseconds) * 1e-9 << "\n";
+    }
+    out << "# HELP unwind_stage_calls_total Number of times the traced stages ran\n";
+    out << "# TYPE unwind_stage_calls_total counter\n";
+    for (const std::pair<const std::string, StageTotals>& stage : stages) {
+        out << "unwind_stage_calls_total{stage=\"";
+        write_escaped_label(out, stage.first);
+        out << "\"} " << stage.second.calls << "\n";
+    }
+}
+
+void write_periodically() {
+    Exporter& e = exporter();
+    const std::chrono::duration<double> interval(e.interval_seconds);
+    std::unique_lock<std::mutex> lock(e.thread_mutex);
+    while (!e.stopping) {
+        if (e.stop_requested.wait_for(lock, interval, [&]() { return e.stopping; })) {
+            break;
+        }
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void stop_at_exit() {
+    Exporter& e = exporter();
+    {
+        std::lock_guard<std::mutex> lock(e.thread_mutex);
+        e.stopping = true;
+    }
+    e.stop_requested.notify_all();
+    if (e.thread.joinable()) {
+        e.thread.join();
+    }
+    flush();
+}
+
+} // namespace
+
+
+Counter& counter(const char* name, const char* help) {
+    return metric(name, help, KindCounter).counter;
+}
+
+Counter& seconds_counter(const char* name, const char* help) {
+    return metric(name, help, KindSeconds).counter;
+}
+
+Gauge& gauge(const char* name, const char* help) {
+    return metric(name, help, KindGauge).gauge;
+}
+
+bool init(std::shared_ptr<spdlog::logger> logger) {
+    Exporter& e = exporter();
+    const char* filename = std::getenv("FISH_METRICS");
+    if (filename == nullptr || filename[0] == '\0' || !e.filename.empty()) {
+        return !e.filename.empty();
+    }
+    const char* interval = std::getenv("FISH_METRICS_INTERVAL");
+    if (interval != nullptr && interval[0] != '\0') {
+        const double seconds = std::atof(interval);
+        if (seconds > 0.0) {
+            e.interval_seconds = seconds;
+        } else {
+            logger->warn("Ignoring FISH_METRICS_INTERVAL '{}', it is not a positive number of seconds", interval);
+        }
+    }
+    e.filename = filename;
+    e.logger = logger;
+    trace::set_observer(observe_stage);
+    e.thread = std::thread(write_periodically);
+    std::atexit(stop_at_exit);
+    logger->info("Writing metrics to '{}' every {} seconds", e.filename, e.interval_seconds);
+    return true;
+}
+
+bool flush() {
+    Exporter& e = exporter();
+    if (e.filename.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(e.write_mutex);
+    const std::string tmp_filename = e.filename + ".tmp";
+    {
+        std::ofstream out(tmp_filename);
+        if (!out) {
+            e.logger->error("Cannot write the metrics to '{}'", tmp_filename);
+            return false;
+        }
+        write_metrics(out);
+        if (!out) {
+            e.logger->error("Cannot write the metrics to '{}'", tmp_filename);
+            return false;
+        }
+    }
+    if (std::rename(tmp_filename.c_str(), e.filename.c_str()) != 0) {
+        e.logger->error("Cannot replace the metrics file '{}'", e.filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace metrics
@@ -0,0 +1,59 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Counters of the work a long running process has done, exported as a Prometheus text file, e.g. the voxels
+// ingested, the tets generated or the bytes exported. Rates such as the export throughput are left to the
+// collector, rate(unwind_export_bytes_total[1m]) in Prometheus.
+//
+// The counters always count, every add is a relaxed atomic add. Exporting is off unless the environment variable
+// FISH_METRICS names the file to write when metrics::init() runs, the file is then rewritten every
+// FISH_METRICS_INTERVAL seconds (default 10) and when the program exits. It is written next to itself and renamed
+// over the old one, so it can be read by the textfile collector of the node exporter at any time, which needs
+// the file name to end in .prom. While exporting, the time spent in every TRACE_SCOPE and BackgroundJob stage is
+// exported as well, as unwind_stage_seconds_total and unwind_stage_calls_total labelled by stage.
+namespace metrics {
+
+class Counter {
+public:
+    void add(std::uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    // For seconds counters, which count nanoseconds
+    void add_seconds(double seconds) { add(seconds > 0.0 ? std::uint64_t(seconds * 1e9) : 0); }
+    std::uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> _value{ 0 };
+};
+
+class Gauge {
+public:
+    void set(std::int64_t value) { _value.store(value, std::memory_order_relaxed); }
+    void add(std::int64_t n) { _value.fetch_add(n, std::memory_order_relaxed); }
+    std::int64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::int64_t> _value{ 0 };
+};
+
+// The metric called name, created on first use and kept until the program exits. Look them up once, e.g. into
+// a function local static reference, as the lookup takes a lock. name and help must be string literals.
+Counter& counter(const char* name, const char* help);
+// A counter of nanoseconds, exported in seconds
+Counter& seconds_counter(const char* name, const char* help);
+Gauge& gauge(const char* name, const char* help);
+
+// Start exporting if FISH_METRICS is set, returns whether it is
+bool init(std::shared_ptr<spdlog::logger> logger);
+
+// Write the metrics to the FISH_METRICS file now, returns false if it cannot be written
+bool flush();
+
+} // namespace metrics
+
+#endif // METRICS_H
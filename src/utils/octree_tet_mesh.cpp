@@ -0,0 +1,480 @@
+#include "octree_tet_mesh.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "parallel_for.h"
+
+
+double SampledDistanceField::operator()(const Eigen::Vector3d& p) const {
+    const Eigen::Vector3d g = (p - origin) / dx;
+    Eigen::Vector3i c;
+    Eigen::Vector3d t;
+    for (int a = 0; a < 3; a++) {
+        if (!(g[a] >= 0.0 && g[a] <= dims[a] - 1)) {
+            return std::numeric_limits<float>::max();
+        }
+        c[a] = std::min(int(g[a]), std::max(dims[a] - 2, 0));
+        t[a] = g[a] - c[a];
+    }
+    auto at = [&](int i, int j, int k) {
+        const int ci = std::min(c[0] + i, dims[0] - 1), cj = std::min(c[1] + j, dims[1] - 1);
+        const int ck = std::min(c[2] + k, dims[2] - 1);
+        if (!phi) {
+            return double((*sparse_phi)(ci, cj, ck));
+        }
+        return double(phi[size_t(ci) + size_t(dims[0]) * (size_t(cj) + size_t(dims[1]) * size_t(ck))]);
+    };
+    double value = 0.0;
+    for (int k = 0; k < 2; k++) {
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < 2; i++) {
+                const double w = (i ? t[0] : 1.0 - t[0]) * (j ? t[1] : 1.0 - t[1]) * (k ? t[2] : 1.0 - t[2]);
+                value += w * at(i, j, k);
+            }
+        }
+    }
+    return value;
+}
+
+
+namespace {
+
+struct OctreeNode {
+    // Minimum corner and edge length, in grid steps. The edge length is a power of two.
+    Eigen::Vector3i corner;
+    int size;
+    // Index of the first of the 8 children, -1 for leaves
+    int children;
+};
+
+class Octree {
+public:
+    explicit Octree(int root_size) : _root_size(root_size) {
+        _nodes.push_back({ Eigen::Vector3i::Zero(), root_size, -1 });
+    }
+
+    const OctreeNode& node(int n) const { return _nodes[n]; }
+    int num_nodes() const { return int(_nodes.size()); }
+
+    // Node of edge length size at corner, or the leaf containing that cube if the tree is coarser there.
+    // -1 if the cube is outside of the root.
+    int find(const Eigen::Vector3i& corner, int size) const {
+        if ((corner.array() < 0).any() || (corner.array() >= _root_size).any()) {
+            return -1;
+        }
+        int n = 0;
+        while (_nodes[n].size > size && _nodes[n].children >= 0) {
+            const int half = _nodes[n].size / 2;
+            const Eigen::Vector3i rel = corner - _nodes[n].corner;
+            n = _nodes[n].children + int(rel[0] >= half) + 2 * int(rel[1] >= half) + 4 * int(rel[2] >= half);
+        }
+        return n;
+    }
+
+    // True if there is a node of edge length size at corner and it has children
+    bool is_split(const Eigen::Vector3i& corner, int size) const {
+        const int n = find(corner, size);
+        return n >= 0 && _nodes[n].size == size && _nodes[n].children >= 0;
+    }
+
+    void split(int n) {
+        const Eigen::Vector3i corner = _nodes[n].corner;
+        const int half = _nodes[n].size / 2;
+        _nodes[n].children = int(_nodes.size());
+        for (int c = 0; c < 8; c++) {
+            _nodes.push_back({ corner + half * Eigen::Vector3i(c & 1, (c >> 1) & 1, (c >> 2) & 1), half, -1 });
+        }
+    }
+
+private:
+    std::vector<OctreeNode> _nodes;
+    int _root_size;
+};
+
+typedef std::array<int, 4> Tet;
+
+// Leaves per chunk of the parallel tetrahedralization, and vertices per chunk when finding the boundary
+constexpr std::size_t LEAVES_PER_CHUNK = 1 << 12;
+constexpr std::size_t VERTICES_PER_CHUNK = 1 << 14;
+
+// Points of the lattice of half grid steps, packed into 64 bit keys
+class Lattice {
+public:
+    explicit Lattice(int root_size) : _width(std::uint64_t(2 * root_size + 1)) {}
+
+    std::uint64_t key(const Eigen::Vector3i& p) const {
+        return std::uint64_t(p[0]) + _width * (std::uint64_t(p[1]) + _width * std::uint64_t(p[2]));
+    }
+
+    Eigen::Vector3i point(std::uint64_t key) const {
+        return Eigen::Vector3i(int(key % _width), int(key / _width % _width), int(key / (_width * _width)));
+    }
+
+private:
+    std::uint64_t _width;
+};
+
+typedef std::array<std::uint64_t, 4> LatticeTet;
+
+// Number the distinct keys in the order they first appear: ids[e] is the number of keys[e], and first[v] the
+// first entry numbered v. The keys are split between the shards of a hash, and each shard is numbered by a
+// single task that scans all the keys in order, so the numbers are the serial ones whatever the number of
+// threads. Returns the number of distinct keys.
+int number_keys(const std::vector<std::uint64_t>& keys, std::vector<int>& ids, std::vector<std::size_t>& first) {
+    const std::size_t n = keys.size();
+    std::vector<std::size_t> first_entry(n);
+    std::vector<int> num_firsts(n);
+    const std::size_t num_shards = parallel_num_threads();
+    parallel_tasks(num_shards, [&](std::size_t shard) {
+        std::unordered_map<std::uint64_t, std::size_t> entries;
+        for (std::size_t e = 0; e < n; e++) {
+            if ((keys[e] * 0x9E3779B97F4A7C15ull >> 32) % num_shards != shard) {
+                continue;
+            }
+            const auto it = entries.emplace(keys[e], e);
+            first_entry[e] = it.first->second;
+            num_firsts[e] = int(it.second);
+        }
+    });
+
+    // The number of a key is the number of first entries up to its first entry, minus one
+    parallel_prefix_sum(num_firsts);
+    const int num_ids = n > 0 ? num_firsts.back() : 0;
+    ids.resize(n);
+    first.resize(std::size_t(num_ids));
+    parallel_for_chunks(n, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t e = begin; e < end; e++) {
+            ids[e] = num_firsts[first_entry[e]] - 1;
+            if (first_entry[e] == e) {
+                first[std::size_t(ids[e])] = e;
+            }
+        }
+    });
+    return num_ids;
+}
+
+int64_t orientation(const Eigen::Vector3i& a, const Eigen::Vector3i& b, const Eigen::Vector3i& c,
+                    const Eigen::Vector3i& d) {
+    const Eigen::Matrix<int64_t, 3, 1> u = (a - d).cast<int64_t>(), v = (b - d).cast<int64_t>();
+    const Eigen::Matrix<int64_t, 3, 1> w = (c - d).cast<int64_t>();
+    return u.dot(v.cross(w));
+}
+
+double signed_volume(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+                     const Eigen::Vector3d& d) {
+    return -(a - d).dot((b - d).cross(c - d)) / 6.0;
+}
+
+// Distance in grid steps from the center of a cell of size grid steps beyond which it holds none of the surface
+double cell_radius(int size) {
+    return 0.5 * std::sqrt(3.0) * size + 1.0;
+}
+
+} // namespace
+
+
+double octree_band(int max_cell_size) {
+    // The inside cells of max_cell_size are kept when the distance exceeds their radius, one more step keeps the
+    // clamped distances strictly above it
+    return cell_radius(max_cell_size) + 1.0;
+}
+
+bool make_octree_tet_mesh(const SampledDistanceField& field, int max_cell_size,
+                          Eigen::MatrixXd& TV, Eigen::MatrixXi& TT) {
+    const int max_dim = std::max(field.dims.maxCoeff() - 1, 1);
+    int root_size = 1;
+    while (root_size < max_dim) {
+        root_size *= 2;
+    }
+
+    auto sample = [&](const Eigen::Vector3i& p) {
+        return field(field.origin + field.dx * p.cast<double>());
+    };
+
+    // Refine the cells that may hold some of the surface, and the inside cells larger than max_cell_size.
+    Octree octree(root_size);
+    std::vector<int> pending(1, 0);
+    while (!pending.empty()) {
+        const int n = pending.back();
+        pending.pop_back();
+        const OctreeNode node = octree.node(n);
+        if (node.size == 1) {
+            continue;
+        }
+        const double phi = sample(node.corner + Eigen::Vector3i::Constant(node.size / 2));
+        const double radius = cell_radius(node.size) * field.dx;
+        if (phi > radius || (phi < -radius && node.size <= max_cell_size)) {
+            continue;
+        }
+        octree.split(n);
+        for (int c = 0; c < 8; c++) {
+            pending.push_back(octree.node(n).children + c);
+        }
+    }
+
+    // Balance the tree so that leaves sharing a face, an edge or a corner are at most a factor two apart
+    for (int n = 0; n < octree.num_nodes(); n++) {
+        if (octree.node(n).children < 0) {
+            pending.push_back(n);
+        }
+    }
+    while (!pending.empty()) {
+        const int n = pending.back();
+        pending.pop_back();
+        if (octree.node(n).children >= 0) {
+            continue;
+        }
+        const Eigen::Vector3i corner = octree.node(n).corner;
+        const int size = octree.node(n).size;
+        for (int d = 0; d < 27; d++) {
+            const Eigen::Vector3i offset(d % 3 - 1, (d / 3) % 3 - 1, d / 9 - 1);
+            if (offset.isZero()) {
+                continue;
+            }
+            const Eigen::Vector3i neighbor = corner + size * offset;
+            for (int m = octree.find(neighbor, size);
+                 m >= 0 && octree.node(m).children < 0 && octree.node(m).size > 2 * size;
+                 m = octree.find(neighbor, size)) {
+                octree.split(m);
+                for (int c = 0; c < 8; c++) {
+                    pending.push_back(octree.node(m).children + c);
+                }
+            }
+        }
+    }
+
+    // Tetrahedralize the leaves on the lattice of half grid steps and keep the tets whose centroid is inside.
+    // Chunks of leaves are meshed in parallel and their tets concatenated in the order of the leaves.
+    std::vector<int> leaves;
+    for (int n = 0; n < octree.num_nodes(); n++) {
+        if (octree.node(n).children < 0) {
+            leaves.push_back(n);
+        }
+    }
+    const Lattice lattice(root_size);
+    auto position = [&](const Eigen::Vector3i& p) {
+        return Eigen::Vector3d(field.origin + 0.5 * field.dx * p.cast<double>());
+    };
+    std::vector<std::vector<LatticeTet>> chunk_tets(parallel_num_chunks(leaves.size(), LEAVES_PER_CHUNK));
+    parallel_for_chunks(leaves.size(), [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::vector<LatticeTet>& tets = chunk_tets[chunk];
+        auto add_tet = [&](const Eigen::Vector3i& a, const Eigen::Vector3i& b, const Eigen::Vector3i& c,
+                           const Eigen::Vector3i& d) {
+            const bool flip = orientation(a, b, c, d) >= 0;
+            const Eigen::Vector3i& second = flip ? c : b;
+            const Eigen::Vector3i& third = flip ? b : c;
+            const Eigen::Vector3d centroid = 0.25 * (position(a) + position(second) + position(third) + position(d));
+            if (field(centroid) < 0.0) {
+                tets.push_back({ lattice.key(a), lattice.key(second), lattice.key(third), lattice.key(d) });
+            }
+        };
+
+        std::vector<Eigen::Vector3i> loop;
+        for (std::size_t l = begin; l < end; l++) {
+            const OctreeNode node = octree.node(leaves[l]);
+            const int size = node.size;
+            const Eigen::Vector3i center = 2 * node.corner + Eigen::Vector3i::Constant(size);
+
+            for (int face = 0; face < 6; face++) {
+                const int a = face / 2, b = (a + 1) % 3, c = (a + 2) % 3;
+                const int side = face % 2;
+                Eigen::Vector3i normal = Eigen::Vector3i::Zero();
+                normal[a] = side ? 1 : -1;
+                const int m = octree.find(node.corner + size * normal, size);
+
+                // Corners of the face in order around it, in half grid steps
+                Eigen::Vector3i corners[4];
+                for (int i = 0; i < 4; i++) {
+                    corners[i] = 2 * node.corner;
+                    corners[i][a] += 2 * size * side;
+                    corners[i][b] += 2 * size * int(i == 1 || i == 2);
+                    corners[i][c] += 2 * size * int(i >= 2);
+                }
+
+                if (m >= 0 && octree.node(m).size == size && octree.node(m).children >= 0) {
+                    // Finer neighbor: each quarter of the face is fanned from its center, like the neighbor does
+                    const Eigen::Vector3i face_center = (corners[0] + corners[2]) / 2;
+                    for (int q = 0; q < 4; q++) {
+                        Eigen::Vector3i quarter[4];
+                        for (int i = 0; i < 4; i++) {
+                            quarter[i] = (corners[q] + corners[(q + i) % 4]) / 2;
+                        }
+                        quarter[2] = face_center;
+                        const Eigen::Vector3i quarter_center = (corners[q] + face_center) / 2;
+                        for (int i = 0; i < 4; i++) {
+                            add_tet(center, quarter_center, quarter[i], quarter[(i + 1) % 4]);
+                        }
+                    }
+                    continue;
+                }
+
+                // The face boundary, with the midpoints of the edges that finer cells split
+                loop.clear();
+                for (int i = 0; i < 4; i++) {
+                    loop.push_back(corners[i]);
+                    const Eigen::Vector3i& p = corners[i];
+                    const Eigen::Vector3i& q = corners[(i + 1) % 4];
+                    const Eigen::Vector3i mid = (p + q) / 2;
+                    // The edge is shared with the cells across the face and across the side of the face it is on
+                    const int e = p[b] == q[b] ? b : c;
+                    Eigen::Vector3i across = Eigen::Vector3i::Zero();
+                    across[e] = mid[e] == 2 * node.corner[e] ? -1 : 1;
+                    if (octree.is_split(node.corner + size * normal, size) ||
+                        octree.is_split(node.corner + size * across, size) ||
+                        octree.is_split(node.corner + size * (normal + across), size)) {
+                        loop.push_back(mid);
+                    }
+                }
+
+                if (m >= 0 && octree.node(m).size == size) {
+                    // Same sized neighbor: the octahedral cells of the lattice around the face, emitted once
+                    if (side == 1) {
+                        const Eigen::Vector3i neighbor_center = center + 2 * size * normal;
+                        for (size_t i = 0; i < loop.size(); i++) {
+                            add_tet(center, neighbor_center, loop[i], loop[(i + 1) % loop.size()]);
+                        }
+                    }
+                } else {
+                    // Coarser neighbor or outside of the tree: fan the face from its center
+                    const Eigen::Vector3i face_center = (corners[0] + corners[2]) / 2;
+                    for (size_t i = 0; i < loop.size(); i++) {
+                        add_tet(center, face_center, loop[i], loop[(i + 1) % loop.size()]);
+                    }
+                }
+            }
+        }
+    }, LEAVES_PER_CHUNK);
+    std::vector<int>().swap(leaves);
+
+    // Number the vertices in the order the kept tets use them
+    std::vector<std::uint64_t> keys;
+    for (std::vector<LatticeTet>& tets : chunk_tets) {
+        for (const LatticeTet& t : tets) {
+            keys.insert(keys.end(), t.begin(), t.end());
+        }
+        std::vector<LatticeTet>().swap(tets);
+    }
+    if (keys.empty()) {
+        TV.resize(0, 3);
+        TT.resize(0, 4);
+        return false;
+    }
+    std::vector<int> ids;
+    std::vector<std::size_t> first;
+    const int num_vertices = number_keys(keys, ids, first);
+    const std::size_t num_tets = keys.size() / 4;
+
+    TV.resize(num_vertices, 3);
+    TT.resize(Eigen::Index(num_tets), 4);
+    std::vector<Tet> kept(num_tets);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            TV.row(Eigen::Index(v)) = position(lattice.point(keys[first[v]])).transpose();
+        }
+    });
+    parallel_for_chunks(num_tets, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t t = begin; t < end; t++) {
+            kept[t] = { ids[4 * t], ids[4 * t + 1], ids[4 * t + 2], ids[4 * t + 3] };
+            TT.row(Eigen::Index(t)) << kept[t][0], kept[t][1], kept[t][2], kept[t][3];
+        }
+    });
+    std::vector<std::uint64_t>().swap(keys);
+    std::vector<int>().swap(ids);
+
+    // The tets around every vertex
+    std::vector<int> incident_offsets(num_vertices + 1, 0);
+    for (const Tet& t : kept) {
+        for (int v : t) {
+            incident_offsets[v + 1]++;
+        }
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        incident_offsets[v + 1] += incident_offsets[v];
+    }
+    std::vector<int> incident(incident_offsets.back());
+    std::vector<int> cursor(incident_offsets.begin(), incident_offsets.end() - 1);
+    for (size_t t = 0; t < kept.size(); t++) {
+        for (int v : kept[t]) {
+            incident[cursor[v]++] = int(t);
+        }
+    }
+
+    // Vertices on the boundary faces, which belong to a single tet. All the tets of a face are around each of
+    // its vertices, so every vertex only looks at its own faces.
+    std::vector<char> on_boundary(num_vertices, 0);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        std::vector<std::array<int, 3>> faces;
+        for (std::size_t v = begin; v < end; v++) {
+            faces.clear();
+            for (int i = incident_offsets[v]; i < incident_offsets[v + 1]; i++) {
+                const Tet& t = kept[incident[i]];
+                for (int f = 0; f < 4; f++) {
+                    if (t[f] == int(v)) {
+                        continue;
+                    }
+                    std::array<int, 3> face = { t[(f + 1) % 4], t[(f + 2) % 4], t[(f + 3) % 4] };
+                    std::sort(face.begin(), face.end());
+                    faces.push_back(face);
+                }
+            }
+            std::sort(faces.begin(), faces.end());
+            for (size_t f = 0; f < faces.size() && !on_boundary[v];) {
+                size_t g = f + 1;
+                while (g < faces.size() && faces[g] == faces[f]) {
+                    g++;
+                }
+                on_boundary[v] = g == f + 1;
+                f = g;
+            }
+        }
+    }, VERTICES_PER_CHUNK);
+
+    // Move the boundary vertices onto the zero level set along the gradient, by at most half a grid step.
+    // A move is undone if one of the tets around the vertex would lose most of its volume.
+    auto volume = [&](int t) {
+        return signed_volume(TV.row(TT(t, 0)), TV.row(TT(t, 1)), TV.row(TT(t, 2)), TV.row(TT(t, 3)));
+    };
+    const double h = 0.5 * field.dx;
+    std::vector<double> old_volumes;
+    for (int v = 0; v < num_vertices; v++) {
+        if (!on_boundary[v]) {
+            continue;
+        }
+        const Eigen::Vector3d p = TV.row(v).transpose();
+        const double phi = field(p);
+        Eigen::Vector3d gradient;
+        for (int a = 0; a < 3; a++) {
+            const Eigen::Vector3d step = h * Eigen::Vector3d::Unit(a);
+            gradient[a] = (field(p + step) - field(p - step)) / (2.0 * h);
+        }
+        if (!gradient.allFinite() || gradient.squaredNorm() < 1e-6 || std::abs(phi) > field.dx) {
+            continue;
+        }
+        Eigen::Vector3d move = -phi * gradient / gradient.squaredNorm();
+        if (move.norm() > h) {
+            move *= h / move.norm();
+        }
+
+        old_volumes.clear();
+        for (int i = incident_offsets[v]; i < incident_offsets[v + 1]; i++) {
+            old_volumes.push_back(volume(incident[i]));
+        }
+        TV.row(v) = (p + move).transpose();
+        for (int i = incident_offsets[v]; i < incident_offsets[v + 1]; i++) {
+            if (volume(incident[i]) < 0.1 * old_volumes[i - incident_offsets[v]]) {
+                TV.row(v) = p.transpose();
+                break;
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef OCTREE_TET_MESH_H
+#define OCTREE_TET_MESH_H
+
+#include <Eigen/Core>
+
+#include "sparse_grid.h"
+
+// Signed distance sampled on a regular grid, negative inside. Sample (i, j, k) is at origin + dx * (i, j, k)
+// and is stored in phi[i + dims[0] * (j + dims[1] * k)], or in sparse_phi(i, j, k) if phi is null. Points off the
+// grid count as outside.
+struct SampledDistanceField {
+    Eigen::Vector3d origin;
+    double dx = 1.0;
+    Eigen::Vector3i dims = Eigen::Vector3i::Zero();
+    const float* phi = nullptr;
+    const SparseGrid<float>* sparse_phi = nullptr;
+
+    // Trilinear interpolation of the samples
+    double operator()(const Eigen::Vector3d& p) const;
+};
+
+// Tetrahedralize the inside of a distance field on a graded octree of the sampling grid. Cells near the
+// surface are one grid step wide, cells further inside grow up to max_cell_size grid steps, with neighboring
+// cells at most a factor two apart. Same sized neighbors are joined by the tets of a body centered cubic
+// lattice and the level changes are closed by pyramids split into tets, so the mesh is conforming. Tets whose
+// centroid is inside are kept and the vertices on the boundary are then moved onto the zero level set when
+// that does not flatten their tets.
+//
+// Cells are refined where the distance at their center is below their radius, so a narrow band distance field
+// clamped to octree_band(max_cell_size) grid steps or more gives the same inside cells as the full one. Only the
+// outside cells further than the band from the surface may be split more finely, and their tets are dropped.
+//
+// The leaves are tetrahedralized in parallel chunks on the lattice of half grid steps, whose points are numbered
+// in the order the kept tets first use them, so the mesh is the same whatever the number of threads.
+//
+// TT is oriented like igl::volume expects. Returns false if no tet is inside.
+bool make_octree_tet_mesh(const SampledDistanceField& field, int max_cell_size,
+                          Eigen::MatrixXd& TV, Eigen::MatrixXi& TT);
+
+// Distance in grid steps the cells up to max_cell_size are tested at, see dexels_to_sparse_signed_distance
+double octree_band(int max_cell_size);
+
+#endif // OCTREE_TET_MESH_H
@@ -0,0 +1,81 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "task_scheduler.h"
+
+// Number of worker threads to use for data parallel loops, see set_task_threads()
+inline std::size_t parallel_num_threads() {
+    return static_cast<std::size_t>(task_threads());
+}
+
+// Number of chunks parallel_for_chunks will split n items into
+inline std::size_t parallel_num_chunks(std::size_t n, std::size_t min_chunk_size) {
+    const std::size_t max_chunks = (n + min_chunk_size - 1) / std::max<std::size_t>(min_chunk_size, 1);
+    return std::max<std::size_t>(1, std::min(parallel_num_threads(), max_chunks));
+}
+
+// Split [0, n) into contiguous chunks and call func(chunk_begin, chunk_end, chunk_index) for each of them
+// in parallel, on the calling thread and the workers of the task scheduler in the lane of the calling thread.
+// Chunks never get smaller than min_chunk_size so small inputs run serially on the calling thread.
+template <typename Func>
+void parallel_for_chunks(std::size_t n, Func func, std::size_t min_chunk_size = 1 << 16) {
+    if (n == 0) {
+        return;
+    }
+    const std::size_t num_chunks = parallel_num_chunks(n, min_chunk_size);
+    const std::size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    if (num_chunks == 1) {
+        func(0, n, 0);
+        return;
+    }
+
+    parallel_tasks(num_chunks, [&](std::size_t c) {
+        const std::size_t begin = c * chunk_size;
+        const std::size_t end = std::min(n, begin + chunk_size);
+        if (begin < end) {
+            func(begin, end, c);
+        }
+    });
+}
+
+// Inclusive prefix sum in place, values[i] becomes values[0] + ... + values[i]. Chunks of chunk_size values are
+// summed in parallel and then offset by the sum of the chunks before them. The chunks do not depend on the number
+// of threads, so floating point sums come out the same on every machine, and inputs of a single chunk are summed
+// in order like std::partial_sum.
+template <typename T>
+void parallel_prefix_sum(std::vector<T>& values, std::size_t chunk_size = 1 << 14) {
+    const std::size_t n = values.size();
+    chunk_size = std::max<std::size_t>(chunk_size, 1);
+    const std::size_t num_chunks = (n + chunk_size - 1) / chunk_size;
+    if (num_chunks <= 1) {
+        std::partial_sum(values.begin(), values.end(), values.begin());
+        return;
+    }
+
+    std::vector<T> chunk_sums(num_chunks);
+    auto chunk_range = [&](std::size_t c) {
+        return std::make_pair(values.begin() + std::ptrdiff_t(c * chunk_size),
+                              values.begin() + std::ptrdiff_t(std::min(n, (c + 1) * chunk_size)));
+    };
+    parallel_tasks(num_chunks, [&](std::size_t c) {
+        const auto range = chunk_range(c);
+        std::partial_sum(range.first, range.second, range.first);
+        chunk_sums[c] = *(range.second - 1);
+    });
+    std::partial_sum(chunk_sums.begin(), chunk_sums.end(), chunk_sums.begin());
+    parallel_tasks(num_chunks - 1, [&](std::size_t c) {
+        const auto range = chunk_range(c + 1);
+        const T offset = chunk_sums[c];
+        for (auto it = range.first; it != range.second; ++it) {
+            *it += offset;
+        }
+    });
+}
+
+#endif // PARALLEL_FOR_H
@@ -0,0 +1,221 @@
+#include "project_file.h"
+
+#include <fstream>
+
+
+namespace {
+
+const char PROJECT_MAGIC[8] = { 'F', 'I', 'S', 'H', 'P', 'R', 'O', '\0' };
+constexpr std::uint64_t PROJECT_ALIGNMENT = 16;
+
+std::uint64_t scalar_size(std::uint32_t type) {
+    switch (type) {
+    case PROJECT_SCALAR_BYTES:
+    case PROJECT_SCALAR_UINT8:
+        return 1;
+    case PROJECT_SCALAR_INT32:
+    case PROJECT_SCALAR_UINT32:
+    case PROJECT_SCALAR_FLOAT:
+        return 4;
+    case PROJECT_SCALAR_INT64:
+    case PROJECT_SCALAR_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+bool host_is_little_endian() {
+    const std::uint32_t one = 1;
+    std::uint8_t first_byte;
+    std::memcpy(&first_byte, &one, 1);
+    return first_byte == 1;
+}
+
+template <typename T>
+void write_pod(std::ofstream& of, const T& value) {
+    of.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Bounds checked reads out of the mapped file
+class ByteReader {
+public:
+    ByteReader(const std::uint8_t* data, std::uint64_t size, std::uint64_t offset) : _data(data), _size(size), _offset(offset) {}
+
+    template <typename T>
+    bool read(T& value) {
+        if (_offset + sizeof(T) > _size) {
+            return false;
+        }
+        std::memcpy(&value, _data + _offset, sizeof(T));
+        _offset += sizeof(T);
+        return true;
+    }
+
+    bool read(std::string& value, std::uint32_t length) {
+        if (_offset + length > _size) {
+            return false;
+        }
+        value.assign(reinterpret_cast<const char*>(_data + _offset), length);
+        _offset += length;
+        return true;
+    }
+
+private:
+    const std::uint8_t* _data;
+    std::uint64_t _size;
+    std::uint64_t _offset;
+};
+
+} // namespace
+
+
+void ProjectFileWriter::add_section(const std::string& name, std::uint32_t type, std::uint32_t flags,
+                                    std::uint64_t rows, std::uint64_t cols, const void* data, std::size_t size) {
+    _sections.push_back({ name, type, flags, rows, cols, data, size, nullptr });
+}
+
+bool ProjectFileWriter::write(const std::string& filename, std::shared_ptr<spdlog::logger> logger) const {
+    if (!host_is_little_endian()) {
+        logger->error("Project files can only be written on little endian machines");
+        return false;
+    }
+
+    std::ofstream of(filename, std::ofstream::binary);
+    if (!of.good()) {
+        logger->error("Failed to create project file '{}'", filename);
+        return false;
+    }
+
+    // Header, the section table offset gets patched in once all the data is written
+    of.write(PROJECT_MAGIC, sizeof(PROJECT_MAGIC));
+    write_pod(of, PROJECT_FILE_VERSION);
+    write_pod(of, std::uint32_t(_sections.size()));
+    write_pod(of, std::uint64_t(0));
+    std::uint64_t offset = sizeof(PROJECT_MAGIC) + 2 * sizeof(std::uint32_t) + sizeof(std::uint64_t);
+
+    const char padding[PROJECT_ALIGNMENT] = {};
+    std::vector<std::uint64_t> offsets;
+    offsets.reserve(_sections.size());
+    for (const Section& s : _sections) {
+        const std::uint64_t pad = (PROJECT_ALIGNMENT - offset % PROJECT_ALIGNMENT) % PROJECT_ALIGNMENT;
+        of.write(padding, std::streamsize(pad));
+        offset += pad;
+        offsets.push_back(offset);
+        of.write(reinterpret_cast<const char*>(s.data), std::streamsize(s.size));
+        offset += s.size;
+    }
+
+    const std::uint64_t table_offset = offset;
+    for (std::size_t i = 0; i < _sections.size(); i++) {
+        const Section& s = _sections[i];
+        write_pod(of, std::uint32_t(s.name.size()));
+        of.write(s.name.data(), std::streamsize(s.name.size()));
+        write_pod(of, s.type);
+        write_pod(of, s.flags);
+        write_pod(of, s.rows);
+        write_pod(of, s.cols);
+        write_pod(of, offsets[i]);
+        write_pod(of, std::uint64_t(s.size));
+    }
+
+    of.seekp(sizeof(PROJECT_MAGIC) + 2 * sizeof(std::uint32_t));
+    write_pod(of, table_offset);
+    if (!of.good()) {
+        logger->error("Failed to write project file '{}'", filename);
+        return false;
+    }
+    logger->debug("Wrote project file '{}' with {} sections ({} bytes)", filename, _sections.size(), table_offset);
+    return true;
+}
+
+
+bool ProjectFile::is_project_file(const std::string& filename) {
+    std::ifstream is(filename, std::ifstream::binary);
+    char magic[sizeof(PROJECT_MAGIC)] = {};
+    is.read(magic, sizeof(magic));
+    return is.good() && std::memcmp(magic, PROJECT_MAGIC, sizeof(magic)) == 0;
+}
+
+bool ProjectFile::open(const std::string& filename, std::shared_ptr<spdlog::logger> logger) {
+    close();
+    _logger = logger;
+    if (!host_is_little_endian()) {
+        logger->error("Project files can only be read on little endian machines");
+        return false;
+    }
+    if (!_file.open(filename, logger)) {
+        return false;
+    }
+
+    ByteReader header(_file.data(), _file.size(), 0);
+    std::string magic;
+    std::uint32_t num_sections = 0;
+    std::uint64_t table_offset = 0;
+    if (!header.read(magic, sizeof(PROJECT_MAGIC)) || std::memcmp(magic.data(), PROJECT_MAGIC, sizeof(PROJECT_MAGIC)) != 0 ||
+        !header.read(_version) || !header.read(num_sections) || !header.read(table_offset)) {
+        logger->error("'{}' is not a project file", filename);
+        close();
+        return false;
+    }
+    if (_version > PROJECT_FILE_VERSION) {
+        logger->error("Project file '{}' has version {} but only versions up to {} are supported", filename, _version, PROJECT_FILE_VERSION);
+        close();
+        return false;
+    }
+
+    ByteReader table(_file.data(), _file.size(), table_offset);
+    for (std::uint32_t i = 0; i < num_sections; i++) {
+        std::uint32_t name_length = 0;
+        std::string name;
+        Section s;
+        const bool ok = table.read(name_length) && table.read(name, name_length) &&
+                table.read(s.type) && table.read(s.flags) && table.read(s.rows) && table.read(s.cols) &&
+                table.read(s.offset) && table.read(s.size);
+        if (!ok || s.offset + s.size > _file.size() || s.size != s.rows * s.cols * scalar_size(s.type)) {
+            logger->error("Project file '{}' has a corrupt section table", filename);
+            close();
+            return false;
+        }
+        _sections[name] = s;
+    }
+
+    logger->debug("Opened project file '{}' (version {}, {} sections)", filename, _version, num_sections);
+    return true;
+}
+
+void ProjectFile::close() {
+    _file.close();
+    _sections.clear();
+    _version = 0;
+}
+
+const ProjectFile::Section* ProjectFile::find(const std::string& name, std::uint32_t type, bool row_major) const {
+    auto it = _sections.find(name);
+    if (it == _sections.end()) {
+        _logger->warn("Project file has no section '{}'", name);
+        return nullptr;
+    }
+    const Section& s = it->second;
+    if (s.type != type) {
+        _logger->error("Project section '{}' has scalar type {} but expected {}", name, s.type, type);
+        return nullptr;
+    }
+
+    // Storage order only matters for actual matrices
+    const bool is_vector = s.rows == 1 || s.cols == 1;
+    if (!is_vector && ((s.flags & PROJECT_SECTION_ROW_MAJOR) != 0) != row_major) {
+        _logger->error("Project section '{}' has the wrong storage order", name);
+        return nullptr;
+    }
+    return &s;
+}
+
+bool ProjectFile::read_string(const std::string& name, std::string& out) const {
+    const Section* s = find(name, PROJECT_SCALAR_BYTES, false);
+    if (s == nullptr) {
+        return false;
+    }
+    out.assign(reinterpret_cast<const char*>(_file.data() + s->offset), s->size);
+    return true;
+}
@@ -0,0 +1,227 @@
+#ifndef PROJECT_FILE_H
+#define PROJECT_FILE_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "raw_volume_view.h"
+
+// Binary container used for .fish.pro project files.
+//
+// Layout (little endian):
+//   char[8]  magic "FISHPRO\0"
+//   uint32   version
+//   uint32   number of sections
+//   uint64   offset of the section table
+//   section data, each blob starting on a 16 byte boundary
+//   section table, for each section:
+//     uint32   name length, followed by the name
+//     uint32   scalar type (ProjectScalarType)
+//     uint32   flags (PROJECT_SECTION_ROW_MAJOR)
+//     uint64   rows
+//     uint64   cols
+//     uint64   offset
+//     uint64   size in bytes
+//
+// Array sections hold the raw bytes of an Eigen matrix (or std::vector), so a reader can map
+// the file and wrap a section in an Eigen::Map without copying or parsing anything. Sections
+// which are not needed are simply never touched.
+
+static constexpr std::uint32_t PROJECT_FILE_VERSION = 1;
+
+enum ProjectScalarType : std::uint32_t {
+    PROJECT_SCALAR_BYTES = 0,
+    PROJECT_SCALAR_UINT8,
+    PROJECT_SCALAR_INT32,
+    PROJECT_SCALAR_UINT32,
+    PROJECT_SCALAR_INT64,
+    PROJECT_SCALAR_FLOAT,
+    PROJECT_SCALAR_DOUBLE,
+};
+
+enum ProjectSectionFlags : std::uint32_t {
+    PROJECT_SECTION_ROW_MAJOR = 1,
+};
+
+template <typename T> struct ProjectScalarTraits;
+template <> struct ProjectScalarTraits<char> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_BYTES; } };
+template <> struct ProjectScalarTraits<std::uint8_t> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_UINT8; } };
+template <> struct ProjectScalarTraits<std::int32_t> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_INT32; } };
+template <> struct ProjectScalarTraits<std::uint32_t> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_UINT32; } };
+template <> struct ProjectScalarTraits<std::int64_t> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_INT64; } };
+template <> struct ProjectScalarTraits<float> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_FLOAT; } };
+template <> struct ProjectScalarTraits<double> { static constexpr ProjectScalarType type() { return PROJECT_SCALAR_DOUBLE; } };
+
+
+class ProjectFileWriter {
+public:
+    // Array sections only reference the caller's data, which has to stay alive until write() returns
+    template <typename Derived>
+    void add_matrix(const std::string& name, const Eigen::PlainObjectBase<Derived>& m) {
+        typedef typename Derived::Scalar Scalar;
+        add_section(name, ProjectScalarTraits<Scalar>::type(), Derived::IsRowMajor ? PROJECT_SECTION_ROW_MAJOR : 0,
+                    std::uint64_t(m.rows()), std::uint64_t(m.cols()), m.data(), std::size_t(m.size()) * sizeof(Scalar));
+    }
+
+    template <typename T>
+    void add_vector(const std::string& name, const std::vector<T>& v) {
+        add_section(name, ProjectScalarTraits<T>::type(), 0, std::uint64_t(v.size()), 1, v.data(), v.size() * sizeof(T));
+    }
+
+    // Same as above but the writer keeps the array alive, for temporaries built just for the file.
+    // MatrixType should be dynamically sized since make_shared does not respect Eigen's alignment.
+    template <typename MatrixType>
+    void add_owned_matrix(const std::string& name, MatrixType m) {
+        std::shared_ptr<MatrixType> owned = std::make_shared<MatrixType>(std::move(m));
+        add_matrix(name, *owned);
+        _sections.back().owned = owned;
+    }
+    template <typename T>
+    void add_owned_vector(const std::string& name, std::vector<T> v) {
+        std::shared_ptr<std::vector<T>> owned = std::make_shared<std::vector<T>>(std::move(v));
+        add_vector(name, *owned);
+        _sections.back().owned = owned;
+    }
+
+    // Scalars and strings are copied
+    template <typename T>
+    void add_value(const std::string& name, const T& value) {
+        add_owned_vector(name, std::vector<T>(1, value));
+    }
+    void add_value(const std::string& name, bool value) {
+        add_value(name, std::uint8_t(value ? 1 : 0));
+    }
+    void add_string(const std::string& name, const std::string& value) {
+        add_owned_vector(name, std::vector<char>(value.begin(), value.end()));
+    }
+
+    bool write(const std::string& filename, std::shared_ptr<spdlog::logger> logger) const;
+
+private:
+    struct Section {
+        std::string name;
+        std::uint32_t type;
+        std::uint32_t flags;
+        std::uint64_t rows;
+        std::uint64_t cols;
+        const void* data;
+        std::size_t size;
+        std::shared_ptr<const void> owned;
+    };
+
+    void add_section(const std::string& name, std::uint32_t type, std::uint32_t flags,
+                     std::uint64_t rows, std::uint64_t cols, const void* data, std::size_t size);
+
+    std::vector<Section> _sections;
+};
+
+
+// Memory mapped reader for files written by ProjectFileWriter
+class ProjectFile {
+public:
+    // Returns true if filename starts with the project file magic, i.e. is not a legacy igl::serialize project
+    static bool is_project_file(const std::string& filename);
+
+    bool open(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+    void close();
+
+    std::uint32_t version() const { return _version; }
+    bool has_section(const std::string& name) const { return _sections.count(name) > 0; }
+
+    // Wrap an array section in an Eigen::Map without copying. The map is valid until the file is closed.
+    template <typename MatrixType>
+    bool map_matrix(const std::string& name, Eigen::Map<const MatrixType>& out) const {
+        typedef typename MatrixType::Scalar Scalar;
+        const Section* s = find_matrix<MatrixType>(name);
+        if (s == nullptr) {
+            return false;
+        }
+        // Eigen::Map cannot be reassigned, placement new is the documented way to rebind it
+        new (&out) Eigen::Map<const MatrixType>(reinterpret_cast<const Scalar*>(_file.data() + s->offset),
+                                                Eigen::Index(s->rows), Eigen::Index(s->cols));
+        return true;
+    }
+
+    template <typename Derived>
+    bool read_matrix(const std::string& name, Eigen::PlainObjectBase<Derived>& out) const {
+        const Section* s = find_matrix<Derived>(name);
+        if (s == nullptr) {
+            return false;
+        }
+        out.resize(Eigen::Index(s->rows), Eigen::Index(s->cols));
+        std::memcpy(out.data(), _file.data() + s->offset, s->size);
+        return true;
+    }
+
+    template <typename T>
+    bool read_vector(const std::string& name, std::vector<T>& out) const {
+        const Section* s = find(name, ProjectScalarTraits<T>::type(), false);
+        if (s == nullptr) {
+            return false;
+        }
+        const T* begin = reinterpret_cast<const T*>(_file.data() + s->offset);
+        out.assign(begin, begin + s->rows * s->cols);
+        return true;
+    }
+
+    template <typename T>
+    bool read_value(const std::string& name, T& out) const {
+        const Section* s = find(name, ProjectScalarTraits<T>::type(), false);
+        if (s == nullptr || s->size != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&out, _file.data() + s->offset, sizeof(T));
+        return true;
+    }
+    bool read_value(const std::string& name, bool& out) const {
+        std::uint8_t value = 0;
+        if (!read_value(name, value)) {
+            return false;
+        }
+        out = value != 0;
+        return true;
+    }
+    bool read_string(const std::string& name, std::string& out) const;
+
+private:
+    struct Section {
+        std::uint32_t type;
+        std::uint32_t flags;
+        std::uint64_t rows;
+        std::uint64_t cols;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    const Section* find(const std::string& name, std::uint32_t type, bool row_major) const;
+
+    // Find a section which can be stored in MatrixType: same scalar type, storage order and any fixed dimensions
+    template <typename MatrixType>
+    const Section* find_matrix(const std::string& name) const {
+        const Section* s = find(name, ProjectScalarTraits<typename MatrixType::Scalar>::type(), MatrixType::IsRowMajor);
+        if (s == nullptr) {
+            return nullptr;
+        }
+        if ((MatrixType::RowsAtCompileTime != Eigen::Dynamic && std::uint64_t(MatrixType::RowsAtCompileTime) != s->rows) ||
+            (MatrixType::ColsAtCompileTime != Eigen::Dynamic && std::uint64_t(MatrixType::ColsAtCompileTime) != s->cols)) {
+            _logger->error("Project section '{}' is {}x{} which does not match the expected size", name, s->rows, s->cols);
+            return nullptr;
+        }
+        return s;
+    }
+
+    std::shared_ptr<spdlog::logger> _logger;
+    RawVolumeView _file;
+    std::uint32_t _version = 0;
+    std::map<std::string, Section> _sections;
+};
+
+#endif // PROJECT_FILE_H
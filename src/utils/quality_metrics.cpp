@@ -0,0 +1,232 @@
+#include "quality_metrics.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include "fishvol.h"
+#include "raw_volume_view.h"
+#include "task_scheduler.h"
+
+namespace {
+
+// Tets per chunk of tet_mesh_quality, fixed so the sums come out the same on every machine
+constexpr std::size_t TETS_PER_CHUNK = 1 << 14;
+
+// SSIM windows and their spacing, in voxels, and the constants of Wang et al. for 8 bit values
+constexpr int SSIM_WINDOW = 8;
+constexpr int SSIM_STEP = 4;
+constexpr double SSIM_C1 = (0.01 * 255.0) * (0.01 * 255.0);
+constexpr double SSIM_C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+// Same orientation as signed_volume in octree_tet_mesh.cpp, positive for the tets the meshers make
+double signed_volume(const Eigen::RowVector3d& a, const Eigen::RowVector3d& b, const Eigen::RowVector3d& c,
+                     const Eigen::RowVector3d& d) {
+    return -(a - d).dot((b - d).cross(c - d)) / 6.0;
+}
+
+struct SliceComparison {
+    std::uint64_t squared_error = 0;
+    std::size_t num_differing = 0;
+    int max_difference = 0;
+    double ssim_sum = 0.0;
+    std::size_t num_windows = 0;
+};
+
+// Window starts along a dimension of n voxels, one window over the whole dimension if it is smaller than one
+int num_windows(int n) {
+    return n < SSIM_WINDOW ? 1 : (n - SSIM_WINDOW) / SSIM_STEP + 1;
+}
+
+SliceComparison compare_slice(const std::uint8_t* a, const std::uint8_t* b, int width, int height) {
+    SliceComparison result;
+    const std::size_t num_voxels = std::size_t(width) * std::size_t(height);
+    for (std::size_t i = 0; i < num_voxels; i++) {
+        const int difference = std::abs(int(a[i]) - int(b[i]));
+        result.squared_error += std::uint64_t(difference * difference);
+        result.num_differing += difference != 0;
+        result.max_difference = std::max(result.max_difference, difference);
+    }
+
+    const int window_w = std::min(width, SSIM_WINDOW), window_h = std::min(height, SSIM_WINDOW);
+    const double n = double(window_w * window_h);
+    for (int wy = 0; wy < num_windows(height); wy++) {
+        for (int wx = 0; wx < num_windows(width); wx++) {
+            // The sums of a window fit in 32 bits, 64 voxels of at most 255^2
+            std::uint32_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (int y = wy * SSIM_STEP; y < wy * SSIM_STEP + window_h; y++) {
+                const std::size_t row = std::size_t(y) * std::size_t(width);
+                for (int x = wx * SSIM_STEP; x < wx * SSIM_STEP + window_w; x++) {
+                    const std::uint32_t va = a[row + x], vb = b[row + x];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+            const double mean_a = sa / n, mean_b = sb / n;
+            const double var_a = saa / n - mean_a * mean_a, var_b = sbb / n - mean_b * mean_b;
+            const double cov = sab / n - mean_a * mean_b;
+            result.ssim_sum += ((2.0 * mean_a * mean_b + SSIM_C1) * (2.0 * cov + SSIM_C2)) /
+                               ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) * (var_a + var_b + SSIM_C2));
+            result.num_windows++;
+        }
+    }
+    return result;
+}
+
+// Slabs of a .raw or .fishvol volume, mapped or decompressed
+class SlabReader {
+public:
+    bool open(const std::string& filename, const Eigen::RowVector3i& dims, std::shared_ptr<spdlog::logger> logger) {
+        _dims = dims;
+        if (!is_fishvol_filename(filename)) {
+            return _raw.open(filename, dims, logger);
+        }
+        if (!_fishvol.open(filename, logger)) {
+            return false;
+        }
+        if (_fishvol.bytes_per_voxel() != 1 || _fishvol.dims() != dims) {
+            logger->error("'{}' is not an 8 bit volume of {} x {} x {}", filename, dims[0], dims[1], dims[2]);
+            return false;
+        }
+        return true;
+    }
+
+    // Slices [z_begin, z_end), valid until the next call
+    const std::uint8_t* slab(int z_begin, int z_end, std::shared_ptr<spdlog::logger> logger) {
+        const std::size_t slice_bytes = std::size_t(_dims[0]) * std::size_t(_dims[1]);
+        if (_raw.is_open()) {
+            return _raw.data() + std::size_t(z_begin) * slice_bytes;
+        }
+        _buffer.resize(std::size_t(z_end - z_begin) * slice_bytes);
+        const Eigen::RowVector3i begin(0, 0, z_begin), end(_dims[0], _dims[1], z_end);
+        return _fishvol.read_region(0, begin, end, _buffer.data(), logger) ? _buffer.data() : nullptr;
+    }
+
+private:
+    Eigen::RowVector3i _dims;
+    RawVolumeView _raw;
+    FishVolFile _fishvol;
+    std::vector<std::uint8_t> _buffer;
+};
+
+} // namespace
+
+
+double tet_mean_ratio(const Eigen::RowVector3d& a, const Eigen::RowVector3d& b, const Eigen::RowVector3d& c,
+                      const Eigen::RowVector3d& d) {
+    const Eigen::RowVector3d p[4] = { a, b, c, d };
+    double squared_edges = 0.0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i + 1; j < 4; j++) {
+            squared_edges += (p[i] - p[j]).squaredNorm();
+        }
+    }
+    if (squared_edges <= 0.0) {
+        return 0.0;
+    }
+    const double volume = signed_volume(a, b, c, d);
+    const double quality = 12.0 * std::cbrt(9.0 * volume * volume) / squared_edges;
+    return volume < 0.0 ? -quality : quality;
+}
+
+TetMeshQuality tet_mesh_quality(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT) {
+    const std::size_t num_tets = std::size_t(TT.rows());
+    const std::size_t num_chunks = (num_tets + TETS_PER_CHUNK - 1) / TETS_PER_CHUNK;
+    std::vector<TetMeshQuality> chunks(num_chunks);
+    std::vector<double> quality_sums(num_chunks, 0.0);
+    parallel_tasks(num_chunks, [&](std::size_t c) {
+        TetMeshQuality& chunk = chunks[c];
+        chunk.min_quality = std::numeric_limits<double>::infinity();
+        const std::size_t end = std::min(num_tets, (c + 1) * TETS_PER_CHUNK);
+        for (std::size_t t = c * TETS_PER_CHUNK; t < end; t++) {
+            const Eigen::RowVector3d p[4] = { TV.row(TT(t, 0)), TV.row(TT(t, 1)), TV.row(TT(t, 2)), TV.row(TT(t, 3)) };
+            const double volume = signed_volume(p[0], p[1], p[2], p[3]);
+            const double quality = tet_mean_ratio(p[0], p[1], p[2], p[3]);
+            chunk.num_tets++;
+            chunk.num_inverted += volume <= 0.0;
+            chunk.num_slivers += quality < SLIVER_QUALITY;
+            chunk.volume += std::abs(volume);
+            chunk.min_quality = std::min(chunk.min_quality, quality);
+            quality_sums[c] += quality;
+        }
+    });
+
+    TetMeshQuality result;
+    if (num_tets == 0) {
+        return result;
+    }
+    result.min_quality = std::numeric_limits<double>::infinity();
+    double quality_sum = 0.0;
+    for (std::size_t c = 0; c < num_chunks; c++) {
+        result.num_tets += chunks[c].num_tets;
+        result.num_inverted += chunks[c].num_inverted;
+        result.num_slivers += chunks[c].num_slivers;
+        result.volume += chunks[c].volume;
+        result.min_quality = std::min(result.min_quality, chunks[c].min_quality);
+        quality_sum += quality_sums[c];
+    }
+    result.mean_quality = quality_sum / double(num_tets);
+    return result;
+}
+
+void VolumeComparator::add_slices(const std::uint8_t* a, const std::uint8_t* b, int num_slices) {
+    const std::size_t slice_voxels = std::size_t(_width) * std::size_t(_height);
+    std::vector<SliceComparison> slices(std::size_t(std::max(num_slices, 0)));
+    parallel_tasks(slices.size(), [&](std::size_t z) {
+        slices[z] = compare_slice(a + z * slice_voxels, b + z * slice_voxels, _width, _height);
+    });
+    // Summed in order, so the result does not depend on the number of threads
+    for (const SliceComparison& slice : slices) {
+        _squared_error += double(slice.squared_error);
+        _num_differing += slice.num_differing;
+        _max_difference = std::max(_max_difference, slice.max_difference);
+        _ssim_sum += slice.ssim_sum;
+        _num_windows += slice.num_windows;
+    }
+    _num_voxels += slices.size() * slice_voxels;
+}
+
+VolumeComparison VolumeComparator::result() const {
+    VolumeComparison result;
+    result.num_voxels = _num_voxels;
+    result.num_differing = _num_differing;
+    result.max_difference = _max_difference;
+    if (_num_voxels == 0) {
+        result.psnr = std::numeric_limits<double>::infinity();
+        return result;
+    }
+    result.mse = _squared_error / double(_num_voxels);
+    result.psnr = result.mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / result.mse) :
+                                     std::numeric_limits<double>::infinity();
+    result.ssim = _num_windows > 0 ? _ssim_sum / double(_num_windows) : 1.0;
+    return result;
+}
+
+bool compare_volume_files(const std::string& filename_a, const std::string& filename_b,
+                          const Eigen::RowVector3i& dims, VolumeComparison& comparison,
+                          std::shared_ptr<spdlog::logger> logger, int slices_per_slab) {
+    SlabReader a, b;
+    if (!a.open(filename_a, dims, logger) || !b.open(filename_b, dims, logger)) {
+        return false;
+    }
+    VolumeComparator comparator(dims[0], dims[1]);
+    slices_per_slab = std::max(slices_per_slab, 1);
+    for (int z = 0; z < dims[2]; z += slices_per_slab) {
+        const int z_end = std::min(dims[2], z + slices_per_slab);
+        const std::uint8_t* slab_a = a.slab(z, z_end, logger);
+        const std::uint8_t* slab_b = b.slab(z, z_end, logger);
+        if (!slab_a || !slab_b) {
+            return false;
+        }
+        comparator.add_slices(slab_a, slab_b, z_end - z);
+    }
+    comparison = comparator.result();
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef QUALITY_METRICS_H
+#define QUALITY_METRICS_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Quality checks of the outputs of the pipeline, to validate the reduced precision and adaptive modes against the
+// exact ones: statistics of tet meshes and comparisons of straightened volumes. They run in parallel and stream the
+// volumes, so they are cheap enough to run after every batch export. The distances between dexel volumes are
+// computed by vor3d::compareVolumes, see vor3d/Quality.h.
+
+struct TetMeshQuality {
+    std::size_t num_tets = 0;
+    // Tets of negative or zero volume
+    std::size_t num_inverted = 0;
+    // Tets of mean ratio below SLIVER_QUALITY, inverted ones included
+    std::size_t num_slivers = 0;
+    // Sum of the absolute volumes of the tets
+    double volume = 0.0;
+    // Mean ratio of the tets, 1 for a regular tet and 0 for a flat one, negative for inverted tets
+    double min_quality = 0.0;
+    double mean_quality = 0.0;
+};
+
+constexpr double SLIVER_QUALITY = 0.1;
+
+// Mean ratio of the tet abcd, 12 (3 |V|)^(2/3) over the sum of its squared edge lengths, with the sign of its
+// volume. Positive for the orientation of the meshers, also see tet_mesh_quality.
+double tet_mean_ratio(const Eigen::RowVector3d& a, const Eigen::RowVector3d& b, const Eigen::RowVector3d& c,
+                      const Eigen::RowVector3d& d);
+
+// Volume and shape statistics of the tets TT of the vertices TV. The sums are taken over fixed chunks of tets, so
+// they do not depend on the number of threads.
+TetMeshQuality tet_mesh_quality(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT);
+
+struct VolumeComparison {
+    std::size_t num_voxels = 0;
+    std::size_t num_differing = 0;
+    int max_difference = 0;
+    double mse = 0.0;
+    // Peak signal to noise ratio in dB for 8 bit voxels, infinite for identical volumes
+    double psnr = 0.0;
+    // Mean structural similarity of the 8 x 8 windows of the slices, spaced by 4 voxels, 1 for identical volumes
+    double ssim = 1.0;
+};
+
+// Compares two 8 bit volumes of the same dimensions a slab of whole slices at a time, so volumes larger than memory
+// are compared while they are read. SSIM is computed within the slices, which keeps the slabs independent.
+class VolumeComparator {
+public:
+    VolumeComparator(int width, int height) : _width(width), _height(height) {}
+
+    // Add num_slices slices of width x height voxels of each volume, x fastest
+    void add_slices(const std::uint8_t* a, const std::uint8_t* b, int num_slices);
+
+    VolumeComparison result() const;
+
+private:
+    int _width, _height;
+    std::size_t _num_voxels = 0;
+    std::size_t _num_differing = 0;
+    int _max_difference = 0;
+    double _squared_error = 0.0;
+    double _ssim_sum = 0.0;
+    std::size_t _num_windows = 0;
+};
+
+// Compare the .raw or .fishvol volumes of dims in filename_a and filename_b, reading slabs of slices_per_slab
+// slices. Returns false if one of them cannot be read.
+bool compare_volume_files(const std::string& filename_a, const std::string& filename_b,
+                          const Eigen::RowVector3i& dims, VolumeComparison& comparison,
+                          std::shared_ptr<spdlog::logger> logger, int slices_per_slab = 16);
+
+#endif // QUALITY_METRICS_H
@@ -0,0 +1,176 @@
+#include "raw_volume_view.h"
+
+#include <utility>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+RawVolumeView::~RawVolumeView() {
+    close();
+}
+
+RawVolumeView::RawVolumeView(RawVolumeView&& other) {
+    *this = std::move(other);
+}
+
+RawVolumeView& RawVolumeView::operator=(RawVolumeView&& other) {
+    if (this == &other) {
+        return *this;
+    }
+    close();
+
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_mapped_size, other._mapped_size);
+#ifdef WIN32
+    std::swap(_file_handle, other._file_handle);
+    std::swap(_mapping_handle, other._mapping_handle);
+#else
+    std::swap(_fd, other._fd);
+#endif
+    return *this;
+}
+
+bool RawVolumeView::open(const std::string& rawfilename, const Eigen::RowVector3i& dims,
+                         std::shared_ptr<spdlog::logger> logger, std::size_t bytes_per_voxel) {
+    const std::size_t num_bytes = (std::size_t)(dims[0]) * (std::size_t)(dims[1]) * (std::size_t)(dims[2]) * bytes_per_voxel;
+    return map_file(rawfilename, num_bytes, logger);
+}
+
+bool RawVolumeView::open(const std::string& filename, std::shared_ptr<spdlog::logger> logger) {
+    return map_file(filename, WHOLE_FILE, logger);
+}
+
+#ifdef WIN32
+
+bool RawVolumeView::map_file(const std::string& rawfilename, std::size_t num_bytes, std::shared_ptr<spdlog::logger> logger) {
+    close();
+
+    HANDLE file = CreateFileA(rawfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        logger->error("RawFile '{}' does not exist.", rawfilename);
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    const bool have_size = GetFileSizeEx(file, &file_size) != 0;
+    if (have_size && num_bytes == WHOLE_FILE) {
+        num_bytes = (std::size_t)(file_size.QuadPart);
+    }
+    if (!have_size || (std::size_t)(file_size.QuadPart) < num_bytes || num_bytes == 0) {
+        logger->error("RawFile '{}' has {} bytes, but expected to read {} bytes.", rawfilename, (std::size_t)(file_size.QuadPart), num_bytes);
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        logger->error("Failed to create a file mapping for RawFile '{}' (error {}).", rawfilename, GetLastError());
+        CloseHandle(file);
+        return false;
+    }
+
+    void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (ptr == nullptr) {
+        logger->error("Failed to map RawFile '{}' (error {}).", rawfilename, GetLastError());
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    _file_handle = file;
+    _mapping_handle = mapping;
+    _data = static_cast<const std::uint8_t*>(ptr);
+    _size = num_bytes;
+    _mapped_size = (std::size_t)(file_size.QuadPart);
+    logger->trace("Mapped {} bytes of RawFile '{}'", _size, rawfilename);
+    return true;
+}
+
+void RawVolumeView::close() {
+    if (_data != nullptr) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping_handle != nullptr) {
+        CloseHandle(_mapping_handle);
+    }
+    if (_file_handle != nullptr) {
+        CloseHandle(_file_handle);
+    }
+    _data = nullptr;
+    _size = 0;
+    _mapped_size = 0;
+    _file_handle = nullptr;
+    _mapping_handle = nullptr;
+}
+
+#else
+
+bool RawVolumeView::map_file(const std::string& rawfilename, std::size_t num_bytes, std::shared_ptr<spdlog::logger> logger) {
+    close();
+
+    int fd = ::open(rawfilename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        logger->error("RawFile '{}' does not exist.", rawfilename);
+        return false;
+    }
+
+    struct stat file_info;
+    const bool have_size = fstat(fd, &file_info) == 0;
+    if (have_size && num_bytes == WHOLE_FILE) {
+        num_bytes = (std::size_t)(file_info.st_size);
+    }
+    if (!have_size || (std::size_t)(file_info.st_size) < num_bytes) {
+        logger->error("RawFile '{}' has {} bytes, but expected to read {} bytes.", rawfilename, (std::size_t)(file_info.st_size), num_bytes);
+        ::close(fd);
+        return false;
+    }
+
+    if (num_bytes == 0) {
+        logger->error("RawFile '{}' has zero size dimensions.", rawfilename);
+        ::close(fd);
+        return false;
+    }
+
+    const std::size_t mapped_size = (std::size_t)(file_info.st_size);
+    void* ptr = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        logger->error("Failed to map RawFile '{}'.", rawfilename);
+        ::close(fd);
+        return false;
+    }
+
+    // We stream through the file once when uploading it so tell the kernel to read ahead aggressively
+    madvise(ptr, mapped_size, MADV_SEQUENTIAL);
+
+    _fd = fd;
+    _data = static_cast<const std::uint8_t*>(ptr);
+    _size = num_bytes;
+    _mapped_size = mapped_size;
+    logger->trace("Mapped {} bytes of RawFile '{}'", _size, rawfilename);
+    return true;
+}
+
+void RawVolumeView::close() {
+    if (_data != nullptr) {
+        munmap(const_cast<std::uint8_t*>(_data), _mapped_size);
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _data = nullptr;
+    _size = 0;
+    _mapped_size = 0;
+    _fd = -1;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef RAW_VOLUME_VIEW_H
+#define RAW_VOLUME_VIEW_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a .raw volume file. The bytes are paged in by the OS on demand
+// so large scans can be handed directly to OpenGL without being copied into process-owned buffers.
+// The view is move-only and unmaps the file when it is destroyed or closed.
+class RawVolumeView {
+public:
+    RawVolumeView() = default;
+    ~RawVolumeView();
+
+    RawVolumeView(const RawVolumeView&) = delete;
+    RawVolumeView& operator=(const RawVolumeView&) = delete;
+    RawVolumeView(RawVolumeView&& other);
+    RawVolumeView& operator=(RawVolumeView&& other);
+
+    // Map the file rawfilename, which must contain at least dims[0]*dims[1]*dims[2]*bytes_per_voxel bytes
+    bool open(const std::string& rawfilename, const Eigen::RowVector3i& dims,
+              std::shared_ptr<spdlog::logger> logger, std::size_t bytes_per_voxel = 1);
+
+    // Map the whole file filename
+    bool open(const std::string& filename, std::shared_ptr<spdlog::logger> logger);
+    void close();
+
+    bool is_open() const { return _data != nullptr; }
+    const std::uint8_t* data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+private:
+    // Map the first num_bytes bytes of the file, or the whole file if num_bytes is WHOLE_FILE
+    static constexpr std::size_t WHOLE_FILE = ~std::size_t(0);
+    bool map_file(const std::string& filename, std::size_t num_bytes, std::shared_ptr<spdlog::logger> logger);
+
+    const std::uint8_t* _data = nullptr;
+    std::size_t _size = 0;
+
+    // Size of the actual mapping (the whole file) which can be larger than _size
+    std::size_t _mapped_size = 0;
+
+#ifdef WIN32
+    void* _file_handle = nullptr;
+    void* _mapping_handle = nullptr;
+#else
+    int _fd = -1;
+#endif
+};
+
+#endif // RAW_VOLUME_VIEW_H
@@ -0,0 +1,107 @@
+#include "redraw_scheduler.h"
+
+#include <algorithm>
+
+
+void RedrawScheduler::set_wake(std::function<void()> wake) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake = std::move(wake);
+}
+
+void RedrawScheduler::set_max_fps(double max_fps) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _min_frame_seconds = max_fps > 0.0 ? 1.0 / max_fps : 0.0;
+}
+
+void RedrawScheduler::set_min_interval(Subsystem subsystem, double seconds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _min_interval[subsystem] = std::max(seconds, 0.0);
+}
+
+std::chrono::steady_clock::duration RedrawScheduler::interval(Subsystem subsystem) const {
+    const double seconds = std::max(_min_interval[subsystem], _min_frame_seconds);
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+void RedrawScheduler::request(Subsystem subsystem) {
+    std::function<void()> wake;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending[subsystem] || _stop) {
+            // The frame is already on its way
+            return;
+        }
+        _pending[subsystem] = true;
+
+        const Clock::time_point due = _last_drawn[subsystem] + interval(subsystem);
+        if (due > Clock::now()) {
+            wake_at(due);
+            return;
+        }
+        wake = _wake;
+    }
+    if (wake) {
+        wake();
+    }
+}
+
+void RedrawScheduler::begin_frame() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Clock::time_point now = Clock::now();
+    for (int i = 0; i < NumSubsystems; i++) {
+        // Requests which are not due yet wait for their timer, even if this frame was drawn for another reason
+        const Subsystem subsystem = Subsystem(i);
+        _frame_dirty[i] = _pending[i] && _last_drawn[i] + interval(subsystem) <= now;
+        if (_frame_dirty[i]) {
+            _pending[i] = false;
+            _last_drawn[i] = now;
+        }
+    }
+}
+
+void RedrawScheduler::wake_at(Clock::time_point time) {
+    // Called with the mutex held
+    if (!_timer.joinable()) {
+        _timer = std::thread(&RedrawScheduler::timer_loop, this);
+    }
+    if (time < _wake_time) {
+        _wake_time = time;
+        _timer_cv.notify_one();
+    }
+}
+
+void RedrawScheduler::timer_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+        if (_wake_time == Clock::time_point::max()) {
+            _timer_cv.wait(lock);
+            continue;
+        }
+        if (_timer_cv.wait_until(lock, _wake_time) == std::cv_status::no_timeout) {
+            // Woken up for an earlier time or to stop
+            continue;
+        }
+        if (Clock::now() < _wake_time) {
+            continue;
+        }
+
+        _wake_time = Clock::time_point::max();
+        std::function<void()> wake = _wake;
+        lock.unlock();
+        if (wake) {
+            wake();
+        }
+        lock.lock();
+    }
+}
+
+void RedrawScheduler::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _timer_cv.notify_one();
+    }
+    if (_timer.joinable()) {
+        _timer.join();
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef REDRAW_SCHEDULER_H
+#define REDRAW_SCHEDULER_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Decides when the viewer draws a frame. The viewer sleeps until an input event arrives or a subsystem asks for
+// a frame with request(), so an idle window draws nothing. request() can be called from any thread: it wakes the
+// render thread right away, or from a timer thread once the minimum interval of the subsystem has passed since
+// it was last drawn, so progressive or expensive views can ask for a frame every time they change without
+// drawing faster than they need.
+//
+// The render thread calls begin_frame() at the start of every frame, which also counts the frames drawn for
+// input events, and can then check which subsystems asked for the frame with is_dirty().
+class RedrawScheduler {
+public:
+    enum Subsystem {
+        VolumeView = 0,
+        Widget2d,
+        Widget3d,
+        ImGui,
+        BackgroundJobs,
+        NumSubsystems
+    };
+
+    RedrawScheduler() = default;
+    RedrawScheduler(const RedrawScheduler&) = delete;
+    RedrawScheduler& operator=(const RedrawScheduler&) = delete;
+
+    ~RedrawScheduler() { shutdown(); }
+
+    // Called from any thread to wake up the render thread, usually glfwPostEmptyEvent. Nothing is woken up
+    // until it is set.
+    void set_wake(std::function<void()> wake);
+
+    // No subsystem is drawn more often than max_fps, typically the refresh rate of the monitor
+    void set_max_fps(double max_fps);
+    // Minimum time between two frames drawn on behalf of subsystem
+    void set_min_interval(Subsystem subsystem, double seconds);
+
+    // Ask for a frame on behalf of subsystem. Thread safe.
+    void request(Subsystem subsystem);
+
+    // Called by the render thread at the start of every frame
+    void begin_frame();
+
+    // Whether subsystem asked for the current frame
+    bool is_dirty(Subsystem subsystem) const { return _frame_dirty[subsystem]; }
+
+    // Stop the timer thread. Call before the wake function becomes invalid (e.g. before glfwTerminate).
+    void shutdown();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::chrono::steady_clock::duration interval(Subsystem subsystem) const;
+    void wake_at(Clock::time_point time);
+    void timer_loop();
+
+    mutable std::mutex _mutex;
+    std::condition_variable _timer_cv;
+    std::thread _timer;
+    bool _stop = false;
+
+    std::function<void()> _wake;
+    double _min_frame_seconds = 0.0;
+    std::array<double, NumSubsystems> _min_interval = {};
+
+    // Requests not drawn yet and the last time each subsystem was drawn. Guarded by _mutex.
+    std::array<bool, NumSubsystems> _pending = {};
+    std::array<Clock::time_point, NumSubsystems> _last_drawn = {};
+    // Earliest time the timer thread has to wake up the render thread, max() when it has nothing to do
+    Clock::time_point _wake_time = Clock::time_point::max();
+
+    // Only touched by the render thread
+    std::array<bool, NumSubsystems> _frame_dirty = {};
+};
+
+#endif // REDRAW_SCHEDULER_H
@@ -0,0 +1,32 @@
+#ifndef RESULT_HANDOFF_H
+#define RESULT_HANDOFF_H
+
+#include <memory>
+#include <utility>
+
+// Hands the result of a background job over to the render thread. The job builds its result in storage only it
+// can reach and publishes it once it is complete, the render thread takes it after BackgroundJob::poll()
+// reported success. Both swap a shared_ptr atomically, so the render thread either gets no result or a whole one,
+// never one the job is still writing.
+//
+// Create a new handoff for every job started and capture it in the work function: a cancelled job that is still
+// winding down then publishes into its own handoff, which nobody looks at anymore, and never over the result of
+// the job that replaced it.
+template <typename T>
+class ResultHandoff {
+public:
+    // Called by the job thread once the result is complete. The job must not touch it afterwards.
+    void publish(std::shared_ptr<T> result) {
+        std::atomic_store(&_result, std::move(result));
+    }
+
+    // The published result, or nullptr if there is none. The result is handed over a single time.
+    std::shared_ptr<T> take() {
+        return std::atomic_exchange(&_result, std::shared_ptr<T>());
+    }
+
+private:
+    std::shared_ptr<T> _result;
+};
+
+#endif // RESULT_HANDOFF_H
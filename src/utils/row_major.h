@@ -0,0 +1,38 @@
+#ifndef ROW_MAJOR_H
+#define ROW_MAJOR_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+// Geometry arrays laid out one point or one element after the other, like the meshes of Quartet and the vertex
+// and index buffers of GL. The meshes of the state stay column major for libigl and the solvers, converting to
+// or from these is a single assignment instead of a loop over rows.
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> RowMatrixX3d;
+typedef Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> RowMatrixX3f;
+typedef Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> RowMatrixX3i;
+typedef Eigen::Matrix<int, Eigen::Dynamic, 4, Eigen::RowMajor> RowMatrixX4i;
+
+// View of an array of fixed size vectors, such as the std::vector<Vec3f> of Quartet, as the rows of a matrix.
+// The vectors must hold Cols scalars and nothing else.
+template<typename Scalar, int Cols, typename Vector>
+Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Cols, Eigen::RowMajor>> map_rows(const std::vector<Vector>& v) {
+    static_assert(sizeof(Vector) == Cols * sizeof(Scalar), "The vectors are not packed arrays of Cols scalars");
+    return Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Cols, Eigen::RowMajor>>(
+        reinterpret_cast<const Scalar*>(v.data()), Eigen::Index(v.size()), Cols);
+}
+
+// TV and TT of a Quartet TetMesh, which orients its tets the other way, so the middle two vertices of each tet are
+// swapped. Each column of TV and TT is written in one pass.
+template<typename TetMesh>
+void quartet_to_eigen(const TetMesh& mesh, Eigen::MatrixXd& TV, Eigen::MatrixXi& TT) {
+    TV = map_rows<float, 3>(mesh.verts()).template cast<double>();
+    const Eigen::Map<const RowMatrixX4i> tets = map_rows<int, 4>(mesh.tets());
+    TT.resize(tets.rows(), 4);
+    TT.col(0) = tets.col(0);
+    TT.col(1) = tets.col(2);
+    TT.col(2) = tets.col(1);
+    TT.col(3) = tets.col(3);
+}
+
+#endif // ROW_MAJOR_H
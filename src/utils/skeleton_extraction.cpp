@@ -0,0 +1,253 @@
+#include "skeleton_extraction.h"
+
+#include "parallel_for.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <numeric>
+#include <Eigen/Geometry>
+
+
+void level_set_centroids(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXd& f,
+                         const std::vector<double>& isovalues,
+                         Eigen::MatrixXd& centroids, Eigen::VectorXd& areas) {
+    level_set_centroids(TV, TT, nullptr, nullptr, f, isovalues, centroids, areas);
+}
+
+void level_set_centroids(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                         const int* tets_begin, const int* tets_end, const Eigen::VectorXd& f,
+                         const std::vector<double>& isovalues,
+                         Eigen::MatrixXd& centroids, Eigen::VectorXd& areas) {
+    const int num_levels = static_cast<int>(isovalues.size());
+
+    // Sorted levels, so each tet finds the levels between its smallest and largest value by binary search
+    std::vector<int> order(num_levels);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return isovalues[a] < isovalues[b]; });
+    std::vector<double> sorted(num_levels);
+    for (int l = 0; l < num_levels; l++) {
+        sorted[l] = isovalues[order[l]];
+    }
+
+    // Each chunk of tets sums area * centroid and the area of every level, the chunks are added up after
+    const size_t min_tets_per_chunk = 1 << 12;
+    // All the rows of TT without a tet list
+    const size_t num_tets = tets_begin ? static_cast<size_t>(tets_end - tets_begin) : static_cast<size_t>(TT.rows());
+    std::vector<Eigen::MatrixXd> sums(parallel_num_chunks(num_tets, min_tets_per_chunk),
+                                      Eigen::MatrixXd::Zero(num_levels, 4));
+    parallel_for_chunks(num_tets, [&](size_t begin, size_t end, size_t chunk) {
+        Eigen::MatrixXd& sum = sums[chunk];
+        for (size_t i = begin; i < end; i++) {
+            const size_t t = tets_begin ? static_cast<size_t>(tets_begin[i]) : i;
+            int v[4];
+            double fv[4];
+            for (int k = 0; k < 4; k++) {
+                v[k] = TT(t, k);
+                fv[k] = f[v[k]];
+            }
+            const double f_min = std::min(std::min(fv[0], fv[1]), std::min(fv[2], fv[3]));
+            const double f_max = std::max(std::max(fv[0], fv[1]), std::max(fv[2], fv[3]));
+            // Levels with f_min <= isovalue < f_max have a vertex on each side
+            const int first = int(std::lower_bound(sorted.begin(), sorted.end(), f_min) - sorted.begin());
+            const int last = int(std::lower_bound(sorted.begin(), sorted.end(), f_max) - sorted.begin());
+
+            for (int l = first; l < last; l++) {
+                const double iso = sorted[l];
+                int above[4], below[4];
+                int num_above = 0, num_below = 0;
+                for (int k = 0; k < 4; k++) {
+                    if (fv[k] > iso) {
+                        above[num_above++] = k;
+                    } else {
+                        below[num_below++] = k;
+                    }
+                }
+                auto cut = [&](int a, int b) -> Eigen::RowVector3d {
+                    const double s = (iso - fv[b]) / (fv[a] - fv[b]);
+                    return TV.row(v[b]) + s * (TV.row(v[a]) - TV.row(v[b]));
+                };
+
+                // One vertex apart gives a triangle, two on each side a quad ordered around its boundary
+                Eigen::RowVector3d p[4];
+                int num_points = 3;
+                if (num_above == 1) {
+                    for (int k = 0; k < 3; k++) { p[k] = cut(above[0], below[k]); }
+                } else if (num_below == 1) {
+                    for (int k = 0; k < 3; k++) { p[k] = cut(above[k], below[0]); }
+                } else {
+                    p[0] = cut(above[0], below[0]);
+                    p[1] = cut(above[0], below[1]);
+                    p[2] = cut(above[1], below[1]);
+                    p[3] = cut(above[1], below[0]);
+                    num_points = 4;
+                }
+                for (int k = 1; k + 1 < num_points; k++) {
+                    const double area = 0.5 * (p[k] - p[0]).cross(p[k + 1] - p[0]).norm();
+                    sum.block<1, 3>(l, 0) += area * (p[0] + p[k] + p[k + 1]) / 3.0;
+                    sum(l, 3) += area;
+                }
+            }
+        }
+    }, min_tets_per_chunk);
+
+    centroids = Eigen::MatrixXd::Zero(num_levels, 3);
+    areas = Eigen::VectorXd::Zero(num_levels);
+    for (int l = 0; l < num_levels; l++) {
+        Eigen::RowVector3d c = Eigen::RowVector3d::Zero();
+        double area = 0.0;
+        for (const Eigen::MatrixXd& sum : sums) {
+            c += sum.block<1, 3>(l, 0);
+            area += sum(l, 3);
+        }
+        if (area > 0.0) {
+            centroids.row(order[l]) = c / area;
+            areas[order[l]] = area;
+        }
+    }
+}
+
+
+
+void compute_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                      const Eigen::VectorXd& normalized_distances,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs,
+                      const Eigen::VectorXi& connected_components,
+                      int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices) {
+    TRACE_SCOPE("compute_skeleton");
+    TetMeshComponents components;
+    split_mesh_components(TT, connected_components, components);
+
+    int vertex_count = 0;
+    skeleton_vertices.resize(num_skeleton_vertices, 3);
+
+    for (int ep_i = 0; ep_i < endpoint_pairs.size(); ep_i++) {
+        const int component = connected_components[endpoint_pairs[ep_i].first];
+        skeleton_vertices.row(vertex_count) = TV.row(endpoint_pairs[ep_i].first);
+        vertex_count++;
+
+        const double nd_ep0 = normalized_distances[endpoint_pairs[ep_i].first];
+        const double nd_ep1 = normalized_distances[endpoint_pairs[ep_i].second];
+        const double isoval_incr = (nd_ep1 - nd_ep0) / num_skeleton_vertices;
+
+        std::vector<double> isovalues(std::max(num_skeleton_vertices - 2, 0));
+        for (int i = 0; i < static_cast<int>(isovalues.size()); i++) {
+            isovalues[i] = nd_ep0 + (i + 1) * isoval_incr;
+        }
+        Eigen::MatrixXd centroids;
+        Eigen::VectorXd areas;
+        level_set_centroids(TV, TT, components.tets_begin(component), components.tets_end(component),
+                            normalized_distances, isovalues, centroids, areas);
+        for (int i = 0; i < static_cast<int>(isovalues.size()); i++) {
+            if (areas[i] > 0.0) {
+                skeleton_vertices.row(vertex_count) = centroids.row(i);
+                vertex_count += 1;
+            }
+        }
+
+        skeleton_vertices.row(vertex_count) = TV.row(endpoint_pairs[ep_i].second);
+        vertex_count += 1;
+    }
+
+    skeleton_vertices.conservativeResize(vertex_count, 3);
+}
+
+bool extract_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& connected_components,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs, int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices, Eigen::VectorXd& geodesic_dists) {
+    SkeletonExtractionCache cache;
+    return extract_skeleton(TV, TT, connected_components, endpoint_pairs, num_skeleton_vertices,
+                            skeleton_vertices, geodesic_dists, cache);
+}
+
+bool extract_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& connected_components,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs, int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices, Eigen::VectorXd& geodesic_dists,
+                      SkeletonExtractionCache& cache, bool heat_method,
+                      std::shared_ptr<spdlog::logger> logger) {
+    // Number of geodesic fields kept in the cache
+    const std::size_t max_cached_fields = 4;
+
+    if (endpoint_pairs.empty()) {
+        return false;
+    }
+    const Eigen::VectorXi& C = connected_components;
+    const int comp = C[endpoint_pairs[0].first];
+
+    // Remeshing the component and factoring its operators only depends on the mesh, so it is shared by
+    // every set of endpoints in the same component
+    if (!cache.geodesics || cache.geodesics->component != comp || cache.geodesics->heat_method != heat_method) {
+        TRACE_SCOPE("geodesic_operators");
+        std::shared_ptr<ComponentGeodesics> g = std::make_shared<ComponentGeodesics>();
+        g->component = comp;
+        g->heat_method = heat_method;
+        remesh_connected_components(comp, C, TV, TT, g->CMap, g->TV, g->TT);
+        const SparseSolverBackend backend = geodesic_solver_backend(int(g->TV.rows()));
+        const bool ok = heat_method ? g->heat_solver.compute(g->TV, g->TT, 1.0, logger, backend)
+                                    : g->solver.compute(g->TV, g->TT, logger, backend);
+        if (!ok) {
+            return false;
+        }
+        cache.clear();
+        cache.geodesics = g;
+    }
+    const ComponentGeodesics& geodesics = *cache.geodesics;
+    const Eigen::VectorXi& CMap = geodesics.CMap;
+
+    std::vector<std::pair<int, int>> selected_endpoints_2;
+    for (const std::pair<int, int>& p : endpoint_pairs) {
+        std::pair<int, int> p2 = std::make_pair(CMap[p.first], CMap[p.second]);
+        selected_endpoints_2.push_back(p2);
+    }
+
+    // The field of these endpoints moves to the front of the cached ones, solving for it if it is not there
+    auto field_it = std::find_if(cache.fields.begin(), cache.fields.end(),
+                                 [&](const std::shared_ptr<const EndpointGeodesics>& f) {
+                                     return f->endpoint_pairs == endpoint_pairs;
+                                 });
+    std::shared_ptr<const EndpointGeodesics> field;
+    if (field_it != cache.fields.end()) {
+        field = *field_it;
+        cache.fields.erase(field_it);
+    } else {
+        TRACE_SCOPE("geodesic_distances");
+        std::shared_ptr<EndpointGeodesics> f = std::make_shared<EndpointGeodesics>();
+        f->endpoint_pairs = endpoint_pairs;
+        const bool normalized = true;
+        const bool ok = heat_method ? geodesics.heat_solver.solve(selected_endpoints_2, f->component_dists) :
+                                      geodesics.solver.solve(selected_endpoints_2, f->component_dists, normalized);
+        if (!ok) {
+            return false;
+        }
+        field = f;
+    }
+    cache.fields.insert(cache.fields.begin(), field);
+    if (cache.fields.size() > max_cached_fields) {
+        cache.fields.resize(max_cached_fields);
+    }
+
+    if (!cache.skeleton || cache.skeleton->field != field ||
+        cache.skeleton->num_skeleton_vertices != num_skeleton_vertices) {
+        std::shared_ptr<SkeletonPolyline> skeleton = std::make_shared<SkeletonPolyline>();
+        skeleton->field = field;
+        skeleton->num_skeleton_vertices = num_skeleton_vertices;
+        const Eigen::VectorXi C2 = Eigen::VectorXi::Zero(geodesics.TV.rows());
+        compute_skeleton(geodesics.TV, geodesics.TT, field->component_dists,
+            selected_endpoints_2, C2,
+            num_skeleton_vertices, skeleton->skeleton_vertices);
+        cache.skeleton = skeleton;
+    }
+    skeleton_vertices = cache.skeleton->skeleton_vertices;
+
+    const Eigen::VectorXd& geodesic_dists2 = field->component_dists;
+    geodesic_dists.resize(TV.rows());
+    for (int i = 0; i < TV.rows(); i++) {
+        if (CMap[i] >= 0) {
+            geodesic_dists[i] = geodesic_dists2[CMap[i]];
+        } else {
+            geodesic_dists[i] = -1.0;
+        }
+    }
+    return skeleton_vertices.rows() >= 2;
+}
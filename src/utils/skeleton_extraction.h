@@ -0,0 +1,104 @@
+#ifndef SKELETON_EXTRACTION_H
+#define SKELETON_EXTRACTION_H
+
+#include "geodesic_solver.h"
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Area weighted centroids of the cross sections of the tets TT at the level sets f = isovalues[l] of the
+// piecewise linear function f, for all the levels in a single pass over the tets. A vertex is above a level
+// when f > isovalue, and a tet is cut when it has vertices on both sides. areas[l] is the area of each cross
+// section, 0 for the levels that cut no tet, whose centroid is left at zero. The isovalues may come in any order.
+void level_set_centroids(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXd& f,
+                         const std::vector<double>& isovalues,
+                         Eigen::MatrixXd& centroids, Eigen::VectorXd& areas);
+
+// Same as above over the rows [tets_begin, tets_end) of TT only, such as one component of TetMeshComponents
+void level_set_centroids(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                         const int* tets_begin, const int* tets_end, const Eigen::VectorXd& f,
+                         const std::vector<double>& isovalues,
+                         Eigen::MatrixXd& centroids, Eigen::VectorXd& areas);
+
+// Estimate a skeleton along the tet mesh component containing the endpoint pairs by slicing it at
+// num_skeleton_vertices level sets of the normalized geodesic distance between each pair of endpoints
+// and taking the centroids of the slices.
+void compute_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                      const Eigen::VectorXd& normalized_distances,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs,
+                      const Eigen::VectorXi& connected_components,
+                      int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices);
+
+// One connected component of a tet mesh remeshed on its own, with its factored geodesic operators
+struct ComponentGeodesics {
+    int component = -1;
+    // Which of the two solvers below is factored
+    bool heat_method = false;
+    // Index of each vertex of the whole mesh in the component mesh, -1 for vertices of other components
+    Eigen::VectorXi CMap;
+    Eigen::MatrixXd TV;
+    Eigen::MatrixXi TT;
+    GeodesicSolver solver;
+    HeatGeodesicSolver heat_solver;
+};
+
+// Extract the skeleton of the connected component of TV, TT holding the endpoint pairs. This is the
+// whole computation behind the endpoint selection step: the component is remeshed on its own, the
+// geodesic distances are computed on it and mapped back onto TV (-1 for vertices of other components).
+// The skeleton is ready to be passed to BoundingCage::set_skeleton_vertices.
+bool extract_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& connected_components,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs, int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices, Eigen::VectorXd& geodesic_dists);
+
+// Geodesic field of a set of endpoint pairs (indexing the whole mesh) on the component mesh of a
+// ComponentGeodesics
+struct EndpointGeodesics {
+    std::vector<std::pair<int, int>> endpoint_pairs;
+    Eigen::VectorXd component_dists;
+};
+
+// Skeleton sliced out of an EndpointGeodesics, before any smoothing
+struct SkeletonPolyline {
+    std::shared_ptr<const EndpointGeodesics> field;
+    int num_skeleton_vertices = 0;
+    Eigen::MatrixXd skeleton_vertices;
+};
+
+// Results of the stages of extract_skeleton, each keyed on the inputs of its stage so a new extraction only
+// reruns the stages whose inputs changed: the component mesh and its factorizations depend on the component
+// and the geodesic method, the geodesic field on the endpoint pairs and the skeleton on the field and the
+// number of skeleton vertices. The last few fields are kept, so going back to endpoints picked before does not
+// solve again. Stages are immutable once computed, copies of a cache share them.
+//
+// The cache belongs to the mesh it was computed on and must be cleared whenever TV or TT change.
+struct SkeletonExtractionCache {
+    std::shared_ptr<const ComponentGeodesics> geodesics;
+    // Most recently used first
+    std::vector<std::shared_ptr<const EndpointGeodesics>> fields;
+    std::shared_ptr<const SkeletonPolyline> skeleton;
+
+    void clear() {
+        geodesics.reset();
+        fields.clear();
+        skeleton.reset();
+    }
+};
+
+// Same as above, starting from the stages held by cache and storing the ones it computes there for the next
+// extraction on the same mesh.
+//
+// With heat_method the distances come from HeatGeodesicSolver::solve instead of geodesic_distances, which
+// follows the geodesic distance more closely on long and bent components. The factorizations of the geodesic
+// solvers are logged to logger if there is one.
+bool extract_skeleton(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::VectorXi& connected_components,
+                      const std::vector<std::pair<int, int>>& endpoint_pairs, int num_skeleton_vertices,
+                      Eigen::MatrixXd& skeleton_vertices, Eigen::VectorXd& geodesic_dists,
+                      SkeletonExtractionCache& cache, bool heat_method = false,
+                      std::shared_ptr<spdlog::logger> logger = nullptr);
+
+#endif // SKELETON_EXTRACTION_H
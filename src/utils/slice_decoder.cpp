@@ -0,0 +1,503 @@
+#include "slice_decoder.h"
+
+#include "parallel_for.h"
+#include "raw_volume_view.h"
+
+#include <geogram/third_party/zlib/zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+
+const std::uint8_t PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// Rounds a 16 bit sample to 8 bit like qt_div_257
+inline std::uint8_t to_8bit(std::uint32_t v) {
+    return static_cast<std::uint8_t>((v + 128 - (v >> 8)) >> 8);
+}
+
+// qGray
+inline std::uint8_t gray(std::uint32_t r, std::uint32_t g, std::uint32_t b) {
+    return static_cast<std::uint8_t>((r * 11 + g * 16 + b * 5) / 32);
+}
+
+inline std::uint32_t read_u16(const std::uint8_t* p, bool big_endian) {
+    return big_endian ? (std::uint32_t(p[0]) << 8) | p[1] : (std::uint32_t(p[1]) << 8) | p[0];
+}
+
+inline std::uint32_t read_u32(const std::uint8_t* p, bool big_endian) {
+    return big_endian ? (read_u16(p, true) << 16) | read_u16(p + 2, true)
+                      : (read_u16(p + 2, false) << 16) | read_u16(p, false);
+}
+
+// Samples of the decoded rows of a slice
+struct SampleLayout {
+    int width = 0;
+    int samples = 1;
+    int bytes = 1;
+    bool big_endian = false;
+    // Photometric interpretation WhiteIsZero of TIFF
+    bool invert = false;
+
+    std::size_t pixel_bytes() const { return std::size_t(samples) * std::size_t(bytes); }
+    std::size_t row_bytes() const { return std::size_t(width) * pixel_bytes(); }
+};
+
+// Convert num_rows packed rows of src to 8 bit grayscale rows of width pixels starting at dst
+void convert_rows(const std::uint8_t* src, int num_rows, const SampleLayout& layout, std::uint8_t* dst) {
+    const std::size_t w = std::size_t(layout.width);
+    if (layout.samples == 1 && layout.bytes == 1 && !layout.invert) {
+        std::memcpy(dst, src, w * std::size_t(num_rows));
+        return;
+    }
+    const std::uint8_t flip = layout.invert ? 255 : 0;
+    for (int y = 0; y < num_rows; y++, src += layout.row_bytes(), dst += w) {
+        if (layout.bytes == 1) {
+            if (layout.samples == 1) {
+                for (std::size_t x = 0; x < w; x++) {
+                    dst[x] = src[x] ^ flip;
+                }
+            } else {
+                for (std::size_t x = 0; x < w; x++) {
+                    dst[x] = gray(src[3 * x], src[3 * x + 1], src[3 * x + 2]) ^ flip;
+                }
+            }
+        } else {
+            if (layout.samples == 1) {
+                for (std::size_t x = 0; x < w; x++) {
+                    dst[x] = to_8bit(read_u16(src + 2 * x, layout.big_endian)) ^ flip;
+                }
+            } else {
+                for (std::size_t x = 0; x < w; x++) {
+                    const std::uint8_t* p = src + 6 * x;
+                    dst[x] = gray(to_8bit(read_u16(p, layout.big_endian)), to_8bit(read_u16(p + 2, layout.big_endian)),
+                                  to_8bit(read_u16(p + 4, layout.big_endian))) ^ flip;
+                }
+            }
+        }
+    }
+}
+
+// Inflate the zlib stream src into exactly dst_size bytes of dst, trailing data is ignored
+bool inflate_exact(const std::uint8_t* src, std::size_t src_size, std::uint8_t* dst, std::size_t dst_size) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+    stream.next_in = const_cast<Bytef*>(src);
+    stream.avail_in = static_cast<uInt>(src_size);
+    stream.next_out = dst;
+    stream.avail_out = static_cast<uInt>(dst_size);
+    const int result = inflate(&stream, Z_FINISH);
+    const bool filled = stream.avail_out == 0 && (result == Z_STREAM_END || result == Z_OK || result == Z_BUF_ERROR);
+    inflateEnd(&stream);
+    return filled;
+}
+
+// The LZW of TIFF: codes of 9 to 12 bits, most significant bit first, the width grows one code before the table
+// needs it and 256 resets the table. Returns the number of bytes written to dst, at most dst_size.
+std::size_t lzw_decode(const std::uint8_t* src, std::size_t src_size, std::uint8_t* dst, std::size_t dst_size) {
+    constexpr int CLEAR_CODE = 256;
+    constexpr int END_CODE = 257;
+    constexpr int MAX_CODES = 4096;
+    std::uint16_t prefix[MAX_CODES];
+    std::uint16_t length[MAX_CODES];
+    std::uint8_t suffix[MAX_CODES];
+    std::uint8_t first[MAX_CODES];
+    for (int c = 0; c < 256; c++) {
+        prefix[c] = 0;
+        length[c] = 1;
+        suffix[c] = first[c] = static_cast<std::uint8_t>(c);
+    }
+
+    std::size_t out = 0, pos = 0;
+    std::uint32_t bit_buffer = 0;
+    int num_bits = 0, width = 9, next_code = END_CODE + 1, previous = -1;
+    while (out < dst_size) {
+        while (num_bits < width) {
+            if (pos == src_size) {
+                return out;
+            }
+            bit_buffer = (bit_buffer << 8) | src[pos++];
+            num_bits += 8;
+        }
+        const int code = int(bit_buffer >> (num_bits - width)) & ((1 << width) - 1);
+        num_bits -= width;
+
+        if (code == END_CODE) {
+            break;
+        }
+        if (code == CLEAR_CODE) {
+            width = 9;
+            next_code = END_CODE + 1;
+            previous = -1;
+            continue;
+        }
+        if (previous < 0) {
+            if (code >= CLEAR_CODE) {
+                return out;
+            }
+            dst[out++] = static_cast<std::uint8_t>(code);
+            previous = code;
+            continue;
+        }
+        if (code > next_code || (code == next_code && next_code == MAX_CODES)) {
+            return out;
+        }
+
+        // The new entry is the previous string and the first byte of this one, which is the first byte of the
+        // previous string as well if the code is the entry itself
+        if (next_code < MAX_CODES) {
+            prefix[next_code] = static_cast<std::uint16_t>(previous);
+            length[next_code] = static_cast<std::uint16_t>(length[previous] + 1);
+            first[next_code] = first[previous];
+            suffix[next_code] = code == next_code ? first[previous] : first[code];
+            next_code += 1;
+            if (next_code == (1 << width) - 1 && width < 12) {
+                width += 1;
+            }
+        }
+
+        // Strings are linked from their last byte, write them back to front and clip them to the output
+        const std::size_t n = length[code];
+        int c = code;
+        for (std::size_t i = n; i-- > 0;) {
+            if (out + i < dst_size) {
+                dst[out + i] = suffix[c];
+            }
+            c = prefix[c];
+        }
+        out = std::min(out + n, dst_size);
+        previous = code;
+    }
+    return out;
+}
+
+// Undo the horizontal differencing of TIFF predictor 2 in num_rows rows
+void undo_horizontal_predictor(std::uint8_t* rows, int num_rows, const SampleLayout& layout) {
+    const std::size_t samples = std::size_t(layout.samples);
+    const std::size_t row_samples = std::size_t(layout.width) * samples;
+    for (int y = 0; y < num_rows; y++) {
+        std::uint8_t* row = rows + std::size_t(y) * layout.row_bytes();
+        if (layout.bytes == 1) {
+            for (std::size_t i = samples; i < row_samples; i++) {
+                row[i] = static_cast<std::uint8_t>(row[i] + row[i - samples]);
+            }
+        } else {
+            for (std::size_t i = samples; i < row_samples; i++) {
+                const std::uint32_t v = (read_u16(row + 2 * i, layout.big_endian) +
+                                         read_u16(row + 2 * (i - samples), layout.big_endian)) & 0xffff;
+                row[2 * i + (layout.big_endian ? 0 : 1)] = static_cast<std::uint8_t>(v >> 8);
+                row[2 * i + (layout.big_endian ? 1 : 0)] = static_cast<std::uint8_t>(v);
+            }
+        }
+    }
+}
+
+// A field of the first image file directory of a TIFF
+struct TiffField {
+    bool present = false;
+    std::uint32_t type = 0;
+    std::uint32_t count = 0;
+    // Of the values in the file, which are stored in the entry itself if they fit into 4 bytes
+    std::size_t offset = 0;
+};
+
+// Reads the BYTE, SHORT or LONG values of field, false if it has another type or points outside of the file
+bool tiff_values(const std::uint8_t* data, std::size_t size, bool big_endian, const TiffField& field,
+                 std::vector<std::uint32_t>& values) {
+    const std::size_t type_size = field.type == 1 ? 1 : field.type == 3 ? 2 : field.type == 4 ? 4 : 0;
+    if (type_size == 0 || field.offset > size || std::size_t(field.count) > (size - field.offset) / type_size) {
+        return false;
+    }
+    values.resize(field.count);
+    for (std::uint32_t i = 0; i < field.count; i++) {
+        const std::uint8_t* p = data + field.offset + i * type_size;
+        values[i] = type_size == 1 ? *p : type_size == 2 ? read_u16(p, big_endian) : read_u32(p, big_endian);
+    }
+    return true;
+}
+
+} // namespace
+
+
+SliceDecodeStatus SliceDecoder::decode(const std::string& filename, int& w, int& h, std::vector<std::uint8_t>& out) {
+    RawVolumeView file;
+    if (!file.open(filename, _logger)) {
+        return SliceDecodeStatus::Failed;
+    }
+    const std::uint8_t* data = file.data();
+    const std::size_t size = file.size();
+    if (size >= 4 && ((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M'))) {
+        return decode_tiff(data, size, w, h, out);
+    }
+    if (size >= 8 && std::memcmp(data, PNG_SIGNATURE, 8) == 0) {
+        return decode_png(data, size, w, h, out);
+    }
+    return SliceDecodeStatus::Unsupported;
+}
+
+SliceDecodeStatus SliceDecoder::decode_tiff(const std::uint8_t* data, std::size_t size, int& w, int& h,
+                                            std::vector<std::uint8_t>& out) {
+    if (size < 8 || !((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M'))) {
+        return SliceDecodeStatus::Unsupported;
+    }
+    const bool big_endian = data[0] == 'M';
+    // 43 is BigTIFF
+    if (read_u16(data + 2, big_endian) != 42) {
+        return SliceDecodeStatus::Unsupported;
+    }
+    const std::size_t ifd = read_u32(data + 4, big_endian);
+    if (ifd + 2 > size) {
+        return SliceDecodeStatus::Failed;
+    }
+    const std::size_t num_entries = read_u16(data + ifd, big_endian);
+    if (ifd + 2 + 12 * num_entries > size) {
+        return SliceDecodeStatus::Failed;
+    }
+
+    enum Tag {
+        ImageWidth = 256, ImageLength = 257, BitsPerSample = 258, Compression = 259, Photometric = 262,
+        FillOrder = 266, StripOffsets = 273, SamplesPerPixel = 277, RowsPerStrip = 278, StripByteCounts = 279,
+        PlanarConfiguration = 284, Predictor = 317, TileWidth = 322, SampleFormat = 339
+    };
+    const int TAGS[] = { ImageWidth, ImageLength, BitsPerSample, Compression, Photometric, FillOrder, StripOffsets,
+                         SamplesPerPixel, RowsPerStrip, StripByteCounts, PlanarConfiguration, Predictor, TileWidth,
+                         SampleFormat };
+    constexpr int NUM_TAGS = sizeof(TAGS) / sizeof(TAGS[0]);
+    TiffField fields[NUM_TAGS];
+    for (std::size_t e = 0; e < num_entries; e++) {
+        const std::uint8_t* entry = data + ifd + 2 + 12 * e;
+        const int tag = int(read_u16(entry, big_endian));
+        const int t = int(std::find(TAGS, TAGS + NUM_TAGS, tag) - TAGS);
+        if (t == NUM_TAGS) {
+            continue;
+        }
+        fields[t].present = true;
+        fields[t].type = read_u16(entry + 2, big_endian);
+        fields[t].count = read_u32(entry + 4, big_endian);
+        const std::size_t type_size = fields[t].type == 3 ? 2 : fields[t].type == 4 ? 4 : 1;
+        fields[t].offset = std::size_t(fields[t].count) * type_size <= 4 ? std::size_t(entry + 8 - data)
+                                                                          : read_u32(entry + 8, big_endian);
+    }
+    auto field = [&](int tag) -> const TiffField& { return fields[std::find(TAGS, TAGS + NUM_TAGS, tag) - TAGS]; };
+
+    // Every value of the field if it is present, default otherwise
+    std::vector<std::uint32_t> values;
+    auto all_values_are = [&](int tag, std::uint32_t default_value, std::uint32_t& value) {
+        if (!field(tag).present) {
+            value = default_value;
+            return true;
+        }
+        if (!tiff_values(data, size, big_endian, field(tag), values) || values.empty()) {
+            return false;
+        }
+        value = values[0];
+        return std::all_of(values.begin(), values.end(), [&](std::uint32_t v) { return v == value; });
+    };
+    std::uint32_t width, height, bits, compression, photometric, fill_order, samples, rows_per_strip, planar,
+        predictor, sample_format;
+    if (!all_values_are(ImageWidth, 0, width) || !all_values_are(ImageLength, 0, height) ||
+        !all_values_are(BitsPerSample, 1, bits) || !all_values_are(Compression, 1, compression) ||
+        !all_values_are(Photometric, ~0u, photometric) || !all_values_are(FillOrder, 1, fill_order) ||
+        !all_values_are(SamplesPerPixel, 1, samples) || !all_values_are(RowsPerStrip, ~0u, rows_per_strip) ||
+        !all_values_are(PlanarConfiguration, 1, planar) || !all_values_are(Predictor, 1, predictor) ||
+        !all_values_are(SampleFormat, 1, sample_format)) {
+        return SliceDecodeStatus::Unsupported;
+    }
+    const bool gray_layout = samples == 1 && (photometric == 0 || photometric == 1);
+    const bool rgb_layout = samples == 3 && photometric == 2 && planar == 1;
+    const bool lzw = compression == 5, deflate = compression == 8 || compression == 32946;
+    if (width == 0 || height == 0 || width > (1u << 30) || height > (1u << 30) || (bits != 8 && bits != 16) ||
+        !(gray_layout || rgb_layout) || !(compression == 1 || lzw || deflate) || fill_order != 1 ||
+        (predictor != 1 && predictor != 2) || sample_format != 1 || field(TileWidth).present ||
+        !field(StripOffsets).present) {
+        return SliceDecodeStatus::Unsupported;
+    }
+
+    SampleLayout layout;
+    layout.width = int(width);
+    layout.samples = int(samples);
+    layout.bytes = int(bits / 8);
+    layout.big_endian = big_endian;
+    layout.invert = photometric == 0;
+    rows_per_strip = std::min(rows_per_strip, height);
+    const std::size_t num_strips = (height + rows_per_strip - 1) / rows_per_strip;
+
+    std::vector<std::uint32_t> strip_offsets, strip_byte_counts;
+    if (!tiff_values(data, size, big_endian, field(StripOffsets), strip_offsets) ||
+        strip_offsets.size() != num_strips) {
+        return SliceDecodeStatus::Failed;
+    }
+    if (field(StripByteCounts).present) {
+        if (!tiff_values(data, size, big_endian, field(StripByteCounts), strip_byte_counts) ||
+            strip_byte_counts.size() != num_strips) {
+            return SliceDecodeStatus::Failed;
+        }
+    } else if (compression == 1) {
+        // Old writers leave out the counts of uncompressed strips
+        strip_byte_counts.assign(num_strips, std::uint32_t(std::size_t(rows_per_strip) * layout.row_bytes()));
+    } else {
+        return SliceDecodeStatus::Unsupported;
+    }
+
+    // The LZW of old writers packs its codes least significant bit first, which libtiff detects by these bits
+    if (lzw && strip_offsets[0] + 2 <= size && data[strip_offsets[0]] == 0 && (data[strip_offsets[0] + 1] & 1)) {
+        return SliceDecodeStatus::Unsupported;
+    }
+
+    w = int(width);
+    h = int(height);
+    out.resize(std::size_t(width) * std::size_t(height));
+
+    // Strips are independent, and the chunks of strips each decompress into their own buffer
+    const std::size_t min_chunk = parallel_strips ? 1 : num_strips;
+    _strip_buffers.resize(std::max(_strip_buffers.size(), parallel_num_chunks(num_strips, min_chunk)));
+    std::atomic_bool failed(false);
+    parallel_for_chunks(num_strips, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::vector<std::uint8_t>& buffer = _strip_buffers[chunk];
+        for (std::size_t s = begin; s < end && !failed; s++) {
+            const int first_row = int(s * rows_per_strip);
+            const int num_rows = std::min(int(rows_per_strip), h - first_row);
+            const std::size_t strip_size = std::size_t(num_rows) * layout.row_bytes();
+            const std::size_t offset = strip_offsets[s], count = strip_byte_counts[s];
+            if (offset > size || count > size - offset) {
+                failed = true;
+                break;
+            }
+
+            const std::uint8_t* rows = data + offset;
+            if (compression == 1) {
+                if (count < strip_size) {
+                    failed = true;
+                    break;
+                }
+                if (predictor == 2) {
+                    buffer.assign(rows, rows + strip_size);
+                    rows = buffer.data();
+                }
+            } else {
+                buffer.resize(strip_size);
+                const bool ok = lzw ? lzw_decode(rows, count, buffer.data(), strip_size) == strip_size
+                                    : inflate_exact(rows, count, buffer.data(), strip_size);
+                if (!ok) {
+                    failed = true;
+                    break;
+                }
+                rows = buffer.data();
+            }
+            if (predictor == 2) {
+                undo_horizontal_predictor(buffer.data(), num_rows, layout);
+            }
+            convert_rows(rows, num_rows, layout, out.data() + std::size_t(first_row) * std::size_t(width));
+        }
+    }, min_chunk);
+    return failed ? SliceDecodeStatus::Failed : SliceDecodeStatus::Decoded;
+}
+
+SliceDecodeStatus SliceDecoder::decode_png(const std::uint8_t* data, std::size_t size, int& w, int& h,
+                                           std::vector<std::uint8_t>& out) {
+    if (size < 8 + 25 || std::memcmp(data, PNG_SIGNATURE, 8) != 0) {
+        return SliceDecodeStatus::Unsupported;
+    }
+    // The header chunk comes first
+    const std::uint8_t* ihdr = data + 8;
+    if (read_u32(ihdr, true) != 13 || std::memcmp(ihdr + 4, "IHDR", 4) != 0) {
+        return SliceDecodeStatus::Failed;
+    }
+    const std::uint32_t width = read_u32(ihdr + 8, true), height = read_u32(ihdr + 12, true);
+    const int bit_depth = ihdr[16], color_type = ihdr[17], compression = ihdr[18], filter = ihdr[19];
+    const int interlace = ihdr[20];
+    // Color types 0 and 2 are grayscale and RGB, the others have a palette or alpha
+    if (width == 0 || height == 0 || width > (1u << 30) || height > (1u << 30) || (bit_depth != 8 && bit_depth != 16) ||
+        (color_type != 0 && color_type != 2) || compression != 0 || filter != 0 || interlace != 0) {
+        return SliceDecodeStatus::Unsupported;
+    }
+
+    SampleLayout layout;
+    layout.width = int(width);
+    layout.samples = color_type == 2 ? 3 : 1;
+    layout.bytes = bit_depth / 8;
+    layout.big_endian = true;
+    const std::size_t row_bytes = layout.row_bytes();
+    // Every scanline starts with the byte of its filter
+    const std::size_t stride = row_bytes + 1;
+    _png_buffer.resize(stride * std::size_t(height));
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        return SliceDecodeStatus::Failed;
+    }
+    stream.next_out = _png_buffer.data();
+    stream.avail_out = static_cast<uInt>(_png_buffer.size());
+    std::size_t pos = 8;
+    int result = Z_OK;
+    while (pos + 12 <= size && stream.avail_out > 0 && result == Z_OK) {
+        const std::size_t length = read_u32(data + pos, true);
+        const std::uint8_t* type = data + pos + 4;
+        if (length > size - pos - 12) {
+            break;
+        }
+        if (std::memcmp(type, "IDAT", 4) == 0) {
+            stream.next_in = const_cast<Bytef*>(data + pos + 8);
+            stream.avail_in = static_cast<uInt>(length);
+            while (stream.avail_in > 0 && stream.avail_out > 0 && result == Z_OK) {
+                result = inflate(&stream, Z_NO_FLUSH);
+            }
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += length + 12;
+    }
+    const bool filled = stream.avail_out == 0 && (result == Z_OK || result == Z_STREAM_END);
+    inflateEnd(&stream);
+    if (!filled) {
+        return SliceDecodeStatus::Failed;
+    }
+
+    w = int(width);
+    h = int(height);
+    out.resize(std::size_t(width) * std::size_t(height));
+    const std::size_t bpp = layout.pixel_bytes();
+    for (std::size_t y = 0; y < height; y++) {
+        std::uint8_t* row = _png_buffer.data() + y * stride + 1;
+        const std::uint8_t* up = y > 0 ? row - stride : nullptr;
+        switch (row[-1]) {
+        case 0:
+            break;
+        case 1:
+            for (std::size_t i = bpp; i < row_bytes; i++) {
+                row[i] = static_cast<std::uint8_t>(row[i] + row[i - bpp]);
+            }
+            break;
+        case 2:
+            for (std::size_t i = 0; up && i < row_bytes; i++) {
+                row[i] = static_cast<std::uint8_t>(row[i] + up[i]);
+            }
+            break;
+        case 3:
+            for (std::size_t i = 0; i < row_bytes; i++) {
+                const int left = i >= bpp ? row[i - bpp] : 0, above = up ? up[i] : 0;
+                row[i] = static_cast<std::uint8_t>(row[i] + (left + above) / 2);
+            }
+            break;
+        case 4:
+            for (std::size_t i = 0; i < row_bytes; i++) {
+                const int a = i >= bpp ? row[i - bpp] : 0, b = up ? up[i] : 0, c = up && i >= bpp ? up[i - bpp] : 0;
+                const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                row[i] = static_cast<std::uint8_t>(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+            }
+            break;
+        default:
+            return SliceDecodeStatus::Failed;
+        }
+        convert_rows(row, 1, layout, out.data() + y * std::size_t(width));
+    }
+    return SliceDecodeStatus::Decoded;
+}
@@ -0,0 +1,53 @@
+#ifndef SLICE_DECODER_H
+#define SLICE_DECODER_H
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class SliceDecodeStatus {
+    Decoded,
+    // Not a file of the formats below, or one using a feature they do not implement. Load it with QImage instead.
+    Unsupported,
+    Failed
+};
+
+// Decodes the image slices of the common scanner outputs into 8 bit grayscale without going through QImage, which
+// converts every slice (and every 16 bit sample) through intermediate images of its own:
+//  - TIFF: stripped, uncompressed, LZW or deflate with or without the horizontal predictor, 8 or 16 bit unsigned
+//    grayscale or RGB with interleaved samples. The strips are decompressed in parallel if parallel_strips is set.
+//  - PNG: non interlaced, 8 or 16 bit grayscale or RGB.
+// Everything else (JPEG, palettes, alpha, tiles, ...) is reported as Unsupported. The slice is written straight into
+// the caller's buffer, which is only reallocated if it is smaller than the slice, and the scratch buffers of the
+// decoder are kept from one slice to the next, so a decoder per thread reading a stack allocates nothing per slice.
+//
+// 16 bit samples are rounded to 8 bit and RGB is converted with the weights of qGray, as QImage would.
+class SliceDecoder {
+public:
+    explicit SliceDecoder(std::shared_ptr<spdlog::logger> logger) : _logger(logger) {}
+
+    // Decompress the strips of each TIFF slice in parallel, worth it where there are fewer decoders than threads
+    bool parallel_strips = false;
+
+    // Resizes out to w * h pixels, rows are tightly packed
+    SliceDecodeStatus decode(const std::string& filename, int& w, int& h, std::vector<std::uint8_t>& out);
+
+    SliceDecodeStatus decode_tiff(const std::uint8_t* data, std::size_t size, int& w, int& h,
+                                  std::vector<std::uint8_t>& out);
+    SliceDecodeStatus decode_png(const std::uint8_t* data, std::size_t size, int& w, int& h,
+                                 std::vector<std::uint8_t>& out);
+
+private:
+    std::shared_ptr<spdlog::logger> _logger;
+
+    // Decompressed strips, one buffer per chunk of strips decoded in parallel
+    std::vector<std::vector<std::uint8_t>> _strip_buffers;
+    // Inflated and unfiltered scanlines of a PNG
+    std::vector<std::uint8_t> _png_buffer;
+};
+
+#endif // SLICE_DECODER_H
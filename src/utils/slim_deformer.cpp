@@ -0,0 +1,231 @@
+#include "slim_deformer.h"
+#include "parallel_for.h"
+#include "trace.h"
+
+#include <igl/slim.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_set>
+#include <vector>
+
+
+SlimDeformer::~SlimDeformer() {
+    stop();
+}
+
+void SlimDeformer::start(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const SlimOptions& options,
+                         std::function<void()> notify) {
+    stop();
+    _options = options;
+    _notify = std::move(notify);
+    _rest_vertices = TV;
+    _tets = TT;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+        _converged = false;
+        _num_iterations = 0;
+        _energy = 0.0;
+        _average_iteration_ms = 0.0;
+    }
+    _vertices.take();
+    _thread = std::thread([this]() { run(); });
+}
+
+void SlimDeformer::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _changed.notify_all();
+    _thread.join();
+}
+
+bool SlimDeformer::is_running() const {
+    return _thread.joinable();
+}
+
+void SlimDeformer::set_constraints(const Eigen::VectorXi& b, const Eigen::MatrixXd& bc) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _b = b;
+        _bc = bc;
+        _constraints_changed = true;
+        _converged = false;
+    }
+    _changed.notify_one();
+}
+
+std::shared_ptr<Eigen::MatrixXd> SlimDeformer::take_vertices() {
+    return _vertices.take();
+}
+
+bool SlimDeformer::converged() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _converged;
+}
+
+int SlimDeformer::num_iterations() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _num_iterations;
+}
+
+double SlimDeformer::energy() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _energy;
+}
+
+double SlimDeformer::average_iteration_ms() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _average_iteration_ms;
+}
+
+void SlimDeformer::run() {
+    using clock = std::chrono::steady_clock;
+    // The mesh follows the constraint being dragged
+    TaskLaneScope lane_scope(TaskLane::Interactive);
+
+    igl::SLIMData data;
+    ArapSolver arap;
+    bool ready = false;
+    // The iterate new constraints are warm-started from
+    Eigen::MatrixXd current = _rest_vertices;
+    double last_energy = 0.0;
+    const clock::duration publish_interval = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(1.0 / std::max(_options.max_publish_rate, 1e-3)));
+    clock::time_point last_publish = clock::now() - publish_interval;
+
+    auto publish = [&](bool force) {
+        const clock::time_point now = clock::now();
+        if (!force && now - last_publish < publish_interval) {
+            return;
+        }
+        last_publish = now;
+        _vertices.publish(std::make_shared<Eigen::MatrixXd>(current));
+        if (_notify) {
+            _notify();
+        }
+    };
+
+    while (true) {
+        Eigen::VectorXi b;
+        Eigen::MatrixXd bc;
+        bool precompute = false;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // Sleep once converged, or until there are constraints to solve for
+            _changed.wait(lock, [&]() { return _stopping || _constraints_changed || (ready && !_converged); });
+            if (_stopping) {
+                return;
+            }
+            if (_constraints_changed) {
+                b = _b;
+                bc = _bc;
+                _constraints_changed = false;
+                precompute = true;
+            }
+        }
+
+        if (precompute && _options.use_arap) {
+            // Only a new set of constrained vertices changes the global system
+            if (!arap.is_valid() || arap.constrained_vertices().size() != b.size() ||
+                    arap.constrained_vertices() != b) {
+                arap.compute(_rest_vertices, _tets, b, _options.soft_constraint_weight);
+            }
+            arap.set_targets(bc);
+            last_energy = 0.0;
+            ready = arap.is_valid();
+            if (!ready) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _converged = true;
+                continue;
+            }
+        } else if (precompute) {
+            TRACE_SCOPE("slim_precompute");
+            data = igl::SLIMData();
+            data.exp_factor = _options.exp_factor;
+            igl::slim_precompute(_rest_vertices, _tets, current, data, igl::SLIMData::EXP_SYMMETRIC_DIRICHLET,
+                                 b, bc, _options.soft_constraint_weight);
+            last_energy = data.energy;
+            ready = true;
+        }
+
+        const clock::time_point start = clock::now();
+        double energy;
+        if (_options.use_arap) {
+            energy = arap.iterate(current);
+        } else {
+            TRACE_SCOPE("slim_solve");
+            igl::slim_solve(data, 1);
+            current = data.V_o;
+            energy = data.energy;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        // The energy only stops decreasing once the iterate has settled
+        const bool converged = !std::isfinite(energy) ||
+                std::abs(last_energy - energy) <= _options.convergence_tolerance * std::abs(last_energy);
+        last_energy = energy;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _num_iterations += 1;
+            _energy = energy;
+            const double alpha = 0.1;
+            _average_iteration_ms = _average_iteration_ms == 0.0 ? ms : alpha * ms + (1.0 - alpha) * _average_iteration_ms;
+            // Constraints that came in during the iteration start a new solve instead
+            _converged = converged && !_constraints_changed;
+        }
+        publish(converged);
+    }
+}
+
+
+void straight_skeleton_constraints(const Eigen::MatrixXd& TV, const Eigen::MatrixXd& skeleton_vertices,
+                                   Eigen::VectorXi& b, Eigen::MatrixXd& bc) {
+    const int num_skeleton_vertices = int(skeleton_vertices.rows());
+    if (num_skeleton_vertices < 2 || TV.rows() == 0) {
+        b.resize(0);
+        bc.resize(0, 3);
+        return;
+    }
+
+    const Eigen::RowVector3d origin = skeleton_vertices.row(0);
+    Eigen::RowVector3d direction = skeleton_vertices.row(num_skeleton_vertices - 1) - origin;
+    if (direction.norm() == 0.0) {
+        direction = Eigen::RowVector3d(0.0, 0.0, 1.0);
+    }
+    direction.normalize();
+
+    std::vector<int> closest(num_skeleton_vertices, 0);
+    parallel_for_chunks(std::size_t(num_skeleton_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            Eigen::Index row;
+            (TV.rowwise() - skeleton_vertices.row(i)).rowwise().squaredNorm().minCoeff(&row);
+            closest[i] = int(row);
+        }
+    }, 1);
+
+    std::unordered_set<int> constrained;
+    b.resize(num_skeleton_vertices);
+    bc.resize(num_skeleton_vertices, 3);
+    int count = 0;
+    double arc_length = 0.0;
+    for (int i = 0; i < num_skeleton_vertices; i++) {
+        if (i > 0) {
+            arc_length += (skeleton_vertices.row(i) - skeleton_vertices.row(i - 1)).norm();
+        }
+        if (!constrained.insert(closest[i]).second) {
+            continue;
+        }
+        b[count] = closest[i];
+        bc.row(count) = origin + arc_length * direction + (TV.row(closest[i]) - skeleton_vertices.row(i));
+        count += 1;
+    }
+    b.conservativeResize(count);
+    bc.conservativeResize(count, 3);
+}
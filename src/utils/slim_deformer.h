@@ -0,0 +1,99 @@
+#ifndef SLIM_DEFORMER_H
+#define SLIM_DEFORMER_H
+
+#include <Eigen/Core>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "arap_solver.h"
+#include "result_handoff.h"
+
+// Parameters of SlimDeformer
+struct SlimOptions {
+    // Weight of the soft constraints
+    double soft_constraint_weight = 1e5;
+    // Exponent of the exponential symmetric Dirichlet energy
+    double exp_factor = 5.0;
+    // Relative decrease of the energy below which an iteration counts as converged
+    double convergence_tolerance = 1e-5;
+    double max_publish_rate = 30.0;
+    // Solve with the parallel local-global iterations of ArapSolver instead of igl::slim. Its global step is
+    // factored once per set of constrained vertices, moving their targets reuses the factorization.
+    bool use_arap = false;
+};
+
+// Straightens a tet mesh volumetrically with SLIM (igl::slim, symmetric Dirichlet energy) on a worker thread, as
+// an alternative to the piecewise linear straightening of the BoundingCage. The vertices in the constraints are
+// pulled towards their targets by a soft penalty and the rest of the mesh follows as rigidly as it can.
+// With SlimOptions::use_arap the as-rigid-as-possible energy of ArapSolver is minimized instead.
+//
+// The worker iterates until the energy stops decreasing, then waits for new constraints. New constraints are
+// warm-started from the last iterate instead of the rest pose, so dragging a constraint only costs the iterations
+// to move from where the mesh already is. The precomputation of SLIM is only redone when the constraints change,
+// every other iteration reuses it.
+//
+// Intermediate vertex positions are published at most max_publish_rate times per second, and once more when the
+// solver has converged.
+class SlimDeformer {
+public:
+    SlimDeformer() = default;
+    SlimDeformer(const SlimDeformer&) = delete;
+    SlimDeformer& operator=(const SlimDeformer&) = delete;
+    ~SlimDeformer();
+
+    // Start solving on the rest mesh TV, TT. The mesh is copied. notify is called from the worker thread whenever
+    // new vertex positions are published, to wake up the UI.
+    void start(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const SlimOptions& options = SlimOptions(),
+               std::function<void()> notify = std::function<void()>());
+    // Stop the worker and wait for it
+    void stop();
+    bool is_running() const;
+
+    // Rows b of the mesh are pulled towards the rows of bc. Replaces the previous constraints.
+    void set_constraints(const Eigen::VectorXi& b, const Eigen::MatrixXd& bc);
+
+    // The newest deformed vertices published since the last call, nullptr if there are none
+    std::shared_ptr<Eigen::MatrixXd> take_vertices();
+
+    bool converged() const;
+    int num_iterations() const;
+    double energy() const;
+    // Exponential moving average of the time of an iteration
+    double average_iteration_ms() const;
+
+private:
+    void run();
+
+    SlimOptions _options;
+    std::function<void()> _notify;
+    Eigen::MatrixXd _rest_vertices;
+    Eigen::MatrixXi _tets;
+
+    // Guards everything below
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    bool _stopping = false;
+    bool _constraints_changed = false;
+    Eigen::VectorXi _b;
+    Eigen::MatrixXd _bc;
+
+    bool _converged = false;
+    int _num_iterations = 0;
+    double _energy = 0.0;
+    double _average_iteration_ms = 0.0;
+
+    ResultHandoff<Eigen::MatrixXd> _vertices;
+    std::thread _thread;
+};
+
+// Constraints that straighten a tet mesh along its skeleton: the vertex of TV closest to each skeleton vertex is
+// moved, with its offset from the skeleton, onto the straight line from the first skeleton vertex towards the last
+// one, at the arc length of the skeleton vertex. Vertices closest to several skeleton vertices are constrained once.
+void straight_skeleton_constraints(const Eigen::MatrixXd& TV, const Eigen::MatrixXd& skeleton_vertices,
+                                   Eigen::VectorXi& b, Eigen::MatrixXd& bc);
+
+#endif // SLIM_DEFORMER_H
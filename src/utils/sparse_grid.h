@@ -0,0 +1,108 @@
+#ifndef SPARSE_GRID_H
+#define SPARSE_GRID_H
+
+#include <Eigen/Core>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sparse grid of samples in the layout of OpenVDB, reduced to two levels: the grid is split into leaf blocks of
+// 8^3 samples, and a table of the blocks tells for each of them whether it holds a leaf of 512 samples, a single
+// tile value for all of its samples, or the background value. Grids whose samples only vary in a thin band,
+// such as narrow band distance fields or the masks of a solid, then take memory in proportion to the band:
+// the table costs 4 bytes per block, less than 1% of a dense grid of floats.
+//
+// Sample (i, j, k) of leaf block b holds the samples 8 b + (0..7, 0..7, 0..7), stored i fastest. Blocks are
+// filled with set_leaf and set_tile, which are not thread safe. Reading is, e.g. to sample the grid from
+// several threads once it is built.
+template <typename T>
+class SparseGrid {
+public:
+    static constexpr int LOG2_BLOCK_SIZE = 3;
+    static constexpr int BLOCK_SIZE = 1 << LOG2_BLOCK_SIZE;
+    static constexpr int BLOCK_SAMPLES = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+    SparseGrid() = default;
+    SparseGrid(const Eigen::Vector3i& dims, T background) { reset(dims, background); }
+
+    // Every block holds the background
+    void reset(const Eigen::Vector3i& dims, T background) {
+        _dims = dims;
+        _block_dims = (dims.array() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        _background = background;
+        _blocks.assign(std::size_t(_block_dims.prod()), BACKGROUND);
+        _leaves.clear();
+        _tiles.clear();
+    }
+
+    const Eigen::Vector3i& dims() const { return _dims; }
+    const Eigen::Vector3i& block_dims() const { return _block_dims; }
+    T background() const { return _background; }
+
+    // Sample (i, j, k), which must be on the grid
+    T operator()(int i, int j, int k) const {
+        const std::int32_t entry = _blocks[block_index(i >> LOG2_BLOCK_SIZE, j >> LOG2_BLOCK_SIZE,
+                                                       k >> LOG2_BLOCK_SIZE)];
+        if (entry >= 0) {
+            const int m = BLOCK_SIZE - 1;
+            return _leaves[std::size_t(entry) * BLOCK_SAMPLES +
+                           std::size_t((i & m) + BLOCK_SIZE * ((j & m) + BLOCK_SIZE * (k & m)))];
+        }
+        return entry == BACKGROUND ? _background : _tiles[std::size_t(TILE_0 - entry)];
+    }
+
+    // The samples of leaf block (bi, bj, bk), nullptr for tiles and the background
+    const T* leaf(int bi, int bj, int bk) const {
+        const std::int32_t entry = _blocks[block_index(bi, bj, bk)];
+        return entry >= 0 ? &_leaves[std::size_t(entry) * BLOCK_SAMPLES] : nullptr;
+    }
+
+    // Store the BLOCK_SAMPLES samples of leaf block (bi, bj, bk), which must not have been set before. The
+    // samples of a block past the border of the grid are stored too but never read.
+    void set_leaf(int bi, int bj, int bk, const T* samples) {
+        _blocks[block_index(bi, bj, bk)] = std::int32_t(_leaves.size() / BLOCK_SAMPLES);
+        _leaves.insert(_leaves.end(), samples, samples + BLOCK_SAMPLES);
+    }
+
+    // Give every sample of block (bi, bj, bk) value, which must not have been set before
+    void set_tile(int bi, int bj, int bk, T value) {
+        if (value == _background) {
+            return;
+        }
+        _blocks[block_index(bi, bj, bk)] = TILE_0 - std::int32_t(_tiles.size());
+        _tiles.push_back(value);
+    }
+
+    std::size_t num_leaves() const { return _leaves.size() / BLOCK_SAMPLES; }
+    std::size_t num_tiles() const { return _tiles.size(); }
+    std::size_t num_bytes() const {
+        return _blocks.size() * sizeof(std::int32_t) + (_leaves.size() + _tiles.size()) * sizeof(T);
+    }
+
+private:
+    // Entries of the block table below 0: the background, or tile TILE_0 - entry
+    static constexpr std::int32_t BACKGROUND = -1;
+    static constexpr std::int32_t TILE_0 = -2;
+
+    std::size_t block_index(int bi, int bj, int bk) const {
+        return std::size_t(bi) +
+               std::size_t(_block_dims[0]) * (std::size_t(bj) + std::size_t(_block_dims[1]) * std::size_t(bk));
+    }
+
+    Eigen::Vector3i _dims = Eigen::Vector3i::Zero();
+    Eigen::Vector3i _block_dims = Eigen::Vector3i::Zero();
+    T _background = T();
+    // Leaf index, or BACKGROUND or a tile, of each block, i fastest
+    std::vector<std::int32_t> _blocks;
+    std::vector<T> _leaves;
+    std::vector<T> _tiles;
+};
+
+template <typename T> constexpr int SparseGrid<T>::LOG2_BLOCK_SIZE;
+template <typename T> constexpr int SparseGrid<T>::BLOCK_SIZE;
+template <typename T> constexpr int SparseGrid<T>::BLOCK_SAMPLES;
+template <typename T> constexpr std::int32_t SparseGrid<T>::BACKGROUND;
+template <typename T> constexpr std::int32_t SparseGrid<T>::TILE_0;
+
+#endif // SPARSE_GRID_H
@@ -0,0 +1,261 @@
+#include "sparse_solver.h"
+
+#include "metrics.h"
+
+#include <Eigen/IterativeLinearSolvers>
+#include <Eigen/SparseCholesky>
+#ifdef UNWIND_USE_CHOLMOD
+#include <Eigen/CholmodSupport>
+#endif
+#ifdef UNWIND_USE_PARDISO
+#include <Eigen/PardisoSupport>
+#endif
+
+#include <chrono>
+#include <utility>
+
+
+struct SparseSolver::Factorization {
+    virtual ~Factorization() = default;
+    virtual SparseSolverBackend backend() const = 0;
+    virtual bool compute(const Eigen::SparseMatrix<double>& A) = 0;
+    virtual Eigen::VectorXd solve(const Eigen::VectorXd& b) const = 0;
+    virtual Eigen::MatrixXd solve(const Eigen::MatrixXd& b) const = 0;
+    virtual Eigen::VectorXd solve(const Eigen::VectorXd& b, const Eigen::VectorXd& /*guess*/) const { return solve(b); }
+};
+
+
+namespace {
+
+typedef Eigen::SparseMatrix<double> SparseMatrixXd;
+
+template <typename Solver, SparseSolverBackend Backend>
+struct EigenInterfaceFactorization : SparseSolver::Factorization {
+    Solver solver;
+
+    SparseSolverBackend backend() const override { return Backend; }
+
+    bool compute(const SparseMatrixXd& A) override {
+        solver.compute(A);
+        return solver.info() == Eigen::Success;
+    }
+
+    Eigen::VectorXd solve(const Eigen::VectorXd& b) const override { return solver.solve(b); }
+    Eigen::MatrixXd solve(const Eigen::MatrixXd& b) const override { return solver.solve(b); }
+};
+
+// The solves stand in for the iterations of the direct backends, ConjugateGradient also counts its iterations
+struct SolverMetrics {
+    metrics::Counter& factorizations = metrics::counter("unwind_solver_factorizations_total",
+                                                        "Sparse matrices factored");
+    metrics::Counter& factor_seconds = metrics::seconds_counter("unwind_solver_factor_seconds_total",
+                                                                "Time spent factoring sparse matrices");
+    metrics::Counter& solves = metrics::counter("unwind_solver_solves_total",
+                                                "Solves with a factored matrix, per right hand side");
+    metrics::Counter& solve_seconds = metrics::seconds_counter("unwind_solver_solve_seconds_total",
+                                                               "Time spent solving with factored matrices");
+    metrics::Counter& iterations = metrics::counter("unwind_solver_iterations_total",
+                                                    "Iterations of the conjugate gradient solves");
+};
+
+SolverMetrics& solver_metrics() {
+    static SolverMetrics instance;
+    return instance;
+}
+
+// Conjugate gradient on the whole matrix (both triangles) with an incomplete Cholesky preconditioner
+struct ConjugateGradientFactorization : SparseSolver::Factorization {
+    typedef Eigen::ConjugateGradient<SparseMatrixXd, Eigen::Lower | Eigen::Upper,
+                                     Eigen::IncompleteCholesky<double>> Solver;
+    // solve() is const in the interface, but the solver keeps the statistics of its last solve
+    mutable Solver solver;
+
+    explicit ConjugateGradientFactorization(double tolerance) { solver.setTolerance(tolerance); }
+
+    SparseSolverBackend backend() const override { return SparseSolverBackend::ConjugateGradient; }
+
+    bool compute(const SparseMatrixXd& A) override {
+        solver.compute(A);
+        return solver.info() == Eigen::Success;
+    }
+
+    Eigen::VectorXd solve(const Eigen::VectorXd& b) const override {
+        Eigen::VectorXd x = solver.solve(b);
+        solver_metrics().iterations.add(std::uint64_t(solver.iterations()));
+        return x;
+    }
+
+    Eigen::MatrixXd solve(const Eigen::MatrixXd& b) const override {
+        // Column by column, so that each one counts its own iterations
+        Eigen::MatrixXd x(b.rows(), b.cols());
+        for (Eigen::Index j = 0; j < b.cols(); j++) {
+            x.col(j) = solve(Eigen::VectorXd(b.col(j)));
+        }
+        return x;
+    }
+
+    Eigen::VectorXd solve(const Eigen::VectorXd& b, const Eigen::VectorXd& guess) const override {
+        Eigen::VectorXd x = solver.solveWithGuess(b, guess);
+        solver_metrics().iterations.add(std::uint64_t(solver.iterations()));
+        return x;
+    }
+};
+
+std::unique_ptr<SparseSolver::Factorization> make_factorization(SparseSolverBackend backend, double tolerance) {
+    switch (backend) {
+    case SparseSolverBackend::ConjugateGradient:
+        return std::unique_ptr<SparseSolver::Factorization>(new ConjugateGradientFactorization(tolerance));
+#ifdef UNWIND_USE_CHOLMOD
+    case SparseSolverBackend::Cholmod:
+        return std::unique_ptr<SparseSolver::Factorization>(
+            new EigenInterfaceFactorization<Eigen::CholmodSupernodalLLT<SparseMatrixXd>, SparseSolverBackend::Cholmod>());
+#endif
+#ifdef UNWIND_USE_PARDISO
+    case SparseSolverBackend::Pardiso:
+        return std::unique_ptr<SparseSolver::Factorization>(
+            new EigenInterfaceFactorization<Eigen::PardisoLDLT<SparseMatrixXd>, SparseSolverBackend::Pardiso>());
+#endif
+    default:
+        return std::unique_ptr<SparseSolver::Factorization>(
+            new EigenInterfaceFactorization<Eigen::SimplicialLDLT<SparseMatrixXd>, SparseSolverBackend::Eigen>());
+    }
+}
+
+double seconds_since(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+
+const char* sparse_solver_backend_name(SparseSolverBackend backend) {
+    switch (backend) {
+    case SparseSolverBackend::Cholmod:
+        return "CHOLMOD supernodal LLT";
+    case SparseSolverBackend::Pardiso:
+        return "Pardiso LDLT";
+    case SparseSolverBackend::ConjugateGradient:
+        return "incomplete Cholesky preconditioned conjugate gradient";
+    default:
+        return "Eigen simplicial LDLT";
+    }
+}
+
+bool sparse_solver_backend_available(SparseSolverBackend backend) {
+    switch (backend) {
+    case SparseSolverBackend::Cholmod:
+#ifdef UNWIND_USE_CHOLMOD
+        return true;
+#else
+        return false;
+#endif
+    case SparseSolverBackend::Pardiso:
+#ifdef UNWIND_USE_PARDISO
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+SparseSolverBackend best_sparse_solver_backend() {
+    if (sparse_solver_backend_available(SparseSolverBackend::Pardiso)) {
+        return SparseSolverBackend::Pardiso;
+    }
+    if (sparse_solver_backend_available(SparseSolverBackend::Cholmod)) {
+        return SparseSolverBackend::Cholmod;
+    }
+    return SparseSolverBackend::Eigen;
+}
+
+
+SparseSolver::SparseSolver(SparseSolverBackend backend) :
+    _requested(sparse_solver_backend_available(backend) ? backend : SparseSolverBackend::Eigen) {}
+
+SparseSolver::~SparseSolver() = default;
+SparseSolver::SparseSolver(SparseSolver&&) = default;
+SparseSolver& SparseSolver::operator=(SparseSolver&&) = default;
+
+bool SparseSolver::compute(const Eigen::SparseMatrix<double>& A, std::shared_ptr<spdlog::logger> logger,
+                           const std::string& name) {
+    _logger = std::move(logger);
+    _name = name;
+    _factor_seconds = 0.0;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _factorization = make_factorization(_requested, _tolerance);
+    bool ok = _factorization->compute(A);
+    // ConjugateGradient was asked for because a factorization would not fit, do not fall back to one
+    if (!ok && _requested != SparseSolverBackend::Eigen && _requested != SparseSolverBackend::ConjugateGradient) {
+        if (_logger) {
+            _logger->warn("{} failed to factor the {}, falling back to {}", sparse_solver_backend_name(_requested),
+                          _name, sparse_solver_backend_name(SparseSolverBackend::Eigen));
+        }
+        _factorization = make_factorization(SparseSolverBackend::Eigen, _tolerance);
+        ok = _factorization->compute(A);
+    }
+    _factor_seconds = seconds_since(start);
+    solver_metrics().factorizations.add();
+    solver_metrics().factor_seconds.add_seconds(_factor_seconds);
+
+    if (!ok) {
+        _factorization.reset();
+        if (_logger) {
+            _logger->error("Failed to factor the {} ({}x{}, {} nonzeros)", _name, A.rows(), A.cols(), A.nonZeros());
+        }
+        return false;
+    }
+    if (_logger) {
+        _logger->debug("Factored the {} ({}x{}, {} nonzeros) with {} in {:.3f}s", _name, A.rows(), A.cols(),
+                       A.nonZeros(), sparse_solver_backend_name(backend()), _factor_seconds);
+    }
+    return true;
+}
+
+bool SparseSolver::is_valid() const {
+    return _factorization != nullptr;
+}
+
+SparseSolverBackend SparseSolver::backend() const {
+    return _factorization ? _factorization->backend() : _requested;
+}
+
+Eigen::VectorXd SparseSolver::solve(const Eigen::VectorXd& b) const {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Eigen::VectorXd x = _factorization->solve(b);
+    const double seconds = seconds_since(start);
+    solver_metrics().solves.add();
+    solver_metrics().solve_seconds.add_seconds(seconds);
+    if (_logger) {
+        _logger->trace("Solved the {} with {} in {:.3f}s", _name, sparse_solver_backend_name(backend()), seconds);
+    }
+    return x;
+}
+
+Eigen::VectorXd SparseSolver::solve(const Eigen::VectorXd& b, const Eigen::VectorXd& guess) const {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Eigen::VectorXd x = _factorization->solve(b, guess);
+    const double seconds = seconds_since(start);
+    solver_metrics().solves.add();
+    solver_metrics().solve_seconds.add_seconds(seconds);
+    if (_logger) {
+        _logger->trace("Solved the {} from a guess with {} in {:.3f}s", _name, sparse_solver_backend_name(backend()),
+                       seconds);
+    }
+    return x;
+}
+
+Eigen::MatrixXd SparseSolver::solve(const Eigen::MatrixXd& b) const {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Eigen::MatrixXd x = _factorization->solve(b);
+    const double seconds = seconds_since(start);
+    solver_metrics().solves.add(std::uint64_t(b.cols()));
+    solver_metrics().solve_seconds.add_seconds(seconds);
+    if (_logger) {
+        _logger->trace("Solved the {} for {} right hand sides with {} in {:.3f}s", _name, b.cols(),
+                       sparse_solver_backend_name(backend()), seconds);
+    }
+    return x;
+}
@@ -0,0 +1,77 @@
+#ifndef SPARSE_SOLVER_H
+#define SPARSE_SOLVER_H
+
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <string>
+
+// Sparse direct solvers the build can provide. CHOLMOD (UNWIND_USE_CHOLMOD) factors with its supernodal
+// Cholesky, which runs its dense blocks through BLAS and so uses as many threads as the BLAS it is linked
+// against. Pardiso (UNWIND_USE_PARDISO) comes with MKL and is multi-threaded itself. Eigen's simplicial LDLT is
+// always there and single-threaded.
+//
+// ConjugateGradient is not a factorization: it is Eigen's conjugate gradient preconditioned with an incomplete
+// Cholesky factorization, which has no more fill than the matrix. Its memory grows linearly with the mesh where
+// the direct factorizations run out of memory on multi-million vertex meshes, at the cost of solves that are only
+// accurate to the tolerance. It is always available but never picked by best_sparse_solver_backend().
+enum class SparseSolverBackend {
+    Eigen,
+    Cholmod,
+    Pardiso,
+    ConjugateGradient,
+};
+
+const char* sparse_solver_backend_name(SparseSolverBackend backend);
+bool sparse_solver_backend_available(SparseSolverBackend backend);
+
+// Pardiso if it was built in, then CHOLMOD, then Eigen
+SparseSolverBackend best_sparse_solver_backend();
+
+// Factorization of a symmetric positive (semi-)definite sparse matrix for repeated solves, with the backend
+// picked at run time among the ones built in. A factorization that fails with CHOLMOD or Pardiso, such as one
+// of a singular semi-definite matrix, is retried with Eigen's LDLT, which copes with the constant kernel of the
+// normal equations and Laplacians we solve.
+//
+// With a logger, the backend and the time to factor are logged at debug level, and each solve at trace level.
+class SparseSolver {
+public:
+    explicit SparseSolver(SparseSolverBackend backend = best_sparse_solver_backend());
+    ~SparseSolver();
+
+    SparseSolver(SparseSolver&&);
+    SparseSolver& operator=(SparseSolver&&);
+
+    // name describes the matrix in the log
+    bool compute(const Eigen::SparseMatrix<double>& A, std::shared_ptr<spdlog::logger> logger = nullptr,
+                 const std::string& name = "matrix");
+
+    bool is_valid() const;
+
+    // Backend of the current factorization, which differs from the requested one after a fallback
+    SparseSolverBackend backend() const;
+    double factor_seconds() const { return _factor_seconds; }
+
+    Eigen::VectorXd solve(const Eigen::VectorXd& b) const;
+    Eigen::MatrixXd solve(const Eigen::MatrixXd& b) const;
+    // Starts the iterations of ConjugateGradient from guess, the direct backends ignore it
+    Eigen::VectorXd solve(const Eigen::VectorXd& b, const Eigen::VectorXd& guess) const;
+
+    // Relative residual the solves of ConjugateGradient stop at, set before compute()
+    void set_tolerance(double tolerance) { _tolerance = tolerance; }
+    double tolerance() const { return _tolerance; }
+
+    struct Factorization;
+
+private:
+    SparseSolverBackend _requested;
+    std::unique_ptr<Factorization> _factorization;
+    double _factor_seconds = 0.0;
+    double _tolerance = 1e-6;
+    std::shared_ptr<spdlog::logger> _logger;
+    std::string _name;
+};
+
+#endif // SPARSE_SOLVER_H
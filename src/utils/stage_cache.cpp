@@ -0,0 +1,153 @@
+#include "stage_cache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "path_utils.h"
+
+
+namespace {
+
+const char* INDEX_FILENAME = "index.txt";
+
+// Jobs cancelled while they store an entry keep running next to the next one, they take turns on the directory
+std::mutex& cache_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Entries of the index, one "<name> <bytes>" line each from the least to the most recently used
+typedef std::vector<std::pair<std::string, std::uint64_t>> CacheIndex;
+
+CacheIndex read_index(const std::string& filename) {
+    CacheIndex index;
+    std::ifstream in(filename);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        std::uint64_t bytes = 0;
+        if (fields >> name >> bytes) {
+            index.emplace_back(name, bytes);
+        }
+    }
+    return index;
+}
+
+bool write_index(const std::string& filename, const CacheIndex& index) {
+    const std::string tmp_filename = filename + ".tmp";
+    {
+        std::ofstream out(tmp_filename);
+        for (const std::pair<std::string, std::uint64_t>& entry : index) {
+            out << entry.first << " " << entry.second << "\n";
+        }
+        if (!out) {
+            std::remove(tmp_filename.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t file_size(const std::string& filename) {
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? std::uint64_t(info.st_size) : 0;
+}
+
+} // namespace
+
+
+std::string StageCache::entry_filename(const std::string& stage, std::uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016" PRIx64, key);
+    return stage + "-" + name + ".fish.stage";
+}
+
+bool StageCache::load(const std::string& stage, std::uint64_t key, ProjectFile& file,
+                      std::shared_ptr<spdlog::logger> logger) const {
+    if (!enabled()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex());
+    const std::string name = entry_filename(stage, key);
+    const std::string filename = _directory + "/" + name;
+    if (get_file_type(filename.c_str()) != FT_REGULAR_FILE) {
+        return false;
+    }
+    if (!file.open(filename, logger)) {
+        // Unreadable entries are dropped, the stage stores a new one
+        file.close();
+        std::remove(filename.c_str());
+        touch(name, 0, logger);
+        return false;
+    }
+    touch(name, file_size(filename), logger);
+    return true;
+}
+
+bool StageCache::store(const std::string& stage, std::uint64_t key, const ProjectFileWriter& writer,
+                       std::shared_ptr<spdlog::logger> logger) const {
+    if (!enabled()) {
+        return false;
+    }
+    if (mkpath(_directory.c_str()) != 0) {
+        logger->warn("Cannot create the stage cache directory '{}'", _directory);
+        return false;
+    }
+    // Written next to the entry and renamed, so a load never sees half an entry
+    std::lock_guard<std::mutex> lock(cache_mutex());
+    const std::string name = entry_filename(stage, key);
+    const std::string filename = _directory + "/" + name;
+    const std::string tmp_filename = filename + ".tmp";
+    if (!writer.write(tmp_filename, logger) || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        logger->warn("Cannot write the stage cache entry '{}'", filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    touch(name, file_size(filename), logger);
+    return true;
+}
+
+void StageCache::touch(const std::string& name, std::uint64_t bytes, std::shared_ptr<spdlog::logger> logger) const {
+    const std::string index_filename = _directory + "/" + INDEX_FILENAME;
+    CacheIndex index = read_index(index_filename);
+    CacheIndex kept;
+    kept.reserve(index.size() + 1);
+    for (const std::pair<std::string, std::uint64_t>& entry : index) {
+        if (entry.first != name) {
+            kept.push_back(entry);
+        }
+    }
+    if (bytes > 0) {
+        kept.emplace_back(name, bytes);
+    }
+
+    // The entry just used is the last one and stays even if it is larger than the limit on its own
+    std::uint64_t total_bytes = 0;
+    for (const std::pair<std::string, std::uint64_t>& entry : kept) {
+        total_bytes += entry.second;
+    }
+    std::size_t num_evicted = 0;
+    while (total_bytes > _max_bytes && num_evicted + 1 < kept.size()) {
+        const std::string filename = _directory + "/" + kept[num_evicted].first;
+        std::remove(filename.c_str());
+        total_bytes -= kept[num_evicted].second;
+        num_evicted++;
+    }
+    kept.erase(kept.begin(), kept.begin() + std::ptrdiff_t(num_evicted));
+    if (num_evicted > 0) {
+        logger->debug("Evicted {} stage cache entries from '{}'", num_evicted, _directory);
+    }
+    if (!write_index(index_filename, kept)) {
+        logger->warn("Cannot update the stage cache index '{}'", index_filename);
+    }
+}
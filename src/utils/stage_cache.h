@@ -0,0 +1,56 @@
+#ifndef STAGE_CACHE_H
+#define STAGE_CACHE_H
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "project_file.h"
+
+// On-disk cache of the outputs of the stages of a pipeline, addressed by a hash of everything each output depends
+// on. An entry is a project file (see project_file.h) named after its stage and key, so switching back to inputs
+// which were processed before reads the outputs back instead of recomputing them.
+//
+// The directory holds an index of the entries from the least to the most recently used. Once the entries take
+// more than max_bytes, the least recently used ones are deleted. The threads of a process take turns on the
+// cache, but only one process at a time may use a directory.
+class StageCache {
+public:
+    StageCache() = default;
+    StageCache(std::string directory, std::uint64_t max_bytes) : _directory(std::move(directory)), _max_bytes(max_bytes) {}
+
+    bool enabled() const { return !_directory.empty(); }
+
+    // Open the entry of stage for key, returns false if there is none
+    bool load(const std::string& stage, std::uint64_t key, ProjectFile& file,
+              std::shared_ptr<spdlog::logger> logger) const;
+    // Write the sections of writer as the entry of stage for key, replacing any previous one
+    bool store(const std::string& stage, std::uint64_t key, const ProjectFileWriter& writer,
+               std::shared_ptr<spdlog::logger> logger) const;
+
+private:
+    std::string entry_filename(const std::string& stage, std::uint64_t key) const;
+    // Move the entry to the back of the index, or remove it if bytes is 0, and evict entries over the limit
+    void touch(const std::string& name, std::uint64_t bytes, std::shared_ptr<spdlog::logger> logger) const;
+
+    std::string _directory;
+    std::uint64_t _max_bytes = 0;
+};
+
+// FNV-1a over the bytes of the values hashed in, for the keys of the entries
+struct KeyHash {
+    std::uint64_t hash = 14695981039346656037ull;
+
+    template <typename T>
+    void add(const T& value) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+};
+
+#endif // STAGE_CACHE_H
@@ -0,0 +1,225 @@
+#include "surface_ray_index.h"
+
+#include <Eigen/Geometry>
+#include <igl/unproject_ray.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace {
+
+// Faces per leaf of the hierarchy
+constexpr int FaceLeafSize = 4;
+
+// The hierarchy is split at the median so its depth is about log2(#faces / FaceLeafSize)
+constexpr int MaxDepth = 64;
+
+// Range [t_enter, t_exit] of the ray source + t * dir in the box, empty if t_enter > t_exit. inv_dir is the
+// componentwise inverse of dir, infinite components make the slabs parallel to the ray all or nothing.
+void ray_box(const Eigen::Vector3d& source, const Eigen::Vector3d& inv_dir, const Eigen::Vector3d& box_min,
+             const Eigen::Vector3d& box_max, double& t_enter, double& t_exit) {
+    t_enter = 0.0;
+    t_exit = std::numeric_limits<double>::infinity();
+    for (int a = 0; a < 3; a++) {
+        double t0 = (box_min[a] - source[a]) * inv_dir[a];
+        double t1 = (box_max[a] - source[a]) * inv_dir[a];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        // NaN when the source lies on a slab parallel to the ray, which does not clip the range
+        if (t0 > t_enter) {
+            t_enter = t0;
+        }
+        if (t1 < t_exit) {
+            t_exit = t1;
+        }
+    }
+}
+
+// Moller-Trumbore intersection of the ray with the triangle v0, v1, v2, on either side. Returns false if they
+// miss or the hit is behind the source, otherwise t, u and v of the hit v0 + u (v1 - v0) + v (v2 - v0).
+bool ray_triangle(const Eigen::Vector3d& source, const Eigen::Vector3d& dir, const Eigen::Vector3d& v0,
+                  const Eigen::Vector3d& v1, const Eigen::Vector3d& v2, double& t, double& u, double& v) {
+    const Eigen::Vector3d e1 = v1 - v0;
+    const Eigen::Vector3d e2 = v2 - v0;
+    const Eigen::Vector3d p = dir.cross(e2);
+    const double det = e1.dot(p);
+    if (det == 0.0) {
+        return false;
+    }
+    const double inv_det = 1.0 / det;
+    const Eigen::Vector3d s = source - v0;
+    u = s.dot(p) * inv_det;
+    if (u < 0.0 || u > 1.0) {
+        return false;
+    }
+    const Eigen::Vector3d q = s.cross(e1);
+    v = dir.dot(q) * inv_det;
+    if (v < 0.0 || u + v > 1.0) {
+        return false;
+    }
+    t = e2.dot(q) * inv_det;
+    return t >= 0.0;
+}
+
+} // namespace
+
+
+void SurfaceRayIndex::clear() {
+    _V.resize(0, 3);
+    _F.resize(0, 3);
+    _nodes.clear();
+    _order.clear();
+}
+
+
+void SurfaceRayIndex::build(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F) {
+    clear();
+    if (F.rows() == 0) {
+        return;
+    }
+    _V = V;
+    _F = F;
+
+    const int num_faces = static_cast<int>(F.rows());
+    std::vector<Eigen::Vector3d> centroids(num_faces), face_min(num_faces), face_max(num_faces);
+    for (int f = 0; f < num_faces; f++) {
+        face_min[f] = face_max[f] = V.row(F(f, 0)).transpose();
+        centroids[f].setZero();
+        for (int k = 0; k < 3; k++) {
+            const Eigen::Vector3d x = V.row(F(f, k)).transpose();
+            face_min[f] = face_min[f].cwiseMin(x);
+            face_max[f] = face_max[f].cwiseMax(x);
+            centroids[f] += x / 3.0;
+        }
+    }
+
+    _order.resize(num_faces);
+    for (int f = 0; f < num_faces; f++) {
+        _order[f] = f;
+    }
+    _nodes.reserve(2 * (num_faces / FaceLeafSize + 1));
+    build_node(centroids, face_min, face_max, 0, num_faces);
+}
+
+
+int SurfaceRayIndex::build_node(const std::vector<Eigen::Vector3d>& centroids,
+                                const std::vector<Eigen::Vector3d>& face_min,
+                                const std::vector<Eigen::Vector3d>& face_max, int begin, int end) {
+    const int node = static_cast<int>(_nodes.size());
+    _nodes.emplace_back();
+
+    Eigen::Vector3d box_min = face_min[_order[begin]];
+    Eigen::Vector3d box_max = face_max[_order[begin]];
+    Eigen::Vector3d ctr_min = centroids[_order[begin]];
+    Eigen::Vector3d ctr_max = ctr_min;
+    for (int i = begin + 1; i < end; i++) {
+        const int f = _order[i];
+        box_min = box_min.cwiseMin(face_min[f]);
+        box_max = box_max.cwiseMax(face_max[f]);
+        ctr_min = ctr_min.cwiseMin(centroids[f]);
+        ctr_max = ctr_max.cwiseMax(centroids[f]);
+    }
+    _nodes[node].box_min = box_min;
+    _nodes[node].box_max = box_max;
+    _nodes[node].begin = begin;
+    _nodes[node].end = end;
+    _nodes[node].right = -1;
+
+    int axis;
+    const double extent = (ctr_max - ctr_min).maxCoeff(&axis);
+    if (end - begin <= FaceLeafSize || extent <= 0.0) {
+        return node;
+    }
+
+    // Split at the median centroid along the longest side, which keeps the tree balanced
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(_order.begin() + begin, _order.begin() + mid, _order.begin() + end,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    build_node(centroids, face_min, face_max, begin, mid);
+    const int right = build_node(centroids, face_min, face_max, mid, end);
+    _nodes[node].right = right;
+    return node;
+}
+
+
+bool SurfaceRayIndex::intersect_ray(const Eigen::Vector3d& source, const Eigen::Vector3d& dir, int& fid,
+                                    Eigen::Vector3d& bc) const {
+    if (empty() || dir.squaredNorm() == 0.0) {
+        return false;
+    }
+    const Eigen::Vector3d inv_dir = dir.cwiseInverse();
+
+    double best_t = std::numeric_limits<double>::infinity();
+    int best = -1;
+    double best_u = 0.0, best_v = 0.0;
+
+    // Nodes still to visit with where the ray enters their box, the nearer child is visited first
+    std::pair<int, double> stack[2 * MaxDepth];
+    int stack_size = 0;
+    double t_enter, t_exit;
+    ray_box(source, inv_dir, _nodes[0].box_min, _nodes[0].box_max, t_enter, t_exit);
+    if (t_enter <= t_exit) {
+        stack[stack_size++] = std::make_pair(0, t_enter);
+    }
+    while (stack_size > 0) {
+        const std::pair<int, double> entry = stack[--stack_size];
+        if (entry.second > best_t) {
+            continue;
+        }
+        const Node& node = _nodes[entry.first];
+        if (node.right < 0) {
+            for (int i = node.begin; i < node.end; i++) {
+                const int f = _order[i];
+                double t, u, v;
+                if (ray_triangle(source, dir, _V.row(_F(f, 0)).transpose(), _V.row(_F(f, 1)).transpose(),
+                                 _V.row(_F(f, 2)).transpose(), t, u, v) &&
+                        (t < best_t || (t == best_t && f < best))) {
+                    best_t = t;
+                    best = f;
+                    best_u = u;
+                    best_v = v;
+                }
+            }
+            continue;
+        }
+
+        const int children[2] = { entry.first + 1, node.right };
+        double enter[2];
+        bool hit[2];
+        for (int c = 0; c < 2; c++) {
+            ray_box(source, inv_dir, _nodes[children[c]].box_min, _nodes[children[c]].box_max, enter[c], t_exit);
+            hit[c] = enter[c] <= t_exit && enter[c] <= best_t;
+        }
+        // Push the farther child first so the nearer one is popped next
+        const int first = enter[0] <= enter[1] ? 0 : 1;
+        for (int c : { 1 - first, first }) {
+            if (hit[c] && stack_size < 2 * MaxDepth) {
+                stack[stack_size++] = std::make_pair(children[c], enter[c]);
+            }
+        }
+    }
+
+    if (best < 0) {
+        return false;
+    }
+    fid = best;
+    bc = Eigen::Vector3d(1.0 - best_u - best_v, best_u, best_v);
+    return true;
+}
+
+
+bool SurfaceRayIndex::unproject_onto_mesh(const Eigen::Vector2f& pos, const Eigen::Matrix4f& model,
+                                          const Eigen::Matrix4f& proj, const Eigen::Vector4f& viewport, int& fid,
+                                          Eigen::Vector3f& bc) const {
+    Eigen::Vector3f source, dir;
+    igl::unproject_ray(pos, model, proj, viewport, source, dir);
+    Eigen::Vector3d hit_bc;
+    if (!intersect_ray(source.cast<double>(), dir.cast<double>(), fid, hit_bc)) {
+        return false;
+    }
+    bc = hit_bc.cast<float>();
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef SURFACE_RAY_INDEX_H
+#define SURFACE_RAY_INDEX_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+// Ray casting on a fixed triangle mesh, e.g. the boundary faces of a tet mesh, for picking with the mouse. A
+// bounding volume hierarchy over the triangles is built in O(n log n) and a ray visits the boxes it crosses from
+// the nearest one, skipping those behind the closest hit so far, so a query is about O(log n) on a surface
+// instead of the test against every face of igl::ray_mesh_intersect.
+//
+// The index keeps a copy of the mesh, so it can be built on a background thread while V and F change.
+class SurfaceRayIndex {
+public:
+    SurfaceRayIndex() = default;
+    SurfaceRayIndex(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F) { build(V, F); }
+
+    void build(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F);
+    void clear();
+
+    bool empty() const { return _nodes.empty(); }
+    int num_vertices() const { return int(_V.rows()); }
+    int num_faces() const { return int(_F.rows()); }
+
+    // Closest hit of the ray source + t * dir, t >= 0, with the mesh. Returns false if it misses, otherwise fid
+    // gets the face and bc the weights (1 - u - v, u, v) of its 3 vertices at the hit, as igl::unproject_onto_mesh.
+    bool intersect_ray(const Eigen::Vector3d& source, const Eigen::Vector3d& dir, int& fid, Eigen::Vector3d& bc) const;
+
+    // The ray under the pixel pos of the viewport through model, proj, as igl::unproject_onto_mesh casts it
+    bool unproject_onto_mesh(const Eigen::Vector2f& pos, const Eigen::Matrix4f& model, const Eigen::Matrix4f& proj,
+                             const Eigen::Vector4f& viewport, int& fid, Eigen::Vector3f& bc) const;
+
+private:
+    // Same layout as the tet hierarchy of TetMeshSpatialIndex: the left child directly follows its parent and
+    // right is the index of the right child. Leaves have right = -1 and hold the faces [begin, end) of _order.
+    struct Node {
+        Eigen::Vector3d box_min;
+        Eigen::Vector3d box_max;
+        int begin;
+        int end;
+        int right;
+    };
+
+    Eigen::MatrixXd _V;
+    Eigen::MatrixXi _F;
+
+    std::vector<Node> _nodes;
+    std::vector<int> _order;
+
+    int build_node(const std::vector<Eigen::Vector3d>& centroids, const std::vector<Eigen::Vector3d>& face_min,
+                   const std::vector<Eigen::Vector3d>& face_max, int begin, int end);
+};
+
+#endif // SURFACE_RAY_INDEX_H
@@ -0,0 +1,255 @@
+#include "task_scheduler.h"
+
+#include <vor3d/Parallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int hardware_threads() {
+    const unsigned int hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : int(hw);
+}
+
+struct Scheduler {
+    // Threads of a parallel loop including its calling thread, 0 until it is first needed
+    std::atomic_int num_threads{ 0 };
+    // Interactive tasks queued and not started yet, read by bulk loops between their items
+    std::atomic_int num_interactive_queued{ 0 };
+
+    // Guards everything below
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> interactive_queue;
+    std::deque<std::function<void()>> bulk_queue;
+    int num_bulk_running = 0;
+    bool stopping = false;
+    // Workers beyond num_threads - 1 left over from an earlier setting stay idle
+    std::vector<std::thread> workers;
+
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int max_bulk_running() const {
+        return std::max(int(workers_wanted()) - 1, 1);
+    }
+
+    std::size_t workers_wanted() const {
+        return std::size_t(std::max(num_threads.load() - 1, 1));
+    }
+
+    // Must be called with the mutex held
+    bool can_run(std::size_t index) const {
+        if (index >= workers_wanted()) {
+            return false;
+        }
+        return !interactive_queue.empty() || (!bulk_queue.empty() && num_bulk_running < max_bulk_running());
+    }
+
+    // Must be called with the mutex held
+    void start_workers() {
+        while (workers.size() < workers_wanted()) {
+            workers.emplace_back(&Scheduler::run_worker, this, workers.size());
+        }
+    }
+
+    void run_worker(std::size_t index);
+};
+
+Scheduler& scheduler() {
+    static Scheduler s;
+    return s;
+}
+
+thread_local TaskLane thread_lane = TaskLane::Bulk;
+
+void Scheduler::run_worker(std::size_t index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&]() { return stopping || can_run(index); });
+        if (stopping) {
+            return;
+        }
+        const bool interactive = !interactive_queue.empty();
+        std::deque<std::function<void()>>& queue = interactive ? interactive_queue : bulk_queue;
+        std::function<void()> task = std::move(queue.front());
+        queue.pop_front();
+        if (interactive) {
+            num_interactive_queued -= 1;
+        } else {
+            num_bulk_running += 1;
+        }
+        lock.unlock();
+
+        thread_lane = interactive ? TaskLane::Interactive : TaskLane::Bulk;
+        task();
+        task = nullptr;
+
+        lock.lock();
+        if (!interactive) {
+            num_bulk_running -= 1;
+            // A bulk task waiting for a free slot may start now
+            wake.notify_all();
+        }
+    }
+}
+
+// Items of a parallel_tasks loop. The workers keep it alive, body is only used while an item is left.
+struct Loop {
+    std::atomic<std::size_t> next{ 0 };
+    std::size_t n = 0;
+    const std::function<void(std::size_t)>* body = nullptr;
+    TaskLane lane = TaskLane::Bulk;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::size_t num_done = 0;
+};
+
+void run_items(const std::shared_ptr<Loop>& loop, bool worker) {
+    Scheduler& s = scheduler();
+    std::size_t num_done = 0;
+    for (;;) {
+        if (worker && loop->lane == TaskLane::Bulk && s.num_interactive_queued > 0) {
+            // Hand the worker to the interactive task and queue the rest of the loop behind it
+            if (loop->next < loop->n) {
+                submit_task(TaskLane::Bulk, [loop]() { run_items(loop, true); });
+            }
+            break;
+        }
+        const std::size_t i = loop->next++;
+        if (i >= loop->n) {
+            break;
+        }
+        (*loop->body)(i);
+        num_done++;
+    }
+    if (num_done > 0) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->num_done += num_done;
+        if (loop->num_done == loop->n) {
+            loop->finished.notify_all();
+        }
+    }
+}
+
+} // namespace
+
+
+bool init_task_scheduler(std::shared_ptr<spdlog::logger> logger) {
+    const char* threads = std::getenv("FISH_THREADS");
+    if (threads != nullptr && threads[0] != '\0') {
+        const int num_threads = std::atoi(threads);
+        if (num_threads > 0) {
+            set_task_threads(num_threads);
+        } else {
+            logger->warn("Ignoring FISH_THREADS '{}', it is not a positive number of threads", threads);
+        }
+    }
+
+    // The sweeps of the dilation share the workers instead of starting threads of their own
+    vor3d::setTaskRunner([](uint32_t num_tasks, int num_threads, const std::function<void(uint32_t)>& body) {
+        parallel_tasks(num_tasks, [&body](std::size_t i) { body(uint32_t(i)); }, num_threads);
+    });
+    logger->info("Running parallel work on {} threads", task_threads());
+    return true;
+}
+
+void set_task_threads(int num_threads) {
+    Scheduler& s = scheduler();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.num_threads = num_threads > 0 ? num_threads : hardware_threads();
+        if (!s.workers.empty()) {
+            s.start_workers();
+        }
+    }
+    s.wake.notify_all();
+}
+
+int task_threads() {
+    Scheduler& s = scheduler();
+    int num_threads = s.num_threads;
+    if (num_threads == 0) {
+        int expected = 0;
+        s.num_threads.compare_exchange_strong(expected, hardware_threads());
+        num_threads = s.num_threads;
+    }
+    return num_threads;
+}
+
+int task_lane_threads(TaskLane lane) {
+    // The calling thread of a loop does not count against the workers of its lane
+    const int num_threads = task_threads();
+    return lane == TaskLane::Interactive ? num_threads : std::max(num_threads - 1, 1);
+}
+
+TaskLane current_task_lane() {
+    return thread_lane;
+}
+
+TaskLaneScope::TaskLaneScope(TaskLane lane) : _previous(thread_lane) {
+    thread_lane = lane;
+}
+
+TaskLaneScope::~TaskLaneScope() {
+    thread_lane = _previous;
+}
+
+void submit_task(TaskLane lane, std::function<void()> task) {
+    Scheduler& s = scheduler();
+    task_threads();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.start_workers();
+        if (lane == TaskLane::Interactive) {
+            s.interactive_queue.push_back(std::move(task));
+            s.num_interactive_queued += 1;
+        } else {
+            s.bulk_queue.push_back(std::move(task));
+        }
+    }
+    // Idle workers beyond the current setting ignore the task, so wake every worker
+    s.wake.notify_all();
+}
+
+void parallel_tasks(std::size_t n, const std::function<void(std::size_t)>& body, int max_threads) {
+    if (n == 0) {
+        return;
+    }
+    const int num_threads = max_threads > 0 ? std::min(max_threads, task_threads()) : task_threads();
+    const std::size_t num_helpers = std::min(std::size_t(std::max(num_threads - 1, 0)), n - 1);
+    if (num_helpers == 0) {
+        for (std::size_t i = 0; i < n; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+    loop->n = n;
+    loop->body = &body;
+    loop->lane = thread_lane;
+    for (std::size_t i = 0; i < num_helpers; i++) {
+        submit_task(loop->lane, [loop]() { run_items(loop, true); });
+    }
+    run_items(loop, false);
+
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&]() { return loop->num_done == loop->n; });
+}
@@ -0,0 +1,60 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+// Pool of worker threads shared by all the parallel work of the application: parallel_for_chunks, the sweeps of
+// vor3d and the tasks of the background jobs. Before, every parallel loop started its own threads, so a meshing
+// job and a picking index build running at the same time oversubscribed the cores twice over.
+//
+// Tasks are queued in one of two lanes. Workers always take interactive tasks, such as picking or a skeleton
+// update, before bulk ones, such as meshing or loading a project, and bulk tasks never take the last worker, so
+// an interactive task starts right away while the bulk lane is saturated. The workers of a parallel loop take
+// its items off a shared counter, and a bulk loop hands its worker back between two items whenever an
+// interactive task is waiting.
+enum class TaskLane {
+    Interactive,
+    Bulk,
+};
+
+// Start using the scheduler for the vor3d sweeps. The environment variable FISH_THREADS sets the number of
+// worker threads, it defaults to every hardware thread.
+bool init_task_scheduler(std::shared_ptr<spdlog::logger> logger);
+
+// Number of threads parallel work runs on, the calling thread of a parallel loop included. 0 uses every
+// hardware thread. Can be changed at any time, tasks already running are not interrupted.
+void set_task_threads(int num_threads);
+int task_threads();
+// Number of those a lane may keep busy at once
+int task_lane_threads(TaskLane lane);
+
+// Lane of the tasks queued by parallel loops on the calling thread. Tasks run in the lane they were queued in,
+// other threads are in the bulk lane unless they are in a TaskLaneScope.
+TaskLane current_task_lane();
+
+// Puts the calling thread into a lane until the scope ends
+class TaskLaneScope {
+public:
+    explicit TaskLaneScope(TaskLane lane);
+    ~TaskLaneScope();
+    TaskLaneScope(const TaskLaneScope&) = delete;
+    TaskLaneScope& operator=(const TaskLaneScope&) = delete;
+
+private:
+    TaskLane _previous;
+};
+
+// Run task on a worker of the lane. Tasks should not block on anything but their own parallel loops.
+void submit_task(TaskLane lane, std::function<void()> task);
+
+// Call body(i) for every i in [0, n), on the calling thread and on the workers in the lane of the calling thread,
+// and return once all calls have returned. At most max_threads threads work on the loop, 0 allows task_threads().
+// The calling thread takes part, so loops can be nested and called from any thread without waiting for a free
+// worker.
+void parallel_tasks(std::size_t n, const std::function<void(std::size_t)>& body, int max_threads = 0);
+
+#endif // TASK_SCHEDULER_H
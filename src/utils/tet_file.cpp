@@ -0,0 +1,375 @@
+#include "tet_file.h"
+
+#include "parallel_for.h"
+#include "raw_volume_view.h"
+#include "utils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <locale>
+#include <sstream>
+#include <vector>
+
+
+namespace {
+
+const char TETB_MAGIC[8] = { 'T', 'E', 'T', 'B', 'I', 'N', '\0', '\0' };
+constexpr std::uint32_t TETB_VERSION = 1;
+
+struct TetbHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t num_vertices;
+    std::uint64_t num_tets;
+    std::uint64_t num_faces;
+};
+
+// Chunks of the text are at least this large, so small files are parsed on the calling thread
+constexpr std::size_t MinTextChunkSize = 1 << 20;
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Skip spaces and tabs, but not the end of the line
+void skip_spaces(const char*& p, const char* end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool parse_int(const char*& p, const char* end, int& value) {
+    skip_spaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || !is_digit(*p)) {
+        return false;
+    }
+    std::int64_t v = 0;
+    while (p < end && is_digit(*p)) {
+        v = 10 * v + (*p - '0');
+        if (v > INT32_MAX) {
+            return false;
+        }
+        p++;
+    }
+    value = static_cast<int>(negative ? -v : v);
+    return true;
+}
+
+// Parse a decimal floating point number. Numbers with at most 15 significant digits and a decimal exponent of at
+// most 22 are converted exactly with a single multiplication or division by an exact power of ten, which covers
+// everything Quartet writes. Anything else goes through the (slower) standard library in the classic locale.
+bool parse_double(const char*& p, const char* end, double& value) {
+    static const double exact_powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    skip_spaces(p, end);
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    std::uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    while (p < end && is_digit(*p)) {
+        any_digit = true;
+        if (mantissa != 0 || *p != '0') {
+            if (num_digits < 19) {
+                mantissa = 10 * mantissa + (*p - '0');
+            } else {
+                exponent++;
+            }
+            num_digits++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && is_digit(*p)) {
+            any_digit = true;
+            if (mantissa != 0 || *p != '0') {
+                if (num_digits < 19) {
+                    mantissa = 10 * mantissa + (*p - '0');
+                    exponent--;
+                }
+                num_digits++;
+            } else {
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (!any_digit) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int e = 0;
+        if (!parse_int(p, end, e)) {
+            return false;
+        }
+        exponent += e;
+    }
+
+    if (num_digits <= 15 && exponent >= -22 && exponent <= 22) {
+        const double m = static_cast<double>(mantissa);
+        value = exponent >= 0 ? m * exact_powers_of_ten[exponent] : m / exact_powers_of_ten[-exponent];
+        value = negative ? -value : value;
+        return true;
+    }
+
+    std::istringstream is(std::string(start, p));
+    is.imbue(std::locale::classic());
+    is >> value;
+    return !is.fail();
+}
+
+// Line ranges of the text, starting and ending at line boundaries
+std::vector<std::pair<const char*, const char*>> split_lines(const char* begin, const char* end) {
+    const std::size_t size = static_cast<std::size_t>(end - begin);
+    const std::size_t num_chunks = parallel_num_chunks(size, MinTextChunkSize);
+    std::vector<std::pair<const char*, const char*>> chunks;
+    const char* chunk_begin = begin;
+    for (std::size_t c = 1; c <= num_chunks && chunk_begin < end; c++) {
+        const char* chunk_end = c == num_chunks ? end : begin + c * size / num_chunks;
+        if (chunk_end < chunk_begin) {
+            chunk_end = chunk_begin;
+        }
+        const char* newline = static_cast<const char*>(std::memchr(chunk_end, '\n', end - chunk_end));
+        chunk_end = newline == nullptr ? end : newline + 1;
+        chunks.emplace_back(chunk_begin, chunk_end);
+        chunk_begin = chunk_end;
+    }
+    return chunks;
+}
+
+const char* line_end(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline == nullptr ? end : newline;
+}
+
+bool is_blank(const char* p, const char* end) {
+    skip_spaces(p, end);
+    return p == end;
+}
+
+bool load_tet_text(const std::string& filename, Eigen::MatrixXd& TV, Eigen::MatrixXi& TT,
+                   std::shared_ptr<spdlog::logger> logger) {
+    RawVolumeView view;
+    if (!view.open(filename, logger)) {
+        return false;
+    }
+    const char* p = reinterpret_cast<const char*>(view.data());
+    const char* const end = p + view.size();
+
+    // Header: a word and the number of vertices and tets, possibly on separate lines
+    while (p < end && (is_space(*p) || *p == '\n')) {
+        p++;
+    }
+    while (p < end && !is_space(*p) && *p != '\n') {
+        p++;
+    }
+    int nv = -1, nt = -1;
+    for (int* count : { &nv, &nt }) {
+        while (p < end && (is_space(*p) || *p == '\n')) {
+            p++;
+        }
+        if (!parse_int(p, end, *count) || *count < 0) {
+            logger->error("Tet file '{}' has an invalid header.", filename);
+            return false;
+        }
+    }
+    p = line_end(p, end);
+
+    // Count the records of every chunk, then parse them all in parallel knowing where each one goes
+    const std::vector<std::pair<const char*, const char*>> chunks = split_lines(p, end);
+    std::vector<int> first_record(chunks.size() + 1, 0);
+    parallel_for_chunks(chunks.size(), [&](std::size_t begin, std::size_t chunk_end, std::size_t) {
+        for (std::size_t c = begin; c < chunk_end; c++) {
+            int count = 0;
+            for (const char* line = chunks[c].first; line < chunks[c].second;) {
+                const char* eol = line_end(line, chunks[c].second);
+                count += is_blank(line, eol) ? 0 : 1;
+                line = eol + 1;
+            }
+            first_record[c + 1] = count;
+        }
+    }, 1);
+    for (std::size_t c = 0; c < chunks.size(); c++) {
+        first_record[c + 1] += first_record[c];
+    }
+    if (first_record.back() != nv + nt) {
+        logger->error("Tet file '{}' has {} records, but its header announces {} vertices and {} tets.",
+                      filename, first_record.back(), nv, nt);
+        return false;
+    }
+
+    TV.resize(nv, 3);
+    TT.resize(nt, 4);
+    std::atomic<int> bad_record{ -1 };
+    parallel_for_chunks(chunks.size(), [&](std::size_t begin, std::size_t chunk_end, std::size_t) {
+        for (std::size_t c = begin; c < chunk_end && bad_record < 0; c++) {
+            int record = first_record[c];
+            for (const char* line = chunks[c].first; line < chunks[c].second;) {
+                const char* eol = line_end(line, chunks[c].second);
+                if (!is_blank(line, eol)) {
+                    const char* q = line;
+                    bool ok = true;
+                    if (record < nv) {
+                        for (int k = 0; k < 3 && ok; k++) {
+                            ok = parse_double(q, eol, TV(record, k));
+                        }
+                    } else {
+                        for (int k = 0; k < 4 && ok; k++) {
+                            ok = parse_int(q, eol, TT(record - nv, k));
+                            ok = ok && TT(record - nv, k) >= 0 && TT(record - nv, k) < nv;
+                        }
+                    }
+                    if (!ok) {
+                        bad_record = record;
+                        return;
+                    }
+                    record++;
+                }
+                line = eol + 1;
+            }
+        }
+    }, 1);
+    if (bad_record >= 0) {
+        if (bad_record < nv) {
+            logger->error("Tet file '{}' has an invalid vertex {}.", filename, int(bad_record));
+        } else {
+            logger->error("Tet file '{}' has an invalid tet {}.", filename, bad_record - nv);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool load_tetb(const std::string& filename, Eigen::MatrixXd& TV, Eigen::MatrixXi& TF, Eigen::MatrixXi& TT,
+               std::shared_ptr<spdlog::logger> logger) {
+    RawVolumeView view;
+    if (!view.open(filename, logger)) {
+        return false;
+    }
+
+    TetbHeader header;
+    if (view.size() < sizeof(header)) {
+        logger->error("'{}' is not a .tetb file.", filename);
+        return false;
+    }
+    std::memcpy(&header, view.data(), sizeof(header));
+    if (std::memcmp(header.magic, TETB_MAGIC, sizeof(TETB_MAGIC)) != 0) {
+        logger->error("'{}' is not a .tetb file.", filename);
+        return false;
+    }
+    if (header.version != TETB_VERSION) {
+        logger->error("Tet file '{}' has unsupported version {}.", filename, header.version);
+        return false;
+    }
+    if (header.num_vertices > INT32_MAX || header.num_tets > INT32_MAX || header.num_faces > INT32_MAX) {
+        logger->error("Tet file '{}' has an invalid header.", filename);
+        return false;
+    }
+    const std::size_t tv_bytes = std::size_t(header.num_vertices) * 3 * sizeof(double);
+    const std::size_t tt_bytes = std::size_t(header.num_tets) * 4 * sizeof(std::int32_t);
+    const std::size_t tf_bytes = std::size_t(header.num_faces) * 3 * sizeof(std::int32_t);
+    if (view.size() != sizeof(header) + tv_bytes + tt_bytes + tf_bytes) {
+        logger->error("Tet file '{}' has {} bytes, but its header announces {} bytes.", filename, view.size(),
+                      sizeof(header) + tv_bytes + tt_bytes + tf_bytes);
+        return false;
+    }
+
+    const std::uint8_t* data = view.data() + sizeof(header);
+    TV.resize(header.num_vertices, 3);
+    std::memcpy(TV.data(), data, tv_bytes);
+    TT.resize(header.num_tets, 4);
+    std::memcpy(TT.data(), data + tv_bytes, tt_bytes);
+    TF.resize(header.num_faces, 3);
+    std::memcpy(TF.data(), data + tv_bytes + tt_bytes, tf_bytes);
+
+    const int nv = static_cast<int>(header.num_vertices);
+    if ((TT.size() > 0 && (TT.minCoeff() < 0 || TT.maxCoeff() >= nv)) ||
+        (TF.size() > 0 && (TF.minCoeff() < 0 || TF.maxCoeff() >= nv))) {
+        logger->error("Tet file '{}' indexes vertices out of range.", filename);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+bool is_tetb_filename(const std::string& filename) {
+    static const std::string extension = ".tetb";
+    return filename.size() >= extension.size() &&
+            filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+bool load_tet_file(const std::string& filename, Eigen::MatrixXd& TV, Eigen::MatrixXi& TF, Eigen::MatrixXi& TT,
+                   std::shared_ptr<spdlog::logger> logger) {
+    if (is_tetb_filename(filename)) {
+        return load_tetb(filename, TV, TF, TT, logger);
+    }
+    if (!load_tet_text(filename, TV, TT, logger)) {
+        return false;
+    }
+    tet_mesh_faces(TT, TF, true /*flip*/);
+    return true;
+}
+
+
+bool save_tetb_file(const std::string& filename, const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TF,
+                    const Eigen::MatrixXi& TT, std::shared_ptr<spdlog::logger> logger) {
+    static_assert(sizeof(int) == sizeof(std::int32_t), "Index matrices are written as they are in memory");
+    if (TV.size() > 0 && TV.cols() != 3) {
+        logger->error("Cannot write '{}', the vertices must have 3 coordinates.", filename);
+        return false;
+    }
+    if ((TT.size() > 0 && TT.cols() != 4) || (TF.size() > 0 && TF.cols() != 3)) {
+        logger->error("Cannot write '{}', expected tets and triangle faces.", filename);
+        return false;
+    }
+
+    std::ofstream of(filename, std::ios::binary);
+    if (!of.good()) {
+        logger->error("Cannot open '{}' for writing.", filename);
+        return false;
+    }
+
+    TetbHeader header;
+    std::memcpy(header.magic, TETB_MAGIC, sizeof(TETB_MAGIC));
+    header.version = TETB_VERSION;
+    header.reserved = 0;
+    header.num_vertices = TV.rows();
+    header.num_tets = TT.rows();
+    header.num_faces = TF.rows();
+    of.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    of.write(reinterpret_cast<const char*>(TV.data()), TV.size() * sizeof(double));
+    of.write(reinterpret_cast<const char*>(TT.data()), TT.size() * sizeof(std::int32_t));
+    of.write(reinterpret_cast<const char*>(TF.data()), TF.size() * sizeof(std::int32_t));
+    if (!of.good()) {
+        logger->error("Failed to write '{}'.", filename);
+        return false;
+    }
+    return true;
+}
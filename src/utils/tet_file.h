@@ -0,0 +1,37 @@
+#ifndef TET_FILE_H
+#define TET_FILE_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <memory>
+#include <string>
+
+// Tet meshes are read from two formats:
+//
+// .tet is the text format written by Quartet: a header word, the number of vertices and the number of tets,
+// then one vertex (x y z) per line followed by one tet (4 vertex indices) per line. Its tets are oriented the
+// other way around from what igl::volume expects.
+//
+// .tetb is a binary cache of a loaded mesh, with the matrices stored in Eigen's column major order so each of
+// them is a single copy out of the mapped file (little endian):
+//   char[8]  magic "TETBIN\0\0"
+//   uint32   version
+//   uint32   reserved, 0
+//   uint64   number of vertices, tets and boundary faces
+//   double   TV, all x then all y then all z
+//   int32    TT, the first vertex of every tet, then the second one and so on
+//   int32    TF, laid out like TT
+
+bool is_tetb_filename(const std::string& filename);
+
+// Load a .tet or .tetb file (picked by the extension) along with the boundary faces TF of the tets. The text
+// format is memory mapped and parsed on all cores.
+bool load_tet_file(const std::string& filename, Eigen::MatrixXd& TV, Eigen::MatrixXi& TF, Eigen::MatrixXi& TT,
+                   std::shared_ptr<spdlog::logger> logger);
+
+// Write a mesh to a .tetb file, which load_tet_file reads back without any parsing
+bool save_tetb_file(const std::string& filename, const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TF,
+                    const Eigen::MatrixXi& TT, std::shared_ptr<spdlog::logger> logger);
+
+#endif // TET_FILE_H
@@ -0,0 +1,238 @@
+#include "tet_mesh_optimization.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+#include "parallel_for.h"
+
+namespace {
+
+// Fractions of the way to the centroid of its neighbors a vertex tries, largest first
+constexpr double STEPS[] = { 1.0, 0.5, 0.25 };
+// Vertices whose tets are all at least this good stay, the others move if that raises the mean ratio of their
+// worst tet by MIN_IMPROVEMENT, so the sweeps settle instead of creeping
+constexpr double GOOD_QUALITY = 0.5;
+constexpr double MIN_IMPROVEMENT = 1e-4;
+// Boundary vertices only slide where the normals of their faces are within about 25 degrees of their normal
+constexpr double SMOOTH_SURFACE_COS = 0.9;
+constexpr std::size_t VERTICES_PER_CHUNK = 1 << 10;
+
+// List of ints of every vertex, those of vertex v are values[offsets[v], offsets[v + 1])
+struct VertexLists {
+    std::vector<int> offsets;
+    std::vector<int> values;
+};
+
+// The rows of E (tets or faces) around each vertex
+VertexLists incident_elements(const Eigen::MatrixXi& E, int num_vertices) {
+    VertexLists elements;
+    elements.offsets.assign(num_vertices + 1, 0);
+    for (int e = 0; e < E.rows(); e++) {
+        for (int c = 0; c < E.cols(); c++) {
+            elements.offsets[E(e, c) + 1]++;
+        }
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        elements.offsets[v + 1] += elements.offsets[v];
+    }
+    elements.values.resize(elements.offsets.back());
+    std::vector<int> cursor(elements.offsets.begin(), elements.offsets.end() - 1);
+    for (int e = 0; e < E.rows(); e++) {
+        for (int c = 0; c < E.cols(); c++) {
+            elements.values[cursor[E(e, c)]++] = e;
+        }
+    }
+    return elements;
+}
+
+// The vertices sharing a tet with each vertex, in increasing order
+VertexLists vertex_neighbors(const Eigen::MatrixXi& TT, const VertexLists& tets, int num_vertices) {
+    auto gather = [&](int v, std::vector<int>& list) {
+        list.clear();
+        for (int i = tets.offsets[v]; i < tets.offsets[v + 1]; i++) {
+            for (int c = 0; c < 4; c++) {
+                if (TT(tets.values[i], c) != v) {
+                    list.push_back(TT(tets.values[i], c));
+                }
+            }
+        }
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    };
+
+    VertexLists neighbors;
+    neighbors.offsets.assign(num_vertices + 1, 0);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        std::vector<int> list;
+        for (std::size_t v = begin; v < end; v++) {
+            gather(int(v), list);
+            neighbors.offsets[v + 1] = int(list.size());
+        }
+    }, VERTICES_PER_CHUNK);
+    parallel_prefix_sum(neighbors.offsets);
+    neighbors.values.resize(neighbors.offsets.back());
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        std::vector<int> list;
+        for (std::size_t v = begin; v < end; v++) {
+            gather(int(v), list);
+            std::copy(list.begin(), list.end(), neighbors.values.begin() + neighbors.offsets[v]);
+        }
+    }, VERTICES_PER_CHUNK);
+    return neighbors;
+}
+
+// Greedy coloring of the vertices of some tet, in order, with the smallest color none of their neighbors has.
+// Returns the vertices of every color.
+std::vector<std::vector<int>> color_vertices(const VertexLists& neighbors) {
+    const int num_vertices = int(neighbors.offsets.size()) - 1;
+    std::vector<int> color(num_vertices, -1);
+    // taken[c] == v when a neighbor of v has color c
+    std::vector<int> taken;
+    std::vector<std::vector<int>> colors;
+    for (int v = 0; v < num_vertices; v++) {
+        if (neighbors.offsets[v] == neighbors.offsets[v + 1]) {
+            continue;
+        }
+        for (int i = neighbors.offsets[v]; i < neighbors.offsets[v + 1]; i++) {
+            const int c = color[neighbors.values[i]];
+            if (c >= 0) {
+                taken[c] = v;
+            }
+        }
+        int c = 0;
+        while (c < int(colors.size()) && taken[c] == v) {
+            c++;
+        }
+        if (c == int(colors.size())) {
+            colors.emplace_back();
+            taken.push_back(-1);
+        }
+        colors[c].push_back(v);
+        color[v] = c;
+    }
+    return colors;
+}
+
+// Mean ratio of the worst tet around vertex v when it is at p
+double worst_quality(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const VertexLists& tets, int v,
+                     const Eigen::RowVector3d& p) {
+    double worst = std::numeric_limits<double>::infinity();
+    for (int i = tets.offsets[v]; i < tets.offsets[v + 1]; i++) {
+        const int t = tets.values[i];
+        Eigen::RowVector3d corners[4];
+        for (int c = 0; c < 4; c++) {
+            corners[c] = TT(t, c) == v ? p : Eigen::RowVector3d(TV.row(TT(t, c)));
+        }
+        worst = std::min(worst, tet_mean_ratio(corners[0], corners[1], corners[2], corners[3]));
+    }
+    return worst;
+}
+
+// Where vertex v would be smoothest: the centroid of its neighbors, or for a vertex on faces of F the centroid of
+// its neighbors on them moved back into its tangent plane. Returns false for boundary vertices on creases and
+// corners, which stay.
+bool smoothing_target(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& F, const VertexLists& neighbors,
+                      const VertexLists& faces, int v, Eigen::RowVector3d& target) {
+    target = Eigen::RowVector3d::Zero();
+    if (faces.offsets[v] == faces.offsets[v + 1]) {
+        for (int i = neighbors.offsets[v]; i < neighbors.offsets[v + 1]; i++) {
+            target += TV.row(neighbors.values[i]);
+        }
+        target /= double(neighbors.offsets[v + 1] - neighbors.offsets[v]);
+        return true;
+    }
+
+    const Eigen::RowVector3d p = TV.row(v);
+    Eigen::RowVector3d normal = Eigen::RowVector3d::Zero();
+    for (int i = faces.offsets[v]; i < faces.offsets[v + 1]; i++) {
+        const int f = faces.values[i];
+        const Eigen::RowVector3d a = TV.row(F(f, 0)), b = TV.row(F(f, 1)), c = TV.row(F(f, 2));
+        normal += (b - a).cross(c - a);
+        // Each neighbor on the boundary is on two of the faces, so they all weigh the same
+        target += a + b + c - p;
+    }
+    if (normal.squaredNorm() == 0.0) {
+        return false;
+    }
+    normal.normalize();
+    for (int i = faces.offsets[v]; i < faces.offsets[v + 1]; i++) {
+        const int f = faces.values[i];
+        const Eigen::RowVector3d a = TV.row(F(f, 0)), b = TV.row(F(f, 1)), c = TV.row(F(f, 2));
+        const Eigen::RowVector3d face_normal = (b - a).cross(c - a);
+        if (face_normal.dot(normal) < SMOOTH_SURFACE_COS * face_normal.norm()) {
+            return false;
+        }
+    }
+    target /= double(2 * (faces.offsets[v + 1] - faces.offsets[v]));
+    target -= (target - p).dot(normal) * normal;
+    return true;
+}
+
+} // namespace
+
+
+bool optimize_tet_mesh(Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::MatrixXi& TF,
+                       double max_seconds, int max_sweeps, TetMeshOptimization& result, JobContext& context) {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    result = TetMeshOptimization();
+    result.before = tet_mesh_quality(TV, TT);
+    result.after = result.before;
+
+    const int num_vertices = int(TV.rows());
+    const VertexLists tets = incident_elements(TT, num_vertices);
+    const VertexLists faces = incident_elements(TF, num_vertices);
+    const VertexLists neighbors = vertex_neighbors(TT, tets, num_vertices);
+    const std::vector<std::vector<int>> colors = color_vertices(neighbors);
+
+    bool out_of_time = max_seconds <= 0.0;
+    while (!out_of_time && !result.converged && result.num_sweeps < max_sweeps) {
+        std::size_t num_moves = 0;
+        for (const std::vector<int>& vertices : colors) {
+            // No tet has two vertices of a color, so each vertex only reads vertices that stay where they are
+            std::vector<std::size_t> chunk_moves(parallel_num_chunks(vertices.size(), VERTICES_PER_CHUNK), 0);
+            parallel_for_chunks(vertices.size(), [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+                for (std::size_t i = begin; i < end; i++) {
+                    const int v = vertices[i];
+                    const Eigen::RowVector3d p = TV.row(v);
+                    const double quality = worst_quality(TV, TT, tets, v, p);
+                    Eigen::RowVector3d target;
+                    if (quality >= GOOD_QUALITY || !smoothing_target(TV, TF, neighbors, faces, v, target)) {
+                        continue;
+                    }
+                    for (double step : STEPS) {
+                        const Eigen::RowVector3d q = p + step * (target - p);
+                        if (worst_quality(TV, TT, tets, v, q) > quality + MIN_IMPROVEMENT) {
+                            TV.row(v) = q;
+                            chunk_moves[chunk]++;
+                            break;
+                        }
+                    }
+                }
+            }, VERTICES_PER_CHUNK);
+            for (std::size_t moves : chunk_moves) {
+                num_moves += moves;
+            }
+
+            if (context.cancelled()) {
+                return false;
+            }
+            const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+            context.set_progress(float(std::min(seconds / max_seconds, 1.0)));
+            if (seconds >= max_seconds) {
+                out_of_time = true;
+                break;
+            }
+        }
+        result.num_sweeps++;
+        result.num_moves += num_moves;
+        result.converged = !out_of_time && num_moves == 0;
+    }
+
+    result.after = tet_mesh_quality(TV, TT);
+    return true;
+}
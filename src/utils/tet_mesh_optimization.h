@@ -0,0 +1,34 @@
+#ifndef TET_MESH_OPTIMIZATION_H
+#define TET_MESH_OPTIMIZATION_H
+
+#include <Eigen/Core>
+
+#include <cstddef>
+
+#include "background_job.h"
+#include "quality_metrics.h"
+
+struct TetMeshOptimization {
+    TetMeshQuality before, after;
+    // Sweeps over all the vertices, the last one may have been cut short by the time budget
+    int num_sweeps = 0;
+    std::size_t num_moves = 0;
+    // The last sweep moved no vertex
+    bool converged = false;
+};
+
+// Improve the shape of the worst tets of TT by moving their vertices, a smart Laplacian smoothing. Each sweep colors
+// the vertices so that no two vertices of a color share a tet, and moves all the vertices of a color at once in
+// parallel. A vertex with a tet of mean ratio below 0.5 (see tet_mean_ratio) moves towards the centroid of its
+// neighbors by the largest of a few steps that raises the mean ratio of its worst tet, and stays otherwise.
+// Vertices on the boundary faces TF slide in their tangent plane towards the centroid of their neighbors on the
+// boundary, unless they are on a crease, so the surface and its vertices stay put up to the curvature. Slivers
+// whose vertices all lie on a flat part of the boundary cannot be helped that way.
+//
+// The vertices are colored in a fixed order, so the mesh only depends on the number of sweeps done. Sweeps stop
+// once max_seconds have passed, checked after every color, once a sweep moves no vertex or after max_sweeps.
+// Returns false if the job was cancelled, TV then holds the vertices moved so far.
+bool optimize_tet_mesh(Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::MatrixXi& TF,
+                       double max_seconds, int max_sweeps, TetMeshOptimization& result, JobContext& context);
+
+#endif // TET_MESH_OPTIMIZATION_H
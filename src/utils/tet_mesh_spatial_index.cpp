@@ -0,0 +1,393 @@
+#include "tet_mesh_spatial_index.h"
+
+#include "parallel_for.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace {
+
+// Tets per leaf of the hierarchy
+constexpr int TetLeafSize = 4;
+
+// The hierarchy is split at the median so its depth is about log2(#tets / TetLeafSize)
+constexpr int MaxTetDepth = 64;
+
+// Tets per block of barycentric transforms and values stored per tet
+constexpr int BlockLanes = 4;
+constexpr int BlockValues = 12;
+
+// Barycentric coordinates closer to 0 than this are left to the exact orientation test, which decides whether a
+// point on a face is inside the tet the same way as the linear scan
+constexpr double BarycentricTolerance = 1e-9;
+
+// Tets whose volume is below this fraction of the cube of their longest edge have an ill-conditioned transform
+// and always go through the exact test
+constexpr double FlatTetRatio = 1e-8;
+
+bool in_box(const Eigen::Vector3d& p, const Eigen::Vector3d& box_min, const Eigen::Vector3d& box_max) {
+    return (p - box_min).minCoeff() >= 0.0 && (box_max - p).minCoeff() >= 0.0;
+}
+
+// Barycentric coordinates of p in the BlockLanes tets of a block, l[k][lane] is the weight of vertex k. The loop
+// over the lanes has no dependencies and reads every value contiguously, so it compiles to packed arithmetic.
+void block_barycentric(const double* block, const Eigen::Vector3d& p, double l[4][BlockLanes]) {
+    for (int lane = 0; lane < BlockLanes; lane++) {
+        const double d0 = p[0] - block[9 * BlockLanes + lane];
+        const double d1 = p[1] - block[10 * BlockLanes + lane];
+        const double d2 = p[2] - block[11 * BlockLanes + lane];
+        for (int k = 0; k < 3; k++) {
+            l[k + 1][lane] = block[(3 * k) * BlockLanes + lane] * d0 + block[(3 * k + 1) * BlockLanes + lane] * d1 +
+                             block[(3 * k + 2) * BlockLanes + lane] * d2;
+        }
+        l[0][lane] = 1.0 - l[1][lane] - l[2][lane] - l[3][lane];
+    }
+}
+
+// Barycentric coordinates of p in tet t as ratios of the orientations point_in_tet compares
+Eigen::RowVector4d exact_barycentric(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT, const Eigen::Vector3d& p,
+                                     int t) {
+    auto orient = [](const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+                     const Eigen::Vector3d& d) -> double {
+        return (b - a).dot((c - a).cross(d - a));
+    };
+    Eigen::Vector3d v[4];
+    for (int k = 0; k < 4; k++) {
+        v[k] = TV.row(TT(t, k)).transpose();
+    }
+    Eigen::RowVector4d w(orient(p, v[1], v[2], v[3]), orient(v[0], p, v[2], v[3]),
+                         orient(v[0], v[1], p, v[3]), orient(v[0], v[1], v[2], p));
+    return w / w.sum();
+}
+
+} // namespace
+
+
+void TetMeshSpatialIndex::clear() {
+    _TV.resize(0, 3);
+    _TT.resize(0, 4);
+    _tet_nodes.clear();
+    _tet_order.clear();
+    _barycentric_blocks.clear();
+    _vertex_order.clear();
+    _split_axis.clear();
+    _incident_tet.clear();
+}
+
+
+void TetMeshSpatialIndex::build(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT) {
+    clear();
+    if (TT.rows() == 0) {
+        return;
+    }
+    _TV = TV;
+    _TT = TT;
+
+    const int num_tets = static_cast<int>(TT.rows());
+    const int num_vertices = static_cast<int>(TV.rows());
+
+    std::vector<Eigen::Vector3d> centroids(num_tets), tet_min(num_tets), tet_max(num_tets);
+    _incident_tet.assign(num_vertices, -1);
+    for (int t = 0; t < num_tets; t++) {
+        tet_min[t] = tet_max[t] = TV.row(TT(t, 0)).transpose();
+        centroids[t].setZero();
+        for (int k = 0; k < 4; k++) {
+            const int v = TT(t, k);
+            const Eigen::Vector3d x = TV.row(v).transpose();
+            tet_min[t] = tet_min[t].cwiseMin(x);
+            tet_max[t] = tet_max[t].cwiseMax(x);
+            centroids[t] += 0.25 * x;
+            if (_incident_tet[v] < 0) {
+                _incident_tet[v] = t;
+            }
+        }
+    }
+
+    _tet_order.resize(num_tets);
+    for (int t = 0; t < num_tets; t++) {
+        _tet_order[t] = t;
+    }
+    _tet_nodes.reserve(2 * (num_tets / TetLeafSize + 1));
+    build_tet_node(centroids, tet_min, tet_max, 0, num_tets);
+    build_barycentric_blocks();
+
+    for (int v = 0; v < num_vertices; v++) {
+        if (_incident_tet[v] >= 0) {
+            _vertex_order.push_back(v);
+        }
+    }
+    _split_axis.resize(_vertex_order.size());
+    build_vertex_node(0, static_cast<int>(_vertex_order.size()));
+}
+
+
+int TetMeshSpatialIndex::build_tet_node(const std::vector<Eigen::Vector3d>& centroids,
+                                        const std::vector<Eigen::Vector3d>& tet_min,
+                                        const std::vector<Eigen::Vector3d>& tet_max, int begin, int end) {
+    const int node = static_cast<int>(_tet_nodes.size());
+    _tet_nodes.emplace_back();
+
+    Eigen::Vector3d box_min = tet_min[_tet_order[begin]];
+    Eigen::Vector3d box_max = tet_max[_tet_order[begin]];
+    Eigen::Vector3d ctr_min = centroids[_tet_order[begin]];
+    Eigen::Vector3d ctr_max = ctr_min;
+    for (int i = begin + 1; i < end; i++) {
+        const int t = _tet_order[i];
+        box_min = box_min.cwiseMin(tet_min[t]);
+        box_max = box_max.cwiseMax(tet_max[t]);
+        ctr_min = ctr_min.cwiseMin(centroids[t]);
+        ctr_max = ctr_max.cwiseMax(centroids[t]);
+    }
+    _tet_nodes[node].box_min = box_min;
+    _tet_nodes[node].box_max = box_max;
+    _tet_nodes[node].begin = begin;
+    _tet_nodes[node].end = end;
+    _tet_nodes[node].right = -1;
+    _tet_nodes[node].first_block = -1;
+
+    int axis;
+    const double extent = (ctr_max - ctr_min).maxCoeff(&axis);
+    if (end - begin <= TetLeafSize || extent <= 0.0) {
+        return node;
+    }
+
+    // Split at the median centroid along the longest side, which keeps the tree balanced
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(_tet_order.begin() + begin, _tet_order.begin() + mid, _tet_order.begin() + end,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    build_tet_node(centroids, tet_min, tet_max, begin, mid);
+    const int right = build_tet_node(centroids, tet_min, tet_max, mid, end);
+    _tet_nodes[node].right = right;
+    return node;
+}
+
+
+void TetMeshSpatialIndex::build_barycentric_blocks() {
+    int num_blocks = 0;
+    for (TetNode& node : _tet_nodes) {
+        if (node.right < 0) {
+            node.first_block = num_blocks;
+            num_blocks += (node.end - node.begin + BlockLanes - 1) / BlockLanes;
+        }
+    }
+    _barycentric_blocks.assign(static_cast<std::size_t>(num_blocks) * BlockValues * BlockLanes, 0.0);
+
+    parallel_for_chunks(_tet_nodes.size(), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t n = begin; n < end; n++) {
+            const TetNode& node = _tet_nodes[n];
+            if (node.right >= 0) {
+                continue;
+            }
+            for (int i = node.begin; i < node.end; i++) {
+                const int t = _tet_order[i];
+                const int lane = (i - node.begin) % BlockLanes;
+                double* block = &_barycentric_blocks[static_cast<std::size_t>(node.first_block +
+                                                                              (i - node.begin) / BlockLanes) *
+                                                     BlockValues * BlockLanes];
+
+                const Eigen::Vector3d v0 = _TV.row(_TT(t, 0)).transpose();
+                Eigen::Matrix3d edges;
+                double max_edge2 = 0.0;
+                for (int k = 0; k < 3; k++) {
+                    edges.col(k) = _TV.row(_TT(t, k + 1)).transpose() - v0;
+                    max_edge2 = std::max(max_edge2, edges.col(k).squaredNorm());
+                }
+                const double det = edges.determinant();
+                Eigen::Matrix3d inverse;
+                if (std::abs(det) > FlatTetRatio * max_edge2 * std::sqrt(max_edge2)) {
+                    inverse = edges.inverse();
+                } else {
+                    inverse.setConstant(std::numeric_limits<double>::quiet_NaN());
+                }
+                for (int r = 0; r < 3; r++) {
+                    for (int c = 0; c < 3; c++) {
+                        block[(3 * r + c) * BlockLanes + lane] = inverse(r, c);
+                    }
+                    block[(9 + r) * BlockLanes + lane] = v0[r];
+                }
+            }
+        }
+    }, 256);
+}
+
+
+void TetMeshSpatialIndex::build_vertex_node(int begin, int end) {
+    if (end - begin <= 1) {
+        if (end - begin == 1) {
+            _split_axis[begin] = 0;
+        }
+        return;
+    }
+
+    Eigen::RowVector3d range_min = _TV.row(_vertex_order[begin]);
+    Eigen::RowVector3d range_max = range_min;
+    for (int i = begin + 1; i < end; i++) {
+        range_min = range_min.cwiseMin(_TV.row(_vertex_order[i]));
+        range_max = range_max.cwiseMax(_TV.row(_vertex_order[i]));
+    }
+    int axis;
+    (range_max - range_min).maxCoeff(&axis);
+
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(_vertex_order.begin() + begin, _vertex_order.begin() + mid, _vertex_order.begin() + end,
+                     [&](int a, int b) { return _TV(a, axis) < _TV(b, axis); });
+    _split_axis[mid] = static_cast<char>(axis);
+    build_vertex_node(begin, mid);
+    build_vertex_node(mid + 1, end);
+}
+
+
+int TetMeshSpatialIndex::containing_tet(const Eigen::RowVector3d& p) const {
+    return locate(p, nullptr);
+}
+
+
+int TetMeshSpatialIndex::containing_tet(const Eigen::RowVector3d& p, Eigen::RowVector4d& barycentric) const {
+    return locate(p, &barycentric);
+}
+
+
+int TetMeshSpatialIndex::locate(const Eigen::RowVector3d& p, Eigen::RowVector4d* barycentric) const {
+    if (empty()) {
+        return -1;
+    }
+    const Eigen::Vector3d q = p.transpose();
+
+    // Tets may overlap on their boundaries, so keep searching for a lower index once a tet is found
+    int best = -1;
+    int stack[MaxTetDepth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const int node_index = stack[--stack_size];
+        const TetNode& node = _tet_nodes[node_index];
+        if (!in_box(q, node.box_min, node.box_max)) {
+            continue;
+        }
+        if (node.right < 0) {
+            const double* block = &_barycentric_blocks[static_cast<std::size_t>(node.first_block) * BlockValues *
+                                                       BlockLanes];
+            for (int i = node.begin; i < node.end; i += BlockLanes, block += BlockValues * BlockLanes) {
+                double l[4][BlockLanes];
+                block_barycentric(block, q, l);
+                const int num_lanes = std::min(BlockLanes, node.end - i);
+                for (int lane = 0; lane < num_lanes; lane++) {
+                    const int t = _tet_order[i + lane];
+                    if (best >= 0 && t > best) {
+                        continue;
+                    }
+                    // NaN coordinates of a flat tet are neither inside nor outside
+                    bool inside = true, outside = false;
+                    for (int k = 0; k < 4; k++) {
+                        inside = inside && l[k][lane] > BarycentricTolerance;
+                        outside = outside || l[k][lane] < -BarycentricTolerance;
+                    }
+                    if (inside) {
+                        best = t;
+                        if (barycentric) {
+                            *barycentric << l[0][lane], l[1][lane], l[2][lane], l[3][lane];
+                        }
+                    } else if (!outside && point_in_tet(_TV, _TT, p, t)) {
+                        best = t;
+                        if (barycentric) {
+                            *barycentric = exact_barycentric(_TV, _TT, q, t);
+                        }
+                    }
+                }
+            }
+        } else {
+            stack[stack_size++] = node.right;
+            stack[stack_size++] = node_index + 1;
+        }
+    }
+    return best;
+}
+
+
+void TetMeshSpatialIndex::nearest_in_range(const Eigen::Vector3d& p, int begin, int end,
+                                           int& best, double& best_dist2) const {
+    if (begin >= end) {
+        return;
+    }
+    const int mid = begin + (end - begin) / 2;
+    const int v = _vertex_order[mid];
+    const double dist2 = (_TV.row(v).transpose() - p).squaredNorm();
+    if (dist2 < best_dist2 || (dist2 == best_dist2 && v < best)) {
+        best = v;
+        best_dist2 = dist2;
+    }
+    if (end - begin == 1) {
+        return;
+    }
+
+    // Visit the side of the split containing p first, the other one can only hold a closer vertex (or one at
+    // the same distance with a lower index) if the split plane is within the best distance
+    const int axis = _split_axis[mid];
+    const double diff = p[axis] - _TV(v, axis);
+    if (diff < 0.0) {
+        nearest_in_range(p, begin, mid, best, best_dist2);
+        if (diff * diff <= best_dist2) {
+            nearest_in_range(p, mid + 1, end, best, best_dist2);
+        }
+    } else {
+        nearest_in_range(p, mid + 1, end, best, best_dist2);
+        if (diff * diff <= best_dist2) {
+            nearest_in_range(p, begin, mid, best, best_dist2);
+        }
+    }
+}
+
+
+int TetMeshSpatialIndex::nearest_vertex(const Eigen::RowVector3d& p) const {
+    int best = -1;
+    double best_dist2 = std::numeric_limits<double>::infinity();
+    nearest_in_range(p.transpose(), 0, static_cast<int>(_vertex_order.size()), best, best_dist2);
+    return best;
+}
+
+
+int TetMeshSpatialIndex::incident_tet(int v) const {
+    if (v < 0 || v >= static_cast<int>(_incident_tet.size())) {
+        return -1;
+    }
+    return _incident_tet[v];
+}
+
+
+void TetMeshSpatialIndex::containing_tets(const Eigen::MatrixXd& P, Eigen::VectorXi& tets) const {
+    tets.resize(P.rows());
+    parallel_for_chunks(P.rows(), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            tets[i] = containing_tet(P.row(i));
+        }
+    }, 256);
+}
+
+
+void TetMeshSpatialIndex::containing_tets(const Eigen::MatrixXd& P, Eigen::VectorXi& tets,
+                                          Eigen::MatrixXd& barycentric) const {
+    tets.resize(P.rows());
+    barycentric.setZero(P.rows(), 4);
+    parallel_for_chunks(P.rows(), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            Eigen::RowVector4d w;
+            tets[i] = containing_tet(P.row(i), w);
+            if (tets[i] >= 0) {
+                barycentric.row(i) = w;
+            }
+        }
+    }, 256);
+}
+
+
+void TetMeshSpatialIndex::nearest_vertices(const Eigen::MatrixXd& P, Eigen::VectorXi& vertices) const {
+    vertices.resize(P.rows());
+    parallel_for_chunks(P.rows(), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++) {
+            vertices[i] = nearest_vertex(P.row(i));
+        }
+    }, 256);
+}
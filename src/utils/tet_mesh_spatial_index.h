@@ -0,0 +1,87 @@
+#ifndef TET_MESH_SPATIAL_INDEX_H
+#define TET_MESH_SPATIAL_INDEX_H
+
+#include <Eigen/Core>
+
+#include <vector>
+
+// Point location on a fixed tet mesh: a bounding volume hierarchy over the tets for containing_tet and a kd-tree
+// over the vertices for nearest_vertex. Both are built in O(n log n) and answer a query in O(log n) on a well
+// shaped mesh, and they return exactly what the linear scans of the same name in utils.h return: the lowest
+// index tet that contains the point, and the lowest index vertex at the smallest distance.
+//
+// The index keeps a copy of the mesh, so it stays valid when TV and TT go away. Only the vertices referenced by
+// TT are in the kd-tree.
+//
+// The leaves also store the inverse barycentric transforms of their tets, laid out so the coordinates of a point
+// in 4 tets are computed at once with vector instructions. Only the points within roundoff of a face (and the
+// nearly flat tets) fall back to the exact orientation test of point_in_tet, and the coordinates of the point
+// come with the containing tet.
+class TetMeshSpatialIndex {
+public:
+    TetMeshSpatialIndex() = default;
+    TetMeshSpatialIndex(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT) { build(TV, TT); }
+
+    void build(const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT);
+    void clear();
+
+    bool empty() const { return _tet_nodes.empty(); }
+
+    // Index of the tet containing p or -1 if p is in no tet
+    int containing_tet(const Eigen::RowVector3d& p) const;
+
+    // Same as above, and barycentric gets the weights of the 4 vertices of the tet that interpolate p (left
+    // unchanged if p is in no tet)
+    int containing_tet(const Eigen::RowVector3d& p, Eigen::RowVector4d& barycentric) const;
+
+    // Index of the closest vertex to p or -1 if the mesh is empty
+    int nearest_vertex(const Eigen::RowVector3d& p) const;
+
+    // Lowest index tet having v as a vertex or -1 if v is in no tet
+    int incident_tet(int v) const;
+
+    // The queries above for every row of P, in parallel. The barycentric rows of the points in no tet are 0.
+    void containing_tets(const Eigen::MatrixXd& P, Eigen::VectorXi& tets) const;
+    void containing_tets(const Eigen::MatrixXd& P, Eigen::VectorXi& tets, Eigen::MatrixXd& barycentric) const;
+    void nearest_vertices(const Eigen::MatrixXd& P, Eigen::VectorXi& vertices) const;
+
+private:
+    // Tets of an inner node are the ones of its children, the left child directly follows its parent and right
+    // is the index of the right child. Leaves have right = -1 and hold the tets [begin, end) of _tet_order, whose
+    // barycentric transforms are the blocks starting at first_block.
+    struct TetNode {
+        Eigen::Vector3d box_min;
+        Eigen::Vector3d box_max;
+        int begin;
+        int end;
+        int right;
+        int first_block;
+    };
+
+    Eigen::MatrixXd _TV;
+    Eigen::MatrixXi _TT;
+
+    std::vector<TetNode> _tet_nodes;
+    std::vector<int> _tet_order;
+
+    // Blocks of 4 tets of a leaf (the last one padded), structure of arrays: for each of the 12 values
+    // below, one lane per tet. Rows 0-8 are the inverse of [v1 - v0, v2 - v0, v3 - v0] in row major order, which
+    // maps p - v0 to the coordinates of v1, v2, v3, and rows 9-11 are v0. Degenerate tets have NaN rows.
+    std::vector<double> _barycentric_blocks;
+
+    // Implicit balanced kd-tree: the node of the range [b, e) of _vertex_order is its middle element m,
+    // splitting along _split_axis[m], with the ranges [b, m) and [m + 1, e) as children
+    std::vector<int> _vertex_order;
+    std::vector<char> _split_axis;
+
+    std::vector<int> _incident_tet;
+
+    int build_tet_node(const std::vector<Eigen::Vector3d>& centroids, const std::vector<Eigen::Vector3d>& tet_min,
+                       const std::vector<Eigen::Vector3d>& tet_max, int begin, int end);
+    void build_vertex_node(int begin, int end);
+    void build_barycentric_blocks();
+    int locate(const Eigen::RowVector3d& p, Eigen::RowVector4d* barycentric) const;
+    void nearest_in_range(const Eigen::Vector3d& p, int begin, int end, int& best, double& best_dist2) const;
+};
+
+#endif // TET_MESH_SPATIAL_INDEX_H
@@ -0,0 +1,194 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <vector>
+
+
+namespace trace {
+
+namespace detail {
+std::atomic_bool enabled{ false };
+}
+
+namespace {
+
+struct Event {
+    const char* name;
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+// Events of one thread. Event i is written to slot i % RING_SIZE, then count is bumped past it.
+struct Ring {
+    std::vector<Event> events = std::vector<Event>(RING_SIZE);
+    std::atomic<std::uint64_t> count{ 0 };
+    int thread_id = 0;
+};
+
+struct Tracer {
+    // Set once by init(), the rings are only filled and flushed if a file is written
+    std::atomic_bool to_file{ false };
+    std::atomic<Observer> observer{ nullptr };
+
+    std::string filename;
+    std::shared_ptr<spdlog::logger> logger;
+    std::uint64_t start = 0;
+
+    // Rings of every thread that recorded an event, kept after their thread exits
+    std::mutex rings_mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    std::mutex names_mutex;
+    std::set<std::string> names;
+};
+
+Tracer& tracer() {
+    static Tracer* instance = new Tracer();
+    return *instance;
+}
+
+Ring& thread_ring() {
+    thread_local Ring* ring = nullptr;
+    if (ring == nullptr) {
+        Tracer& t = tracer();
+        std::lock_guard<std::mutex> lock(t.rings_mutex);
+        t.rings.emplace_back(new Ring());
+        ring = t.rings.back().get();
+        ring->thread_id = int(t.rings.size());
+    }
+    return *ring;
+}
+
+void write_escaped(std::ostream& out, const char* s) {
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') {
+            out << '\\' << *s;
+        } else if (static_cast<unsigned char>(*s) < 0x20) {
+            out << ' ';
+        } else {
+            out << *s;
+        }
+    }
+}
+
+void flush_at_exit() {
+    flush();
+}
+
+} // namespace
+
+
+bool init(std::shared_ptr<spdlog::logger> logger) {
+    Tracer& t = tracer();
+    const char* filename = std::getenv("FISH_TRACE");
+    if (filename == nullptr || filename[0] == '\0' || t.to_file) {
+        return t.to_file;
+    }
+    t.filename = filename;
+    t.logger = logger;
+    t.start = now();
+    t.to_file = true;
+    detail::enabled = true;
+    std::atexit(flush_at_exit);
+    logger->info("Tracing to '{}'", t.filename);
+    return true;
+}
+
+std::uint64_t now() {
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void set_observer(Observer observer) {
+    Tracer& t = tracer();
+    t.observer = observer;
+    detail::enabled = observer != nullptr || t.to_file;
+}
+
+void record(const char* name, std::uint64_t begin, std::uint64_t end) {
+    if (!enabled()) {
+        return;
+    }
+    Tracer& t = tracer();
+    const Observer observer = t.observer.load(std::memory_order_relaxed);
+    if (observer != nullptr) {
+        observer(name, begin, end);
+    }
+    if (!t.to_file.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Ring& ring = thread_ring();
+    const std::uint64_t i = ring.count.load(std::memory_order_relaxed);
+    ring.events[i % RING_SIZE] = Event{ name, begin, end };
+    ring.count.store(i + 1, std::memory_order_release);
+}
+
+const char* intern(const std::string& name) {
+    Tracer& t = tracer();
+    std::lock_guard<std::mutex> lock(t.names_mutex);
+    // Nodes of a std::set never move, so the strings stay where they are
+    return t.names.insert(name).first->c_str();
+}
+
+bool flush() {
+    Tracer& t = tracer();
+    if (!t.to_file) {
+        return false;
+    }
+    std::vector<std::pair<int, Event>> events;
+    std::size_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(t.rings_mutex);
+        for (const std::unique_ptr<Ring>& ring : t.rings) {
+            const std::uint64_t count = ring->count.load(std::memory_order_acquire);
+            const std::uint64_t first = count > RING_SIZE ? count - RING_SIZE : 0;
+            const std::size_t size = events.size();
+            for (std::uint64_t i = first; i < count; ++i) {
+                events.emplace_back(ring->thread_id, ring->events[i % RING_SIZE]);
+            }
+            // The thread may have wrapped around over the oldest events while they were copied
+            const std::uint64_t written = ring->count.load(std::memory_order_acquire);
+            const std::uint64_t overwritten = written > RING_SIZE ? std::min(written - RING_SIZE, count) : 0;
+            if (overwritten > first) {
+                events.erase(events.begin() + size, events.begin() + size + std::size_t(overwritten - first));
+            }
+            dropped += std::size_t(std::max(overwritten, first));
+        }
+    }
+
+    std::ofstream out(t.filename);
+    if (!out) {
+        t.logger->error("Cannot write the trace to '{}'", t.filename);
+        return false;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const Event& e = events[i].second;
+        const std::uint64_t begin = e.begin > t.start ? e.begin - t.start : 0;
+        const std::uint64_t duration = e.end > e.begin ? e.end - e.begin : 0;
+        out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"";
+        write_escaped(out, e.name);
+        out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].first
+            << ",\"ts\":" << double(begin) * 1e-3 << ",\"dur\":" << double(duration) * 1e-3 << "}";
+    }
+    out << "\n]}\n";
+    if (!out) {
+        t.logger->error("Cannot write the trace to '{}'", t.filename);
+        return false;
+    }
+    if (dropped > 0) {
+        t.logger->warn("{} trace events were dropped from full rings", dropped);
+    }
+    t.logger->info("Wrote {} trace events to '{}'", events.size(), t.filename);
+    return true;
+}
+
+} // namespace trace
@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Scoped tracing of the pipeline stages, saved as a chrome://tracing JSON file which ui.perfetto.dev opens as well.
+//
+// Tracing is off unless the environment variable FISH_TRACE names the file to write when trace::init() runs.
+// TRACE_SCOPE("name") then records the time spent in the rest of the enclosing scope on the calling thread, and
+// the stages of every BackgroundJob are recorded as well. When tracing is off a scope costs a load and a branch.
+//
+// Every thread records into a ring of its own without taking a lock: only that thread writes its ring and it
+// publishes every event with a release store of its event count. trace::flush() copies the published events of
+// all the rings into the file, from any thread. A ring keeps the last RING_SIZE events of its thread.
+//
+// An observer set with trace::set_observer() sees every event as it is recorded, which turns the scopes on
+// as well while no file is written, see metrics.h.
+namespace trace {
+
+constexpr std::size_t RING_SIZE = 1 << 14;
+
+namespace detail {
+extern std::atomic_bool enabled;
+}
+
+// Turn tracing on if FISH_TRACE is set, the file is written by flush() and when the program exits.
+// Returns whether tracing is on.
+bool init(std::shared_ptr<spdlog::logger> logger);
+
+// Whether the scopes record, because a file is written or an observer is set
+inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+// Called from the recording thread for every event, it must be thread safe and quick
+typedef void (*Observer)(const char* name, std::uint64_t begin, std::uint64_t end);
+void set_observer(Observer observer);
+
+// Nanoseconds on the steady clock
+std::uint64_t now();
+
+// Record an event of the calling thread. name must outlive the trace, e.g. a string literal or intern(name).
+void record(const char* name, std::uint64_t begin, std::uint64_t end);
+
+// A copy of name kept until the program exits, for event names built at run time
+const char* intern(const std::string& name);
+
+// Write the events recorded so far to the FISH_TRACE file, returns false if it cannot be written
+bool flush();
+
+class Scope {
+public:
+    explicit Scope(const char* name) : _name(name), _begin(enabled() ? now() : 0) {}
+    ~Scope() {
+        if (_begin != 0) {
+            record(_name, _begin, now());
+        }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* _name;
+    std::uint64_t _begin;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Trace the rest of the enclosing scope under name, a string literal
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif // TRACE_H
@@ -1,194 +1,436 @@
 #include "utils.h"
+#include "raw_volume_view.h"
+#include "fishvol.h"
+#include "parallel_for.h"
+#include "geodesic_solver.h"
 
 #include <igl/edges.h>
 #include <igl/barycentric_coordinates.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <numeric>
 #include <fstream>
 #include <iostream>
-#include <igl/harmonic.h>
-#include <igl/grad.h>
+#include <limits>
 #include <igl/adjacency_list.h>
 #include <igl/components.h>
 #include <glad/glad.h>
 
-void split_mesh_components(const Eigen::MatrixXi& TT, const Eigen::VectorXi& components, std::vector<Eigen::MatrixXi>& out) {
-  const int num_components = components.maxCoeff() + 1;
+namespace {
 
-  for (int c = 0; c < num_components; c++) {
-    int count = 0;
-    Eigen::MatrixXi TTcomp(TT.rows(), 4);
-    for (int i = 0; i < TT.rows(); i++) {
-      const int t1 = TT(i, 0), t2 = TT(i, 1), t3 = TT(i, 2), t4 = TT(i, 3);
-      const int comp = components[t1];
-      assert(components[t1] == components[t2] && components[t1] == components[t3] && components[t1] == components[t4]);
-      if (!(components[t1] == components[t2] && components[t1] == components[t3] && components[t1] == components[t4])) {
-          std::cerr << "T1: " << components[t1] << " " << components[t2] << " " << components[t3] << " " << components[t4];
-          std::cerr.flush();
-      }
-      if (comp == c) {
-        TTcomp.row(count) = Eigen::RowVector4i(t1, t2, t3, t4);
-        count += 1;
-      }
-    }
-    TTcomp.conservativeResize(count, 4);
-    out.push_back(TTcomp);
+// Counting sort of the indices [0, keys.size()) by key into offsets and sorted, keeping the order of equal keys
+template <typename Keys>
+void counting_sort(const Keys& keys, int num_keys, std::vector<int>& offsets, std::vector<int>& sorted) {
+  offsets.assign(num_keys + 1, 0);
+  for (int i = 0; i < static_cast<int>(keys.size()); i++) {
+    offsets[keys[i] + 1] += 1;
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  sorted.resize(keys.size());
+  std::vector<int> next(offsets.begin(), offsets.end() - 1);
+  for (int i = 0; i < static_cast<int>(keys.size()); i++) {
+    sorted[next[keys[i]]++] = i;
   }
 }
 
+}
 
-void tet_mesh_faces(const Eigen::MatrixXi& TT, Eigen::MatrixXi& TF, bool flip) {
-  using namespace std;
-
-  vector<array<int, 4>> tris_sorted;
+namespace {
 
-  vector<array<int, 4>> tris;
-  for (int i = 0; i < TT.rows(); i++) {
-    const int e1 = TT(i, 0);
-    const int e2 = TT(i, 1);
-    const int e3 = TT(i, 2);
-    const int e4 = TT(i, 3);
-    array<int, 4> t1, t2, t3, t4;
-    if (!flip) {
-      t1 = array<int, 4>{{ e1, e2, e3, INT_MAX }};
-      t2 = array<int, 4>{{ e1, e3, e4, INT_MAX }};
-      t3 = array<int, 4>{{ e2, e4, e3, INT_MAX }};
-      t4 = array<int, 4>{{ e1, e4, e2, INT_MAX }};
-    } else {
-      t1 = array<int, 4>{{ e1, e3, e2, INT_MAX }};
-      t2 = array<int, 4>{{ e1, e4, e3, INT_MAX }};
-      t3 = array<int, 4>{{ e2, e3, e4, INT_MAX }};
-      t4 = array<int, 4>{{ e1, e2, e4, INT_MAX }};
+// Root of the set of v. Halves the path on the way, the parent pointers only ever move towards the root, so
+// concurrent finds and unions see a valid forest at all times.
+int find_root(std::vector<std::atomic<int>>& parent, int v) {
+    for (;;) {
+        int p = parent[v].load(std::memory_order_relaxed);
+        if (p == v) {
+            return v;
+        }
+        const int gp = parent[p].load(std::memory_order_relaxed);
+        if (p != gp) {
+            parent[v].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+        }
+        v = gp;
     }
-    tris.push_back(t1);
-    tris.push_back(t2);
-    tris.push_back(t3);
-    tris.push_back(t4);
-    t1[3] = tris_sorted.size();
-    t2[3] = tris_sorted.size()+1;
-    t3[3] = tris_sorted.size()+2;
-    t4[3] = tris_sorted.size()+3;
-    sort(t1.begin(), t1.end());
-    sort(t2.begin(), t2.end());
-    sort(t3.begin(), t3.end());
-    sort(t4.begin(), t4.end());
-    tris_sorted.push_back(t1);
-    tris_sorted.push_back(t2);
-    tris_sorted.push_back(t3);
-    tris_sorted.push_back(t4);
-  }
+}
 
-  int fcount = 0;
-  TF.resize(tris_sorted.size(), 3);
-  sort(tris_sorted.begin(), tris_sorted.end());
-  for (int i = 0; i < TF.rows();) {
-    int v1 = tris_sorted[i][0], v2 = tris_sorted[i][1], v3 = tris_sorted[i][2];
-    int tid = tris_sorted[i][3];
-    int count = 0;
-    while (i < TF.rows() && v1 == tris_sorted[i][0] && v2 == tris_sorted[i][1] && v3 == tris_sorted[i][2]) {
-      i += 1;
-      count += 1;
+// Merge the sets of a and b, the root with the larger index is linked under the smaller one, so the root of
+// every set ends up being its smallest vertex
+void unite(std::vector<std::atomic<int>>& parent, int a, int b) {
+    for (;;) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a == b) {
+            return;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        int expected = a;
+        if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+            return;
+        }
     }
-    if (count == 1) {
-      TF.row(fcount++) = Eigen::RowVector3i(tris[tid][0], tris[tid][1], tris[tid][2]);
+}
+
+// Elements and vertices per chunk of the parallel loops of mesh_components
+constexpr std::size_t COMPONENTS_CHUNK_SIZE = 1 << 14;
+
+}
+
+void mesh_components(const Eigen::MatrixXi& F, Eigen::VectorXi& components) {
+    mesh_components(F, F.size() > 0 ? F.maxCoeff() + 1 : 0, components);
+}
+
+void mesh_components(const Eigen::MatrixXi& F, int num_vertices, Eigen::VectorXi& components) {
+    std::vector<std::atomic<int>> parent(num_vertices);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            parent[v].store(int(v), std::memory_order_relaxed);
+        }
+    }, COMPONENTS_CHUNK_SIZE);
+
+    parallel_for_chunks(std::size_t(F.rows()), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (Eigen::Index i = Eigen::Index(begin); i < Eigen::Index(end); i++) {
+            for (Eigen::Index j = 1; j < F.cols(); j++) {
+                unite(parent, F(i, 0), F(i, j));
+            }
+        }
+    }, COMPONENTS_CHUNK_SIZE);
+
+    // Every root is the smallest vertex of its set, so numbering the roots in order of their index numbers the
+    // components like the BFS of igl::components does
+    components.resize(num_vertices);
+    std::vector<int> root_rank(num_vertices);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            components[v] = find_root(parent, int(v));
+            root_rank[v] = components[v] == int(v) ? 1 : 0;
+        }
+    }, COMPONENTS_CHUNK_SIZE);
+    parallel_prefix_sum(root_rank, COMPONENTS_CHUNK_SIZE);
+    parallel_for_chunks(std::size_t(num_vertices), [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t v = begin; v < end; v++) {
+            components[v] = root_rank[components[v]] - 1;
+        }
+    }, COMPONENTS_CHUNK_SIZE);
+}
+
+void component_sizes(const Eigen::VectorXi& components, std::vector<int>& sizes) {
+    sizes.assign(components.size() > 0 ? std::size_t(components.maxCoeff()) + 1 : 0, 0);
+    for (Eigen::Index v = 0; v < components.size(); v++) {
+        sizes[components[v]] += 1;
     }
-  }
+}
 
-  TF.conservativeResize(fcount, 3);
+void keep_large_components(const Eigen::MatrixXi& F, const Eigen::VectorXi& components,
+                           const std::vector<int>& sizes, int min_size, Eigen::MatrixXi& kept) {
+    // All vertices of a face are in the same component, so its first vertex decides
+    const std::size_t num_faces = std::size_t(F.rows());
+    std::vector<int> offsets(num_faces);
+    parallel_for_chunks(num_faces, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t f = begin; f < end; f++) {
+            offsets[f] = sizes[components[F(Eigen::Index(f), 0)]] >= min_size ? 1 : 0;
+        }
+    }, COMPONENTS_CHUNK_SIZE);
+    parallel_prefix_sum(offsets, COMPONENTS_CHUNK_SIZE);
+
+    kept.resize(offsets.empty() ? 0 : offsets.back(), F.cols());
+    parallel_for_chunks(num_faces, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t f = begin; f < end; f++) {
+            const int previous = f == 0 ? 0 : offsets[f - 1];
+            if (offsets[f] != previous) {
+                kept.row(previous) = F.row(Eigen::Index(f));
+            }
+        }
+    }, COMPONENTS_CHUNK_SIZE);
 }
 
+void split_mesh_components(const Eigen::MatrixXi& TT, const Eigen::VectorXi& components, TetMeshComponents& out) {
+  const int num_components = components.size() > 0 ? components.maxCoeff() + 1 : 0;
 
-void load_tet_file(const std::string& tet, Eigen::MatrixXd& TV, Eigen::MatrixXi& TF, Eigen::MatrixXi& TT) {
-  using namespace std;
-  using namespace Eigen;
+  std::vector<int> tet_components(TT.rows());
+  for (int i = 0; i < TT.rows(); i++) {
+    const int t1 = TT(i, 0), t2 = TT(i, 1), t3 = TT(i, 2), t4 = TT(i, 3);
+    assert(components[t1] == components[t2] && components[t1] == components[t3] && components[t1] == components[t4]);
+    if (!(components[t1] == components[t2] && components[t1] == components[t3] && components[t1] == components[t4])) {
+        std::cerr << "T1: " << components[t1] << " " << components[t2] << " " << components[t3] << " " << components[t4];
+        std::cerr.flush();
+    }
+    tet_components[i] = components[t1];
+  }
+  counting_sort(tet_components, num_components, out.tet_offsets, out.tets);
+  counting_sort(components, num_components, out.vertex_offsets, out.vertices);
 
-  ifstream ifs(tet);
-
-  int nv = 0;
-  int nt = 0;
-  string header;
-  ifs >> header;
-  ifs >> nv;
-  ifs >> nt;
-
-  TV.resize(nv, 3);
-  TT.resize(nt, 4);
-  for (int i = 0; i < nv; i++) {
-    double x, y, z;
-    ifs >> x >> y >> z;
-    TV.row(i) = RowVector3d(x, y, z);
+  out.local_index.resize(components.size());
+  for (int c = 0; c < num_components; c++) {
+    for (int i = out.vertex_offsets[c]; i < out.vertex_offsets[c + 1]; i++) {
+      out.local_index[out.vertices[i]] = i - out.vertex_offsets[c];
+    }
   }
-  for (int i = 0; i < nt; i++) {
-    int a = -1, b = -1, c = -1, d = -1;
-    ifs >> a >> b >> c >> d;
-    TT.row(i) = RowVector4i(a, b, c, d);
+}
+
+void TetMeshComponents::extract(int c, const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                                Eigen::MatrixXd& outTV, Eigen::MatrixXi& outTT) const {
+  outTV.resize(num_vertices(c), TV.cols());
+  for (int i = 0; i < num_vertices(c); i++) {
+    outTV.row(i) = TV.row(vertices[vertex_offsets[c] + i]);
   }
+  outTT.resize(num_tets(c), TT.cols());
+  for (int i = 0; i < num_tets(c); i++) {
+    const int t = tets[tet_offsets[c] + i];
+    for (int j = 0; j < TT.cols(); j++) {
+      outTT(i, j) = local_index[TT(t, j)];
+    }
+  }
+}
 
-  tet_mesh_faces(TT, TF, true /*flip*/);
+void split_mesh_components(const Eigen::MatrixXi& TT, const Eigen::VectorXi& components, std::vector<Eigen::MatrixXi>& out) {
+  TetMeshComponents split;
+  split_mesh_components(TT, components, split);
+
+  out.resize(split.num_components());
+  for (int c = 0; c < split.num_components(); c++) {
+    out[c].resize(split.num_tets(c), 4);
+    for (int i = 0; i < split.num_tets(c); i++) {
+      out[c].row(i) = TT.row(split.tets[split.tet_offsets[c] + i]);
+    }
+  }
 }
 
-bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, Eigen::VectorXf& out, std::shared_ptr<spdlog::logger> logger, bool normalize) {
-    const size_t num_bytes = (size_t)(dims[0]) * (size_t)(dims[1]) * (size_t)(dims[2]);
 
-    char* data = new char[num_bytes];
-    std::ifstream rawfile(rawfilename, std::ifstream::binary);
+void reorder_tet_mesh(Eigen::MatrixXd& TV, Eigen::MatrixXi& TT, Eigen::VectorXi* new_index) {
+  const int num_vertices = TV.rows();
+  const int num_tets = TT.rows();
+  if (num_vertices == 0) {
+    return;
+  }
 
-    if (!rawfile.good()) {
-        logger->error("RawFile '{}' does not exist.", rawfilename);
-        return false;
+  // 21 bits per axis over the bounding box, interleaved into 63 bits
+  const Eigen::RowVector3d lo = TV.colwise().minCoeff();
+  const double extent = (TV.colwise().maxCoeff() - lo).maxCoeff();
+  const double scale = extent > 0.0 ? double((1 << 21) - 1) / extent : 0.0;
+  auto spread = [](uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+  };
+  std::vector<std::pair<uint64_t, int>> codes(num_vertices);
+  parallel_for_chunks(num_vertices, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t v = begin; v < end; v++) {
+      uint64_t code = 0;
+      for (int a = 0; a < 3; a++) {
+        code |= spread(uint64_t((TV(v, a) - lo[a]) * scale)) << a;
+      }
+      codes[v] = std::make_pair(code, int(v));
+    }
+  }, 1 << 14);
+  std::sort(codes.begin(), codes.end());
+
+  std::vector<int> index(num_vertices);
+  Eigen::MatrixXd sorted_TV(num_vertices, TV.cols());
+  parallel_for_chunks(num_vertices, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t i = begin; i < end; i++) {
+      index[codes[i].second] = int(i);
+      sorted_TV.row(i) = TV.row(codes[i].second);
+    }
+  }, 1 << 14);
+  TV = std::move(sorted_TV);
+  std::vector<std::pair<uint64_t, int>>().swap(codes);
+
+  std::vector<int> min_vertex(num_tets);
+  parallel_for_chunks(num_tets, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t t = begin; t < end; t++) {
+      int m = num_vertices;
+      for (int j = 0; j < TT.cols(); j++) {
+        TT(t, j) = index[TT(t, j)];
+        m = std::min(m, TT(t, j));
+      }
+      min_vertex[t] = m;
+    }
+  }, 1 << 14);
+  std::vector<int> offsets, order;
+  counting_sort(min_vertex, num_vertices, offsets, order);
+  Eigen::MatrixXi sorted_TT(num_tets, TT.cols());
+  parallel_for_chunks(num_tets, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t t = begin; t < end; t++) {
+      sorted_TT.row(t) = TT.row(order[t]);
     }
+  }, 1 << 14);
+  TT = std::move(sorted_TT);
 
-    rawfile.read(data, num_bytes);
-    if (!rawfile) {
-        logger->error("Only read {} bytes from RawFile '{}', but expected to read {} bytes.", rawfile.gcount(), rawfilename, num_bytes);
-        return false;
+  if (new_index) {
+    *new_index = Eigen::Map<const Eigen::VectorXi>(index.data(), num_vertices);
+  }
+}
+
+void tet_mesh_faces(const Eigen::MatrixXi& TT, Eigen::MatrixXi& TF, bool flip) {
+  // Outward faces of a tet, for tets oriented like igl::volume expects and for flipped ones
+  static const int tet_faces[2][4][3] = {
+    {{ 0, 1, 2 }, { 0, 2, 3 }, { 1, 3, 2 }, { 0, 3, 1 }},
+    {{ 0, 2, 1 }, { 0, 3, 2 }, { 1, 2, 3 }, { 0, 1, 3 }},
+  };
+  const int num_tets = TT.rows();
+  const int num_faces = 4 * num_tets;
+  const int num_vertices = TT.size() > 0 ? TT.maxCoeff() + 1 : 0;
+
+  // Face 4 * t + i is face i of tet t. It is keyed by its smallest vertex and by the other two packed in 64 bits.
+  std::vector<int> min_vertex(num_faces);
+  std::vector<uint64_t> keys(num_faces);
+  parallel_for_chunks(num_tets, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t t = begin; t < end; t++) {
+      for (int i = 0; i < 4; i++) {
+        std::array<int, 3> f = {{ TT(t, tet_faces[flip][i][0]), TT(t, tet_faces[flip][i][1]), TT(t, tet_faces[flip][i][2]) }};
+        std::sort(f.begin(), f.end());
+        min_vertex[4 * t + i] = f[0];
+        keys[4 * t + i] = (uint64_t(uint32_t(f[1])) << 32) | uint32_t(f[2]);
+      }
     }
-    rawfile.close();
-
-    out.resize(num_bytes);
-    for (int i = 0; i < num_bytes; i++) {
-        out[i] = static_cast<double>(reinterpret_cast<std::uint8_t*>(data)[i]);
-        if (normalize) {
-            static_assert(sizeof(char) == sizeof(std::uint8_t), "Your system is fucked"); // This is dumb but why not
-            out[i] /= 255.0;
+  }, 1 << 14);
+
+  // Only a handful of faces share their smallest vertex, so bucketing them by it leaves small groups to sort
+  std::vector<int> offsets, sorted;
+  counting_sort(min_vertex, num_vertices, offsets, sorted);
+
+  // A face is on the boundary when no other face of its group has the same key
+  std::vector<char> on_boundary(num_faces, 0);
+  parallel_for_chunks(num_vertices, [&](std::size_t begin, std::size_t end, std::size_t) {
+    for (std::size_t v = begin; v < end; v++) {
+      const auto group_begin = sorted.begin() + offsets[v];
+      const auto group_end = sorted.begin() + offsets[v + 1];
+      std::sort(group_begin, group_end, [&](int a, int b) { return keys[a] < keys[b]; });
+      for (auto it = group_begin; it != group_end;) {
+        auto run_end = it + 1;
+        while (run_end != group_end && keys[*run_end] == keys[*it]) {
+          ++run_end;
+        }
+        if (run_end - it == 1) {
+          on_boundary[*it] = 1;
         }
+        it = run_end;
+      }
+    }
+  }, 1 << 12);
+
+  // Faces come out in the order of their tets
+  const int fcount = std::count(on_boundary.begin(), on_boundary.end(), 1);
+  TF.resize(fcount, 3);
+  for (int f = 0, row = 0; f < num_faces; f++) {
+    if (on_boundary[f]) {
+      const int t = f / 4, i = f % 4;
+      TF.row(row++) = Eigen::RowVector3i(TT(t, tet_faces[flip][i][0]), TT(t, tet_faces[flip][i][1]), TT(t, tet_faces[flip][i][2]));
     }
+  }
+}
 
+
+bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, Eigen::VectorXf& out, std::shared_ptr<spdlog::logger> logger, bool normalize) {
+    RawVolumeView view;
+    if (!view.open(rawfilename, dims, logger)) {
+        return false;
+    }
+
+    // Convert straight out of the mapped file, we never hold a second copy of the raw bytes
+    const float scale = normalize ? 1.f / 255.f : 1.f;
+    out = Eigen::Map<const Eigen::Matrix<std::uint8_t, Eigen::Dynamic, 1>>(view.data(), view.size()).cast<float>() * scale;
     return true;
 }
 
 bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, std::vector<uint8_t> &out, std::shared_ptr<spdlog::logger> logger) {
-    const size_t num_bytes = (size_t)(dims[0]) * (size_t)(dims[1]) * (size_t)(dims[2]);
-
-    logger->trace("allocating {} bytes", num_bytes);
-    char* data = new char[num_bytes];
-    logger->trace("Allocated {} bytes", num_bytes);
-
-    std::ifstream rawfile(rawfilename, std::ifstream::binary);
-    if (!rawfile.good()) {
-        logger->error("RawFile '{}' does not exist.", rawfilename);
+    RawVolumeView view;
+    if (!view.open(rawfilename, dims, logger)) {
         return false;
     }
 
-    logger->trace("About to read {} bytes", num_bytes);
-    rawfile.read(data, num_bytes);
-    if (!rawfile) {
-        logger->error("Only read {} bytes from RawFile '{}', but expected to read {} bytes.", rawfile.gcount(), rawfilename, num_bytes);
-        return false;
+    logger->trace("Copying {} bytes", view.size());
+    out.assign(view.data(), view.data() + view.size());
+    logger->trace("Copied output");
+    return true;
+}
+
+bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, VolumeBuffer<uint8_t> &out, std::shared_ptr<spdlog::logger> logger, VolumeHistogram* histogram) {
+    RawVolumeView view;
+    const uint8_t* src = nullptr;
+    if (is_fishvol_filename(rawfilename)) {
+        // Chunked files are decompressed straight into the output, there is nothing left to copy below
+        FishVolFile file;
+        if (!file.open(rawfilename, logger)) {
+            return false;
+        }
+        if (file.dims() != dims || file.bytes_per_voxel() != 1) {
+            logger->error("Fishvol file '{}' does not contain an 8 bit volume of size {}x{}x{}", rawfilename, dims[0], dims[1], dims[2]);
+            return false;
+        }
+        if (!file.read_level(0, out.storage(), logger)) {
+            return false;
+        }
+    } else {
+        if (!view.open(rawfilename, dims, logger)) {
+            return false;
+        }
+        out.resize(view.size());
+        src = view.data();
     }
-    rawfile.close();
-    logger->trace("read {} bytes", num_bytes);
 
-    logger->trace("Resizing output");
-    out.resize(num_bytes);
-    for (size_t i = 0; i < num_bytes; i++) {
-        out[i] = data[i];
+    const size_t num_bytes = out.size();
+
+    // Each worker copies its chunk out of the mapping and bins it, the partial histograms are merged at the end
+    std::vector<std::array<std::uint64_t, 256>> partial_bins(parallel_num_chunks(num_bytes, 1 << 20));
+    parallel_for_chunks(num_bytes, [&](size_t begin, size_t end, size_t chunk) {
+        uint8_t* dst = out.data();
+        if (src != nullptr) {
+            std::copy(src + begin, src + end, dst + begin);
+        }
+        if (histogram != nullptr) {
+            std::array<std::uint64_t, 256>& bins = partial_bins[chunk];
+            bins.fill(0);
+            for (size_t i = begin; i < end; i++) {
+                bins[dst[i]] += 1;
+            }
+        }
+    }, 1 << 20);
+
+    if (histogram != nullptr) {
+        histogram->clear();
+        for (const std::array<std::uint64_t, 256>& bins : partial_bins) {
+            for (int i = 0; i < 256; i++) {
+                histogram->bins[i] += bins[i];
+            }
+        }
+        histogram->update_range();
     }
-    logger->trace("Copied output");
     return true;
 }
 
+void quantize_volume(const VolumeBuffer<uint8_t>& in, uint8_t min_value, uint8_t max_value, std::vector<uint8_t>& out) {
+    out.resize(in.size());
+
+    // The mapping only has 256 possible inputs so we tabulate it rather than doing a division per voxel
+    const double value_range = std::max(double(max_value) - double(min_value), 1.0);
+    std::array<uint8_t, 256> remap;
+    bool is_identity = true;
+    for (int i = 0; i < 256; i++) {
+        const double v = std::min(std::max((i - double(min_value)) / value_range, 0.0), 1.0);
+        remap[i] = static_cast<uint8_t>(v * std::numeric_limits<uint8_t>::max());
+        is_identity = is_identity && remap[i] == i;
+    }
+
+    parallel_for_chunks(in.size(), [&](size_t begin, size_t end, size_t) {
+        if (is_identity) {
+            std::copy(in.data() + begin, in.data() + end, out.data() + begin);
+        } else {
+            std::transform(in.data() + begin, in.data() + end, out.data() + begin,
+                           [&remap](uint8_t v) { return remap[v]; });
+        }
+    }, 1 << 20);
+}
+
 void edge_endpoints(const Eigen::MatrixXd& V,
                     const Eigen::MatrixXi& F,
                     Eigen::MatrixXd& V1,
@@ -196,11 +438,14 @@ void edge_endpoints(const Eigen::MatrixXd& V,
   Eigen::MatrixXi E;
   igl::edges(F, E);
 
+  // Column by column, so the writes are sequential in the column major outputs
   V1.resize(E.rows(), 3);
   V2.resize(E.rows(), 3);
-  for (int i = 0; i < E.rows(); i++) {
-    V1.row(i) = V.row(E(i, 0));
-    V2.row(i) = V.row(E(i, 1));
+  for (int c = 0; c < 3; c++) {
+    for (int i = 0; i < E.rows(); i++) {
+      V1(i, c) = V(E(i, 0), c);
+      V2(i, c) = V(E(i, 1), c);
+    }
   }
 }
 
@@ -216,34 +461,20 @@ bool point_in_tet(const Eigen::MatrixXd& TV,
     return (double(0) < val) - (val < double(0));
   };
 
-  Matrix4d D0, D1, D2, D3, D4;
-  RowVector3d v1 = TV.row(TT(tet, 0)), v2 = TV.row(TT(tet, 1));
-  RowVector3d v3 = TV.row(TT(tet, 2)), v4 = TV.row(TT(tet, 3));
-
-  D0 << v1[0], v1[1], v1[2], 1,
-        v2[0], v2[1], v2[2], 1,
-        v3[0], v3[1], v3[2], 1,
-        v4[0], v4[1], v4[2], 1;
-
-  RowVector4d pt_row(pt[0], pt[1], pt[2], 1);
-  D1 = D0;
-  D1.row(0) = pt_row;
-
-  D2 = D0;
-  D2.row(1) = pt_row;
-
-  D3 = D0;
-  D3.row(2) = pt_row;
+  // Orientation of the tet (a, b, c, d), the 4x4 determinant of its homogeneous coordinates up to the sign
+  auto orient = [](const Vector3d& a, const Vector3d& b, const Vector3d& c, const Vector3d& d) -> double {
+    return (b - a).dot((c - a).cross(d - a));
+  };
 
-  D4 = D0;
-  D4.row(3) = pt_row;
+  const Vector3d v1 = TV.row(TT(tet, 0)).transpose(), v2 = TV.row(TT(tet, 1)).transpose();
+  const Vector3d v3 = TV.row(TT(tet, 2)).transpose(), v4 = TV.row(TT(tet, 3)).transpose();
+  const Vector3d p = pt.transpose();
 
-  const double det0 = D0.determinant();
-  assert(det0 != 0);
-  const double det1 = D1.determinant();
-  const double det2 = D2.determinant();
-  const double det3 = D3.determinant();
-  const double det4 = D4.determinant();
+  assert(orient(v1, v2, v3, v4) != 0);
+  const double det1 = orient(p, v2, v3, v4);
+  const double det2 = orient(v1, p, v3, v4);
+  const double det3 = orient(v1, v2, p, v4);
+  const double det4 = orient(v1, v2, v3, p);
 
   return sgn(det1) == sgn(det2) && sgn(det1) == sgn(det3) && sgn(det1) == sgn(det4);
 }
@@ -298,26 +529,10 @@ void heat_diffusion_distances(const Eigen::MatrixXd& TV,
                               const std::vector<std::pair<int, int>>& endpoints,
                               Eigen::VectorXd& isovals,
                               bool normalize) {
-  Eigen::MatrixXi constraint_indices;
-  Eigen::MatrixXd constraint_values;
-  constraint_indices.resize(2*endpoints.size(), 1);
-  constraint_values.resize(2*endpoints.size(), 1);
-
-  int ccount = 0;
-  for (int i = 0; i < endpoints.size(); i++) {
-    auto ep = endpoints[i];
-    constraint_indices(ccount, 0) = ep.second;
-    constraint_indices(ccount + 1, 0) = ep.first;
-    constraint_values(ccount, 0) = 1.0;
-    constraint_values(ccount+1, 0) = 0.0;
-    ccount += 2;
-  }
-
-  igl::harmonic(TV, TT, constraint_indices,
-                constraint_values, 1, isovals);
-
-  if (normalize) {
-    scale_zero_one(isovals, isovals);
+  // Factors the Laplacian through GeodesicSolver, use it directly to reuse the factorization across endpoints
+  GeodesicSolver solver;
+  if (!solver.compute(TV, TT) || !solver.harmonic(endpoints, isovals, normalize)) {
+    isovals = Eigen::VectorXd::Zero(TV.rows());
   }
 }
 
@@ -347,32 +562,38 @@ void remesh_connected_components(int comp, const Eigen::VectorXi& C,
                                  Eigen::VectorXi& outCMap,
                                  Eigen::MatrixXd& outTV,
                                  Eigen::MatrixXi& outTT) {
+    // Count the vertices and tets of the component first so the outputs are allocated at their final size
     outCMap.resize(C.size());
-    outTV.resize(TV.rows(), TV.cols());
     int v_count = 0;
     for (int i = 0; i < C.size(); i++) {
         if (C[i] == comp) {
             outCMap[i] = v_count;
-            outTV.row(v_count) = TV.row(i);
             v_count += 1;
         } else {
             outCMap[i] = -1;
         }
     }
-    outTV.conservativeResize(v_count, TV.cols());
+    outTV.resize(v_count, TV.cols());
+    for (int i = 0; i < C.size(); i++) {
+        if (outCMap[i] >= 0) {
+            outTV.row(outCMap[i]) = TV.row(i);
+        }
+    }
 
     int f_count = 0;
-    outTT.resize(TT.rows(), TT.cols());
     for (int i = 0; i < TT.rows(); i++) {
-        const int c = C[TT(i, 0)];
-        if (c == comp) {
+        f_count += C[TT(i, 0)] == comp;
+    }
+    outTT.resize(f_count, TT.cols());
+    f_count = 0;
+    for (int i = 0; i < TT.rows(); i++) {
+        if (C[TT(i, 0)] == comp) {
             for (int j = 0; j < TT.cols(); j++) {
                 outTT(f_count, j) = outCMap[TT(i, j)];
             }
             f_count += 1;
         }
     }
-    outTT.conservativeResize(f_count, TT.cols());
 }
 
 // Compute approximate geodesic distance
@@ -381,24 +602,10 @@ void geodesic_distances(const Eigen::MatrixXd& TV,
                         const std::vector<std::pair<int, int>>& endpoints,
                         Eigen::VectorXd& isovals,
                         bool normalized) {
-  using namespace std;
-  using namespace Eigen;
-
-  typedef SparseMatrix<double> SparseMatrixXd;
-
-  // Discrete Gradient operator
-  SparseMatrixXd G;
-  igl::grad(TV, TT, G);
-  //uniform_grad(TT, G);
-
-  heat_diffusion_distances(TV, TT, endpoints, isovals, true /*normalize*/);
-
-  VectorXd g = G*isovals;
-  SimplicialLDLT<SparseMatrixXd> solver;
-  solver.compute(G.transpose()*G);
-  isovals = solver.solve(G.transpose()*g);
-  if (normalized) {
-    scale_zero_one(isovals, isovals);
+  // Harmonic function from the endpoints, then its gradient integrated back in the least squares sense
+  GeodesicSolver solver;
+  if (!solver.compute(TV, TT) || !solver.solve(endpoints, isovals, normalized)) {
+    isovals = Eigen::VectorXd::Zero(TV.rows());
   }
 }
 
@@ -8,6 +8,8 @@
 #include <memory>
 #include <glad/glad.h>
 
+#include "volume_buffer.h"
+
 
 #ifdef _MSC_VER
     static constexpr int PATH_BUFFER_SIZE = 4*4096;
@@ -32,17 +34,71 @@ void heat_diffusion_distances(const Eigen::MatrixXd& TV,
                                 Eigen::VectorXd& isovals,
                                 bool normalize);
 
+// Connected components of a tet mesh as compressed index lists, built by a counting sort in O(vertices + tets).
+// The tets of component c are tets[tet_offsets[c]] .. tets[tet_offsets[c + 1] - 1] in increasing order, and
+// likewise for the vertices. local_index[v] is the position of vertex v within its component.
+struct TetMeshComponents {
+    std::vector<int> tet_offsets;
+    std::vector<int> tets;
+    std::vector<int> vertex_offsets;
+    std::vector<int> vertices;
+    Eigen::VectorXi local_index;
+
+    int num_components() const { return static_cast<int>(tet_offsets.size()) - 1; }
+    int num_tets(int c) const { return tet_offsets[c + 1] - tet_offsets[c]; }
+    int num_vertices(int c) const { return vertex_offsets[c + 1] - vertex_offsets[c]; }
+    const int* tets_begin(int c) const { return tets.data() + tet_offsets[c]; }
+    const int* tets_end(int c) const { return tets.data() + tet_offsets[c + 1]; }
+
+    // Sub mesh of component c with its own vertex indices, what remesh_connected_components computes
+    void extract(int c, const Eigen::MatrixXd& TV, const Eigen::MatrixXi& TT,
+                 Eigen::MatrixXd& outTV, Eigen::MatrixXi& outTT) const;
+};
+
+// Connected components of the vertices of a mesh with any number of vertices per element (tets, triangles or
+// edges), the same labels as igl::components gives: components are numbered in the order of their smallest vertex,
+// and vertices used by no element get components of their own. The elements are merged in parallel by a lock-free
+// union-find, in one pass over F, instead of a BFS over an adjacency matrix. There are num_vertices vertices, by
+// default as many as F indexes.
+void mesh_components(const Eigen::MatrixXi& F, Eigen::VectorXi& components);
+void mesh_components(const Eigen::MatrixXi& F, int num_vertices, Eigen::VectorXi& components);
+
+// Number of vertices in each component of components, as computed by mesh_components
+void component_sizes(const Eigen::VectorXi& components, std::vector<int>& sizes);
+
+// The faces of F, in their order in F, whose component has at least min_size vertices. components and sizes come
+// from mesh_components and component_sizes. The faces are tested in parallel and the kept ones are written at the
+// offsets of a parallel prefix sum, so filtering a noisy scan with millions of specks does not copy F serially.
+void keep_large_components(const Eigen::MatrixXi& F, const Eigen::VectorXi& components,
+                           const std::vector<int>& sizes, int min_size, Eigen::MatrixXi& kept);
+
+// components holds the component of each vertex, as computed by mesh_components or igl::components
+void split_mesh_components(const Eigen::MatrixXi& TT, const Eigen::VectorXi& components, TetMeshComponents& out);
+
+// Tets of each component, indexing the vertices of the whole mesh
 void split_mesh_components(const Eigen::MatrixXi& TT, const Eigen::VectorXi& components, std::vector<Eigen::MatrixXi>& out);
 
 
-void tet_mesh_faces(const Eigen::MatrixXi& TT, Eigen::MatrixXi& TF, bool flip=false);
+// Renumber the vertices of a tet mesh along a Morton curve of their positions and sort the tets by their smallest
+// vertex, keeping the order of the tets with the same one and the orientation of every tet. Vertices close in space
+// are then close in memory, and so are the tets around them, for the sweeps over the mesh such as the gradients,
+// the assembly of the solvers, the surface extraction and the upload. Vertex v becomes (*new_index)[v].
+void reorder_tet_mesh(Eigen::MatrixXd& TV, Eigen::MatrixXi& TT, Eigen::VectorXi* new_index = nullptr);
 
-void load_tet_file(const std::string& tet, Eigen::MatrixXd& TV, Eigen::MatrixXi& TF, Eigen::MatrixXi& TT);
+// Boundary faces of the tet mesh, the faces belonging to a single tet, oriented outward. Tets are oriented like
+// igl::volume expects (the faces match igl::boundary_facets) or the other way around with flip.
+void tet_mesh_faces(const Eigen::MatrixXi& TT, Eigen::MatrixXi& TF, bool flip=false);
 
 bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, Eigen::VectorXf &out, std::shared_ptr<spdlog::logger> logger, bool normalize = true);
 
 bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, std::vector<uint8_t> &out, std::shared_ptr<spdlog::logger> logger);
 
+// Load an 8 bit raw (or .fishvol) file, optionally computing its histogram in the same (multi-threaded) pass
+bool load_rawfile(const std::string& rawfilename, const Eigen::RowVector3i& dims, VolumeBuffer<uint8_t> &out, std::shared_ptr<spdlog::logger> logger, VolumeHistogram* histogram = nullptr);
+
+// Linearly remap the values of in so that [min_value, max_value] covers [0, 255]
+void quantize_volume(const VolumeBuffer<uint8_t>& in, uint8_t min_value, uint8_t max_value, std::vector<uint8_t>& out);
+
 void edge_endpoints(const Eigen::MatrixXd& V,
                     const Eigen::MatrixXi& F,
                     Eigen::MatrixXd& V1,
@@ -56,13 +112,14 @@ bool point_in_tet(const Eigen::MatrixXd& TV,
                   int tet);
 
 
-// Return the index of the tet containing the point p or -1 if the vertex is in no tets
+// Return the index of the tet containing the point p or -1 if the vertex is in no tets. This scans all of the
+// tets, use a TetMeshSpatialIndex to locate many points in the same mesh.
 int containing_tet(const Eigen::MatrixXd& TV,
                    const Eigen::MatrixXi& TT,
                    const Eigen::RowVector3d& p);
 
 
-// Return the index of the closest vertex to p
+// Return the index of the closest vertex to p, scanning all of the vertices like containing_tet
 int nearest_vertex(const Eigen::MatrixXd& TV, const Eigen::RowVector3d& p);
 
 // Compute a new mesh with only the connected component comp
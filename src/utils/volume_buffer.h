@@ -0,0 +1,124 @@
+#ifndef VOLUME_BUFFER_H
+#define VOLUME_BUFFER_H
+
+#include <Eigen/Core>
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Per voxel type information used to upload and normalize a VolumeBuffer
+template <typename T>
+struct VolumeBufferTraits;
+
+template <>
+struct VolumeBufferTraits<std::uint8_t> {
+    static constexpr GLenum gl_type() { return GL_UNSIGNED_BYTE; }
+    static constexpr GLenum gl_internal_format() { return GL_R8; }
+    static constexpr float normalization_scale() { return 1.f / 255.f; }
+};
+
+template <>
+struct VolumeBufferTraits<std::uint16_t> {
+    static constexpr GLenum gl_type() { return GL_UNSIGNED_SHORT; }
+    static constexpr GLenum gl_internal_format() { return GL_R16; }
+    static constexpr float normalization_scale() { return 1.f / 65535.f; }
+};
+
+template <>
+struct VolumeBufferTraits<float> {
+    static constexpr GLenum gl_type() { return GL_FLOAT; }
+    static constexpr GLenum gl_internal_format() { return GL_R32F; }
+    static constexpr float normalization_scale() { return 1.f; }
+};
+
+
+// Dense scalar volume stored in its native voxel type (x fastest, then y, then z).
+// Consumers that need values in [0, 1] should use normalized() or normalized_value(),
+// which convert lazily instead of materializing a float copy of the whole volume.
+template <typename T>
+class VolumeBuffer {
+public:
+    typedef T Scalar;
+    typedef VolumeBufferTraits<T> Traits;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, 1> VectorType;
+    typedef Eigen::Map<VectorType> MapType;
+    typedef Eigen::Map<const VectorType> ConstMapType;
+
+    VolumeBuffer() = default;
+    explicit VolumeBuffer(std::size_t num_voxels) : _data(num_voxels) {}
+
+    void resize(std::size_t num_voxels) { _data.resize(num_voxels); }
+    void clear() { _data.clear(); _data.shrink_to_fit(); }
+
+    std::size_t size() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+    std::size_t size_in_bytes() const { return _data.size() * sizeof(T); }
+
+    T* data() { return _data.data(); }
+    const T* data() const { return _data.data(); }
+
+    T& operator[](std::size_t i) { return _data[i]; }
+    const T& operator[](std::size_t i) const { return _data[i]; }
+
+    std::vector<T>& storage() { return _data; }
+    const std::vector<T>& storage() const { return _data; }
+
+    // Eigen views of the raw voxel values. These do not copy.
+    MapType as_eigen() { return MapType(_data.data(), _data.size()); }
+    ConstMapType as_eigen() const { return ConstMapType(_data.data(), _data.size()); }
+
+    // Voxel value mapped to [0, 1] (or left as is for float volumes)
+    float normalized_value(std::size_t i) const {
+        return static_cast<float>(_data[i]) * Traits::normalization_scale();
+    }
+
+    // Lazy normalized view of the volume, evaluates to an Eigen::VectorXf only if assigned to one
+    auto normalized() const -> decltype(std::declval<ConstMapType>().template cast<float>() * float()) {
+        return as_eigen().template cast<float>() * Traits::normalization_scale();
+    }
+
+    // Smallest and largest voxel value in a single pass
+    std::pair<T, T> range() const {
+        if (_data.empty()) {
+            return std::make_pair(T(0), T(0));
+        }
+        auto mm = std::minmax_element(_data.begin(), _data.end());
+        return std::make_pair(*mm.first, *mm.second);
+    }
+
+private:
+    std::vector<T> _data;
+};
+
+// Histogram of an 8 bit volume. This is filled in while the volume is loaded so the
+// value range comes for free and the transfer function editor can display it.
+struct VolumeHistogram {
+    std::array<std::uint64_t, 256> bins = {};
+    std::uint8_t min_value = 0;
+    std::uint8_t max_value = 0;
+
+    void clear() {
+        bins.fill(0);
+        min_value = 0;
+        max_value = 0;
+    }
+
+    // Recompute min_value and max_value from the bins
+    void update_range() {
+        int lo = 0, hi = 255;
+        while (lo < 255 && bins[lo] == 0) { lo += 1; }
+        while (hi > 0 && bins[hi] == 0) { hi -= 1; }
+        if (lo > hi) {
+            lo = hi = 0;
+        }
+        min_value = static_cast<std::uint8_t>(lo);
+        max_value = static_cast<std::uint8_t>(hi);
+    }
+};
+
+#endif // VOLUME_BUFFER_H
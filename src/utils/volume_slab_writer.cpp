@@ -0,0 +1,167 @@
+#include "volume_slab_writer.h"
+
+#include "direct_file_writer.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+VolumeSlabWriter::~VolumeSlabWriter() {
+    if (_thread.joinable()) {
+        finish();
+        _thread.join();
+    }
+}
+
+bool VolumeSlabWriter::begin(const std::string& filename, const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+                             std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options) {
+    if (_thread.joinable()) {
+        if (!_done) {
+            logger->error("Cannot write '{}' while '{}' is still being written", filename, _filename);
+            return false;
+        }
+        _thread.join();
+    }
+
+    _filename = filename;
+    _dims = dims;
+    _bytes_per_voxel = bytes_per_voxel;
+    _options = options;
+    _logger = logger;
+    _slabs.clear();
+    _finished = false;
+    _done = false;
+    _succeeded = false;
+    _thread = std::thread(&VolumeSlabWriter::write_slabs, this);
+    return true;
+}
+
+void VolumeSlabWriter::push_slab(std::vector<std::uint8_t>&& voxels) {
+    static metrics::Counter& exported_bytes =
+        metrics::counter("unwind_export_bytes_total", "Voxel bytes of the exported volumes, before compression");
+    exported_bytes.add(voxels.size());
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _slabs.push_back(std::move(voxels));
+    }
+    _slab_available.notify_one();
+}
+
+std::size_t VolumeSlabWriter::num_queued() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _slabs.size();
+}
+
+void VolumeSlabWriter::wait_for_queue(std::size_t max_queued) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slab_taken.wait(lock, [&]() { return _slabs.size() < max_queued || _done; });
+}
+
+void VolumeSlabWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+    }
+    _slab_available.notify_one();
+}
+
+bool VolumeSlabWriter::wait() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    return _succeeded;
+}
+
+void VolumeSlabWriter::write_slabs() {
+    const std::size_t num_bytes = std::size_t(_dims[0]) * std::size_t(_dims[1]) * std::size_t(_dims[2]) * _bytes_per_voxel;
+    const bool fishvol = is_fishvol_filename(_filename);
+
+    DirectFileWriter file;
+    std::vector<std::uint8_t> volume;
+    if (fishvol) {
+        volume.resize(num_bytes);
+    } else if (file.open(_filename) && !file.is_direct()) {
+        _logger->debug("'{}' is written through the page cache, its file system has no direct I/O", _filename);
+    }
+
+    // Level l - 1 slices are reduced into level l as soon as both slices feeding them arrived, so the
+    // pyramid is complete right after the last slab instead of taking another pass over the volume
+    const int num_levels = fishvol ? std::max(_options.num_levels, 1) : 1;
+    std::vector<Eigen::RowVector3i> level_dims(static_cast<std::size_t>(num_levels), _dims);
+    std::vector<std::vector<std::uint8_t>> coarse_levels(static_cast<std::size_t>(num_levels));
+    std::vector<int> num_level_slices(static_cast<std::size_t>(num_levels), 0);
+    for (int l = 1; l < num_levels; l++) {
+        level_dims[l] = fishvol_coarser_dims(level_dims[l-1]);
+        coarse_levels[l].resize(std::size_t(level_dims[l].prod()) * _bytes_per_voxel);
+    }
+    auto level_data = [&](int l) { return l == 0 ? volume.data() : coarse_levels[l].data(); };
+    auto reduce_levels = [&](int num_full_res_slices) {
+        num_level_slices[0] = num_full_res_slices;
+        for (int l = 1; l < num_levels; l++) {
+            const int num_input_slices = num_level_slices[l-1];
+            const int num_ready = num_input_slices == level_dims[l-1][2] ? level_dims[l][2] : num_input_slices / 2;
+            if (num_ready > num_level_slices[l]) {
+                fishvol_downsample_slices(level_data(l-1), level_dims[l-1], _bytes_per_voxel, level_data(l),
+                                          num_level_slices[l], num_ready);
+                num_level_slices[l] = num_ready;
+            }
+        }
+    };
+    const std::size_t slice_bytes = std::max<std::size_t>(std::size_t(_dims[0]) * std::size_t(_dims[1]) * _bytes_per_voxel, 1);
+
+    bool ok = fishvol || file.is_open();
+    std::size_t num_written = 0;
+    while (true) {
+        std::vector<std::uint8_t> slab;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _slab_available.wait(lock, [&]() { return !_slabs.empty() || _finished; });
+            if (_slabs.empty()) {
+                break;
+            }
+            slab = std::move(_slabs.front());
+            _slabs.pop_front();
+        }
+        _slab_taken.notify_all();
+
+        // Keep draining the queue after an error so the producer is never blocked
+        if (!ok || num_written + slab.size() > num_bytes) {
+            ok = false;
+            continue;
+        }
+        if (fishvol) {
+            std::memcpy(volume.data() + num_written, slab.data(), slab.size());
+        } else {
+            ok = file.write(slab.data(), slab.size());
+        }
+        num_written += slab.size();
+        if (num_levels > 1) {
+            reduce_levels(int(num_written / slice_bytes));
+        }
+    }
+
+    if (ok && num_written != num_bytes) {
+        _logger->error("Only received {} of {} bytes of '{}'", num_written, num_bytes, _filename);
+        ok = false;
+    } else if (ok && fishvol) {
+        std::vector<const std::uint8_t*> levels;
+        for (int l = 0; l < num_levels; l++) {
+            levels.push_back(level_data(l));
+        }
+        ok = write_fishvol_levels(_filename, levels, _dims, _bytes_per_voxel, _logger, _options);
+    } else if (!fishvol) {
+        ok = file.close() && ok;
+    }
+    if (!ok) {
+        _logger->error("Failed to write exported volume to '{}'", _filename);
+    }
+
+    _succeeded = ok;
+    {
+        // Under the lock, so wait_for_queue cannot miss it between checking _done and waiting
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+    _slab_taken.notify_all();
+}
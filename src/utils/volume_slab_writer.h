@@ -0,0 +1,72 @@
+#ifndef VOLUME_SLAB_WRITER_H
+#define VOLUME_SLAB_WRITER_H
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fishvol.h"
+
+// Writes a volume to disk on a background thread while it arrives as a sequence of slabs along z.
+// .raw files are streamed slab by slab with a DirectFileWriter, past the page cache. .fishvol files are bricked over the whole volume, so their
+// slabs are gathered into a single buffer which is compressed and written once the last slab arrived.
+// The coarser levels of a .fishvol pyramid are reduced on the writer thread as the slabs come in.
+class VolumeSlabWriter {
+public:
+    VolumeSlabWriter() = default;
+    VolumeSlabWriter(const VolumeSlabWriter&) = delete;
+    VolumeSlabWriter& operator=(const VolumeSlabWriter&) = delete;
+    // Waits for the writer thread to finish
+    ~VolumeSlabWriter();
+
+    // Start writing a dims sized volume with bytes_per_voxel bytes per voxel to filename. The options only
+    // apply to .fishvol files, .raw files always hold just the full resolution.
+    bool begin(const std::string& filename, const Eigen::RowVector3i& dims, std::size_t bytes_per_voxel,
+               std::shared_ptr<spdlog::logger> logger, const FishVolWriteOptions& options = FishVolWriteOptions());
+
+    // Queue the next slab (x fastest, then y, then z) for writing, slabs must arrive in z order
+    void push_slab(std::vector<std::uint8_t>&& voxels);
+
+    // No more slabs follow. Returns immediately, the thread keeps writing until is_busy() is false.
+    void finish();
+
+    // Wait for the writer thread and return whether everything was written
+    bool wait();
+
+    bool is_busy() const { return _thread.joinable() && !_done; }
+    // Slabs pushed and not written yet, producers hold back while it is too high to bound the memory in flight
+    std::size_t num_queued() const;
+    // Block until fewer than max_queued slabs are queued, for the producers that can wait on the disk
+    void wait_for_queue(std::size_t max_queued) const;
+    bool succeeded() const { return _succeeded; }
+
+private:
+    void write_slabs();
+
+    std::string _filename;
+    Eigen::RowVector3i _dims;
+    std::size_t _bytes_per_voxel = 1;
+    FishVolWriteOptions _options;
+    std::shared_ptr<spdlog::logger> _logger;
+
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _slab_available;
+    mutable std::condition_variable _slab_taken;
+    std::deque<std::vector<std::uint8_t>> _slabs;
+    bool _finished = false;
+
+    std::atomic_bool _done{false};
+    std::atomic_bool _succeeded{false};
+};
+
+#endif // VOLUME_SLAB_WRITER_H
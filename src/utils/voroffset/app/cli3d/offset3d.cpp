@@ -4,9 +4,7 @@
 #include <vor3d/VoronoiBruteForce.h>
 #include <vor3d/Dexelize.h>
 #include <vor3d/Timer.h>
-#ifdef USE_TBB
-#include <tbb/task_scheduler_init.h>
-#endif
+#include <vor3d/Parallel.h>
 #include <CLI11.hpp>
 #include <json.hpp>
 #include <geogram/basic/logger.h>
@@ -14,6 +12,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <utility>
 #include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -95,9 +94,9 @@ int main(int argc, char * argv[]) {
 		};
 	}
 
-	#ifdef USE_TBB
-	tbb::task_scheduler_init init(args.num_thread);
-	#endif
+	vor3d::ParallelSettings parallel_settings;
+	parallel_settings.num_threads = args.num_thread;
+	vor3d::setParallelSettings(parallel_settings);
 
 	// Create offset operator
 	GEO::Logger::div("Offseting");
@@ -117,7 +116,7 @@ int main(int argc, char * argv[]) {
 		output = input;
 	} else if (args.operation == "erosion") {
 		GEO::Stopwatch W("Erosion");
-		op->erosion(input, output, args.radius, time_1, time_2);
+		op->erosion(std::move(input), output, args.radius, time_1, time_2);
 	} else if (args.operation == "dilation") {
 		GEO::Stopwatch W("Dilation");
 		op->dilation(input, output, args.radius, time_1, time_2);
@@ -125,11 +124,11 @@ int main(int argc, char * argv[]) {
 		GEO::Stopwatch W("Closing");
 		vor3d::CompressedVolume tmp;
 		op->dilation(input, tmp, args.radius, time_1, time_2);
-		op->erosion(tmp, output, args.radius, time_1, time_2);
+		op->erosion(std::move(tmp), output, args.radius, time_1, time_2);
 	} else if (args.operation == "opening") {
 		GEO::Stopwatch W("Opening");
 		vor3d::CompressedVolume tmp;
-		op->erosion(input, tmp, args.radius, time_1, time_2);
+		op->erosion(std::move(input), tmp, args.radius, time_1, time_2);
 		op->dilation(tmp, output, args.radius, time_1, time_2);
 	} else {
 		throw std::invalid_argument("Operation");
@@ -0,0 +1,297 @@
+////////////////////////////////////////////////////////////////////////////////
+#include <vor3d/CompressedVolume.h>
+#include <vor3d/Dexelize.h>
+#include <vor3d/HalfDilationOperator.h>
+#include <vor3d/MorphologyOperators.h>
+#include <vor3d/Parallel.h>
+#include <vor3d/Quality.h>
+#include <vor3d/Timer.h>
+#include <vor3d/Voronoi2D.h>
+#include <vor3d/VoronoiBruteForce.h>
+#include <vor3d/VoronoiVorPower.h>
+#include <CLI11.hpp>
+#include <json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Benchmarks of the dilation and of its building blocks, over grid sizes, radii and thread counts. Every timing is
+// the best of a few repetitions, in ms. The results are written in the format of the json databases of
+// python/figure_threads.py, a list of entries per model, so both sweeps of the script can be plotted from it:
+//
+//     vor3d_bench -s num_dexels -j num_dexels.json
+//     vor3d_bench -s radius -i bunny.obj -j radius.json
+//
+// Besides the "dilation" entries, every model and grid size gets "dexelize" (mesh inputs only), "union_segs"
+// (time per union of two neighboring rays) and "half_dilate" (time per sweep line of the first pass) entries. The
+// "dilation" entries also hold the differences of their result to the result of the first method on the first
+// thread count, see vor3d::compareVolumes, to check that the methods and thread counts agree.
+
+namespace
+{
+	// Name of the procedural model, used when no input mesh is given
+	const std::string SYNTHETIC_MODEL = "spheres";
+
+	// Union of random spheres filling the middle of an n^3 cube, dexelized exactly
+	vor3d::CompressedVolume makeSpheres(int n, int padding)
+	{
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<double> center(0.2 * n, 0.8 * n), radius(0.05 * n, 0.15 * n);
+		std::vector<Eigen::Vector4d> spheres(64);
+		for (Eigen::Vector4d &s : spheres)
+		{
+			s << center(rng), center(rng), center(rng), radius(rng);
+		}
+
+		vor3d::CompressedVolume volume(Eigen::Vector3d::Zero(), Eigen::Vector3d::Constant(n), 1.0, padding);
+		vor3d::CompressedVolume::Builder builder(volume);
+		std::vector<std::pair<double, double> > spans;
+		for (int y = 0; y < volume.gridSize()[1]; ++y)
+		{
+			for (int x = 0; x < volume.gridSize()[0]; ++x)
+			{
+				const Eigen::Vector2d p = volume.dexelCenter(x, y);
+				spans.clear();
+				for (const Eigen::Vector4d &s : spheres)
+				{
+					const double h2 = s[3] * s[3] - (p - s.head<2>()).squaredNorm();
+					if (h2 > 0)
+					{
+						spans.emplace_back(s[2] - std::sqrt(h2), s[2] + std::sqrt(h2));
+					}
+				}
+				std::sort(spans.begin(), spans.end());
+				for (const auto &span : spans)
+				{
+					vor3d::appendSegment(builder.ray(x, y), span.first, span.second);
+				}
+			}
+		}
+		volume.assemble(builder);
+		return volume;
+	}
+
+	// Best time of func() over the repetitions
+	template<typename Func>
+	double bestTime(int repetitions, Func func)
+	{
+		double best = std::numeric_limits<double>::max();
+		for (int k = 0; k < repetitions; ++k)
+		{
+			Timer t;
+			func();
+			best = std::min(best, t.get());
+		}
+		return best;
+	}
+
+	// Time per union of every ray with its neighbor along x
+	double benchUnionSegs(const vor3d::CompressedVolume &volume, int repetitions)
+	{
+		const int xsize = volume.gridSize()[0], ysize = volume.gridSize()[1];
+		std::vector<vor3d::Scalar> result;
+		const double time = bestTime(repetitions, [&]()
+		{
+			for (int y = 0; y < ysize; ++y)
+			{
+				for (int x = 0; x + 1 < xsize; ++x)
+				{
+					result.clear();
+					vor3d::unionSegs(volume.at(x, y), volume.at(x + 1, y), result);
+				}
+			}
+		});
+		return time / std::max(1, (xsize - 1) * ysize);
+	}
+
+	// Time per line of the forward sweeps of the first pass of VoronoiMorphoVorPower
+	double benchHalfDilate(const vor3d::CompressedVolume &volume, double radius, int repetitions)
+	{
+		const int xsize = volume.gridSize()[0], ysize = volume.gridSize()[1];
+		const double z_min = volume.origin()(2) / volume.spacing();
+		const double z_max = z_min + 2 * volume.padding() + volume.extent()(2) / volume.spacing();
+		vor3d::VoronoiMorpho2D op(ysize, z_min, z_max, radius, volume.spacing());
+		vor3d::LineBuffer<vor3d::SegmentWithRadius> line;
+		const double time = bestTime(repetitions, [&]()
+		{
+			for (int x = 0; x < xsize; ++x)
+			{
+				line.reset(false, ysize);
+				vor3d::halfDilate<true>(op, volume, line, x, 0, 0, +1);
+				op.resetData();
+			}
+		});
+		return time / std::max(1, xsize);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char * argv[]) {
+	// Default arguments, the ranges of python/figure_threads.py
+	struct {
+		std::vector<std::string> inputs;
+		std::string output_json = "bench.json";
+		std::string sweep = "num_dexels";
+		std::vector<int> num_dexels = { 256, 322, 406, 512, 645, 813, 1024 };
+		std::vector<double> radii = { 0.0125, 0.025, 0.0375, 0.05, 0.0625, 0.075, 0.0875, 0.1 };
+		std::vector<int> num_threads = { 1, 3, 6 };
+		std::vector<std::string> methods = { "ours", "brute_force" };
+		int repetitions = 3;
+	} args;
+
+	CLI::App app("Benchmarks of vor3d");
+	app.add_option("-i,--input", args.inputs, "Input models, a union of spheres if none")->check(CLI::ExistingFile);
+	app.add_option("-j,--json", args.output_json, "Output json file", true);
+	app.add_set("-s,--sweep", args.sweep, {"num_dexels","radius"},
+		"Vary the number of dexels (radius of 5%) or the radius (512 dexels)", true);
+	app.add_option("-n,--num_dexels", args.num_dexels, "Numbers of dexels of the num_dexels sweep");
+	app.add_option("-r,--radii", args.radii, "Radii of the radius sweep, relative to the number of dexels");
+	app.add_option("-t,--num_threads", args.num_threads, "Numbers of threads");
+	app.add_option("-m,--methods", args.methods, "Methods (ours, brute_force)");
+	app.add_option("-k,--repetitions", args.repetitions, "Repetitions of every timing, the best one is kept", true);
+	try {
+		app.parse(argc, argv);
+	} catch (const CLI::ParseError &e) {
+		return app.exit(e);
+	}
+	for (const std::string &method : args.methods) {
+		if (method != "ours" && method != "brute_force") {
+			std::cerr << "Invalid method: " << method << std::endl;
+			return 1;
+		}
+	}
+	if (args.inputs.empty()) {
+		args.inputs.push_back(SYNTHETIC_MODEL);
+	}
+
+	// (number of dexels, relative radius) of the runs
+	std::vector<std::pair<int, double> > sizes;
+	if (args.sweep == "num_dexels") {
+		for (int n : args.num_dexels) {
+			sizes.emplace_back(n, 0.05);
+		}
+	} else {
+		for (double r : args.radii) {
+			sizes.emplace_back(512, r);
+		}
+	}
+
+	nlohmann::json database;
+	for (const std::string &model : args.inputs) {
+		const std::string model_name = model == SYNTHETIC_MODEL ? model : model.substr(model.find_last_of("/\\") + 1);
+		nlohmann::json entries = nlohmann::json::array();
+		for (const auto &size : sizes) {
+			const int n = size.first;
+			const double radius = size.second * n;
+			const int padding = int(std::ceil(radius));
+
+			vor3d::setParallelSettings(vor3d::ParallelSettings());
+			vor3d::CompressedVolume input;
+			double time_dexelize = 0;
+			if (model == SYNTHETIC_MODEL) {
+				input = makeSpheres(n, padding);
+			} else {
+				double dexel_size = 1;
+				Timer t;
+				input = vor3d::create_dexels(model, dexel_size, padding, n);
+				time_dexelize = t.get();
+			}
+			const nlohmann::json stats = {
+				{ "model_name", model },
+				{ "voxel_size", input.spacing() },
+				{ "padding", input.padding() },
+				{ "num_dexels", n },
+				{ "radius", radius },
+				{ "radius_relative", size.second },
+				{ "grid_size", { input.gridSize()(0), input.gridSize()(1) } },
+				{ "num_segments", input.numSegments() },
+			};
+			std::cout << model_name << ": " << n << " dexels, radius " << radius << std::endl;
+
+			// Building blocks, on one thread
+			nlohmann::json entry = stats;
+			entry["method"] = "ours";
+			entry["num_threads"] = 1;
+			if (model != SYNTHETIC_MODEL) {
+				entry["operation"] = "dexelize";
+				entry["time"] = time_dexelize;
+				entries.push_back(entry);
+			}
+			entry["operation"] = "union_segs";
+			entry["time"] = benchUnionSegs(input, args.repetitions);
+			entries.push_back(entry);
+			entry["operation"] = "half_dilate";
+			entry["time"] = benchHalfDilate(input, radius, args.repetitions);
+			entries.push_back(entry);
+
+			vor3d::CompressedVolume reference;
+			bool has_reference = false;
+			for (const std::string &method : args.methods) {
+				for (int num_threads : args.num_threads) {
+					vor3d::ParallelSettings parallel_settings;
+					parallel_settings.num_threads = num_threads;
+					vor3d::setParallelSettings(parallel_settings);
+					std::unique_ptr<vor3d::VoronoiMorpho> op;
+					if (method == "ours") {
+						op = std::make_unique<vor3d::VoronoiMorphoVorPower>();
+					} else {
+						op = std::make_unique<vor3d::VoronoiMorphoBruteForce>();
+					}
+
+					double time_1 = 0, time_2 = 0, best_1 = 0, best_2 = 0;
+					double best = std::numeric_limits<double>::max();
+					vor3d::CompressedVolume output;
+					for (int k = 0; k < args.repetitions; ++k) {
+						Timer t;
+						op->dilation(input, output, radius, time_1, time_2);
+						const double time = t.get();
+						if (time < best) {
+							best = time;
+							best_1 = time_1;
+							best_2 = time_2;
+						}
+					}
+					std::cout << "  " << method << " on " << num_threads << " threads: " << best << " ms" << std::endl;
+					vor3d::VolumeDifference difference;
+					if (has_reference) {
+						difference = vor3d::compareVolumes(reference, output);
+					} else {
+						reference = std::move(output);
+						has_reference = true;
+					}
+
+					entry = stats;
+					entry["method"] = method;
+					entry["num_threads"] = num_threads;
+					entry["operation"] = "dilation";
+					entry["time"] = best;
+					entry["time_first_pass"] = best_1;
+					entry["time_second_pass"] = best_2;
+					entry["xor_volume"] = difference.xorVolume;
+					entry["ray_hausdorff"] = difference.rayHausdorff;
+					entry["num_unmatched_dexels"] = difference.numUnmatchedDexels;
+					entries.push_back(entry);
+				}
+			}
+		}
+		database[model_name] = entries;
+	}
+
+	std::ofstream out(args.output_json);
+	if (!out) {
+		std::cerr << "Cannot write " << args.output_json << std::endl;
+		return 1;
+	}
+	out << std::setw(4) << database << std::endl;
+	return 0;
+}
@@ -55,6 +55,7 @@ import matplotlib.pyplot as plt
 # Hard-coded root data folder
 project_folder = os.path.join(os.path.dirname(os.path.realpath(__file__)), "..")
 exe_path = os.path.join(project_folder, 'build/offset3d')
+bench_path = os.path.join(project_folder, 'build/vor3d_bench')
 data_folder = os.path.join(project_folder, 'data')
 if not os.path.exists(exe_path):
     raise FileNotFoundError("Executable file not found. Please compile or update hard-coded path:\n" + exe_path)
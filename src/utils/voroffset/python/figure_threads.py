@@ -105,6 +105,31 @@ def batch_test_radius(input_models, output_json):
         f.write(json.dumps(database, indent=4))
 
 
+def batch_bench(input_models, output_json, sweep):
+    """
+    Same as batch_test_num_dexels (sweep='num_dexels') or batch_test_radius (sweep='radius'), in a single run of
+    vor3d_bench, which also times the building blocks of the dilation. Without input models it benchmarks its
+    procedural union of spheres.
+
+    Args:
+        input_models (list): List of input models to test on.
+        output_json (str): Destination file for the result data.
+        sweep (str): Parameter to vary, 'num_dexels' or 'radius'.
+    """
+    json_filename = os.path.join(common.result_folder, output_json)
+    common.ensure_folder_exists(json_filename)
+    args = [common.bench_path, '--sweep', sweep, '--json', json_filename,
+            '--num_threads'] + [str(k) for k in array_num_threads] + ['--methods'] + array_method
+    if sweep == 'num_dexels':
+        args += ['--num_dexels'] + [str(n) for n in array_num_dexels]
+    else:
+        args += ['--radii'] + [str(r) for r in array_radii]
+    for model_path in input_models:
+        args += ['--input', model_path]
+    print(' '.join(args))
+    subprocess.check_call(args)
+
+
 def plot_curves(file_name, type_name, xlabel, ylabel='time', show_ylabel=True, show_legend=True):
     json_file = os.path.join(common.result_folder, file_name)
     with open(json_file, 'r') as f:
@@ -118,6 +143,9 @@ def plot_curves(file_name, type_name, xlabel, ylabel='time', show_ylabel=True, s
     y_arrays = {}
     for i, entries in enumerate(database.values()):
         for entry in entries:
+            # vor3d_bench also times the building blocks of the dilation
+            if entry.get('operation', 'dilation') != 'dilation':
+                continue
             key = (entry['method'], entry['num_threads'])
             if key not in y_arrays:
                 y_arrays[key] = numpy.zeros((len(database.keys()), len(x_array)))
@@ -161,11 +189,13 @@ def plot_curves(file_name, type_name, xlabel, ylabel='time', show_ylabel=True, s
 def main():
     data_file = 'num_dexels.json'
     # batch_test_num_dexels(common.Dataset.basic.models(), data_file)
+    # batch_bench(common.Dataset.basic.models(), data_file, 'num_dexels')
     plot_curves(data_file, 'linear', 'num_dexels', 'time', True, True)
     plot_curves(data_file, 'loglog', 'num_dexels', 'time', False, False)
 
     data_file = 'radius.json'
     # batch_test_radius(common.Dataset.basic.models(), data_file)
+    # batch_bench(common.Dataset.basic.models(), data_file, 'radius')
     plot_curves(data_file, 'linear', 'radius_relative', 'time', True, False)
     plot_curves(data_file, 'loglog', 'radius_relative', 'time', False, False)
 
@@ -4,6 +4,7 @@
 #include "vor2d/Common.h"
 #include "vor2d/Image.h"
 #include <set>
+#include <stdexcept>
 #include <limits>
 #include <cassert>
 #include <vector>
@@ -58,8 +59,22 @@ public:
 	// Empty?
 	bool empty() const;
 
-	// Apply a function to each segment in the structure
-	void iterate(std::function<void(int, Scalar, Scalar)> func) const;
+	// Apply func(row, begin, end) to each segment in the structure
+	template<typename Func>
+	void iterate(Func &&func) const
+	{
+		for (int i = 0; i < (int) m_Rays.size(); ++i)
+		{
+			if (m_Rays[i].size() % 2 != 0)
+			{
+				throw std::runtime_error("Invalid number of events along a ray.");
+			}
+			for (size_t j = 0; 2 * j < m_Rays[i].size(); ++j)
+			{
+				func(i, m_Rays[i][2 * j], m_Rays[i][2 * j + 1]);
+			}
+		}
+	}
 
 	// Writes a pixel at a given location
 	// return true if the value was changed
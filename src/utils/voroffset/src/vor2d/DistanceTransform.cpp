@@ -1,5 +1,6 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "vor2d/DistanceTransform.h"
+#include "vor2d/Parallel.h"
 #include <vector>
 #include <cassert>
 #include <limits>
@@ -31,84 +32,90 @@ void voroffset::computeDistanceTransformExact(const Image<int> &img, Image<int>
 	// PHASE 1 //
 	/////////////
 
-	#pragma omp parallel for
-	for (int x = 0; x < width; ++x) 
+	// Columns are independent, on the threads of vor2d/Parallel.h
+	parallelFor(width, 16, [&](int begin, int end)
 	{
-		// Scan 1
-		dt(x, 0) = (img(x, 0) == 0 ? 0 : DIST_MAX);
-		for (int y = 1; y < height; ++y) 
+		for (int x = begin; x < end; ++x) 
 		{
-			dt(x, y) = (img(x, y) == 0 ? 0 : safe_incr(dt(x, y - 1)));
-		}
-		// Scan 2
-		for (int y = height - 2; y >= 0; --y) 
-		{
-			if (dt(x, y + 1) < dt(x,y)) 
+			// Scan 1
+			dt(x, 0) = (img(x, 0) == 0 ? 0 : DIST_MAX);
+			for (int y = 1; y < height; ++y) 
 			{
-				dt(x, y) = 1 + dt(x, y + 1);
+				dt(x, y) = (img(x, y) == 0 ? 0 : safe_incr(dt(x, y - 1)));
+			}
+			// Scan 2
+			for (int y = height - 2; y >= 0; --y) 
+			{
+				if (dt(x, y + 1) < dt(x,y)) 
+				{
+					dt(x, y) = 1 + dt(x, y + 1);
+				}
 			}
 		}
-	}
+	});
 
 	/////////////
 	// PHASE 2 //
 	/////////////
 
-	#pragma omp parallel for
-	for (int y = 0; y < height; ++y) 
+	// Rows are independent as well
+	parallelFor(height, 16, [&](int begin, int end)
 	{
-		Eigen::VectorXi s(width);
-		Eigen::VectorXi t(width);
-		Eigen::VectorXi r(width); // Temporary row
-
-		// See [Meijster et al. 2002] for explanations of 'f' and 'sep'
-		auto f = [y, &dt] (int x, int i) 
-		{
-			return (dt(i, y) == DIST_MAX ? DIST_MAX : (x - i)*(x - i) + dt(i, y));
-		};
-		auto sep = [y, &dt] (int i, int u)
+		for (int y = begin; y < end; ++y) 
 		{
-			if (dt(u, y) == DIST_MAX || dt(i, y) == DIST_MAX) 
-			{
-				return DIST_MAX;
-			} 
-			else
-			{
-				return (u*u - i*i + dt(u, y) - dt(i, y)) / (2 * (u - i));
-			}
-		};
+			Eigen::VectorXi s(width);
+			Eigen::VectorXi t(width);
+			Eigen::VectorXi r(width); // Temporary row
 
-		// Scan 3
-		int q = 0; s[0] = 0; t[0] = 0;
-		for (int u = 1; u < width; ++u) 
-		{
-			vor_assert(q < width);
-			while (q >= 0 && f(t[q], s[q]) > f(t[q], u)) 
+			// See [Meijster et al. 2002] for explanations of 'f' and 'sep'
+			auto f = [y, &dt] (int x, int i) 
 			{
-				--q;
-			}
-			if (q < 0) 
+				return (dt(i, y) == DIST_MAX ? DIST_MAX : (x - i)*(x - i) + dt(i, y));
+			};
+			auto sep = [y, &dt] (int i, int u)
 			{
-				q = 0; s[0] = u;
-			} 
-			else 
+				if (dt(u, y) == DIST_MAX || dt(i, y) == DIST_MAX) 
+				{
+					return DIST_MAX;
+				} 
+				else
+				{
+					return (u*u - i*i + dt(u, y) - dt(i, y)) / (2 * (u - i));
+				}
+			};
+
+			// Scan 3
+			int q = 0; s[0] = 0; t[0] = 0;
+			for (int u = 1; u < width; ++u) 
 			{
-				int w = safe_incr(sep(s[q], u));
-				if (w < width) 
+				vor_assert(q < width);
+				while (q >= 0 && f(t[q], s[q]) > f(t[q], u)) 
 				{
-					q = q + 1; s[q] = u; t[q] = w;
+					--q;
+				}
+				if (q < 0) 
+				{
+					q = 0; s[0] = u;
+				} 
+				else 
+				{
+					int w = safe_incr(sep(s[q], u));
+					if (w < width) 
+					{
+						q = q + 1; s[q] = u; t[q] = w;
+					}
 				}
 			}
-		}
 
-		// Scan 4
-		for (int u = width - 1; u >= 0; --u) 
-		{
-			r[u] = f(u, s[q]);
-			if (u == t[q]) { --q; }
+			// Scan 4
+			for (int u = width - 1; u >= 0; --u) 
+			{
+				r[u] = f(u, s[q]);
+				if (u == t[q]) { --q; }
+			}
+			dt.data().row(y) = r;
 		}
-		dt.data().row(y) = r;
-	}
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1,10 +1,12 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "vor2d/DoubleCompressedImage.h"
+#include "vor2d/Parallel.h"
 #include "vor2d/DoubleVoronoi.h"
 #include <map>
 #include <set>
 #include <complex>
 #include <algorithm>
+#include <iterator>
 #include <thread>
 #include <cassert>
 #include <type_traits>
@@ -110,18 +112,13 @@ void voroffset::DoubleCompressedImage::unionIntersections(std::vector<Scalar> &i
 	}
 }
 
-void voroffset::DoubleCompressedImage::copyFrom(const voroffset::DoubleCompressedImage source_dexel)
+void voroffset::DoubleCompressedImage::copyFrom(const voroffset::DoubleCompressedImage &source_dexel)
 {
+	if (&source_dexel == this)
+		return;
 	m_XSize = source_dexel.m_XSize;
-	int size_ = source_dexel.m_Rays.size();
-	m_Rays.assign(size_, std::vector<Scalar>());
-	for (int i = 0; i < size_; i++)
-	{
-		int inter_num = source_dexel.m_Rays[i].size();
-		vor_assert(inter_num % 2 == 0);
-		m_Rays[i].resize(inter_num);
-		std::copy_n(source_dexel.m_Rays[i].begin(), inter_num, m_Rays[i].begin());
-	}
+	// Ray by ray assignment reuses the memory of the rays already allocated here
+	m_Rays = source_dexel.m_Rays;
 }
 
 // Export to 2D image
@@ -232,22 +229,6 @@ bool voroffset::DoubleCompressedImage::empty() const
 	return true;
 }
 
-// Apply a function to each segment in the structure
-void voroffset::DoubleCompressedImage::iterate(std::function<void(int, Scalar, Scalar)> func) const
-{
-	for (int i = 0; i < (int)m_Rays.size(); ++i) 
-	{
-		if (m_Rays[i].size() % 2 != 0) 
-		{
-			throw std::runtime_error("Invalid number of events along a ray.");
-		}
-		for (size_t j = 0; 2 * j < m_Rays[i].size(); ++j)
-		{
-			func(i, m_Rays[i][2 * j], m_Rays[i][2 * j + 1]);
-		}
-	}
-}
-
 // Writes a pixel at a given location
 // return true if the value was changed
 bool voroffset::DoubleCompressedImage::write(int i, int j, bool newVal) 
@@ -477,110 +458,54 @@ voroffset::DoubleCompressedImage voroffset::DoubleCompressedImage::transposed()
 
 void voroffset::DoubleCompressedImage::transposeInPlace()
 {
-	// Store all events and sort them transposed
-	std::set<std::pair<int, int> > allEvents;
-	for (int j = 0; j < (int)m_Rays.size(); ++j)
+	// Sweep the rows in order. The columns where a row differs from the previous one are where the segments of
+	// the transposed rows start or end, at the index of the row, so only the boundaries of the shape are visited
+	// instead of sorting every event. Events read as pixel boundaries, coinciding ones cancel out.
+	auto rowEvents = [this](const std::vector<Scalar> &row, std::vector<int> &events)
 	{
-		for (const auto & val : m_Rays[j]) 
+		events.clear();
+		for (const auto & val : row)
 		{
-			allEvents.emplace(val, j);
+			const int x = std::min(std::max(int(val), 0), m_XSize);
+			if (!events.empty() && events.back() == x)
+			{
+				events.pop_back();
+			}
+			else
+			{
+				events.push_back(x);
+			}
 		}
-	}
-	// Resize internal array and swap dims
-	{
-		int tmp = m_XSize;
-		m_XSize = (int)m_Rays.size();
-		m_Rays.assign(tmp, {});
-	}
+	};
 
-	// Helper function: toggle an event in a line
-	auto toggle = [](std::set<int> &s, int x) 
+	const int num_rows = (int) m_Rays.size();
+	std::vector<std::vector<Scalar> > transposed(m_XSize);
+	std::vector<int> previous, current, changes;
+	for (int j = 0; j <= num_rows; ++j)
 	{
-		if (s.count(x)) 
-		{
-			s.erase(x);
-		}
-		else 
+		if (j < num_rows)
 		{
-			s.insert(x);
+			rowEvents(m_Rays[j], current);
 		}
-	};
-
-#if 0
-	int prevLine = 0;
-	std::set<int> currentLine;
-	for (auto it = allEvents.begin(); it != allEvents.end(); ++it)
-	{
-		int i = it->first;
-		int j = it->second;
-
-		// Register current line
-		if (prevLine != i) 
+		else
 		{
-			for (int ii = prevLine; ii < i; ++ii) 
-			{
-				for (auto jt = currentLine.begin(); jt != currentLine.end(); ++jt) 
-				{
-					m_Rays[ii].push_back(*jt);
-				}
-			}
+			current.clear();
 		}
-
-		// Toggle segment (i, j) -- (i, j + 1)
-		toggle(currentLine, j);
-		toggle(currentLine, j + 1);
-		prevLine = i;
-	}
-	// Register last line
-	m_Rays[prevLine].insert(m_Rays[prevLine].end(), currentLine.begin(), currentLine.end());
-#else
-	int startCol = -1;
-	int endCol = -1;
-	int prevLine = -1;
-	std::set<int> currentLine;
-	for (auto it = allEvents.begin(); it != allEvents.end(); ++it) 
-	{
-		int i = it->first;
-		int j = it->second;
-
-		// Register current line
-		if (prevLine != i) 
+		changes.clear();
+		std::set_symmetric_difference(previous.begin(), previous.end(), current.begin(), current.end(),
+			std::back_inserter(changes));
+		for (size_t k = 0; k + 1 < changes.size(); k += 2)
 		{
-			// Toggle segment (i, startCol) -- (i, endCol)
-			toggle(currentLine, startCol);
-			toggle(currentLine, endCol);
-			startCol = endCol = j;
-
-			if (prevLine != -1) 
+			for (int x = changes[k]; x < changes[k + 1]; ++x)
 			{
-				for (int ii = prevLine; ii < i; ++ii) 
-				{
-					for (auto jt = currentLine.begin(); jt != currentLine.end(); ++jt) 
-					{
-						m_Rays[ii].push_back(*jt);
-					}
-				}
+				transposed[x].push_back(j);
 			}
 		}
-
-		if (j != endCol) 
-		{
-			// Toggle segment (i, startCol) -- (i, endCol)
-			toggle(currentLine, startCol);
-			toggle(currentLine, endCol);
-			startCol = j;
-		}
-		endCol = j + 1;
-		prevLine = i;
+		previous.swap(current);
 	}
 
-	// Toggle segment (i, startCol) -- (i, endCol)
-	toggle(currentLine, startCol);
-	toggle(currentLine, endCol);
-
-	// Register last line
-	m_Rays[prevLine].insert(m_Rays[prevLine].end(), currentLine.begin(), currentLine.end());
-#endif
+	m_XSize = num_rows;
+	m_Rays.swap(transposed);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -662,14 +587,15 @@ namespace
 		}
 	}
 
-	template<typename Iterator1, typename Iterator2>
-	void unionMap(Iterator1 a, Iterator2 b, std::vector<std::vector<double> > &res) 
+	// Union of rows [begin, end) of the forward sweep a and of the backward sweep b into a
+	void unionRows(std::vector<DoubleVector> &a, const std::vector<DoubleVector> &b, int begin, int end)
 	{
-		for (size_t i = 0; i < res.size(); ++i) 
+		DoubleVector temp;
+		for (int i = begin; i < end; ++i)
 		{
-			DoubleVector temp;
-			unionSegs(a[i], b[i], temp);
-			res[i].swap(temp);
+			temp.clear();
+			unionSegs(a[i], b[b.size() - 1 - i], temp);
+			a[i].swap(temp);
 		}
 	}
 
@@ -679,25 +605,37 @@ namespace
 
 void DoubleCompressedImage::dilate(double radius) 
 {
-	typedef std::reverse_iterator<decltype(m_Rays.begin())> rev_t;
+	typedef std::reverse_iterator<decltype(m_Rays.cbegin())> rev_t;
 
-	std::vector<std::vector<double> > r1, r2;
-	voronoiF_half_dilate(height(), width(), radius * m_Rays.size(), m_Rays.begin(), r1);
-	voronoiF_half_dilate(height(), width(), radius * m_Rays.size(), rev_t(m_Rays.end()), r2);
-	unionMap(r1.cbegin(), r2.crbegin(), m_Rays);
+	// Bands of rows are swept and merged in parallel, they only read m_Rays until they are all done
+	const int xsize = height();
+	const double sweep_radius = radius * m_Rays.size();
+	std::vector<DoubleVector> r1(xsize), r2(xsize);
+	parallelFor(xsize, sweepBandSize(xsize, sweep_radius), [&](int begin, int end)
+	{
+		voronoiF_half_dilate_rows(xsize, width(), sweep_radius, m_Rays.cbegin(), begin, end, r1);
+		voronoiF_half_dilate_rows(xsize, width(), sweep_radius, rev_t(m_Rays.cend()), xsize - end, xsize - begin, r2);
+		unionRows(r1, r2, begin, end);
+	});
+	m_Rays.swap(r1);
 	vor_assert(isValid() == true);
 }
 
 // -----------------------------------------------------------------------------
 
-void DoubleCompressedImage::erode(double radius)
+void DoubleCompressedImage::erode(double radius) 
 {
-	typedef std::reverse_iterator<decltype(m_Rays.begin())> rev_t;
+	typedef std::reverse_iterator<decltype(m_Rays.cbegin())> rev_t;
 
-	std::vector<std::vector<double> > r1, r2;
-	voronoiF_half_erode(height(), width(), radius, m_Rays.begin(), r1);
-	voronoiF_half_erode(height(), width(), radius, rev_t(m_Rays.end()), r2);
-	unionMap(r1.cbegin(), r2.crbegin(), m_Rays);
+	const int xsize = height();
+	std::vector<DoubleVector> r1(xsize), r2(xsize);
+	parallelFor(xsize, sweepBandSize(xsize, radius), [&](int begin, int end)
+	{
+		voronoiF_half_erode_rows(xsize, width(), radius, m_Rays.cbegin(), begin, end, r1);
+		voronoiF_half_erode_rows(xsize, width(), radius, rev_t(m_Rays.cend()), xsize - end, xsize - begin, r2);
+		unionRows(r1, r2, begin, end);
+	});
+	m_Rays.swap(r1);
 	negate();
 	vor_assert(isValid());
 }
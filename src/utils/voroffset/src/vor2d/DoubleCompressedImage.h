@@ -4,6 +4,7 @@
 #include "vor2d/Common.h"
 #include "vor2d/Image.h"
 #include <set>
+#include <stdexcept>
 #include <limits>
 #include <cassert>
 #include <vector>
@@ -62,8 +63,22 @@ public:
 	// Empty?
 	bool empty() const;
 
-	// Apply a function to each segment in the structure
-	void iterate(std::function<void(int, Scalar, Scalar)> func) const;
+	// Apply func(row, begin, end) to each segment in the structure
+	template<typename Func>
+	void iterate(Func &&func) const
+	{
+		for (int i = 0; i < (int) m_Rays.size(); ++i)
+		{
+			if (m_Rays[i].size() % 2 != 0)
+			{
+				throw std::runtime_error("Invalid number of events along a ray.");
+			}
+			for (size_t j = 0; 2 * j < m_Rays[i].size(); ++j)
+			{
+				func(i, m_Rays[i][2 * j], m_Rays[i][2 * j + 1]);
+			}
+		}
+	}
 
 	const std::vector<Scalar> & at(int x) const { return m_Rays[x]; }
 
@@ -92,7 +107,7 @@ public:
 	void negate();
 
 	// Copy from another dexel
-	void copyFrom(const DoubleCompressedImage source_dexel);
+	void copyFrom(const DoubleCompressedImage &source_dexel);
 
 	// Transpose operation to get a column-compressed map
 	DoubleCompressedImage transposed() const;
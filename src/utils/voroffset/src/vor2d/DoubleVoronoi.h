@@ -7,6 +7,8 @@
 #include <vector>
 #include <array>
 #include <set>
+#include <algorithm>
+#include <cmath>
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace voroffset
@@ -97,15 +99,17 @@ namespace voroffset
 
 	////////////////////////////////////////////////////////////////////////////////
 
-	// Forward sweep for dilation operation
+	// Forward sweep for dilation operation, writing rows [begin, end) of result, which has xsize rows. Rows
+	// farther than the radius above begin do not reach it, so the sweep starts just above them: disjoint row
+	// ranges can be computed independently and in parallel.
 	template<typename Iterator>
-	void voronoiF_half_dilate(
+	void voronoiF_half_dilate_rows(
 		int xsize, int ysize, double radius,
-		Iterator it, std::vector<std::vector<double> > &result)
+		Iterator it, int begin, int end, std::vector<std::vector<double> > &result)
 	{
 		VoronoiMorphoF voronoi(xsize, ysize, radius);
-		result.assign(xsize, std::vector<double>());
-		for (int i = 0; i < xsize; ++i) 
+		std::vector<double> ignored;
+		for (int i = std::max(0, begin - (int)std::ceil(radius) - 1); i < end; ++i) 
 		{
 			voronoi.removeInactiveSegments(i);
 			vor_assert(it[i].size() % 2 == 0);
@@ -113,24 +117,39 @@ namespace voroffset
 			{
 				voronoi.insertSegment(i, it[i][k], it[i][k + 1]);
 			}
-			voronoi.getLine(i, result[i], ysize);
+			voronoi.getLine(i, i < begin ? ignored : result[i], ysize);
+			ignored.clear();
 		}
 	}
 
+	// Forward sweep for dilation operation
+	template<typename Iterator>
+	void voronoiF_half_dilate(
+		int xsize, int ysize, double radius,
+		Iterator it, std::vector<std::vector<double> > &result)
+	{
+		result.assign(xsize, std::vector<double>());
+		voronoiF_half_dilate_rows(xsize, ysize, radius, it, 0, xsize, result);
+	}
+
 	// -----------------------------------------------------------------------------
 
-	// Forward sweep for erosion operation
+	// Forward sweep for erosion operation, writing rows [begin, end) of result like voronoiF_half_dilate_rows
 	template<typename Iterator>
-	void voronoiF_half_erode(
+	void voronoiF_half_erode_rows(
 		int xsize, int ysize, double radius,
-		Iterator it, std::vector<std::vector<double> > &result)
+		Iterator it, int begin, int end, std::vector<std::vector<double> > &result)
 	{
 		VoronoiMorphoF voronoi(xsize, ysize + 1, radius);
-		result.assign(xsize, std::vector<double>());
 		if (xsize == 0) { return; }
+		const int first = std::max(0, begin - (int)std::ceil(radius) - 1);
 		// Extra segment before first row
-		voronoi.insertSegment(-1, -1, ysize);
-		for (int i = 0; i < xsize; ++i) 
+		if (first == 0)
+		{
+			voronoi.insertSegment(-1, -1, ysize);
+		}
+		std::vector<double> ignored;
+		for (int i = first; i < end; ++i) 
 		{
 			voronoi.removeInactiveSegments(i);
 			vor_assert(it[i].size() % 2 == 0);
@@ -143,10 +162,21 @@ namespace voroffset
 			}
 			voronoi.insertSegment(i, -1, j2);
 			// Retrieve result
-			voronoi.getLine(i, result[i], ysize);
+			voronoi.getLine(i, i < begin ? ignored : result[i], ysize);
+			ignored.clear();
 		}
 	}
 
+	// Forward sweep for erosion operation
+	template<typename Iterator>
+	void voronoiF_half_erode(
+		int xsize, int ysize, double radius,
+		Iterator it, std::vector<std::vector<double> > &result)
+	{
+		result.assign(xsize, std::vector<double>());
+		voronoiF_half_erode_rows(xsize, ysize, radius, it, 0, xsize, result);
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 
 } // namespace voroffset
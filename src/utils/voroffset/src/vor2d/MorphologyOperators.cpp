@@ -227,7 +227,7 @@ void voroffset::negate_ray(std::vector<double> &result, double y_min, double y_m
 	}
 }
 
-void voroffset::negate_ray(std::vector<m_Segment> input, std::vector<m_Segment> &result, double y_min, double y_max)
+void voroffset::negate_ray(const std::vector<m_Segment> &input, std::vector<m_Segment> &result, double y_min, double y_max)
 {
 	int size_ = input.size();
 	result.clear();
@@ -250,7 +250,7 @@ void voroffset::negate_ray(std::vector<m_Segment> input, std::vector<m_Segment>
 ////////////////////////////////////////////////////////////////////////////////////////
 
 // calculate the xor between two vectors of segments
-void voroffset::calculate_ray_xor(std::vector<m_Segment> ray_1, std::vector<m_Segment> ray_2, std::vector<m_Segment> &ray_xor, double y_min, double y_max)
+void voroffset::calculate_ray_xor(const std::vector<m_Segment> &ray_1, const std::vector<m_Segment> &ray_2, std::vector<m_Segment> &ray_xor, double y_min, double y_max)
 {
 	ray_xor.clear();
 	std::vector<m_Segment> record_1, record_2, tmpt_union_1, tmpt_union_2, before_remove_pts;
@@ -258,20 +258,17 @@ void voroffset::calculate_ray_xor(std::vector<m_Segment> ray_1, std::vector<m_Se
 	negate_ray(ray_2, record_2, y_min, y_max);
 	unionSegs(record_1, ray_2, tmpt_union_1);
 	unionSegs(record_2, ray_1, tmpt_union_2);
-	negate_ray(tmpt_union_1, ray_1, y_min, y_max);
-	negate_ray(tmpt_union_2, ray_2, y_min, y_max);
-	unionSegs(ray_1, ray_2, before_remove_pts);
+	// The complements are no longer needed, ray_1 - ray_2 and ray_2 - ray_1 go in their place
+	negate_ray(tmpt_union_1, record_1, y_min, y_max);
+	negate_ray(tmpt_union_2, record_2, y_min, y_max);
+	unionSegs(record_1, record_2, before_remove_pts);
 	removepoint(before_remove_pts, ray_xor);
 }
 
-void voroffset::calculate_ray_xor(std::vector<double> ray_1, std::vector<double> ray_2, std::vector<double> &ray_xor, double y_min, double y_max)
+void voroffset::calculate_ray_xor(const std::vector<double> &ray_1, const std::vector<double> &ray_2, std::vector<double> &ray_xor, double y_min, double y_max)
 {
 	ray_xor.clear();
-	std::vector<double> record_1, record_2, tmpt_union_1, tmpt_union_2, before_remove_pts;
-	record_1.resize(ray_1.size());
-	record_2.resize(ray_2.size());
-	std::copy_n(ray_1.begin(), ray_1.size(), record_1.begin());
-	std::copy_n(ray_2.begin(), ray_2.size(), record_2.begin());
+	std::vector<double> record_1(ray_1), record_2(ray_2), tmpt_union_1, tmpt_union_2, before_remove_pts;
 	negate_ray(record_1, y_min, y_max);
 	negate_ray(record_2, y_min, y_max);
 	unionSegs(record_1, ray_2, tmpt_union_1);
@@ -284,7 +281,7 @@ void voroffset::calculate_ray_xor(std::vector<double> ray_1, std::vector<double>
 /////////////////////////////////////////////////////////////////////////////
 
 // remove the segment when its size is too small to be seen
-void voroffset::removepoint(const std::vector<m_Segment> segs, std::vector<m_Segment> &res)
+void voroffset::removepoint(const std::vector<m_Segment> &segs, std::vector<m_Segment> &res)
 {
 	int size_ = segs.size();
 	for (int i = 0; i < size_; i++)
@@ -294,7 +291,7 @@ void voroffset::removepoint(const std::vector<m_Segment> segs, std::vector<m_Seg
 		res.push_back(segs[i]);
 	}
 }
-void voroffset::removepoint(const std::vector<double> segs, std::vector<double> &res)
+void voroffset::removepoint(const std::vector<double> &segs, std::vector<double> &res)
 {
 	int size_ = segs.size();
 	for (int i = 0; i < size_; i += 2)
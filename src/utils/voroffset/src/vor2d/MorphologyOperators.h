@@ -28,14 +28,14 @@ namespace voroffset
 
 	// negate ray
 	void negate_ray(std::vector<double> &result, double y_min, double y_max);
-	void negate_ray(std::vector<m_Segment> input, std::vector<m_Segment> &result, double y_min, double y_max);
+	void negate_ray(const std::vector<m_Segment> &input, std::vector<m_Segment> &result, double y_min, double y_max);
 
 	// calculate the xor of two rays
-	void calculate_ray_xor(std::vector<m_Segment> ray_1, std::vector<m_Segment> ray_2, std::vector<m_Segment> &ray_xor, double y_min, double y_max);
-	void calculate_ray_xor(std::vector<double> ray_1, std::vector<double> ray_2, std::vector<double> &ray_xor, double y_min, double y_max);
+	void calculate_ray_xor(const std::vector<m_Segment> &ray_1, const std::vector<m_Segment> &ray_2, std::vector<m_Segment> &ray_xor, double y_min, double y_max);
+	void calculate_ray_xor(const std::vector<double> &ray_1, const std::vector<double> &ray_2, std::vector<double> &ray_xor, double y_min, double y_max);
 
 	// remove the segment when its size is too small to be seen, which can modify the viwer of visualization
-	void removepoint(const std::vector<m_Segment> segs, std::vector<m_Segment> &res);
-	void removepoint(const std::vector<double> segs, std::vector<double> &res);
+	void removepoint(const std::vector<m_Segment> &segs, std::vector<m_Segment> &res);
+	void removepoint(const std::vector<double> &segs, std::vector<double> &res);
 
 }//namespace voroffset
\ No newline at end of file
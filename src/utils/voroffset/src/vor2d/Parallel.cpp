@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "vor2d/Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	std::atomic<int> g_num_threads(0);
+}
+
+void voroffset::setNumThreads(int num_threads)
+{
+	g_num_threads = std::max(num_threads, 0);
+}
+
+int voroffset::numThreads()
+{
+	const int num_threads = g_num_threads;
+	if (num_threads > 0)
+	{
+		return num_threads;
+	}
+	const unsigned int hw = std::thread::hardware_concurrency();
+	return hw == 0 ? 1 : int(hw);
+}
+
+void voroffset::parallelFor(int n, int grain, const std::function<void(int, int)> &body)
+{
+	if (n <= 0)
+	{
+		return;
+	}
+	grain = std::max(grain, 1);
+	const int num_grains = (n + grain - 1) / grain;
+	const int num_workers = std::min(numThreads(), num_grains);
+	std::atomic<int> next_grain(0);
+	auto worker = [&]()
+	{
+		for (int g = next_grain++; g < num_grains; g = next_grain++)
+		{
+			const int begin = g * grain;
+			body(begin, std::min(n, begin + grain));
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_workers; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &t : threads)
+	{
+		t.join();
+	}
+}
+
+int voroffset::sweepBandSize(int num_rows, double radius)
+{
+	const int overlap = (int) std::ceil(radius) + 1;
+	// Enough bands to keep every thread busy, but no band sweeping more rows again than it writes
+	const int num_bands = 4 * numThreads();
+	const int balanced = (num_rows + num_bands - 1) / num_bands;
+	return std::max({ balanced, 4 * overlap, 16 });
+}
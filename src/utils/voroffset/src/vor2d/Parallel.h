@@ -0,0 +1,22 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <functional>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset
+{
+	// Number of threads of the 2D operators, 0 (the default) uses every hardware thread and 1 runs them in the
+	// calling thread. Used by the following calls to parallelFor, from any thread.
+	void setNumThreads(int num_threads);
+	int numThreads();
+
+	// Call body(begin, end) on sub ranges of grain items covering [0, n), on up to numThreads() threads. The
+	// workers take the sub ranges off a shared counter, so uneven rows balance out.
+	void parallelFor(int n, int grain, const std::function<void(int, int)> &body);
+
+	// Rows per band of the banded sweeps of an operator of the given radius. Each band sweeps the rows up to
+	// the radius above it again, so bands are kept a few times taller than the radius.
+	int sweepBandSize(int num_rows, double radius);
+
+} // namespace voroffset
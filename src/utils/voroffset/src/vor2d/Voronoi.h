@@ -6,6 +6,8 @@
 #include <vector>
 #include <array>
 #include <set>
+#include <algorithm>
+#include <cmath>
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace voroffset
@@ -101,15 +103,17 @@ struct VoronoiMorpho
 
 ////////////////////////////////////////////////////////////////////////////////
 
-// Forward sweep for dilation operation
+// Forward sweep for dilation operation, writing rows [begin, end) of result, which has xsize rows. Rows farther
+// than the radius above begin do not reach it, so the sweep starts just above them: disjoint row ranges can be
+// computed independently and in parallel.
 template<typename Iterator>
-void voronoi_half_dilate(
+void voronoi_half_dilate_rows(
 	int xsize, int ysize, double radius,
-	Iterator it, std::vector<std::vector<int> > &result)
+	Iterator it, int begin, int end, std::vector<std::vector<int> > &result)
 {
 	VoronoiMorpho voronoi(xsize, ysize, radius);
-	result.assign(xsize, std::vector<int>());
-	for (int i = 0; i < xsize; ++i) 
+	std::vector<int> ignored;
+	for (int i = std::max(0, begin - (int) std::ceil(radius) - 1); i < end; ++i) 
 	{
 		voronoi.removeInactiveSegments(i);
 		vor_assert(it[i].size() % 2 == 0);
@@ -117,24 +121,39 @@ void voronoi_half_dilate(
 		{
 			voronoi.insertSegment(i, it[i][k], it[i][k + 1] - 1);
 		}
-		voronoi.getLine(i, result[i], ysize);
+		voronoi.getLine(i, i < begin ? ignored : result[i], ysize);
+		ignored.clear();
 	}
 }
 
+// Forward sweep for dilation operation
+template<typename Iterator>
+void voronoi_half_dilate(
+	int xsize, int ysize, double radius,
+	Iterator it, std::vector<std::vector<int> > &result)
+{
+	result.assign(xsize, std::vector<int>());
+	voronoi_half_dilate_rows(xsize, ysize, radius, it, 0, xsize, result);
+}
+
 // -----------------------------------------------------------------------------
 
-// Forward sweep for erosion operation
+// Forward sweep for erosion operation, writing rows [begin, end) of result like voronoi_half_dilate_rows
 template<typename Iterator>
-void voronoi_half_erode(
+void voronoi_half_erode_rows(
 	int xsize, int ysize, double radius,
-	Iterator it, std::vector<std::vector<int> > &result)
+	Iterator it, int begin, int end, std::vector<std::vector<int> > &result)
 {
 	VoronoiMorpho voronoi(xsize, ysize + 1, radius);
-	result.assign(xsize, std::vector<int>());
 	if (xsize == 0) { return; }
+	const int first = std::max(0, begin - (int) std::ceil(radius) - 1);
 	// Extra segment before first row
-	voronoi.insertSegment(-1, -1, ysize);
-	for (int i = 0; i < xsize; ++i)
+	if (first == 0)
+	{
+		voronoi.insertSegment(-1, -1, ysize);
+	}
+	std::vector<int> ignored;
+	for (int i = first; i < end; ++i)
 	{
 		voronoi.removeInactiveSegments(i);
 		vor_assert(it[i].size() % 2 == 0);
@@ -147,10 +166,21 @@ void voronoi_half_erode(
 		}
 		voronoi.insertSegment(i, -1, j2);
 		// Retrieve result
-		voronoi.getLine(i, result[i], ysize);
+		voronoi.getLine(i, i < begin ? ignored : result[i], ysize);
+		ignored.clear();
 	}
 }
 
+// Forward sweep for erosion operation
+template<typename Iterator>
+void voronoi_half_erode(
+	int xsize, int ysize, double radius,
+	Iterator it, std::vector<std::vector<int> > &result)
+{
+	result.assign(xsize, std::vector<int>());
+	voronoi_half_erode_rows(xsize, ysize, radius, it, 0, xsize, result);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 } // namespace voroffset
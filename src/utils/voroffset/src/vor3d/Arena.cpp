@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Arena.h"
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace voroffset3d;
+
+MonotonicArena::MonotonicArena(size_t initial_size)
+	: m_NextSize(std::max(initial_size, size_t(64)))
+{}
+
+void * MonotonicArena::allocate(size_t bytes, size_t alignment)
+{
+	if (!m_Blocks.empty())
+	{
+		Block &block = m_Blocks.back();
+		void *p = block.data.get() + m_Used;
+		size_t space = block.size - m_Used;
+		if (std::align(alignment, bytes, p, space))
+		{
+			m_Used = block.size - space + bytes;
+			return p;
+		}
+	}
+
+	// Blocks double in size, so a step needs a handful of them at most
+	const size_t size = std::max(m_NextSize, bytes + alignment);
+	m_Blocks.push_back(Block{ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+	m_NextSize = 2 * size;
+	void *p = m_Blocks.back().data.get();
+	size_t space = size;
+	std::align(alignment, bytes, p, space);
+	m_Used = size - space + bytes;
+	return p;
+}
+
+void MonotonicArena::release()
+{
+	// The last block is the largest one
+	if (m_Blocks.size() > 1)
+	{
+		m_Blocks.erase(m_Blocks.begin(), m_Blocks.end() - 1);
+	}
+	m_Used = 0;
+}
+
+size_t MonotonicArena::capacity() const
+{
+	size_t size = 0;
+	for (const Block &block : m_Blocks)
+	{
+		size += block.size;
+	}
+	return size;
+}
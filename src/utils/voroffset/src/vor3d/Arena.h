@@ -0,0 +1,68 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <memory>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Memory for the temporaries of one step of a sweep, in the spirit of std::pmr::monotonic_buffer_resource,
+	// which C++14 does not have. Allocations bump a pointer through blocks of growing size and deallocating
+	// does nothing, so node based containers such as the seed sets never go through the global allocator,
+	// which is shared by every worker. release() frees everything at once and keeps the largest block for the
+	// next step. An arena belongs to one thread and takes no lock.
+	class MonotonicArena
+	{
+	public:
+		explicit MonotonicArena(size_t initial_size = 4096);
+		MonotonicArena(const MonotonicArena &) = delete;
+		MonotonicArena & operator=(const MonotonicArena &) = delete;
+
+		void * allocate(size_t bytes, size_t alignment);
+
+		// Everything allocated so far must no longer be in use
+		void release();
+
+		// Bytes held in blocks, in use or not
+		size_t capacity() const;
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<unsigned char[]> data;
+			size_t size;
+		};
+		std::vector<Block> m_Blocks;
+		// Bytes used in the last block
+		size_t m_Used = 0;
+		size_t m_NextSize;
+	};
+
+	// Standard allocator handing out memory from an arena, for the containers of the std namespace. The arena
+	// must outlive the container.
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		typedef T value_type;
+
+		explicit ArenaAllocator(MonotonicArena &arena) : m_Arena(&arena) {}
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other) : m_Arena(other.arena()) {}
+
+		T * allocate(size_t n) { return static_cast<T *>(m_Arena->allocate(n * sizeof(T), alignof(T))); }
+		void deallocate(T *, size_t) {}
+
+		MonotonicArena * arena() const { return m_Arena; }
+
+	private:
+		MonotonicArena *m_Arena;
+	};
+
+	template<typename T, typename U>
+	bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena() == b.arena(); }
+	template<typename T, typename U>
+	bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena() != b.arena(); }
+}
@@ -12,7 +12,14 @@
 namespace voroffset3d 
 {
 	// typedef//
+	// Type of the dexel endpoints stored in the volumes. They are z coordinates in dexels, so single precision
+	// keeps them within 1/100 dexel for volumes up to 65k deep while halving the memory traffic of the sweeps.
+	// The 2D Voronoi and power diagram sweeps compute in double either way.
+#ifdef VOR3D_FLOAT_SCALAR
+	typedef float Scalar;
+#else
 	typedef double Scalar;
+#endif
 	typedef std::complex<Scalar> PointF;
 	typedef std::vector<Scalar>::iterator data_iterator;
 	///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,15 +1,91 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "vor3d/CompressedVolume.h"
 #include "vor3d/MorphologyOperators.h"
+#include "vor3d/Parallel.h"
+#include <geogram/third_party/zlib/zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 ////////////////////////////////////////////////////////////////////////////////
 
 using namespace voroffset3d;
 
+namespace
+{
+	// Layout of saveCompact (little endian):
+	//   char[4]  magic "VDX1"
+	//   double   origin[3], extent[3], spacing
+	//   int32    padding, grid size[2]
+	//   uint32   subdivisions, rows per block, number of blocks
+	//   for each block: uint64 number of values, deflated size, inflated size
+	//   the deflated blocks, one after the other
+	// An inflated block holds, for each dexel of its rows, the number of values of the ray and then its values
+	// as the zigzag varint of the difference to the previous one, in units of 1/subdivisions.
+	const char COMPACT_MAGIC[4] = { 'V', 'D', 'X', '1' };
+	// Rows of dexels deflated together. Blocks of some ten kilobytes keep deflate close to its best ratio.
+	const int COMPACT_BLOCK_ROWS = 16;
+
+	struct CompactBlock
+	{
+		uint64_t num_values;
+		uint64_t deflated_size;
+		uint64_t inflated_size;
+	};
+
+	template<typename T>
+	void write(std::vector<uint8_t> &out, const T &value)
+	{
+		const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	template<typename T>
+	bool read(const uint8_t *&data, const uint8_t *end, T &value)
+	{
+		if (size_t(end - data) < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return true;
+	}
+
+	void writeVarint(std::vector<uint8_t> &out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(uint8_t(value));
+	}
+
+	bool readVarint(const uint8_t *&data, const uint8_t *end, uint64_t &value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && data != end; shift += 7)
+		{
+			const uint8_t byte = *data++;
+			value |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint64_t zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+	int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CompressedVolume::CompressedVolume(
-	Eigen::Vector3d origin, Eigen::Vector3d extent, Scalar voxel_size, int padding)
+	Eigen::Vector3d origin, Eigen::Vector3d extent, double voxel_size, int padding)
 {
 	m_Origin = origin;
 	m_Extent = extent;
@@ -18,44 +94,194 @@ CompressedVolume::CompressedVolume(
 	m_Origin.array() -= padding * voxel_size;
 	m_GridSize[0] =  (int)(std::ceil(extent[0] / m_Spacing) + 2 * padding);
 	m_GridSize[1] =  (int)(std::ceil(extent[1] / m_Spacing) + 2 * padding);
-	m_Data.assign(m_GridSize[0] * m_GridSize[1], {});
+	m_Data.assign(m_GridSize[0] * m_GridSize[1]);
 
 }
 
-void CompressedVolume::iterate(int i, int j, std::function<void(Scalar, Scalar)> func)
+void CompressedVolume::saveCompact(std::vector<uint8_t> &out, int subdivisions) const
 {
-	const auto &ray = at(i, j);
-	for (size_t k = 0; k+1 < ray.size(); k+=2)
+	const int num_blocks = (m_GridSize[1] + COMPACT_BLOCK_ROWS - 1) / COMPACT_BLOCK_ROWS;
+	std::vector<CompactBlock> blocks(num_blocks);
+	std::vector<std::vector<uint8_t> > deflated(num_blocks);
+	parallelFor((uint32_t)num_blocks, [&](uint32_t begin, uint32_t end)
 	{
-		func(ray[k], ray[k + 1]);
+		std::vector<uint8_t> inflated;
+		for (uint32_t b = begin; b < end; ++b)
+		{
+			inflated.clear();
+			const int y_end = std::min(int(b + 1) * COMPACT_BLOCK_ROWS, m_GridSize[1]);
+			size_t num_values = 0;
+			for (int y = int(b) * COMPACT_BLOCK_ROWS; y < y_end; ++y)
+			{
+				for (int x = 0; x < m_GridSize[0]; ++x)
+				{
+					const RayView<Scalar> ray = at(x, y);
+					writeVarint(inflated, ray.size());
+					int64_t previous = 0;
+					for (Scalar value : ray)
+					{
+						const int64_t q = std::llround(double(value) * subdivisions);
+						writeVarint(inflated, zigzag(q - previous));
+						previous = q;
+					}
+					num_values += ray.size();
+				}
+			}
+			uLongf deflated_size = compressBound(uLong(inflated.size()));
+			deflated[b].resize(deflated_size);
+			compress2(deflated[b].data(), &deflated_size, inflated.data(), uLong(inflated.size()), Z_BEST_SPEED);
+			deflated[b].resize(deflated_size);
+			blocks[b] = CompactBlock{ num_values, deflated_size, inflated.size() };
+		}
+	}, 1);
+
+	out.clear();
+	out.insert(out.end(), COMPACT_MAGIC, COMPACT_MAGIC + 4);
+	for (int i = 0; i < 3; ++i)
+		write(out, m_Origin[i]);
+	for (int i = 0; i < 3; ++i)
+		write(out, m_Extent[i]);
+	write(out, m_Spacing);
+	write(out, int32_t(m_Padding));
+	write(out, int32_t(m_GridSize[0]));
+	write(out, int32_t(m_GridSize[1]));
+	write(out, uint32_t(subdivisions));
+	write(out, uint32_t(COMPACT_BLOCK_ROWS));
+	write(out, uint32_t(num_blocks));
+	for (const CompactBlock &block : blocks)
+	{
+		write(out, block.num_values);
+		write(out, block.deflated_size);
+		write(out, block.inflated_size);
+	}
+	for (const std::vector<uint8_t> &block : deflated)
+	{
+		out.insert(out.end(), block.begin(), block.end());
 	}
 }
 
-void CompressedVolume::iterate(int i, int j, std::function<void(Scalar, Scalar, Scalar)> func)
+bool CompressedVolume::loadCompact(const uint8_t *data, size_t size)
 {
-	const auto &ray = at(i, j);
-	for (size_t k = 0; k + 1 < ray.size(); k += 2)
+	const uint8_t *data_end = data + size;
+	clear();
+	m_GridSize.setZero();
+	int32_t padding, xsize, ysize;
+	uint32_t subdivisions, block_rows, num_blocks;
+	if (size < 4 || std::memcmp(data, COMPACT_MAGIC, 4) != 0)
+	{
+		return false;
+	}
+	data += 4;
+	bool ok = true;
+	for (int i = 0; i < 3; ++i)
+		ok = ok && read(data, data_end, m_Origin[i]);
+	for (int i = 0; i < 3; ++i)
+		ok = ok && read(data, data_end, m_Extent[i]);
+	ok = ok && read(data, data_end, m_Spacing);
+	ok = ok && read(data, data_end, padding) && read(data, data_end, xsize) && read(data, data_end, ysize);
+	ok = ok && read(data, data_end, subdivisions) && read(data, data_end, block_rows) && read(data, data_end, num_blocks);
+	if (!ok || xsize < 0 || ysize < 0 || subdivisions == 0 || block_rows == 0 ||
+		num_blocks != (uint32_t(ysize) + block_rows - 1) / block_rows)
 	{
-		func(ray[k], ray[k + 1], 0.f);
+		return false;
 	}
+
+	// Where the values and the deflated data of every block start
+	std::vector<CompactBlock> blocks(num_blocks);
+	std::vector<size_t> first_value(num_blocks + 1, 0);
+	std::vector<const uint8_t *> block_data(num_blocks);
+	for (uint32_t b = 0; b < num_blocks; ++b)
+	{
+		ok = ok && read(data, data_end, blocks[b].num_values) && read(data, data_end, blocks[b].deflated_size) &&
+			read(data, data_end, blocks[b].inflated_size);
+		first_value[b + 1] = first_value[b] + size_t(blocks[b].num_values);
+	}
+	for (uint32_t b = 0; ok && b < num_blocks; ++b)
+	{
+		block_data[b] = data;
+		ok = blocks[b].deflated_size <= uint64_t(data_end - data);
+		data += ok ? blocks[b].deflated_size : 0;
+	}
+	if (!ok)
+	{
+		return false;
+	}
+
+	m_Padding = padding;
+	m_GridSize << xsize, ysize;
+	m_Data.allocate(numDexels(), first_value[num_blocks]);
+	size_t *offsets = m_Data.offsets();
+	Scalar *values = m_Data.values();
+	const double scale = 1.0 / subdivisions;
+	std::atomic<bool> valid(true);
+	parallelFor(num_blocks, [&](uint32_t begin, uint32_t end)
+	{
+		std::vector<uint8_t> inflated;
+		for (uint32_t b = begin; b < end && valid; ++b)
+		{
+			inflated.resize(size_t(blocks[b].inflated_size));
+			uLongf inflated_size = uLongf(inflated.size());
+			if (uncompress(inflated.data(), &inflated_size, block_data[b], uLong(blocks[b].deflated_size)) != Z_OK ||
+				inflated_size != inflated.size())
+			{
+				valid = false;
+				break;
+			}
+			const uint8_t *in = inflated.data(), *in_end = in + inflated.size();
+			size_t v = first_value[b];
+			const size_t v_end = first_value[b + 1];
+			const size_t i_end = size_t(std::min((b + 1) * block_rows, uint32_t(ysize))) * xsize;
+			for (size_t i = size_t(b) * block_rows * xsize; i < i_end; ++i)
+			{
+				uint64_t count, delta;
+				if (!readVarint(in, in_end, count) || count > v_end - v)
+				{
+					valid = false;
+					break;
+				}
+				int64_t q = 0;
+				for (uint64_t k = 0; k < count; ++k)
+				{
+					if (!readVarint(in, in_end, delta))
+					{
+						valid = false;
+						break;
+					}
+					q += unzigzag(delta);
+					values[v++] = Scalar(double(q) * scale);
+				}
+				if (!valid)
+				{
+					break;
+				}
+				// Ray i ends where ray i + 1 starts
+				offsets[i + 1] = v;
+			}
+			if (v != v_end)
+			{
+				valid = false;
+			}
+		}
+	}, 1);
+	if (!valid)
+	{
+		clear();
+		m_GridSize.setZero();
+		return false;
+	}
+	return true;
 }
 
-void CompressedVolume::copy_volume_from(const CompressedVolume voxel)
+void CompressedVolume::copy_volume_from(const CompressedVolume &voxel)
 {
+	if (&voxel == this)
+		return;
 	m_Origin = voxel.origin();
 	m_Extent = voxel.extent();
 	m_GridSize = voxel.gridSize();
 	m_Padding = voxel.padding();
 	m_Spacing = voxel.spacing();
-	m_Data.assign(m_GridSize[0] * m_GridSize[1], {});
-	//m_Data_Points.assign(m_GridSize[0] * m_GridSize[1], {});
-	for(int x=0;x<m_GridSize[0];x++)
-		for (int y = 0; y < m_GridSize[1]; y++)
-		{
-			m_Data[x + y*m_GridSize[0]].resize(voxel.at(x, y).size());
-			std::copy_n(voxel.at(x, y).begin(), voxel.at(x, y).size(), m_Data[x + y*m_GridSize[0]].begin());
-		}
-
+	m_Data = voxel.m_Data;
 }
 
 double CompressedVolume::get_volume()
@@ -75,22 +301,36 @@ double CompressedVolume::get_volume()
 
 int CompressedVolume::numSegments()
 {
-	int num_segs=0;
-	for (int x = 0; x < m_GridSize(0); x++)
-		for (int y = 0; y < m_GridSize(1); y++)
-			iterate(x, y, [&num_segs](Scalar begin_pt, Scalar end_pt) {++num_segs; });
-	return num_segs;
+	return int(m_Data.numValues() / 2);
 }
 
-void CompressedVolume::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius)
+void CompressedVolume::Builder::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius)
 {
-	vor3d::appendSegment(at(i, j), begin_pt, end_pt);
+	vor3d::appendSegment(ray(i, j), begin_pt, end_pt);
+}
+
+void CompressedVolume::assemble(std::vector<Builder> &builders)
+{
+	std::vector<DexelRays<Scalar>::Builder *> rays;
+	rays.reserve(builders.size());
+	for (Builder &builder : builders)
+	{
+		vor_assert(builder.m_XSize == m_GridSize[0]);
+		rays.push_back(&builder.m_Rays);
+	}
+	m_Data.assemble(numDexels(), rays);
+}
+
+void CompressedVolume::assemble(Builder &builder)
+{
+	vor_assert(builder.m_XSize == m_GridSize[0]);
+	m_Data.assemble(numDexels(), builder.m_Rays);
 }
 
 void CompressedVolume::reshape(int xsize, int ysize)
 {
 	m_GridSize << xsize, ysize;
-	m_Data.assign(xsize*ysize, {});
+	m_Data.assign(xsize*ysize);
 }
 
 void CompressedVolume::resize(int xsize, int ysize)
@@ -101,16 +341,7 @@ void CompressedVolume::resize(int xsize, int ysize)
 
 void CompressedVolume::clear()
 {
-	for (int x = 0; x < m_GridSize[0]; x++)
-	{
-		for (int y = 0; y < m_GridSize[1]; y++)
-		{
-			m_Data[x + m_GridSize[0] * y].clear();
-			m_Data[x + m_GridSize[0] * y].shrink_to_fit();
-		}
-	}
 	m_Data.clear();
-	m_Data.shrink_to_fit();
 }
 
 void CompressedVolume::load(std::istream &in)
@@ -120,17 +351,22 @@ void CompressedVolume::load(std::istream &in)
 	in >> m_GridSize(0) >> m_GridSize(1);
 	in >> m_Padding;
 	in >> m_Spacing;
-	m_Data.assign(m_GridSize(0)*m_GridSize(1), {});
-	for (auto & row : m_Data)
+	Builder builder(*this);
+	for (int y = 0; y < m_GridSize(1); ++y)
 	{
-		size_t size;
-		in >> size;
-		row.resize(size);
-		for (auto & val : row)
+		for (int x = 0; x < m_GridSize(0); ++x)
 		{
-			in >> val;
+			size_t size;
+			in >> size;
+			auto & row = builder.ray(x, y);
+			row.resize(size);
+			for (auto & val : row)
+			{
+				in >> val;
+			}
 		}
 	}
+	assemble(builder);
 }
 
 void CompressedVolume::save(std::ostream &out) const
@@ -140,8 +376,9 @@ void CompressedVolume::save(std::ostream &out) const
 	out << m_GridSize(0) << ' ' << m_GridSize(1) << "\n";
 	out << m_Padding << "\n";
 	out << m_Spacing << "\n";
-	for (const auto & row : m_Data)
+	for (size_t i = 0; i < m_Data.size(); ++i)
 	{
+		const auto row = m_Data[i];
 		out << row.size();
 		for (const auto & val : row)
 		{
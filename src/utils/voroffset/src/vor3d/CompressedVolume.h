@@ -2,6 +2,8 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "vor3d/CompressedVolumeBase.h"
+#include "vor3d/DexelRays.h"
+#include <cstdint>
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace voroffset3d
@@ -11,29 +13,71 @@ namespace voroffset3d
 	{
 	private:
 		// Member data
-		std::vector<std::vector<Scalar> > m_Data;
+		DexelRays<Scalar> m_Data;
 
 	public:
+		// Writes the rays of a volume, possibly from several threads with one builder each, see
+		// DexelRays::Builder. The builders are merged into the volume with assemble().
+		class Builder
+		{
+		private:
+			friend class CompressedVolume;
+			int m_XSize;
+			DexelRays<Scalar>::Builder m_Rays;
+
+		public:
+			explicit Builder(const CompressedVolumeBase &volume) : m_XSize(volume.gridSize()[0]) { }
+
+			// Intersections of dexel (x, y), the vector is empty when a ray is first asked for
+			std::vector<Scalar> & ray(int x, int y) { return m_Rays.ray(x + m_XSize * y); }
+
+			// Append a segment to dexel (i, j), merging it with the previous segment of the same ray
+			void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius);
+		};
+
 		// Interface
-		CompressedVolume(Eigen::Vector3d origin, Eigen::Vector3d extent, Scalar voxel_size, int padding);
+		CompressedVolume(Eigen::Vector3d origin, Eigen::Vector3d extent, double voxel_size, int padding);
 		CompressedVolume() = default;
 
 		// Marshalling
 		void save(std::ostream &out) const;
 		void load(std::istream &in);
 
-		void copy_volume_from(const CompressedVolume voxel);
+		// Compact binary form, e.g. to cache a volume in a file. The values of every ray are rounded to
+		// 1/subdivisions of a unit, delta encoded and packed as varints, then blocks of rows are deflated on
+		// their own so that both saving and loading run over the blocks in parallel. Loading decodes the
+		// blocks straight into the rays. Returns false if the data is not a valid compact volume, the
+		// volume is left empty then.
+		void saveCompact(std::vector<uint8_t> &out, int subdivisions = 256) const;
+		bool loadCompact(const uint8_t *data, size_t size);
+
+		void copy_volume_from(const CompressedVolume &voxel);
 		double get_volume();
 		int numSegments();
-		const std::vector<Scalar> & at(int x, int y) const { return m_Data[x + m_GridSize[0] * y]; }
-		std::vector<Scalar> & at(int x, int y) { return m_Data[x + m_GridSize[0] * y]; }
+		RayView<Scalar> at(int x, int y) const { return m_Data[x + m_GridSize[0] * y]; }
 
+		// Replace the rays with the ones of the builders, for the current grid size
+		void assemble(std::vector<Builder> &builders);
+		void assemble(Builder &builder);
 
-		// Apply a function to each segment in the structure
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar)> func) override;
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar, Scalar)> func1) override;
+		// Segments of dexel (x, y), see SegmentView
+		SegmentView segments(int x, int y) const { return at(x, y); }
 
-		virtual void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius) override;
+		// Apply func(begin, end) to each segment of dexel (i, j), or func(begin, end, radius) with a radius of 0
+		template<typename Func>
+		void iterate(int i, int j, Func &&func) const
+		{
+			const RayView<Scalar> ray = at(i, j);
+			for (size_t k = 0; k + 1 < ray.size(); k += 2)
+			{
+				func(ray[k], ray[k + 1]);
+			}
+		}
+		template<typename Func>
+		void iterateWithRadii(int i, int j, Func &&func) const
+		{
+			iterate(i, j, [&func](Scalar begin_pt, Scalar end_pt) { func(begin_pt, end_pt, Scalar(0)); });
+		}
 
 		virtual void reshape(int xsize, int ysize) override;
 		virtual void resize(int xsize, int ysize) override;
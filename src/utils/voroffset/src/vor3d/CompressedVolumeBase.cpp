@@ -10,7 +10,7 @@ Eigen::Vector2d CompressedVolumeBase::dexelCenter(int x, int y) const
 	return pos + m_Origin.head<2>();
 }
 
-void CompressedVolumeBase::reset(Eigen::Vector3d origin, Eigen::Vector3d extent, Scalar voxel_size, int padding, 
+void CompressedVolumeBase::reset(Eigen::Vector3d origin, Eigen::Vector3d extent, double voxel_size, int padding, 
 	int xsize, int ysize)
 {
 	m_Origin = origin;
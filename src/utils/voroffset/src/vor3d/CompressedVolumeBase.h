@@ -16,7 +16,7 @@ namespace voroffset3d
 	protected:
 		Eigen::Vector3d m_Origin;
 		Eigen::Vector3d m_Extent;
-		Scalar          m_Spacing; // voxel size (in mm)
+		double          m_Spacing; // voxel size (in mm)
 		int				m_Padding;
 		Eigen::Vector2i m_GridSize;
 
@@ -25,15 +25,11 @@ namespace voroffset3d
 		virtual ~CompressedVolumeBase() = default;
 		//CompressedVolumeBase() {}
 
-		// Apply a function to each segment in the structure
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar, Scalar)> func) = 0;
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar)> func) = 0;
-
-		// Append a segment to the given segments vector
-		virtual void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius) = 0;
+		// The segments of a dexel are read through the concrete volume types (segments, iterate), so that the
+		// work done per segment inlines into the loops over them
 
 		virtual void reshape(int xsize, int ysize) = 0;
-		void reset(Eigen::Vector3d origin, Eigen::Vector3d extent, Scalar voxel_size, int padding,
+		void reset(Eigen::Vector3d origin, Eigen::Vector3d extent, double voxel_size, int padding,
 						int xsize, int ysize);
 		virtual void resize(int xsize, int ysize) = 0;
 		virtual void clear() = 0;
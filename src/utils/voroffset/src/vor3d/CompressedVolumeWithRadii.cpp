@@ -17,41 +17,20 @@ CompressedVolumeWithRadii::CompressedVolumeWithRadii(
 	m_Origin.array() -= padding * voxel_size;
 	m_GridSize[0] =  (int)(std::ceil(extent[0] / m_Spacing) + 2 * padding);
 	m_GridSize[1] =  (int)(std::ceil(extent[1] / m_Spacing) + 2 * padding);
-	m_Data.assign(m_GridSize[0] * m_GridSize[1], {});
+	m_Data.assign(m_GridSize[0] * m_GridSize[1]);
 	
 }
 // ----------------------------------------------------------------------------
-void CompressedVolumeWithRadii::iterate(int i, int j, std::function<void(Scalar, Scalar, Scalar)> func)
-{
-	auto &m_ray = at(i, j);
-	for (const SegmentWithRadius s : m_ray)
-		func(s.y1, s.y2, s.r);
-
-}
-
-void CompressedVolumeWithRadii::iterate(int i, int j, std::function<void(Scalar, Scalar)> func)
-{
-	auto &m_ray = at(i, j);
-	for (const SegmentWithRadius s : m_ray)
-		func(s.y1, s.y2);
-
-}
-
-void CompressedVolumeWithRadii::copy_volume_from(const CompressedVolumeWithRadii voxel)
+void CompressedVolumeWithRadii::copy_volume_from(const CompressedVolumeWithRadii &voxel)
 {
+	if (&voxel == this)
+		return;
 	m_Origin = voxel.origin();
 	m_Extent = voxel.extent();
 	m_GridSize = voxel.gridSize();
 	m_Padding = voxel.padding();
 	m_Spacing = voxel.spacing();
-	m_Data.assign(m_GridSize[0] * m_GridSize[1], {});
-	for(int x=0;x<m_GridSize[0];x++)
-		for (int y = 0; y < m_GridSize[1]; y++)
-		{
-			m_Data[x + y*m_GridSize[0]].resize(voxel.at(x, y).size());
-			std::copy_n(voxel.at(x, y).begin(), voxel.at(x, y).size(), m_Data[x + y*m_GridSize[0]].begin());
-		}
-
+	m_Data = voxel.m_Data;
 }
 
 double CompressedVolumeWithRadii::get_volume()
@@ -71,24 +50,37 @@ double CompressedVolumeWithRadii::get_volume()
 
 int CompressedVolumeWithRadii::numSegments()
 {
-	int num_segs=0;
-	for (int x = 0; x < m_GridSize(0); x++)
-		for (int y = 0; y < m_GridSize(1); y++)
-			iterate(x, y, [&num_segs](Scalar begin_pt, Scalar end_pt){++num_segs; });
-	return num_segs;
+	return int(m_Data.numValues());
 }
 
-void CompressedVolumeWithRadii::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius)
+void CompressedVolumeWithRadii::Builder::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius)
 {
 	SegmentWithRadius m_seg(begin_pt, end_pt, radius);
-	vor3d::appendSegment(at(i, j), m_seg);
+	vor3d::appendSegment(ray(i, j), m_seg);
 }
 
+void CompressedVolumeWithRadii::assemble(std::vector<Builder> &builders)
+{
+	std::vector<DexelRays<SegmentWithRadius>::Builder *> rays;
+	rays.reserve(builders.size());
+	for (Builder &builder : builders)
+	{
+		vor_assert(builder.m_XSize == m_GridSize[0]);
+		rays.push_back(&builder.m_Rays);
+	}
+	m_Data.assemble(numDexels(), rays);
+}
+
+void CompressedVolumeWithRadii::assemble(Builder &builder)
+{
+	vor_assert(builder.m_XSize == m_GridSize[0]);
+	m_Data.assemble(numDexels(), builder.m_Rays);
+}
 
 void CompressedVolumeWithRadii::reshape(int xsize, int ysize)
 {
 	m_GridSize << xsize, ysize;
-	m_Data.assign(xsize*ysize, {});
+	m_Data.assign(xsize*ysize);
 }
 
 void CompressedVolumeWithRadii::resize(int xsize, int ysize)
@@ -99,14 +91,5 @@ void CompressedVolumeWithRadii::resize(int xsize, int ysize)
 
 void CompressedVolumeWithRadii::clear()
 {
-	for (int x = 0; x < m_GridSize[0]; x++)
-	{
-		for (int y = 0; y < m_GridSize[1]; y++)
-		{
-			m_Data[x + m_GridSize[0] * y].clear();
-			m_Data[x + m_GridSize[0] * y].shrink_to_fit();
-		}
-	}
 	m_Data.clear();
-	m_Data.shrink_to_fit();
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "vor3d/CompressedVolumeBase.h"
+#include "vor3d/DexelRays.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace voroffset3d
@@ -10,26 +11,58 @@ namespace voroffset3d
 	class CompressedVolumeWithRadii : public CompressedVolumeBase
 	{
 	private:
-		std::vector<std::vector<SegmentWithRadius>> m_Data;
-		std::vector<SegmentWithRadius> m_segs_vec;
+		DexelRays<SegmentWithRadius> m_Data;
 
 	public:
+		// Same as CompressedVolume::Builder
+		class Builder
+		{
+		private:
+			friend class CompressedVolumeWithRadii;
+			int m_XSize;
+			DexelRays<SegmentWithRadius>::Builder m_Rays;
+
+		public:
+			explicit Builder(const CompressedVolumeBase &volume) : m_XSize(volume.gridSize()[0]) { }
+
+			std::vector<SegmentWithRadius> & ray(int x, int y) { return m_Rays.ray(x + m_XSize * y); }
+
+			// Append a segment to dexel (i, j), resolving its overlap with the previous segments of the ray
+			void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius);
+		};
+
 		// Interface
 		CompressedVolumeWithRadii(Eigen::Vector3d origin, Eigen::Vector3d extent, double voxel_size, int padding);
 		CompressedVolumeWithRadii() = default;
 
-		void copy_volume_from(const CompressedVolumeWithRadii voxel);
+		void copy_volume_from(const CompressedVolumeWithRadii &voxel);
 		double get_volume();
 		int numSegments();
-		const std::vector<SegmentWithRadius> & at(int x, int y) const { return m_Data[x + m_GridSize[0] * y]; }
-		std::vector<SegmentWithRadius> & at(int x, int y) { return m_Data[x + m_GridSize[0] * y]; }
+		RayView<SegmentWithRadius> at(int x, int y) const { return m_Data[x + m_GridSize[0] * y]; }
+
+		void assemble(std::vector<Builder> &builders);
+		void assemble(Builder &builder);
 
-		// Apply a function to each segment in the structure
-		//void iterate(std::function<void(int, int, Scalar, Scalar)> func) const;
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar)> func) override;
-		virtual void iterate(int i, int j, std::function<void(Scalar, Scalar, Scalar)> func1) override;
+		// Segments of dexel (x, y), same as CompressedVolume::segments
+		RayView<SegmentWithRadius> segments(int x, int y) const { return at(x, y); }
 
-		virtual void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius) override;
+		// Apply func(begin, end) or func(begin, end, radius) to each segment of dexel (i, j)
+		template<typename Func>
+		void iterate(int i, int j, Func &&func) const
+		{
+			for (const SegmentWithRadius &s : at(i, j))
+			{
+				func(s.y1, s.y2);
+			}
+		}
+		template<typename Func>
+		void iterateWithRadii(int i, int j, Func &&func) const
+		{
+			for (const SegmentWithRadius &s : at(i, j))
+			{
+				func(s.y1, s.y2, s.r);
+			}
+		}
 
 		virtual void reshape(int xsize, int ysize) override;
 		virtual void resize(int xsize, int ysize) override;
@@ -0,0 +1,136 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Common.h"
+#include <cstddef>
+#include <utility>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Read only view of the values of one dexel ray, or of a std::vector holding a ray
+	template<typename T>
+	class RayView
+	{
+	private:
+		const T *m_Begin = nullptr;
+		const T *m_End = nullptr;
+
+	public:
+		typedef T value_type;
+		typedef const T * const_iterator;
+
+		RayView() = default;
+		RayView(const T *begin, const T *end) : m_Begin(begin), m_End(end) { }
+		RayView(const std::vector<T> &ray) : m_Begin(ray.data()), m_End(ray.data() + ray.size()) { }
+
+		const T * begin() const { return m_Begin; }
+		const T * end() const { return m_End; }
+		size_t size() const { return size_t(m_End - m_Begin); }
+		bool empty() const { return m_Begin == m_End; }
+		const T & operator[](size_t i) const { return m_Begin[i]; }
+		const T & front() const { return *m_Begin; }
+		const T & back() const { return m_End[-1]; }
+	};
+
+	// Segments of a ray of interleaved begin and end values, as a range of SegmentWithRadius of radius 0 so that
+	// code written for CompressedVolumeWithRadii::segments reads CompressedVolume::segments as well. A trailing
+	// unmatched value is ignored.
+	class SegmentView
+	{
+	public:
+		class const_iterator
+		{
+		private:
+			const Scalar *m_Pos;
+
+		public:
+			explicit const_iterator(const Scalar *pos) : m_Pos(pos) { }
+			SegmentWithRadius operator*() const { return SegmentWithRadius(m_Pos[0], m_Pos[1], Scalar(0)); }
+			const_iterator & operator++() { m_Pos += 2; return *this; }
+			bool operator==(const const_iterator &o) const { return m_Pos == o.m_Pos; }
+			bool operator!=(const const_iterator &o) const { return m_Pos != o.m_Pos; }
+		};
+
+	private:
+		RayView<Scalar> m_Ray;
+
+	public:
+		SegmentView(RayView<Scalar> ray) : m_Ray(ray) { }
+
+		const_iterator begin() const { return const_iterator(m_Ray.begin()); }
+		const_iterator end() const { return const_iterator(m_Ray.begin() + 2 * size()); }
+		size_t size() const { return m_Ray.size() / 2; }
+		bool empty() const { return size() == 0; }
+	};
+
+	// Rays of a grid of dexels in compressed sparse row layout: the values of all the rays follow each other in a
+	// single array, ray i is [offsets[i], offsets[i + 1]). Sweeps read the rays in order without chasing one heap
+	// block per dexel, at the price of rays that cannot grow in place. Rays are written with Builders instead.
+	template<typename T>
+	class DexelRays
+	{
+	public:
+		// Collects whole rays, in any order, for one writer (e.g. one sweep line or one worker thread). The
+		// rays of several builders are merged with DexelRays::assemble.
+		class Builder
+		{
+		private:
+			friend class DexelRays;
+
+			// Values of the finished rays, in the order they were written
+			std::vector<T> m_Values;
+			// Index and number of values of each finished ray
+			std::vector<std::pair<size_t, size_t> > m_Rays;
+			// Ray being written, reused from one ray to the next
+			std::vector<T> m_Current;
+			size_t m_CurrentIndex = size_t(-1);
+
+			void flush();
+
+		public:
+			// Vector receiving the values of ray i. It stays the same vector while the same ray is asked for, so
+			// segments can be merged with the previous ones. Asking for another ray finishes ray i.
+			std::vector<T> & ray(size_t i);
+
+			void clear();
+		};
+
+	private:
+		std::vector<T> m_Values;
+		std::vector<size_t> m_Offsets = std::vector<size_t>(1, 0);
+
+	public:
+		// Number of rays
+		size_t size() const { return m_Offsets.size() - 1; }
+		// Number of values over all the rays
+		size_t numValues() const { return m_Values.size(); }
+
+		RayView<T> operator[](size_t i) const
+		{
+			return RayView<T>(m_Values.data() + m_Offsets[i], m_Values.data() + m_Offsets[i + 1]);
+		}
+
+		// num_rays empty rays
+		void assign(size_t num_rays);
+		// Keep the first num_rays rays, the new ones are empty
+		void resize(size_t num_rays);
+		// Release the memory
+		void clear();
+
+		// Storage for num_rays rays of num_values values overall, left for the caller to fill in place: ray i
+		// takes values [offsets()[i], offsets()[i + 1]), with offsets()[0] = 0 and offsets()[num_rays] =
+		// num_values. For readers that know the size of every ray up front, such as CompressedVolume::loadCompact.
+		void allocate(size_t num_rays, size_t num_values);
+		size_t * offsets() { return m_Offsets.data(); }
+		T * values() { return m_Values.data(); }
+
+		// Replace the content with num_rays rays written by the builders, then clear the builders. Rays nobody
+		// wrote are empty, rays written several times are concatenated in the order of the builders.
+		void assemble(size_t num_rays, const std::vector<Builder *> &builders);
+		void assemble(size_t num_rays, Builder &builder) { assemble(num_rays, std::vector<Builder *>(1, &builder)); }
+	};
+}
+
+#include "vor3d/DexelRays.hpp"
@@ -0,0 +1,111 @@
+#include "vor3d/DexelRays.h"
+#include <algorithm>
+
+namespace voroffset3d
+{
+	template<typename T>
+	std::vector<T> & DexelRays<T>::Builder::ray(size_t i)
+	{
+		if (i != m_CurrentIndex)
+		{
+			flush();
+			m_CurrentIndex = i;
+		}
+		return m_Current;
+	}
+
+	template<typename T>
+	void DexelRays<T>::Builder::flush()
+	{
+		if (m_CurrentIndex != size_t(-1) && !m_Current.empty())
+		{
+			m_Values.insert(m_Values.end(), m_Current.begin(), m_Current.end());
+			m_Rays.emplace_back(m_CurrentIndex, m_Current.size());
+		}
+		m_Current.clear();
+		m_CurrentIndex = size_t(-1);
+	}
+
+	template<typename T>
+	void DexelRays<T>::Builder::clear()
+	{
+		std::vector<T>().swap(m_Values);
+		std::vector<std::pair<size_t, size_t> >().swap(m_Rays);
+		std::vector<T>().swap(m_Current);
+		m_CurrentIndex = size_t(-1);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+
+	template<typename T>
+	void DexelRays<T>::assign(size_t num_rays)
+	{
+		m_Values.clear();
+		m_Offsets.assign(num_rays + 1, 0);
+	}
+
+	template<typename T>
+	void DexelRays<T>::resize(size_t num_rays)
+	{
+		if (num_rays < size())
+		{
+			m_Offsets.resize(num_rays + 1);
+			m_Values.resize(m_Offsets.back());
+		}
+		else
+		{
+			m_Offsets.resize(num_rays + 1, m_Offsets.back());
+		}
+	}
+
+	template<typename T>
+	void DexelRays<T>::allocate(size_t num_rays, size_t num_values)
+	{
+		m_Offsets.assign(num_rays + 1, 0);
+		m_Offsets[num_rays] = num_values;
+		m_Values.resize(num_values);
+	}
+
+	template<typename T>
+	void DexelRays<T>::clear()
+	{
+		std::vector<T>().swap(m_Values);
+		m_Offsets.assign(1, 0);
+		m_Offsets.shrink_to_fit();
+	}
+
+	template<typename T>
+	void DexelRays<T>::assemble(size_t num_rays, const std::vector<Builder *> &builders)
+	{
+		// Count the values of each ray in m_Offsets[i + 1], then turn the counts into offsets
+		m_Offsets.assign(num_rays + 1, 0);
+		for (Builder *builder : builders)
+		{
+			builder->flush();
+			for (const auto &ray : builder->m_Rays)
+			{
+				vor_assert(ray.first < num_rays);
+				m_Offsets[ray.first + 1] += ray.second;
+			}
+		}
+		for (size_t i = 1; i <= num_rays; ++i)
+			m_Offsets[i] += m_Offsets[i - 1];
+		m_Values.resize(m_Offsets[num_rays]);
+
+		// m_Offsets[i] is the write position of ray i, it ends up at the start of ray i + 1
+		for (Builder *builder : builders)
+		{
+			auto src = builder->m_Values.cbegin();
+			for (const auto &ray : builder->m_Rays)
+			{
+				std::copy_n(src, ray.second, m_Values.begin() + m_Offsets[ray.first]);
+				m_Offsets[ray.first] += ray.second;
+				src += ray.second;
+			}
+			builder->clear();
+		}
+		for (size_t i = num_rays; i > 0; --i)
+			m_Offsets[i] = m_Offsets[i - 1];
+		m_Offsets[0] = 0;
+	}
+}
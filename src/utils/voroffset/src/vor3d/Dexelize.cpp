@@ -1,4 +1,5 @@
 #include "vor3d/Dexelize.h"
+#include "vor3d/Parallel.h"
 #include <geogram/basic/file_system.h>
 #include <geogram/basic/command_line.h>
 #include <geogram/basic/command_line_args.h>
@@ -18,9 +19,6 @@
 #include <igl/copyleft/marching_cubes.h>
 #include <igl/writeOBJ.h>
 
-//#include "tbb/blocked_range.h"
-//#include "tbb/parallel_for.h"
-//#include "tbb/task_scheduler_init.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef TEST_WID
@@ -126,42 +124,58 @@ namespace
 	////////////////////////////////////////////////////////////////////////////////
 
 
+	// Vertices of a facet in the (X, Y, Z) frame of the rays, copied out of the mesh once so the ray casts
+	// don't go through the corner and vertex indirections for every candidate facet
+	struct RayFacet
+	{
+		double x[3], y[3], z[3];
+		// Facets whose projection along the rays is flat are never hit
+		bool flat;
+	};
+
+	template<int X = 0, int Y = 1, int Z = 2>
+	std::vector<RayFacet> ray_facets(const GEO::Mesh &M)
+	{
+		using namespace GEO;
+
+		std::vector<RayFacet> facets(M.facets.nb());
+		for (index_t f = 0; f < M.facets.nb(); ++f)
+		{
+			RayFacet &facet = facets[f];
+			index_t c = M.facets.corners_begin(f);
+			for (int i = 0; i < 3; ++i, ++c)
+			{
+				const vec3& p = Geom::mesh_vertex(M, M.facet_corners.vertex(c));
+				facet.x[i] = p[X];
+				facet.y[i] = p[Y];
+				facet.z[i] = p[Z];
+			}
+			facet.flat = orient_2d_inexact(vec2(facet.x[0], facet.y[0]), vec2(facet.x[1], facet.y[1]),
+				vec2(facet.x[2], facet.y[2])) == GEO::ZERO;
+		}
+		return facets;
+	}
+
 	/**
 	 * @brief      { Intersect a vertical ray with a triangle }
 	 *
-	 * @param[in]  M     { Mesh containing the triangle to intersect }
-	 * @param[in]  f     { Index of the facet to intersect }
-	 * @param[in]  q     { Query point (only XY coordinates are used) }
+	 * @param[in]  facet { Triangle to intersect }
+	 * @param[in]  qx    { X coordinate of the ray }
+	 * @param[in]  qy    { Y coordinate of the ray }
 	 * @param[out] z     { Intersection }
 	 *
-	 * @return     { description_of_the_return_value }
+	 * @return     { Whether the ray crosses the triangle }
 	 */
-	template<int X = 0, int Y = 1, int Z = 2>
-	int intersect_ray_z(const GEO::Mesh &M, GEO::index_t f, const GEO::vec3 &q, double &z)
+	inline bool intersect_ray_z(const RayFacet &facet, double qx, double qy, double &z)
 	{
-		using namespace GEO;
-
-		index_t c = M.facets.corners_begin(f);
-		const vec3& p1 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
-		const vec3& p2 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
-		const vec3& p3 = Geom::mesh_vertex(M, M.facet_corners.vertex(c));
-
 		double u, v, w;
-		if (point_in_triangle_2d(
-			q[X], q[Y], p1[X], p1[Y], p2[X], p2[Y], p3[X], p3[Y], u, v, w))
+		if (!facet.flat && point_in_triangle_2d(
+			qx, qy, facet.x[0], facet.y[0], facet.x[1], facet.y[1], facet.x[2], facet.y[2], u, v, w))
 		{
-			z = u * p1[Z] + v * p2[Z] + w * p3[Z];
-			auto sign = orient_2d_inexact(vec2(p1[X], p1[Y]), vec2(p2[X], p2[Y]), vec2(p3[X], p3[Y]));
-			switch (sign)
-			{
-			case GEO::POSITIVE: return 1;
-			case GEO::NEGATIVE: return -1;
-			case GEO::ZERO:
-			default: return 0;
-			}
+			z = u * facet.z[0] + v * facet.z[1] + w * facet.z[2];
+			return true;
 		}
-
-		return 0;
+		return false;
 	}
 
 	// -----------------------------------------------------------------------------
@@ -178,48 +192,43 @@ namespace
 			GEO::vec3 min_corner, max_corner;
 			GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
 
-			const GEO::vec3 origin(dexels.origin().data());
-			const double origin_z = origin[2];
 			const double spacing = dexels.spacing();
-			//GEO::parallel_for([&](int y)
-			for (int y = 0; y < size[1]; ++y)
+			const std::vector<RayFacet> facets = ray_facets(M);
+			// Rows of dexels, each written by its own builder. The AABB tree is only read by the queries.
+			std::vector<vor3d::CompressedVolume::Builder> rows(size[1], vor3d::CompressedVolume::Builder(dexels));
+			vor3d::parallelFor((uint32_t)size[1], [&](uint32_t begin, uint32_t end)
 			{
-				//if (GEO::Thread::current()->id() == 0) {
-				// task.progress((int) (100.0 * y / size[1] * GEO::Process::number_of_cores()));
-				//}
-				for (int x = 0; x < size[0]; ++x)
+				// Intersections of the current dexel, reused over the rows of the range
+				std::vector<double> inter;
+				for (int y = (int)begin; y < (int)end; ++y)
 				{
-					GEO::vec2 center_xy(dexels.dexelCenter(x, y).data());
-					GEO::vec3 center(center_xy[0], center_xy[1], 0);
+					for (int x = 0; x < size[0]; ++x)
+					{
+						const Eigen::Vector2d center = dexels.dexelCenter(x, y);
 
-					GEO::Box box;
-					box.xyz_min[0] = box.xyz_max[0] = center[0];
-					box.xyz_min[1] = box.xyz_max[1] = center[1];
-					box.xyz_min[2] = min_corner[2] - spacing;
-					box.xyz_max[2] = max_corner[2] + spacing;
+						GEO::Box box;
+						box.xyz_min[0] = box.xyz_max[0] = center[0];
+						box.xyz_min[1] = box.xyz_max[1] = center[1];
+						box.xyz_min[2] = min_corner[2] - spacing;
+						box.xyz_max[2] = max_corner[2] + spacing;
 
-					std::vector<double> inter;
-					auto action = [&M, &inter, &center, &spacing](GEO::index_t f)
-					{
-						double z;
-						if (intersect_ray_z(M, f, center, z))
+						inter.clear();
+						auto action = [&facets, &inter, &center, spacing](GEO::index_t f)
 						{
-							inter.push_back(z / spacing);
-						}
-					};
-					aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
-					std::sort(inter.begin(), inter.end());
-
-					dexels.at(x, y).resize(inter.size());
-					//dexels.at(x, y).resize(inter.size() / 2);
-					size_t n = dexels.at(x, y).size();
-					std::copy_n(inter.begin(), inter.size(), dexels.at(x, y).begin());
-					/*for (int i = 0; i < n; i++)
-					{
-					dexels.at(x, y)[i] = vor3d::m_Segment(inter[2 * i], inter[2 * i + 1], radius);
-					}*/
+							double z;
+							if (intersect_ray_z(facets[f], center[0], center[1], z))
+							{
+								inter.push_back(z / spacing);
+							}
+						};
+						aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
+						std::sort(inter.begin(), inter.end());
+
+						rows[y].ray(x, y).assign(inter.begin(), inter.end());
+					}
 				}
-			}//, 0, size[1]);
+			});
+			dexels.assemble(rows);
 		}
 		catch (const GEO::TaskCanceled&)
 		{
@@ -320,6 +329,7 @@ void voroffset3d::dexel_dump(const std::string &filename, const CompressedVolume
 
 void volume_to_dexels(const Eigen::VectorXd& scalars, int w, int h, int d, vor3d::CompressedVolume& dexels) {
   dexels = vor3d::CompressedVolume(Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(w, h, d), 1.0, 0.0);
+  vor3d::CompressedVolume::Builder builder(dexels);
 
   for (int z = 0; z < d; z++) {
     for (int y = 0; y < h; y++) {
@@ -331,11 +341,12 @@ void volume_to_dexels(const Eigen::VectorXd& scalars, int w, int h, int d, vor3d
           seg_entry = x;
           outside = false;
         } else if (outside && scalars[start_idx] <= 0.0) {
-          dexels.appendSegment(z, y, seg_entry, x, -1);
+          builder.appendSegment(z, y, seg_entry, x, -1);
           outside = true;
         }
       }
     }
   }
+  dexels.assemble(builder);
 
 }
@@ -0,0 +1,144 @@
+#include "vor3d/DistanceField.h"
+#include "vor3d/DistanceTransform.h"
+#include "vor3d/Parallel.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+using namespace voroffset3d;
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DistanceField::build(const CompressedVolume &input, double max_radius)
+{
+	clear();
+	m_Origin = input.origin();
+	m_Extent = input.extent();
+	m_Spacing = input.spacing();
+	m_Padding = input.padding();
+	m_GridSize = input.gridSize();
+	m_MaxRadius = max_radius;
+
+	// Box of the input
+	int x_min = m_GridSize[0], x_max = -1, y_min = m_GridSize[1], y_max = -1;
+	double z_min = std::numeric_limits<double>::max(), z_max = std::numeric_limits<double>::lowest();
+	for (int y = 0; y < m_GridSize[1]; ++y)
+	{
+		for (int x = 0; x < m_GridSize[0]; ++x)
+		{
+			RayView<Scalar> ray = input.at(x, y);
+			if (ray.empty())
+			{
+				continue;
+			}
+			x_min = std::min(x_min, x);
+			x_max = std::max(x_max, x);
+			y_min = std::min(y_min, y);
+			y_max = std::max(y_max, y);
+			z_min = std::min(z_min, double(ray.front()));
+			z_max = std::max(z_max, double(ray.back()));
+		}
+	}
+	if (x_max < 0)
+	{
+		return;
+	}
+
+	// Grown by what a max_radius dilation reaches, and a sample more for the interpolation of its ends
+	const double margin = max_radius + 2;
+	const int reach = int(std::ceil(max_radius)) + 1;
+	m_X0 = std::max(x_min - reach, 0);
+	m_Y0 = std::max(y_min - reach, 0);
+	m_NX = std::min(x_max + reach + 1, m_GridSize[0]) - m_X0;
+	m_NY = std::min(y_max + reach + 1, m_GridSize[1]) - m_Y0;
+	m_Z0 = std::floor(z_min - margin);
+	m_NZ = int(std::ceil(z_max + margin - m_Z0));
+	m_Dist.resize(size_t(m_NX) * m_NY * m_NZ);
+
+	// Distances beyond the cap are never looked at, capping them keeps the parabolas of the transforms finite
+	const float cap = float(margin * margin);
+	const int nx = m_NX, ny = m_NY, nz = m_NZ;
+
+	// Along z: distance of every sample to the segments of its own dexel
+	parallelFor((uint32_t)ny, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			for (int x = 0; x < nx; ++x)
+			{
+				float *dist = m_Dist.data() + (size_t(y) * nx + x) * nz;
+				squaredDistanceToSegments(input.at(m_X0 + x, m_Y0 + int(y)), m_Z0 + 0.5, 1.0, nz, dist,
+					static_cast<float *>(nullptr));
+				for (int k = 0; k < nz; ++k)
+				{
+					dist[k] = std::min(dist[k], cap);
+				}
+			}
+		}
+	});
+
+	// Along x and y
+	squaredDistanceTransform(m_Dist.data(), std::array<int, 3>{{ nz, nx, ny }}, 1.0, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DistanceField::dilation(double radius, CompressedVolume &result) const
+{
+	assert(radius <= m_MaxRadius);
+	result.reset(m_Origin, m_Extent, m_Spacing, m_Padding, m_GridSize[0], m_GridSize[1]);
+	if (m_Dist.empty())
+	{
+		return;
+	}
+	const double r2 = radius * radius;
+	const int nx = m_NX, nz = m_NZ;
+
+	std::vector<CompressedVolume::Builder> rows(m_NY, CompressedVolume::Builder(result));
+	parallelFor((uint32_t)m_NY, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			for (int x = 0; x < nx; ++x)
+			{
+				const float *dist = m_Dist.data() + (size_t(y) * nx + x) * nz;
+				std::vector<Scalar> *ray = nullptr;
+				bool inside = false;
+				for (int k = 0; k < nz; ++k)
+				{
+					if ((dist[k] <= r2) == inside)
+					{
+						continue;
+					}
+					// The threshold is crossed between samples k - 1 and k, where the distance reaches radius
+					double z = m_Z0 + k + 0.5;
+					if (k > 0)
+					{
+						const double d0 = std::sqrt(double(dist[k - 1]));
+						const double d1 = std::sqrt(double(dist[k]));
+						z -= (radius - d1) / (d0 - d1);
+					}
+					if (!ray)
+					{
+						ray = &rows[y].ray(m_X0 + x, m_Y0 + int(y));
+					}
+					ray->push_back(Scalar(z));
+					inside = !inside;
+				}
+				if (inside)
+				{
+					ray->push_back(Scalar(m_Z0 + nz - 0.5));
+				}
+			}
+		}
+	});
+	result.assemble(rows);
+}
+
+void DistanceField::clear()
+{
+	m_Dist.clear();
+	m_Dist.shrink_to_fit();
+	m_NX = m_NY = m_NZ = 0;
+}
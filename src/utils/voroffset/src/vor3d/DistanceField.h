@@ -0,0 +1,47 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Common.h"
+#include "vor3d/CompressedVolume.h"
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Squared Euclidean distance to a volume, sampled once so that its dilations by any radius up to max_radius are
+	// a threshold away instead of two sweeps each. The distance is exact at the samples: the rays are first
+	// sampled along z at unit steps, then the separable transform of Felzenszwalb and Huttenlocher runs along
+	// x and along y. Samples further than max_radius (plus a margin) from the volume are capped, which does not
+	// change the distances below the cap.
+	//
+	// Only the box around the volume a max_radius dilation can reach is stored, one float per sample.
+	class DistanceField
+	{
+	private:
+		// Grid of the input volume
+		Eigen::Vector3d m_Origin, m_Extent;
+		double m_Spacing = 1;
+		int m_Padding = 0;
+		Eigen::Vector2i m_GridSize = Eigen::Vector2i::Zero();
+		double m_MaxRadius = 0;
+		// Stored box: dexels [m_X0, m_X0 + m_NX) x [m_Y0, m_Y0 + m_NY), sample k at z = m_Z0 + k + 0.5
+		int m_X0 = 0, m_Y0 = 0;
+		int m_NX = 0, m_NY = 0, m_NZ = 0;
+		double m_Z0 = 0;
+		// Squared distances, sample k of dexel (x, y) of the box at ((y * m_NX) + x) * m_NZ + k
+		std::vector<float> m_Dist;
+
+	public:
+		// Sample the distance to input, for dilations up to max_radius (in units of the spacing, like
+		// VoronoiMorpho::dilation)
+		void build(const CompressedVolume &input, double max_radius);
+
+		// The dilation of the input by radius <= maxRadius(), in the grid of the input. Segment ends are
+		// interpolated between the samples on both sides of the threshold, within a sample of the exact dilation.
+		void dilation(double radius, CompressedVolume &result) const;
+
+		double maxRadius() const { return m_MaxRadius; }
+		bool empty() const { return m_Dist.empty(); }
+		void clear();
+	};
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/DexelRays.h"
+#include "vor3d/Parallel.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Exact squared Euclidean distance transforms of sampled functions on dense grids, one axis at a time
+	// (Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions"). The first pass over dexels
+	// does not need to be sampled and transformed: squaredDistanceToSegments gives the distance along the ray
+	// directly, and the other axes are transformed after it.
+
+	// Buffers of squaredDistance1D, reused from one line to the next
+	struct DistanceTransformScratch
+	{
+		std::vector<double> g;
+		std::vector<int> v;
+		std::vector<double> z;
+	};
+
+	// Squared distance transform of the n contiguous samples of f in place, for samples spaced by spacing.
+	// Each sample q is a parabola (spacing * (p - q))^2 + f[q] and gets the lower envelope of all of them.
+	// Infinite samples add no parabola, so a line without a finite sample stays infinite.
+	template<typename T>
+	void squaredDistance1D(T *f, int n, double spacing, DistanceTransformScratch &scratch)
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		const double h2 = spacing * spacing;
+		std::vector<double> &g = scratch.g;
+		std::vector<int> &v = scratch.v;
+		std::vector<double> &z = scratch.z;
+		g.assign(f, f + n);
+		v.resize(n);
+		z.resize(n + 1);
+
+		int k = -1;
+		for (int q = 0; q < n; ++q)
+		{
+			if (g[q] == inf)
+			{
+				continue;
+			}
+			// Drop the parabolas the one of q hides
+			double s = -inf;
+			while (k >= 0)
+			{
+				const int p = v[k];
+				s = ((g[q] + h2 * q * q) - (g[p] + h2 * p * p)) / (2.0 * h2 * (q - p));
+				if (s > z[k])
+				{
+					break;
+				}
+				--k;
+			}
+			++k;
+			v[k] = q;
+			z[k] = k == 0 ? -inf : s;
+			z[k + 1] = inf;
+		}
+		if (k < 0)
+		{
+			return;
+		}
+
+		for (int p = 0, j = 0; p < n; ++p)
+		{
+			while (z[j + 1] < p)
+			{
+				++j;
+			}
+			const double d = spacing * (p - v[j]);
+			f[p] = T(d * d + g[v[j]]);
+		}
+	}
+
+	// Squared distances of the n samples first + k * spacing along a dexel to its segments. outside gets the
+	// distance to the segments, 0 inside them, and inside, unless it is null, the distance to the gaps between
+	// them, 0 outside. Samples on a segment end are outside at distance 0. A dexel without segments is infinitely
+	// far from every sample.
+	template<typename Scalar, typename T>
+	void squaredDistanceToSegments(RayView<Scalar> ray, double first, double spacing, int n, T *outside, T *inside)
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		size_t s = 0;
+		for (int k = 0; k < n; ++k)
+		{
+			const double t = first + k * spacing;
+			// Number of segment ends at or before t
+			while (s < ray.size() && ray[s] <= t)
+			{
+				++s;
+			}
+			double d = inf;
+			if (s > 0)
+			{
+				d = t - ray[s - 1];
+			}
+			if (s < ray.size())
+			{
+				d = std::min(d, double(ray[s]) - t);
+			}
+			const bool in = s % 2 == 1;
+			outside[k] = in ? T(0) : T(d * d);
+			if (inside)
+			{
+				inside[k] = in ? T(d * d) : T(0);
+			}
+		}
+	}
+
+	// Squared distance transform along one axis of the grid data of dims[0] x ... x dims[N - 1] samples spaced by
+	// spacing, dims[0] fastest. Lines along axis 0 are contiguous and transformed in place. The lines along the
+	// other axes are strided, so tiles of lines which are consecutive in memory are gathered into a contiguous
+	// buffer, one line after the other, transformed there and scattered back: each pass then streams the grid
+	// instead of touching a cache line per sample. The tiles are split between the threads of parallelFor.
+	template<typename T, size_t N>
+	void squaredDistanceTransformAxis(T *data, const std::array<int, N> &dims, size_t axis, double spacing)
+	{
+		// data[(o * n + t) * inner + i] is sample t of line (o, i)
+		size_t inner = 1, outer = 1;
+		for (size_t a = 0; a < axis; ++a)
+		{
+			inner *= size_t(dims[a]);
+		}
+		for (size_t a = axis + 1; a < N; ++a)
+		{
+			outer *= size_t(dims[a]);
+		}
+		const int n = dims[axis];
+		if (n <= 1 || inner * outer == 0)
+		{
+			return;
+		}
+
+		if (inner == 1)
+		{
+			parallelFor(uint32_t(outer), [&](uint32_t begin, uint32_t end)
+			{
+				DistanceTransformScratch scratch;
+				for (uint32_t o = begin; o < end; ++o)
+				{
+					squaredDistance1D(data + size_t(o) * n, n, spacing, scratch);
+				}
+			}, 16);
+			return;
+		}
+
+		// Lines per tile, a cache line of floats
+		const size_t tile_lines = 16;
+		const size_t tiles_per_row = (inner + tile_lines - 1) / tile_lines;
+		parallelFor(uint32_t(outer * tiles_per_row), [&](uint32_t begin, uint32_t end)
+		{
+			DistanceTransformScratch scratch;
+			std::vector<T> tile(tile_lines * size_t(n));
+			for (uint32_t index = begin; index < end; ++index)
+			{
+				const size_t o = index / tiles_per_row;
+				const size_t i0 = (index % tiles_per_row) * tile_lines;
+				const size_t num_lines = std::min(tile_lines, inner - i0);
+				T *base = data + o * size_t(n) * inner + i0;
+				for (int t = 0; t < n; ++t)
+				{
+					const T *row = base + size_t(t) * inner;
+					for (size_t l = 0; l < num_lines; ++l)
+					{
+						tile[l * n + t] = row[l];
+					}
+				}
+				for (size_t l = 0; l < num_lines; ++l)
+				{
+					squaredDistance1D(tile.data() + l * n, n, spacing, scratch);
+				}
+				for (int t = 0; t < n; ++t)
+				{
+					T *row = base + size_t(t) * inner;
+					for (size_t l = 0; l < num_lines; ++l)
+					{
+						row[l] = tile[l * n + t];
+					}
+				}
+			}
+		});
+	}
+
+	// Squared distance transform along the axes first_axis, ..., N - 1, e.g. from 1 on after the distances along
+	// the dexels were written by squaredDistanceToSegments. With first_axis = 0 and 0 on the features and infinity
+	// elsewhere this is the exact squared Euclidean distance transform of the grid.
+	template<typename T, size_t N>
+	void squaredDistanceTransform(T *data, const std::array<int, N> &dims, double spacing, size_t first_axis = 0)
+	{
+		for (size_t axis = first_axis; axis < N; ++axis)
+		{
+			squaredDistanceTransformAxis(data, dims, axis, spacing);
+		}
+	}
+}
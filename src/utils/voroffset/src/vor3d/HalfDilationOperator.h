@@ -6,27 +6,65 @@
 
 namespace voroffset3d
 {
-	
+	// Rays of one sweep line of a plane, indexed by their position along the line. dilateLine writes the
+	// forward and backward half dilations of a line into two of these and merges them straight into the
+	// output of the pass, so neither direction is ever stored as a whole volume.
+	template<typename SegmentType>
+	class LineBuffer
+	{
+	private:
+		// Whether the line runs along x (deltaX != 0) or along y
+		bool m_AlongX = false;
+		std::vector<std::vector<SegmentType> > m_Rays;
+
+	public:
+		// Empty rays for a line of length dexels, keeping the storage of the previous line
+		void reset(bool along_x, int length);
+
+		std::vector<SegmentType> & ray(int x, int y) { return m_Rays[m_AlongX ? x : y]; }
+		RayView<SegmentType> at(int k) const { return m_Rays[k]; }
+
+		// Same as the Builder of the volumes
+		void appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius);
+	};
 
 	/**
 	* @brief      Forward sweep for dilation operation.
 	*
-	* @param[in]  vor					{ The algorithm for computing the dilation. }
-	* @param[in]  is_apply_power_alg	{ Whether we apply power algorithm, which means that we need to change the dilation radius. }
-	* @param[in]  input					{ Input data. }
-	* @param[in]  output				{ Output data. }
+	* @tparam     SetRadii				{ Whether we apply power algorithm, which means that we need to change the dilation radius. }
+	* @param[in]  vor					{ The algorithm for computing the dilation, see Morpho2D.h. }
+	* @param[in]  input					{ Input data, a CompressedVolume or CompressedVolumeWithRadii, read through segments(). }
+	* @param[in]  output				{ Builder or LineBuffer receiving the dilated rays of the plane. }
 	* @param[in]  (x0,y0,deltaX, deltaY)
 										{ Arguments for locate the plane as well as decide the sweepline direction.  }
 	**/
+	template<bool SetRadii, typename Morpho, typename Volume, typename Builder>
 	void halfDilate(
-		Morpho2D &vor,
-		bool is_apply_power_alg,
-		CompressedVolumeBase &input,
-		CompressedVolumeBase &output,
+		Morpho &vor,
+		const Volume &input,
+		Builder &output,
 		int x0, int y0, int deltaX, int deltaY);
 
+	/**
+	* @brief      Dilate a line in both sweep directions and write the union to the output.
+	*
+	* @param[in]  forward, backward		{ Scratch buffers receiving the two half dilations, reused from line to line. }
+	* @param[in]  output				{ Builder receiving the dilated rays of the line, in order along the line. }
+	* @param[in]  (x0,y0,deltaX, deltaY)
+										{ First dexel of the line and direction of the forward sweep, along one axis. }
+	* @param[in]  length				{ Number of dexels of the line. }
+	**/
+	template<bool SetRadii, typename Morpho, typename Volume, typename SegmentType, typename Builder>
+	void dilateLine(
+		Morpho &vor,
+		const Volume &input,
+		LineBuffer<SegmentType> &forward,
+		LineBuffer<SegmentType> &backward,
+		Builder &output,
+		int x0, int y0, int deltaX, int deltaY, int length);
+
 	template<typename CompressedVolumeType>
-	void unionMap(CompressedVolumeType voxel_1, CompressedVolumeType voxel_2, CompressedVolumeType &result);
+	void unionMap(const CompressedVolumeType &voxel_1, const CompressedVolumeType &voxel_2, CompressedVolumeType &result);
 }
 
 #include "vor3d/HalfDilationOperator.hpp"
\ No newline at end of file
@@ -1,16 +1,89 @@
 #include "vor3d/HalfDilationOperator.h"
+#include "vor3d/MorphologyOperators.h"
 
 namespace voroffset3d
 {
+	template<typename SegmentType>
+	void LineBuffer<SegmentType>::reset(bool along_x, int length)
+	{
+		m_AlongX = along_x;
+		m_Rays.resize(length);
+		for (std::vector<SegmentType> &ray : m_Rays)
+		{
+			ray.clear();
+		}
+	}
+
+	template<>
+	inline void LineBuffer<Scalar>::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar)
+	{
+		vor3d::appendSegment(ray(i, j), begin_pt, end_pt);
+	}
+
+	template<>
+	inline void LineBuffer<SegmentWithRadius>::appendSegment(int i, int j, Scalar begin_pt, Scalar end_pt, Scalar radius)
+	{
+		vor3d::appendSegment(ray(i, j), SegmentWithRadius(begin_pt, end_pt, radius));
+	}
+
+	template<bool SetRadii, typename Morpho, typename Volume, typename Builder>
+	void halfDilate(
+		Morpho &vor,
+		const Volume &input,
+		Builder &output,
+		int x0, int y0, int deltaX, int deltaY)
+	{
+		auto append = [&output](int posX, int posY, double z1, double z2, double r)
+		{
+			output.appendSegment(posX, posY, z1, z2, r);
+		};
+		for (int i = x0, j = y0, k = 0; i < input.gridSize()(0) && i >= 0 && j < input.gridSize()(1) && j >= 0; i += deltaX, j += deltaY, ++k)
+		{
+			vor.removeInactiveSegments(k);
+			vor.removeInactivePoints(k);
+			for (const SegmentWithRadius &s : input.segments(i, j))
+			{
+				vor.insertSegment(k, s.y1, s.y2, s.r);
+			}
+			vor.flushLine(i);
+			vor.template getLine<SetRadii>(x0, y0, deltaX, deltaY, k, append);
+		}
+	}
+
+	template<bool SetRadii, typename Morpho, typename Volume, typename SegmentType, typename Builder>
+	void dilateLine(
+		Morpho &vor,
+		const Volume &input,
+		LineBuffer<SegmentType> &forward,
+		LineBuffer<SegmentType> &backward,
+		Builder &output,
+		int x0, int y0, int deltaX, int deltaY, int length)
+	{
+		const bool along_x = deltaX != 0;
+		forward.reset(along_x, length);
+		backward.reset(along_x, length);
+		halfDilate<SetRadii>(vor, input, forward, x0, y0, deltaX, deltaY);
+		vor.resetData();
+		halfDilate<SetRadii>(vor, input, backward, x0 + (length - 1) * deltaX, y0 + (length - 1) * deltaY, -deltaX, -deltaY);
+		vor.resetData();
+		for (int k = 0; k < length; k++)
+		{
+			unionSegs(forward.at(k), backward.at(k), output.ray(x0 + k * deltaX, y0 + k * deltaY));
+		}
+	}
+
 	template<typename CompressedVolumeType>
-	void unionMap(CompressedVolumeType voxel_1, CompressedVolumeType voxel_2, CompressedVolumeType &result)
+	void unionMap(const CompressedVolumeType &voxel_1, const CompressedVolumeType &voxel_2, CompressedVolumeType &result)
 	{
 		int x_size = voxel_1.gridSize()(0);
 		int y_size = voxel_1.gridSize()(1);
-		for (int i = 0; i < x_size; i++)
-			for (int j = 0; j < y_size; j++)
+		// Rays in storage order, so the result is written sequentially
+		typename CompressedVolumeType::Builder builder(result);
+		for (int j = 0; j < y_size; j++)
+			for (int i = 0; i < x_size; i++)
 			{
-				unionSegs(voxel_1.at(i, j), voxel_2.at(i, j), result.at(i, j));
+				unionSegs(voxel_1.at(i, j), voxel_2.at(i, j), builder.ray(i, j));
 			}
+		result.assemble(builder);
 	}
 }
\ No newline at end of file
@@ -11,40 +11,28 @@
 
 namespace voroffset3d
 {
-	class Morpho2D
-	{
-	public:
-		// Constant parameters for the current dilation
-		int m_XMax;
-		double m_YMax, m_YMin;
-		double m_Radius;
-		double m_DexelSize;
-
-	public:
-		virtual ~Morpho2D() = default;
-
-		/////////////
-		// Methods //
-		/////////////
-	public:
-		// Insert a new seed segment
-		virtual void insertSegment(int i, double j1, double j2, double r) = 0;
-
-		// Remove seeds that are not contributing anymore to the current sweep line
-		virtual void removeInactiveSegments(int i) = 0;
-
-		// Remove seeds that are not contributing anymore to the current sweep line
-		virtual void removeInactivePoints(int i) {}
-
-		virtual void flushLine(int i) {}
-
-		// Extract the result for the current line
-		virtual void getLine(bool is_set_radii, int posX, int posY, int deltaX, int deltaY, int i,
-			std::function<void(int, int, double, double, double)> _appendSegment)=0;
-
-		// Reset data
-		virtual void resetData() = 0;
-	};
+	// The 2D operators swept along the lines of a plane by halfDilate (VoronoiMorpho2D, SeparatePowerMorpho2D)
+	// share no base class. halfDilate is a template on the operator, so the calls of its per line loop are
+	// resolved at compile time and inlined instead of going through a vtable. An operator provides:
+	//
+	//	// Insert a new seed segment
+	//	void insertSegment(int i, double j1, double j2, double r);
+	//
+	//	// Remove seeds that are not contributing anymore to the current sweep line
+	//	void removeInactiveSegments(int i);
+	//	void removeInactivePoints(int i);
+	//
+	//	// Finish the seeds of the current sweep line once all of its segments were inserted
+	//	void flushLine(int i);
+	//
+	//	// Extract the result for the current line, calling append(pos_x, pos_y, begin, end, radius) for each
+	//	// of its segments. SetRadii keeps the seeds and passes the radius they are dilated by at this line,
+	//	// instead of dilating them and passing a radius of 0.
+	//	template<bool SetRadii, typename Sink>
+	//	void getLine(int posX, int posY, int deltaX, int deltaY, int i, Sink &append);
+	//
+	//	// Reset data
+	//	void resetData();
 
 
 	////////////////////////////////////////////////////////////////////////////////
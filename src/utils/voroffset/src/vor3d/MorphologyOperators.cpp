@@ -1,4 +1,5 @@
 #include"vor3d/MorphologyOperators.h"
+#include <algorithm>
 using namespace voroffset3d;
 
 #ifndef MIN_SEG_SIZE
@@ -12,12 +13,12 @@ namespace voroffset3d
 
 	// Appends segment [a,b] to the given sorted line
 	// Assume that inserted segment is larger than all of the segments in the segments vector
-	void appendSegment(std::vector<double> &nl, double a, double b)
+	void appendSegment(std::vector<Scalar> &nl, double a, double b)
 	{
 		// Ensures nl[-2] < a
 		while (!nl.empty() && nl.rbegin()[1] >= a)
 		{
-			b = std::max(b, nl.back());
+			b = std::max(b, double(nl.back()));
 			nl.pop_back();
 			nl.pop_back();
 		}
@@ -36,7 +37,9 @@ namespace voroffset3d
 	// Appends segment [a,b] to the given sorted line
 	void appendSegment(std::vector<SegmentWithRadius> &n1, SegmentWithRadius seg)
 	{
-		std::vector<SegmentWithRadius> _segs_vec;
+		// Called for every segment of the sweeps, so the scratch of a thread is kept from call to call
+		static thread_local std::vector<SegmentWithRadius> _segs_vec;
+		_segs_vec.clear();
 		while (!n1.empty() && n1.back().y1 >= seg.y1)
 		{
 			if (n1.back().y1 > seg.y2)
@@ -95,7 +98,7 @@ namespace voroffset3d
 	}
 	
 	// get the next segment of the given position
-	void getNextSegment(const std::vector<double> & segs, std::vector<double>::const_iterator & it,
+	void getNextSegment(RayView<Scalar> segs, const Scalar * & it,
 		double & left, double & right, bool & full)
 	{
 		if (it == segs.end())
@@ -111,102 +114,85 @@ namespace voroffset3d
 
 	////////////////////////////////////////////////////////////////////////////////////
 
-	// Computes the union of two sorted and nonoverlapping lists of segments.
-	// output is also sorted and nonoverlapping segments
-	// Uses a parallel sweep of both lists, akin to merge-sort.
-	void unionSegs(const std::vector<double> & a, const std::vector<double> & b, std::vector<double> & result)
+	namespace
 	{
-		if (result.size())
-			result.clear();
-		if (a.empty())
+		// Appends [l, r] to the output ending at out, whose last segment starts at or before l. It always
+		// writes the two scalars at out and only keeps them when [l, r] doesn't touch the last segment, so the
+		// merge below compiles to conditional moves instead of unpredictable branches.
+		inline Scalar * appendSorted(Scalar *out, Scalar l, Scalar r)
 		{
-			result.insert(result.end(), b.begin(), b.end());
-			return;
+			const bool disjoint = out[-1] < l;
+			const Scalar last = out[-1];
+			out[0] = l;
+			out[1] = r;
+			out[-1] = disjoint ? last : std::max(last, r);
+			return out + (disjoint ? 2 : 0);
 		}
-		if (b.empty())
-		{
-			result.insert(result.end(), a.begin(), a.end());
-			return;
-		}
-		std::vector<double>::const_iterator ia(a.begin()), ib(b.begin());
-		double al, ar, bl, br;
-		al = *ia++; ar = *ia++;
-		bl = *ib++; br = *ib++;
-		bool bfull(true), afull(true);
-		while (bfull || afull)
+
+		// Appends the rest of a list once the other one is exhausted. Only the first segments can still
+		// touch the output, after the first one which doesn't the rest is copied as is.
+		inline Scalar * appendTail(Scalar *out, const Scalar *it, const Scalar *end)
 		{
-			if (bfull && bl <= al)
-			{
-				addSegmentAtTheEnd(result, bl, br);
-				getNextSegment(b, ib, bl, br, bfull);
-			}
-			else if (afull)
+			while (it != end && !(out[-1] < it[0]))
 			{
-				addSegmentAtTheEnd(result, al, ar);
-				if (ia == a.end())
-				{
-					afull = false;
-					al = std::numeric_limits<int>::max();
-				}
-				else
-				{
-					al = *ia++;
-					ar = *ia++;
-				}
+				out[-1] = std::max(out[-1], it[1]);
+				it += 2;
 			}
+			return std::copy(it, end, out);
 		}
 	}
-	
 
-	void unionPoints(const std::vector<PointWithRadius> & a, const std::vector<PointWithRadius> & b
-		, std::vector<PointWithRadius> & result)
+	// Computes the union of two sorted and nonoverlapping lists of segments.
+	// output is also sorted and nonoverlapping segments
+	// Uses a parallel sweep of both lists, akin to merge-sort. The output is sized for the worst case up
+	// front and written through a pointer, each step picks the list with the leftmost segment without a branch.
+	void unionSegs(RayView<Scalar> a, RayView<Scalar> b, std::vector<Scalar> & result)
 	{
-		if (result.size())
-			result.clear();
 		if (a.empty())
 		{
-			result.insert(result.end(), b.begin(), b.end());
+			result.assign(b.begin(), b.end());
 			return;
 		}
 		if (b.empty())
 		{
-			result.insert(result.end(), a.begin(), a.end());
+			result.assign(a.begin(), a.end());
 			return;
 		}
-		std::vector<PointWithRadius>::const_iterator ia(a.begin()), ib(b.begin());
-		PointWithRadius a_1, b_1;
-		a_1 = *ia++;
-		b_1 = *ib++;
-		bool bfull(true), afull(true);
-		while (bfull || afull)
+		result.resize(a.size() + b.size());
+		const Scalar *ia(a.begin()), *ib(b.begin());
+		const Scalar *const ea(a.end()), *const eb(b.end());
+		Scalar *out = result.data();
+		// The leftmost segment starts the output so that appendSorted always has a last segment to look at
+		const Scalar *first = *ib <= *ia ? ib : ia;
+		out[0] = first[0];
+		out[1] = first[1];
+		out += 2;
+		if (first == ib)
+			ib += 2;
+		else
+			ia += 2;
+		while (ia != ea && ib != eb)
 		{
-			if (bfull && b_1._pt <= a_1._pt)
-			{
-				result.push_back(b_1);
-				if (ib == b.end())
-				{
-					bfull = false;
-					b_1._pt = std::numeric_limits<int>::max();
-				}
-				else
-				{
-					b_1 = *ib++;
-				}
-			}
-			else if (afull)
-			{
-				result.push_back(a_1);
-				if (ia == a.end())
-				{
-					afull = false;
-					a_1._pt = std::numeric_limits<int>::max();
-				}
-				else
-				{
-					a_1 = *ia++;
-				}
-			}
+			// Ties take the segment of b first, like the sequential sweep did
+			const bool take_b = *ib <= *ia;
+			const Scalar *seg = take_b ? ib : ia;
+			ia += take_b ? 0 : 2;
+			ib += take_b ? 2 : 0;
+			out = appendSorted(out, seg[0], seg[1]);
 		}
+		out = appendTail(out, ia, ea);
+		out = appendTail(out, ib, eb);
+		result.resize(out - result.data());
+	}
+	
+
+	// Merges two lists of points sorted by position, the points of b go first on ties
+	void unionPoints(const std::vector<PointWithRadius> & a, const std::vector<PointWithRadius> & b
+		, std::vector<PointWithRadius> & result)
+	{
+		result.resize(a.size() + b.size());
+		std::merge(b.begin(), b.end(), a.begin(), a.end(), result.begin(),
+			[](const PointWithRadius &p, const PointWithRadius &q) { return p._pt < q._pt; });
 	}
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -227,13 +213,13 @@ namespace voroffset3d
 	//////////////////////////////////////////////////////////////////////////////////
 
 	// negate ray
-	void negate_ray(std::vector<double> &result, double y_min, double y_max)
+	void negate_ray(std::vector<Scalar> &result, double y_min, double y_max)
 	{
 		size_t size_ = result.size();
 
 		if (result.empty())
 		{
-			result = { y_min, y_max };
+			result = { Scalar(y_min), Scalar(y_max) };
 		}
 		else
 		{
@@ -258,7 +244,7 @@ namespace voroffset3d
 		}
 	}
 
-	void negate_ray(std::vector<SegmentWithRadius> input, std::vector<SegmentWithRadius> &result, double y_min, double y_max)
+	void negate_ray(RayView<SegmentWithRadius> input, std::vector<SegmentWithRadius> &result, double y_min, double y_max)
 	{
 		size_t size_ = input.size();
 		result.clear();
@@ -279,13 +265,13 @@ namespace voroffset3d
 		}
 	}
 
-	void negate_ray_range(std::vector<double> &result, double y_min, double y_max)
+	void negate_ray_range(std::vector<Scalar> &result, double y_min, double y_max)
 	{
 		size_t size_ = result.size();
 
 		if (result.empty())
 		{
-			result = { y_min, y_max };
+			result = { Scalar(y_min), Scalar(y_max) };
 		}
 		else
 		{
@@ -316,29 +302,29 @@ namespace voroffset3d
 	////////////////////////////////////////////////////////////////////////////////////////
 
 	// calculate the xor between two vectors of segments
-	void calculate_ray_xor(std::vector<SegmentWithRadius> ray_1, std::vector<SegmentWithRadius> ray_2
+	void calculate_ray_xor(RayView<SegmentWithRadius> ray_1, RayView<SegmentWithRadius> ray_2
 		, std::vector<SegmentWithRadius> &ray_xor, double y_min, double y_max)
 	{
 		ray_xor.clear();
-		std::vector<SegmentWithRadius> record_1, record_2, tmp_union_1, tmp_union_2, before_remove_pts;
+		// Scratch of the thread reused from ray to ray, every buffer is overwritten before it is read
+		static thread_local std::vector<SegmentWithRadius> record_1, record_2, tmp_union_1, tmp_union_2, before_remove_pts;
 		negate_ray(ray_1, record_1, y_min, y_max);
 		negate_ray(ray_2, record_2, y_min, y_max);
-		unionSegs(record_1, ray_2, tmp_union_1);
-		unionSegs(record_2, ray_1, tmp_union_2);
-		negate_ray(tmp_union_1, ray_1, y_min, y_max);
-		negate_ray(tmp_union_2, ray_2, y_min, y_max);
-		unionSegs(ray_1, ray_2, before_remove_pts);
+		unionSegs<SegmentWithRadius>(record_1, ray_2, tmp_union_1);
+		unionSegs<SegmentWithRadius>(record_2, ray_1, tmp_union_2);
+		// The complements are no longer needed, ray_1 - ray_2 and ray_2 - ray_1 go in their place
+		negate_ray(tmp_union_1, record_1, y_min, y_max);
+		negate_ray(tmp_union_2, record_2, y_min, y_max);
+		unionSegs<SegmentWithRadius>(record_1, record_2, before_remove_pts);
 		removepoint(before_remove_pts, ray_xor);
 	}
 
-	void calculate_ray_xor(std::vector<double> ray_1, std::vector<double> ray_2, std::vector<double> &ray_xor, double y_min, double y_max)
+	void calculate_ray_xor(RayView<Scalar> ray_1, RayView<Scalar> ray_2, std::vector<Scalar> &ray_xor, double y_min, double y_max)
 	{
 		ray_xor.clear();
-		std::vector<double> record_1, record_2, tmp_union_1, tmp_union_2, before_remove_pts;
-		record_1.resize(ray_1.size());
-		record_2.resize(ray_2.size());
-		std::copy_n(ray_1.begin(), ray_1.size(), record_1.begin());
-		std::copy_n(ray_2.begin(), ray_2.size(), record_2.begin());
+		static thread_local std::vector<Scalar> record_1, record_2, tmp_union_1, tmp_union_2, before_remove_pts;
+		record_1.assign(ray_1.begin(), ray_1.end());
+		record_2.assign(ray_2.begin(), ray_2.end());
 		negate_ray(record_1, y_min, y_max);
 		negate_ray(record_2, y_min, y_max);
 		unionSegs(record_1, ray_2, tmp_union_1);
@@ -351,7 +337,7 @@ namespace voroffset3d
 	/////////////////////////////////////////////////////////////////////////////
 
 	// remove the segment when its size is too small to be seen
-	void removepoint(const std::vector<SegmentWithRadius> segs, std::vector<SegmentWithRadius> &res)
+	void removepoint(const std::vector<SegmentWithRadius> &segs, std::vector<SegmentWithRadius> &res)
 	{
 		size_t size_ = segs.size();
 		for (int i = 0; i < size_; i++)
@@ -361,7 +347,7 @@ namespace voroffset3d
 			res.push_back(segs[i]);
 		}
 	}
-	void removepoint(const std::vector<double> segs, std::vector<double> &res)
+	void removepoint(const std::vector<Scalar> &segs, std::vector<Scalar> &res)
 	{
 		size_t size_ = segs.size();
 		for (int i = 0; i < size_; i += 2)
@@ -73,7 +73,7 @@ namespace voroffset3d
 	// Computes the union of two sorted and nonoverlapping lists of segments.
 	// output is also sorted and nonoverlapping segments
 	template<typename SegmentType>
-	void unionSegs(const std::vector<SegmentType> & a, const std::vector<SegmentType> & b
+	void unionSegs(RayView<SegmentType> a, RayView<SegmentType> b
 		, std::vector<SegmentType> & result)
 	{
 		if (result.size())
@@ -88,6 +88,8 @@ namespace voroffset3d
 			result.insert(result.end(), a.begin(), a.end());
 			return;
 		}
+		// Splitting a segment can add one more, the input sizes are only the usual case
+		result.reserve(a.size() + b.size());
 		auto ia = a.begin();
 		auto ib = b.begin();
 		SegmentType a_1, b_1;
@@ -0,0 +1,117 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+#ifdef USE_TBB
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace voroffset3d;
+
+namespace
+{
+	std::atomic<int> g_num_threads(0);
+	std::atomic<uint32_t> g_grain_size(10);
+
+	std::mutex g_task_runner_mutex;
+	TaskRunner g_task_runner;
+
+	TaskRunner taskRunner()
+	{
+		std::lock_guard<std::mutex> lock(g_task_runner_mutex);
+		return g_task_runner;
+	}
+}
+
+void voroffset3d::setParallelSettings(const ParallelSettings &settings)
+{
+	g_num_threads = std::max(settings.num_threads, 0);
+	g_grain_size = std::max(settings.grain_size, 1u);
+}
+
+void voroffset3d::setTaskRunner(TaskRunner runner)
+{
+	std::lock_guard<std::mutex> lock(g_task_runner_mutex);
+	g_task_runner = std::move(runner);
+}
+
+ParallelSettings voroffset3d::parallelSettings()
+{
+	ParallelSettings settings;
+	settings.num_threads = g_num_threads;
+	settings.grain_size = g_grain_size;
+	return settings;
+}
+
+int voroffset3d::parallelNumThreads()
+{
+#if defined(USE_TBB) || defined(VOR3D_USE_THREADS)
+	const int num_threads = g_num_threads;
+	if (num_threads > 0)
+		return num_threads;
+	const unsigned int hw = std::thread::hardware_concurrency();
+	return hw == 0 ? 1 : int(hw);
+#else
+	return 1;
+#endif
+}
+
+void voroffset3d::parallelFor(uint32_t n, const std::function<void(uint32_t, uint32_t)> &body, uint32_t grain_scale)
+{
+	if (n == 0)
+		return;
+	const uint32_t grain = std::max(g_grain_size.load() * std::max(grain_scale, 1u), 1u);
+	const int num_threads = parallelNumThreads();
+
+#ifdef USE_TBB
+	auto run = [&]()
+	{
+		tbb::parallel_for(tbb::blocked_range<uint32_t>(0u, n, grain), [&](const tbb::blocked_range<uint32_t> &range)
+		{
+			body(range.begin(), range.end());
+		});
+	};
+	tbb::task_arena arena(num_threads);
+	arena.execute(run);
+#elif defined(VOR3D_USE_THREADS)
+	// Workers pull grains off a shared counter, so columns with many dexels do not hold up a fixed split
+	const uint32_t num_grains = (n + grain - 1) / grain;
+	const uint32_t num_workers = std::min(uint32_t(num_threads), num_grains);
+	if (const TaskRunner runner = taskRunner())
+	{
+		runner(num_grains, int(num_workers), [&](uint32_t g)
+		{
+			const uint32_t begin = g * grain;
+			body(begin, std::min(n, begin + grain));
+		});
+		return;
+	}
+	std::atomic<uint32_t> next_grain(0);
+	auto worker = [&]()
+	{
+		for (uint32_t g = next_grain++; g < num_grains; g = next_grain++)
+		{
+			const uint32_t begin = g * grain;
+			body(begin, std::min(n, begin + grain));
+		}
+	};
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < num_workers; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread &t : threads)
+		t.join();
+#else
+	(void) num_threads;
+	for (uint32_t begin = 0; begin < n; begin += grain)
+		body(begin, std::min(n, begin + grain));
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+#include <functional>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Threading backend of the per-dexel sweeps. It is chosen at compile time: TBB when USE_TBB is
+	// defined, std::thread when VOR3D_USE_THREADS is defined, and a plain loop otherwise.
+	struct ParallelSettings
+	{
+		// Number of worker threads, 0 uses every hardware thread
+		int num_threads = 0;
+		// Number of consecutive items a worker takes at once. Sweeps over dexel columns vary a lot in
+		// cost, so small grains balance better.
+		uint32_t grain_size = 10;
+	};
+
+	// Settings used by the following calls to parallelFor, from any thread
+	void setParallelSettings(const ParallelSettings &settings);
+	ParallelSettings parallelSettings();
+
+	// Number of threads parallelFor runs on with the current settings and backend
+	int parallelNumThreads();
+
+	// Call body(begin, end) on sub ranges covering [0, n), in parallel if the backend allows it. Sub ranges
+	// hold grain_size * grain_scale items, except for the last one.
+	void parallelFor(uint32_t n, const std::function<void(uint32_t, uint32_t)> &body, uint32_t grain_scale = 1);
+
+	// Calls body(i) for every i in [0, num_tasks) on up to num_threads threads, the calling thread included,
+	// and returns once all calls have returned
+	using TaskRunner = std::function<void(uint32_t num_tasks, int num_threads,
+		const std::function<void(uint32_t)> &body)>;
+
+	// Run the sub ranges of the std::thread backend on the thread pool of the application instead of threads
+	// started by every call to parallelFor. An empty runner starts the threads again.
+	void setTaskRunner(TaskRunner runner);
+}
+
+namespace vor3d = voroffset3d;
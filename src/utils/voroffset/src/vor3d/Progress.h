@@ -0,0 +1,33 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <cstdint>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Progress of a long operation, and a request to stop it, shared with the thread waiting for it. It only
+	// holds atomics, so the sweeps update it once per line without a lock and the other thread reads it
+	// whenever it likes, once per frame for instance.
+	struct ProgressChannel
+	{
+		// Units of work done and to do, sweep lines for the dilations. Operations add the work of each of
+		// their steps to total as they start it, so the fraction done can step back between two steps.
+		std::atomic<uint64_t> done{ 0 };
+		std::atomic<uint64_t> total{ 0 };
+		// Set by the waiting thread. Operations return as soon as they see it, their result is then unspecified.
+		std::atomic<bool> cancelled{ false };
+
+		void reset()
+		{
+			done.store(0, std::memory_order_relaxed);
+			total.store(0, std::memory_order_relaxed);
+		}
+		void addTotal(uint64_t work) { total.fetch_add(work, std::memory_order_relaxed); }
+		void addDone(uint64_t work) { done.fetch_add(work, std::memory_order_relaxed); }
+		bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+	};
+}
+
+namespace vor3d = voroffset3d;
@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Quality.h"
+#include "vor3d/Parallel.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace voroffset3d;
+
+namespace
+{
+	// Largest distance from a point of [u, v] to the closest of lo and hi, lo <= u <= v <= hi, either of them
+	// infinite when there is no boundary on that side
+	double farthestPoint(double u, double v, double lo, double hi)
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		if (lo == -inf)
+		{
+			return hi - u;
+		}
+		if (hi == inf)
+		{
+			return v - lo;
+		}
+		const double m = std::min(std::max(0.5 * (lo + hi), u), v);
+		return std::min(m - lo, hi - m);
+	}
+
+	// Xor length and Hausdorff distance of the segments of two rays, with a parallel sweep of their boundaries.
+	// Along an interval of a - b, the closest points of b are its last boundary before the interval and its first
+	// boundary after it, and conversely.
+	void compareRays(RayView<Scalar> a, RayView<Scalar> b, double &xor_length, double &hausdorff)
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		xor_length = 0;
+		hausdorff = 0;
+		size_t ia = 0, ib = 0;
+		double prev = 0;
+		while (ia < a.size() || ib < b.size())
+		{
+			const bool from_a = ib == b.size() || (ia < a.size() && a[ia] <= b[ib]);
+			const double t = from_a ? a[ia] : b[ib];
+			// [prev, t] is inside a iff ia is odd, and inside b iff ib is odd. Both are even before the first
+			// boundary, so prev is set whenever they differ.
+			if (ia % 2 != ib % 2 && t > prev)
+			{
+				xor_length += t - prev;
+				const double d = ia % 2 == 1 ?
+					farthestPoint(prev, t, ib > 0 ? b[ib - 1] : -inf, ib < b.size() ? b[ib] : inf) :
+					farthestPoint(prev, t, ia > 0 ? a[ia - 1] : -inf, ia < a.size() ? a[ia] : inf);
+				hausdorff = std::max(hausdorff, d);
+			}
+			prev = t;
+			if (from_a)
+			{
+				++ia;
+			}
+			else
+			{
+				++ib;
+			}
+		}
+	}
+
+	struct RowDifference
+	{
+		double xor_length = 0;
+		double hausdorff = 0;
+		size_t num_unmatched = 0;
+		size_t num_differing = 0;
+	};
+}
+
+VolumeDifference voroffset3d::compareVolumes(const CompressedVolume &a, const CompressedVolume &b)
+{
+	assert(a.gridSize() == b.gridSize());
+	const int xsize = a.gridSize()(0);
+	const int ysize = a.gridSize()(1);
+	std::vector<RowDifference> rows(ysize);
+	parallelFor((uint32_t)ysize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			RowDifference &row = rows[y];
+			for (int x = 0; x < xsize; ++x)
+			{
+				const RayView<Scalar> ray_a = a.at(x, y), ray_b = b.at(x, y);
+				double xor_length, hausdorff;
+				compareRays(ray_a, ray_b, xor_length, hausdorff);
+				row.xor_length += xor_length;
+				if (xor_length > 0)
+				{
+					++row.num_differing;
+				}
+				if (ray_a.empty() != ray_b.empty())
+				{
+					++row.num_unmatched;
+				}
+				else
+				{
+					row.hausdorff = std::max(row.hausdorff, hausdorff);
+				}
+			}
+		}
+	});
+
+	VolumeDifference result;
+	double xor_length = 0;
+	for (const RowDifference &row : rows)
+	{
+		xor_length += row.xor_length;
+		result.rayHausdorff = std::max(result.rayHausdorff, row.hausdorff);
+		result.numUnmatchedDexels += row.num_unmatched;
+		result.numDifferingDexels += row.num_differing;
+	}
+	const double spacing = a.spacing();
+	result.xorVolume = xor_length * spacing * spacing * spacing;
+	result.rayHausdorff *= spacing;
+	return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/CompressedVolume.h"
+#include <cstddef>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace voroffset3d
+{
+	// Differences between two dexel volumes of the same grid, e.g. a dilation in single precision and the same
+	// dilation in double precision, or the results of two methods
+	struct VolumeDifference
+	{
+		// Volume of the symmetric difference, in the units of the volume (spacing^3 per dexel and z unit)
+		double xorVolume = 0;
+		// Hausdorff distance of the two volumes restricted to each dexel, the largest over the dexels along
+		// which both have segments, in the units of the volume. It bounds how far a boundary moved along z,
+		// which is what the precision of the dexels changes, without the cost of a 3D distance transform.
+		double rayHausdorff = 0;
+		// Dexels where only one of the volumes has segments, their distance along the dexel is infinite
+		size_t numUnmatchedDexels = 0;
+		// Dexels whose segments differ at all
+		size_t numDifferingDexels = 0;
+	};
+
+	// Compares the dexels of a and b in parallel, without building the xor volume like
+	// VoronoiMorpho::calculateXor. The sums are taken row by row in order, so they do not depend on the number
+	// of threads. a and b must have the same grid.
+	VolumeDifference compareVolumes(const CompressedVolume &a, const CompressedVolume &b);
+}
@@ -159,15 +159,17 @@ double SeparatePowerMorpho2D::rayIntersect(PointWithRadiusX p, PointWithRadiusX
 
 // -----------------------------------------------------------------------------
 
-// Assumes that it != m_S.end()
-void SeparatePowerMorpho2D::exploreLeft(P_const_iter it, PointWithRadiusX p, int i)
+// Assumes that it != m_P.end()
+size_t SeparatePowerMorpho2D::exploreLeft(P_iter it, PointWithRadiusX p, int i)
 {
+	size_t num_erased = 0;
 	while (it != m_P.begin())
 	{
 		double xinter = rayIntersect(*std::prev(it), *it, p);
 		if (xinter < i + EPS)
 		{
 			it = std::prev(m_P.erase(it));
+			num_erased++;
 		}
 		else
 		{
@@ -179,13 +181,14 @@ void SeparatePowerMorpho2D::exploreLeft(P_const_iter it, PointWithRadiusX p, int
 					m_Q_P[x_sup].push_back(*it);
 				}
 			}
-			return;
+			return num_erased;
 		}
 	}
+	return num_erased;
 }
 
-// Assumes that it != m_S.end()
-void SeparatePowerMorpho2D::exploreRight(P_const_iter it, PointWithRadiusX p, int i)
+// Assumes that it != m_P.end()
+void SeparatePowerMorpho2D::exploreRight(P_iter it, PointWithRadiusX p, int i)
 {
 	while (std::next(it) != m_P.end())
 	{
@@ -228,16 +231,17 @@ void SeparatePowerMorpho2D::insertSegment(int i, double j1, double j2, double r)
 void SeparatePowerMorpho2D::insertPoint(PointWithRadiusX p)
 {
 	//PointWithRadiusX p(i, j1, r);
-	P_const_iter it = m_P.lower_bound(p);
+	P_iter it = std::lower_bound(m_P.begin(), m_P.end(), p);
 	while (it != m_P.end() && p.contains(*it))
 	{
 		it = m_P.erase(it);
 	}
 	while (it != m_P.begin() && p.contains(*std::prev(it)))
 	{
-		m_P.erase(std::prev(it));
+		it = m_P.erase(std::prev(it));
 	}
-	P_const_iter jt = m_P.insert(it, p);
+	// Points erased by exploreRight() are all after jt, so it stays valid
+	P_iter jt = m_P.insert(it, p);
 	int xsup = (int)std::floor(p.x + p.r) + 1;
 	if (xsup < m_XMax) { m_Q_P[xsup].push_back(p); }
 	it = std::next(jt);
@@ -277,14 +281,17 @@ void SeparatePowerMorpho2D::removeInactivePoints(int i)
 	std::sort(m_Q_P[i].begin(), m_Q_P[i].end());
 	while (!m_Q_P[i].empty())
 	{
-		P_const_iter it = m_P.find(m_Q_P[i].back());
+		const PointWithRadiusX q = m_Q_P[i].back();
 		m_Q_P[i].pop_back();
-		if (it != m_P.end())
+		P_iter it = std::lower_bound(m_P.begin(), m_P.end(), q);
+		if (it != m_P.end() && !(q < *it))
 		{
 			it = m_P.erase(it);
 			if (it != m_P.begin() && it != m_P.end())
 			{
-				exploreLeft(std::prev(it), *it, i);
+				// exploreLeft() erases points before it, which shifts it down in the vector
+				const size_t pos = size_t(it - m_P.begin()) - exploreLeft(std::prev(it), *it, i);
+				it = m_P.begin() + pos;
 				exploreRight(it, *std::prev(it), i);
 			}
 		}
@@ -292,11 +299,8 @@ void SeparatePowerMorpho2D::removeInactivePoints(int i)
 	m_Q_P[i].clear();
 }
 
-void SeparatePowerMorpho2D::getLine(bool is_set_radii, int posX, int posY, int deltaX, int deltaY, int i,
-	std::function<void(int, int, double, double, double)> _appendSegment)
+const std::vector<Scalar> & SeparatePowerMorpho2D::lineSegments(int i)
 {
-	int pos_x = posX + i*deltaX;
-	int pos_y = posY + i*deltaY;
 	ray_P.clear();
 	ray_S.clear();
 	ray_U.clear();
@@ -334,20 +338,33 @@ void SeparatePowerMorpho2D::getLine(bool is_set_radii, int posX, int posY, int d
 		}
 	}
 	vor3d::unionSegs(ray_P, ray_S, ray_U);
-	for (int k = 0; k < ray_U.size(); k += 2)
-	{
-		_appendSegment(pos_x, pos_y, ray_U[k], ray_U[k + 1], 0.f);
-	}
+	return ray_U;
 }
 
 void SeparatePowerMorpho2D::resetData()
 {
+	// clear() keeps the capacity, so the sweeps reach a steady state without allocating per line
 	m_S.clear();
 	m_S_New.clear();
 	m_S_Tmp.clear();
 	m_P.clear();
+	m_P_Tmp.clear();
+	for (std::vector<PointWithRadiusX> &q : m_Q_P)
+	{
+		q.clear();
+	}
 	current_line = -1;
 }
+
+void SeparatePowerMorpho2D::reset(int _xmax, double _ymin, double _ymax, double _dexel_size)
+{
+	m_XMax = _xmax;
+	m_YMin = _ymin;
+	m_YMax = _ymax;
+	m_DexelSize = _dexel_size;
+	m_Q_P.resize(m_XMax);
+	resetData();
+}
 void SeparatePowerMorpho2D::unionSegs()
 {
 	if (m_S_New.size())
@@ -6,14 +6,13 @@
 #include <iostream>
 #include <vector>
 #include <array>
-#include <set>
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace voroffset3d
 {
 	// the coordinate of our sweep line are range from dexelcenter(0,0) to dexelcenter(gridsize(0),0) if scanning from direction y
 	// else it should be from dexelcenter(0,0) to dexelcenter(0, gridsize(1))
-	struct SeparatePowerMorpho2D : public Morpho2D
+	struct SeparatePowerMorpho2D
 	{
 		////////////////
 		//////////////////
@@ -30,7 +29,9 @@ namespace voroffset3d
 		std::vector<SegmentWithRadiusX> m_S;
 		std::vector<SegmentWithRadiusX> m_S_New;
 		std::vector<SegmentWithRadiusX> m_S_Tmp;
-		std::set<PointWithRadiusX> m_P;
+		// Seed points sorted by ascending y. A sweep line only holds a few of them, so a sorted vector
+		// inserts and erases faster than a std::set and, unlike it, keeps its storage from line to line.
+		std::vector<PointWithRadiusX> m_P;
 		std::vector<PointWithRadiusX> m_P_Tmp;
 
 		// Candidate Voronoi vertices sorted by ascending x
@@ -38,7 +39,7 @@ namespace voroffset3d
 
 		// Typedefs
 		typedef std::vector<SegmentWithRadiusX>::const_iterator S_const_iter;
-		typedef std::set<PointWithRadiusX>::const_iterator P_const_iter;
+		typedef std::vector<PointWithRadiusX>::iterator P_iter;
 
 		/////////////
 		// Methods //
@@ -47,21 +48,24 @@ namespace voroffset3d
 		// Assumes that y_p < y_q < y_r
 		double rayIntersect(PointWithRadiusX p, PointWithRadiusX q, PointWithRadiusX r) const;
 
-		// Assumes that it != m_S.end()
-		void exploreLeft(P_const_iter it, PointWithRadiusX p, int i);
+		// Assumes that it != m_P.end(). Returns the number of points erased, which were all before it.
+		size_t exploreLeft(P_iter it, PointWithRadiusX p, int i);
 
-		// Assumes that it != m_S.end()
-		void exploreRight(P_const_iter it, PointWithRadiusX p, int i);
+		// Assumes that it != m_P.end()
+		void exploreRight(P_iter it, PointWithRadiusX p, int i);
 
 		// Insert a new seed segment
-		virtual void insertSegment(int i, double j1, double j2, double r) override;
+		void insertSegment(int i, double j1, double j2, double r);
 		void insertPoint(PointWithRadiusX p);
 
 		// Remove seeds that are not contributing anymore to the current sweep line
-		virtual void removeInactiveSegments(int i) override;
+		void removeInactiveSegments(int i);
 		void removeInactivePoints(int i);
 
-		virtual void resetData() override;
+		void resetData();
+
+		// Set up the operator for a new plane size, keeping the storage of all its containers
+		void reset(int _xmax, double _ymin, double _ymax, double _dexel_size);
 
 		void flushLine(int i);
 
@@ -71,9 +75,19 @@ namespace voroffset3d
 			otherwise, return -1
 		*/
 
-		// Extract the result for the current line
-		void getLine(bool is_set_radii, int posX, int posY, int deltaX, int deltaY, int i,
-			std::function<void(int, int, double, double, double)> _appendSegment);
+		// Extract the result for the current line, see Morpho2D.h. The seeds have their own radii, so the
+		// segments are always dilated whatever SetRadii is.
+		template<bool SetRadii, typename Sink>
+		void getLine(int posX, int posY, int deltaX, int deltaY, int i, Sink &append)
+		{
+			const std::vector<Scalar> &segments = lineSegments(i);
+			const int pos_x = posX + i * deltaX;
+			const int pos_y = posY + i * deltaY;
+			for (size_t k = 0; k + 1 < segments.size(); k += 2)
+			{
+				append(pos_x, pos_y, segments[k], segments[k + 1], 0.0);
+			}
+		}
 
 		SeparatePowerMorpho2D(int _xmax, double _ymin, double _ymax, double _dexel_size)
 			: m_XMax(_xmax)
@@ -88,11 +102,13 @@ namespace voroffset3d
 		SeparatePowerMorpho2D() = default;
 
 	private:
-		std::vector<double> ray_S;
-		std::vector<double> ray_P;
-		std::vector<double> ray_U;
+		std::vector<Scalar> ray_S;
+		std::vector<Scalar> ray_P;
+		std::vector<Scalar> ray_U;
 
 	private:
+		// Union of the dilated seed segments and points at the current line i, in ray_U
+		const std::vector<Scalar> & lineSegments(int i);
 		void unionSegs();	// union segments in m_S and m_S_Tmp, at mean time, we upate m_S
 		void addSegment(SegmentWithRadiusX segment); // append the segment to the end
 
@@ -3,6 +3,7 @@
 #include "vor3d/CompressedVolumeBase.h"
 #include "vor3d/CompressedVolume.h"
 #include "vor3d/CompressedVolumeWithRadii.h"
+#include "vor3d/Progress.h"
 #include <iostream>
 #include <vector>
 #include <array>
@@ -15,7 +16,7 @@ namespace voroffset3d
 
 	public:
 		virtual ~VoronoiMorpho() = default;
-		virtual void dilation(CompressedVolume input, CompressedVolume &result, double radius, double &time_1, double &time_2) = 0;
+		virtual void dilation(const CompressedVolume &input, CompressedVolume &result, double radius, double &time_1, double &time_2) = 0;
 		/**
 		* @brief      dilate the input with given radius
 		*
@@ -26,8 +27,20 @@ namespace voroffset3d
 		* @param[in]  time_2		{ time cost by second pass}
 		* 
 		**/
-		virtual void erosion(CompressedVolume input, CompressedVolume &result, double radius, double &time_1, double &time_2);
-		double calculateXor(CompressedVolume voxel_1, CompressedVolume voxel_2, CompressedVolume &result);
+		// Erosion is the dilation of the complement. The first overload releases input as soon as its
+		// complement is built, to lower the peak memory use.
+		virtual void erosion(CompressedVolume &&input, CompressedVolume &result, double radius, double &time_1, double &time_2);
+		void erosion(const CompressedVolume &input, CompressedVolume &result, double radius, double &time_1, double &time_2);
+		// Closing (dilation then erosion) fills the gaps and cavities narrower than the radius, opening (erosion
+		// then dilation) removes the bridges and specks thinner than it. Both take input by value for the same
+		// reason as erosion, times are summed over the two steps.
+		void closing(CompressedVolume &&input, CompressedVolume &result, double radius, double &time_1, double &time_2);
+		void opening(CompressedVolume &&input, CompressedVolume &result, double radius, double &time_1, double &time_2);
+		double calculateXor(const CompressedVolume &voxel_1, const CompressedVolume &voxel_2, CompressedVolume &result);
+
+		// Report the progress of the following operations to progress and stop them when it is cancelled,
+		// nullptr stops reporting. progress must outlive the operations.
+		void setProgress(ProgressChannel *progress) { m_Progress = progress; }
 		/**
 		* @brief      calculate the xor between two voxels, with the assumption that these two voxels have the same gridesize
 		*
@@ -39,7 +52,9 @@ namespace voroffset3d
 		*/
 
 	protected:
-		void negate(CompressedVolume &result, double z_min, double z_max);
+		ProgressChannel *m_Progress = nullptr;
+
+		void negate(const CompressedVolume &input, CompressedVolume &result, double z_min, double z_max);
 		void negateInv(CompressedVolume &result, double z_min, double z_max);
 	};
 }
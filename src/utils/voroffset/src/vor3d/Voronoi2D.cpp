@@ -695,52 +695,10 @@ void VoronoiMorpho2D::removeInactiveSegments(int i)
 
 
 
-// Extract the result for the current line
-void VoronoiMorpho2D::getLine(bool is_set_radii, int posX, int posY, int deltaX, int deltaY, int i,
-	std::function<void(int, int, double, double, double)> _appendSegment)
-{
-	if (is_set_radii)
-	{
-		for (Segment s : m_S)
-		{
-			double a, b;
-			double r;
-			double delta_x = i - s.x < m_Radius ? i - s.x : m_Radius;
-			if (i == s.x)
-			{
-				r = m_Radius;
-			}
-			else
-			{
-				r = std::sqrt(m_Radius * m_Radius - delta_x*delta_x);
-			}
-			a = s.y1;
-			b = s.y2;
-			int pos_x = posX + i*deltaX;
-			int pos_y = posY + i*deltaY;
-			_appendSegment(pos_x, pos_y, a, b, r);
-		}
-	}
-	else
-	{
-		for (Segment s : m_S)
-		{
-			vor_assert((i - s.x) <= m_Radius + TOLENRANCE*m_DexelSize);
-			double delta_x = i - s.x < m_Radius ? i - s.x : m_Radius;
-			const double dy = (std::sqrt(m_Radius * m_Radius - delta_x * delta_x));
-			const double a = s.y1 - dy;
-			const double b = s.y2 + dy;
-			int pos_x = posX + i*deltaX;
-			int pos_y = posY + i*deltaY;
-			_appendSegment(pos_x, pos_y, a, b, 0.f);
-		}
-
-	}
-}
-
 void VoronoiMorpho2D::resetData()
 {
 	m_S.clear();
+	m_SeedArena.release();
 }
 
 
@@ -1,8 +1,10 @@
 #pragma once
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "vor3d/Arena.h"
 #include "vor3d/Common.h"
 #include "vor3d/Morpho2D.h"
+#include <cmath>
 #include <iostream>
 #include <vector>
 #include <array>
@@ -13,7 +15,7 @@ namespace voroffset3d
 {
 	// the coordinate of our sweep line are range from dexelcenter(0,0) to dexelcenter(gridsize(0),0) if scanning from direction y
 	// else it should be from dexelcenter(0,0) to dexelcenter(0, gridsize(1))
-	struct VoronoiMorpho2D : public Morpho2D
+	struct VoronoiMorpho2D
 	{
 		////////////////
 		// Data types //
@@ -33,14 +35,16 @@ namespace voroffset3d
 		double m_YMax, m_YMin;
 		double m_Radius;
 		double m_DexelSize;
+		// Nodes of m_S, released with the seeds at the end of every sweep
+		MonotonicArena m_SeedArena;
 		// Seeds above sorted by ascending y of their midpoint
-		std::set<Segment> m_S;
+		std::set<Segment, std::less<Segment>, ArenaAllocator<Segment> > m_S;
 
 		// Candidate Voronoi vertices sorted by ascending x
 		std::vector<std::vector<Segment> > m_Q;
 
 		// Typedefs
-		typedef std::set<Segment>::const_iterator S_const_iter;
+		typedef std::set<Segment, std::less<Segment>, ArenaAllocator<Segment> >::const_iterator S_const_iter;
 
 		/////////////
 		// Methods //
@@ -59,16 +63,20 @@ namespace voroffset3d
 		void exploreRight(S_const_iter it, Segment lp, int i);
 
 		// Insert a new seed segment [(i,j1), (i,j2)]
-		virtual void insertSegment(int i, double j1, double j2, double r) override;
+		void insertSegment(int i, double j1, double j2, double r);
 
 		// Remove seeds that are not contributing anymore to the current sweep line (y==i)
-		virtual void removeInactiveSegments(int i) override;
+		void removeInactiveSegments(int i);
 
-		virtual void resetData() override;
+		// The seeds are segments only, which are complete once inserted
+		void removeInactivePoints(int) {}
+		void flushLine(int) {}
 
-		// Extract the result for the current line
-		void getLine(bool is_set_radii, int posX, int posY, int deltaX, int deltaY, int i,
-			std::function<void(int, int, double, double, double)> _appendSegment);
+		void resetData();
+
+		// Extract the result for the current line, see Morpho2D.h
+		template<bool SetRadii, typename Sink>
+		void getLine(int posX, int posY, int deltaX, int deltaY, int i, Sink &append) const;
 
 
 		VoronoiMorpho2D(int _xmax, double _ymin, double _ymax, double _radius, double _dexel_size)
@@ -77,16 +85,39 @@ namespace voroffset3d
 			, m_YMin(_ymin)
 			, m_Radius(_radius)
 			, m_DexelSize(_dexel_size)
+			, m_S(ArenaAllocator<Segment>(m_SeedArena))
 			, m_Q(m_XMax)
 		{}
 
 		VoronoiMorpho2D()
+			: m_S(ArenaAllocator<Segment>(m_SeedArena))
 		{}
 
 		private:
 			std::vector<Segment> m_new_segs;
 	};
 
+	template<bool SetRadii, typename Sink>
+	void VoronoiMorpho2D::getLine(int posX, int posY, int deltaX, int deltaY, int i, Sink &append) const
+	{
+		const int pos_x = posX + i * deltaX;
+		const int pos_y = posY + i * deltaY;
+		for (const Segment &s : m_S)
+		{
+			const double delta_x = i - s.x < m_Radius ? i - s.x : m_Radius;
+			if (SetRadii)
+			{
+				const double r = i == s.x ? m_Radius : std::sqrt(m_Radius * m_Radius - delta_x * delta_x);
+				append(pos_x, pos_y, s.y1, s.y2, r);
+			}
+			else
+			{
+				vor_assert((i - s.x) <= m_Radius + 1e-6 * m_DexelSize);
+				const double dy = std::sqrt(m_Radius * m_Radius - delta_x * delta_x);
+				append(pos_x, pos_y, s.y1 - dy, s.y2 + dy, 0.0);
+			}
+		}
+	}
 
 	////////////////////////////////////////////////////////////////////////////////
 
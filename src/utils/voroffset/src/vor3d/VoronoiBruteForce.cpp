@@ -1,39 +1,24 @@
 #include "vor3d/VoronoiBruteForce.h"
 #include "vor3d/MorphologyOperators.h"
-#ifdef USE_TBB
-#include "tbb/blocked_range.h"
-#include "tbb/parallel_for.h"
-#include "tbb/task_scheduler_init.h"
-
-#ifndef GRAIN_SIZE
-#define GRAIN_SIZE 10
-#endif
-#endif
+#include "vor3d/Parallel.h"
 
 using namespace voroffset3d;
 
 
-void VoronoiMorphoBruteForce::dilation(CompressedVolume input, CompressedVolume &result, double radius, double &time_1, double &time_2)
+void VoronoiMorphoBruteForce::dilation(const CompressedVolume &input, CompressedVolume &result, double radius, double &time_1, double &time_2)
 {
 	int x_size = input.gridSize()(0);
 	int y_size = input.gridSize()(1);
 	result.reset(input.origin(), input.extent(), input.spacing(), input.padding(), x_size, y_size);
-#ifdef USE_TBB
-	auto operation = [&](const tbb::blocked_range<uint32_t> &range)
+	// Rows of dexels, each written by its own builder
+	std::vector<CompressedVolume::Builder> rows(y_size, CompressedVolume::Builder(result));
+	parallelFor((uint32_t)y_size, [&](uint32_t begin, uint32_t end)
 	{
 		std::vector<MyPoint> tmp_ray;
-		for (uint32_t phaseIdx = range.begin(); phaseIdx < range.end(); ++phaseIdx)
+		for (uint32_t i = begin * x_size; i < end * x_size; ++i)
 		{
-
-			int x = phaseIdx % x_size;
-			int y = phaseIdx / x_size;
-#else
-			std::vector<MyPoint> tmp_ray;
-            for(int i = 0;i < x_size * y_size;i++)
-            {
 			int x = i % x_size;
 			int y = i / x_size;
-#endif
 
             tmp_ray.clear();
             for (int range_y = (int) std::ceil(y - radius);
@@ -58,17 +43,14 @@ void VoronoiMorphoBruteForce::dilation(CompressedVolume input, CompressedVolume
                     }
                 }
             }
-			unionMap(tmp_ray, result.at(x, y));
+			unionMap(tmp_ray, rows[y].ray(x, y));
 		}
-#ifdef USE_TBB
-	};
-	tbb::blocked_range<uint32_t> range(0u, (uint32_t)x_size * y_size, GRAIN_SIZE*x_size);
-	tbb::parallel_for(range, operation);
-#endif
+	});
+	result.assemble(rows);
 }
 
 
-void VoronoiMorphoBruteForce::unionMap(std::vector<MyPoint> vec, std::vector<double> &result)
+void VoronoiMorphoBruteForce::unionMap(std::vector<MyPoint> &vec, std::vector<Scalar> &result)
 {
 	result.clear();
 	size_t inter_num = vec.size();
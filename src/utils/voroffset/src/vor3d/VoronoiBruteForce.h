@@ -8,8 +8,8 @@ namespace voroffset3d
     {
 		typedef std::pair<double, int> MyPoint;
 	public:
-		virtual void dilation(CompressedVolume input, CompressedVolume &result, double radius, double &time_1, double &time_2) override;
+		virtual void dilation(const CompressedVolume &input, CompressedVolume &result, double radius, double &time_1, double &time_2) override;
     private:
-    	void unionMap(std::vector<MyPoint> vec, std::vector<double> &result);
+    	void unionMap(std::vector<MyPoint> &vec, std::vector<Scalar> &result);
     };
 }
\ No newline at end of file
@@ -0,0 +1,398 @@
+// unwind-utils-bench: time the tet mesh utilities of utils/utils.h
+//
+// Every utility runs on synthetic tet meshes of a few sizes and on the .tet and .tetb files given on the command
+// line, e.g. the meshes saved with the projects of real scans. The best and mean time of each one is reported
+// along with a hash of its output, so a faster implementation can be checked to compute exactly the same thing
+// by comparing the hashes of two runs.
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <igl/components.h>
+
+#include "utils/content_hash.h"
+#include "utils/tet_file.h"
+#include "utils/utils.h"
+
+namespace {
+
+struct BenchmarkOptions {
+    // Cubes along each side of the synthetic meshes, every cube is split into 6 tets
+    std::vector<int> sizes = { 8, 16, 32 };
+    std::vector<std::string> input_filenames;
+    int num_repeats = 5;
+    // Points located by containing_tet and nearest_vertex per run
+    int num_queries = 100;
+    // Skip geodesic_distances, which takes far longer than the others on large meshes
+    bool skip_geodesics = false;
+    std::string output_filename = "utils-bench.json";
+    // Written into the results as is, e.g. the commit the benchmark was built from
+    std::string label;
+};
+
+void print_usage() {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  unwind-utils-bench [options] [mesh.tet|mesh.tetb ...]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --sizes N,N,...   cubes per side of the synthetic meshes, none if empty (default: 8,16,32)" << std::endl;
+    std::cerr << "  --repeats R       timed runs of every utility (default: 5)" << std::endl;
+    std::cerr << "  --queries Q       points located per run of containing_tet and nearest_vertex (default: 100)" << std::endl;
+    std::cerr << "  --no-geodesics    skip geodesic_distances" << std::endl;
+    std::cerr << "  --output FILE     JSON file the results are written to (default: utils-bench.json)" << std::endl;
+    std::cerr << "  --label L         label stored with the results, e.g. the commit" << std::endl;
+}
+
+bool parse_sizes(const std::string& list, std::vector<int>& sizes) {
+    sizes.clear();
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        const int size = std::atoi(item.c_str());
+        if (size < 1) {
+            return false;
+        }
+        sizes.push_back(size);
+    }
+    return true;
+}
+
+bool parse_arguments(int argc, char *argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            if (!parse_sizes(argv[++i], options.sizes)) {
+                std::cerr << "ERROR: --sizes needs a comma separated list of sizes >= 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--repeats" && has_value) {
+            options.num_repeats = std::atoi(argv[++i]);
+        } else if (arg == "--queries" && has_value) {
+            options.num_queries = std::atoi(argv[++i]);
+        } else if (arg == "--no-geodesics") {
+            options.skip_geodesics = true;
+        } else if (arg == "--output" && has_value) {
+            options.output_filename = argv[++i];
+        } else if (arg == "--label" && has_value) {
+            options.label = argv[++i];
+        } else if (!arg.empty() && arg[0] != '-') {
+            options.input_filenames.push_back(arg);
+        } else {
+            if (arg != "--help" && arg != "-h") {
+                std::cerr << "ERROR: Unknown or incomplete option '" << arg << "'" << std::endl;
+            }
+            return false;
+        }
+    }
+    if (options.num_repeats < 1 || options.num_queries < 1) {
+        std::cerr << "ERROR: Need --repeats >= 1 and --queries >= 1" << std::endl;
+        return false;
+    }
+    if (options.sizes.empty() && options.input_filenames.empty()) {
+        std::cerr << "ERROR: Nothing to benchmark, give --sizes or meshes" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct Mesh {
+    std::string name;
+    Eigen::MatrixXd TV;
+    Eigen::MatrixXi TT;
+};
+
+// Two blocks of n x n x n unit cubes side by side, so the mesh has two components. Every cube is split into
+// the 6 tets around its main diagonal, all with the same orientation.
+void make_synthetic_mesh(int n, Mesh& mesh) {
+    const int side = n + 1;
+    const int block_vertices = side * side * side;
+    mesh.name = "synthetic-" + std::to_string(n);
+    mesh.TV.resize(2 * block_vertices, 3);
+    mesh.TT.resize(2 * 6 * n * n * n, 4);
+    // The diagonal goes through 3 edges of the cube, one along each axis, in the order of a permutation
+    static const int permutations[6][3] = { {0, 1, 2}, {1, 2, 0}, {2, 0, 1}, {0, 2, 1}, {2, 1, 0}, {1, 0, 2} };
+    int t = 0;
+    for (int block = 0; block < 2; block++) {
+        const int first = block * block_vertices;
+        auto index = [&](int x, int y, int z) { return first + x + side * (y + side * z); };
+        for (int z = 0; z < side; z++) {
+            for (int y = 0; y < side; y++) {
+                for (int x = 0; x < side; x++) {
+                    // One cube of space between the blocks
+                    mesh.TV.row(index(x, y, z)) << double(x + block * (n + 1)), double(y), double(z);
+                }
+            }
+        }
+        for (int z = 0; z < n; z++) {
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < n; x++) {
+                    for (int p = 0; p < 6; p++) {
+                        int corner[3] = { x, y, z };
+                        int tet[4];
+                        tet[0] = index(x, y, z);
+                        for (int k = 0; k < 3; k++) {
+                            corner[permutations[p][k]] += 1;
+                            tet[k + 1] = index(corner[0], corner[1], corner[2]);
+                        }
+                        // Odd permutations are mirror images of the even ones
+                        if (p >= 3) {
+                            std::swap(tet[1], tet[2]);
+                        }
+                        mesh.TT.row(t++) << tet[0], tet[1], tet[2], tet[3];
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Derived>
+std::uint64_t hash_matrix(const Eigen::PlainObjectBase<Derived>& m) {
+    return hash_bytes(reinterpret_cast<const std::uint8_t*>(m.data()),
+                      std::size_t(m.size()) * sizeof(typename Derived::Scalar));
+}
+
+struct Timing {
+    std::string name;
+    double best_ms = 0.0;
+    double mean_ms = 0.0;
+    // Time of every run, the samples unwind-bench-compare tests
+    std::vector<double> samples_ms;
+    std::uint64_t hash = 0;
+};
+
+// Time run() num_repeats times, hash() then hashes the output of the last run
+template <typename Run, typename Hash>
+Timing time_utility(const std::string& name, int num_repeats, Run run, Hash hash) {
+    Timing timing;
+    timing.name = name;
+    timing.best_ms = std::numeric_limits<double>::max();
+    double total_ms = 0.0;
+    for (int i = 0; i < num_repeats; i++) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        timing.best_ms = std::min(timing.best_ms, ms);
+        timing.samples_ms.push_back(ms);
+        total_ms += ms;
+    }
+    timing.mean_ms = total_ms / num_repeats;
+    timing.hash = hash();
+    return timing;
+}
+
+struct MeshResult {
+    std::string name;
+    Eigen::Index num_vertices = 0;
+    Eigen::Index num_tets = 0;
+    int num_components = 0;
+    std::vector<Timing> timings;
+};
+
+void benchmark_mesh(const BenchmarkOptions& options, const Mesh& mesh, MeshResult& result,
+                    std::shared_ptr<spdlog::logger> logger) {
+    const Eigen::MatrixXd& TV = mesh.TV;
+    const Eigen::MatrixXi& TT = mesh.TT;
+    const int repeats = options.num_repeats;
+    result.name = mesh.name;
+    result.num_vertices = TV.rows();
+    result.num_tets = TT.rows();
+
+    Eigen::VectorXi components;
+    mesh_components(TT, int(TV.rows()), components);
+    result.num_components = components.size() > 0 ? components.maxCoeff() + 1 : 0;
+    logger->info("{}: {} vertices, {} tets, {} components", mesh.name, TV.rows(), TT.rows(), result.num_components);
+
+    // Both give the same labels when every vertex is in a tet, so the hashes can be compared
+    Eigen::VectorXi timed_components;
+    result.timings.push_back(time_utility("igl::components", repeats,
+        [&]() { igl::components(TT, timed_components); },
+        [&]() { return hash_matrix(timed_components); }));
+    result.timings.push_back(time_utility("mesh_components", repeats,
+        [&]() { mesh_components(TT, int(TV.rows()), timed_components); },
+        [&]() { return hash_matrix(timed_components); }));
+
+    Eigen::MatrixXi TF;
+    result.timings.push_back(time_utility("tet_mesh_faces", repeats,
+        [&]() { tet_mesh_faces(TT, TF); },
+        [&]() { return hash_matrix(TF); }));
+
+    TetMeshComponents split;
+    result.timings.push_back(time_utility("split_mesh_components", repeats,
+        [&]() { split_mesh_components(TT, components, split); },
+        [&]() {
+            std::uint64_t h = hash_bytes(reinterpret_cast<const std::uint8_t*>(split.tets.data()), split.tets.size() * sizeof(int));
+            return h ^ hash_bytes(reinterpret_cast<const std::uint8_t*>(split.vertices.data()), split.vertices.size() * sizeof(int));
+        }));
+
+    std::vector<Eigen::MatrixXi> split_tets;
+    result.timings.push_back(time_utility("split_mesh_components (matrices)", repeats,
+        [&]() { split_mesh_components(TT, components, split_tets); },
+        [&]() {
+            std::uint64_t h = 0;
+            for (const Eigen::MatrixXi& tets : split_tets) {
+                h = h * 31 + hash_matrix(tets);
+            }
+            return h;
+        }));
+
+    // The largest component, the one the skeleton is extracted from in the viewer
+    int largest = 0;
+    if (split.num_components() > 0) {
+        for (int c = 1; c < split.num_components(); c++) {
+            largest = split.num_tets(c) > split.num_tets(largest) ? c : largest;
+        }
+    }
+    Eigen::VectorXi CMap;
+    Mesh component;
+    result.timings.push_back(time_utility("remesh_connected_components", repeats,
+        [&]() { remesh_connected_components(largest, components, TV, TT, CMap, component.TV, component.TT); },
+        [&]() { return hash_matrix(component.TV) ^ hash_matrix(component.TT) * 31 ^ hash_matrix(CMap) * 961; }));
+
+    // Random points in the bounding box, the same ones in every run
+    const Eigen::RowVector3d bb_min = TV.colwise().minCoeff(), bb_max = TV.colwise().maxCoeff();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<Eigen::RowVector3d> queries(options.num_queries);
+    for (Eigen::RowVector3d& q : queries) {
+        for (int k = 0; k < 3; k++) {
+            q[k] = bb_min[k] + unit(rng) * (bb_max[k] - bb_min[k]);
+        }
+    }
+    Eigen::VectorXi found(options.num_queries);
+    result.timings.push_back(time_utility("containing_tet", repeats,
+        [&]() {
+            for (int i = 0; i < options.num_queries; i++) {
+                found[i] = containing_tet(TV, TT, queries[i]);
+            }
+        },
+        [&]() { return hash_matrix(found); }));
+    result.timings.push_back(time_utility("nearest_vertex", repeats,
+        [&]() {
+            for (int i = 0; i < options.num_queries; i++) {
+                found[i] = nearest_vertex(TV, queries[i]);
+            }
+        },
+        [&]() { return hash_matrix(found); }));
+
+    Eigen::MatrixXd V1, V2;
+    result.timings.push_back(time_utility("edge_endpoints", repeats,
+        [&]() { edge_endpoints(TV, TT, V1, V2); },
+        [&]() { return hash_matrix(V1) ^ hash_matrix(V2) * 31; }));
+
+    if (!options.skip_geodesics && component.TV.rows() > 1) {
+        // Between the vertices of the component at both ends of its bounding box along x
+        Eigen::Index head = 0, tail = 0;
+        component.TV.col(0).minCoeff(&head);
+        component.TV.col(0).maxCoeff(&tail);
+        const std::vector<std::pair<int, int>> endpoints = { { int(head), int(tail) } };
+        Eigen::VectorXd isovals;
+        result.timings.push_back(time_utility("geodesic_distances", repeats,
+            [&]() { geodesic_distances(component.TV, component.TT, endpoints, isovals); },
+            [&]() { return hash_matrix(isovals); }));
+    }
+
+    for (const Timing& timing : result.timings) {
+        logger->info("  {}: {:.3f} ms (best), {:.3f} ms (mean), output {:016x}", timing.name, timing.best_ms,
+                     timing.mean_ms, timing.hash);
+    }
+}
+
+void write_json_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool write_results(const BenchmarkOptions& options, const std::vector<MeshResult>& results,
+                   std::shared_ptr<spdlog::logger> logger) {
+    std::ofstream out(options.output_filename);
+    out << "{\n  \"label\": ";
+    write_json_string(out, options.label);
+    out << ",\n  \"options\": {\"repeats\": " << options.num_repeats << ", \"queries\": " << options.num_queries << "},\n";
+    out << "  \"meshes\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const MeshResult& result = results[i];
+        out << "    {\"name\": ";
+        write_json_string(out, result.name);
+        out << ", \"vertices\": " << result.num_vertices << ", \"tets\": " << result.num_tets
+            << ", \"components\": " << result.num_components << ", \"utilities\": [\n";
+        for (std::size_t j = 0; j < result.timings.size(); j++) {
+            const Timing& timing = result.timings[j];
+            char hash[17];
+            std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(timing.hash));
+            out << "      {\"name\": ";
+            write_json_string(out, timing.name);
+            out << ", \"best_ms\": " << timing.best_ms << ", \"mean_ms\": " << timing.mean_ms << ", \"samples_ms\": [";
+            for (std::size_t k = 0; k < timing.samples_ms.size(); k++) {
+                out << (k == 0 ? "" : ", ") << timing.samples_ms[k];
+            }
+            out << "], \"output_hash\": \"" << hash << "\"}" << (j + 1 < result.timings.size() ? ",\n" : "\n");
+        }
+        out << "    ]}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    if (!out) {
+        logger->error("Cannot write the results to '{}'", options.output_filename);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    if (!parse_arguments(argc, argv, options)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    std::shared_ptr<spdlog::logger> logger = spdlog::stdout_color_mt("unwind-utils-bench");
+
+    std::vector<MeshResult> results;
+    for (int size : options.sizes) {
+        Mesh mesh;
+        make_synthetic_mesh(size, mesh);
+        results.emplace_back();
+        benchmark_mesh(options, mesh, results.back(), logger);
+    }
+    for (const std::string& filename : options.input_filenames) {
+        Mesh mesh;
+        Eigen::MatrixXi TF;
+        if (!load_tet_file(filename, mesh.TV, TF, mesh.TT, logger)) {
+            logger->error("Cannot load the tet mesh '{}'", filename);
+            return EXIT_FAILURE;
+        }
+        mesh.name = filename.substr(filename.find_last_of("/\\") + 1);
+        results.emplace_back();
+        benchmark_mesh(options, mesh, results.back(), logger);
+    }
+
+    if (!write_results(options, results, logger)) {
+        return EXIT_FAILURE;
+    }
+    logger->info("Wrote the results to '{}'", options.output_filename);
+    return EXIT_SUCCESS;
+}